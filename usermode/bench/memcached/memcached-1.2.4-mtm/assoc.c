@@ -0,0 +1,889 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Hash table
+ *
+ * The hash function used here is by Bob Jenkins, 1996:
+ *    <http://burtleburtle.net/bob/hash/doobs.html>
+ *       "By Bob Jenkins, 1996.  bob_jenkins@burtleburtle.net.
+ *       You may use this code any way you wish, private, educational,
+ *       or commercial.  It's free."
+ *
+ * The rest of the file is licensed under the BSD license.  See LICENSE.
+ *
+ * $Id: assoc.c 595 2007-07-10 06:30:07Z plindner $
+ */
+
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/signal.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <memcached.h>
+
+/*
+ * Since the hash function does bit manipulation, it needs to know
+ * whether it's big or little-endian. ENDIAN_LITTLE and ENDIAN_BIG
+ * are set in the configure script.
+ */
+#if ENDIAN_BIG == 1
+# define HASH_LITTLE_ENDIAN 0
+# define HASH_BIG_ENDIAN 1
+#else
+# if ENDIAN_LITTLE == 1
+#  define HASH_LITTLE_ENDIAN 1
+#  define HASH_BIG_ENDIAN 0
+# else
+#  define HASH_LITTLE_ENDIAN 0
+#  define HASH_BIG_ENDIAN 0
+# endif
+#endif
+
+#define rot(x,k) (((x)<<(k)) ^ ((x)>>(32-(k))))
+
+/*
+-------------------------------------------------------------------------------
+mix -- mix 3 32-bit values reversibly.
+
+This is reversible, so any information in (a,b,c) before mix() is
+still in (a,b,c) after mix().
+
+If four pairs of (a,b,c) inputs are run through mix(), or through
+mix() in reverse, there are at least 32 bits of the output that
+are sometimes the same for one pair and different for another pair.
+This was tested for:
+* pairs that differed by one bit, by two bits, in any combination
+  of top bits of (a,b,c), or in any combination of bottom bits of
+  (a,b,c).
+* "differ" is defined as +, -, ^, or ~^.  For + and -, I transformed
+  the output delta to a Gray code (a^(a>>1)) so a string of 1's (as
+  is commonly produced by subtraction) look like a single 1-bit
+  difference.
+* the base values were pseudorandom, all zero but one bit set, or
+  all zero plus a counter that starts at zero.
+
+Some k values for my "a-=c; a^=rot(c,k); c+=b;" arrangement that
+satisfy this are
+    4  6  8 16 19  4
+    9 15  3 18 27 15
+   14  9  3  7 17  3
+Well, "9 15 3 18 27 15" didn't quite get 32 bits diffing
+for "differ" defined as + with a one-bit base and a two-bit delta.  I
+used http://burtleburtle.net/bob/hash/avalanche.html to choose
+the operations, constants, and arrangements of the variables.
+
+This does not achieve avalanche.  There are input bits of (a,b,c)
+that fail to affect some output bits of (a,b,c), especially of a.  The
+most thoroughly mixed value is c, but it doesn't really even achieve
+avalanche in c.
+
+This allows some parallelism.  Read-after-writes are good at doubling
+the number of bits affected, so the goal of mixing pulls in the opposite
+direction as the goal of parallelism.  I did what I could.  Rotates
+seem to cost as much as shifts on every machine I could lay my hands
+on, and rotates are much kinder to the top and bottom bits, so I used
+rotates.
+-------------------------------------------------------------------------------
+*/
+#define mix(a,b,c) \
+{ \
+  a -= c;  a ^= rot(c, 4);  c += b; \
+  b -= a;  b ^= rot(a, 6);  a += c; \
+  c -= b;  c ^= rot(b, 8);  b += a; \
+  a -= c;  a ^= rot(c,16);  c += b; \
+  b -= a;  b ^= rot(a,19);  a += c; \
+  c -= b;  c ^= rot(b, 4);  b += a; \
+}
+
+/*
+-------------------------------------------------------------------------------
+final -- final mixing of 3 32-bit values (a,b,c) into c
+
+Pairs of (a,b,c) values differing in only a few bits will usually
+produce values of c that look totally different.  This was tested for
+* pairs that differed by one bit, by two bits, in any combination
+  of top bits of (a,b,c), or in any combination of bottom bits of
+  (a,b,c).
+* "differ" is defined as +, -, ^, or ~^.  For + and -, I transformed
+  the output delta to a Gray code (a^(a>>1)) so a string of 1's (as
+  is commonly produced by subtraction) look like a single 1-bit
+  difference.
+* the base values were pseudorandom, all zero but one bit set, or
+  all zero plus a counter that starts at zero.
+
+These constants passed:
+ 14 11 25 16 4 14 24
+ 12 14 25 16 4 14 24
+and these came close:
+  4  8 15 26 3 22 24
+ 10  8 15 26 3 22 24
+ 11  8 15 26 3 22 24
+-------------------------------------------------------------------------------
+*/
+#define final(a,b,c) \
+{ \
+  c ^= b; c -= rot(b,14); \
+  a ^= c; a -= rot(c,11); \
+  b ^= a; b -= rot(a,25); \
+  c ^= b; c -= rot(b,16); \
+  a ^= c; a -= rot(c,4);  \
+  b ^= a; b -= rot(a,14); \
+  c ^= b; c -= rot(b,24); \
+}
+
+#if HASH_LITTLE_ENDIAN == 1
+TM_ATTR
+uint32_t hash(
+  const void *key,       /* the key to hash */
+  size_t      length,    /* length of the key */
+  const uint32_t    initval)   /* initval */
+{
+  uint32_t a,b,c;                                          /* internal state */
+  union { const void *ptr; size_t i; } u;     /* needed for Mac Powerbook G4 */
+
+  /* Set up the internal state */
+  a = b = c = 0xdeadbeef + ((uint32_t)length) + initval;
+
+  u.ptr = key;
+  if (HASH_LITTLE_ENDIAN && ((u.i & 0x3) == 0)) {
+    const uint32_t *k = key;                           /* read 32-bit chunks */
+#ifdef VALGRIND
+    const uint8_t  *k8;
+#endif /* ifdef VALGRIND */
+
+    /*------ all but last block: aligned reads and affect 32 bits of (a,b,c) */
+    while (length > 12)
+    {
+      a += k[0];
+      b += k[1];
+      c += k[2];
+      mix(a,b,c);
+      length -= 12;
+      k += 3;
+    }
+
+    /*----------------------------- handle the last (probably partial) block */
+    /*
+     * "k[2]&0xffffff" actually reads beyond the end of the string, but
+     * then masks off the part it's not allowed to read.  Because the
+     * string is aligned, the masked-off tail is in the same word as the
+     * rest of the string.  Every machine with memory protection I've seen
+     * does it on word boundaries, so is OK with this.  But VALGRIND will
+     * still catch it and complain.  The masking trick does make the hash
+     * noticably faster for short strings (like English words).
+     */
+#ifndef VALGRIND
+
+    switch(length)
+    {
+    case 12: c+=k[2]; b+=k[1]; a+=k[0]; break;
+    case 11: c+=k[2]&0xffffff; b+=k[1]; a+=k[0]; break;
+    case 10: c+=k[2]&0xffff; b+=k[1]; a+=k[0]; break;
+    case 9 : c+=k[2]&0xff; b+=k[1]; a+=k[0]; break;
+    case 8 : b+=k[1]; a+=k[0]; break;
+    case 7 : b+=k[1]&0xffffff; a+=k[0]; break;
+    case 6 : b+=k[1]&0xffff; a+=k[0]; break;
+    case 5 : b+=k[1]&0xff; a+=k[0]; break;
+    case 4 : a+=k[0]; break;
+    case 3 : a+=k[0]&0xffffff; break;
+    case 2 : a+=k[0]&0xffff; break;
+    case 1 : a+=k[0]&0xff; break;
+    case 0 : return c;  /* zero length strings require no mixing */
+    }
+
+#else /* make valgrind happy */
+
+    k8 = (const uint8_t *)k;
+    switch(length)
+    {
+    case 12: c+=k[2]; b+=k[1]; a+=k[0]; break;
+    case 11: c+=((uint32_t)k8[10])<<16;  /* fall through */
+    case 10: c+=((uint32_t)k8[9])<<8;    /* fall through */
+    case 9 : c+=k8[8];                   /* fall through */
+    case 8 : b+=k[1]; a+=k[0]; break;
+    case 7 : b+=((uint32_t)k8[6])<<16;   /* fall through */
+    case 6 : b+=((uint32_t)k8[5])<<8;    /* fall through */
+    case 5 : b+=k8[4];                   /* fall through */
+    case 4 : a+=k[0]; break;
+    case 3 : a+=((uint32_t)k8[2])<<16;   /* fall through */
+    case 2 : a+=((uint32_t)k8[1])<<8;    /* fall through */
+    case 1 : a+=k8[0]; break;
+    case 0 : return c;  /* zero length strings require no mixing */
+    }
+
+#endif /* !valgrind */
+
+  } else if (HASH_LITTLE_ENDIAN && ((u.i & 0x1) == 0)) {
+    const uint16_t *k = key;                           /* read 16-bit chunks */
+    const uint8_t  *k8;
+
+    /*--------------- all but last block: aligned reads and different mixing */
+    while (length > 12)
+    {
+      a += k[0] + (((uint32_t)k[1])<<16);
+      b += k[2] + (((uint32_t)k[3])<<16);
+      c += k[4] + (((uint32_t)k[5])<<16);
+      mix(a,b,c);
+      length -= 12;
+      k += 6;
+    }
+
+    /*----------------------------- handle the last (probably partial) block */
+    k8 = (const uint8_t *)k;
+    switch(length)
+    {
+    case 12: c+=k[4]+(((uint32_t)k[5])<<16);
+             b+=k[2]+(((uint32_t)k[3])<<16);
+             a+=k[0]+(((uint32_t)k[1])<<16);
+             break;
+    case 11: c+=((uint32_t)k8[10])<<16;     /* @fallthrough */
+    case 10: c+=k[4];                       /* @fallthrough@ */
+             b+=k[2]+(((uint32_t)k[3])<<16);
+             a+=k[0]+(((uint32_t)k[1])<<16);
+             break;
+    case 9 : c+=k8[8];                      /* @fallthrough */
+    case 8 : b+=k[2]+(((uint32_t)k[3])<<16);
+             a+=k[0]+(((uint32_t)k[1])<<16);
+             break;
+    case 7 : b+=((uint32_t)k8[6])<<16;      /* @fallthrough */
+    case 6 : b+=k[2];
+             a+=k[0]+(((uint32_t)k[1])<<16);
+             break;
+    case 5 : b+=k8[4];                      /* @fallthrough */
+    case 4 : a+=k[0]+(((uint32_t)k[1])<<16);
+             break;
+    case 3 : a+=((uint32_t)k8[2])<<16;      /* @fallthrough */
+    case 2 : a+=k[0];
+             break;
+    case 1 : a+=k8[0];
+             break;
+    case 0 : return c;  /* zero length strings require no mixing */
+    }
+
+  } else {                        /* need to read the key one byte at a time */
+    const uint8_t *k = key;
+
+    /*--------------- all but the last block: affect some 32 bits of (a,b,c) */
+    while (length > 12)
+    {
+      a += k[0];
+      a += ((uint32_t)k[1])<<8;
+      a += ((uint32_t)k[2])<<16;
+      a += ((uint32_t)k[3])<<24;
+      b += k[4];
+      b += ((uint32_t)k[5])<<8;
+      b += ((uint32_t)k[6])<<16;
+      b += ((uint32_t)k[7])<<24;
+      c += k[8];
+      c += ((uint32_t)k[9])<<8;
+      c += ((uint32_t)k[10])<<16;
+      c += ((uint32_t)k[11])<<24;
+      mix(a,b,c);
+      length -= 12;
+      k += 12;
+    }
+
+    /*-------------------------------- last block: affect all 32 bits of (c) */
+    switch(length)                   /* all the case statements fall through */
+    {
+    case 12: c+=((uint32_t)k[11])<<24;
+    case 11: c+=((uint32_t)k[10])<<16;
+    case 10: c+=((uint32_t)k[9])<<8;
+    case 9 : c+=k[8];
+    case 8 : b+=((uint32_t)k[7])<<24;
+    case 7 : b+=((uint32_t)k[6])<<16;
+    case 6 : b+=((uint32_t)k[5])<<8;
+    case 5 : b+=k[4];
+    case 4 : a+=((uint32_t)k[3])<<24;
+    case 3 : a+=((uint32_t)k[2])<<16;
+    case 2 : a+=((uint32_t)k[1])<<8;
+    case 1 : a+=k[0];
+             break;
+    case 0 : return c;  /* zero length strings require no mixing */
+    }
+  }
+
+  final(a,b,c);
+  return c;             /* zero length strings require no mixing */
+}
+
+#elif HASH_BIG_ENDIAN == 1
+/*
+ * hashbig():
+ * This is the same as hashword() on big-endian machines.  It is different
+ * from hashlittle() on all machines.  hashbig() takes advantage of
+ * big-endian byte ordering.
+ */
+TM_ATTR
+uint32_t hash( const void *key, size_t length, const uint32_t initval)
+{
+  uint32_t a,b,c;
+  union { const void *ptr; size_t i; } u; /* to cast key to (size_t) happily */
+
+  /* Set up the internal state */
+  a = b = c = 0xdeadbeef + ((uint32_t)length) + initval;
+
+  u.ptr = key;
+  if (HASH_BIG_ENDIAN && ((u.i & 0x3) == 0)) {
+    const uint32_t *k = key;                           /* read 32-bit chunks */
+#ifdef VALGRIND
+    const uint8_t  *k8;
+#endif /* ifdef VALGRIND */
+
+    /*------ all but last block: aligned reads and affect 32 bits of (a,b,c) */
+    while (length > 12)
+    {
+      a += k[0];
+      b += k[1];
+      c += k[2];
+      mix(a,b,c);
+      length -= 12;
+      k += 3;
+    }
+
+    /*----------------------------- handle the last (probably partial) block */
+    /*
+     * "k[2]<<8" actually reads beyond the end of the string, but
+     * then shifts out the part it's not allowed to read.  Because the
+     * string is aligned, the illegal read is in the same word as the
+     * rest of the string.  Every machine with memory protection I've seen
+     * does it on word boundaries, so is OK with this.  But VALGRIND will
+     * still catch it and complain.  The masking trick does make the hash
+     * noticably faster for short strings (like English words).
+     */
+#ifndef VALGRIND
+
+    switch(length)
+    {
+    case 12: c+=k[2]; b+=k[1]; a+=k[0]; break;
+    case 11: c+=k[2]&0xffffff00; b+=k[1]; a+=k[0]; break;
+    case 10: c+=k[2]&0xffff0000; b+=k[1]; a+=k[0]; break;
+    case 9 : c+=k[2]&0xff000000; b+=k[1]; a+=k[0]; break;
+    case 8 : b+=k[1]; a+=k[0]; break;
+    case 7 : b+=k[1]&0xffffff00; a+=k[0]; break;
+    case 6 : b+=k[1]&0xffff0000; a+=k[0]; break;
+    case 5 : b+=k[1]&0xff000000; a+=k[0]; break;
+    case 4 : a+=k[0]; break;
+    case 3 : a+=k[0]&0xffffff00; break;
+    case 2 : a+=k[0]&0xffff0000; break;
+    case 1 : a+=k[0]&0xff000000; break;
+    case 0 : return c;              /* zero length strings require no mixing */
+    }
+
+#else  /* make valgrind happy */
+
+    k8 = (const uint8_t *)k;
+    switch(length)                   /* all the case statements fall through */
+    {
+    case 12: c+=k[2]; b+=k[1]; a+=k[0]; break;
+    case 11: c+=((uint32_t)k8[10])<<8;  /* fall through */
+    case 10: c+=((uint32_t)k8[9])<<16;  /* fall through */
+    case 9 : c+=((uint32_t)k8[8])<<24;  /* fall through */
+    case 8 : b+=k[1]; a+=k[0]; break;
+    case 7 : b+=((uint32_t)k8[6])<<8;   /* fall through */
+    case 6 : b+=((uint32_t)k8[5])<<16;  /* fall through */
+    case 5 : b+=((uint32_t)k8[4])<<24;  /* fall through */
+    case 4 : a+=k[0]; break;
+    case 3 : a+=((uint32_t)k8[2])<<8;   /* fall through */
+    case 2 : a+=((uint32_t)k8[1])<<16;  /* fall through */
+    case 1 : a+=((uint32_t)k8[0])<<24; break;
+    case 0 : return c;
+    }
+
+#endif /* !VALGRIND */
+
+  } else {                        /* need to read the key one byte at a time */
+    const uint8_t *k = key;
+
+    /*--------------- all but the last block: affect some 32 bits of (a,b,c) */
+    while (length > 12)
+    {
+      a += ((uint32_t)k[0])<<24;
+      a += ((uint32_t)k[1])<<16;
+      a += ((uint32_t)k[2])<<8;
+      a += ((uint32_t)k[3]);
+      b += ((uint32_t)k[4])<<24;
+      b += ((uint32_t)k[5])<<16;
+      b += ((uint32_t)k[6])<<8;
+      b += ((uint32_t)k[7]);
+      c += ((uint32_t)k[8])<<24;
+      c += ((uint32_t)k[9])<<16;
+      c += ((uint32_t)k[10])<<8;
+      c += ((uint32_t)k[11]);
+      mix(a,b,c);
+      length -= 12;
+      k += 12;
+    }
+
+    /*-------------------------------- last block: affect all 32 bits of (c) */
+    switch(length)                   /* all the case statements fall through */
+    {
+    case 12: c+=k[11];
+    case 11: c+=((uint32_t)k[10])<<8;
+    case 10: c+=((uint32_t)k[9])<<16;
+    case 9 : c+=((uint32_t)k[8])<<24;
+    case 8 : b+=k[7];
+    case 7 : b+=((uint32_t)k[6])<<8;
+    case 6 : b+=((uint32_t)k[5])<<16;
+    case 5 : b+=((uint32_t)k[4])<<24;
+    case 4 : a+=k[3];
+    case 3 : a+=((uint32_t)k[2])<<8;
+    case 2 : a+=((uint32_t)k[1])<<16;
+    case 1 : a+=((uint32_t)k[0])<<24;
+             break;
+    case 0 : return c;
+    }
+  }
+
+  final(a,b,c);
+  return c;
+}
+#else /* HASH_XXX_ENDIAN == 1 */
+#error Must define HASH_BIG_ENDIAN or HASH_LITTLE_ENDIAN
+#endif /* HASH_XXX_ENDIAN == 1 */
+
+typedef  unsigned long  int  ub4;   /* unsigned 4-byte quantities */
+typedef  unsigned       char ub1;   /* unsigned 1-byte quantities */
+
+/* how many powers of 2's worth of buckets we use */
+static unsigned int hashpower = 16;
+
+#define hashsize(n) ((ub4)1<<(n))
+#define hashmask(n) (hashsize(n)-1)
+
+/*
+ * Number of buckets of the next table cleared by one expansion step. Keeps
+ * the write set of each step to a few dozen cachelines.
+ */
+#define ASSOC_ZERO_BUCKETS 512
+
+/* Sanketh here !!!*/
+/* Main hash table. This is where we look except during expansion. */
+static item** primary_hashtable = 0;
+
+/*
+ * Previous hash table. During expansion, we look here for keys that haven't
+ * been moved over to the primary yet.
+ */
+static item** old_hashtable = 0;
+
+/*
+ * Table being prepared for the next expansion. It is not visible to lookups
+ * until every bucket has been cleared.
+ */
+static item** next_hashtable = 0;
+
+/*
+ * Number of items in the hash table, striped per thread. Summed only when a
+ * stripe looks large enough to warrant growing the table.
+ */
+static struct {
+    int items;
+} __attribute__((aligned(CACHELINE_BYTES))) hash_items[COUNTER_STRIPES];
+
+/* Flag: Are we in the middle of expanding now? */
+static bool expanding = false;
+
+/* Flag: Has an insert asked for the table to grow? */
+static bool expand_pending = false;
+
+/*
+ * During expansion we migrate values with bucket granularity; this is how
+ * far we've gotten so far. Ranges from 0 .. hashsize(hashpower - 1) - 1.
+ */
+static unsigned int expand_bucket = 0;
+
+/*
+ * How many buckets of next_hashtable have been cleared. Lookups never read
+ * it, so it is kept off the cacheline holding the fields above.
+ */
+static unsigned int zero_bucket __attribute__((aligned(CACHELINE_BYTES))) = 0;
+
+/*
+ * Items a previous incarnation left in the table are put back on the LRU
+ * queues lazily, one stripe at a time. A stripe holds the items whose hash
+ * ends in the same hashpower - 1 bits, as the table had them at startup;
+ * later expansions only add high bits, so a stripe stays a fixed set of
+ * buckets in the primary and old tables. A request restores the stripe of
+ * the key it looks up before using it, and the restore sweep does the
+ * stripes no request touched. All of this is volatile.
+ */
+#define ASSOC_RESTORE_BATCH 32
+
+static bool restoring = false;
+static unsigned char *restore_done = NULL;
+static unsigned int restore_mask = 0;
+static unsigned int restore_cursor = 0;
+
+void assoc_init(void) {
+    unsigned int hash_size = hashsize(hashpower) * sizeof(void*);
+    /* Sanketh */
+	/*
+ 		So the primary hash table is simply
+		a chunk of memory. but why is it a 2d array ?
+		to handle collisions ???
+	 */
+	int v_hashtbl_zeroed = 1;
+	PTx {
+		primary_hashtable = (item**) PGET(p_primary_hashtbl);
+		if(!primary_hashtable) {
+		
+		    	primary_hashtable = (item**) pmalloc(hash_size);
+			if(primary_hashtable) {
+				PSET(p_primary_hashtbl, primary_hashtable);
+				PSET(p_hashpower, hashpower);
+				v_hashtbl_zeroed = 0;
+			}
+		} else {
+			/* Pick up an expansion the previous incarnation left behind. */
+			if (PGET(p_hashpower))
+				hashpower = PGET(p_hashpower);
+			old_hashtable = (item**) PGET(p_old_hashtbl);
+			expand_bucket = PGET(p_expand_bucket);
+			expanding = (old_hashtable != NULL);
+			/* A table still being cleared was never published. */
+			if (PGET(p_next_hashtbl)) {
+				pfree(PGET(p_next_hashtbl));
+				PSET(p_next_hashtbl, NULL);
+			}
+		}
+	}
+	if (v_hashtbl_zeroed) {
+		restore_mask = hashmask(hashpower - 1);
+		restore_done = calloc(hashsize(hashpower - 1), 1);
+		if (!restore_done) {
+			fprintf(stderr, "Failed to allocate the restore map.\n");
+			exit(EXIT_FAILURE);
+		}
+		restoring = true;
+	}
+	fprintf(stderr, "assoc_init: hash_size = %lu\n",
+	        (unsigned long) hashsize(hashpower) * sizeof(void*));
+	
+	if(!primary_hashtable) {
+		assert(v_hashtbl_zeroed == 1);
+		fprintf(stderr, "Failed to init hashtable.\n");
+		exit(EXIT_FAILURE);
+	} else {
+		/* 
+		 * Don't put this inside the Tx, 
+		 * Triggers and expansion of the write-set of the Tx
+		 * which is not currently supported.
+		 */
+		if(!v_hashtbl_zeroed)	{
+			memset(primary_hashtable, 0, hash_size);
+			fprintf(stderr, "***************************************************\n");
+			fprintf(stderr, "  Allocated hash-table in CURRENT incarnation \n");
+			fprintf(stderr, "  primary_hashtable = %p\n", primary_hashtable);
+			fprintf(stderr, "***************************************************\n");
+
+		} else {
+			fprintf(stderr, "***************************************************\n");
+			fprintf(stderr, "  Using hash-table from PREVIOUS incarnation \n");
+			fprintf(stderr, "  primary_hashtable = %p\n", primary_hashtable);
+			if (expanding) {
+				fprintf(stderr, "  resuming expansion at bucket %u\n", expand_bucket);
+			}
+			fprintf(stderr, "***************************************************\n");
+		}
+	}
+
+
+}
+
+/*
+ * puts the items of one stripe back on the LRU queues and into the item
+ * counts. Buckets of the old table below expand_bucket are empty already.
+ */
+TM_ATTR
+static void assoc_restore_stripe(unsigned int stripe) {
+    unsigned int bucket;
+    item *it;
+
+    if (restore_done[stripe])
+        return;
+    for (bucket = stripe; bucket < hashsize(hashpower); bucket += restore_mask + 1) {
+        for (it = primary_hashtable[bucket]; it; it = it->h_next) {
+            do_item_restore(it);
+            hash_items[thread_stripe].items++;
+        }
+    }
+    if (expanding) {
+        for (bucket = stripe; bucket < hashsize(hashpower - 1); bucket += restore_mask + 1) {
+            for (it = old_hashtable[bucket]; it; it = it->h_next) {
+                do_item_restore(it);
+                hash_items[thread_stripe].items++;
+            }
+        }
+    }
+    restore_done[stripe] = 1;
+}
+
+/* makes sure the items that may share a bucket with hv are on the LRU. */
+TM_ATTR
+static inline void assoc_restore_hv(uint32_t hv) {
+    if (restoring)
+        assoc_restore_stripe(hv & restore_mask);
+}
+
+/*
+ * restores the next ASSOC_RESTORE_BATCH stripes no request has restored yet.
+ * Returns false once every stripe is done.
+ */
+TM_ATTR
+bool do_assoc_restore_next(void) {
+    unsigned int n;
+
+    if (!restoring)
+        return false;
+    for (n = 0; n < ASSOC_RESTORE_BATCH && restore_cursor <= restore_mask; restore_cursor++) {
+        if (!restore_done[restore_cursor]) {
+            assoc_restore_stripe(restore_cursor);
+            n++;
+        }
+    }
+    if (restore_cursor > restore_mask) {
+        restoring = false;
+        return false;
+    }
+    return true;
+}
+
+/* racy hint, as for assoc_expansion_pending(). */
+bool assoc_restore_pending(void) {
+    return restoring;
+}
+
+TM_ATTR
+item *assoc_find(const char *key, const size_t nkey) {
+    uint32_t hv = hash(key, nkey, 0);
+    item *it;
+    unsigned int oldbucket;
+
+    assoc_restore_hv(hv);
+
+	// find the item here, Sanketh !
+    if (expanding &&
+        (oldbucket = (hv & hashmask(hashpower - 1))) >= expand_bucket)
+    {
+        it = old_hashtable[oldbucket];
+    } else {
+        it = primary_hashtable[hv & hashmask(hashpower)];
+    }
+
+    while (it) {
+        if ((nkey == it->nkey) &&
+            (txc_libc_memcmp(key, ITEM_key(it), nkey) == 0)) {
+            return it;
+        }
+        it = it->h_next;
+    }
+    return 0;
+}
+
+/* returns the address of the item pointer before the key.  if *item == 0,
+   the item wasn't found */
+TM_ATTR
+item** _hashitem_before (const char *key, const size_t nkey) {
+    uint32_t hv = hash(key, nkey, 0);
+    item **pos;
+    unsigned int oldbucket;
+
+    assoc_restore_hv(hv);
+
+    if (expanding &&
+        (oldbucket = (hv & hashmask(hashpower - 1))) >= expand_bucket)
+    {
+        pos = &old_hashtable[oldbucket];
+    } else {
+        pos = &primary_hashtable[hv & hashmask(hashpower)];
+    }
+
+    while (*pos && ((nkey != (*pos)->nkey) || txc_libc_memcmp(key, ITEM_key(*pos), nkey))) {
+        pos = &(*pos)->h_next;
+    }
+    return pos;
+}
+
+/* sums the per-thread item counts. */
+TM_ATTR
+static unsigned int assoc_count(void) {
+    int i, n = 0;
+
+    for (i = 0; i < COUNTER_STRIPES; i++) {
+        n += hash_items[i].items;
+    }
+    return n;
+}
+
+/*
+ * prepares the next, twice as large, table. Each call either allocates it or
+ * clears the next ASSOC_ZERO_BUCKETS of its buckets; the call that clears
+ * the last one swaps it in and starts migrating.
+ */
+TM_ATTR
+static void assoc_expand_step(void) {
+    unsigned int nbuckets = hashsize(hashpower + 1);
+    unsigned int bucket, end;
+
+    if (!next_hashtable) {
+        next_hashtable = pmalloc(nbuckets * sizeof(void *)); // freud : this shd be persistent 
+        if (!next_hashtable) {
+            /* Bad news, but we can keep running. */
+            expand_pending = false;
+            return;
+        }
+        PSET(p_next_hashtbl, next_hashtable);
+        zero_bucket = 0;
+        return;
+    }
+
+    bucket = zero_bucket;
+    end = bucket + ASSOC_ZERO_BUCKETS;
+    if (end > nbuckets)
+        end = nbuckets;
+    for (; bucket < end; bucket++) {
+        next_hashtable[bucket] = NULL;
+    }
+    zero_bucket = bucket;
+    if (bucket < nbuckets)
+        return;
+
+    if (settings.verbose > 1) {
+		//__tm_waiver {
+           // fprintf(stderr, "Hash table expansion starting\n");
+	//	}	
+	}	
+
+    old_hashtable = primary_hashtable;
+    primary_hashtable = next_hashtable;
+    next_hashtable = NULL;
+    hashpower++;
+    expanding = true;
+    expand_pending = false;
+    expand_bucket = 0;
+
+    PSET(p_old_hashtbl, old_hashtable);
+    PSET(p_primary_hashtbl, primary_hashtable);
+    PSET(p_next_hashtbl, NULL);
+    PSET(p_hashpower, hashpower);
+    PSET(p_expand_bucket, expand_bucket);
+}
+
+/* migrates the next bucket of the old table to the primary hashtable. */
+TM_ATTR
+static void assoc_migrate_bucket(void) {
+    item *it, *next;
+    int bucket;
+
+    for (it = old_hashtable[expand_bucket]; NULL != it; it = next) {
+        next = it->h_next;
+
+        bucket = hash(ITEM_key(it), it->nkey, 0) & hashmask(hashpower);
+        it->h_next = primary_hashtable[bucket];
+        primary_hashtable[bucket] = it;
+    }
+
+    old_hashtable[expand_bucket] = NULL;
+
+    expand_bucket++;
+    PSET(p_expand_bucket, expand_bucket);
+    if (expand_bucket == hashsize(hashpower - 1)) {
+        expanding = false;
+        pfree(old_hashtable);
+        old_hashtable = NULL;
+        PSET(p_old_hashtbl, NULL);
+	
+        if (settings.verbose > 1) {
+		//	__tm_waiver {
+                //fprintf(stderr, "Hash table expansion done\n");
+		//	}
+		}
+	
+    }
+}
+
+/*
+ * does one bounded step of a pending expansion. Growing the table is spread
+ * over many small transactions, one per call, so no single transaction has
+ * to clear or rehash the whole table.
+ */
+TM_ATTR
+void do_assoc_move_next_bucket(void) {
+    if (expanding) {
+        assoc_migrate_bucket();
+    } else if (expand_pending) {
+        assoc_expand_step();
+    }
+}
+
+/*
+ * racy hint for callers deciding whether do_assoc_move_next_bucket() is worth
+ * a transaction; the step itself rechecks under the transaction.
+ */
+bool assoc_expansion_pending(void) {
+    return expanding || expand_pending;
+}
+
+/* Note: this isn't an assoc_update.  The key must not already exist to call this */
+TM_ATTR
+int assoc_insert(item *it) {
+	/* Sanketh, this where a brand new SET lands
+	 * Look for refs to SCM in here !
+	 */
+    uint32_t hv;
+    unsigned int oldbucket;
+    unsigned int limit;
+
+    assert(assoc_find(ITEM_key(it), it->nkey) == 0);  /* shouldn't have duplicately named things defined */
+
+	/*
+	fprintf(stderr, "assoc key : %s\n", ITEM_key(it));
+	fprintf(stderr, "assoc val : %s\n", ITEM_data(it));
+	fprintf(stderr, "assoc key : %p\n", ITEM_key(it));
+	fprintf(stderr, "assoc val : %p\n", ITEM_data(it));
+	*/
+
+    hv = hash(ITEM_key(it), it->nkey, 0);
+    /* restoring the stripe after the insert would link it twice */
+    assoc_restore_hv(hv);
+    if (expanding &&
+        (oldbucket = (hv & hashmask(hashpower - 1))) >= expand_bucket)
+    {
+        it->h_next = old_hashtable[oldbucket];
+        old_hashtable[oldbucket] = it;
+    } else {
+        it->h_next = primary_hashtable[hv & hashmask(hashpower)];
+        primary_hashtable[hv & hashmask(hashpower)] = it;
+    }
+
+    hash_items[thread_stripe].items++;
+    /*
+     * Only look at the other stripes once ours holds its share of the
+     * limit; the expansion itself runs from do_assoc_move_next_bucket().
+     */
+    limit = (hashsize(hashpower) * 3) / 2;
+    if (! expanding && ! expand_pending &&
+        hash_items[thread_stripe].items > (int) (limit / COUNTER_STRIPES) &&
+        assoc_count() > limit) {
+        expand_pending = true;
+    }
+
+    return 1;
+}
+
+TM_ATTR
+void assoc_delete(const char *key, const size_t nkey) {
+    item **before = _hashitem_before(key, nkey);
+
+    if (*before) {
+        item *nxt = (*before)->h_next;
+        (*before)->h_next = 0;   /* probably pointless, but whatever. */
+        *before = nxt;
+        hash_items[thread_stripe].items--;
+        return;
+    }
+    /* Note:  we never actually get here.  the callers don't delete things
+       they can't find. */
+    assert(*before != 0);
+}
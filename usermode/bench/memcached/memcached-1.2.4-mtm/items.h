@@ -0,0 +1,33 @@
+/* See items.c */
+void item_init(void);
+/*@null@*/
+TM_ATTR item *do_item_alloc(char *key, const size_t nkey, const int flags, const rel_time_t exptime, const int nbytes);
+TM_ATTR void item_free(item *it);
+bool item_size_ok(const size_t nkey, const int flags, const int nbytes);
+
+TM_ATTR int  do_item_link(item *it);     /** may fail if transgresses limits */
+TM_ATTR void do_item_unlink(item *it);
+TM_ATTR void do_item_remove(item *it);
+TM_ATTR void do_item_update(item *it);   /** update LRU time to current and reposition */
+TM_ATTR int  do_item_replace(item *it, item *new_it);
+bool item_bump(item *it);                /** queue an LRU update for a GET hit */
+TM_ATTR void do_item_bump_drain(void);
+void item_bump_clear(void);
+TM_ATTR void do_item_restore(item *it);
+
+/*@null@*/
+TM_ATTR char *do_item_cachedump(const unsigned int slabs_clsid, const unsigned int limit, unsigned int *bytes);
+TM_ATTR char *do_item_stats(int *bytes);
+TM_ATTR void item_stats_fold(struct stats *s);
+TM_ATTR void item_stats_reset(void);
+
+/*@null@*/
+TM_ATTR char *do_item_stats_sizes(int *bytes);
+TM_ATTR void do_item_flush_expired(void);
+item *item_get(const char *key, const size_t nkey);
+
+TM_ATTR item *do_item_get_notedeleted(const char *key, const size_t nkey, bool *delete_locked);
+TM_ATTR void do_item_get_multi(char **keys, size_t *nkeys, const int n, item **items);
+TM_ATTR item *do_item_get_nocheck(const char *key, const size_t nkey);
+TM_ATTR bool item_delete_lock_over (item *it);
+
@@ -0,0 +1,20 @@
+/*!
+ * \file
+ *
+ * \author Sanketh Nalli <nalli@wisc.edu>
+ */
+
+#define __PVAR_C__
+#include "pvar.h"
+#undef __PVAR_C__
+
+// Global variables, not persistent
+rel_time_t current_time;
+struct stats stats;
+struct settings settings;
+__thread unsigned int thread_stripe = 0;
+
+
+
+
+
@@ -0,0 +1,266 @@
+/*!
+ * \file
+ *
+ * Throughput and latency driver for the physical logs of mcore.
+ *
+ * A single writer appends records of record_words random words to a log of
+ * the chosen type and flushes the log every flush_every records, as the
+ * commits of a thread do. The log is truncated either synchronously after
+ * each flush (SYNC_TRUNCATION) or by a concurrent thread that reads the
+ * stable part of the log and truncates it, as the asynchronous truncation
+ * does. Before the timed run, half of the log is filled and read back to
+ * measure the reads on their own.
+ *
+ * The log lives in DRAM and is written with the PCM primitives of the
+ * build, so the numbers follow the mcore flush_backend setting and, in an
+ * M_PCM_EMULATE_LATENCY build, the emulated latencies. Each run prints one
+ * CSV or JSON record with the cycles per logged word spent in each 
+ * operation and the latency of a write-and-flush group. sweep.py drives
+ * the grid.
+ */
+#include "pvar.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <pcm.h>
+#include <log.h>
+#include "hrtime.h"
+#include "hdrhist.h"
+
+#define MAX_GROUP_WORDS  (1 << 16)
+#define LOGBENCH_LF_TYPE 0x00FF     /* no log type of the log manager */
+
+typedef struct {
+	const char    *logtype;
+	int           record_words;
+	int           flush_every;
+	int           async;
+	int           duration_ms;
+	int           size_log2;
+	int           json;
+	int           header;
+	const char    *label;
+} options_t;
+
+typedef struct {
+	uint64_t      words;            /* payload words written */
+	uint64_t      groups;           /* flushes */
+	uint64_t      write_cycles;
+	uint64_t      flush_cycles;
+	uint64_t      truncate_cycles;
+	uint64_t      stall_cycles;     /* waiting for the truncation thread */
+	uint64_t      read_words;       /* words read back, headers and padding included */
+	uint64_t      read_cycles;
+	uint64_t      truncations;
+	hdrhist_t     hist;             /* cycles per group */
+} result_t;
+
+static options_t       opt = { "tornbit", 4, 1, 0, 1000, 16, 0, 0, "default" };
+static int             group_words;
+static uint64_t        group_span;
+static uint64_t        group_room;
+static volatile int    stop;
+static struct timespec t0;
+static result_t        bg;
+
+
+static inline uint64_t xorshift64(uint64_t *s)
+{
+	uint64_t x = *s;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	return *s = x;
+}
+
+
+static void *timer(void *arg)
+{
+	usleep(opt.duration_ms * 1000);
+	stop = 1;
+	return NULL;
+}
+
+
+/* Starts the timed part of the run */
+static void start_clock(void)
+{
+	pthread_t tid;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	pthread_create(&tid, NULL, timer, NULL);
+	pthread_detach(tid);
+}
+
+
+#define PHLOG_TYPE base
+#include "phlog-bits.h"
+#undef PHLOG_TYPE
+#define PHLOG_TYPE tornbit
+#include "phlog-bits.h"
+#undef PHLOG_TYPE
+#define PHLOG_TYPE checksum
+#include "phlog-bits.h"
+#undef PHLOG_TYPE
+
+static struct {
+	const char    *name;
+	void          (*run)(result_t *fg, result_t *fill);
+} logtypes[] = {
+	{ "base",     base_run },
+	{ "tornbit",  tornbit_run },
+	{ "checksum", checksum_run }
+};
+
+
+static double elapsed_s(struct timespec *a, struct timespec *b)
+{
+	return (b->tv_sec - a->tv_sec) + (b->tv_nsec - a->tv_nsec) / 1e9;
+}
+
+
+/* Cycles per microsecond of the timestamp counter */
+static double calibrate_mhz(void)
+{
+	struct timespec    a;
+	struct timespec    b;
+	unsigned long long c0;
+	unsigned long long c1;
+
+	clock_gettime(CLOCK_MONOTONIC, &a);
+	c0 = hrtime_cycles_ordered();
+	usleep(50000);
+	clock_gettime(CLOCK_MONOTONIC, &b);
+	c1 = hrtime_cycles_ordered();
+	return (c1 - c0) / (elapsed_s(&a, &b) * 1e6);
+}
+
+
+static double per_word(uint64_t cycles, uint64_t words)
+{
+	return words ? (double) cycles / words : 0;
+}
+
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-L base|tornbit|checksum] [-s record_words]\n"
+	                "          [-F flush_every] [-a] [-z log_size_log2] [-d duration_ms]\n"
+	                "          [-l label] [-f csv|json] [-H]\n"
+	                "  -a  truncate from a concurrent thread instead of after each flush\n"
+	                "  -H  print the CSV header before the record\n", name);
+	exit(1);
+}
+
+
+int main(int argc, char **argv)
+{
+	struct timespec t1;
+	result_t        fg;
+	result_t        fill;
+	double          secs;
+	double          mhz;
+	double          write_cpw;
+	double          flush_cpw;
+	double          truncate_cpw;
+	double          read_cpw;
+	double          commit_cpw;
+	int             type = -1;
+	int             c;
+	int             i;
+
+	while ((c = getopt(argc, argv, "L:s:F:az:d:l:f:H")) != -1) {
+		switch (c) {
+			case 'L': opt.logtype = optarg; break;
+			case 's': opt.record_words = atoi(optarg); break;
+			case 'F': opt.flush_every = atoi(optarg); break;
+			case 'a': opt.async = 1; break;
+			case 'z': opt.size_log2 = atoi(optarg); break;
+			case 'd': opt.duration_ms = atoi(optarg); break;
+			case 'l': opt.label = optarg; break;
+			case 'f': opt.json = strcmp(optarg, "json") == 0; break;
+			case 'H': opt.header = 1; break;
+			default: usage(argv[0]);
+		}
+	}
+	for (i = 0; i < sizeof(logtypes) / sizeof(logtypes[0]); i++) {
+		if (strcmp(opt.logtype, logtypes[i].name) == 0) {
+			type = i;
+		}
+	}
+	if (opt.record_words < 1 || opt.flush_every < 1 ||
+	    (uint64_t) opt.record_words * opt.flush_every > MAX_GROUP_WORDS)
+	{
+		usage(argv[0]);
+	}
+	group_words = opt.record_words * opt.flush_every;
+	/* Payload, tornbit chunk headers, the padding of the last chunk and a trailer */
+	group_span = group_words + group_words / 7 + 16;
+	if (type < 0 ||
+	    opt.size_log2 < PHYSICAL_LOG_MIN_NUM_ENTRIES_LOG2 ||
+	    opt.size_log2 > PHYSICAL_LOG_MAX_NUM_ENTRIES_LOG2 ||
+	    group_span * 4 > (1ULL << opt.size_log2))
+	{
+		usage(argv[0]);
+	}
+	/* The writer waits for room for a whole group: its writes never fail */
+	group_room = (1ULL << opt.size_log2) - 2 * group_span;
+
+	memset(&fg, 0, sizeof(fg));
+	memset(&fill, 0, sizeof(fill));
+	hdrhist_init(&fg.hist);
+	hdrhist_init(&fill.hist);
+	hdrhist_init(&bg.hist);
+	logtypes[type].run(&fg, &fill);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	secs = elapsed_s(&t0, &t1);
+	mhz = calibrate_mhz();
+
+	write_cpw = per_word(fg.write_cycles, fg.words);
+	flush_cpw = per_word(fg.flush_cycles, fg.words);
+	/* Concurrent truncation is off the writer's path: report what it costs the truncator */
+	truncate_cpw = per_word(opt.async ? bg.read_cycles + bg.truncate_cycles : fg.truncate_cycles,
+	                        fg.words);
+	read_cpw = per_word(fill.read_cycles, fill.words);
+	commit_cpw = per_word(fg.write_cycles + fg.flush_cycles +
+	                      (opt.async ? 0 : fg.truncate_cycles), fg.words);
+
+	if (opt.json) {
+		printf("{\"label\": \"%s\", \"log\": \"%s\", \"record_words\": %d, "
+		       "\"flush_every\": %d, \"truncation\": \"%s\", \"seconds\": %.3f, "
+		       "\"words\": %llu, \"words_per_sec\": %.0f, \"write_cpw\": %.2f, "
+		       "\"flush_cpw\": %.2f, \"truncate_cpw\": %.2f, \"read_cpw\": %.2f, "
+		       "\"commit_cpw\": %.2f, \"stall_pct\": %.1f, \"p50_ns\": %.0f, "
+		       "\"p99_ns\": %.0f, \"max_ns\": %.0f}\n",
+		       opt.label, opt.logtype, opt.record_words, opt.flush_every,
+		       opt.async ? "async" : "sync", secs,
+		       (unsigned long long) fg.words, fg.words / secs,
+		       write_cpw, flush_cpw, truncate_cpw, read_cpw, commit_cpw,
+		       100.0 * fg.stall_cycles / (secs * mhz * 1e6),
+		       hdrhist_quantile(&fg.hist, 0.50) / mhz * 1000,
+		       hdrhist_quantile(&fg.hist, 0.99) / mhz * 1000,
+		       fg.hist.max / mhz * 1000);
+	} else {
+		if (opt.header) {
+			printf("label,log,record_words,flush_every,truncation,seconds,words,"
+			       "words_per_sec,write_cpw,flush_cpw,truncate_cpw,read_cpw,"
+			       "commit_cpw,stall_pct,p50_ns,p99_ns,max_ns\n");
+		}
+		printf("%s,%s,%d,%d,%s,%.3f,%llu,%.0f,%.2f,%.2f,%.2f,%.2f,%.2f,%.1f,"
+		       "%.0f,%.0f,%.0f\n",
+		       opt.label, opt.logtype, opt.record_words, opt.flush_every,
+		       opt.async ? "async" : "sync", secs,
+		       (unsigned long long) fg.words, fg.words / secs,
+		       write_cpw, flush_cpw, truncate_cpw, read_cpw, commit_cpw,
+		       100.0 * fg.stall_cycles / (secs * mhz * 1e6),
+		       hdrhist_quantile(&fg.hist, 0.50) / mhz * 1000,
+		       hdrhist_quantile(&fg.hist, 0.99) / mhz * 1000,
+		       fg.hist.max / mhz * 1000);
+	}
+	return 0;
+}
@@ -0,0 +1,186 @@
+/*!
+ * \file
+ *
+ * The benchmark loops of one physical log type. main.c includes this file
+ * once per log type with PHLOG_TYPE set to the type's name (base, tornbit,
+ * ...), so that the log calls are inlined as they are in the runtime
+ * rather than made through a table of operations.
+ */
+
+#define PB_CAT2(a, b)       a##b
+#define PB_CAT(a, b)        PB_CAT2(a, b)
+#define PB_PHLOG(fn)        PB_CAT(PB_CAT(m_phlog_, PHLOG_TYPE), PB_CAT(_, fn))
+#define PB_LOCAL(fn)        PB_CAT(PHLOG_TYPE, PB_CAT(_, fn))
+#define PB_LOG_T            PB_CAT(PB_CAT(m_phlog_, PHLOG_TYPE), _t)
+#define PB_NVMD_T           PB_CAT(PB_CAT(m_phlog_, PHLOG_TYPE), _nvmd_t)
+
+
+/* Formats a log of 2^size_log2 words in DRAM */
+static PB_LOG_T *
+PB_LOCAL(create)(pcm_storeset_t *set)
+{
+	PB_LOG_T   *log;
+	PB_NVMD_T  *nvmd;
+	pcm_word_t *nvphlog;
+	size_t     size = sizeof(pcm_word_t) << opt.size_log2;
+
+	if (posix_memalign((void **) &log, CACHELINE_SIZE, sizeof(*log)) != 0 ||
+	    posix_memalign((void **) &nvmd, CACHELINE_SIZE, sizeof(*nvmd)) != 0 ||
+	    posix_memalign((void **) &nvphlog, 4096, size) != 0)
+	{
+		fprintf(stderr, "logbench: cannot allocate a log of %lu bytes\n",
+		        (unsigned long) size);
+		exit(1);
+	}
+	memset(nvmd, 0, sizeof(*nvmd));
+	memset(nvphlog, 0, size);
+	PB_PHLOG(format)(set, nvmd, nvphlog, LOGBENCH_LF_TYPE, opt.size_log2);
+	PB_PHLOG(init)(log, nvmd, nvphlog);
+	return log;
+}
+
+
+/* Words between the head and the tail: written and not yet truncated */
+static inline uint64_t
+PB_LOCAL(used)(PB_LOG_T *log)
+{
+	return (log->tail - *(volatile uint64_t *) &log->head) & log->mask;
+}
+
+
+/*
+ * Writes a group of records and flushes it, as a commit does, and then
+ * truncates the log if sync is set. With concurrent truncation, stalls 
+ * first while the truncation thread has not made room for the group.
+ */
+static inline void
+PB_LOCAL(write_group)(pcm_storeset_t *set, PB_LOG_T *log, result_t *res,
+                      uint64_t *seed, int sync)
+{
+	hrtime_t start;
+	hrtime_t written;
+	hrtime_t flushed;
+	hrtime_t truncated;
+	int      i;
+
+	start = hrtime_cycles();
+	if (opt.async) {
+		while (PB_LOCAL(used)(log) > group_room) {
+			if (stop) {
+				return;
+			}
+			asm volatile("pause" ::: "memory");
+		}
+		written = hrtime_cycles();
+		res->stall_cycles += written - start;
+		start = written;
+	}
+	for (i = 0; i < group_words; i++) {
+		while (PB_PHLOG(write)(set, log, xorshift64(seed)) != M_R_SUCCESS) {
+			asm volatile("pause" ::: "memory");
+		}
+	}
+	written = hrtime_cycles();
+	while (PB_PHLOG(flush)(set, log) != M_R_SUCCESS) {
+		asm volatile("pause" ::: "memory");
+	}
+	flushed = hrtime_cycles();
+	truncated = flushed;
+	if (sync) {
+		PB_PHLOG(truncate_sync)(set, log);
+		truncated = hrtime_cycles();
+	}
+	res->write_cycles += written - start;
+	res->flush_cycles += flushed - written;
+	res->truncate_cycles += truncated - flushed;
+	res->words += group_words;
+	res->groups++;
+	hdrhist_record(&res->hist, truncated - start);
+}
+
+
+/*
+ * Reads the stable part of the log, as the truncation does, and truncates
+ * it. A pass stops at the words present when it starts, so that a pass
+ * keeping up with the writer still moves the head.
+ */
+static inline uint64_t
+PB_LOCAL(read_truncate)(pcm_storeset_t *set, PB_LOG_T *log, result_t *res)
+{
+	hrtime_t start;
+	hrtime_t read;
+	uint64_t value;
+	uint64_t sum = 0;
+	uint64_t n = 0;
+	uint64_t limit = PB_LOCAL(used)(log);
+
+	start = hrtime_cycles();
+	while (n < limit && PB_PHLOG(read)(log, &value) == M_R_SUCCESS) {
+		sum += value;
+		n++;
+	}
+	if (n == 0) {
+		return 0;
+	}
+	read = hrtime_cycles();
+	PB_PHLOG(truncate_async)(set, log);
+	res->read_cycles += read - start;
+	res->read_words += n;
+	res->truncate_cycles += hrtime_cycles() - read;
+	res->truncations++;
+	return sum | 1;
+}
+
+
+/* Concurrent truncation: drains the log while the writer fills it */
+static void *
+PB_LOCAL(truncator)(void *arg)
+{
+	PB_LOG_T       *log = (PB_LOG_T *) arg;
+	pcm_storeset_t *set = pcm_storeset_get();
+
+	while (!stop) {
+		if (PB_LOCAL(read_truncate)(set, log, &bg) == 0) {
+			asm volatile("pause" ::: "memory");
+		}
+	}
+	return NULL;
+}
+
+
+static void
+PB_LOCAL(run)(result_t *fg, result_t *fill)
+{
+	pcm_storeset_t *set = pcm_storeset_get();
+	PB_LOG_T       *log = PB_LOCAL(create)(set);
+	pthread_t      tid;
+	uint64_t       seed = 0x9E3779B97F4A7C15ULL;
+
+	/*
+	 * Read cost: fill half of the log without truncating, then read it all
+	 * back and truncate it in one go.
+	 */
+	while (PB_LOCAL(used)(log) + group_span < (1ULL << opt.size_log2) / 2) {
+		PB_LOCAL(write_group)(set, log, fill, &seed, 0);
+	}
+	PB_LOCAL(read_truncate)(set, log, fill);
+
+	start_clock();
+	if (opt.async) {
+		pthread_create(&tid, NULL, PB_LOCAL(truncator), log);
+	}
+	while (!stop) {
+		PB_LOCAL(write_group)(set, log, fg, &seed, !opt.async);
+	}
+	if (opt.async) {
+		pthread_join(tid, NULL);
+	}
+}
+
+
+#undef PB_CAT2
+#undef PB_CAT
+#undef PB_PHLOG
+#undef PB_LOCAL
+#undef PB_LOG_T
+#undef PB_NVMD_T
@@ -0,0 +1,4 @@
+#ifndef __PVAR_C__
+#define __PVAR_C__
+#include "pvar.h"
+#endif
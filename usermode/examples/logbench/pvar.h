@@ -0,0 +1,13 @@
+/*!
+ * \file
+ *
+ * Persistent variables of the physical log benchmark: it keeps its logs in
+ * DRAM and has none, but the examples build expects the library.
+ */
+
+#ifndef __PVAR_H__
+#define __PVAR_H__
+
+#include <mnemosyne.h>
+
+#endif /* __PVAR_H__ */
@@ -0,0 +1,64 @@
+#!/usr/bin/env python
+#
+# Runs logbench over a grid of physical log types, record sizes, flush
+# frequencies and truncation modes, and collects the records as CSV and
+# JSON.
+#
+#   sweep.py -o build/results/logbench build/examples/logbench/logbench
+
+import itertools
+import json
+import optparse
+import os
+import subprocess
+import sys
+
+def int_list(s):
+	return [int(x) for x in s.split(',')]
+
+def main():
+	parser = optparse.OptionParser(usage="%prog [options] PATH")
+	parser.add_option('-o', dest='outdir', default='.', help='result directory')
+	parser.add_option('-d', dest='duration', default='1000', help='milliseconds per run')
+	parser.add_option('-z', dest='size_log2', default='16', help='log2 of the log size in words')
+	parser.add_option('-L', dest='logs', default='base,tornbit,checksum')
+	parser.add_option('-s', dest='record_words', default='1,4,16,64')
+	parser.add_option('-F', dest='flush_every', default='1,8,64')
+	parser.add_option('-T', dest='truncation', default='sync,async')
+	(options, args) = parser.parse_args()
+	binary = args[0] if args else 'build/examples/logbench/logbench'
+	if not os.path.isdir(options.outdir):
+		os.makedirs(options.outdir)
+
+	records = []
+	header = None
+	grid = itertools.product(options.logs.split(','), int_list(options.record_words),
+	                         int_list(options.flush_every), options.truncation.split(','))
+	for (log, record_words, flush_every, truncation) in grid:
+		args = [binary, '-H', '-l', log, '-L', log, '-d', options.duration,
+		        '-z', options.size_log2, '-s', str(record_words), '-F', str(flush_every)]
+		if truncation == 'async':
+			args.append('-a')
+		try:
+			lines = subprocess.check_output(args).decode().strip().splitlines()
+		except subprocess.CalledProcessError as e:
+			sys.stderr.write('%s/%d/%d/%s: run failed with status %d\n' %
+			                 (log, record_words, flush_every, truncation, e.returncode))
+			continue
+		header = lines[-2].split(',')
+		records.append(dict(zip(header, lines[-1].split(','))))
+		sys.stdout.write(lines[-1] + '\n')
+		sys.stdout.flush()
+
+	if header is None:
+		return 1
+	with open(os.path.join(options.outdir, 'results.csv'), 'w') as f:
+		f.write(','.join(header) + '\n')
+		for r in records:
+			f.write(','.join(r[c] for c in header) + '\n')
+	with open(os.path.join(options.outdir, 'results.json'), 'w') as f:
+		json.dump(records, f, indent=2)
+	return 0
+
+if __name__ == '__main__':
+	sys.exit(main())
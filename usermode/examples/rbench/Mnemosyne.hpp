@@ -1,8 +1,10 @@
 #ifndef _MNEMOSYNE_PERSISTENCY_
 #define _MNEMOSYNE_PERSISTENCY_
 
+#include <stdio.h>
 #include "pvar.h"
 #include <pmalloc.h>
+#include <mnemosyne.hh>
 
 // We have to do this because pmalloc.h defines these as macros
 #undef pmalloc
@@ -28,16 +30,24 @@ public:
     static std::string className() { return "Mnemosyne"; }
 
 
+    // Objects are kept in the persistent roots "rbench.<idx>"
+    template <typename T>
+    inline persistent_ptr<T>* object_root(int idx) {
+        char name[32];
+        snprintf(name, sizeof(name), "rbench.%d", idx);
+        return root<T>(name);
+    }
+
     template <typename T>
     inline T* get_object(int idx) {
-        return nullptr;
-        //return (T*)per->objects[idx];  // TODO: fix me
+        persistent_ptr<T>* r = object_root<T>(idx);
+        return r ? r->get() : nullptr;
     }
 
     template <typename T>
     inline void put_object(int idx, T* obj) {
-        //per->objects[idx] = obj;  // TODO: fix me
-        //PWB(&per->objects[idx]);
+        persistent_ptr<T>* r = object_root<T>(idx);
+        if (r) *r = obj;
     }
 
 
@@ -0,0 +1,303 @@
+/*!
+ * \file
+ *
+ * Throughput and latency driver for the persistent transaction runtime.
+ *
+ * Each thread runs durable transactions over a shared persistent array of
+ * 64-bit words for a fixed time. A transaction touches tx_size words, a
+ * read_pct share of them loads and the rest stores, and hot_pct of the
+ * accesses land in the first cacheline of the array so that contention
+ * can be dialed in independently of the array size. Transaction latency
+ * is recorded per thread in a log-bucketed histogram and reported as
+ * P50/P99/P99.9 next to the aggregate throughput, one CSV or JSON record
+ * per run. sweep.py drives the parameter grid.
+ */
+#include "pvar.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <cpuid.h>
+#include <pthread.h>
+#include <sys/utsname.h>
+#include <pmalloc.h>
+#include "hrtime.h"
+#include "hdrhist.h"
+#include "ut_barrier.h"
+
+#define MAX_THREADS  64
+#define MAX_TX_SIZE  1024
+#define HOT_WORDS    8     /* one cacheline */
+
+typedef struct {
+	int           nthreads;
+	int           duration_ms;
+	uint64_t      nwords;
+	int           tx_size;
+	int           read_pct;
+	int           hot_pct;
+	int           json;
+	int           header;
+	const char    *label;
+} options_t;
+
+typedef struct {
+	uint32_t      idx;
+	uint32_t      write;
+} access_t;
+
+typedef struct {
+	pthread_t     tid;
+	int           id;
+	uint64_t      seed;
+	uint64_t      commits;
+	hdrhist_t     hist;
+} __attribute__((aligned(64))) thread_data_t;
+
+static options_t       opt = { 1, 1000, 1 << 20, 8, 80, 0, 0, 0, "default" };
+static uint64_t        *array;
+static volatile int    stop;
+static ut_barrier_t    start_barrier;
+static thread_data_t   threads[MAX_THREADS];
+
+
+static inline uint64_t xorshift64(uint64_t *s)
+{
+	uint64_t x = *s;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	return *s = x;
+}
+
+
+/* Picks the accesses outside the transaction so that only the runtime is timed */
+static void generate_tx(thread_data_t *td, access_t *acc)
+{
+	int      i;
+	uint64_t r;
+
+	for (i = 0; i < opt.tx_size; i++) {
+		r = xorshift64(&td->seed);
+		if ((int) (r % 100) < opt.hot_pct) {
+			acc[i].idx = (uint32_t) ((r >> 8) % HOT_WORDS);
+		} else {
+			acc[i].idx = (uint32_t) ((r >> 8) % opt.nwords);
+		}
+		acc[i].write = (int) ((r >> 40) % 100) >= opt.read_pct;
+	}
+}
+
+
+static void *worker(void *arg)
+{
+	thread_data_t      *td = (thread_data_t *) arg;
+	access_t           acc[MAX_TX_SIZE];
+	uint64_t           sum = 0;
+	unsigned long long start;
+	int                n = opt.tx_size;
+	int                i;
+
+	ut_barrier_wait(&start_barrier);
+	while (!stop) {
+		generate_tx(td, acc);
+		start = hrtime_cycles();
+		PTx {
+			for (i = 0; i < n; i++) {
+				if (acc[i].write) {
+					array[acc[i].idx] = sum + i;
+				} else {
+					sum += array[acc[i].idx];
+				}
+			}
+		}
+		hdrhist_record(&td->hist, hrtime_cycles() - start);
+		td->commits++;
+	}
+	/* Keep the loads alive */
+	if (sum == 1) {
+		fprintf(stderr, " ");
+	}
+	return NULL;
+}
+
+
+static double elapsed_s(struct timespec *a, struct timespec *b)
+{
+	return (b->tv_sec - a->tv_sec) + (b->tv_nsec - a->tv_nsec) / 1e9;
+}
+
+
+/* Cycles per microsecond of the timestamp counter */
+static double calibrate_mhz(void)
+{
+	struct timespec    a;
+	struct timespec    b;
+	unsigned long long c0;
+	unsigned long long c1;
+
+	clock_gettime(CLOCK_MONOTONIC, &a);
+	c0 = hrtime_cycles_ordered();
+	usleep(50000);
+	clock_gettime(CLOCK_MONOTONIC, &b);
+	c1 = hrtime_cycles_ordered();
+	return (c1 - c0) / (elapsed_s(&a, &b) * 1e6);
+}
+
+
+static void print_hwinfo(void)
+{
+	char           line[256];
+	char           model[256] = "unknown";
+	char           *p;
+	FILE           *f;
+	struct utsname u;
+	unsigned int   eax, ebx, ecx, edx;
+	int            clflushopt = 0;
+	int            clwb = 0;
+	const char     *config = getenv("MNEMOSYNE_CONFIG");
+
+	if ((f = fopen("/proc/cpuinfo", "r"))) {
+		while (fgets(line, sizeof(line), f)) {
+			if (strncmp(line, "model name", 10) == 0 && (p = strchr(line, ':'))) {
+				snprintf(model, sizeof(model), "%s", p + 2);
+				model[strcspn(model, "\n")] = '\0';
+				break;
+			}
+		}
+		fclose(f);
+	}
+	if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+		clflushopt = (ebx >> 23) & 1;
+		clwb = (ebx >> 24) & 1;
+	}
+	uname(&u);
+	printf("{\"cpu\": \"%s\", \"online_cpus\": %ld, \"tsc_mhz\": %.0f, "
+	       "\"clflushopt\": %d, \"clwb\": %d, \"kernel\": \"%s %s\", "
+	       "\"config\": \"%s\"}\n",
+	       model, sysconf(_SC_NPROCESSORS_ONLN), calibrate_mhz(),
+	       clflushopt, clwb, u.sysname, u.release, config ? config : "");
+}
+
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-t threads] [-d duration_ms] [-w array_words]\n"
+	                "          [-s tx_size] [-r read_pct] [-c hot_pct] [-l label]\n"
+	                "          [-f csv|json] [-H] [-i]\n"
+	                "  -H  print the CSV header before the record\n"
+	                "  -i  print the hardware description as JSON and exit\n", name);
+	exit(1);
+}
+
+
+int main(int argc, char **argv)
+{
+	struct timespec t0;
+	struct timespec t1;
+	hdrhist_t       hist;
+	uint64_t        commits = 0;
+	double          secs;
+	double          mhz;
+	int             c;
+	int             i;
+
+	while ((c = getopt(argc, argv, "t:d:w:s:r:c:l:f:Hi")) != -1) {
+		switch (c) {
+			case 't': opt.nthreads = atoi(optarg); break;
+			case 'd': opt.duration_ms = atoi(optarg); break;
+			case 'w': opt.nwords = strtoull(optarg, NULL, 0); break;
+			case 's': opt.tx_size = atoi(optarg); break;
+			case 'r': opt.read_pct = atoi(optarg); break;
+			case 'c': opt.hot_pct = atoi(optarg); break;
+			case 'l': opt.label = optarg; break;
+			case 'f': opt.json = strcmp(optarg, "json") == 0; break;
+			case 'H': opt.header = 1; break;
+			case 'i': print_hwinfo(); return 0;
+			default: usage(argv[0]);
+		}
+	}
+	if (opt.nthreads < 1 || opt.nthreads > MAX_THREADS ||
+	    opt.tx_size < 1 || opt.tx_size > MAX_TX_SIZE ||
+	    opt.nwords < HOT_WORDS || opt.nwords > UINT32_MAX ||
+	    opt.read_pct < 0 || opt.read_pct > 100 ||
+	    opt.hot_pct < 0 || opt.hot_pct > 100)
+	{
+		usage(argv[0]);
+	}
+
+	/* Reclaim the array of a run that did not finish */
+	PTx {
+		if (PGET(bench_array)) {
+			pfree(PGET(bench_array));
+		}
+		array = (uint64_t *) pmalloc(opt.nwords * sizeof(uint64_t));
+		PSET(bench_array, array);
+	}
+	if (array == NULL) {
+		fprintf(stderr, "tmbench: cannot allocate %llu persistent words\n",
+		        (unsigned long long) opt.nwords);
+		return 1;
+	}
+
+	ut_barrier_init(&start_barrier, opt.nthreads + 1);
+	for (i = 0; i < opt.nthreads; i++) {
+		threads[i].id = i;
+		threads[i].seed = 0x9E3779B97F4A7C15ULL * (i + 1);
+		hdrhist_init(&threads[i].hist);
+		pthread_create(&threads[i].tid, NULL, worker, &threads[i]);
+	}
+	ut_barrier_wait(&start_barrier);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	usleep(opt.duration_ms * 1000);
+	stop = 1;
+	for (i = 0; i < opt.nthreads; i++) {
+		pthread_join(threads[i].tid, NULL);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	hdrhist_init(&hist);
+	for (i = 0; i < opt.nthreads; i++) {
+		hdrhist_merge(&hist, &threads[i].hist);
+		commits += threads[i].commits;
+	}
+	secs = elapsed_s(&t0, &t1);
+	mhz = calibrate_mhz();
+
+	if (opt.json) {
+		printf("{\"label\": \"%s\", \"threads\": %d, \"tx_size\": %d, "
+		       "\"read_pct\": %d, \"hot_pct\": %d, \"words\": %llu, "
+		       "\"seconds\": %.3f, \"commits\": %llu, \"tx_per_sec\": %.0f, "
+		       "\"p50_ns\": %.0f, \"p99_ns\": %.0f, \"p999_ns\": %.0f, "
+		       "\"max_ns\": %.0f}\n",
+		       opt.label, opt.nthreads, opt.tx_size, opt.read_pct, opt.hot_pct,
+		       (unsigned long long) opt.nwords, secs,
+		       (unsigned long long) commits, commits / secs,
+		       hdrhist_quantile(&hist, 0.50) / mhz * 1000,
+		       hdrhist_quantile(&hist, 0.99) / mhz * 1000,
+		       hdrhist_quantile(&hist, 0.999) / mhz * 1000,
+		       hist.max / mhz * 1000);
+	} else {
+		if (opt.header) {
+			printf("label,threads,tx_size,read_pct,hot_pct,words,seconds,"
+			       "commits,tx_per_sec,p50_ns,p99_ns,p999_ns,max_ns\n");
+		}
+		printf("%s,%d,%d,%d,%d,%llu,%.3f,%llu,%.0f,%.0f,%.0f,%.0f,%.0f\n",
+		       opt.label, opt.nthreads, opt.tx_size, opt.read_pct, opt.hot_pct,
+		       (unsigned long long) opt.nwords, secs,
+		       (unsigned long long) commits, commits / secs,
+		       hdrhist_quantile(&hist, 0.50) / mhz * 1000,
+		       hdrhist_quantile(&hist, 0.99) / mhz * 1000,
+		       hdrhist_quantile(&hist, 0.999) / mhz * 1000,
+		       hist.max / mhz * 1000);
+	}
+
+	PTx {
+		pfree(array);
+		PSET(bench_array, NULL);
+	}
+	return 0;
+}
@@ -0,0 +1,131 @@
+#!/usr/bin/env python
+#
+# Runs tmbench over a grid of transaction sizes, read ratios, contention
+# levels, thread counts and cacheline flush backends, and collects the
+# records as CSV and JSON next to a description of the machine.
+#
+# With -u it also runs each point with transaction components turned off
+# through the mtm unsafe_disable setting (benchmarking only: the runs are
+# not isolated or durable) and writes breakdown.csv, the time per
+# transaction each component accounts for next to the full run.
+#
+# Log types are chosen at build time, so each one is a separate binary:
+# build them with different --config-name values and pass them as
+# NAME=PATH arguments.
+#
+#   sweep.py -o build/results/tmbench default=build/examples/tmbench/tmbench
+
+import itertools
+import json
+import optparse
+import os
+import subprocess
+import sys
+import tempfile
+
+def int_list(s):
+	return [int(x) for x in s.split(',')]
+
+def run(binary, args, env):
+	out = subprocess.check_output([binary] + args, env=env)
+	return out.decode().strip().splitlines()[-1]
+
+def tx_ns(r):
+	# Time per transaction and thread, in ns
+	return int(r['threads']) * 1e9 / max(float(r['tx_per_sec']), 1)
+
+def write_breakdown(path, records, unsafe):
+	point = ['log', 'flush_backend', 'threads', 'tx_size', 'read_pct', 'hot_pct']
+	runs = {}
+	for r in records:
+		runs[tuple(r[c] for c in point) + (r['unsafe_disable'],)] = r
+	with open(path, 'w') as f:
+		f.write(','.join(point + ['tx_ns'] + ['%s_ns' % u for u in unsafe[1:]]) + '\n')
+		for key, r in sorted(runs.items()):
+			if key[-1] != 'none':
+				continue
+			full = tx_ns(r)
+			costs = []
+			for u in unsafe[1:]:
+				other = runs.get(key[:-1] + (u,))
+				costs.append('%.0f' % (full - tx_ns(other)) if other else '')
+			f.write(','.join(list(key[:-1]) + ['%.0f' % full] + costs) + '\n')
+
+def main():
+	parser = optparse.OptionParser(usage="%prog [options] NAME=PATH...")
+	parser.add_option('-o', dest='outdir', default='.', help='result directory')
+	parser.add_option('-d', dest='duration', default='1000', help='milliseconds per run')
+	parser.add_option('-w', dest='words', default='1048576', help='array size in words')
+	parser.add_option('-t', dest='threads', default='1,2,4,8')
+	parser.add_option('-s', dest='tx_sizes', default='1,8,64')
+	parser.add_option('-r', dest='read_pcts', default='0,50,90')
+	parser.add_option('-c', dest='hot_pcts', default='0,50')
+	parser.add_option('-f', dest='flush', default='auto,clflush,clflushopt,clwb',
+	                  help='mcore flush_backend values to sweep')
+	parser.add_option('-u', dest='unsafe', default='',
+	                  help='mtm unsafe_disable values to sweep besides none, '
+	                       'components of a value joined by + '
+	                       '(isolation,logging,log_flush,home_flush)')
+	(options, args) = parser.parse_args()
+	if not args:
+		args = ['default=build/examples/tmbench/tmbench']
+	binaries = [a.split('=', 1) if '=' in a else (os.path.basename(a), a) for a in args]
+	if not os.path.isdir(options.outdir):
+		os.makedirs(options.outdir)
+
+	hwinfo = json.loads(run(binaries[0][1], ['-i'], os.environ))
+	with open(os.path.join(options.outdir, 'hwinfo.json'), 'w') as f:
+		json.dump(hwinfo, f, indent=2)
+
+	records = []
+	header = None
+	unsafe = ['none'] + [u for u in options.unsafe.split(',') if u]
+	grid = itertools.product(binaries, options.flush.split(','), unsafe,
+	                         int_list(options.threads), int_list(options.tx_sizes),
+	                         int_list(options.read_pcts), int_list(options.hot_pcts))
+	for ((logname, binary), flush, disable, threads, tx_size, read_pct, hot_pct) in grid:
+		ini = tempfile.NamedTemporaryFile(mode='w', suffix='.ini', delete=False)
+		ini.write('mcore: {\n  flush_backend = "%s";\n};\n' % flush)
+		if disable != 'none':
+			ini.write('mtm: {\n  unsafe_disable = "%s";\n};\n' % disable.replace('+', ','))
+		ini.close()
+		env = dict(os.environ)
+		env['MNEMOSYNE_CONFIG'] = ini.name
+		label = '%s/%s' % (logname, flush)
+		if disable != 'none':
+			label += '/-' + disable
+		try:
+			lines = subprocess.check_output([binary, '-H', '-l', label,
+			    '-t', str(threads), '-d', options.duration, '-w', options.words,
+			    '-s', str(tx_size), '-r', str(read_pct), '-c', str(hot_pct)],
+			    env=env).decode().strip().splitlines()
+		except subprocess.CalledProcessError as e:
+			sys.stderr.write('%s: run failed with status %d\n' % (label, e.returncode))
+			continue
+		finally:
+			os.unlink(ini.name)
+		header = lines[-2].split(',')
+		values = lines[-1].split(',')
+		record = dict(zip(header, values))
+		record['log'] = logname
+		record['flush_backend'] = flush
+		record['unsafe_disable'] = disable
+		records.append(record)
+		sys.stdout.write(lines[-1] + '\n')
+		sys.stdout.flush()
+
+	if header is None:
+		return 1
+	columns = ['log', 'flush_backend', 'unsafe_disable'] + header
+	with open(os.path.join(options.outdir, 'results.csv'), 'w') as f:
+		f.write(','.join(columns) + '\n')
+		for r in records:
+			f.write(','.join(str(r[c]) for c in columns) + '\n')
+	if len(unsafe) > 1:
+		write_breakdown(os.path.join(options.outdir, 'breakdown.csv'), records, unsafe)
+	with open(os.path.join(options.outdir, 'results.json'), 'w') as f:
+		json.dump({'hardware': hwinfo, 'runs': records}, f, indent=2)
+	return 0
+
+if __name__ == '__main__':
+	sys.exit(main())
@@ -40,7 +40,7 @@
 #define ENVVAR_MAX_LEN 128
 
 static inline int 
-env_setting_lookup(char *group, char *member, char **value_str)
+env_setting_lookup(const char *group, const char *member, char **value_str)
 {
 	char name[ENVVAR_MAX_LEN];
 	char *val;
@@ -70,7 +70,7 @@ env_setting_lookup(char *group, char *member, char **value_str)
 }
 
 static inline int
-env_setting_lookup_int(char *group, char *member, int *value)
+env_setting_lookup_int(const char *group, const char *member, int *value)
 {
 	char *value_str;
 
@@ -87,14 +87,14 @@ env_setting_lookup_int(char *group, char *member, int *value)
 }
 
 static inline int
-env_setting_lookup_bool(char *group, char *member, int *value)
+env_setting_lookup_bool(const char *group, const char *member, int *value)
 {
 	return env_setting_lookup_int(group, member, value);
 }
 
 
 static inline int 
-env_setting_lookup_string(char *group, char *member, char **value)
+env_setting_lookup_string(const char *group, const char *member, char **value)
 {
 	return env_setting_lookup(group, member, value);	
 }
@@ -102,8 +102,8 @@ env_setting_lookup_string(char *group, char *member, char **value)
 
 int
 m_config_setting_lookup_bool(config_t *cfg, 
-                             char *group_name, 
-                             char *member_name, 
+                             const char *group_name, 
+                             const char *member_name, 
                              int *value, 
                              int validity_check, ...)
 {
@@ -130,8 +130,8 @@ m_config_setting_lookup_bool(config_t *cfg,
 
 int
 m_config_setting_lookup_int(config_t *cfg, 
-                            char *group_name, 
-                            char *member_name, 
+                            const char *group_name, 
+                            const char *member_name, 
                             int *value, 
                             int validity_check, ...)
 {
@@ -164,7 +164,7 @@ m_config_setting_lookup_int(config_t *cfg,
 				min = va_arg(ap, int);
 				max = va_arg(ap, int);
 				va_end(ap);
-				if (*value >= min && *value <= max) {
+				if (val >= min && val <= max) {
 					*value = val;
 					return CONFIG_TRUE;
 				}
@@ -189,8 +189,8 @@ m_config_setting_lookup_int(config_t *cfg,
 
 int
 m_config_setting_lookup_string(config_t *cfg, 
-                               char *group_name, 
-                               char *member_name, 
+                               const char *group_name, 
+                               const char *member_name, 
                                char **value, 
                                int validity_check, ...)
 {
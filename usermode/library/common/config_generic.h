@@ -66,17 +66,17 @@
   }
 
 static inline void
-config_setting_print_bool(FILE * stream, char *group, char *member, int val) {
+config_setting_print_bool(FILE * stream, const char *group, const char *member, int val) {
     fprintf(stream, "%s.%s = %s\n", group, member, val==1 ? "true": "false");
 }
 
 static inline void
-config_setting_print_int(FILE * stream, char *group, char *member, int val) {
+config_setting_print_int(FILE * stream, const char *group, const char *member, int val) {
     fprintf(stream, "%s.%s = %d\n", group, member, val);
 }
 
 static inline void
-config_setting_print_string(FILE * stream, char *group, char *member, char *val) {
+config_setting_print_string(FILE * stream, const char *group, const char *member, char *val) {
     fprintf(stream, "%s.%s = %s\n", group, member, val);
 }
 
@@ -92,8 +92,8 @@ do {                                                                           \
   FOREACH_RUNTIME_CONFIG_SETTING(CONFIG_SETTING_PRINT, group, NULL, values)    \
 } while(0);
 
-int m_config_setting_lookup_string(config_t *cfg, char *group_name, char *member_name, char **value, int validity_check, ...);
-int m_config_setting_lookup_int(config_t *cfg, char *group_name, char *member_name, int *value, int validity_check, ...);
-int m_config_setting_lookup_bool(config_t *cfg, char *group_name, char *member_name, int *value, int validity_check, ...);
+int m_config_setting_lookup_string(config_t *cfg, const char *group_name, const char *member_name, char **value, int validity_check, ...);
+int m_config_setting_lookup_int(config_t *cfg, const char *group_name, const char *member_name, int *value, int validity_check, ...);
+int m_config_setting_lookup_bool(config_t *cfg, const char *group_name, const char *member_name, int *value, int validity_check, ...);
 
 #endif 
@@ -37,10 +37,11 @@
 #include <stdarg.h>
 #include <string.h>
 #include <pthread.h>
+#include <unistd.h>
 #include "debug.h"
 
 #define PSEGMENT_RESERVED_REGION_START   0x0000100000000000
-#define PSEGMENT_RESERVED_REGION_SIZE    0x0000010000000000 /* 1 TB */
+#define PSEGMENT_RESERVED_REGION_SIZE    0x0000400000000000 /* 64 TB */
 #define PSEGMENT_RESERVED_REGION_END     (PSEGMENT_RESERVED_REGION_START +    \
                                           PSEGMENT_RESERVED_REGION_SIZE)
 
@@ -195,6 +196,84 @@ m_debug_print_L(int debug_flag, const char *strformat, ...)
 }
 
 
+int m_log_levels[M_LOG_CAT_COUNT] = { 
+	M_LOG_WARNING, M_LOG_WARNING, M_LOG_WARNING, M_LOG_WARNING, M_LOG_WARNING
+};
+
+static const char *m_log_category_names[M_LOG_CAT_COUNT] = {
+	"core", "segment", "phlog", "mtm", "pmalloc"
+};
+
+static const char *m_log_level_names[] = {
+	"error", "warning", "info", "debug", "trace"
+};
+
+
+/* Parses MNEMOSYNE_LOG, a list of category=level; category "all" sets all */
+__attribute__((constructor))
+static void
+m_log_init(void)
+{
+	char *env = getenv("MNEMOSYNE_LOG");
+	char buf[256];
+	char *item;
+	char *level;
+	char *saveptr;
+	int  c;
+	int  l;
+
+	if (!env) {
+		return;
+	}
+	snprintf(buf, sizeof(buf), "%s", env);
+	for (item = strtok_r(buf, ",", &saveptr); item; item = strtok_r(NULL, ",", &saveptr)) {
+		if (!(level = strchr(item, '='))) {
+			continue;
+		}
+		*level++ = '\0';
+		for (l = M_LOG_TRACE; l >= 0; l--) {
+			if (strcmp(level, m_log_level_names[l]) == 0) {
+				break;
+			}
+		}
+		if (l < 0) {
+			continue;
+		}
+		for (c = 0; c < M_LOG_CAT_COUNT; c++) {
+			if (strcmp(item, "all") == 0 || strcmp(item, m_log_category_names[c]) == 0) {
+				m_log_levels[c] = l;
+			}
+		}
+	}
+}
+
+
+/* 
+ * Formats the message on the stack and writes it with a single write, so 
+ * that messages of concurrent threads do not interleave and stdio's lock 
+ * is not taken.
+ */
+void 
+m_log_print(int category, int level, const char *strformat, ...) 
+{
+	char    msg[512];
+	int     len;
+	va_list ap;
+
+	len = snprintf(msg, sizeof(msg), "[%s:%s] ", 
+	               m_log_category_names[category], m_log_level_names[level]);
+	va_start(ap, strformat);
+	len += vsnprintf(&msg[len], sizeof(msg) - len, strformat, ap);
+	va_end(ap);
+	if (len >= (int) sizeof(msg)) {
+		len = sizeof(msg) - 1;
+	}
+	if (write(fileno(M_DEBUG_OUT), msg, len) < 0) {
+		return;
+	}
+}
+
+
 /* Obtain a backtrace and print it to stdout. */
 void 
 m_print_trace (void)
@@ -48,6 +48,53 @@ extern "C" {
     m_debug_print(NULL, 0, 1, "Error",	msg, ##__VA_ARGS__ )
 
 
+/*
+ * Leveled logging
+ *
+ * M_LOG(category, level, fmt, ...) prints when level is at or below the
+ * category's runtime level, which costs one load and one branch; the 
+ * arguments are only evaluated, and the message only formatted, when it 
+ * prints. Messages above M_LOG_LEVEL_MAX are compiled out along with 
+ * their arguments, so release builds keep nothing of debug and trace 
+ * messages on the hot paths.
+ *
+ * The runtime levels are set from the MNEMOSYNE_LOG environment variable,
+ * a comma separated list of category=level, e.g. "segment=debug,all=info".
+ */
+
+#define M_LOG_ERROR         0
+#define M_LOG_WARNING       1
+#define M_LOG_INFO          2
+#define M_LOG_DEBUG         3
+#define M_LOG_TRACE         4
+
+#ifndef M_LOG_LEVEL_MAX
+# ifdef _M_BUILD_DEBUG
+#  define M_LOG_LEVEL_MAX   M_LOG_TRACE
+# else
+#  define M_LOG_LEVEL_MAX   M_LOG_INFO
+# endif
+#endif
+
+#define M_LOG_CAT_CORE      0
+#define M_LOG_CAT_SEGMENT   1
+#define M_LOG_CAT_PHLOG     2
+#define M_LOG_CAT_MTM       3
+#define M_LOG_CAT_PMALLOC   4
+#define M_LOG_CAT_COUNT     5
+
+extern int m_log_levels[M_LOG_CAT_COUNT];
+
+#define M_LOG(category, level, msg, ...)                                    \
+    do {                                                                    \
+        if ((level) <= M_LOG_LEVEL_MAX &&                                   \
+            __builtin_expect((level) <= m_log_levels[(category)], 0))       \
+        {                                                                   \
+            m_log_print((category), (level), msg, ##__VA_ARGS__);           \
+        }                                                                   \
+    } while (0)
+
+
 #ifdef _M_BUILD_DEBUG
 
 # define M_WARNING(msg, ...)                                                \
@@ -55,7 +102,11 @@ extern "C" {
 
 
 # define M_DEBUG_PRINT(debug_level, msg, ...)                               \
-    m_debug_print_L(debug_level,	msg, ##__VA_ARGS__ )
+    do {                                                                    \
+        if (debug_level) {                                                  \
+            M_LOG(M_LOG_CAT_CORE, M_LOG_DEBUG, msg, ##__VA_ARGS__);         \
+        }                                                                   \
+    } while (0)
 
 # define M_ASSERT(condition) assert(condition) 
 
@@ -72,6 +123,8 @@ extern "C" {
 
 void m_debug_print(char *file, int line, int fatal, const char *prefix, const char *strformat, ...); 
 void m_debug_print_L(int debug_level, const char *strformat, ...); 
+void m_log_print(int category, int level, const char *strformat, ...)
+    __attribute__((format(printf, 3, 4), cold));
 void m_print_trace (void);
 
 #define TSTR_SZ		128
@@ -0,0 +1,414 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/**
+ * \file flathash.c
+ *
+ * \brief Open-addressing hash table implementation.
+ *
+ * Slots are probed a group of M_FLATHASH_GROUP at a time, groups in 
+ * triangular order. A control byte is M_FLATHASH_EMPTY, M_FLATHASH_DELETED
+ * or the low 7 bits of the key's hash. A probe for a key stops at the 
+ * first group with an empty slot. The table grows when 7/8 of its slots 
+ * are used or deleted.
+ */
+
+#include <string.h>
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+#include "debug.h"
+#include "result.h"
+#include "util.h"
+#include "flathash.h"
+
+#define M_FLATHASH_GROUP     16
+#define M_FLATHASH_EMPTY     ((uint8_t) 0x80)
+#define M_FLATHASH_DELETED   ((uint8_t) 0xFE)
+
+struct m_flathash_s {
+	uint8_t                *ctrl;      /**< One control byte per slot */
+	m_flathash_key_t       *keys;
+	m_flathash_value_t     *values;
+	unsigned int           capacity;   /**< Number of slots (power of 2) */
+	unsigned int           count;      /**< Slots holding a key */
+	unsigned int           deleted;    /**< Slots marked deleted */
+	bool                   mtsafe;
+	m_mutex_t              mutex;
+};
+
+
+static inline uint64_t
+hash_key(m_flathash_key_t key)
+{
+	uint64_t h = (uint64_t) key * 0x9E3779B97F4A7C15ULL;
+
+	return h ^ (h >> 29);
+}
+
+
+/* Bit i is set if control byte i of the group equals c */
+static inline unsigned int
+group_match(const uint8_t *group, uint8_t c)
+{
+#ifdef __SSE2__
+	__m128i ctrl = _mm_loadu_si128((const __m128i *) group);
+
+	return (unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char) c)));
+#else
+	unsigned int mask = 0;
+	int          i;
+
+	for (i = 0; i < M_FLATHASH_GROUP; i++) {
+		if (group[i] == c) {
+			mask |= 1U << i;
+		}
+	}
+	return mask;
+#endif
+}
+
+
+/* Bit i is set if slot i of the group is empty or deleted */
+static inline unsigned int
+group_match_free(const uint8_t *group)
+{
+#ifdef __SSE2__
+	/* Only the free markers have the top bit set */
+	return (unsigned int) _mm_movemask_epi8(_mm_loadu_si128((const __m128i *) group));
+#else
+	unsigned int mask = 0;
+	int          i;
+
+	for (i = 0; i < M_FLATHASH_GROUP; i++) {
+		if (group[i] & 0x80) {
+			mask |= 1U << i;
+		}
+	}
+	return mask;
+#endif
+}
+
+
+static m_result_t
+table_alloc(m_flathash_t *h, unsigned int capacity)
+{
+	h->ctrl = (uint8_t *) MALLOC(capacity);
+	h->keys = (m_flathash_key_t *) MALLOC(capacity * sizeof(m_flathash_key_t));
+	h->values = (m_flathash_value_t *) MALLOC(capacity * sizeof(m_flathash_value_t));
+	if (h->ctrl == NULL || h->keys == NULL || h->values == NULL) {
+		FREE(h->ctrl);
+		FREE(h->keys);
+		FREE(h->values);
+		return M_R_NOMEMORY;
+	}
+	memset(h->ctrl, M_FLATHASH_EMPTY, capacity);
+	h->capacity = capacity;
+	h->count = 0;
+	h->deleted = 0;
+	return M_R_SUCCESS;
+}
+
+
+/* 
+ * Returns the slot holding key, or -1 if there is none. If slot is not 
+ * NULL, it is set to the first free slot on the key's probe sequence.
+ */
+static int
+find_slot(m_flathash_t *h, m_flathash_key_t key, int *slot)
+{
+	uint64_t     hash = hash_key(key);
+	uint8_t      h2 = (uint8_t) (hash & 0x7F);
+	unsigned int ngroups_mask = h->capacity / M_FLATHASH_GROUP - 1;
+	unsigned int g = (unsigned int) (hash >> 7) & ngroups_mask;
+	unsigned int step;
+	unsigned int match;
+	uint8_t      *group;
+	int          i;
+
+	if (slot) {
+		*slot = -1;
+	}
+	for (step = 1; step <= ngroups_mask + 1; g = (g + step++) & ngroups_mask) {
+		group = &h->ctrl[g * M_FLATHASH_GROUP];
+		for (match = group_match(group, h2); match; match &= match - 1) {
+			i = g * M_FLATHASH_GROUP + __builtin_ctz(match);
+			if (h->keys[i] == key) {
+				return i;
+			}
+		}
+		match = group_match_free(group);
+		if (slot && *slot < 0 && match) {
+			*slot = g * M_FLATHASH_GROUP + __builtin_ctz(match);
+		}
+		if (group_match(group, M_FLATHASH_EMPTY)) {
+			break;
+		}
+	}
+	return -1;
+}
+
+
+static void
+put_slot(m_flathash_t *h, int i, m_flathash_key_t key, m_flathash_value_t value)
+{
+	if (h->ctrl[i] == M_FLATHASH_DELETED) {
+		h->deleted--;
+	}
+	h->ctrl[i] = (uint8_t) (hash_key(key) & 0x7F);
+	h->keys[i] = key;
+	h->values[i] = value;
+	h->count++;
+}
+
+
+/* Rehashes into a table twice as large, or as large if deletions take the room */
+static m_result_t
+table_grow(m_flathash_t *h)
+{
+	m_flathash_t old = *h;
+	unsigned int capacity = h->capacity;
+	unsigned int i;
+	int          slot;
+
+	if (h->count >= h->capacity / 2) {
+		capacity *= 2;
+	}
+	if (table_alloc(h, capacity) != M_R_SUCCESS) {
+		*h = old;
+		return M_R_NOMEMORY;
+	}
+	for (i = 0; i < old.capacity; i++) {
+		if (!(old.ctrl[i] & 0x80)) {
+			find_slot(h, old.keys[i], &slot);
+			put_slot(h, slot, old.keys[i], old.values[i]);
+		}
+	}
+	FREE(old.ctrl);
+	FREE(old.keys);
+	FREE(old.values);
+	return M_R_SUCCESS;
+}
+
+
+m_result_t 
+m_flathash_create(m_flathash_t** hp, unsigned int table_size, bool mtsafe)
+{
+	unsigned int capacity = M_FLATHASH_GROUP;
+
+	*hp = (m_flathash_t *) MALLOC(sizeof(m_flathash_t));
+	if (*hp == NULL) 
+	{
+		return M_R_NOMEMORY;
+	}
+	while (capacity < table_size) {
+		capacity *= 2;
+	}
+	if (table_alloc(*hp, capacity) != M_R_SUCCESS) 
+	{
+		FREE(*hp);
+		return M_R_NOMEMORY;
+	}
+	M_MUTEX_INIT(&(*hp)->mutex, NULL);
+	(*hp)->mtsafe = mtsafe;
+
+	return M_R_SUCCESS;
+}
+
+
+m_result_t
+m_flathash_destroy(m_flathash_t** hp)
+{
+	if (*hp == NULL) 
+	{
+		return M_R_SUCCESS;
+	}
+	FREE((*hp)->ctrl);
+	FREE((*hp)->keys);
+	FREE((*hp)->values);
+	FREE(*hp);
+	*hp = NULL;
+	
+	return M_R_SUCCESS;
+}
+
+
+m_result_t
+m_flathash_add(m_flathash_t* h, 
+               m_flathash_key_t key, 
+               m_flathash_value_t value)
+{
+	m_result_t result;
+	int        slot;
+
+	if (h->mtsafe == true) 
+	{
+		M_MUTEX_LOCK(&(h->mutex));
+	}
+
+	if (find_slot(h, key, &slot) >= 0) 
+	{
+		result = M_R_EXISTS;
+		goto done;
+	}
+	if ((h->count + h->deleted + 1) * 8 > h->capacity * 7) 
+	{
+		if ((result = table_grow(h)) != M_R_SUCCESS) 
+		{
+			goto done;
+		}
+		find_slot(h, key, &slot);
+	}
+	put_slot(h, slot, key, value);
+	result = M_R_SUCCESS;
+
+done:
+	if (h->mtsafe == true) 
+	{
+		M_MUTEX_UNLOCK(&(h->mutex));
+	}
+	return result;
+}
+
+
+m_result_t
+m_flathash_lookup(m_flathash_t* h,
+                  m_flathash_key_t key, 
+                  m_flathash_value_t *value)
+{
+	m_result_t result;
+	int        i;
+
+	if (h->mtsafe == true) 
+	{
+		M_MUTEX_LOCK(&(h->mutex));
+	}
+
+	if ((i = find_slot(h, key, NULL)) >= 0) 
+	{
+		if (value) 
+		{
+			*value = h->values[i];
+		}
+		result = M_R_SUCCESS;
+	} else {
+		result = M_R_NOTEXISTS;
+	}
+
+	if (h->mtsafe == true) 
+	{
+		M_MUTEX_UNLOCK(&(h->mutex));
+	}
+	return result;
+}
+
+
+m_result_t
+m_flathash_remove(m_flathash_t* h,
+                  m_flathash_key_t key, 
+                  m_flathash_value_t *value)
+{
+	m_result_t result;
+	int        i;
+
+	if (h->mtsafe == true) 
+	{
+		M_MUTEX_LOCK(&(h->mutex));
+	}
+
+	if ((i = find_slot(h, key, NULL)) >= 0) 
+	{
+		if (value) 
+		{
+			*value = h->values[i];
+		}
+		/* Probes for other keys may have passed this slot: keep them going */
+		h->ctrl[i] = M_FLATHASH_DELETED;
+		h->count--;
+		h->deleted++;
+		result = M_R_SUCCESS;
+	} else {
+		result = M_R_NOTEXISTS;
+	}
+
+	if (h->mtsafe == true) 
+	{
+		M_MUTEX_UNLOCK(&(h->mutex));
+	}
+	return result;
+}
+
+/* Iterator is not multithreaded safe */
+
+void
+m_flathash_iter_init(m_flathash_t *flathash, m_flathash_iter_t *iter)
+{
+	iter->flathash = flathash;
+	iter->index = 0;
+}
+
+
+m_result_t
+m_flathash_iter_next(m_flathash_iter_t *iter, 
+                     m_flathash_key_t *key, 
+                     m_flathash_value_t *value)
+{
+	m_flathash_t *flathash = iter->flathash;
+
+	for (; iter->index < flathash->capacity; iter->index++) {
+		if (!(flathash->ctrl[iter->index] & 0x80)) {
+			*key = flathash->keys[iter->index];
+			*value = flathash->values[iter->index];
+			iter->index++;
+			return M_R_SUCCESS;
+		}
+	}
+	*key = 0;
+	*value = NULL;
+	return M_R_NULLITER;
+}
+
+
+void 
+m_flathash_print(m_flathash_t *h) {
+	unsigned int i;
+
+	fprintf(M_DEBUG_OUT, "HASH TABLE: %p (%u/%u slots used, %u deleted)\n", 
+	        h, h->count, h->capacity, h->deleted);
+	for (i = 0; i < h->capacity; i++)
+	{
+		if (!(h->ctrl[i] & 0x80)) {
+			fprintf(M_DEBUG_OUT, "[%u]: (%lu, %p)\n", i, 
+			        (unsigned long) h->keys[i], h->values[i]);
+		}
+	}
+}
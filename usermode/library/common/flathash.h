@@ -0,0 +1,74 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/**
+ * \file flathash.h
+ *
+ * \brief Open-addressing hash table interface.
+ *
+ * Keys and values live in flat arrays next to one control byte per slot,
+ * which holds 7 bits of the key's hash or marks the slot empty or deleted.
+ * A lookup compares a group of 16 control bytes at once and only touches
+ * the keys whose byte matches, so it costs about one cache miss and no
+ * pointer chasing.
+ */
+
+#ifndef _M_FLATHASH_H
+#define _M_FLATHASH_H
+
+#include "mtypes.h"
+#include "result.h"
+
+/* Opaque structure used to represent hash table. */
+typedef struct m_flathash_s m_flathash_t;
+
+/* Structure used to represent hash table iterator. */
+typedef struct m_flathash_iter_s m_flathash_iter_t;
+
+typedef uintptr_t m_flathash_key_t;
+typedef void *m_flathash_value_t;
+
+struct m_flathash_iter_s {
+	m_flathash_t      *flathash;
+	unsigned int      index;
+};
+
+
+m_result_t m_flathash_create(m_flathash_t**, unsigned int, bool);
+m_result_t m_flathash_destroy(m_flathash_t**);
+m_result_t m_flathash_add(m_flathash_t*, m_flathash_key_t, m_flathash_value_t);
+m_result_t m_flathash_lookup(m_flathash_t*, m_flathash_key_t, m_flathash_value_t *);
+m_result_t m_flathash_remove(m_flathash_t*, m_flathash_key_t, m_flathash_value_t *);
+void m_flathash_iter_init(m_flathash_t *flathash, m_flathash_iter_t *iter);
+m_result_t m_flathash_iter_next(m_flathash_iter_t *iter, m_flathash_key_t *key, m_flathash_value_t *value);
+void m_flathash_print(m_flathash_t *);
+#endif
@@ -0,0 +1,139 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/*
+ * \file
+ *
+ * \brief Log-linear latency histogram, in the manner of HdrHistogram.
+ *
+ * Values below 2^(HDRHIST_SUB_BITS+1) get a bucket each. Above that, 
+ * each power of two is split into 2^HDRHIST_SUB_BITS buckets, so a value 
+ * is known to within 1/2^HDRHIST_SUB_BITS of itself (6.25%) whatever its 
+ * magnitude. Recording is a bit scan and an increment.
+ */
+
+#ifndef _HDRHIST_H
+#define _HDRHIST_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define HDRHIST_SUB_BITS  4
+#define HDRHIST_SUB       (1 << HDRHIST_SUB_BITS)
+#define HDRHIST_NBUCKETS  ((64 - HDRHIST_SUB_BITS + 1) * HDRHIST_SUB)
+
+typedef struct hdrhist_s {
+	uint64_t count;
+	uint64_t max;
+	uint64_t buckets[HDRHIST_NBUCKETS];
+} hdrhist_t;
+
+
+static inline void hdrhist_init(hdrhist_t *h)
+{
+	memset(h, 0, sizeof(*h));
+}
+
+
+static inline unsigned int hdrhist_bucket(uint64_t v)
+{
+	unsigned int e;
+
+	if (v < 2 * HDRHIST_SUB) {
+		return (unsigned int) v;
+	}
+	e = 63 - __builtin_clzll(v) - HDRHIST_SUB_BITS;
+	return (e + 1) * HDRHIST_SUB + (unsigned int) ((v >> e) - HDRHIST_SUB);
+}
+
+
+/* Highest value that falls in bucket i */
+static inline uint64_t hdrhist_bucket_value(unsigned int i)
+{
+	unsigned int e;
+
+	if (i < 2 * HDRHIST_SUB) {
+		return i;
+	}
+	e = i / HDRHIST_SUB - 1;
+	return (((uint64_t) (i % HDRHIST_SUB + HDRHIST_SUB + 1)) << e) - 1;
+}
+
+
+static inline void hdrhist_record(hdrhist_t *h, uint64_t v)
+{
+	h->buckets[hdrhist_bucket(v)]++;
+	h->count++;
+	if (v > h->max) {
+		h->max = v;
+	}
+}
+
+
+static inline void hdrhist_merge(hdrhist_t *dst, const hdrhist_t *src)
+{
+	unsigned int i;
+
+	for (i = 0; i < HDRHIST_NBUCKETS; i++) {
+		dst->buckets[i] += src->buckets[i];
+	}
+	dst->count += src->count;
+	if (src->max > dst->max) {
+		dst->max = src->max;
+	}
+}
+
+
+/* Value below which fraction q (0 to 1) of the recorded values fall */
+static inline uint64_t hdrhist_quantile(const hdrhist_t *h, double q)
+{
+	uint64_t     rank;
+	uint64_t     seen = 0;
+	unsigned int i;
+
+	if (h->count == 0) {
+		return 0;
+	}
+	rank = (uint64_t) (q * h->count);
+	if (rank >= h->count) {
+		rank = h->count - 1;
+	}
+	for (i = 0; i < HDRHIST_NBUCKETS; i++) {
+		seen += h->buckets[i];
+		if (seen > rank) {
+			return hdrhist_bucket_value(i) < h->max ? hdrhist_bucket_value(i) : h->max;
+		}
+	}
+	return h->max;
+}
+
+#endif /* _HDRHIST_H */
@@ -76,5 +76,16 @@ static inline unsigned long long hrtime_cycles(void)
 #error "What architecture is this???"
 #endif
 
+/* 
+ * Like hrtime_cycles but waits for all earlier instructions to execute 
+ * first, so that the time of the code being measured is not cut short.
+ */
+static inline unsigned long long hrtime_cycles_ordered(void)
+{
+	unsigned hi, lo;
+	__asm__ __volatile__ ("rdtscp" : "=a"(lo), "=d"(hi) : : "ecx");
+	return ( (unsigned long long)lo)|( ((unsigned long long)hi)<<32 );
+}
+
 
 #endif /* _HRTIME_H_121AJ1 */
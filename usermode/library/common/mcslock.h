@@ -0,0 +1,186 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/**
+ * \file mcslock.h
+ *
+ * \brief MCS queue spinlock for the runtime's internal locks.
+ *
+ * Waiters queue up behind the lock's tail and each spins on a flag in its
+ * own queue node, which the previous holder clears on release. Unlike the
+ * ticket lock in spinlock.h, where every waiter polls the same line, a 
+ * release moves one cacheline to one waiter, so handoffs stay cheap when 
+ * the waiters sit on other sockets, and the lock is granted in FIFO order.
+ *
+ * Queue nodes come from a small per-thread pool and the holder's node is
+ * remembered in the lock, so callers lock and unlock as with a mutex. A 
+ * thread may hold up to M_MCSLOCK_MAX_NESTING of these locks at a time.
+ *
+ * Waiters spin and yield rather than sleep: use it for short critical sections 
+ * that never block and never wait on a condition variable.
+ */
+
+#ifndef _M_MCSLOCK_H
+#define _M_MCSLOCK_H
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define M_MCSLOCK_MAX_NESTING 8
+
+/* 
+ * Spins before a waiter yields its CPU, so that a preempted holder or 
+ * successor gets to run when there are more threads than CPUs.
+ */
+#define M_MCSLOCK_SPINS_BEFORE_YIELD 1024
+
+typedef struct m_mcslock_node_s m_mcslock_node_t;
+typedef struct m_mcslock_s m_mcslock_t;
+
+struct m_mcslock_node_s {
+	m_mcslock_node_t * volatile next;    /**< the waiter queued behind us */
+	volatile int                locked;  /**< set until the predecessor hands over the lock */
+	int                         in_use;  /**< the node is queued on some lock */
+} __attribute__((aligned(64)));
+
+struct m_mcslock_s {
+	m_mcslock_node_t * volatile tail;    /**< last node in the queue, NULL if free */
+	m_mcslock_node_t            *holder; /**< node of the holder; written with the lock held */
+};
+
+#define M_MCSLOCK_INITIALIZER { NULL, NULL }
+
+static __thread m_mcslock_node_t m_mcslock_nodes[M_MCSLOCK_MAX_NESTING];
+
+
+static inline void
+m_mcslock_init(m_mcslock_t *lock)
+{
+	lock->tail = NULL;
+	lock->holder = NULL;
+}
+
+
+static inline void
+m_mcslock_spin(int *spins)
+{
+	if (++*spins < M_MCSLOCK_SPINS_BEFORE_YIELD) {
+		__builtin_ia32_pause();
+	} else {
+		*spins = 0;
+		sched_yield();
+	}
+}
+
+
+static inline m_mcslock_node_t *
+m_mcslock_node_get(void)
+{
+	int i;
+
+	for (i = 0; i < M_MCSLOCK_MAX_NESTING; i++) {
+		if (!m_mcslock_nodes[i].in_use) {
+			m_mcslock_nodes[i].in_use = 1;
+			m_mcslock_nodes[i].next = NULL;
+			m_mcslock_nodes[i].locked = 1;
+			return &m_mcslock_nodes[i];
+		}
+	}
+	fprintf(stderr, "m_mcslock: more than %d locks held by one thread\n", 
+	        M_MCSLOCK_MAX_NESTING);
+	abort();
+}
+
+
+static inline void
+m_mcslock_lock(m_mcslock_t *lock)
+{
+	m_mcslock_node_t *node = m_mcslock_node_get();
+	m_mcslock_node_t *pred;
+	int              spins = 0;
+
+	pred = __atomic_exchange_n(&lock->tail, node, __ATOMIC_ACQ_REL);
+	if (pred) {
+		__atomic_store_n(&pred->next, node, __ATOMIC_RELEASE);
+		while (__atomic_load_n(&node->locked, __ATOMIC_ACQUIRE)) {
+			m_mcslock_spin(&spins);
+		}
+	}
+	lock->holder = node;
+}
+
+
+/* Returns 0 if the lock was taken, nonzero if it is held */
+static inline int
+m_mcslock_trylock(m_mcslock_t *lock)
+{
+	m_mcslock_node_t *node = m_mcslock_node_get();
+	m_mcslock_node_t *expected = NULL;
+
+	if (__atomic_compare_exchange_n(&lock->tail, &expected, node, 0, 
+	                                __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+	{
+		lock->holder = node;
+		return 0;
+	}
+	node->in_use = 0;
+	return 1;
+}
+
+
+static inline void
+m_mcslock_unlock(m_mcslock_t *lock)
+{
+	m_mcslock_node_t *node = lock->holder;
+	m_mcslock_node_t *next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE);
+	m_mcslock_node_t *expected;
+	int              spins = 0;
+
+	if (next == NULL) {
+		expected = node;
+		if (__atomic_compare_exchange_n(&lock->tail, &expected, NULL, 0, 
+		                                __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		{
+			node->in_use = 0;
+			return;
+		}
+		/* A waiter swapped itself in but has not linked behind us yet */
+		while ((next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE)) == NULL) {
+			m_mcslock_spin(&spins);
+		}
+	}
+	__atomic_store_n(&next->locked, 0, __ATOMIC_RELEASE);
+	node->in_use = 0;
+}
+
+#endif /* _M_MCSLOCK_H */
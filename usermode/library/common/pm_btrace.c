@@ -0,0 +1,148 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/**
+ * \file
+ *
+ * \brief Set up of the binary PM access trace (see pm_btrace.h).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "debug.h"
+#include "pm_btrace.h"
+
+pm_btrace_header_t           *pm_btrace_file = NULL;
+PM_BTRACE_TLS pm_btrace_tls_t pm_btrace_tls;
+
+static uint64_t pm_btrace_size;
+
+
+int
+pm_btrace_init(const char *path, int records_log2, uint64_t tsc_mhz)
+{
+	pm_btrace_header_t *hdr;
+	uint64_t            slot_size;
+	uint64_t            size;
+	uint32_t            lo, hi;
+	int                 fd;
+
+	slot_size = sizeof(pm_btrace_slot_t) + 
+	            (sizeof(pm_btrace_record_t) << records_log2);
+	size = PM_BTRACE_HEADER_SIZE + PM_BTRACE_MAX_THREADS * slot_size;
+
+	/* 
+	 * Truncate first so that a trace left by an earlier run does not 
+	 * show through; the file stays sparse until threads write to it.
+	 */
+	if ((fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0) {
+		return -1;
+	}
+	if (ftruncate(fd, size) != 0) {
+		close(fd);
+		return -1;
+	}
+	hdr = (pm_btrace_header_t *) mmap(NULL, size, PROT_READ | PROT_WRITE, 
+	                                  MAP_SHARED, fd, 0);
+	close(fd);
+	if (hdr == MAP_FAILED) {
+		return -1;
+	}
+
+	__asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+	hdr->version = PM_BTRACE_VERSION;
+	hdr->record_size = sizeof(pm_btrace_record_t);
+	hdr->max_threads = PM_BTRACE_MAX_THREADS;
+	hdr->records_log2 = records_log2;
+	hdr->slot_size = slot_size;
+	hdr->tsc_mhz = tsc_mhz;
+	hdr->start_tsc = ((uint64_t) hi << 32) | lo;
+	hdr->pid = getpid();
+	hdr->nthreads = 0;
+	/* The magic goes last: the decoder trusts a header only once it is set */
+	__asm__ __volatile__ ("" : : : "memory");
+	hdr->magic = PM_BTRACE_MAGIC;
+
+	pm_btrace_size = size;
+	pm_btrace_file = hdr;
+	return 0;
+}
+
+
+/* 
+ * Threads may still be recording while the library shuts down, so the 
+ * mapping is only written back; it goes away with the process.
+ */
+void
+pm_btrace_fini(void)
+{
+	if (pm_btrace_file) {
+		msync(pm_btrace_file, pm_btrace_size, MS_SYNC);
+	}
+}
+
+
+/* 
+ * Claims the next free slot for the calling thread. Once all slots are 
+ * taken, further threads are not traced.
+ */
+void
+pm_btrace_thread_attach(void)
+{
+	pm_btrace_header_t *hdr = pm_btrace_file;
+	pm_btrace_slot_t   *slot;
+	uint32_t            n;
+
+	if (hdr == NULL) {
+		return;
+	}
+	do {
+		n = hdr->nthreads;
+		if (n >= hdr->max_threads) {
+			return;
+		}
+	} while (!__sync_bool_compare_and_swap(&hdr->nthreads, n, n + 1));
+
+	slot = (pm_btrace_slot_t *) ((char *) hdr + PM_BTRACE_HEADER_SIZE + 
+	                             n * hdr->slot_size);
+	slot->tid = syscall(SYS_gettid);
+	slot->head = 0;
+	pm_btrace_tls.slot = slot;
+	pm_btrace_tls.mask = (1ULL << hdr->records_log2) - 1;
+	pm_btrace_tls.records = (pm_btrace_record_t *) (slot + 1);
+}
@@ -0,0 +1,181 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/**
+ * \file
+ *
+ * \brief Binary trace of PM accesses (the _ENABLE_BTRACE build).
+ *
+ * Each thread appends fixed-size records to its own ring in a file that 
+ * all of them share through a MAP_SHARED mapping, so recording takes no 
+ * lock, no formatting and no system call: a TSC read and four stores. 
+ * The file outlives a crash of the process and is decoded offline by 
+ * tool/pmtrace.
+ *
+ * Layout: a header page, then max_threads slots of slot_size bytes, each 
+ * a 64-byte slot header followed by 2^records_log2 records. A slot's head 
+ * counts every record the thread appended; once it exceeds the ring size 
+ * the oldest records have been overwritten.
+ */
+
+#ifndef _PM_BTRACE_H
+#define _PM_BTRACE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PM_BTRACE_MAGIC        0x45434152544d50ULL /* "PMTRACE" */
+#define PM_BTRACE_VERSION      1
+#define PM_BTRACE_MAX_THREADS  256
+#define PM_BTRACE_HEADER_SIZE  4096
+
+/* One per marker of pm_instr.h */
+enum {
+	PM_BT_WRITE = 1,   /* PM_W */
+	PM_BT_DWRITE,      /* PM_DW */
+	PM_BT_DI,          /* PM_DI */
+	PM_BT_READ,        /* PM_R */
+	PM_BT_NTI,         /* PM_I */
+	PM_BT_FLUSH,       /* PM_L */
+	PM_BT_FLUSHOPT,    /* PM_O */
+	PM_BT_TX_START,    /* PM_XS */
+	PM_BT_FENCE,       /* PM_N */
+	PM_BT_COMMIT,      /* PM_C */
+	PM_BT_BARRIER,     /* PM_B */
+	PM_BT_TX_END,      /* PM_XE */
+	PM_BT_NTYPES
+};
+
+typedef struct pm_btrace_header_s {
+	uint64_t          magic;
+	uint32_t          version;
+	uint32_t          record_size;
+	uint32_t          max_threads;
+	uint32_t          records_log2;
+	uint64_t          slot_size;
+	uint64_t          tsc_mhz;
+	uint64_t          start_tsc;
+	uint32_t          pid;
+	volatile uint32_t nthreads;
+} pm_btrace_header_t;
+
+typedef struct pm_btrace_slot_s {
+	volatile uint64_t head;
+	uint32_t          tid;
+	uint32_t          pad[13];
+} pm_btrace_slot_t;
+
+/* addr and size are zero for the delimiters, which carry neither */
+typedef struct pm_btrace_record_s {
+	uint64_t tsc;
+	uint64_t addr;
+	uint32_t size;
+	uint16_t type;
+	uint16_t reserved;
+} pm_btrace_record_t;
+
+/* Where the calling thread appends; all NULL until it first records */
+typedef struct pm_btrace_tls_s {
+	pm_btrace_slot_t   *slot;
+	pm_btrace_record_t *records;
+	uint64_t            mask;
+} pm_btrace_tls_t;
+
+/* Initial-exec, so that reaching the slot is a single %fs-relative load */
+#define PM_BTRACE_TLS __thread __attribute__((tls_model("initial-exec")))
+
+extern pm_btrace_header_t              *pm_btrace_file;
+extern PM_BTRACE_TLS pm_btrace_tls_t    pm_btrace_tls;
+
+int pm_btrace_init(const char *path, int records_log2, uint64_t tsc_mhz);
+void pm_btrace_fini(void);
+void pm_btrace_thread_attach(void);
+
+/* 
+ * Markers are string literals, so after inlining this folds to a 
+ * constant and the record's type costs nothing.
+ */
+static inline __attribute__((always_inline))
+int
+pm_btrace_marker_type(const char *marker)
+{
+	switch (marker[3]) {
+		case 'W': return PM_BT_WRITE;
+		case 'D': return marker[4] == 'W' ? PM_BT_DWRITE : PM_BT_DI;
+		case 'R': return PM_BT_READ;
+		case 'I': return PM_BT_NTI;
+		case 'L': return PM_BT_FLUSH;
+		case 'O': return PM_BT_FLUSHOPT;
+		case 'X': return marker[4] == 'S' ? PM_BT_TX_START : PM_BT_TX_END;
+		case 'N': return PM_BT_FENCE;
+		case 'C': return PM_BT_COMMIT;
+		default:  return PM_BT_BARRIER;
+	}
+}
+
+static inline __attribute__((always_inline))
+void
+pm_btrace_record(int type, uint64_t addr, uint64_t size)
+{
+	pm_btrace_record_t *r;
+	uint64_t            head;
+	uint32_t            lo, hi;
+
+	if (__builtin_expect(pm_btrace_tls.records == NULL, 0)) {
+		pm_btrace_thread_attach();
+		if (pm_btrace_tls.records == NULL) {
+			return;
+		}
+	}
+	if (type >= PM_BT_TX_START) {
+		addr = size = 0;
+	}
+	__asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+	head = pm_btrace_tls.slot->head;
+	r = &pm_btrace_tls.records[head & pm_btrace_tls.mask];
+	r->tsc = ((uint64_t) hi << 32) | lo;
+	r->addr = addr;
+	r->size = (uint32_t) size;
+	r->type = (uint16_t) type;
+	/* Publish the record only after it is complete */
+	__asm__ __volatile__ ("" : : : "memory");
+	pm_btrace_tls.slot->head = head + 1;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _PM_BTRACE_H */
@@ -132,6 +132,25 @@
                 write(trace_marker, tstr+4, tsz-4);                             \
         }                                                                       \
     }
+#elif _ENABLE_BTRACE
+/* 
+ * Binary per-thread trace, see pm_btrace.h. Only the marker, the address 
+ * and the size are kept: the format, the thread id and the location are 
+ * dropped, so nothing is formatted on the hot path. The size of PM_I, 
+ * PM_L and PM_O is their count, which follows done/copied; the trailing 
+ * 0 gives the delimiters, which have neither, enough arguments.
+ */
+#include <pm_btrace.h>
+#define TENTRY_ID (int)0
+#define pm_trace_print(format, args ...)					\
+	__pm_btrace_print(args, 0)
+#define __pm_btrace_print(id, marker, addr, a, b, rest ...)			\
+	pm_btrace_record(pm_btrace_marker_type(marker),				\
+	                 (uint64_t) (uintptr_t) (addr),				\
+	                 pm_btrace_marker_type(marker) == PM_BT_NTI ||		\
+	                 pm_btrace_marker_type(marker) == PM_BT_FLUSH ||	\
+	                 pm_btrace_marker_type(marker) == PM_BT_FLUSHOPT ?	\
+	                 (uint64_t) (uintptr_t) (b) : (uint64_t) (uintptr_t) (a))
 #else
 #define TENTRY_ID (int)0
 #define pm_trace_print(format, args ...)					\
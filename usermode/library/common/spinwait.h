@@ -0,0 +1,190 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/**
+ * \file spinwait.h
+ *
+ * \brief Adaptive waiting: spin with exponential backoff, then park.
+ *
+ * A waiter polls its condition with PAUSE spins that double in length up
+ * to M_SPINWAIT_SPIN_LIMIT, which rides out short waits without a system
+ * call. Past that it parks on a futex until woken or M_SPINWAIT_PARK_NS
+ * pass, so waiters on an oversubscribed host give their CPU to the thread
+ * they wait for instead of spinning or yielding against it.
+ *
+ * Waiters park in a hashed table of wait queues keyed by the address of 
+ * what they wait on. Whoever changes that state calls m_spinwait_wake 
+ * with the same address; it costs a fence and one load when nobody is 
+ * parked anywhere. Wakeups are hints: the timeout bounds a lost one and 
+ * waiters always recheck their condition.
+ *
+ *   m_spinwait_t w;
+ *
+ *   m_spinwait_init(&w, key);
+ *   while (!condition) {
+ *       m_spinwait_pause(&w);
+ *   }
+ *   m_spinwait_done(&w);
+ */
+
+#ifndef _M_SPINWAIT_H
+#define _M_SPINWAIT_H
+
+#include <stdint.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+/* Longest backoff, in PAUSE iterations, before a waiter parks */
+#define M_SPINWAIT_SPIN_LIMIT  4096
+
+/* Longest a parked waiter sleeps before rechecking its condition */
+#define M_SPINWAIT_PARK_NS     1000000
+
+/* Number of wait queues in the parking table (power of two) */
+#define M_SPINWAIT_QUEUES      256
+
+typedef struct m_spinwait_queue_s m_spinwait_queue_t;
+typedef struct m_spinwait_s m_spinwait_t;
+
+struct m_spinwait_queue_s {
+	volatile uint32_t   seq;      /**< futex word; bumped by every wakeup */
+	volatile uint32_t   waiters;  /**< threads parked or about to park here */
+} __attribute__((aligned(64)));
+
+struct m_spinwait_s {
+	m_spinwait_queue_t  *queue;   /**< queue of the key waited on */
+	uint32_t            spins;    /**< length of the next backoff */
+	uint32_t            seq;      /**< queue->seq when the condition was last checked */
+	int                 parked;   /**< registered as a waiter of queue */
+};
+
+extern m_spinwait_queue_t m_spinwait_queues[M_SPINWAIT_QUEUES];
+extern volatile uint32_t  m_spinwait_parked;
+
+
+static inline m_spinwait_queue_t *
+m_spinwait_queue(const volatile void *key)
+{
+	uintptr_t h = (uintptr_t) key;
+
+	h ^= h >> 17;
+	h *= 0x9E3779B97F4A7C15ULL;
+	return &m_spinwait_queues[(h >> 32) & (M_SPINWAIT_QUEUES - 1)];
+}
+
+
+static inline void
+m_spinwait_init(m_spinwait_t *w, const volatile void *key)
+{
+	w->queue = m_spinwait_queue(key);
+	w->spins = 1;
+	w->parked = 0;
+}
+
+
+/**
+ * Waits a little before the caller rechecks its condition. Spins first; 
+ * once the backoff is exhausted registers as a waiter and returns at 
+ * once, so the condition is rechecked after registering, and from then 
+ * on sleeps until woken.
+ */
+static inline void
+m_spinwait_pause(m_spinwait_t *w)
+{
+	struct timespec timeout = { 0, M_SPINWAIT_PARK_NS };
+	uint32_t        i;
+
+	if (w->spins <= M_SPINWAIT_SPIN_LIMIT) {
+		for (i = 0; i < w->spins; i++) {
+			__builtin_ia32_pause();
+		}
+		w->spins <<= 1;
+		return;
+	}
+	if (!w->parked) {
+		w->parked = 1;
+		__sync_fetch_and_add(&m_spinwait_parked, 1);
+		__sync_fetch_and_add(&w->queue->waiters, 1);
+		w->seq = w->queue->seq;
+		return;
+	}
+	syscall(SYS_futex, &w->queue->seq, FUTEX_WAIT_PRIVATE, w->seq, &timeout, NULL, 0);
+	w->seq = w->queue->seq;
+}
+
+
+static inline void
+m_spinwait_done(m_spinwait_t *w)
+{
+	if (w->parked) {
+		__sync_fetch_and_sub(&w->queue->waiters, 1);
+		__sync_fetch_and_sub(&m_spinwait_parked, 1);
+		w->parked = 0;
+	}
+}
+
+
+/** True if some thread may be parked; orders the caller's stores before */
+static inline int
+m_spinwait_any_parked(void)
+{
+	__sync_synchronize();
+	return m_spinwait_parked != 0;
+}
+
+
+/** Wakes the threads parked on key, without the fence of m_spinwait_wake */
+static inline void
+m_spinwait_wake_nofence(const volatile void *key)
+{
+	m_spinwait_queue_t *q = m_spinwait_queue(key);
+
+	if (q->waiters) {
+		__sync_fetch_and_add(&q->seq, 1);
+		syscall(SYS_futex, &q->seq, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+	}
+}
+
+
+/** Wakes the threads parked on key after the state they wait on changed */
+static inline void
+m_spinwait_wake(const volatile void *key)
+{
+	if (m_spinwait_any_parked()) {
+		m_spinwait_wake_nofence(key);
+	}
+}
+
+#endif /* _M_SPINWAIT_H */
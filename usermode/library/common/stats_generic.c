@@ -47,7 +47,7 @@
 #include <stdbool.h>
 #include <string.h>
 #include "stats_generic.h"
-#include "chhash.h"
+#include "flathash.h"
 #include "util.h"
 #include "debug.h"
 
@@ -72,7 +72,7 @@ static const char __whitespaces[] = "
 struct m_stats_threadstat_s {
     unsigned int tid;
 	m_stats_statset_t           summary_statset; /**< Statistics summary */
-	m_chhash_t                  *stats_table; /**< Collected statistics */
+	m_flathash_t                  *stats_table; /**< Collected statistics */
 	struct m_stats_threadstat_s *next;     /**< Used to implement the list of thread statistics. */
 	struct m_stats_threadstat_s *prev;     /**< Used to implement the list of thread statistics. */
 };
@@ -155,8 +155,8 @@ m_stats_threadstat_create(m_statsmgr_t *statsmgr,
 
 	m_stats_statset_init(&(threadstat->summary_statset), NULL);
 	threadstat->tid = tid;
-	m_chhash_create(&threadstat->stats_table, 
-	                M_STATS_THREADSTAT_HASHTABLE_SIZE, 
+	m_flathash_create(&threadstat->stats_table, 
+	                  M_STATS_THREADSTAT_HASHTABLE_SIZE, 
 					false);
 	*threadstatp = threadstat;
 	return M_R_SUCCESS;					  
@@ -214,16 +214,16 @@ m_stats_statset_init(m_stats_statset_t *statset,
 
 static
 m_result_t
-stats_get_statset(m_chhash_t *stats_table,
+stats_get_statset(m_flathash_t *stats_table,
                   char *name, 
                   m_stats_statset_t **statsetp)
 {
-	m_chhash_key_t    key;
-	m_chhash_value_t  value;
+	m_flathash_key_t    key;
+	m_flathash_value_t  value;
 	m_stats_statset_t *statset;
 
-	key = (m_chhash_key_t) name;
-	if (m_chhash_lookup(stats_table, key, &value) == M_R_SUCCESS)
+	key = (m_flathash_key_t) name;
+	if (m_flathash_lookup(stats_table, key, &value) == M_R_SUCCESS)
 	{
 		statset = (m_stats_statset_t *) value;	
 		*statsetp = statset;
@@ -264,9 +264,9 @@ m_stats_threadstat_aggregate(m_stats_threadstat_t *threadstat, m_stats_statset_t
 	if (result != M_R_SUCCESS) {
 		m_stats_statset_create(&statset_all);
 		m_stats_statset_init(statset_all, source_statset->name);
-		m_chhash_add(threadstat->stats_table, 
-		             source_statset->name, 
-		             (m_chhash_value_t) (statset_all));
+		m_flathash_add(threadstat->stats_table, 
+		               source_statset->name, 
+		               (m_flathash_value_t) (statset_all));
 	}
 
 	
@@ -338,9 +338,9 @@ void
 stats_threadstat_print(FILE *fout, 
                        m_stats_threadstat_t *threadstat) 
 {
-	m_chhash_iter_t   iter;
-	m_chhash_key_t    key;
-	m_chhash_value_t  value;
+	m_flathash_iter_t   iter;
+	m_flathash_key_t    key;
+	m_flathash_value_t  value;
 	m_stats_statset_t *statset;
 	m_stats_statset_t statset_all;
 	int               i;
@@ -350,8 +350,8 @@ stats_threadstat_print(FILE *fout,
 	fprintf(fout, "\n");
 	fprintf(fout, "  Transactions for thread %u\n\n", threadstat->tid);
 	
-	m_chhash_iter_init(threadstat->stats_table, &iter);
-	while(M_R_SUCCESS == m_chhash_iter_next(&iter, &key, &value)) {
+	m_flathash_iter_init(threadstat->stats_table, &iter);
+	while(M_R_SUCCESS == m_flathash_iter_next(&iter, &key, &value)) {
 		statset = (m_stats_statset_t *) value;
 		m_stats_statset_print(fout, statset, 4, true);
 		fprintf(fout, "\n");
@@ -364,11 +364,11 @@ void
 stats_summarize_all(m_statsmgr_t *statsmgr, m_stats_threadstat_t *summary)
 {
 	m_stats_threadstat_t *threadstat;
-	m_chhash_iter_t      iter;
+	m_flathash_iter_t      iter;
 	m_stats_statset_t    *statset;
 	m_stats_statset_t    *statset_summary;
-	m_chhash_key_t       key;
-	m_chhash_value_t     value;
+	m_flathash_key_t       key;
+	m_flathash_value_t     value;
 	int                  i;
 	m_result_t           result;
 
@@ -377,17 +377,17 @@ stats_summarize_all(m_statsmgr_t *statsmgr, m_stats_threadstat_t *summary)
 	     threadstat;
 		 threadstat = threadstat->next)
 	{
-		m_chhash_iter_init(threadstat->stats_table, &iter);
-		while(M_R_SUCCESS == m_chhash_iter_next(&iter, &key, &value)) {
+		m_flathash_iter_init(threadstat->stats_table, &iter);
+		while(M_R_SUCCESS == m_flathash_iter_next(&iter, &key, &value)) {
 			statset = (m_stats_statset_t *) value;
 			result = stats_get_statset(summary->stats_table, 
 			                           statset->name, &statset_summary);
 			if (result != M_R_SUCCESS) {
 				m_stats_statset_create(&statset_summary);
 				m_stats_statset_init(statset_summary, statset->name);
-				m_chhash_add(summary->stats_table, 
+				m_flathash_add(summary->stats_table, 
 			                 statset->name, 
-			                 (m_chhash_value_t) (statset_summary));
+			                 (m_flathash_value_t) (statset_summary));
 			}
 			statset_summary->count += statset->count;
 			summary->summary_statset.count += statset->count;
@@ -423,11 +423,11 @@ stats_summarize_all(m_statsmgr_t *statsmgr, m_stats_threadstat_t *summary)
 void
 m_stats_print(m_statsmgr_t *statsmgr)
 {
-	m_chhash_iter_t      iter;
+	m_flathash_iter_t      iter;
 	m_stats_threadstat_t *threadstat;
 	m_stats_threadstat_t summary;
-	m_chhash_key_t       key;
-	m_chhash_value_t     value;
+	m_flathash_key_t       key;
+	m_flathash_value_t     value;
 	m_stats_statset_t    *statset;
 	m_stats_statset_t    statset_grand_total;
 	int                  i;
@@ -452,13 +452,13 @@ m_stats_print(m_statsmgr_t *statsmgr)
 
 	/* Print per TRANSACTION totals */
 	fprintf(fout, "TRANSACTION TOTALS\n\n");
-	m_chhash_create(&(summary.stats_table),
-	                M_STATS_THREADSTAT_HASHTABLE_SIZE, 
+	m_flathash_create(&(summary.stats_table),
+	                  M_STATS_THREADSTAT_HASHTABLE_SIZE, 
                     false);
 	m_stats_statset_init(&summary.summary_statset, NULL);					  
 	stats_summarize_all(statsmgr, &summary);
-	m_chhash_iter_init(summary.stats_table, &iter);
-	while(M_R_SUCCESS == m_chhash_iter_next(&iter, &key, &value)) {
+	m_flathash_iter_init(summary.stats_table, &iter);
+	while(M_R_SUCCESS == m_flathash_iter_next(&iter, &key, &value)) {
 		statset = (m_stats_statset_t *) value;
 		m_stats_statset_print(fout, statset, 0, true);
 		fprintf(fout, "\n");
@@ -0,0 +1,77 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/**
+ * \file
+ *
+ * \brief Static tracepoints (the _ENABLE_USDT build).
+ *
+ * USDT probes of the mnemosyne provider, for perf, bpftrace or 
+ * SystemTap to attach to:
+ *
+ *   tx__begin(tx, prop)              outermost transaction begins
+ *   tx__commit(tx, sqn)              outermost transaction committed
+ *   tx__abort(tx, reason)            transaction restarts (mtm_restart_reason)
+ *   log__flush(log)                  commit flushes a physical log
+ *   log__full__wait__begin(log)      log full, waiting for truncation
+ *   log__full__wait__end(log, ns)
+ *   trunc__pass__begin()             background truncation pass
+ *   trunc__pass__end(us)
+ *   recovery__begin(nlogs)           log recovery at startup
+ *   recovery__progress(nfragments)   a log fragment replayed
+ *   recovery__end(nfragments)
+ *
+ * A disabled probe is a nop instruction and a note in the binary. Built 
+ * without _ENABLE_USDT, or without <sys/sdt.h>, the probes compile away.
+ */
+
+#ifndef _M_USDT_H
+#define _M_USDT_H
+
+#if defined(_ENABLE_USDT) && defined(__has_include)
+# if __has_include(<sys/sdt.h>)
+#  include <sys/sdt.h>
+#  define M_USDT_ENABLED
+# endif
+#endif
+
+#ifdef M_USDT_ENABLED
+# define M_PROBE(name)                 DTRACE_PROBE(mnemosyne, name)
+# define M_PROBE1(name, a)             DTRACE_PROBE1(mnemosyne, name, a)
+# define M_PROBE2(name, a, b)          DTRACE_PROBE2(mnemosyne, name, a, b)
+#else
+# define M_PROBE(name)                 do { } while (0)
+# define M_PROBE1(name, a)             do { } while (0)
+# define M_PROBE2(name, a, b)          do { } while (0)
+#endif
+
+#endif /* _M_USDT_H */
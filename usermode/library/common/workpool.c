@@ -0,0 +1,335 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/**
+ * \file workpool.c
+ *
+ * \brief Worker pool with per-worker queues and work stealing.
+ */
+
+#include <stdlib.h>
+#include "mcslock.h"
+#include "result.h"
+#include "util.h"
+#include "workpool.h"
+
+typedef struct m_workpool_task_s m_workpool_task_t;
+
+struct m_workpool_task_s {
+	m_workpool_fn_t   fn;
+	void              *arg;
+	m_workpool_task_t *next;
+};
+
+typedef struct m_workpool_queue_s {
+	m_mcslock_t       lock;
+	m_workpool_task_t *head;
+	m_workpool_task_t *tail;
+} __attribute__((aligned(64))) m_workpool_queue_t;
+
+typedef struct m_workpool_worker_s {
+	m_workpool_t      *pool;
+	int               id;
+	pthread_t         thread;
+} m_workpool_worker_t;
+
+struct m_workpool_s {
+	int                 nworkers;
+	m_workpool_worker_t *workers;
+	m_workpool_queue_t  *queues;      /**< one per worker, and one when there is none */
+	int                 nqueues;
+	volatile int        queued;      /**< tasks in the queues */
+	volatile int        pending;     /**< tasks submitted and not finished */
+	volatile int        nparked;     /**< workers parked on park_cv */
+	volatile int        stop;
+	volatile unsigned   next_queue;  /**< queue of the next task submitted from outside */
+	pthread_mutex_t     park_lock;
+	pthread_cond_t      park_cv;     /**< tasks were queued */
+	pthread_cond_t      done_cv;     /**< pending dropped to zero */
+};
+
+/* Worker the running thread is, and of which pool */
+static __thread m_workpool_t *self_pool;
+static __thread int          self_id;
+
+
+static void
+queue_push(m_workpool_queue_t *q, m_workpool_task_t *task)
+{
+	task->next = NULL;
+	m_mcslock_lock(&q->lock);
+	if (q->tail) {
+		q->tail->next = task;
+	} else {
+		q->head = task;
+	}
+	q->tail = task;
+	m_mcslock_unlock(&q->lock);
+}
+
+
+static m_workpool_task_t *
+queue_pop(m_workpool_queue_t *q)
+{
+	m_workpool_task_t *task;
+
+	/* Peek first so that thieves do not queue up on empty queues */
+	if (q->head == NULL) {
+		return NULL;
+	}
+	m_mcslock_lock(&q->lock);
+	if ((task = q->head) != NULL) {
+		if ((q->head = task->next) == NULL) {
+			q->tail = NULL;
+		}
+	}
+	m_mcslock_unlock(&q->lock);
+	return task;
+}
+
+
+/* Takes a task from queue first, then from the others in turn */
+static m_workpool_task_t *
+take_task(m_workpool_t *pool, int first)
+{
+	m_workpool_task_t *task;
+	int               i;
+
+	for (i = 0; i < pool->nqueues; i++) {
+		if ((task = queue_pop(&pool->queues[(first + i) % pool->nqueues])) != NULL) {
+			__sync_sub_and_fetch(&pool->queued, 1);
+			return task;
+		}
+	}
+	return NULL;
+}
+
+
+static void
+run_task(m_workpool_t *pool, m_workpool_task_t *task)
+{
+	task->fn(task->arg);
+	FREE(task);
+	if (__sync_sub_and_fetch(&pool->pending, 1) == 0) {
+		pthread_mutex_lock(&pool->park_lock);
+		pthread_cond_broadcast(&pool->done_cv);
+		pthread_mutex_unlock(&pool->park_lock);
+	}
+}
+
+
+static void *
+worker_main(void *arg)
+{
+	m_workpool_worker_t *worker = (m_workpool_worker_t *) arg;
+	m_workpool_t        *pool = worker->pool;
+	m_workpool_task_t   *task;
+	int                 spins = 0;
+
+	self_pool = pool;
+	self_id = worker->id;
+	while (!pool->stop) {
+		if ((task = take_task(pool, worker->id)) != NULL) {
+			run_task(pool, task);
+			spins = 0;
+			continue;
+		}
+		if (++spins < M_WORKPOOL_SPINS) {
+			__builtin_ia32_pause();
+			continue;
+		}
+		pthread_mutex_lock(&pool->park_lock);
+		__sync_add_and_fetch(&pool->nparked, 1);
+		while (!pool->stop && pool->queued == 0) {
+			pthread_cond_wait(&pool->park_cv, &pool->park_lock);
+		}
+		__sync_sub_and_fetch(&pool->nparked, 1);
+		pthread_mutex_unlock(&pool->park_lock);
+		spins = 0;
+	}
+	return NULL;
+}
+
+
+m_result_t
+m_workpool_create(m_workpool_t **poolp, int nworkers)
+{
+	m_workpool_t *pool;
+	int          i;
+
+	if (nworkers < 0) {
+		nworkers = 0;
+	}
+	if ((pool = (m_workpool_t *) CALLOC(1, sizeof(m_workpool_t))) == NULL) {
+		return M_R_NOMEMORY;
+	}
+	pool->nworkers = nworkers;
+	pool->nqueues = nworkers > 0 ? nworkers : 1;
+	if (posix_memalign((void **) &pool->queues, 64, 
+	                   pool->nqueues * sizeof(m_workpool_queue_t)) != 0) 
+	{
+		FREE(pool);
+		return M_R_NOMEMORY;
+	}
+	for (i = 0; i < pool->nqueues; i++) {
+		m_mcslock_init(&pool->queues[i].lock);
+		pool->queues[i].head = pool->queues[i].tail = NULL;
+	}
+	pthread_mutex_init(&pool->park_lock, NULL);
+	pthread_cond_init(&pool->park_cv, NULL);
+	pthread_cond_init(&pool->done_cv, NULL);
+	if (nworkers > 0 && 
+	    (pool->workers = (m_workpool_worker_t *) CALLOC(nworkers, sizeof(m_workpool_worker_t))) == NULL) 
+	{
+		FREE(pool->queues);
+		FREE(pool);
+		return M_R_NOMEMORY;
+	}
+	for (i = 0; i < nworkers; i++) {
+		pool->workers[i].pool = pool;
+		pool->workers[i].id = i;
+		if (pthread_create(&pool->workers[i].thread, NULL, worker_main, &pool->workers[i]) != 0) {
+			/* Run with the workers we got */
+			pool->nworkers = i;
+			break;
+		}
+	}
+	*poolp = pool;
+	return M_R_SUCCESS;
+}
+
+
+void
+m_workpool_destroy(m_workpool_t *pool)
+{
+	int i;
+
+	m_workpool_wait(pool);
+	pthread_mutex_lock(&pool->park_lock);
+	pool->stop = 1;
+	pthread_cond_broadcast(&pool->park_cv);
+	pthread_mutex_unlock(&pool->park_lock);
+	for (i = 0; i < pool->nworkers; i++) {
+		pthread_join(pool->workers[i].thread, NULL);
+	}
+	pthread_mutex_destroy(&pool->park_lock);
+	pthread_cond_destroy(&pool->park_cv);
+	pthread_cond_destroy(&pool->done_cv);
+	FREE(pool->workers);
+	FREE(pool->queues);
+	FREE(pool);
+}
+
+
+m_result_t
+m_workpool_submit(m_workpool_t *pool, m_workpool_fn_t fn, void *arg)
+{
+	m_workpool_task_t *task;
+	int               q;
+
+	if ((task = (m_workpool_task_t *) MALLOC(sizeof(m_workpool_task_t))) == NULL) {
+		return M_R_NOMEMORY;
+	}
+	task->fn = fn;
+	task->arg = arg;
+	if (self_pool == pool) {
+		q = self_id;
+	} else {
+		q = __sync_fetch_and_add(&pool->next_queue, 1) % pool->nqueues;
+	}
+	__sync_add_and_fetch(&pool->pending, 1);
+	queue_push(&pool->queues[q], task);
+	/* Pairs with the check of queued by a parking worker */
+	__sync_add_and_fetch(&pool->queued, 1);
+	if (pool->nparked > 0) {
+		pthread_mutex_lock(&pool->park_lock);
+		pthread_cond_signal(&pool->park_cv);
+		pthread_mutex_unlock(&pool->park_lock);
+	}
+	return M_R_SUCCESS;
+}
+
+
+void
+m_workpool_wait(m_workpool_t *pool)
+{
+	m_workpool_task_t *task;
+
+	while (pool->pending > 0) {
+		if ((task = take_task(pool, 0)) != NULL) {
+			run_task(pool, task);
+			continue;
+		}
+		/* What is left is running on the workers */
+		pthread_mutex_lock(&pool->park_lock);
+		while (pool->pending > 0 && pool->queued == 0) {
+			pthread_cond_wait(&pool->done_cv, &pool->park_lock);
+		}
+		pthread_mutex_unlock(&pool->park_lock);
+	}
+}
+
+
+typedef struct {
+	m_workpool_for_fn_t fn;
+	void                *arg;
+	int                 n;
+	volatile int        next;
+} parallel_for_t;
+
+
+static void
+parallel_for_task(void *arg)
+{
+	parallel_for_t *pf = (parallel_for_t *) arg;
+	int            i;
+
+	while ((i = __sync_fetch_and_add(&pf->next, 1)) < pf->n) {
+		pf->fn(pf->arg, i);
+	}
+}
+
+
+void
+m_workpool_parallel_for(m_workpool_t *pool, int n, m_workpool_for_fn_t fn, void *arg)
+{
+	parallel_for_t pf = { fn, arg, n, 0 };
+	int            i;
+
+	for (i = 0; i < pool->nworkers && i < n - 1; i++) {
+		if (m_workpool_submit(pool, parallel_for_task, &pf) != M_R_SUCCESS) {
+			break;
+		}
+	}
+	parallel_for_task(&pf);
+	m_workpool_wait(pool);
+}
@@ -0,0 +1,147 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/**
+ * \file workpool.h
+ *
+ * \brief Worker pool and barrier shared by the runtime's parallel phases.
+ *
+ * A pool runs tasks on a fixed set of worker threads. Each worker has its
+ * own queue; a worker that runs out of tasks steals from the others, and 
+ * parks after spinning a while with nothing to steal. Tasks submitted by 
+ * a worker go to its own queue, others are spread over all of them.
+ * m_workpool_wait lets the caller help run tasks until all are done.
+ *
+ * The barrier is sense-reversing: the last thread to arrive flips the 
+ * barrier's sense, which the others spin on, then park on, for a while.
+ */
+
+#ifndef _M_WORKPOOL_H
+#define _M_WORKPOOL_H
+
+#include <pthread.h>
+#include "result.h"
+
+/* Polls before a waiting thread parks */
+#define M_WORKPOOL_SPINS 4096
+
+typedef void (*m_workpool_fn_t)(void *arg);
+typedef void (*m_workpool_for_fn_t)(void *arg, int i);
+
+typedef struct m_workpool_s m_workpool_t;
+
+
+/** 
+ * \brief Starts a pool of nworkers threads. A pool with no workers runs 
+ * the tasks in m_workpool_wait.
+ */
+m_result_t m_workpool_create(m_workpool_t **poolp, int nworkers);
+
+/** \brief Waits for the queued tasks to finish and stops the workers. */
+void m_workpool_destroy(m_workpool_t *pool);
+
+/** \brief Queues fn(arg). Returns M_R_NOMEMORY if the task cannot be queued. */
+m_result_t m_workpool_submit(m_workpool_t *pool, m_workpool_fn_t fn, void *arg);
+
+/** \brief Runs queued tasks until every submitted task has finished. */
+void m_workpool_wait(m_workpool_t *pool);
+
+/** 
+ * \brief Runs fn(arg, i) for i from 0 to n-1 on the workers and the 
+ * caller, each taking the next index when done with the last.
+ */
+void m_workpool_parallel_for(m_workpool_t *pool, int n, m_workpool_for_fn_t fn, void *arg);
+
+
+typedef struct m_barrier_s m_barrier_t;
+
+struct m_barrier_s {
+	int             count;      /**< threads taking part */
+	volatile int    remaining;  /**< threads yet to arrive in this phase */
+	volatile int    sense;      /**< flipped by the last thread to arrive */
+	pthread_mutex_t lock;
+	pthread_cond_t  cv;         /**< parked waiters */
+};
+
+
+static inline void
+m_barrier_init(m_barrier_t *b, int count)
+{
+	b->count = count;
+	b->remaining = count;
+	b->sense = 0;
+	pthread_mutex_init(&b->lock, NULL);
+	pthread_cond_init(&b->cv, NULL);
+}
+
+
+static inline void
+m_barrier_destroy(m_barrier_t *b)
+{
+	pthread_mutex_destroy(&b->lock);
+	pthread_cond_destroy(&b->cv);
+}
+
+
+/** 
+ * \brief Waits for all threads to arrive. Returns 1 in the last thread 
+ * to arrive and 0 in the others.
+ */
+static inline int
+m_barrier_wait(m_barrier_t *b)
+{
+	int sense = b->sense;
+	int spins;
+
+	if (__sync_sub_and_fetch(&b->remaining, 1) == 0) {
+		b->remaining = b->count;
+		pthread_mutex_lock(&b->lock);
+		__atomic_store_n(&b->sense, !sense, __ATOMIC_RELEASE);
+		pthread_cond_broadcast(&b->cv);
+		pthread_mutex_unlock(&b->lock);
+		return 1;
+	}
+	for (spins = 0; spins < M_WORKPOOL_SPINS; spins++) {
+		if (__atomic_load_n(&b->sense, __ATOMIC_ACQUIRE) != sense) {
+			return 0;
+		}
+		__builtin_ia32_pause();
+	}
+	pthread_mutex_lock(&b->lock);
+	while (b->sense == sense) {
+		pthread_cond_wait(&b->cv, &b->lock);
+	}
+	pthread_mutex_unlock(&b->lock);
+	return 0;
+}
+
+#endif /* _M_WORKPOOL_H */
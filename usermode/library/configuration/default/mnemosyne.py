@@ -38,3 +38,14 @@ M_PCM_LATENCY_WRITE = 150
 ########################################################################
 
 M_PCM_BANDWIDTH_MB = 1200
+
+########################################################################
+# PHYSICAL_LOG_NUM_ENTRIES_LOG2 (default=20): size of each physical log,
+#   as the log2 of the number of (8-byte) words it holds.  Logs are 
+#   mapped 32 at a time as threads need them, from a pool with room 
+#   for up to 1024 logs of 16MB.  The log_size_log2 runtime setting 
+#   overrides it; each log records the size it was formatted with, and 
+#   the slot size is fixed when the pool is first created.
+########################################################################
+
+PHYSICAL_LOG_NUM_ENTRIES_LOG2 = 20
@@ -9,14 +9,21 @@
 ########################################################################
 # ALLOW_ABORTS: Allows transaction aborts. When disabled and 
 #   combined with no-isolation, the TM system does not need to perform 
-#   version management for volatile data.
+#   version management for volatile data, and a transaction without
+#   isolation that aborts is a fatal error.
 ########################################################################
 
-ALLOW_ABORTS = False
+ALLOW_ABORTS = True
 
 ########################################################################
 # SYNC_TRUNCATION: Synchronously flushes the write set out of the HW
 #   cache and truncates the persistent log. 
+#
+#   When disabled, commit returns once the log is durable, and the log
+#   truncation threads flush the written cache lines and truncate the 
+#   logs in batches, every log_truncation_period_ms (runtime setting). 
+#   mtm_sync() waits for the home locations of the transactions 
+#   committed so far to be durable.
 ########################################################################
 
 SYNC_TRUNCATION = True
@@ -28,9 +35,15 @@ SYNC_TRUNCATION = True
 #   each transaction commit/abort to properly keep track of the log 
 #   limits.
 #   
-# TMLOG_TYPE_TORNBIT: a log that reserves a torn bit per 64-bit word to 
-#   detect writes that did not make it to persistent storage. Does not
-#   require updating the tail on each transaction commit/abort.
+# TMLOG_TYPE_TORNBIT: a log that reserves a header word per 64-byte chunk,
+#   holding a torn bit and a checksum of the chunk, to detect writes that 
+#   did not make it to persistent storage. Does not require updating the 
+#   tail on each transaction commit/abort.
+#
+# TMLOG_TYPE_CHECKSUM: a log that ends each transaction's log fragment 
+#   with a CRC32C of the fragment to detect writes that did not make it
+#   to persistent storage. Does not require updating the tail on each 
+#   transaction commit/abort. Requires SSE4.2.
 ########################################################################
 
 TMLOG_TYPE = 'TMLOG_TYPE_BASE'
@@ -39,12 +52,35 @@ TMLOG_TYPE = 'TMLOG_TYPE_BASE'
 ########################################################################
 # FLUSH_CACHELINE_ONCE: When asynchronously truncating the log, the log 
 #   manager flushes each cacheline of the write set only once by keeping 
-#   track flushed cachelines. This adds some bookkeeping overhead which 
-#   for some workloads might be worse than simply flushing a cacheline 
-#   multiple times.
+#   track flushed cachelines. The set is an open-addressing table probed 
+#   a cacheline of keys at a time and cleared in constant time, so the 
+#   bookkeeping costs less than a repeated flush.
 ########################################################################
 
-FLUSH_CACHELINE_ONCE = False
+FLUSH_CACHELINE_ONCE = True
+
+########################################################################
+# READ_SET_FILTER: Keep a per-transaction bloom filter (a 256-bit 
+#   signature) over the locks in the read set. A write to a stripe whose
+#   version is newer than the snapshot must know whether the stripe has 
+#   been read; with the filter the common not-read case costs a couple 
+#   of bit tests instead of a scan of the whole read set. False 
+#   positives fall back to the scan and are counted in the statistics 
+#   (rsfilter_false_positives).
+########################################################################
+
+READ_SET_FILTER = True
+
+########################################################################
+# WRITE_SET_INDEX: Keep a per-transaction hash index from written 
+#   address to write-set entry (and from cacheline to the last entry 
+#   written in it). Read-after-write and write-after-write lookups then 
+#   cost a hash probe instead of a walk of the chain of entries covered 
+#   by the same lock, which pays off for transactions with large write 
+#   sets. The index is cleared at transaction start.
+########################################################################
+
+WRITE_SET_INDEX = False
 
 ########################################################################
 ########################################################################
@@ -102,8 +138,10 @@ WAIT_YIELD = True
 ########################################################################
 # Use an epoch-based memory allocator and garbage collector to ensure
 # that accesses to the dynamic memory allocated by a transaction from
-# another transaction are valid.  There is a slight overhead from
-# enabling this feature.
+# another transaction are valid.  Blocks freed by transactions, with
+# free or pfree, are only reused once every transaction that might still
+# read them has finished.  There is a slight overhead from enabling this
+# feature.
 ########################################################################
 
 EPOCH_GC = False
@@ -129,6 +167,16 @@ CONFLICT_TRACKING = False
 
 READ_LOCKED_DATA = False
 
+########################################################################
+# Count commits globally as they begin and finish, so that extending
+# the snapshot or committing can skip revalidating the read set when no
+# other transaction has begun committing since it was last validated
+# with no commit in flight.  Saves the read-set walk for long read-mostly
+# transactions at the cost of two atomic increments per update commit.
+########################################################################
+
+INCREMENTAL_VALIDATION = False
+
 ########################################################################
 # Tweak the hash function that maps addresses to locks so that
 # consecutive addresses do not map to consecutive locks.  This can avoid
@@ -197,21 +245,132 @@ LOCK_IDX_SWAP = True
 #
 #   The priority contention manager can be activated only after a
 #   configurable number of retries.  Until then, CM_SUICIDE is used.
+#
+# CM_POLICY: the policy is chosen when the library starts, through the
+#   cm_policy runtime setting, among suicide, delay and backoff (as
+#   above, with the backoff bounds given by cm_backoff_min and
+#   cm_backoff_max) and karma and polka.  With karma and polka, a
+#   transaction finding a lock taken compares the accesses done by
+#   itself and by the owner, counting the executions aborted since the
+#   last commit.  If it has done more, it waits for the lock for up to
+#   that many backoff intervals instead of aborting.  The intervals are
+#   fixed with karma and grow exponentially with polka.  Otherwise it
+#   aborts and behaves as CM_DELAY.
 ########################################################################
 
 CM = 'CM_SUICIDE'
 
+########################################################################
+# Several schemes are available to obtain commit timestamps from the
+# global clock:
+#
+# CLOCK_GV1: every update transaction atomically increments the clock
+#   on commit.
+#
+# CLOCK_GV4: update transactions try to increment the clock with a
+#   single CAS; on failure they share the timestamp of the transaction
+#   that won ("pass on failure").  Reduces contention on the clock
+#   cache line when many threads commit concurrently.
+#
+# CLOCK_GV5: update transactions commit with clock + 1 without
+#   incrementing the clock.  A transaction that finds a version ahead
+#   of the clock advances it before extending its snapshot.  Removes
+#   clock writes from the commit path at the cost of more validation
+#   and extensions.
+#
+# All schemes keep versions below VERSION_MAX and work with
+# ROLLOVER_CLOCK.
+########################################################################
+
+CLOCK_SCHEME = 'CLOCK_GV1'
+
+########################################################################
+# HTM_FASTPATH (default=False): on processors with RTM, first try to run
+#   isolated transactions inside a hardware transaction.  Loads only check
+#   the lock of the address (no read set), stores acquire locks and fill
+#   the write set as usual, and the persistent log is written after the
+#   hardware transaction ends, followed by the normal software commit.
+#   Hardware aborts retry up to mtm.htm_attempts times (runtime setting)
+#   before the transaction runs in software.  RTM support is detected at
+#   startup.
+########################################################################
+
+HTM_FASTPATH = False
+
+########################################################################
+# TMLOG_AT_COMMIT (default=False): write the persistent TM log at commit
+#   time, after validation, with one record per word of the write set 
+#   carrying the word's final value, instead of logging every store as 
+#   it happens.  Transactions that write the same word many times log it
+#   once, and transactions that abort log nothing.  Commit latency grows
+#   with the size of the write set.
+########################################################################
+
+TMLOG_AT_COMMIT = False
+
+########################################################################
+# COMMIT_TIME_LOCKING (default=False): use the WRITE_BACK_CTL design 
+#   instead of WRITE_BACK_ETL.  Stores are buffered in the write set 
+#   without touching the lock array; the entries covered by a lock hang 
+#   off a private pseudo-lock (PRIVATE_LOCK_ARRAY_LOG_SIZE) until commit.
+#   Commit acquires the locks of the write set in lock order, waiting for
+#   the ones taken by other committing transactions (the order rules out
+#   deadlocks), then validates and writes back as usual.  Locks are only
+#   held during write back, so concurrent readers of data written by long
+#   transactions abort less, at the cost of detecting write-write 
+#   conflicts late.  Does not work with HTM_FASTPATH or CM_PRIORITY.
+########################################################################
+
+COMMIT_TIME_LOCKING = False
+
+########################################################################
+# UNDO_LOGGING (default=False): use the WRITE_THROUGH design instead of
+#   write-back.  Stores acquire their lock as with WRITE_BACK_ETL and go
+#   to memory in place; the first store to a persistent word logs its 
+#   old value to an undo log (LF_TYPE_TM_UNDO) and flushes the log 
+#   before storing.  Reads of data the transaction wrote go to memory,
+#   and commit flushes the written cachelines and then marks (or with 
+#   SYNC_TRUNCATION truncates) the log instead of writing back.  An 
+#   abort restores the old values.  Recovery restores the old values of
+#   transactions that were running.  The log type replaces TMLOG_TYPE.
+#   Does not work with HTM_FASTPATH, READ_LOCKED_DATA, TMLOG_AT_COMMIT or
+#   CLOSED_NESTING.
+########################################################################
+
+UNDO_LOGGING = False
+
+########################################################################
+# CLOSED_NESTING (default=True): give each nested transaction a 
+#   savepoint over the write set, the read set, the local undo log and
+#   the user-action lists.  A user abort inside a nested transaction 
+#   then rolls back only the nested transaction, and a conflict inside 
+#   it re-executes only the nested transaction (up to PWB_NESTED_RETRIES
+#   times, as long as the enclosing transaction's reads are still valid)
+#   before falling back to restarting the outermost transaction.  Locks 
+#   acquired by a rolled back nested transaction are kept until the
+#   outermost transaction ends.  Nesting deeper than PWB_MAX_SAVEPOINTS
+#   levels is flattened.
+########################################################################
+
+CLOSED_NESTING = True
+
 ########################################################################
 # RW_SET_SIZE: initial size of the read and write sets. These sets will
-#   grow dynamically when they become full.
+#   grow dynamically when they become full, and are sized before each 
+#   transaction to what the transactions begun at the same call site 
+#   needed, so a small initial size costs no reallocation in steady state.
 ########################################################################
 
-RW_SET_SIZE = 32768
+RW_SET_SIZE = 4096
 
 ########################################################################
 # LOCK_ARRAY_LOG_SIZE (default=20): number of bits used for indexes in
 #   the lock array.  The size of the array will be 2 to the power of
-#   LOCK_ARRAY_LOG_SIZE.
+#   LOCK_ARRAY_LOG_SIZE.  This is only the default: the runtime setting
+#   mtm.lock_array_log_size overrides it, and mtm.lock_shift sets the
+#   number of address bits covered by each lock (default 6, one cache
+#   line).  The aborts_locked_aliased statistic counts aborts caused by
+#   stripes hashing to the same lock and tells when to grow the array.
 ########################################################################
 
 LOCK_ARRAY_LOG_SIZE = 20
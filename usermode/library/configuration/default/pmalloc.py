@@ -15,3 +15,40 @@
 ########################################################################
 
 GENALLOC = 'GENALLOC_DOUGLEA'
+
+########################################################################
+# PMALLOC_NUMA: splits the persistent heap region evenly into one 
+#   extent heap per NUMA node (up to 8), each preferring the memory of 
+#   its node, and makes each thread allocate from the heap of the node 
+#   it first allocated on. The split is fixed when the heap is first 
+#   created. See also the mcore.log_numa_local runtime setting for the
+#   logs.
+########################################################################
+
+PMALLOC_NUMA = False
+
+########################################################################
+# PMALLOC_REBALANCE_INTERVAL_MS (default=1000): period in milliseconds 
+#   of the background rebalancer, which returns the empty slabs of 
+#   idle thread heaps to the extent heap. 0 disables the rebalancer.
+#   Independently, a thread's slabs are returned to the shared slab 
+#   heap when the thread exits.
+########################################################################
+
+PMALLOC_REBALANCE_INTERVAL_MS = 1000
+
+########################################################################
+# PMALLOC_REGION_SIZE_MB (default=8192), PMALLOC_REGION_GROW_MB 
+#   (default=1024), PMALLOC_BLOCK_LOG2SIZE (default=13), 
+#   PMALLOC_SLAB_LOG2SIZE (default=13), PMALLOC_SLAB_MAX_LOG2SIZE 
+#   (default=18): defaults of the pmalloc.* 
+#   runtime settings of the same name in lower case, which can be 
+#   overridden in mnemosyne.ini. The sizes take effect when the heap is
+#   first created; a full heap grows by region_grow_mb regions.
+########################################################################
+
+PMALLOC_REGION_SIZE_MB = 8192
+PMALLOC_REGION_GROW_MB = 1024
+PMALLOC_BLOCK_LOG2SIZE = 13
+PMALLOC_SLAB_LOG2SIZE = 13
+PMALLOC_SLAB_MAX_LOG2SIZE = 18
@@ -138,4 +138,6 @@ class Environment(SCons.Environment.Environment):
 			150), 
 		('M_PCM_BANDWIDTH_MB',       'Bandwidth to PCM in MB/s. This is used to model sequential writes.', 
 			1200), 
+		('PHYSICAL_LOG_NUM_ENTRIES_LOG2', 'Default size of each physical log, as the log2 of the number of words it holds (10 to 21).', 
+			20), 
 	]
@@ -49,22 +49,38 @@ class Environment(mnemosyne.Environment):
 			True),
 		('NO_DUPLICATES_IN_RW_SETS', 'Prevent duplicate entries in read/write sets when accessing the same address multiple times.  Enabling this option may reduce performance so leave it disabled unless transactions repeatedly read or write the same address.',
 			True),
-		('WAIT_YIELD',               'Yield the processor when waiting for a contended lock to be released. This only applies to the CM_WAIT and CM_PRIORITY contention managers.',
+		('WAIT_YIELD',               'When waiting for a contended lock to be released, back off and then park on a futex until the owner releases it, instead of busy waiting. This only applies to the CM_DELAY, CM_PRIORITY and CM_POLICY contention managers.',
 			True),
-		('EPOCH_GC',                 'Use an epoch-based memory allocator and garbage collector to ensure that accesses to the dynamic memory allocated by a transaction from another transaction are valid.  There is a slight overhead from enabling this feature.',
+		('EPOCH_GC',                 'Use an epoch-based memory allocator and garbage collector to ensure that accesses to the dynamic memory allocated by a transaction from another transaction are valid.  Blocks freed by transactions, with free or pfree, are only reused once every transaction that might still read them has finished.  There is a slight overhead from enabling this feature.',
 			False),
 		('CONFLICT_TRACKING',        'Keep track of conflicts between transactions and notifies the application (using a callback), passing the identity of the two conflicting transaction and the associated threads.  This feature requires EPOCH_GC.',
 			False),
 		('READ_LOCKED_DATA',         'Allow transactions to read the previous version of locked memory locations, as in the original LSA algorithm (see [DISC-06]). This is achieved by peeking into the write set of the transaction that owns the lock.  There is a small overhead with non-contended workloads but it may significantly reduce the abort rate, especially with transactions that read much data.  This feature only works with the WRITE_BACK_ETL design and requires EPOCH_GC.',
 			False),
+		('INCREMENTAL_VALIDATION',   'Count commits globally as they begin and finish, so that extending the snapshot or committing can skip revalidating the read set when no other transaction has begun committing since it was last validated with no commit in flight. Saves the read-set walk for long read-mostly transactions at the cost of two atomic increments per update commit.',
+			False),
 		('LOCK_IDX_SWAP',            'Tweak the hash function that maps addresses to locks so that consecutive addresses do not map to consecutive locks. This can avoid cache line invalidations for application that perform sequential memory accesses. The last byte of the lock index is swapped with the previous byte.',
 			True),
-		('ALLOW_ABORTS',       'Allows transaction aborts. When disabled and combined with no-isolation, the TM system does not need to perform version management for volatile data.',
-			False),
+		('ALLOW_ABORTS',       'Allows transaction aborts. When disabled and combined with no-isolation, the TM system does not need to perform version management for volatile data, and a transaction without isolation that aborts is a fatal error.',
+			True),
 		('SYNC_TRUNCATION',          'Synchronously flushes the write set out of the HW cache and truncates the persistent log.',
 			True),
 		('FLUSH_CACHELINE_ONCE',          'When asynchronously truncating the log, the log manager flushes each cacheline of the write set only once by keeping track flushed cachelines.',
+			True),
+		('READ_SET_FILTER',          'Keep a per-transaction bloom filter over the locks in the read set so that checking whether a stripe has been read (on a write that needs a timestamp extension) skips the read-set scan in the common not-read case.',
+			True),
+		('HTM_FASTPATH',             'On processors with RTM, first try to run isolated transactions as hardware transactions that acquire write locks and defer persistent logging to commit, falling back to the software path on abort.',
 			False),
+		('WRITE_SET_INDEX',          'Keep a per-transaction hash index from written address to write-set entry so that read-after-write and write-after-write lookups do not walk the chain of entries hanging off the lock.',
+			False),
+		('TMLOG_AT_COMMIT',          'Write the persistent TM log from the write set at commit instead of at each store, so that a word written several times by a transaction is logged once with its final value.',
+			False),
+		('COMMIT_TIME_LOCKING',      'Buffer writes in the write set without acquiring locks, and acquire the locks of the write set, sorted by lock, only at commit (WRITE_BACK_CTL design). Locks are held for the write back alone, which helps workloads where encounter-time locks held across long transactions cause readers to abort. Does not work with HTM_FASTPATH or CM_PRIORITY.',
+			False),
+		('UNDO_LOGGING',             'Store in place at each write (WRITE_THROUGH design) with encounter-time locking, logging the old value of each persistent word to an undo log that is made durable before the store. Reads of written data go to memory and commit only flushes the written cachelines, which suits read-dominated workloads; each first write to a word pays a log flush. Replaces TMLOG_TYPE. Does not work with HTM_FASTPATH, READ_LOCKED_DATA, TMLOG_AT_COMMIT or CLOSED_NESTING.',
+			False),
+		('CLOSED_NESTING',           'Give nested transactions a savepoint so that a conflict or a user abort inside a nested transaction rolls back and retries only the nested transaction instead of the outermost one.',
+			True),
 
 	]
 	
@@ -73,18 +89,22 @@ class Environment(mnemosyne.Environment):
 		('CM',
 		                 'Determines the conflict_management policy for the STM.',
 		                 'CM_SUICIDE',
-		                 ['CM_SUICIDE', 'CM_DELAY', 'CM_BACKOFF', 'CM_PRIORITY']),
+		                 ['CM_SUICIDE', 'CM_DELAY', 'CM_BACKOFF', 'CM_PRIORITY', 'CM_POLICY']),
 		('TMLOG_TYPE',
 		                 'Determines the type of the persistent log used.',
 		                 'TMLOG_TYPE_BASE',
-		                 ['TMLOG_TYPE_BASE', 'TMLOG_TYPE_TORNBIT'])
+		                 ['TMLOG_TYPE_BASE', 'TMLOG_TYPE_TORNBIT', 'TMLOG_TYPE_CHECKSUM']),
+		('CLOCK_SCHEME',
+		                 'Determines how update transactions obtain their commit timestamp from the global clock.',
+		                 'CLOCK_GV1',
+		                 ['CLOCK_GV1', 'CLOCK_GV4', 'CLOCK_GV5'])
 	]
 	
 	#: Build directives which have numerical values
 	_numerical_directive_vars = [
 		('RW_SET_SIZE',
-		 'Initial size of the read and write sets. These sets will grow dynamically when they become full.',
-		 16384 # Default
+		 'Initial size of the read and write sets. These sets will grow dynamically when they become full, and are sized before each transaction to what transactions begun at the same site needed.',
+		 4096 # Default
 				 ),
 		('LOCK_ARRAY_LOG_SIZE',
 		 'Number of bits used for indexes in the lock array. The size of the array will be 2 to the power of LOCK_ARRAY_LOG_SIZE.',
@@ -43,6 +43,7 @@ class Environment(mnemosyne.Environment):
 
 	#: Build directives which are either on or off.
 	_boolean_directive_vars = [
+		('PMALLOC_NUMA', 'Split the persistent heap into one extent heap per NUMA node and allocate from the node of the calling thread.', False),
 	]
 	
 	#: Build directives which have enumerated values.
@@ -56,4 +57,40 @@ class Environment(mnemosyne.Environment):
 	
 	#: Build directives which have numerical values
 	_numerical_directive_vars = [
+		('PMALLOC_REBALANCE_INTERVAL_MS',
+		 'Period in milliseconds at which empty slabs of idle thread heaps are returned to the extent heap. 0 disables the rebalancer.',
+		 1000 # Default
+				 ),
+		('PMALLOC_REGION_SIZE_MB',
+		 'Default size in MB of the persistent heap region (runtime setting pmalloc.region_size_mb).',
+		 8192 # Default
+				 ),
+		('PMALLOC_REGION_GROW_MB',
+		 'Default size in MB of the regions appended to a full heap (runtime setting pmalloc.region_grow_mb). 0 disables growth.',
+		 1024 # Default
+				 ),
+		('PMALLOC_BLOCK_LOG2SIZE',
+		 'Default log2 of the extent heap block size (runtime setting pmalloc.block_log2size).',
+		 13 # Default
+				 ),
+		('PMALLOC_SLAB_LOG2SIZE',
+		 'Default log2 of the slab size (runtime setting pmalloc.slab_log2size).',
+		 13 # Default
+				 ),
+		('PMALLOC_SLAB_MAX_LOG2SIZE',
+		 'Default log2 of the largest slab size of the larger sizeclasses (runtime setting pmalloc.slab_max_log2size).',
+		 18 # Default
+				 ),
+		('PMALLOC_DISCARD_INTERVAL_S',
+		 'Default period in seconds at which the rebalancer punches holes in the backing stores under free extents (runtime setting pmalloc.discard_interval_s). 0 disables it.',
+		 0 # Default
+				 ),
+		('PMALLOC_COMPACT_INTERVAL_S',
+		 'Default period in seconds at which the rebalancer moves objects out of sparse slabs through the registered relocators (runtime setting pmalloc.compact_interval_s). 0 disables it.',
+		 0 # Default
+				 ),
+		('PMALLOC_LOAD_THREADS',
+		 'Default number of threads that scan the extent headers for slabs when a heap is loaded (runtime setting pmalloc.load_threads).',
+		 4 # Default
+				 ),
 	]
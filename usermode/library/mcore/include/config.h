@@ -39,10 +39,94 @@
 #define FOREACH_RUNTIME_CONFIG_SETTING(ACTION, group, config, values)          \
   ACTION(config, values, group, reset_segments, bool, int, 0,                  \
          CONFIG_NO_CHECK, 0)                                                   \
+  ACTION(config, values, group, init_mode, string, char *, "eager",            \
+         CONFIG_NO_CHECK, 0)                                                   \
   ACTION(config, values, group, segments_dir, string, char *, "/tmp/segments", \
          CONFIG_NO_CHECK, 0)                                                   \
+  ACTION(config, values, group, segments_backend, string, char *, "auto",      \
+         CONFIG_NO_CHECK, 0)                                                   \
+  ACTION(config, values, group, segments_page_log2, int, int, 12,              \
+         CONFIG_RANGE_CHECK, 12, 30)                                           \
+  ACTION(config, values, group, segments_preallocate, bool, int, 0,            \
+         CONFIG_NO_CHECK, 0)                                                   \
+  ACTION(config, values, group, segments_prefault, string, char *, "none",     \
+         CONFIG_NO_CHECK, 0)                                                   \
+  ACTION(config, values, group, segments_prefault_threads, int, int, 4,        \
+         CONFIG_RANGE_CHECK, 1, 64)                                            \
+  ACTION(config, values, group, segments_map_threads, int, int, 4,             \
+         CONFIG_RANGE_CHECK, 1, 64)                                            \
+  ACTION(config, values, group, reincarnation_threads, int, int, 4,            \
+         CONFIG_RANGE_CHECK, 0, 64)                                            \
+  ACTION(config, values, group, segments_tier_dir, string, char *, "",         \
+         CONFIG_NO_CHECK, 0)                                                   \
+  ACTION(config, values, group, log_segments_dir, string, char *, "",          \
+         CONFIG_NO_CHECK, 0)                                                   \
+  ACTION(config, values, group, segments_lazy_map_mb, int, int, 0,             \
+         CONFIG_RANGE_CHECK, 0, 1048576)                                       \
+  ACTION(config, values, group, segments_region_gb, int, int, 1024,            \
+         CONFIG_RANGE_CHECK, 1, 65536)                                         \
+  ACTION(config, values, group, segments_table_extensions, int, int, 15,       \
+         CONFIG_RANGE_CHECK, 0, 1024)                                          \
+  ACTION(config, values, group, module_cache, bool, int, 1,                    \
+         CONFIG_NO_CHECK, 0)                                                   \
+  ACTION(config, values, group, persistence_domain, string, char *, "auto",    \
+         CONFIG_NO_CHECK, 0)                                                   \
+  ACTION(config, values, group, flush_backend, string, char *, "auto",         \
+         CONFIG_NO_CHECK, 0)                                                   \
+  ACTION(config, values, group, log_stream_store, string, char *, "auto",      \
+         CONFIG_NO_CHECK, 0)                                                   \
+  ACTION(config, values, group, pm_emulate, bool, int, 0,                      \
+         CONFIG_NO_CHECK, 0)                                                   \
+  ACTION(config, values, group, pm_flush_latency_ns, int, int, 0,              \
+         CONFIG_RANGE_CHECK, 0, 100000)                                        \
+  ACTION(config, values, group, pm_fence_latency_ns, int, int, 0,              \
+         CONFIG_RANGE_CHECK, 0, 100000)                                        \
+  ACTION(config, values, group, pm_bandwidth_mb, int, int, 0,                  \
+         CONFIG_RANGE_CHECK, 0, 1048576)                                       \
+  ACTION(config, values, group, crash_point, int, int, 0,                      \
+         CONFIG_NO_CHECK, 0)                                                   \
+  ACTION(config, values, group, trace_file, string, char *, "/tmp/pmtrace",   \
+         CONFIG_NO_CHECK, 0)                                                   \
+  ACTION(config, values, group, trace_records_log2, int, int, 16,              \
+         CONFIG_RANGE_CHECK, 8, 28)                                            \
   ACTION(config, values, group, stats, bool, int, 0, CONFIG_NO_CHECK, 0)       \
   ACTION(config, values, group, stats_file, string, char *, "mcore.stats",     \
+         CONFIG_NO_CHECK, 0)                                                   \
+  ACTION(config, values, group, group_commit, bool, int, 0,                    \
+         CONFIG_NO_CHECK, 0)                                                   \
+  ACTION(config, values, group, group_commit_max_latency, int, int, 0,         \
+         CONFIG_NO_CHECK, 0)                                                   \
+  ACTION(config, values, group, log_truncation_threads, int, int, 1,           \
+         CONFIG_RANGE_CHECK, 1, 64)                                            \
+  ACTION(config, values, group, log_truncation_cpu, int, int, 1,               \
+         CONFIG_NO_CHECK, 0)                                                   \
+  ACTION(config, values, group, log_truncation_node, int, int, -1,             \
+         CONFIG_NO_CHECK, 0)                                                   \
+  ACTION(config, values, group, log_truncation_period_ms, int, int, 10,        \
+         CONFIG_RANGE_CHECK, 1, 10000)                                         \
+  ACTION(config, values, group, log_truncation_high_watermark, int, int, 50,  \
+         CONFIG_RANGE_CHECK, 1, 100)                                           \
+  ACTION(config, values, group, log_truncation_critical_watermark, int, int,   \
+         90, CONFIG_RANGE_CHECK, 1, 100)                                       \
+  ACTION(config, values, group, log_truncation_throttle_us, int, int, 100,     \
+         CONFIG_RANGE_CHECK, 0, 1000000)                                       \
+  ACTION(config, values, group, log_truncation_bandwidth_mb, int, int, 0,      \
+         CONFIG_RANGE_CHECK, 0, 65536)                                         \
+  ACTION(config, values, group, log_truncation_flush_latency_ns, int, int, 0,  \
+         CONFIG_RANGE_CHECK, 0, 1000000)                                       \
+  ACTION(config, values, group, log_size_log2, int, int, 0,                    \
+         CONFIG_NO_CHECK, 0)                                                   \
+  ACTION(config, values, group, log_recovery_threads, int, int, 1,             \
+         CONFIG_RANGE_CHECK, 1, 64)                                            \
+  ACTION(config, values, group, log_numa_local, bool, int, 0,                  \
+         CONFIG_NO_CHECK, 0)                                                   \
+  ACTION(config, values, group, log_ship_target, string, char *, "",           \
+         CONFIG_NO_CHECK, 0)                                                   \
+  ACTION(config, values, group, log_ship_listen_port, int, int, 0,             \
+         CONFIG_RANGE_CHECK, 0, 65535)                                         \
+  ACTION(config, values, group, log_ship_buffer_mb, int, int, 64,              \
+         CONFIG_RANGE_CHECK, 1, 65536)                                         \
+  ACTION(config, values, group, log_ship_sync, bool, int, 0,                   \
          CONFIG_NO_CHECK, 0)
 
 
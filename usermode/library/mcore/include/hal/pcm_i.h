@@ -97,8 +97,14 @@ extern "C" {
 #endif
 
 
-#define NS2CYCLE(__ns) ((__ns) * M_PCM_CPUFREQ / 1000)
-#define CYCLE2NS(__cycles) ((__cycles) * 1000 / M_PCM_CPUFREQ)
+/** 
+ * TSC frequency in MHz. Starts at the build-time M_PCM_CPUFREQ and is 
+ * replaced by a measured value when pcm_emulate_init runs.
+ */
+extern uint64_t pcm_tsc_mhz;
+
+#define NS2CYCLE(__ns) ((__ns) * pcm_tsc_mhz / 1000)
+#define CYCLE2NS(__cycles) ((__cycles) * 1000 / pcm_tsc_mhz)
 
 
 #define likely(x)	__builtin_expect(!!(x), 1)
@@ -267,6 +273,213 @@ static inline unsigned long long asm_rdtscp(void)
 #define asm_clflush(addr) {;}
 */
 
+/* 
+ * CLFLUSHOPT and CLWB are encoded by hand (as 66-prefixed CLFLUSH and 
+ * XSAVEOPT) so we don't depend on the assembler knowing the mnemonics.
+ * Unlike CLFLUSH, both are weakly ordered with respect to other flushes
+ * and stores to different cachelines, so a batch of them must be followed
+ * by a fence before any dependent store.
+ */
+#define asm_clflushopt(addr)					\
+({								\
+	__asm__ __volatile__ (".byte 0x66; clflush %0" : "+m"(*(volatile char *) (addr)));	\
+})
+
+#define asm_clwb(addr)						\
+({								\
+	__asm__ __volatile__ (".byte 0x66; xsaveopt %0" : "+m"(*(volatile char *) (addr)));	\
+})
+
+/** 
+ * Cacheline flush instruction used by PCM_WB_FLUSH. The backend is 
+ * selected when mcore initializes: either the one named by the 
+ * flush_backend setting, or by querying CPUID, preferring CLWB (writes back 
+ * without evicting) over CLFLUSHOPT over CLFLUSH. NONE elides the flush 
+ * and is only safe when the caches are persistent (see below).
+ */
+typedef enum {
+	PCM_FLUSH_BACKEND_CLFLUSH = 0,
+	PCM_FLUSH_BACKEND_CLFLUSHOPT,
+	PCM_FLUSH_BACKEND_CLWB,
+	PCM_FLUSH_BACKEND_NONE
+} pcm_flush_backend_t;
+
+extern pcm_flush_backend_t pcm_flush_backend;
+
+/* Returns -1 and falls back to CPUID if the named backend is unavailable */
+int pcm_flush_backend_init(const char *name);
+const char *pcm_flush_backend_name(pcm_flush_backend_t backend);
+
+/**
+ * Persistence domain of the platform. With ADR a store is durable once it 
+ * reaches the memory controller, so cached stores must be flushed. With 
+ * extended ADR (eADR) the CPU caches are flushed on power failure too: 
+ * pcm_persist_domain_init then switches the flush backend to NONE and the 
+ * stream backend to CACHED, keeping only the fences, which still order 
+ * stores. The domain is named by the persistence_domain setting or, with 
+ * auto, read from the NFIT-derived persistence_domain attribute the kernel 
+ * exports for each NVDIMM region; it is eADR only if every region reports 
+ * cpu_cache.
+ */
+typedef enum {
+	PCM_PERSIST_DOMAIN_ADR = 0,
+	PCM_PERSIST_DOMAIN_EADR
+} pcm_persist_domain_t;
+
+extern pcm_persist_domain_t pcm_persist_domain;
+
+/* Returns -1 and falls back to detection if the name is not known */
+int pcm_persist_domain_init(const char *name);
+const char *pcm_persist_domain_name(pcm_persist_domain_t domain);
+
+/**
+ * Runtime PM latency and bandwidth emulation over DRAM. Unlike the 
+ * M_PCM_EMULATE_LATENCY build this is selected in mnemosyne.ini: when 
+ * pcm_emulate_enabled is clear the hooks below cost a single predicted 
+ * branch.
+ *
+ * Flushes pay pm_flush_latency_ns each; persist barriers pay 
+ * pm_fence_latency_ns and charge the bytes written back since the 
+ * previous barrier to a token bucket shared by all threads of the 
+ * calling thread's socket, stalling when the bucket runs dry.
+ */
+extern int pcm_emulate_enabled;
+
+void pcm_emulate_init(int enable, int flush_latency_ns, int fence_latency_ns, 
+                      int bandwidth_mb);
+
+/**
+ * Crash injection for crash-consistency fuzzing. With a nonzero crash 
+ * point the process exits with PCM_CRASH_EXIT_STATUS right after the 
+ * persist barrier of that number, counted across all threads: everything 
+ * ordered before the barrier is durable, nothing after it is. Shares the 
+ * emulation hooks, so it costs nothing when off.
+ */
+#define PCM_CRASH_EXIT_STATUS 86
+
+void pcm_crash_init(int crash_point);
+void pcm_emulate_flush(void);
+void pcm_emulate_nt_store(unsigned int nbytes);
+void pcm_emulate_fence(void);
+
+#define PCM_EMULATE_FLUSH()					\
+({								\
+	if (unlikely(pcm_emulate_enabled)) {			\
+		pcm_emulate_flush();				\
+	}							\
+})
+
+#define PCM_EMULATE_NT_STORE(nbytes)				\
+({								\
+	if (unlikely(pcm_emulate_enabled)) {			\
+		pcm_emulate_nt_store(nbytes);			\
+	}							\
+})
+
+#define PCM_EMULATE_FENCE()					\
+({								\
+	PCM_STAT_FENCE();					\
+	if (unlikely(pcm_emulate_enabled)) {			\
+		pcm_emulate_fence();				\
+	}							\
+})
+
+/**
+ * Fences issued by the calling thread, in statistics builds. Transactions 
+ * take the difference across their commit to report the fences they cost.
+ */
+#ifdef _M_STATS_BUILD
+extern __thread uint64_t pcm_stat_fences;
+# define PCM_STAT_FENCE() (pcm_stat_fences++)
+#else
+# define PCM_STAT_FENCE() ((void) 0)
+#endif
+
+#define asm_flush(addr)						\
+({								\
+	if (pcm_flush_backend == PCM_FLUSH_BACKEND_CLWB) {		\
+		asm_clwb(addr);					\
+	} else if (pcm_flush_backend == PCM_FLUSH_BACKEND_CLFLUSHOPT) {	\
+		asm_clflushopt(addr);				\
+	} else {						\
+		asm_clflush(addr);				\
+	}							\
+})
+
+/**
+ * Instructions used to stream a 64-byte block to memory. The backend is 
+ * selected when mcore initializes: either the one named by the 
+ * log_stream_store setting, or the widest the CPU and OS support. A vector 
+ * store hands the whole cacheline to the write-combining buffer at once 
+ * instead of in eight MOVNTIs.
+ */
+typedef enum {
+	PCM_STREAM_BACKEND_MOVNTI = 0,
+	PCM_STREAM_BACKEND_AVX2,
+	PCM_STREAM_BACKEND_AVX512,
+	PCM_STREAM_BACKEND_CACHED
+} pcm_stream_backend_t;
+
+extern pcm_stream_backend_t pcm_stream_backend;
+
+/* Whether byte-masked cacheline stores use AVX-512BW (set with the backend) */
+extern int pcm_masked_store_avx512;
+
+void pcm_store_line_masked_avx512(volatile void *addr, const void *val, uint64_t bytemask);
+
+/* Returns -1 and picks the widest available if the named one is not */
+int pcm_stream_backend_init(const char *name);
+const char *pcm_stream_backend_name(pcm_stream_backend_t backend);
+
+/* 
+ * The source may be unaligned; the destination must be a cacheline, else 
+ * it goes through MOVNTI. xmm0/xmm1 clobbers cover their ymm/zmm aliases.
+ */
+#define asm_stream_block64(addr, val)						\
+({										\
+	if (pcm_stream_backend == PCM_STREAM_BACKEND_AVX512 &&			\
+	    ((uintptr_t) (addr) & (CACHELINE_SIZE - 1)) == 0) 			\
+	{									\
+		__asm__ __volatile__ ("vmovdqu64 %1, %%zmm0\n\t"			\
+		                      "vmovntdq %%zmm0, %0\n\t"			\
+		                      "vzeroupper"				\
+		                      : "=m"(*(volatile char (*)[64]) (addr))	\
+		                      : "m"(*(const char (*)[64]) (val))		\
+		                      : "xmm0");					\
+	} else if (pcm_stream_backend == PCM_STREAM_BACKEND_AVX2 &&		\
+	           ((uintptr_t) (addr) & (CACHELINE_SIZE - 1)) == 0) 		\
+	{									\
+		__asm__ __volatile__ ("vmovdqu %2, %%ymm0\n\t"			\
+		                      "vmovdqu %3, %%ymm1\n\t"			\
+		                      "vmovntdq %%ymm0, %0\n\t"			\
+		                      "vmovntdq %%ymm1, %1\n\t"			\
+		                      "vzeroupper"				\
+		                      : "=m"(*(volatile char (*)[32]) (addr)),	\
+		                        "=m"(*((volatile char (*)[32]) (addr) + 1))	\
+		                      : "m"(*(const char (*)[32]) (val)),		\
+		                        "m"(*((const char (*)[32]) (val) + 1))	\
+		                      : "xmm0", "xmm1");				\
+	} else if (pcm_stream_backend == PCM_STREAM_BACKEND_CACHED) {		\
+		__builtin_memcpy((void *) (addr), (val), CACHELINE_SIZE);	\
+	} else {								\
+		asm_sse_write_block64(addr, val);				\
+	}									\
+})
+
+/* 
+ * Word store of the NT and sequential-stream paths: MOVNTI, or a regular 
+ * cached store when the caches are persistent and bypassing them only 
+ * costs a later read miss.
+ */
+#define asm_pm_store(addr, val)							\
+({										\
+	if (unlikely(pcm_stream_backend == PCM_STREAM_BACKEND_CACHED)) {	\
+		PM_EQU_DW(*(addr), (val));					\
+	} else {								\
+		asm_movnti(addr, val);						\
+	}									\
+})
+
 // static inline void asm_mfence(void)
 #define asm_mfence()				\
 ({						\
@@ -400,32 +613,86 @@ emulate_latency_ns(int ns)
 #define PCM_WB_STORE_ALIGNED_MASKED(set, addr, val, mask)			\
 		PCM_WB_STORE_MASKED(set, addr, val, mask);
 
+/* 
+ * Stores the bytes of val selected by the 64-bit byte mask into the 
+ * cacheline at addr, which must be aligned. Like write_aligned_masked, it 
+ * writes no unselected byte, so concurrent writers of other bytes of the 
+ * line are not disturbed: with AVX-512BW in a single byte-masked store, 
+ * else byte by byte. The vector store lives in pcm.c, compiled for 
+ * AVX-512BW whatever the library is built for.
+ */
+#define PCM_WB_STORE_LINE_MASKED(set, addr, val, bytemask)			\
+({										\
+	if (pcm_masked_store_avx512) {						\
+		pcm_store_line_masked_avx512((addr), (val), (bytemask));	\
+	} else {								\
+		uint64_t _m = (bytemask);					\
+		int      _b;							\
+		for (; _m; _m &= _m - 1) {					\
+			_b = __builtin_ctzll(_m);				\
+			PM_EQU_DW(((volatile uint8_t *) (addr))[_b],		\
+			          ((const uint8_t *) (val))[_b]);		\
+		}								\
+	}									\
+})
+
+/* 
+ * Stores a whole cacheline through the cache. It is durable once a 
+ * PCM_WB_FLUSH of the line, issued on any processor, is ordered by a 
+ * PCM_PERSIST_BARRIER on that same processor.
+ */
+#define PCM_WB_STORE_64B(set, addr, val)					\
+	({ __builtin_memcpy((void *) (addr), (val), CACHELINE_SIZE); })
+
 #define PCM_WB_FENCE(set)							\
-	asm_mfence(); 
+	({ asm_mfence(); PCM_STAT_FENCE(); });
 
+/* 
+ * Orders prior stores, non-temporal stores and cacheline flushes with 
+ * respect to later stores. Persistence ordering only needs store ordering, 
+ * so on x86 this is an SFENCE rather than a full MFENCE.
+ */
+#define PCM_PERSIST_BARRIER(set)						\
+	({ asm_sfence(); PCM_EMULATE_FENCE(); });
+
+/* 
+ * Weakly ordered when the flush backend is CLWB or CLFLUSHOPT: callers flush 
+ * a whole batch of cachelines and then issue a single PCM_PERSIST_BARRIER.
+ */
 #define PCM_WB_FLUSH(set, addr)							\
-	asm_clflush(addr); 							\
+({										\
+	if (pcm_flush_backend != PCM_FLUSH_BACKEND_NONE) {			\
+		asm_flush(addr);						\
+		PCM_EMULATE_FLUSH();						\
+	}									\
+})
 
 #define PCM_NT_STORE(set, addr, val)						\
-	asm_movnti(addr, val);
+	({ asm_pm_store(addr, val); PCM_EMULATE_NT_STORE(sizeof(pcm_word_t)); });
 
 #define PCM_NT_FLUSH(set)							\
-	asm_sfence();
+	({ asm_sfence(); PCM_EMULATE_FENCE(); });
+
+/* Streams a whole cacheline; like PCM_NT_STORE, ordered by PCM_NT_FLUSH */
+#define PCM_NT_STORE_64B(set, addr, val)					\
+	({ asm_stream_block64(addr, val);					\
+	   PCM_EMULATE_NT_STORE(CACHELINE_SIZE); });
 
 #define PCM_SEQSTREAM_STORE(set, addr, val)					\
-	asm_movnti(addr, val);
+	({ asm_pm_store(addr, val); PCM_EMULATE_NT_STORE(sizeof(pcm_word_t)); });
 
 #define PCM_SEQSTREAM_STORE_64B_FIRST_WORD(set, addr, val)			\
-	asm_movnti(addr, val);
+	({ asm_pm_store(addr, val); PCM_EMULATE_NT_STORE(sizeof(pcm_word_t)); });
 
 #define PCM_SEQSTREAM_STORE_64B_NEXT_WORD(set, addr, val)			\
-	asm_movnti(addr, val);
+	({ asm_pm_store(addr, val); PCM_EMULATE_NT_STORE(sizeof(pcm_word_t)); });
 
 #define PCM_SEQSTREAM_STORE_64B(set, addr, val)					\
-	asm_sse_write_block64(addr, val);
+	({ asm_stream_block64(addr, val);					\
+	   PCM_EMULATE_NT_STORE(CACHELINE_SIZE); });
 
 #define PCM_SEQSTREAM_FLUSH(set)						\
-	asm_sfence();
+	({ asm_sfence(); PCM_EMULATE_FENCE(); });
 
 #define PCM_SEQSTREAM_INIT(set) {;}
 
@@ -44,4 +44,7 @@
 /*! Greater than zero if mnemosyne has been initialized (or more importantly: reincarnated) */
 extern volatile uint32_t mnemosyne_initialized;
 
+/*! Initializes the library unless done already (see mnemosyne.h) */
+void mnemosyne_init_global(void);
+
 #endif /* end of include guard: INIT_H_FY8AG1WS */
@@ -45,5 +45,7 @@
 #include <log_i.h>
 #include <phlog_base.h>
 #include <phlog_tornbit.h>
+#include <phlog_checksum.h>
+#include <logship.h>
 
 #endif /* _LOG_H */
@@ -0,0 +1,105 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/**
+ * \file
+ *
+ * \brief Interface to group commit of the physical logs.
+ *
+ * When group commit is enabled, the base and tornbit logs write their 
+ * chunks through the cache instead of streaming them, and a committing 
+ * thread issues no fence of its own: it joins the currently open commit 
+ * epoch with the range of chunks it wrote since its last commit and, for 
+ * the base log, the tail to publish. The first thread to join an epoch 
+ * becomes its leader. While the previous epoch is being made durable more 
+ * threads join, optionally for up to the configured maximum latency; the 
+ * leader then writes back every member's chunks, fences once, publishes 
+ * the tails and fences once more, whatever the size of the epoch. Members 
+ * return once their epoch is durable.
+ *
+ * This works because a cacheline write-back acts on the whole coherence 
+ * domain, so the leader can flush lines other processors dirtied. A fence 
+ * does not drain the write-combining buffers of other processors, which is
+ * why the chunks may not be streamed. The checksum log does not take part.
+ */
+#ifndef _GROUPCOMMIT_H
+#define _GROUPCOMMIT_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <result.h>
+#include "../hal/pcm_i.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Maximum number of committers made durable by one leader */
+#define GROUPCOMMIT_MAX_MEMBERS 64
+
+typedef struct m_groupcommit_member_s m_groupcommit_member_t;
+typedef struct m_groupcommit_s        m_groupcommit_t;
+
+struct m_groupcommit_member_s {
+	volatile pcm_word_t *nvphlog;  /**< log the member wrote its chunks to */
+	uint64_t            mask;      /**< number of words in that log minus one */
+	uint64_t            from;      /**< index of the first chunk to write back */
+	uint64_t            to;        /**< index right after the last chunk to write back */
+	volatile pcm_word_t *addr;     /**< word to publish once the chunks are durable, or NULL */
+	pcm_word_t          val;
+};
+
+struct m_groupcommit_s {
+	pthread_mutex_t        mutex;
+	pthread_cond_t         cond_durable;  /**< signalled when an epoch becomes durable */
+	pthread_cond_t         cond_full;     /**< signalled when the open epoch is full */
+	uint64_t               open_epoch;    /**< epoch currently accepting members */
+	uint64_t               durable_epoch; /**< all epochs up to this one are durable */
+	int                    has_leader;    /**< the open epoch has a leader */
+	int                    nmembers;
+	m_groupcommit_member_t members[GROUPCOMMIT_MAX_MEMBERS];
+	uint64_t               stat_epochs;
+	uint64_t               stat_commits;
+};
+
+/** Non-zero if committing threads should go through m_groupcommit_join */
+extern int m_groupcommit_enabled;
+
+m_result_t m_groupcommit_init(int enable, int max_latency_us);
+m_result_t m_groupcommit_fini(void);
+void m_groupcommit_join(pcm_storeset_t *set, m_groupcommit_member_t *member);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _GROUPCOMMIT_H */
@@ -44,8 +44,11 @@
 #include <stdint.h>
 #include <result.h>
 #include <list.h>
+#include <spinwait.h>
 #include "hrtime.h"
+#include <usdt.h>
 #include "../hal/pcm_i.h"
+#include "groupcommit.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -55,11 +58,28 @@ extern "C" {
 /* 
  * Physical log size is power of 2 to implement arithmetic efficiently 
  * e.g. modulo using bitwise operations: x % 2^n == x & (2^n - 1) 
+ *
+ * PHYSICAL_LOG_NUM_ENTRIES_LOG2 is only the default size; each log records
+ * the size it was formatted with in its non-volatile metadata (see the 
+ * log_size_log2 runtime setting).
  */
-#define PHYSICAL_LOG_NUM_ENTRIES_LOG2 20
+#ifndef PHYSICAL_LOG_NUM_ENTRIES_LOG2
+# define PHYSICAL_LOG_NUM_ENTRIES_LOG2 20
+#endif
+#define PHYSICAL_LOG_MIN_NUM_ENTRIES_LOG2 10
+#define PHYSICAL_LOG_MAX_NUM_ENTRIES_LOG2 21 /* LOG_POOL_SIZE reserves 16MB per log */
 #define PHYSICAL_LOG_NUM_ENTRIES      (1 << PHYSICAL_LOG_NUM_ENTRIES_LOG2)
 #define PHYSICAL_LOG_SIZE             (PHYSICAL_LOG_NUM_ENTRIES * sizeof(pcm_word_t)) /* in bytes */
 
+/* Logs formatted before their size was recorded have the default size. */
+#define PHYSICAL_LOG_NVMD_SIZE_LOG2(nvmd)                                     \
+    ((nvmd)->size_log2 ? (int) (nvmd)->size_log2 : PHYSICAL_LOG_NUM_ENTRIES_LOG2)
+
+#if PHYSICAL_LOG_NUM_ENTRIES_LOG2 < PHYSICAL_LOG_MIN_NUM_ENTRIES_LOG2 || \
+    PHYSICAL_LOG_NUM_ENTRIES_LOG2 > PHYSICAL_LOG_MAX_NUM_ENTRIES_LOG2
+# error "PHYSICAL_LOG_NUM_ENTRIES_LOG2 out of range."
+#endif
+
 
 /* Masks for the 64-bit non-volatile generic_flags field. */
 
@@ -74,6 +94,10 @@ extern "C" {
 
 /* Volatile flags */
 #define LF_ASYNC_TRUNCATION 0x0000000000000001
+#define LF_RETIRED          0x0000000000000002 /* released; reusable once truncated */
+
+/* Marks a valid entry of the truncation checkpoint */
+#define LF_CHECKPOINT_VALID 0x4000000000000000
 
 /* Hardwired log types known at compilation time (static) */
 enum {
@@ -95,6 +119,7 @@ struct m_log_ops_s {
 	m_result_t (*truncation_init)(pcm_storeset_t *set, m_log_dsc_t *log_dsc);
 	m_result_t (*truncation_prepare_next)(pcm_storeset_t *set, m_log_dsc_t *log_dsc);
 	m_result_t (*truncation_do)(pcm_storeset_t *set, m_log_dsc_t *log_dsc);
+	m_result_t (*truncation_publish)(pcm_storeset_t *set, m_log_dsc_t *log_dsc);
 	m_result_t (*recovery_init)(pcm_storeset_t *set, m_log_dsc_t *log_dsc);
 	m_result_t (*recovery_prepare_next)(pcm_storeset_t *set, m_log_dsc_t *log_dsc);
 	m_result_t (*recovery_do)(pcm_storeset_t *set, m_log_dsc_t *log_dsc);
@@ -121,6 +146,11 @@ struct m_log_dsc_s {
 	pcm_word_t       *nvphlog;         /**< non-volatile physical log */
 	uint64_t         flags;            /**< array of flags */
 	uint64_t         logorder;         /**< log order number */
+	int              size_log2;        /**< size the physical log is formatted with, as log2 of its words */
+	pcm_word_t       trunc_point;      /**< truncation point not yet published, or INV_LOG_ORDER */
+	uint64_t         trunc_words;      /**< words the current truncation pass has truncated, for its pacing */
+	int              node;             /**< NUMA node the physical log was placed on, or -1 if unknown */
+	struct m_logship_stream_s *ship;   /**< redo records copied for the standby (see logship.h) */
 	struct list_head list;
 };
 
@@ -134,9 +164,12 @@ struct m_logmgr_s {
 	struct list_head known_logtypes_list;   /**< log types known (registered) to the log manager */
 	/* log truncation */
 	pthread_cond_t   logtrunc_cond;
+	pthread_cond_t   logtrunc_done_cond;    /**< broadcast at the end of each truncation pass */
 	pthread_t        logtrunc_thread;
+	int              logtrunc_started;      /**< whether the truncation threads run */
 	uint64_t         trunc_time;
-	uint64_t         trunc_count;
+	uint64_t         trunc_count;           /**< number of truncation passes done */
+	uint64_t         trunc_requested;       /**< truncation passes asked for by m_logtrunc_sync */
 };
 
 
@@ -146,11 +179,48 @@ m_result_t m_logmgr_register_logtype(pcm_storeset_t *set, int type, m_log_ops_t
 m_result_t m_logmgr_alloc_log(pcm_storeset_t *set, int type, uint64_t flags, m_log_dsc_t **log_dscp);
 m_result_t m_logmgr_free_log(m_log_dsc_t *log_dsc);
 m_result_t m_logmgr_do_recovery(pcm_storeset_t *set);
+void m_logmgr_checkpoint_begin(pcm_storeset_t *set);
+void m_logmgr_checkpoint_add(pcm_storeset_t *set, m_log_dsc_t *log_dsc);
+void m_logmgr_checkpoint_commit(pcm_storeset_t *set);
 m_result_t m_logtrunc_truncate(pcm_storeset_t *set);
+m_result_t m_logtrunc_signal();
+m_result_t m_logtrunc_sync();
+void m_logtrunc_backpressure(volatile uint64_t *head, uint64_t tail, uint64_t mask);
+void m_logtrunc_stall_begin(void);
+void m_logtrunc_stall_end(void);
+
+extern uint64_t m_logtrunc_high_watermark;
+extern int m_logtrunc_flush_sampled;
+extern volatile uint64_t m_logtrunc_flush_cycles;
+extern __thread unsigned int m_logtrunc_flush_count;
+extern int m_log_unsafe_nobarrier;
+void m_logrecovery_store(pcm_storeset_t *set, uintptr_t addr, pcm_word_t value, pcm_word_t mask);
+void m_logrecovery_logical(pcm_storeset_t *set, unsigned int opcode, const void *args, size_t size);
 void m_logmgr_stat_print();
 
 
 
+/*
+ * Fence ending a log flush. Benchmarks breaking the commit cost down turn it
+ * off (see the mtm setting unsafe_disable): the records of a committed
+ * transaction are then not known to be durable.
+ */
+#define PHLOG_PERSIST_BARRIER(set)                                            \
+do {                                                                          \
+    if (!m_log_unsafe_nobarrier) {                                            \
+        PCM_PERSIST_BARRIER(set);                                             \
+    }                                                                         \
+} while (0)
+
+
+/* 
+ * Whether log flushes go through a commit epoch (see groupcommit.h). The 
+ * chunks are then written through the cache for the epoch leader to flush.
+ */
+#define PHLOG_GROUP_COMMIT()                                                  \
+    (m_groupcommit_enabled && !m_log_unsafe_nobarrier)
+
+
 #define PHLOG_WRITE(logtype, set, phlog, val)                                 \
 do {                                                                          \
     int retries = 0;                                                          \
@@ -164,9 +234,23 @@ do {                                                                          \
 } while (0);
 
 
+#define PHLOG_RESERVE(logtype, set, phlog, nwords)                            \
+do {                                                                          \
+    int retries = 0;                                                          \
+    while (m_phlog_##logtype##_reserve((phlog), (nwords)) != M_R_SUCCESS) {   \
+        if (retries++ > 1) {                                                  \
+            M_INTERNALERROR("Cannot complete log write successfully.\n");     \
+        }                                                                     \
+        (phlog)->stat_wait_for_trunc++;                                       \
+        m_logtrunc_truncate(set);                                             \
+    }                                                                         \
+} while (0);
+
+
 #define PHLOG_FLUSH(logtype, set, phlog)                                      \
 do {                                                                          \
     int retries = 0;                                                          \
+    M_PROBE1(log__flush, (phlog));                                            \
     while (m_phlog_##logtype##_flush(set, (phlog)) != M_R_SUCCESS) {          \
         if (retries++ > 1) {                                                  \
             M_INTERNALERROR("Cannot complete log write successfully.\n");     \
@@ -177,16 +261,79 @@ do {                                                                          \
 } while (0);
 
 
+/*
+ * Foreground flush latency the truncation pacing backs off from (see 
+ * logtrunc.c): while it is enabled, one in LOGTRUNC_FLUSH_SAMPLE commit 
+ * flushes of each thread is timed into a moving average.
+ */
+#define LOGTRUNC_FLUSH_SAMPLE 16
+
+static inline hrtime_t
+m_logtrunc_flush_sample_begin(void)
+{
+	if (!m_logtrunc_flush_sampled || 
+	    (++m_logtrunc_flush_count & (LOGTRUNC_FLUSH_SAMPLE - 1)))
+	{
+		return 0;
+	}
+	return hrtime_cycles();
+}
+
+static inline void
+m_logtrunc_flush_sample_end(hrtime_t start)
+{
+	uint64_t avg;
+
+	if (start) {
+		/* Racy, but a lost sample does not matter */
+		avg = m_logtrunc_flush_cycles;
+		m_logtrunc_flush_cycles = avg - (avg >> 3) + ((hrtime_cycles() - start) >> 3);
+	}
+}
+
+
 #define PHLOG_WRITE_ASYNCTRUNC(logtype, set, phlog, val)                       \
 do {                                                                           \
 	hrtime_t __start;                                                          \
 	hrtime_t __end;                                                            \
+	m_spinwait_t __w;                                                          \
     if (m_phlog_##logtype##_write(set, (phlog), (val)) != M_R_SUCCESS) {       \
         (phlog)->stat_wait_for_trunc++;                                        \
+        m_logtrunc_stall_begin();                                              \
+        M_PROBE1(log__full__wait__begin, (phlog));                             \
         __start = hrtime_cycles();                                             \
-        while (m_phlog_##logtype##_write(set, (phlog), (val)) != M_R_SUCCESS); \
+        m_spinwait_init(&__w, &(phlog)->head);                                 \
+        while (m_phlog_##logtype##_write(set, (phlog), (val)) != M_R_SUCCESS) {\
+            m_spinwait_pause(&__w);                                            \
+        }                                                                      \
+        m_spinwait_done(&__w);                                                 \
+        m_logtrunc_stall_end();                                                \
         __end = hrtime_cycles();                                               \
 	    phlog->stat_wait_time_for_trunc += (HRTIME_CYCLE2NS(__end - __start)); \
+        M_PROBE2(log__full__wait__end, (phlog), HRTIME_CYCLE2NS(__end - __start)); \
+    }                                                                          \
+} while (0);
+
+
+#define PHLOG_RESERVE_ASYNCTRUNC(logtype, set, phlog, nwords)                 \
+do {                                                                           \
+	hrtime_t __start;                                                          \
+	hrtime_t __end;                                                            \
+	m_spinwait_t __w;                                                          \
+    if (m_phlog_##logtype##_reserve((phlog), (nwords)) != M_R_SUCCESS) {       \
+        (phlog)->stat_wait_for_trunc++;                                        \
+        m_logtrunc_stall_begin();                                              \
+        M_PROBE1(log__full__wait__begin, (phlog));                             \
+        __start = hrtime_cycles();                                             \
+        m_spinwait_init(&__w, &(phlog)->head);                                 \
+        while (m_phlog_##logtype##_reserve((phlog), (nwords)) != M_R_SUCCESS) {\
+            m_spinwait_pause(&__w);                                            \
+        }                                                                      \
+        m_spinwait_done(&__w);                                                 \
+        m_logtrunc_stall_end();                                                \
+        __end = hrtime_cycles();                                               \
+	    phlog->stat_wait_time_for_trunc += (HRTIME_CYCLE2NS(__end - __start)); \
+        M_PROBE2(log__full__wait__end, (phlog), HRTIME_CYCLE2NS(__end - __start)); \
     }                                                                          \
 } while (0);
 
@@ -195,12 +342,48 @@ do {                                                                           \
 do {                                                                           \
 	hrtime_t __start;                                                          \
 	hrtime_t __end;                                                            \
+	m_spinwait_t __w;                                                          \
+	hrtime_t __sample = m_logtrunc_flush_sample_begin();                       \
+    M_PROBE1(log__flush, (phlog));                                             \
     if (m_phlog_##logtype##_flush(set, (phlog)) != M_R_SUCCESS) {              \
         (phlog)->stat_wait_for_trunc++;                                        \
+        m_logtrunc_stall_begin();                                              \
+        M_PROBE1(log__full__wait__begin, (phlog));                             \
+        __sample = 0; /* a stall is no sample of the flush latency */          \
         __start = hrtime_cycles();                                             \
-        while (m_phlog_##logtype##_flush(set, (phlog)) != M_R_SUCCESS);        \
+        m_spinwait_init(&__w, &(phlog)->head);                                 \
+        while (m_phlog_##logtype##_flush(set, (phlog)) != M_R_SUCCESS) {       \
+            m_spinwait_pause(&__w);                                            \
+        }                                                                      \
+        m_spinwait_done(&__w);                                                 \
+        m_logtrunc_stall_end();                                                \
         __end = hrtime_cycles();                                               \
 	    phlog->stat_wait_time_for_trunc += (HRTIME_CYCLE2NS(__end - __start)); \
+        M_PROBE2(log__full__wait__end, (phlog), HRTIME_CYCLE2NS(__end - __start)); \
+    }                                                                          \
+    m_logtrunc_flush_sample_end(__sample);                                     \
+} while (0);
+
+
+/*
+ * Checked when a transaction begins on a log truncated asynchronously: past 
+ * the high watermark (m_logtrunc_high_watermark, in units of 1/100 of the 
+ * log) the truncation threads are woken up early, and past the critical one
+ * m_logtrunc_backpressure also holds the thread back for a while, so that it 
+ * does not run into a full log in the middle of the transaction. The head 
+ * the truncation publishes is read only when the cached copy, which lags 
+ * behind it, puts the log past the high watermark.
+ */
+#define PHLOG_BACKPRESSURE(phlog)                                              \
+do {                                                                           \
+    uint64_t __used = ((phlog)->tail - (phlog)->cached_head) & (phlog)->mask;  \
+    if (__used * 100 >= m_logtrunc_high_watermark * ((phlog)->mask + 1)) {     \
+        (phlog)->cached_head = (phlog)->head;                                  \
+        __used = ((phlog)->tail - (phlog)->cached_head) & (phlog)->mask;       \
+    }                                                                          \
+    if (__used * 100 >= m_logtrunc_high_watermark * ((phlog)->mask + 1)) {     \
+        m_logtrunc_backpressure((volatile uint64_t *) &(phlog)->head,          \
+                                (phlog)->tail, (phlog)->mask);                 \
     }                                                                          \
 } while (0);
 
@@ -0,0 +1,185 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/**
+ * \file
+ *
+ * \brief Interface to shipping the redo logs to a standby.
+ *
+ * With log_ship_target set, the asynchronous truncation of a log copies the
+ * redo records of each committed fragment it reads (m_logship_store and 
+ * m_logship_logical, then m_logship_commit). At the end of each truncation
+ * pass the fragments of all logs are merged by commit sequence number, and
+ * those up to the durability watermark read when the pass began are handed
+ * to a sender thread that streams them over TCP; the others wait for a 
+ * later pass. Every commit up to the watermark was durable, hence read, by
+ * then, so the standby receives a prefix of the commit order. 
+ *
+ * A standby (log_ship_listen_port set) applies each batch through the 
+ * recovery apply path, makes it durable and acknowledges the last sequence
+ * number of the batch. It must start from a snapshot of the primary 
+ * (mtm_snapshot) taken before the primary starts shipping, and must not run
+ * transactions on the segments it receives.
+ *
+ * Wire format, in 64-bit words: a fragment is its sequence number, its 
+ * number of words and its records, each an address, a value and a mask, or
+ * LOGSHIP_LOGICAL, an opcode, a size in bytes and the argument words. A 
+ * batch ends with the sequence number of its last fragment and 
+ * LOGSHIP_BATCH_END; the standby answers with that sequence number.
+ *
+ * With log_ship_sync set as well, the logs are not shipped at truncation: 
+ * each transaction copies its records into a stream of its log as it 
+ * writes them (m_logship_sync_store, m_logship_sync_logical), and its 
+ * commit sends them to the standby as a batch of one fragment before 
+ * flushing its own log, then waits for the acknowledgment 
+ * (m_logship_sync_send, m_logship_sync_wait). The transaction is thus 
+ * durable on both nodes when its commit returns, at the cost of a round 
+ * trip that overlaps the local flush. Commits that conflict are sent in 
+ * commit order, since the later one cannot commit before the earlier one
+ * returns and releases its locks.
+ */
+#ifndef _LOGSHIP_H
+#define _LOGSHIP_H
+
+#include <stdint.h>
+#include <result.h>
+#include "log_i.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LOGSHIP_LOGICAL   0xFFFFFFFFFFFFFFFFLLU  /**< address word of a logical record */
+#define LOGSHIP_BATCH_END 0xFFFFFFFFFFFFFFFFLLU  /**< size word of the frame ending a batch */
+
+typedef struct m_logship_stream_s m_logship_stream_t;
+
+/** Redo records read from a log in the current truncation pass, or written by a transaction */
+struct m_logship_stream_s {
+	pcm_word_t *words;
+	uint64_t   nwords;
+	uint64_t   maxwords;
+	uint64_t   frag_start;   /**< header of the fragment being read, or INV_LOG_ORDER */
+};
+
+extern int m_logship_enabled;
+extern int m_logship_sync_enabled;
+
+m_result_t m_logship_init(uint64_t (*watermark)(void));
+void m_logship_stream_init(m_logship_stream_t *s);
+void m_logship_stream_append(m_logship_stream_t *s, pcm_word_t word);
+void m_logship_stream_commit(m_logship_stream_t *s, uint64_t sqn);
+void m_logship_stream_abort(m_logship_stream_t *s);
+uint64_t m_logship_sync_send(m_logship_stream_t *s, uint64_t sqn);
+void m_logship_sync_wait(uint64_t ticket);
+void m_logship_append(m_log_dsc_t *log_dsc, pcm_word_t word);
+void m_logship_commit(m_log_dsc_t *log_dsc, uint64_t sqn);
+void m_logship_abort(m_log_dsc_t *log_dsc);
+void m_logship_pass_begin(void);
+void m_logship_collect(m_log_dsc_t *log_dsc);
+void m_logship_pass_end(void);
+
+
+static inline
+void
+m_logship_store(m_log_dsc_t *log_dsc, uintptr_t addr, pcm_word_t value, pcm_word_t mask)
+{
+	if (m_logship_enabled) {
+		m_logship_append(log_dsc, (pcm_word_t) addr);
+		m_logship_append(log_dsc, value);
+		m_logship_append(log_dsc, mask);
+	}
+}
+
+
+/* Followed by the size bytes of arguments, a word at a time */
+static inline
+void
+m_logship_logical(m_log_dsc_t *log_dsc, pcm_word_t opcode, pcm_word_t size)
+{
+	if (m_logship_enabled) {
+		m_logship_append(log_dsc, LOGSHIP_LOGICAL);
+		m_logship_append(log_dsc, opcode);
+		m_logship_append(log_dsc, size);
+	}
+}
+
+
+static inline
+void
+m_logship_word(m_log_dsc_t *log_dsc, pcm_word_t word)
+{
+	if (m_logship_enabled) {
+		m_logship_append(log_dsc, word);
+	}
+}
+
+
+static inline
+void
+m_logship_sync_store(m_logship_stream_t *s, uintptr_t addr, pcm_word_t value, pcm_word_t mask)
+{
+	if (m_logship_sync_enabled) {
+		m_logship_stream_append(s, (pcm_word_t) addr);
+		m_logship_stream_append(s, value);
+		m_logship_stream_append(s, mask);
+	}
+}
+
+
+/* Followed by the size bytes of arguments, a word at a time */
+static inline
+void
+m_logship_sync_logical(m_logship_stream_t *s, pcm_word_t opcode, pcm_word_t size)
+{
+	if (m_logship_sync_enabled) {
+		m_logship_stream_append(s, LOGSHIP_LOGICAL);
+		m_logship_stream_append(s, opcode);
+		m_logship_stream_append(s, size);
+	}
+}
+
+
+static inline
+void
+m_logship_sync_word(m_logship_stream_t *s, pcm_word_t word)
+{
+	if (m_logship_sync_enabled) {
+		m_logship_stream_append(s, word);
+	}
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _LOGSHIP_H */
@@ -37,6 +37,7 @@
 #define _LOGTRUNC_H
 
 m_result_t m_logtrunc_init(m_logmgr_t *mgr);
+void m_logtrunc_start(void);
 m_result_t m_logtrunc_truncate(pcm_storeset_t *set);
 
 #endif /* _LOGTRUNC_H */
@@ -68,6 +68,7 @@
 #include <list.h>
 #include "../hal/pcm_i.h"
 #include "log_i.h"
+#include "groupcommit.h"
 
 
 #ifdef __cplusplus
@@ -85,7 +86,7 @@ struct m_phlog_base_nvmd_s {
 	pcm_word_t generic_flags;
 	pcm_word_t head;                         
 	pcm_word_t tail;     
-	pcm_word_t reserved4;                /**< reserved for future use */
+	pcm_word_t size_log2;                /**< log2 of the number of words in the physical log */
 	// char padding[32];
 };/* 32 bytes, possibly. Two of these can reside in one cache line */
 
@@ -99,20 +100,29 @@ struct m_phlog_base_nvmd_s {
  * ensure that writes are atomic. x86 guarantees atomicity of word writes 
  * if the words are aligned. All fields are word-sized so that when the 
  * whole structure is word aligned, each field is word-aligned.
+ *
+ * As in m_phlog_tornbit_s, the fields are grouped by who writes them, a 
+ * group per cacheline; the stable tail is published in nvmd->tail.
  */
 struct m_phlog_base_s {
+	/* written by the owner thread */
 	uint64_t                buffer[CHUNK_SIZE/sizeof(uint64_t)];    /**< software buffer to collect log writes till we form a complete chunk */
 	uint64_t                buffer_count;                           /**< number of valid words in the buffer */
-	uint64_t                *nvphlog;                               /**< points to the non-volatile physical log */
-	m_phlog_base_nvmd_t     *nvmd;                                  /**< points to the non-volatile metadata */
-	uint64_t                head;
 	uint64_t                tail;
-	uint64_t                read_index;
-
-	/* statistics */
-	uint64_t                pad1[8];                                /**< some padding to avoid having statistics in the same cacheline with metadata */
+	uint64_t                cached_head;                            /**< head as last read by the owner thread; lags behind head */
 	uint64_t                stat_wait_for_trunc;                    /**< number of times waited for asynchronous truncation */
 	uint64_t                stat_wait_time_for_trunc;               /**< total time waited for asynchronous truncation */
+
+	/* read-only after initialization */
+	uint64_t                *nvphlog __attribute__((aligned(CACHELINE_SIZE))); /**< points to the non-volatile physical log */
+	m_phlog_base_nvmd_t     *nvmd;                                  /**< points to the non-volatile metadata */
+	uint64_t                mask;                                   /**< number of words in the physical log minus one */
+
+	/* published by the consumer */
+	uint64_t                head __attribute__((aligned(CACHELINE_SIZE)));
+
+	/* written by the consumer */
+	uint64_t                read_index __attribute__((aligned(CACHELINE_SIZE)));
 };
 
 
@@ -129,26 +139,50 @@ base_write_buffer2log(pcm_storeset_t *set, m_phlog_base_t *log)
 {
 	/* 
 	 * Modulo arithmetic is implemented using the most efficient equivalent:
-	 * (log->tail + k) % PHYSICAL_LOG_NUM_ENTRIES == (log->tail + k) & (PHYSICAL_LOG_NUM_ENTRIES-1)
+	 * (log->tail + k) % (log->mask + 1) == (log->tail + k) & log->mask
 	 */
-	PCM_SEQSTREAM_STORE_64B_FIRST_WORD(set, (volatile pcm_word_t *) &log->nvphlog[(log->tail+0)], 
-	                                   (pcm_word_t) log->buffer[0]);
-	PCM_SEQSTREAM_STORE_64B_NEXT_WORD(set, (volatile pcm_word_t *) &log->nvphlog[(log->tail+1)], 
-	                                  (pcm_word_t) log->buffer[1]);
-	PCM_SEQSTREAM_STORE_64B_NEXT_WORD(set, (volatile pcm_word_t *) &log->nvphlog[(log->tail+2)], 
-	                                  (pcm_word_t) log->buffer[2]);
-	PCM_SEQSTREAM_STORE_64B_NEXT_WORD(set, (volatile pcm_word_t *) &log->nvphlog[(log->tail+3)], 
-	                                  (pcm_word_t) log->buffer[3]);
-	PCM_SEQSTREAM_STORE_64B_NEXT_WORD(set, (volatile pcm_word_t *) &log->nvphlog[(log->tail+4)], 
-	                                  (pcm_word_t) log->buffer[4]);
-	PCM_SEQSTREAM_STORE_64B_NEXT_WORD(set, (volatile pcm_word_t *) &log->nvphlog[(log->tail+5)], 
-	                                  (pcm_word_t) log->buffer[5]);
-	PCM_SEQSTREAM_STORE_64B_NEXT_WORD(set, (volatile pcm_word_t *) &log->nvphlog[(log->tail+6)], 
-	                                  (pcm_word_t) log->buffer[6]);
-	PCM_SEQSTREAM_STORE_64B_NEXT_WORD(set, (volatile pcm_word_t *) &log->nvphlog[(log->tail+7)], 
-	                                  (pcm_word_t) log->buffer[7]);
+	if (PHLOG_GROUP_COMMIT()) {
+		PCM_WB_STORE_64B(set, &log->nvphlog[log->tail], log->buffer);
+	} else {
+		PCM_SEQSTREAM_STORE_64B_FIRST_WORD(set, (volatile pcm_word_t *) &log->nvphlog[(log->tail+0)], 
+		                                   (pcm_word_t) log->buffer[0]);
+		PCM_SEQSTREAM_STORE_64B_NEXT_WORD(set, (volatile pcm_word_t *) &log->nvphlog[(log->tail+1)], 
+		                                  (pcm_word_t) log->buffer[1]);
+		PCM_SEQSTREAM_STORE_64B_NEXT_WORD(set, (volatile pcm_word_t *) &log->nvphlog[(log->tail+2)], 
+		                                  (pcm_word_t) log->buffer[2]);
+		PCM_SEQSTREAM_STORE_64B_NEXT_WORD(set, (volatile pcm_word_t *) &log->nvphlog[(log->tail+3)], 
+		                                  (pcm_word_t) log->buffer[3]);
+		PCM_SEQSTREAM_STORE_64B_NEXT_WORD(set, (volatile pcm_word_t *) &log->nvphlog[(log->tail+4)], 
+		                                  (pcm_word_t) log->buffer[4]);
+		PCM_SEQSTREAM_STORE_64B_NEXT_WORD(set, (volatile pcm_word_t *) &log->nvphlog[(log->tail+5)], 
+		                                  (pcm_word_t) log->buffer[5]);
+		PCM_SEQSTREAM_STORE_64B_NEXT_WORD(set, (volatile pcm_word_t *) &log->nvphlog[(log->tail+6)], 
+		                                  (pcm_word_t) log->buffer[6]);
+		PCM_SEQSTREAM_STORE_64B_NEXT_WORD(set, (volatile pcm_word_t *) &log->nvphlog[(log->tail+7)], 
+		                                  (pcm_word_t) log->buffer[7]);
+	}
 	log->buffer_count=0;
-	log->tail = (log->tail+8) & (PHYSICAL_LOG_NUM_ENTRIES-1);
+	log->tail = (log->tail+8) & log->mask;
+}
+
+
+/**
+ * \brief Returns whether writing out another chunk would overflow the log.
+ *
+ * Reads head, which the consumer moves, only if the log looks full with 
+ * the cached copy.
+ */
+static inline
+bool
+base_log_full(m_phlog_base_t *log)
+{
+	uint64_t next_tail = (log->tail + CHUNK_SIZE/sizeof(pcm_word_t)) & log->mask;
+
+	if (next_tail != log->cached_head) {
+		return false;
+	}
+	log->cached_head = log->head;
+	return next_tail == log->cached_head;
 }
 
 
@@ -174,8 +208,7 @@ m_phlog_base_write(pcm_storeset_t *set, m_phlog_base_t *log, pcm_word_t value)
 	/* Will new write fill buffer and require flushing out to log? */
 	if (log->buffer_count+1 > CHUNK_SIZE/sizeof(pcm_word_t)-1) {
 		/* Will log overflow? */
-		if (((log->tail + CHUNK_SIZE/sizeof(pcm_word_t)) & (PHYSICAL_LOG_NUM_ENTRIES-1))
-		    == log->head)
+		if (base_log_full(log))
 		{
 			return M_R_FAILURE;
 		} else {
@@ -206,10 +239,21 @@ m_phlog_base_flush(pcm_storeset_t *set, m_phlog_base_t *log)
 	if (log->buffer_count > 0) { /* freud : There are still some stores left in buffer */
 		base_write_buffer2log(set, log);
 	}	
-	PCM_SEQSTREAM_FLUSH(set); /* freud : necessary fence */
+	if (PHLOG_GROUP_COMMIT()) {
+		/* The epoch leader writes back the chunks and publishes the tail */
+		m_groupcommit_member_t member = { log->nvphlog, log->mask, 
+		                                  log->nvmd->tail, log->tail,
+		                                  (volatile pcm_word_t *) &log->nvmd->tail, 
+		                                  (pcm_word_t) log->tail };
+		m_groupcommit_join(set, &member);
+		return M_R_SUCCESS;
+	}
+	if (!m_log_unsafe_nobarrier) {
+		PCM_SEQSTREAM_FLUSH(set); /* freud : necessary fence */
+	}
 	PCM_NT_STORE(set, (volatile pcm_word_t *) &log->nvmd->tail, 
 	             (pcm_word_t) log->tail);
-	PCM_WB_FENCE(set); /* freud : necessary fence */
+	PHLOG_PERSIST_BARRIER(set); /* freud : necessary fence */
 	// nvmd->tail and nvmd->head are in the same cacheline; hence self-dependency.
 	return M_R_SUCCESS;
 }
@@ -230,7 +274,7 @@ m_phlog_base_read(m_phlog_base_t *log, uint64_t *valuep)
 	/* Are there any stable data to read? */
 	if (log->read_index != log->nvmd->tail) {
 		value = log->nvphlog[log->read_index];
-		log->read_index = (log->read_index + 1) & (PHYSICAL_LOG_NUM_ENTRIES - 1);
+		log->read_index = (log->read_index + 1) & log->mask;
 		*valuep = value;
 		return M_R_SUCCESS;
 	}
@@ -273,7 +317,7 @@ m_phlog_base_next_chunk(m_phlog_base_t *log)
 	 * then we are already in the next chunk so we don't need to advance.
 	 */
 	if (read_index != log->read_index) {
-		log->read_index = (read_index + CHUNK_SIZE/sizeof(pcm_word_t)) & (PHYSICAL_LOG_NUM_ENTRIES-1); 
+		log->read_index = (read_index + CHUNK_SIZE/sizeof(pcm_word_t)) & log->mask; 
 	}
 }
 
@@ -312,21 +356,23 @@ static inline
 m_result_t
 m_phlog_base_truncate_sync(pcm_storeset_t *set, m_phlog_base_t *phlog) 
 {
-	phlog->head = phlog->tail;
+	phlog->head = phlog->cached_head = phlog->tail;
 	/* freud : truncating the log by advancing the head, you could pull back the tail */
 	PCM_NT_STORE(set, (volatile pcm_word_t *) &phlog->nvmd->head, 
 	             (pcm_word_t) phlog->head);
-	PCM_NT_FLUSH(set);
+	PCM_PERSIST_BARRIER(set);
 	
 	return M_R_SUCCESS;
 }
 
 
-m_result_t m_phlog_base_format (pcm_storeset_t *set, m_phlog_base_nvmd_t *nvmd, pcm_word_t *nvphlog, int type);
+m_result_t m_phlog_base_format (pcm_storeset_t *set, m_phlog_base_nvmd_t *nvmd, pcm_word_t *nvphlog, int type, int size_log2);
 m_result_t m_phlog_base_alloc (m_phlog_base_t **phlog_basep);
 m_result_t m_phlog_base_init (m_phlog_base_t *phlog, m_phlog_base_nvmd_t *nvmd, pcm_word_t *nvphlog);
 m_result_t m_phlog_base_check_consistency(m_phlog_base_nvmd_t *nvmd, pcm_word_t *nvphlog, uint64_t *stable_tail);
 m_result_t m_phlog_base_truncate_async(pcm_storeset_t *set, m_phlog_base_t *phlog);
+pcm_word_t m_phlog_base_truncation_point(m_phlog_base_t *phlog);
+m_result_t m_phlog_base_truncate_to(pcm_storeset_t *set, m_phlog_base_t *phlog, pcm_word_t point);
 
 
 #ifdef __cplusplus
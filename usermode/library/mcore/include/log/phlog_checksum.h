@@ -0,0 +1,405 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+
+/**
+ * \file
+ * 
+ * \brief Physical log implemented using a CRC32C checksum per atomic log 
+ * fragment to detect fragments that did not make it to persistent memory.
+ *
+ * NON-VOLATILE PHYSICAL LOG FORMAT:
+ *
+ * The payload words of a fragment are stored as is. The fragment ends with
+ * a trailer word, followed by padding up to the end of the chunk:
+ *
+ * +---------+-----+---------+----------------------------+---------+
+ * | word 0  | ... | word n  |          trailer           | padding |
+ * +---------+-----+---------+-------------+--------------+---------+
+ * | Payload | ... | Payload | TRAILER_TAG | CRC32C(0..n) |   ...   |
+ * +---------+-----+---------+-------------+--------------+---------+
+ *
+ * The CRC is seeded with the index the fragment starts at and the pass bit
+ * of the current pass over the log, so that a fragment left over from an 
+ * earlier pass never validates. Recovery scans from the head and the stable 
+ * region ends at the first fragment without a matching trailer. Hence 
+ * neither the tail nor per-word torn bits have to be persisted: a commit 
+ * costs a single persist barrier.
+ *
+ * INVARIANTS:
+ *
+ * 1. Head and tail always advance by the number of words in a chunk.
+ *    Fragments always start at a chunk boundary.
+ *
+ * TERMINOLOGY:
+ *
+ * Atomic log fragment: a region of the log guaranteed to be made persistent.
+ *
+ */
+
+#ifndef _PHYSICAL_LOG_CHECKSUM_H
+#define _PHYSICAL_LOG_CHECKSUM_H
+
+/* System header files */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+/* Mnemosyne common header files */
+#include <result.h>
+#include <list.h>
+#include "../hal/pcm_i.h"
+#include "log_i.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#define CHUNK_SIZE              64
+
+#define CHECKSUM_CHUNK_NWORDS   (CHUNK_SIZE/sizeof(pcm_word_t))
+#define CHECKSUM_TRAILER_TAG    0xC4ECC5A100000000LLU /* upper half of a fragment trailer */
+
+#define LF_PASS                 0x8000000000000000LLU
+#define LF_PASS_HEAD_MASK       0x00000000FFFFFFFFLLU
+
+
+
+typedef struct m_phlog_checksum_s      m_phlog_checksum_t;
+typedef struct m_phlog_checksum_nvmd_s m_phlog_checksum_nvmd_t;
+
+struct m_phlog_checksum_nvmd_s {
+	pcm_word_t generic_flags;
+	pcm_word_t flags;                         /**< the MSB is the pass bit of the head while the LSB part stores the head index */
+	pcm_word_t generation;                    /**< bumped by every format; seeds the fragment checksums */
+	pcm_word_t size_log2;                     /**< log2 of the number of words in the physical log */
+};
+
+
+
+
+/** 
+ * The volatile representation of the physical log 
+ *
+ * To allow a consumer read metadata and values without locking we need to 
+ * ensure that writes are atomic. x86 guarantees atomicity of word writes 
+ * if the words are aligned. All fields are word-sized so that when the 
+ * whole structure is word aligned, each field is word-aligned.
+ *
+ * As in m_phlog_tornbit_s, the fields are grouped by who writes them, a 
+ * group per cacheline.
+ */
+struct m_phlog_checksum_s {
+	/* written by the owner thread */
+	uint64_t                buffer[CHUNK_SIZE/sizeof(uint64_t)];    /**< software buffer to collect log writes till we form a complete chunk */
+	uint64_t                buffer_count;                           /**< number of valid words in the buffer */
+	uint64_t                crc;                                    /**< running CRC32C of the current fragment */
+	uint64_t                tail;
+	uint64_t                pass;                                   /**< pass bit of the tail */
+	uint64_t                cached_head;                            /**< head as last read by the owner thread; lags behind head */
+	uint64_t                stat_wait_for_trunc;                    /**< number of times waited for asynchronous truncation */
+	uint64_t                stat_wait_time_for_trunc;               /**< total time waited for asynchronous truncation */
+	uint64_t                stat_chunks;                            /**< number of chunks written out */
+	uint64_t                stat_padded_chunks;                     /**< number of chunks a flush wrote out before they were full */
+	uint64_t                stat_pad_words;                         /**< number of payload words those chunks left unused */
+
+	/* read-only after initialization */
+	uint64_t                *nvphlog __attribute__((aligned(CACHELINE_SIZE))); /**< points to the non-volatile physical log */
+	m_phlog_checksum_nvmd_t *nvmd;                                  /**< points to the non-volatile metadata */
+	uint64_t                mask;                                   /**< number of words in the physical log minus one */
+	uint64_t                generation;                             /**< generation of the non-volatile log */
+
+	/* published by the owner thread */
+	uint64_t                stable_tail __attribute__((aligned(CACHELINE_SIZE))); /**< data between head and stable_tail have been made persistent */
+
+	/* published by the consumer */
+	uint64_t                head __attribute__((aligned(CACHELINE_SIZE)));
+
+	/* written by the consumer */
+	uint64_t                read_index __attribute__((aligned(CACHELINE_SIZE)));
+};
+
+
+/**
+ * \brief Accumulates a word into a CRC32C using the SSE4.2 crc32 
+ * instruction. 
+ *
+ * Inline assembly keeps the log usable from code not compiled with 
+ * -msse4.2.
+ */
+static inline
+uint64_t
+checksum_crc32c(uint64_t crc, pcm_word_t word)
+{
+	__asm__ __volatile__ ("crc32q %1, %0" : "+r" (crc) : "rm" (word));
+	return crc;
+}
+
+
+/**
+ * \brief Returns the initial CRC of a fragment starting at index with the
+ * given pass bit.
+ *
+ * The seed also binds the fragment to the generation of the log, so that 
+ * fragments left over from a previous use never validate after the log is 
+ * formatted again.
+ */
+static inline
+uint64_t
+checksum_seed(uint64_t index, uint64_t pass, uint64_t generation)
+{
+	return checksum_crc32c(checksum_crc32c(0xFFFFFFFFLLU, index | pass), generation);
+}
+
+
+/**
+ * \brief Writes the contents of the log buffer to the actual log.
+ *
+ * Does not guarantee that the contents actually made it to persistent memory. 
+ * A separate action to flush the log to memory is needed. 
+ */
+static inline
+void
+checksum_write_buffer2log(pcm_storeset_t *set, m_phlog_checksum_t *log)
+{
+	volatile pcm_word_t *chunk = &log->nvphlog[log->tail];
+
+	PCM_SEQSTREAM_STORE_64B(set, chunk, log->buffer);
+	log->stat_chunks++;
+	log->buffer_count=0;
+	/* 
+	 * Modulo arithmetic is implemented using the most efficient equivalent:
+	 * (log->tail + k) % (log->mask + 1) == (log->tail + k) & log->mask
+	 */
+	log->tail = (log->tail+CHECKSUM_CHUNK_NWORDS) & log->mask;
+
+	/* Flip pass bit if wrap around */
+	if (log->tail == 0x0) {
+		log->pass = ~(log->pass) & LF_PASS;
+	}
+}
+
+
+/**
+ * \brief Returns whether writing out another chunk would overflow the log.
+ *
+ * Reads head, which the consumer moves, only if the log looks full with 
+ * the cached copy.
+ */
+static inline
+bool
+checksum_log_full(m_phlog_checksum_t *log)
+{
+	uint64_t next_tail = (log->tail + CHECKSUM_CHUNK_NWORDS) & log->mask;
+
+	if (next_tail != log->cached_head) {
+		return false;
+	}
+	log->cached_head = log->head;
+	return next_tail == log->cached_head;
+}
+
+
+/** 
+ * \brief Writes a given value to the physical log. 
+ *
+ * Value is first buffered and only written to the log when a complete
+ * chunk is formed or when the log is flushed explicitly via 
+ * m_phlog_flush.
+ */
+static inline
+m_result_t
+m_phlog_checksum_write(pcm_storeset_t *set, m_phlog_checksum_t *log, pcm_word_t value)
+{
+	/* 
+	 * Check there is space in the buffer and in the log before writing the
+	 * new value. This duplicates some code but doesn't require unrolling state
+	 * in case of any error.
+	 */
+
+	/* Will new write fill buffer and require writing out the chunk? */
+	if (log->buffer_count+1 == CHECKSUM_CHUNK_NWORDS) {
+		/* Will log overflow? */
+		if (checksum_log_full(log)) {
+			return M_R_FAILURE;
+		}
+		log->buffer[log->buffer_count] = value; 
+		log->buffer_count++;
+		checksum_write_buffer2log(set, log);
+	} else {
+		log->buffer[log->buffer_count] = value;
+		log->buffer_count++;
+	}
+	log->crc = checksum_crc32c(log->crc, value);
+
+	return M_R_SUCCESS;
+}
+
+
+/**
+ * \brief Closes the current atomic log fragment and flushes the log to 
+ * SCM memory.
+ *
+ * The fragment trailer is appended to the buffered writes and the last 
+ * chunk is written out, padded if necessary. No metadata update is needed
+ * to make the fragment visible to recovery.
+ */
+static inline
+m_result_t
+m_phlog_checksum_flush(pcm_storeset_t *set, m_phlog_checksum_t *log)
+{
+	/* The trailer fits in the buffer, so exactly one chunk is written out */
+	if (checksum_log_full(log)) {
+		return M_R_FAILURE;
+	}
+	log->buffer[log->buffer_count] = CHECKSUM_TRAILER_TAG | log->crc;
+	if (log->buffer_count + 1 < CHECKSUM_CHUNK_NWORDS) {
+		log->stat_padded_chunks++;
+		log->stat_pad_words += CHECKSUM_CHUNK_NWORDS - log->buffer_count - 1;
+	}
+	checksum_write_buffer2log(set, log);
+	log->crc = checksum_seed(log->tail, log->pass, log->generation);
+	PHLOG_PERSIST_BARRIER(set);
+	log->stable_tail = log->tail;
+
+	return M_R_SUCCESS;
+}
+
+
+/**
+ * \brief Reads a single word from the stable part of the log. 
+ *
+ * The stable part is the one that has made it to SCM memory.
+ *
+ */
+static inline
+m_result_t
+m_phlog_checksum_read(m_phlog_checksum_t *log, uint64_t *valuep)
+{
+	/* Are there any stable data to read? */
+	if (log->read_index != log->stable_tail) {
+		*valuep = log->nvphlog[log->read_index];
+		log->read_index = (log->read_index + 1) & log->mask;
+		return M_R_SUCCESS;
+	}
+	return M_R_FAILURE;
+}
+
+
+/**
+ * \brief Checks whether there is a stable part of the log to read. 
+ *
+ * The stable part is the one that has made it to SCM memory.
+ *
+ */
+static inline
+bool
+m_phlog_checksum_stable_exists(m_phlog_checksum_t *log)
+{
+	if (log->read_index != log->stable_tail) {
+		return true;
+	}
+	return false;
+}
+
+
+
+/** 
+ * \brief Moves read pointer past the trailer of the fragment just read 
+ * and the padding of its last chunk.
+ *
+ * Must be called right after reading the last payload word of a fragment.
+ */
+static inline
+void
+m_phlog_checksum_next_chunk(m_phlog_checksum_t *log)
+{
+	uint64_t read_index; 
+
+	/* Skip the trailer and align up to the next chunk */
+	read_index = log->read_index + CHECKSUM_CHUNK_NWORDS;
+	log->read_index = (read_index & ~(CHECKSUM_CHUNK_NWORDS - 1)) & log->mask; 
+}
+
+
+/**
+ * \brief Checkpoints the read pointer to allow re-reading data from the
+ * checkpointed point. 
+ */
+static inline
+m_result_t
+m_phlog_checksum_checkpoint_readindex(m_phlog_checksum_t *log, uint64_t *readindex)
+{
+	*readindex = log->read_index;
+
+	return M_R_SUCCESS;
+}
+
+
+/**
+ * \brief Restored the read pointer.
+ */
+static inline
+void
+m_phlog_checksum_restore_readindex(m_phlog_checksum_t *log, uint64_t readindex)
+{
+	log->read_index = readindex;
+}
+
+
+static inline
+m_result_t
+m_phlog_checksum_truncate_sync(pcm_storeset_t *set, m_phlog_checksum_t *phlog) 
+{
+	phlog->head = phlog->cached_head = phlog->tail;
+
+	PCM_NT_STORE(set, (volatile pcm_word_t *) &phlog->nvmd->flags, (pcm_word_t) (phlog->head | phlog->pass));
+	PCM_PERSIST_BARRIER(set);
+	
+	return M_R_SUCCESS;
+}
+
+m_result_t m_phlog_checksum_format (pcm_storeset_t *set, m_phlog_checksum_nvmd_t *nvmd, pcm_word_t *nvphlog, int type, int size_log2);
+m_result_t m_phlog_checksum_alloc (m_phlog_checksum_t **phlog_checksump);
+m_result_t m_phlog_checksum_init (m_phlog_checksum_t *phlog, m_phlog_checksum_nvmd_t *nvmd, pcm_word_t *nvphlog);
+m_result_t m_phlog_checksum_check_consistency(m_phlog_checksum_nvmd_t *nvmd, pcm_word_t *nvphlog, uint64_t *stable_tail);
+m_result_t m_phlog_checksum_truncate_async(pcm_storeset_t *set, m_phlog_checksum_t *phlog);
+pcm_word_t m_phlog_checksum_truncation_point(m_phlog_checksum_t *phlog);
+m_result_t m_phlog_checksum_truncate_to(pcm_storeset_t *set, m_phlog_checksum_t *phlog, pcm_word_t point);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _PHYSICAL_LOG_CHECKSUM_H */
@@ -33,36 +33,36 @@
 /**
  * \file
  * 
- * \brief Physical log implemented using a torn-bit per word to detect
- * torn words. 
+ * \brief Physical log implemented using a torn bit per chunk to detect
+ * torn chunks. 
  *
  * NON-VOLATILE PHYSICAL LOG FORMAT:
  *
- * +----------------------------------------------------------+ 
- * |                       64-bit WORD                        |
- * +-------------------------------+--------+-----------------+
- * |             Byte 7            |   ...  |      Byte 0     |
- * +---+---+---+---+---+---+---+---+--------+---+-----+---+---+
- * |b63|b62|b61|b60|b59|b58|b57|b56|        |b07| ... |b01|b00|
- * +---+---+---+---+---+---+---+---+--------+---+-----+---+---+
- * | T |                      Payload                         | 
- * +---+------------------------------------------------------+
+ * The log is a sequence of 64-byte chunks. The first 7 words of a chunk 
+ * hold the payload as is; the last word is the chunk header:
  *
+ * +---------+---------+-----+---------+---------------------------------+
+ * | word 0  | word 1  | ... | word 6  |             header              |
+ * +---------+---------+-----+---------+---+-----------------------------+
+ * | Payload | Payload | ... | Payload | T |  checksum of words 0 .. 6   |
+ * +---------+---------+-----+---------+---+-----------------------------+
+ *
+ * A chunk is valid if its header carries the torn bit of the current pass 
+ * over the log and the checksum of its payload. A chunk whose write was 
+ * torn by a crash either keeps the header of the previous pass or fails 
+ * the checksum.
  *
  * INVARIANTS:
  *
- * 1. Head and tail always advance by the number of buffer entries.
+ * 1. Head and tail always advance by the number of words in a chunk.
  *    
- *    For example if cache-line size is 64 bytes and word is 64-bits,
- *    then the buffer has 8 entries to ensuere that there would always
- *    be a complete cacheline to write to the hardware WC buffer. 
- *    Since buffer has 8 entries, we advance head and tail by 8 entries
- *    as well. In the case when we flush the log, the buffer might not
- *    be full. We still flush 8 entries even if the buffer is full and
- *    we advance tail by 8. This simplifies and makes bounds checking
- *    faster by requiring less conditions (less branches, no-memory fences).
+ *    A chunk is always written out as a complete cacheline to the hardware
+ *    WC buffer. In the case when we flush the log, the buffer might not
+ *    be full. We still write the whole chunk and advance tail by 8. This 
+ *    simplifies and makes bounds checking faster by requiring less 
+ *    conditions (less branches, no-memory fences).
  *
- * 2. todo: state the rest of the invariants
+ * 2. The read index never points to a chunk header.
  *
  * TERMINOLOGY:
  *
@@ -70,17 +70,6 @@
  *
  */
 
-/*
- * FIXME: Tornbit currently appears to be working correctly and passing our 
- *        tests. Developing it was quite painful mainly due to some
- *        optimizations (to avoid branches), which is not clear whether 
- *        they paid off. Thus, the author fills a simpler, more robust 
- *        implementation with good performance should be possible. 
- *        Reconsider a simpler implementation...
- *        
- *
- */
-
 
 #ifndef _PHYSICAL_LOG_TORNBIT_H
 #define _PHYSICAL_LOG_TORNBIT_H
@@ -95,8 +84,6 @@
 #include "../hal/pcm_i.h"
 #include "log_i.h"
 
-uint64_t load_nt_word(void *addr);
-
 #undef _DEBUG_THIS 
 //#define _DEBUG_THIS 1
 
@@ -106,6 +93,8 @@ extern "C" {
 
 
 #define CHUNK_SIZE              64
+#define CHUNK_NWORDS            (CHUNK_SIZE/sizeof(pcm_word_t))
+#define CHUNK_PAYLOAD_NWORDS    (CHUNK_NWORDS - 1) /* the last word is the chunk header */
 
 
 #define TORN_MASK               0x8000000000000000LLU
@@ -125,7 +114,7 @@ struct m_phlog_tornbit_nvmd_s {
 	pcm_word_t generic_flags;
 	pcm_word_t flags;                         /**< the MSB part is reserved for flags while the LSB part stores the head index */
 	pcm_word_t reserved3;                     /**< reserved for future use */
-	pcm_word_t reserved4;                     /**< reserved for future use */
+	pcm_word_t size_log2;                     /**< log2 of the number of words in the physical log */
 };
 
 
@@ -138,29 +127,48 @@ struct m_phlog_tornbit_nvmd_s {
  * ensure that writes are atomic. x86 guarantees atomicity of word writes 
  * if the words are aligned. All fields are word-sized so that when the 
  * whole structure is word aligned, each field is word-aligned.
+ *
+ * The fields are grouped by who writes them, a group per cacheline, so 
+ * that the log truncation (the consumer) moving head and read_index does 
+ * not invalidate the line the owner thread appends through, and flushes do
+ * not invalidate the consumer's. The owner checks for space against 
+ * cached_head, and reads head again only when the log looks full.
  */
 struct m_phlog_tornbit_s {
+	/* written by the owner thread */
 	uint64_t                buffer[CHUNK_SIZE/sizeof(uint64_t)];    /**< software buffer to collect log writes till we form a complete chunk */
-	uint64_t                buffer_count;                           /**< number of valid words in the buffer */
-	uint64_t                write_remainder;                        /**< the remainder bits after the encoding operation */
-	uint64_t                write_remainder_nbits;                  /**< number of the valid least-significant bits of the write_remainder buffer */
-	uint64_t                read_remainder;                         /**< the remainder bits after the decoding operation */
-	uint64_t                read_remainder_nbits;                   /**< number of the valid least-significant bits of the read_remainder buffer */
-	uint64_t                *nvphlog;                               /**< points to the non-volatile physical log */
-	m_phlog_tornbit_nvmd_t  *nvmd;                                  /**< points to the non-volatile metadata */
-	uint64_t                head;
+	uint64_t                buffer_count;                           /**< number of valid payload words in the buffer */
 	uint64_t                tail;
-	uint64_t                stable_tail;                            /**< data between head and stable_tail have been made persistent */
-	uint64_t                read_index;
 	uint64_t                tornbit;
-	//uint64_t              tornbit[CHUNK_SIZE/sizeof(uint64_t)];
-	
-	/* statistics */
-	uint64_t                pad1[8];                                /**< some padding to avoid having statistics in the same cacheline with metadata */
+	uint64_t                cached_head;                            /**< head as last read by the owner thread; lags behind head */
 	uint64_t                stat_wait_for_trunc;                    /**< number of times waited for asynchronous truncation */
 	uint64_t                stat_wait_time_for_trunc;               /**< total time waited for asynchronous truncation */
+	uint64_t                stat_chunks;                            /**< number of chunks written out */
+	uint64_t                stat_padded_chunks;                     /**< number of chunks a flush wrote out before they were full */
+	uint64_t                stat_pad_words;                         /**< number of payload words those chunks left unused */
+
+	/* read-only after initialization */
+	uint64_t                *nvphlog __attribute__((aligned(CACHELINE_SIZE))); /**< points to the non-volatile physical log */
+	m_phlog_tornbit_nvmd_t  *nvmd;                                  /**< points to the non-volatile metadata */
+	uint64_t                mask;                                   /**< number of words in the physical log minus one */
+
+	/* published by the owner thread */
+	uint64_t                stable_tail __attribute__((aligned(CACHELINE_SIZE))); /**< data between head and stable_tail have been made persistent */
+
+	/* published by the consumer */
+	uint64_t                head __attribute__((aligned(CACHELINE_SIZE)));
+
+	/* written by the consumer */
+	uint64_t                read_index __attribute__((aligned(CACHELINE_SIZE)));
+	uint64_t                read_chunk_index;                       /**< index of the chunk in read_chunk, TORNBIT_NO_CHUNK if none */
+	uint64_t                read_chunk[CHUNK_NWORDS] __attribute__((aligned(CACHELINE_SIZE))); /**< copy of the chunk read_index is in */
 };
 
+/* Never the index of a chunk, which is a multiple of CHUNK_NWORDS */
+#define TORNBIT_NO_CHUNK        ((uint64_t) -1)
+
+void m_phlog_tornbit_load_chunk(m_phlog_tornbit_t *log, uint64_t index);
+
 
 static 
 void 
@@ -178,6 +186,24 @@ print_binary64(uint64_t val)
 }
 
 
+/**
+ * \brief Returns the checksum stored in the header of a chunk with the 
+ * given payload.
+ */
+static inline
+pcm_word_t
+tornbit_chunk_checksum(const pcm_word_t *payload)
+{
+	pcm_word_t checksum = 0;
+	int        i;
+
+	for (i=0; i<CHUNK_PAYLOAD_NWORDS; i++) {
+		checksum = ((checksum << 1) | (checksum >> 63)) ^ payload[i];
+	}
+	return checksum & TORN_MASKC;
+}
+
+
 /**
  * \brief Writes the contents of the log buffer to the actual log.
  *
@@ -188,33 +214,26 @@ static inline
 void
 tornbit_write_buffer2log(pcm_storeset_t *set, m_phlog_tornbit_t *log)
 {
-	/* 
-	 * Modulo arithmetic is implemented using the most efficient equivalent:
-	 * (log->tail + k) % PHYSICAL_LOG_NUM_ENTRIES == (log->tail + k) & (PHYSICAL_LOG_NUM_ENTRIES-1)
-	 */
+	volatile pcm_word_t *chunk = &log->nvphlog[log->tail];
+
 #ifdef _DEBUG_THIS		
 	printf("tornbit_write_buffer2log: log->tail = %llu\n", log->tail);	 
 #endif	
-
-	PCM_SEQSTREAM_STORE_64B_FIRST_WORD(set, (volatile pcm_word_t *) &log->nvphlog[(log->tail+0)], 
-	                                   log->tornbit | (pcm_word_t) log->buffer[0]);
-	PCM_SEQSTREAM_STORE_64B_NEXT_WORD(set, (volatile pcm_word_t *) &log->nvphlog[(log->tail+1)], 
-	                                  log->tornbit | (pcm_word_t) log->buffer[1]);
-	PCM_SEQSTREAM_STORE_64B_NEXT_WORD(set, (volatile pcm_word_t *) &log->nvphlog[(log->tail+2)], 
-	                                  log->tornbit | (pcm_word_t) log->buffer[2]);
-	PCM_SEQSTREAM_STORE_64B_NEXT_WORD(set, (volatile pcm_word_t *) &log->nvphlog[(log->tail+3)], 
-	                                  log->tornbit | (pcm_word_t) log->buffer[3]);
-	PCM_SEQSTREAM_STORE_64B_NEXT_WORD(set, (volatile pcm_word_t *) &log->nvphlog[(log->tail+4)], 
-	                                  log->tornbit | (pcm_word_t) log->buffer[4]);
-	PCM_SEQSTREAM_STORE_64B_NEXT_WORD(set, (volatile pcm_word_t *) &log->nvphlog[(log->tail+5)], 
-	                                  log->tornbit | (pcm_word_t) log->buffer[5]);
-	PCM_SEQSTREAM_STORE_64B_NEXT_WORD(set, (volatile pcm_word_t *) &log->nvphlog[(log->tail+6)], 
-	                                  log->tornbit | (pcm_word_t) log->buffer[6]);
-	PCM_SEQSTREAM_STORE_64B_NEXT_WORD(set, (volatile pcm_word_t *) &log->nvphlog[(log->tail+7)], 
-	                                  log->tornbit | (pcm_word_t) log->buffer[7]);
+	/* Payload words past buffer_count are stale but covered by the checksum */
+	log->buffer[CHUNK_PAYLOAD_NWORDS] = log->tornbit | tornbit_chunk_checksum(log->buffer);
+	if (PHLOG_GROUP_COMMIT()) {
+		PCM_WB_STORE_64B(set, chunk, log->buffer);
+	} else {
+		PCM_SEQSTREAM_STORE_64B(set, chunk, log->buffer);
+	}
+	log->stat_chunks++;
 
 	log->buffer_count=0;
-	log->tail = (log->tail+8) & (PHYSICAL_LOG_NUM_ENTRIES-1);
+	/* 
+	 * Modulo arithmetic is implemented using the most efficient equivalent:
+	 * (log->tail + k) % (log->mask + 1) == (log->tail + k) & log->mask
+	 */
+	log->tail = (log->tail+CHUNK_NWORDS) & log->mask;
 
 	/* Flip tornbit if wrap around */
 	if (log->tail == 0x0) {
@@ -223,6 +242,26 @@ tornbit_write_buffer2log(pcm_storeset_t *set, m_phlog_tornbit_t *log)
 }
 
 
+/**
+ * \brief Returns whether writing out another chunk would overflow the log.
+ *
+ * Reads head, which the consumer moves, only if the log looks full with 
+ * the cached copy.
+ */
+static inline
+bool
+tornbit_log_full(m_phlog_tornbit_t *log)
+{
+	uint64_t next_tail = (log->tail + CHUNK_NWORDS) & log->mask;
+
+	if (next_tail != log->cached_head) {
+		return false;
+	}
+	log->cached_head = log->head;
+	return next_tail == log->cached_head;
+}
+
+
 /** 
  * \brief Writes a given value to the physical log. 
  *
@@ -237,93 +276,76 @@ m_phlog_tornbit_write(pcm_storeset_t *set, m_phlog_tornbit_t *log, pcm_word_t va
 	/* 
 	 * Check there is space in the buffer and in the log before writing the
 	 * new value. This duplicates some code but doesn't require unrolling state
-	 * in case of any error. We could also avoid duplication by putting some
-	 * extra branches but we prefer as few branches as possible in the critical
-	 * path.
+	 * in case of any error.
 	 */
 
 #ifdef _DEBUG_THIS
-	printf("buffer_count = %lu, write_remainder_nbits = %lu, log->head=%lu, log->tail=%lu\n", log->buffer_count, log->write_remainder_nbits, log->head, log->tail);
+	printf("buffer_count = %lu, log->head=%lu, log->tail=%lu\n", log->buffer_count, log->head, log->tail);
 	printf("value = 0x%llX\n", value);
-	printf("[T: %x] &log->tail= %p\n", pthread_self(), &log->tail);
 #endif
-	/* Will new write flush buffer out to log? */
-	if (log->buffer_count+1 > CHUNK_SIZE/sizeof(pcm_word_t)-1) {
-		/* UNCOMMON PATH */
+	/* Will new write fill the payload and require writing out the chunk? */
+	if (log->buffer_count+1 == CHUNK_PAYLOAD_NWORDS) {
 		/* Will log overflow? */
-		if (((log->tail + CHUNK_SIZE/sizeof(pcm_word_t)) & (PHYSICAL_LOG_NUM_ENTRIES-1))
-		    == log->head)
-		{
+		if (tornbit_log_full(log)) {
 #ifdef _DEBUG_THIS
 			printf("LOG OVERFLOW!!!\n");
 			printf("tail: %lu\n", log->tail);
 			printf("head: %lu\n", log->head);
 #endif			
 			return M_R_FAILURE;
-		} else {
-#ifdef _DEBUG_THIS		
-			printf("FLUSH BUFFER OUT\n");
-#endif			
-			log->buffer[log->buffer_count] = ~TORN_MASK & 
-											 (log->write_remainder | 
-											  (value << log->write_remainder_nbits));
-			/* the new remainder is the part of the value not written to the buffer */								  
-			log->write_remainder = value >> (64 - (log->write_remainder_nbits+1));
-			log->write_remainder_nbits = (log->write_remainder_nbits + 1) & (64 - 1); /* efficient form of (log->write_remainder_nbits + 1) % 64 */
-			//log->buffer_count++; /* do we need this inc? write_buffer2log sets this to zero */
-
-			tornbit_write_buffer2log(set, log); /* write_buffer2log resets buffer_count to zero */
-			/* 
-			 * If write_remainder_nbits wrapped around then we are actually left 
-			 * with an overflow remainder of 64 bits, not zero. Write a complete 
-			 * buffer entry using 63 of the 64 bits. 
-			 */
-			if (log->write_remainder_nbits == 0) {
-				log->buffer[0] = ~TORN_MASK & 
-				                 (log->write_remainder);
-				log->buffer_count++;
-				//log->write_remainder = value >> 63;
-				/* the new remainder is the 64th bit that didn't make it */
-				log->write_remainder = log->write_remainder >> 63;
-				log->write_remainder_nbits = 1;
-			}
 		}
+		log->buffer[log->buffer_count] = value; 
+		log->buffer_count++;
+		tornbit_write_buffer2log(set, log);
 	} else {
-		/* COMMON PATH */
-		/* 
-		 * Store the remainder bits in the lowest part of the buffer word
-		 * and fill the highest part of the buffer word with a fragment of
-		 * the value.
-		 *
-		 * +-+--------------------------------+------------------------+
-		 * |T| value << write_remainder_nbits | write_remainder        |
-		 * +-+--------------------------------+------------------------+
-		 *
-		 */
-		log->buffer[log->buffer_count] = ~TORN_MASK & 
-										 (log->write_remainder | 
-										  (value << log->write_remainder_nbits));
-		/* 
-		 * Invariant: Remainder bits cannot be more than 63. So one buffer 
-		 * slot should suffice. 
-		 */
-		log->write_remainder_nbits = (log->write_remainder_nbits + 1) & (64 - 1); 
-		log->write_remainder = value >> (64 - log->write_remainder_nbits);
+		log->buffer[log->buffer_count] = value;
 		log->buffer_count++;
-		/* 
-		 * Note: It would be easier to check whether there are 63 remaining
-		 * bits and write them to the buffer. However this would add an 
-		 * extra branch in the common path. We avoid this by doing the check
-		 * in the uncommon path above instead. This is correct because we go 
-		 * through the uncommon path every 8th write, so when we are left with 
-		 * 64 bits to write out (i.e 63 bits we had to write + 1 new bit), we 
-		 * will be in the uncommon path already.
-		 */
 	}
 	return M_R_SUCCESS;
 }
 
 
+/**
+ * \brief Reserves room in the log for nwords more words.
+ *
+ * The next nwords words may then be appended with m_phlog_tornbit_append, 
+ * which does not check for room, so that a record or a whole transaction
+ * checks once rather than on every word. Returns M_R_FAILURE if the chunks
+ * the words fill would overflow the log; as with m_phlog_tornbit_write, a 
+ * chunk is always left free.
+ */
+static inline
+m_result_t
+m_phlog_tornbit_reserve(m_phlog_tornbit_t *log, uint64_t nwords)
+{
+	uint64_t room = (log->buffer_count + nwords) / CHUNK_PAYLOAD_NWORDS * CHUNK_NWORDS;
+
+	if (((log->tail - log->cached_head) & log->mask) + room <= log->mask) {
+		return M_R_SUCCESS;
+	}
+	log->cached_head = log->head;
+	if (((log->tail - log->cached_head) & log->mask) + room <= log->mask) {
+		return M_R_SUCCESS;
+	}
+	return M_R_FAILURE;
+}
+
+
+/** 
+ * \brief Appends a value to the physical log in room reserved with 
+ * m_phlog_tornbit_reserve.
+ */
+static inline
+void
+m_phlog_tornbit_append(pcm_storeset_t *set, m_phlog_tornbit_t *log, pcm_word_t value)
+{
+	log->buffer[log->buffer_count++] = value;
+	if (log->buffer_count == CHUNK_PAYLOAD_NWORDS) {
+		tornbit_write_buffer2log(set, log);
+	}
+}
+
+
 /**
  * \brief Flushes the log to SCM memory.
  *
@@ -340,11 +362,9 @@ m_phlog_tornbit_flush(pcm_storeset_t *set, m_phlog_tornbit_t *log)
   	printf("nvmd       : %p\n", log->nvmd);
   	printf("nvphlog    : %p\n", log->nvphlog);
 #endif	
-	if (log->write_remainder_nbits > 0) {
+	if (log->buffer_count > 0) {
 		/* Will log overflow? */
-		if (((log->tail + CHUNK_SIZE/sizeof(pcm_word_t)) & (PHYSICAL_LOG_NUM_ENTRIES-1))
-		    == log->head) 
-		{
+		if (tornbit_log_full(log)) {
 #ifdef _DEBUG_THIS		
 			printf("FLUSH: LOG OVERFLOW!!!\n");
 			printf("tail: %lu\n", log->tail);
@@ -352,29 +372,28 @@ m_phlog_tornbit_flush(pcm_storeset_t *set, m_phlog_tornbit_t *log)
 			printf("stable_tail: %lu\n", log->stable_tail);
 #endif			
 			return M_R_FAILURE;
-		} else {
-			/* 
-			 * Invariant: After each log_write we check whether buffer is full. 
-			 * Therefore when we get here we should have at least one slot free.
-			 *
-			 * Invariant: Remainder bits cannot be more than 63. So one buffer
-			 * slot should suffice.
-			 */
-			log->buffer[log->buffer_count] = ~TORN_MASK & 
-											 (log->write_remainder);
-			log->buffer_count++;
-			log->write_remainder_nbits = 0;
-			log->write_remainder = 0;
-			/* 
-			 * Write the buffer out to log even if it is not completely full. 
-			 * Simplifies and makes bound checking faster: no extra branches, 
-			 * no memory-fences.
-			 */
-			tornbit_write_buffer2log(set, log);
-		}	
+		}
+		/* 
+		 * Write the buffer out to log even if it is not completely full. 
+		 * Simplifies and makes bound checking faster: no extra branches, 
+		 * no memory-fences.
+		 */
+		if (log->buffer_count < CHUNK_PAYLOAD_NWORDS) {
+			log->stat_padded_chunks++;
+			log->stat_pad_words += CHUNK_PAYLOAD_NWORDS - log->buffer_count;
+		}
+		tornbit_write_buffer2log(set, log);
+	}
+	if (PHLOG_GROUP_COMMIT()) {
+		/* The epoch leader writes back the chunks; there is no tail to publish */
+		m_groupcommit_member_t member = { log->nvphlog, log->mask, 
+		                                  log->stable_tail, log->tail, NULL, 0 };
+		m_groupcommit_join(set, &member);
+		log->stable_tail = log->tail;
+		return M_R_SUCCESS;
 	}
 	log->stable_tail = log->tail;
-	PCM_SEQSTREAM_FLUSH(set);
+	PHLOG_PERSIST_BARRIER(set);
 #ifdef _DEBUG_THIS		
 	printf("phlog_tornbit_flush: log->tail = %llu, log->stable_tail = %llu\n", log->tail, log->stable_tail);
 #endif	
@@ -385,83 +404,34 @@ m_phlog_tornbit_flush(pcm_storeset_t *set, m_phlog_tornbit_t *log)
 /**
  * \brief Reads a single word from the stable part of the log. 
  *
- * The stable part is the one that has made it to SCM memory.
- *
+ * The stable part is the one that has made it to SCM memory. Stable chunks
+ * are complete, so the chunk of the word is loaded as a whole the first 
+ * time one of its words is read, and the following words of a record come
+ * from that copy.
  */
-#if  0
 static inline
 m_result_t
 m_phlog_tornbit_read(m_phlog_tornbit_t *log, uint64_t *valuep)
 {
-	uint64_t value;
+	uint64_t chunk;
 
 #ifdef _DEBUG_THIS		
-	printf("log_read: %lu %lu %lu\n", log->read_index, (uint64_t) log->read_remainder_nbits, log->stable_tail);
+	printf("log_read: %lu %lu\n", log->read_index, log->stable_tail);
 #endif
 	/* Are there any stable data to read? */
-	if (log->read_index != log->stable_tail && 
-	    log->read_index + 1 != log->stable_tail) 
-	{
-#ifdef _DEBUG_THIS		
-		printf("[%04lu]: 0x%016llX\n", log->read_index, ~TORN_MASK & log->nvphlog[log->read_index]);
-#endif		
-		value = (~TORN_MASK & log->nvphlog[log->read_index]) >> log->read_remainder_nbits;
-		log->read_index = (log->read_index + 1) & (PHYSICAL_LOG_NUM_ENTRIES - 1);
-#ifdef _DEBUG_THIS		
-		printf("[%04lu]: 0x%016llX\n", log->read_index, ~TORN_MASK & log->nvphlog[log->read_index]);
-#endif		
-		value |= log->nvphlog[log->read_index] << (63 - log->read_remainder_nbits);
-		log->read_remainder_nbits = (log->read_remainder_nbits + 1) & (64 - 1);
-		if (log->read_remainder_nbits == 63) {
-			log->read_index = (log->read_index + 1) & (PHYSICAL_LOG_NUM_ENTRIES - 1);
-			log->read_remainder_nbits = 0;
+	if (log->read_index != log->stable_tail) {
+		chunk = log->read_index & ~(CHUNK_NWORDS - 1);
+		if (chunk != log->read_chunk_index) {
+			m_phlog_tornbit_load_chunk(log, chunk);
 		}
-		*valuep = value;
-#ifdef _DEBUG_THIS		
-		printf("\t read value: 0x%016lX\n", value);
-#endif		
-		return M_R_SUCCESS;
-	}
-#ifdef _DEBUG_THIS		
-	printf("NO DATA\n");
-#endif		
-	return M_R_FAILURE;
-}
-#else
-
-static inline
-m_result_t
-m_phlog_tornbit_read(m_phlog_tornbit_t *log, uint64_t *valuep)
-{
-	uint64_t value;
-	uint64_t tmp;
-
-#ifdef _DEBUG_THIS		
-	printf("log_read: %lu %lu %lu\n", log->read_index, (uint64_t) log->read_remainder_nbits, log->stable_tail);
-#endif
-	/* Are there any stable data to read? */
-	if (log->read_index != log->stable_tail && 
-	    log->read_index + 1 != log->stable_tail) 
-	{
-#ifdef _DEBUG_THIS		
-		printf("[%04lu]: 0x%016llX\n", log->read_index, ~TORN_MASK & log->nvphlog[log->read_index]);
-#endif		
-		tmp = load_nt_word(&log->nvphlog[log->read_index]);
-		value = (~TORN_MASK & tmp) >> log->read_remainder_nbits;
-		log->read_index = (log->read_index + 1) & (PHYSICAL_LOG_NUM_ENTRIES - 1);
-#ifdef _DEBUG_THIS		
-		printf("[%04lu]: 0x%016llX\n", log->read_index, ~TORN_MASK & log->nvphlog[log->read_index]);
-#endif		
-		tmp = load_nt_word(&log->nvphlog[log->read_index]);
-		value |= tmp << (63 - log->read_remainder_nbits);
-		log->read_remainder_nbits = (log->read_remainder_nbits + 1) & (64 - 1);
-		if (log->read_remainder_nbits == 63) {
-			log->read_index = (log->read_index + 1) & (PHYSICAL_LOG_NUM_ENTRIES - 1);
-			log->read_remainder_nbits = 0;
+		*valuep = log->read_chunk[log->read_index & (CHUNK_NWORDS - 1)];
+		log->read_index = (log->read_index + 1) & log->mask;
+		/* Step over the chunk header */
+		if ((log->read_index & (CHUNK_NWORDS - 1)) == CHUNK_PAYLOAD_NWORDS) {
+			log->read_index = (log->read_index + 1) & log->mask;
 		}
-		*valuep = value;
 #ifdef _DEBUG_THIS		
-		printf("\t read value: 0x%016lX\n", value);
+		printf("\t read value: 0x%016lX\n", *valuep);
 #endif		
 		return M_R_SUCCESS;
 	}
@@ -470,7 +440,7 @@ m_phlog_tornbit_read(m_phlog_tornbit_t *log, uint64_t *valuep)
 #endif		
 	return M_R_FAILURE;
 }
-#endif
+
 
 /**
  * \brief Checks whether there is a stable part of the log to read. 
@@ -501,20 +471,13 @@ m_phlog_tornbit_next_chunk(m_phlog_tornbit_t *log)
 {
 	uint64_t read_index; 
 
-	if (log->read_remainder_nbits > 0) {
-		log->read_remainder_nbits = 0;
-		read_index = log->read_index & ~(CHUNK_SIZE/sizeof(pcm_word_t) - 1);
-		log->read_index = (read_index + CHUNK_SIZE/sizeof(pcm_word_t)) & (PHYSICAL_LOG_NUM_ENTRIES-1); 
-	} else {
-		log->read_remainder_nbits = 0;
-		read_index = log->read_index & ~(CHUNK_SIZE/sizeof(pcm_word_t) - 1);
-		/* 
-		 * If current log->read_index points to the beginning of a chunk
-		 * then we are already in the next chunk so we don't need to advance.
-		 */
-		if (read_index != log->read_index) {
-			log->read_index = (read_index + CHUNK_SIZE/sizeof(pcm_word_t)) & (PHYSICAL_LOG_NUM_ENTRIES-1); 
-		}
+	read_index = log->read_index & ~(CHUNK_NWORDS - 1);
+	/* 
+	 * If current log->read_index points to the beginning of a chunk
+	 * then we are already in the next chunk so we don't need to advance.
+	 */
+	if (read_index != log->read_index) {
+		log->read_index = (read_index + CHUNK_NWORDS) & log->mask; 
 	}
 }
 
@@ -522,16 +485,11 @@ m_phlog_tornbit_next_chunk(m_phlog_tornbit_t *log)
 /**
  * \brief Checkpoints the read pointer to allow re-reading data from the
  * checkpointed point. 
- * 
- * Cannot checkpoint in the middle of reading an atomic log fragment.
  */
 static inline
 m_result_t
 m_phlog_tornbit_checkpoint_readindex(m_phlog_tornbit_t *log, uint64_t *readindex)
 {
-	if (log->read_remainder_nbits > 0) {
-		return M_R_FAILURE;
-	}
 	*readindex = log->read_index;
 
 	return M_R_SUCCESS;
@@ -540,16 +498,12 @@ m_phlog_tornbit_checkpoint_readindex(m_phlog_tornbit_t *log, uint64_t *readindex
 
 /**
  * \brief Restored the read pointer.
- * 
- * Assumes that the checkpoint was not taken while in the middle of reading 
- * an atomic log fragment.
  */
 static inline
 void
 m_phlog_tornbit_restore_readindex(m_phlog_tornbit_t *log, uint64_t readindex)
 {
 	log->read_index = readindex;
-	log->read_remainder_nbits = 0;
 }
 
 
@@ -557,21 +511,23 @@ static inline
 m_result_t
 m_phlog_tornbit_truncate_sync(pcm_storeset_t *set, m_phlog_tornbit_t *phlog) 
 {
-	phlog->head = phlog->tail;
+	phlog->head = phlog->cached_head = phlog->tail;
 
 	//FIXME: do we need a flush? PCM_NT_FLUSH(set);
 	PCM_NT_STORE(set, (volatile pcm_word_t *) &phlog->nvmd->flags, (pcm_word_t) (phlog->head | phlog->tornbit));
-	PCM_NT_FLUSH(set);
+	PCM_PERSIST_BARRIER(set);
 	
 	return M_R_SUCCESS;
 }
 
-m_result_t m_phlog_tornbit_format (pcm_storeset_t *set, m_phlog_tornbit_nvmd_t *nvmd, pcm_word_t *nvphlog, int type);
+m_result_t m_phlog_tornbit_format (pcm_storeset_t *set, m_phlog_tornbit_nvmd_t *nvmd, pcm_word_t *nvphlog, int type, int size_log2);
 m_result_t m_phlog_tornbit_alloc (m_phlog_tornbit_t **phlog_tornbitp);
 m_result_t m_phlog_tornbit_init (m_phlog_tornbit_t *phlog, m_phlog_tornbit_nvmd_t *nvmd, pcm_word_t *nvphlog);
 m_result_t m_phlog_tornbit_check_consistency(m_phlog_tornbit_nvmd_t *nvmd, pcm_word_t *nvphlog, uint64_t *stable_tail);
 m_result_t m_phlog_tornbit_prepare_truncate(m_log_dsc_t *log_dsc);
 m_result_t m_phlog_tornbit_truncate_async(pcm_storeset_t *set, m_phlog_tornbit_t *phlog);
+pcm_word_t m_phlog_tornbit_truncation_point(m_phlog_tornbit_t *phlog);
+m_result_t m_phlog_tornbit_truncate_to(pcm_storeset_t *set, m_phlog_tornbit_t *phlog, pcm_word_t point);
 
 
 #ifdef __cplusplus
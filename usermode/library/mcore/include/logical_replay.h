@@ -0,0 +1,54 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/*!
+ * \file
+ * Specifies the interface by which log recovery finds the replay routines 
+ * of logical log records.
+ */
+#ifndef LOGICAL_REPLAY_H_P3K8QZ2M
+#define LOGICAL_REPLAY_H_P3K8QZ2M
+
+#include <stddef.h>
+
+/*! Opcodes of logical log records range over [0, MNEMOSYNE_LOGICAL_OPCODES) */
+#define MNEMOSYNE_LOGICAL_OPCODES 256
+
+/*! \see mnemosyne.h */
+int mnemosyne_logical_replay_register(unsigned int opcode, void (*replay)(const void *args, size_t size));
+
+/*!
+ * Returns the replay routine registered for opcode, or NULL if there is none.
+ */
+void (*mnemosyne_logical_replay_lookup(unsigned int opcode))(const void *, size_t);
+
+#endif /* end of include guard: LOGICAL_REPLAY_H_P3K8QZ2M */
@@ -50,6 +50,7 @@
 #define MNEMOSYNE_H_4EOVRWJH
 
 #include <sys/types.h>
+#include "pptr.h"
 
 /*!
  * Allows the declaration of a persistent global variable. A programmer making use
@@ -60,11 +61,19 @@
  */
 #define MNEMOSYNE_PERSISTENT __attribute__ ((section("PERSISTENT")))
 
+/*!
+ * Like MNEMOSYNE_PERSISTENT, for a persistent global variable without an 
+ * initializer (or initialized to zero). Such variables take no room in the 
+ * binary, and the pages of the segment that hold them are left untouched 
+ * until written, so large persistent arrays cost nothing at startup.
+ */
+#define MNEMOSYNE_PERSISTENT_BSS __attribute__ ((section(".persistent.bss")))
+
 #ifndef PSEGMENT_RESERVED_REGION_START
 # define PSEGMENT_RESERVED_REGION_START   0x0000100000000000
 #endif
 #ifndef PSEGMENT_RESERVED_REGION_SIZE
-# define PSEGMENT_RESERVED_REGION_SIZE    0x0000010000000000 /* 1 TB */
+# define PSEGMENT_RESERVED_REGION_SIZE    0x0000400000000000 /* 64 TB */
 #endif
 
 # ifdef __cplusplus
@@ -88,10 +97,132 @@ extern "C" {
  */
 void mnemosyne_reincarnation_callback_register(void(*initializer)());
 
+/*! The callback may run on a worker thread, alongside other callbacks. */
+#define MNEMOSYNE_REINCARNATION_PARALLEL    0x1
+/*! 
+ * The callback runs on a worker thread and the library does not wait for 
+ * it to finish initializing: code that needs what it rebuilds calls 
+ * mnemosyne_reincarnation_wait() first.
+ */
+#define MNEMOSYNE_REINCARNATION_BACKGROUND  0x2
+
+/*!
+ * Registers a reincarnation callback like 
+ * mnemosyne_reincarnation_callback_register(), that runs only once the 
+ * callbacks whose identifiers are given in deps have finished. Callbacks
+ * without MNEMOSYNE_REINCARNATION_PARALLEL or _BACKGROUND run on the 
+ * thread that initializes the library, in registration order; the others 
+ * run on the reincarnation_threads worker threads as soon as their 
+ * dependencies allow.
+ *
+ * \param initializer is called with arg.
+ * \param flags MNEMOSYNE_REINCARNATION_* flags.
+ * \param deps identifiers of callbacks registered before, ndeps of them.
+ * \return the identifier of the callback (greater than 0), or -1 if a 
+ *  dependency is not known or too many callbacks are registered.
+ */
+int mnemosyne_reincarnation_callback_register_ordered(void (*initializer)(void *), 
+                                                      void *arg, int flags, 
+                                                      const int *deps, int ndeps);
+
+/*!
+ * Waits until the reincarnation callback id has finished. Meant for 
+ * lookups into a volatile index that a background callback rebuilds, so 
+ * that they wait for that index only; returns at once when it is done. 
+ * Must not be called before the library is initialized, nor by a callback 
+ * on one it does not depend on (declare the dependency instead).
+ */
+void mnemosyne_reincarnation_wait(int id);
+
+/*!
+ * Registers the routine which replays the logical log records of opcode
+ * (see mtm_logical_begin) found at log recovery. The routine is passed the
+ * arguments logged with the operation and must redo the operation's
+ * updates and make them durable (m_persist) before it returns. Recovery
+ * may replay an operation whose updates already reached persistent memory,
+ * so the routine must be idempotent: the arguments should carry the
+ * outcome of the operation (e.g. the new value of a counter) rather than a
+ * delta. It runs single-threaded, after the redo records logged before the
+ * operation have been applied.
+ *
+ * The transactional logs are recovered when the first transaction of the
+ * process starts, so the opcodes must be registered before then. Opcodes
+ * range over [0, 256); returns 0 on success, -1 for an invalid opcode.
+ */
+int mnemosyne_logical_replay_register(unsigned int opcode, void (*replay)(const void *args, size_t size));
+
 void *m_pmap(void *start, unsigned long long length, int prot, int flags);
 void *m_pmap2(void *start, unsigned long long  length, int prot, int flags);
 int  m_punmap(void *start, unsigned long long length);
+int  m_pmap_bind_node(void *start, unsigned long long length, int node);
+int  m_pdiscard(void *start, unsigned long long length);
+int  m_psnapshot(const char *dir);
+int  m_numa_nodes(void);
+int  m_numa_node_self(void);
+int  m_numa_interleave(void *start, unsigned long long length);
+void m_segment_touch(void *addr);
+
+/*!
+ * Tiering: m_segment_tier_out moves the m_pmap segment starting at start 
+ * out of persistent memory into a file in segments_tier_dir, typically on
+ * NVMe, where it stays mapped at the same address with its pages read in
+ * on access; m_segment_tier_in moves it back. The segment must not be 
+ * written meanwhile and its committed stores must have been written back
+ * (mtm_sync). m_segment_sample_cold lists up to max segments in persistent
+ * memory untouched since its previous call, candidates to tier out. All 
+ * return -1 with errno set on failure.
+ */
+int  m_segment_tier_out(void *start);
+int  m_segment_tier_in(void *start);
+int  m_segment_sample_cold(void **starts, int max);
+
+/*!
+ * Named persistent roots: persistent pointers kept in the segment table 
+ * under a name (up to 55 characters), so that persistent data built in 
+ * dynamic segments can be found again after a restart without a 
+ * persistent global. m_root returns the root called name, adding it with 
+ * a NULL pointer if there is none, or NULL if the name is too long or all
+ * 48 roots are taken. The name is made durable on return, outside any 
+ * transaction; the pointer is persistent memory like any other, to be set
+ * by transactions. Roots are never removed.
+ */
+__attribute__((transaction_pure))
+m_pptr_t *m_root(const char *name);
 
+/*!
+ * Calls fn(start, size, arg) on each mapped persistent segment, pmap 
+ * segments and persistent sections. fn must not map segments.
+ */
+void m_segment_foreach(void (*fn)(void *start, size_t size, void *arg), void *arg);
+
+/*!
+ * Persistence primitives for data updated outside transactions: m_pflush 
+ * writes back the cachelines of a range and m_pfence orders those write 
+ * backs before later stores. A store is durable once a fence follows its 
+ * flush.
+ */
+void m_pflush(const void *addr, size_t length);
+void m_pfence(void);
+
+/*! m_pflush followed by m_pfence: the range is durable on return */
+void m_persist(const void *addr, size_t length);
+
+/*!
+ * Highest commit sequence number (see mtm_last_committed_sqn) the log 
+ * shipping standby has made durable, on the primary as acknowledged by the
+ * standby and on the standby itself. 0 without log shipping.
+ */
+uint64_t m_logship_replicated_sqn(void);
+
+/*!
+ * Maps the persistent segments back and recovers the logs, unless done 
+ * already. By default (init_mode eager) a constructor does it before main.
+ * With init_mode lazy it is left to the first call into the library 
+ * (m_pmap, the first transaction or this routine), and with background to
+ * a thread started by the constructor, which this routine waits for.
+ * Persistent globals are valid only once it is done, so in those modes 
+ * call this routine before reading them outside the library.
+ */
 void mnemosyne_init_global(void);
 
 # ifdef __cplusplus
@@ -0,0 +1,132 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/*!
+ * \file
+ * C++ interface to persistent memory: typed persistent pointers, named 
+ * persistent roots, transactions and persistent objects allocated with 
+ * pmalloc. Header only; needs the include directories of mcore, mtm and 
+ * pmalloc and a build with -fgnu-tm.
+ *
+ * \code
+ * struct counter { long value; };
+ *
+ * mnemosyne::persistent_ptr<counter>* c = mnemosyne::root<counter>("counter");
+ * mnemosyne::transaction([&] {
+ *     if (!*c) {
+ *         *c = mnemosyne::make_persistent<counter>();
+ *     }
+ *     (*c)->value++;
+ * });
+ * \endcode
+ *
+ * Transactions are lexically scoped blocks, so they take the code to run 
+ * as a function object rather than a begin/end pair. The compiler 
+ * instruments the accesses of the code with barriers of the width of 
+ * each access, as in a MNEMOSYNE_ATOMIC block.
+ */
+#ifndef MNEMOSYNE_HH_R3XQ8WFN
+#define MNEMOSYNE_HH_R3XQ8WFN
+
+#include <new>
+#include <utility>
+
+#include <mnemosyne.h>
+#include <mtm.h>
+#include <pmalloc.h>
+#include "pptr.h"
+
+namespace mnemosyne {
+
+/*! Persistent pointer to a T, relocatable with the persistent region */
+template<typename T>
+using persistent_ptr = pptr<T>;
+
+/*!
+ * The persistent root called name (see m_root), as a persistent pointer 
+ * to a T; NULL if the name is too long or all roots are taken. The root 
+ * is NULL until a transaction sets it.
+ */
+template<typename T>
+persistent_ptr<T>* root(const char* name)
+{
+	return reinterpret_cast<persistent_ptr<T>*>(m_root(name));
+}
+
+/*!
+ * Runs func in a durability transaction and returns what it returns. 
+ * func may run more than once if the transaction conflicts, and must not 
+ * throw.
+ */
+template<class F>
+auto transaction(F&& func) -> decltype(func())
+{
+	MNEMOSYNE_ATOMIC {
+		return func();
+	}
+}
+
+/*!
+ * Allocates a T with pmalloc and constructs it with args; a NULL pointer 
+ * if the heap is exhausted. Must be called in a transaction, which frees 
+ * the object again if it aborts.
+ */
+template<typename T, typename... Args>
+persistent_ptr<T> make_persistent(Args&&... args)
+{
+	void* addr = _ITM_pmalloc(sizeof(T));
+
+	if (!addr) {
+		return persistent_ptr<T>();
+	}
+	return persistent_ptr<T>(new (addr) T(std::forward<Args>(args)...));
+}
+
+/*!
+ * Destroys the T ptr points to and frees it with pfree. Must be called in
+ * a transaction; the object is freed when the transaction commits.
+ */
+template<typename T>
+void delete_persistent(persistent_ptr<T> ptr)
+{
+	T* obj = ptr.get();
+
+	if (!obj) {
+		return;
+	}
+	obj->~T();
+	_ITM_pfree(obj);
+}
+
+} // namespace mnemosyne
+
+#endif /* end of include guard: MNEMOSYNE_HH_R3XQ8WFN */
@@ -41,6 +41,40 @@
 /*! The maximum path length for a module. */
 #define M_MODULE_PATH_MAX 256
 
+/*! Module cache entry flags */
+#define M_MODCACHE_VALID       0x1 /**< the entry describes a module */
+#define M_MODCACHE_PERSISTENT  0x2 /**< the module has a .persistent section */
+
+/*! Slots probed for a module in the module cache */
+#define M_MODCACHE_PROBE       8
+
+
+/*!
+ * \brief Persistent module cache entry
+ *
+ * Holds what persistent_shdr_open found in a module file, keyed by the 
+ * file's inode, modification time and size, so that a restart does not 
+ * parse the modules again. Modules without a .persistent section, the vast 
+ * majority, are cached too.
+ */
+typedef struct m_modcache_entry_s m_modcache_entry_t;
+struct m_modcache_entry_s {
+	uint64_t         inode;
+	uint64_t         mtime_ns;
+	uint64_t         size;
+	uint64_t         flags;                 /**< M_MODCACHE_*, written last */
+	uint64_t         persistent_addr;       /**< sh_addr of .persistent, .persistent.bss included */
+	uint64_t         persistent_size;       /**< sh_size of .persistent, .persistent.bss included */
+	uint64_t         GOT_addr;              /**< sh_addr of .got */
+	uint64_t         GOT_size;              /**< sh_size of .got */
+};
+
+/*! The module cache: n entries of persistent memory */
+typedef struct {
+	m_modcache_entry_t *entries;
+	uint32_t           n;
+} m_modcache_t;
+
 
 /*!
  * \brief Module descriptor (for modules that have a .persistent section)
@@ -54,8 +88,8 @@ struct module_dsr_s {
 	char             module_path[M_MODULE_PATH_MAX]; /**< pathname of the module owning this section */
 	uint64_t         module_inode;          /**< the inode number of the module file */
 	uintptr_t        module_start;          /**< address where the module is loaded */
-	int              fd;                    /**< file descriptor of the open elf object */
-	Elf              *elf;                  /**< the elf in-mem object that corresponds to this section */
+	int              fd;                    /**< file descriptor of the open elf object, -1 if found in the module cache */
+	Elf              *elf;                  /**< the elf in-mem object that corresponds to this section, NULL if found in the module cache */
 	GElf_Shdr        GOT_shdr;              /**< the .got (global offset table) section header descriptor */
 	GElf_Shdr        persistent_shdr;       /**< the .persistent section header descriptor */
     Elf_Scn          *persistent_scn;       /**< the in-mem .persistent section object */
@@ -64,7 +98,8 @@ struct module_dsr_s {
 
 extern struct list_head module_dsr_list;
 
-m_result_t m_module_create_module_dsr_list(struct list_head *module_dsr_listp);
+m_result_t m_module_create_module_dsr_list(struct list_head *module_dsr_listp, m_modcache_t *cache);
+m_result_t m_module_open(module_dsr_t *module_dsr);
 void m_module_relocate_symbols(uintptr_t got_start, uintptr_t got_end, uintptr_t old_start, uintptr_t old_end, uintptr_t new_start, uintptr_t new_end);
 
 #endif /* _MNEMOSYNE_MODULE_H */
@@ -0,0 +1,163 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/*!
+ * \file
+ * Relocatable persistent pointers.
+ *
+ * A persistent pointer stores the offset of its target from the base of the 
+ * region persistent segments are mapped into, instead of the target's 
+ * address, so persistent data holding only such pointers does not depend on 
+ * where the region is mapped. Offset 0, the start of the segment table, is 
+ * never a valid target and stands for NULL.
+ *
+ * Decoding is a single add to the base. The base does not change while 
+ * transactions run, so code that follows many pointers loads it once with 
+ * M_PPTR_BASE and decodes with M_PPTR_GET; the base is read through a 
+ * transaction_pure function and so costs no read barrier.
+ *
+ * \code
+ * __transaction_atomic {
+ *     M_PPTR_BASE(base);
+ *     for (n = M_PPTR_GET(base, struct node *, head); n; n = M_PPTR_GET(base, struct node *, n->next)) {
+ *         ...
+ *     }
+ * }
+ * \endcode
+ */
+#ifndef MNEMOSYNE_PPTR_H_7KQ2ZLDA
+#define MNEMOSYNE_PPTR_H_7KQ2ZLDA
+
+#include <stdint.h>
+#include <stddef.h>
+
+# ifdef __cplusplus
+extern "C" {
+# endif
+
+/*! Address the region of persistent segments is mapped at */
+extern uintptr_t m_pregion_base;
+
+/*! A persistent pointer: offset of the target from m_pregion_base, or 0 */
+typedef struct {
+	uint64_t off;
+} m_pptr_t;
+
+#define M_PPTR_NULL  ((m_pptr_t) { 0 })
+
+__attribute__((transaction_pure))
+static inline uintptr_t
+m_pptr_base(void)
+{
+	return m_pregion_base;
+}
+
+static inline m_pptr_t
+m_pptr_encode_base(uintptr_t base, const void *ptr)
+{
+	m_pptr_t p;
+
+	p.off = ptr ? (uint64_t) ((uintptr_t) ptr - base) : 0;
+	return p;
+}
+
+static inline void *
+m_pptr_decode_base(uintptr_t base, m_pptr_t p)
+{
+	return p.off ? (void *) (base + (uintptr_t) p.off) : NULL;
+}
+
+static inline m_pptr_t
+m_pptr_encode(const void *ptr)
+{
+	return m_pptr_encode_base(m_pptr_base(), ptr);
+}
+
+static inline void *
+m_pptr_decode(m_pptr_t p)
+{
+	return m_pptr_decode_base(m_pptr_base(), p);
+}
+
+static inline int
+m_pptr_is_null(m_pptr_t p)
+{
+	return p.off == 0;
+}
+
+/*! Declares base and loads the region base into it */
+#define M_PPTR_BASE(base)         const uintptr_t base = m_pptr_base()
+
+/*! The target of persistent pointer p as a type, given a loaded base */
+#define M_PPTR_GET(base, type, p) ((type) m_pptr_decode_base((base), (p)))
+
+/*! Persistent pointer to ptr, given a loaded base */
+#define M_PPTR_SET(base, ptr)     m_pptr_encode_base((base), (ptr))
+
+# ifdef __cplusplus
+}
+
+namespace mnemosyne {
+
+/*!
+ * Typed persistent pointer; has the layout of m_pptr_t, so the two may 
+ * point at each other's data.
+ */
+template<typename T>
+class pptr {
+public:
+	pptr() { p_.off = 0; }
+	pptr(T *ptr) { p_ = m_pptr_encode(ptr); }
+	pptr(uintptr_t base, T *ptr) { p_ = m_pptr_encode_base(base, ptr); }
+
+	pptr& operator=(T *ptr) { p_ = m_pptr_encode(ptr); return *this; }
+
+	T *get() const { return static_cast<T *>(m_pptr_decode(p_)); }
+	T *get(uintptr_t base) const { return static_cast<T *>(m_pptr_decode_base(base, p_)); }
+
+	T *operator->() const { return get(); }
+	T &operator*() const { return *get(); }
+	explicit operator bool() const { return p_.off != 0; }
+
+	bool operator==(const pptr &other) const { return p_.off == other.p_.off; }
+	bool operator!=(const pptr &other) const { return p_.off != other.p_.off; }
+
+	m_pptr_t raw() const { return p_; }
+
+private:
+	m_pptr_t p_;
+};
+
+} // namespace mnemosyne
+# endif
+
+#endif /* end of include guard: MNEMOSYNE_PPTR_H_7KQ2ZLDA */
@@ -37,12 +37,12 @@
 /* 
  * We reserve a large hole in the 47-bit virtual space for mapping 
  * persistent memory segments.
- * FIXME: Even if we ensure persistent segments fall into the reserved space,
- * the kernel has to be aware about this reservation to make sure that no other 
- * memory is allocated there. Indead, when mmap is passed 0 as starting
- * address, it searches for an empty region starting from the end of the last
- * allocated region. So it could be very easily map a non-persistent region 
- * into the reserved space.
+ * The segment manager maps the whole hole PROT_NONE from a constructor that 
+ * runs before any other of the library, so that the kernel does not place 
+ * non-persistent mappings there, and maps segments over it with MAP_FIXED.
+ * Mappings made before that, by the dynamic loader or by constructors of 
+ * earlier libraries, can still land in the hole; the reservation then fails 
+ * and segments are mapped at hinted addresses as before.
  *
  * Each region must be page aligned. We use PAGE_ALIGN to accomblish this.
  *
@@ -51,24 +51,51 @@
  *
  */
 
+/* 
+ * The largest the region can be; the size it actually has is chosen when 
+ * the segment table is first formatted (see segments_region_gb) and is 
+ * 1TB for images formatted before that. Accesses anywhere below the 
+ * maximum are treated as persistent.
+ */
 #define PSEGMENT_RESERVED_REGION_START   0x0000100000000000
-#define PSEGMENT_RESERVED_REGION_SIZE    0x0000010000000000 /* 1 TB */
+#define PSEGMENT_RESERVED_REGION_SIZE    0x0000400000000000 /* 64 TB */
 #define PSEGMENT_RESERVED_REGION_END     (PSEGMENT_RESERVED_REGION_START +    \
                                           PSEGMENT_RESERVED_REGION_SIZE)
-/* Segment table */
+#define PSEGMENT_LEGACY_REGION_SIZE      0x0000010000000000 /* 1 TB */
+/* 
+ * Segment table. The table header follows the entries in the first page 
+ * past them, and the module cache the header, still inside the hole before 
+ * the log pool. 
+ */
 #define SEGMENT_TABLE_START              PSEGMENT_RESERVED_REGION_START
 #define SEGMENT_TABLE_NUM_ENTRIES        1024
 #define SEGMENT_TABLE_SIZE               (sizeof(m_segtbl_entry_t) *          \
                                           SEGMENT_TABLE_NUM_ENTRIES)
+#define SEGMENT_TABLE_HEADER_START       PAGE_ALIGN(SEGMENT_TABLE_START +     \
+                                                    SEGMENT_TABLE_SIZE)
+#define SEGMENT_TABLE_MODCACHE_START     (SEGMENT_TABLE_HEADER_START + PAGE_SIZE)
+#define SEGMENT_TABLE_MODCACHE_SIZE      (8 * PAGE_SIZE)
+#define SEGMENT_TABLE_MAP_SIZE           (SEGMENT_TABLE_MODCACHE_START -      \
+                                          SEGMENT_TABLE_START +               \
+                                          SEGMENT_TABLE_MODCACHE_SIZE)
+/* Entries per extension block chained to the segment table */
+#define SEGMENT_TABLE_EXT_ENTRIES        4096
 
 #define SEGMENT_TABLE_HOLE               0x10000
 #define SEGMENT_TABLE_END                PAGE_ALIGN(                          \
                                              SEGMENT_TABLE_START +            \
                                              SEGMENT_TABLE_HOLE +             \
                                              SEGMENT_TABLE_SIZE)
-/* Log pool */										  
+/* 
+ * Log pool. Reserves room for the metadata of LOG_POOL_MAX_LOGS logs and 
+ * for the physical logs, which are mapped LOG_POOL_EXTENT_LOGS at a time 
+ * as more logs are needed. 16MB are reserved per log; with larger physical 
+ * logs, fewer logs fit.
+ */
 #define LOG_POOL_START                   SEGMENT_TABLE_END 
-#define LOG_POOL_SIZE                    (32*16*1024*1024+32*32*64)
+#define LOG_POOL_MAX_LOGS                1024
+#define LOG_POOL_EXTENT_LOGS             32
+#define LOG_POOL_SIZE                    (LOG_POOL_MAX_LOGS*16ULL*1024*1024+LOG_POOL_MAX_LOGS*32*64)
 #define LOG_POOL_HOLE                    0x10000
 #define LOG_POOL_END                     PAGE_ALIGN(                          \
                                              LOG_POOL_START +                 \
@@ -53,4 +53,10 @@ void mnemosyne_reincarnation_callback_register(void(*initializer)());
  */
 void mnemosyne_reincarnation_callback_execute_all();
 
+/*!
+ * Waits for the callbacks still running in the background and stops the 
+ * worker threads that run them.
+ */
+void mnemosyne_reincarnation_callback_fini();
+
 #endif /* end of include guard: REINCARNATION_CALLBACK_H_WTK12KU8 */
@@ -46,7 +46,11 @@
 #include <stdint.h>
 /* Mnemosyne common header files */
 #include <list.h>
+#include <mcslock.h>
 #include <result.h>
+#include "pregionlayout.h"
+#include "pptr.h"
+#include "module.h"
 
 
 #ifndef MAP_SCM
@@ -60,32 +64,90 @@
 # define MAP_PERSISTENT 0
 #endif
 
+#ifndef MAP_SHARED_VALIDATE
+#define MAP_SHARED_VALIDATE 0x03
+#endif
+
+#ifndef MAP_SYNC
+#define MAP_SYNC 0x80000
+#endif
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
+#ifndef FICLONE
+#define FICLONE _IOW(0x94, 9, int)
+#endif
+
+/** 
+ * Backing stores of persistent segments, picked from segments_dir and the 
+ * segments_backend setting.
+ */
+typedef enum {
+	SEGMENT_BACKEND_FILE,   /**< files mapped through the page cache */
+	SEGMENT_BACKEND_FSDAX,  /**< files on a DAX file system mapped with MAP_SYNC */
+	SEGMENT_BACKEND_DEVDAX  /**< a device-DAX character device */
+} m_segment_backend_t;
+
 /** Persistent segment table entry flags */
 #define SGTB_TYPE_PMAP                0x1    /* a segment allocated via pmap family of functions */
 #define SGTB_TYPE_SECTION             0x2    /* a segment of a .persistent section */
 #define SGTB_VALID_ENTRY              0x4
 #define SGTB_VALID_DATA               0x8
+#define SGTB_TYPE_TABLE               0x10   /* an extension block of the segment table */
+#define SGTB_TIERED                   0x20   /* backing store moved to segments_tier_dir */
+#define SGTB_LOGS                     0x40   /* a log pool segment, backed from log_segments_dir */
+#define SGTB_NODE_SHIFT               8      /* NUMA node of a log pool segment plus one, 0 if none */
+#define SGTB_NODE_MASK                0xff00
+
+#define SGTB_NODE(flags)              ((int) (((flags) & SGTB_NODE_MASK) >> SGTB_NODE_SHIFT) - 1)
+
+/** Marks a formatted segment table header */
+#define SEGMENT_TABLE_MAGIC           0x4d4e5354424c3031ULL
+
+/** Named persistent roots kept in the segment table header, and their name length */
+#define SEGMENT_TABLE_ROOTS           48
+#define SEGMENT_TABLE_ROOT_NAME_MAX   56
 
 typedef struct m_segtbl_entry_s m_segtbl_entry_t;
 typedef struct m_segidx_entry_s m_segidx_entry_t;
 typedef struct m_segidx_s       m_segidx_t;
 typedef struct m_segtbl_s       m_segtbl_t;
+typedef struct m_segidx_range_s m_segidx_range_t;
+typedef struct m_segtbl_header_s m_segtbl_header_t;
+typedef struct m_segtbl_ext_s   m_segtbl_ext_t;
+typedef struct m_segtbl_root_s  m_segtbl_root_t;
 
 /** Persistent segment table index entry. */
 struct m_segidx_entry_s {
 	m_segtbl_entry_t *segtbl_entry; /**< the segment table entry */
 	uint32_t         index;         /**< the index of the entry in the segment table */ 
 	uint64_t         module_id;     /**< valid for .persistent sections only. Identifies the module the .persistent section belongs to */
+	int              hot;           /**< accessed since the last m_segment_sample_cold */
 	struct list_head list;
 };
 
 
+/** Address range of a mapped segment in the index's lookup array. */
+struct m_segidx_range_s {
+	uintptr_t        start;
+	uintptr_t        end;
+	m_segidx_entry_t *entry;
+};
+
+
 /* Persistent segment table index. */
 struct m_segidx_s {
-	pthread_mutex_t  mutex;          /**< synchronizes access to the index */
+	m_mcslock_t      lock;           /**< synchronizes access to the index */
 	m_segidx_entry_t *all_entries;   /**< all the segment index entries */
 	m_segidx_entry_t mapped_entries; /**< the head of the mapped segments list; we keep this list ordered by start address; no overlaps allowed */
 	m_segidx_entry_t free_entries;   /**< the head of the free segments list */
+	uint32_t         nentries;       /**< number of entries the index can hold, with extension blocks not yet chained */
+	int              nfree;          /**< number of entries in the free list */
+	volatile uint64_t seq;           /**< odd while ranges are updated; readers retry if it changes under them */
+	volatile int     nranges;        /**< number of mapped segments in ranges */
+	m_segidx_range_t *ranges;        /**< the mapped segments sorted by start address, for lock-free lookups */
 };
 
 
@@ -97,10 +159,47 @@ struct m_segtbl_entry_s {
 };
 
 
+/** Named persistent root (see m_root). */
+struct m_segtbl_root_s {
+	char      name[SEGMENT_TABLE_ROOT_NAME_MAX]; /**< empty if the slot is free */
+	m_pptr_t  ptr;                               /**< written by transactions */
+};
+
+
+/** 
+ * Persistent segment table header, in the page following the entries. 
+ * Tables from before the roots read zeroes there: no roots.
+ */
+struct m_segtbl_header_s {
+	uint64_t        magic;        /**< SEGMENT_TABLE_MAGIC once formatted */
+	uint64_t        region_size;  /**< size of the reserved region, fixed when formatted */
+	uintptr_t       next;         /**< start address of the first extension block, 0 if none */
+	uint64_t        pad[5];
+	m_segtbl_root_t roots[SEGMENT_TABLE_ROOTS];
+};
+
+
+/** 
+ * Persistent segment table extension block. Blocks are segments of their 
+ * own, whose entries are in the block chained before them, and number 
+ * their entries on from the entries of the blocks before them.
+ */
+struct m_segtbl_ext_s {
+	uintptr_t        next;      /**< start address of the next extension block, 0 if last */
+	uint64_t         pad[7];
+	m_segtbl_entry_t entries[SEGMENT_TABLE_EXT_ENTRIES];
+};
+
+
 /** Persistent segment table. */
 struct m_segtbl_s {
-	m_segtbl_entry_t *entries;  /**< pointer to the persistent segment table entries */
-	m_segidx_t       *idx;      /**< the fast index providing access to the persistent segment table. */
+	m_segtbl_entry_t  *entries;  /**< pointer to the persistent segment table entries */
+	m_segtbl_header_t *header;   /**< pointer to the persistent segment table header */
+	m_segtbl_ext_t    **ext;     /**< the extension blocks in chain order */
+	int               next;      /**< number of extension blocks */
+	int               max_next;  /**< number of extension blocks the index has room for */
+	m_modcache_t      modcache;  /**< the persistent module cache following the header */
+	m_segidx_t        *idx;      /**< the fast index providing access to the persistent segment table. */
 };
 
 
@@ -111,6 +210,11 @@ m_result_t m_segmentmgr_init();
 m_result_t m_segmentmgr_fini();
 
 void *m_pmap2(void *start, unsigned long long length, int prot, int flags);
+void *m_pmap_logs(void *start, unsigned long long length, int node);
+int m_numa_nodes(void);
 m_result_t m_segment_find_using_addr(void *addr, m_segidx_entry_t **entryp);
+m_segment_backend_t m_segment_backend(void);
+void m_segment_touch(void *addr);
+int m_segment_flush_persistent(void);
 
 #endif /* _MNEMOSYNE_SEGMENT_H */
@@ -31,9 +31,17 @@
 */
 
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
 #include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <cpuid.h>
 #include <mmintrin.h>
+#include <immintrin.h>
 #include <list.h>
 #include <spinlock.h>
 #include "cuckoo_hash/PointerHashInline.h"
@@ -117,9 +125,35 @@ unsigned int pcm_likelihood_evicted_cacheline = 10000;
 
 volatile arch_spinlock_t ticket_lock = {0};
 
+/* 
+ * Flush instruction used by PCM_WB_FLUSH. Defaults to CLFLUSH, which is 
+ * always available, until pcm_flush_backend_init runs.
+ */
+pcm_flush_backend_t pcm_flush_backend = PCM_FLUSH_BACKEND_CLFLUSH;
+
+/* 
+ * Stream instructions used by PCM_SEQSTREAM_STORE_64B. Defaults to MOVNTI, 
+ * which is always available, until pcm_stream_backend_init runs.
+ */
+pcm_stream_backend_t pcm_stream_backend = PCM_STREAM_BACKEND_MOVNTI;
+
+/* Set by pcm_stream_backend_init along with the AVX-512 backend */
+int pcm_masked_store_avx512 = 0;
+
+/* Flushes are kept until pcm_persist_domain_init proves they are not needed */
+pcm_persist_domain_t pcm_persist_domain = PCM_PERSIST_DOMAIN_ADR;
+
+uint64_t pcm_tsc_mhz = M_PCM_CPUFREQ;
+
+int pcm_emulate_enabled = 0;
+
 
 __thread pcm_storeset_t* _thread_pcm_storeset;
 
+#ifdef _M_STATS_BUILD
+__thread uint64_t pcm_stat_fences = 0;
+#endif
+
 
 static inline
 cacheline_t *
@@ -203,6 +237,417 @@ pcm_storeset_put(void)
 }
 
 
+/* CPUID.(EAX=07H,ECX=0):EBX feature bits */
+#define CPUID_LEAF7_EBX_CLFLUSHOPT (1 << 23)
+#define CPUID_LEAF7_EBX_CLWB       (1 << 24)
+
+int
+pcm_flush_backend_init(const char *name)
+{
+	unsigned int eax, ebx, ecx, edx;
+	int          clwb = 0;
+	int          clflushopt = 0;
+
+	if (__get_cpuid_max(0, NULL) >= 7) {
+		__cpuid_count(7, 0, eax, ebx, ecx, edx);
+		clwb = (ebx & CPUID_LEAF7_EBX_CLWB) != 0;
+		clflushopt = (ebx & CPUID_LEAF7_EBX_CLFLUSHOPT) != 0;
+	}
+
+	if (name && strcmp(name, "clflush") == 0) {
+		pcm_flush_backend = PCM_FLUSH_BACKEND_CLFLUSH;
+		return 0;
+	}
+	if (name && strcmp(name, "none") == 0) {
+		pcm_flush_backend = PCM_FLUSH_BACKEND_NONE;
+		return 0;
+	}
+	if (name && strcmp(name, "clflushopt") == 0 && clflushopt) {
+		pcm_flush_backend = PCM_FLUSH_BACKEND_CLFLUSHOPT;
+		return 0;
+	}
+	if (name && strcmp(name, "clwb") == 0 && clwb) {
+		pcm_flush_backend = PCM_FLUSH_BACKEND_CLWB;
+		return 0;
+	}
+
+	if (clwb) {
+		pcm_flush_backend = PCM_FLUSH_BACKEND_CLWB;
+	} else if (clflushopt) {
+		pcm_flush_backend = PCM_FLUSH_BACKEND_CLFLUSHOPT;
+	} else {
+		pcm_flush_backend = PCM_FLUSH_BACKEND_CLFLUSH;
+	}
+	return (name == NULL || strcmp(name, "auto") == 0) ? 0 : -1;
+}
+
+
+/* CPUID feature bits and XCR0 state components for the vector stores */
+#define CPUID_LEAF1_ECX_OSXSAVE    (1 << 27)
+#define CPUID_LEAF1_ECX_AVX        (1 << 28)
+#define CPUID_LEAF7_EBX_AVX2       (1 << 5)
+#define CPUID_LEAF7_EBX_AVX512F    (1 << 16)
+#define CPUID_LEAF7_EBX_AVX512BW   (1 << 30)
+#define XCR0_AVX_STATE             0x06   /* SSE, AVX */
+#define XCR0_AVX512_STATE          0xe6   /* SSE, AVX, opmask, ZMM */
+
+int
+pcm_stream_backend_init(const char *name)
+{
+	unsigned int eax, ebx, ecx, edx;
+	unsigned int xcr0_lo, xcr0_hi;
+	int          avx2 = 0;
+	int          avx512 = 0;
+	int          avx512bw = 0;
+
+	__cpuid(1, eax, ebx, ecx, edx);
+	if ((ecx & CPUID_LEAF1_ECX_OSXSAVE) && (ecx & CPUID_LEAF1_ECX_AVX) &&
+	    __get_cpuid_max(0, NULL) >= 7) 
+	{
+		/* The OS must save the vector state, not only the CPU have it */
+		__asm__ __volatile__ ("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+		__cpuid_count(7, 0, eax, ebx, ecx, edx);
+		avx2 = (ebx & CPUID_LEAF7_EBX_AVX2) && 
+		       (xcr0_lo & XCR0_AVX_STATE) == XCR0_AVX_STATE;
+		avx512 = (ebx & CPUID_LEAF7_EBX_AVX512F) && 
+		         (xcr0_lo & XCR0_AVX512_STATE) == XCR0_AVX512_STATE;
+		avx512bw = avx512 && (ebx & CPUID_LEAF7_EBX_AVX512BW);
+	}
+
+	/* Byte-masked stores go vector only where the streams do */
+	pcm_masked_store_avx512 = 0;
+
+	if (name && strcmp(name, "movnti") == 0) {
+		pcm_stream_backend = PCM_STREAM_BACKEND_MOVNTI;
+		return 0;
+	}
+	if (name && strcmp(name, "cached") == 0) {
+		pcm_stream_backend = PCM_STREAM_BACKEND_CACHED;
+		return 0;
+	}
+	if (name && strcmp(name, "avx2") == 0 && avx2) {
+		pcm_stream_backend = PCM_STREAM_BACKEND_AVX2;
+		return 0;
+	}
+	if (name && strcmp(name, "avx512") == 0 && avx512) {
+		pcm_stream_backend = PCM_STREAM_BACKEND_AVX512;
+		pcm_masked_store_avx512 = avx512bw;
+		return 0;
+	}
+
+	if (avx512) {
+		pcm_stream_backend = PCM_STREAM_BACKEND_AVX512;
+		pcm_masked_store_avx512 = avx512bw;
+	} else if (avx2) {
+		pcm_stream_backend = PCM_STREAM_BACKEND_AVX2;
+	} else {
+		pcm_stream_backend = PCM_STREAM_BACKEND_MOVNTI;
+	}
+	return (name == NULL || strcmp(name, "auto") == 0) ? 0 : -1;
+}
+
+
+/* See PCM_WB_STORE_LINE_MASKED; called only if pcm_masked_store_avx512 */
+__attribute__((target("avx512bw")))
+void
+pcm_store_line_masked_avx512(volatile void *addr, const void *val, uint64_t bytemask)
+{
+	_mm512_mask_storeu_epi8((void *) addr, bytemask, _mm512_loadu_si512(val));
+}
+
+
+const char *
+pcm_stream_backend_name(pcm_stream_backend_t backend)
+{
+	switch (backend) {
+		case PCM_STREAM_BACKEND_AVX512:
+			return "avx512";
+		case PCM_STREAM_BACKEND_AVX2:
+			return "avx2";
+		case PCM_STREAM_BACKEND_CACHED:
+			return "cached";
+		default:
+			return "movnti";
+	}
+}
+
+
+const char *
+pcm_flush_backend_name(pcm_flush_backend_t backend)
+{
+	switch (backend) {
+		case PCM_FLUSH_BACKEND_CLWB:
+			return "clwb";
+		case PCM_FLUSH_BACKEND_CLFLUSHOPT:
+			return "clflushopt";
+		case PCM_FLUSH_BACKEND_NONE:
+			return "none";
+		default:
+			return "clflush";
+	}
+}
+
+
+#define ND_DEVICES_PATH "/sys/bus/nd/devices"
+
+/* 
+ * eADR only if there is at least one NVDIMM region and all of them report 
+ * the CPU cache as their persistence domain. Emulated PM (DRAM, files) has 
+ * no regions and keeps the flushes.
+ */
+static
+pcm_persist_domain_t
+persist_domain_detect(void)
+{
+	DIR           *dir;
+	struct dirent *ent;
+	FILE          *fp;
+	char           path[512];
+	char           domain[64];
+	int            nregions = 0;
+	int            neadr = 0;
+
+	if ((dir = opendir(ND_DEVICES_PATH)) == NULL) {
+		return PCM_PERSIST_DOMAIN_ADR;
+	}
+	while ((ent = readdir(dir)) != NULL) {
+		if (strncmp(ent->d_name, "region", 6) != 0) {
+			continue;
+		}
+		snprintf(path, sizeof(path), "%s/%s/persistence_domain", 
+		         ND_DEVICES_PATH, ent->d_name);
+		nregions++;
+		if ((fp = fopen(path, "r")) == NULL) {
+			continue;
+		}
+		if (fgets(domain, sizeof(domain), fp) && 
+		    strncmp(domain, "cpu_cache", 9) == 0) 
+		{
+			neadr++;
+		}
+		fclose(fp);
+	}
+	closedir(dir);
+
+	return (nregions > 0 && neadr == nregions) ? PCM_PERSIST_DOMAIN_EADR 
+	                                           : PCM_PERSIST_DOMAIN_ADR;
+}
+
+
+int
+pcm_persist_domain_init(const char *name)
+{
+	int rv = 0;
+
+	if (name && strcmp(name, "adr") == 0) {
+		pcm_persist_domain = PCM_PERSIST_DOMAIN_ADR;
+	} else if (name && strcmp(name, "eadr") == 0) {
+		pcm_persist_domain = PCM_PERSIST_DOMAIN_EADR;
+	} else {
+		pcm_persist_domain = persist_domain_detect();
+		rv = (name == NULL || strcmp(name, "auto") == 0) ? 0 : -1;
+	}
+
+	if (pcm_persist_domain == PCM_PERSIST_DOMAIN_EADR) {
+		pcm_flush_backend = PCM_FLUSH_BACKEND_NONE;
+		pcm_stream_backend = PCM_STREAM_BACKEND_CACHED;
+	}
+	return rv;
+}
+
+
+const char *
+pcm_persist_domain_name(pcm_persist_domain_t domain)
+{
+	switch (domain) {
+		case PCM_PERSIST_DOMAIN_EADR:
+			return "eadr";
+		default:
+			return "adr";
+	}
+}
+
+
+/* Runtime latency/bandwidth emulation */
+
+#define PCM_EMULATE_MAX_SOCKETS     64
+
+/* Bytes a socket may write back ahead of its bandwidth budget. */
+#define PCM_EMULATE_BURST_BYTES     (64*1024)
+
+/* Wall-clock interval the TSC is measured over. */
+#define PCM_EMULATE_CALIBRATE_NS    (10*1000*1000)
+
+/* 
+ * Token bucket kept as the theoretical arrival time of the next write-back: 
+ * a charge advances it by the transfer time of the bytes, and the writer 
+ * stalls while it runs more than a burst ahead of the TSC.
+ */
+typedef struct {
+	volatile uint64_t tat;
+	char              pad[CACHELINE_SIZE - sizeof(uint64_t)];
+} pcm_emulate_bucket_t;
+
+static pcm_emulate_bucket_t pcm_emulate_buckets[PCM_EMULATE_MAX_SOCKETS] 
+                            __attribute__ ((aligned (CACHELINE_SIZE)));
+
+static uint64_t pcm_emulate_flush_cycles = 0;
+static uint64_t pcm_emulate_fence_cycles = 0;
+static double   pcm_emulate_cycles_per_byte = 0;
+static uint64_t pcm_emulate_burst_cycles = 0;
+
+static volatile int64_t pcm_crash_countdown = 0;
+
+static __thread uint64_t pcm_emulate_pending_bytes = 0;
+static __thread int      pcm_emulate_socket = -1;
+
+
+static inline
+uint64_t
+monotonic_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+/* Measures the TSC rate against the monotonic clock. */
+static
+uint64_t
+tsc_calibrate_mhz(void)
+{
+	uint64_t t0, t1;
+	uint64_t c0, c1;
+
+	t0 = monotonic_ns();
+	c0 = asm_rdtsc();
+	do {
+		t1 = monotonic_ns();
+	} while (t1 - t0 < PCM_EMULATE_CALIBRATE_NS);
+	c1 = asm_rdtsc();
+
+	return (c1 - c0) * 1000 / (t1 - t0);
+}
+
+
+static inline
+void
+emulate_spin_cycles(uint64_t cycles)
+{
+	uint64_t start = asm_rdtsc();
+
+	while (asm_rdtsc() - start < cycles) {
+		asm volatile ("pause");
+	}
+}
+
+
+void
+pcm_emulate_init(int enable, int flush_latency_ns, int fence_latency_ns, 
+                 int bandwidth_mb)
+{
+	uint64_t mhz;
+
+	mhz = tsc_calibrate_mhz();
+	if (mhz > 0) {
+		pcm_tsc_mhz = mhz;
+	}
+	if (!enable) {
+		pcm_emulate_enabled = 0;
+		return;
+	}
+	pcm_emulate_flush_cycles = NS2CYCLE((uint64_t) flush_latency_ns);
+	pcm_emulate_fence_cycles = NS2CYCLE((uint64_t) fence_latency_ns);
+	if (bandwidth_mb > 0) {
+		/* MB/s at pcm_tsc_mhz cycles per microsecond */
+		pcm_emulate_cycles_per_byte = (double) pcm_tsc_mhz / bandwidth_mb;
+		pcm_emulate_burst_cycles = PCM_EMULATE_BURST_BYTES * 
+		                           pcm_emulate_cycles_per_byte;
+	} else {
+		pcm_emulate_cycles_per_byte = 0;
+	}
+	pcm_emulate_enabled = 1;
+}
+
+
+void
+pcm_crash_init(int crash_point)
+{
+	if (crash_point > 0) {
+		pcm_crash_countdown = crash_point;
+		pcm_emulate_enabled = 1;
+	}
+}
+
+
+void
+pcm_emulate_flush(void)
+{
+	pcm_emulate_pending_bytes += CACHELINE_SIZE;
+	if (pcm_emulate_flush_cycles) {
+		emulate_spin_cycles(pcm_emulate_flush_cycles);
+	}
+}
+
+
+void
+pcm_emulate_nt_store(unsigned int nbytes)
+{
+	pcm_emulate_pending_bytes += nbytes;
+}
+
+
+static
+void
+emulate_bandwidth(uint64_t nbytes)
+{
+	pcm_emulate_bucket_t *bucket;
+	uint64_t             cost;
+	uint64_t             now;
+	uint64_t             old;
+	uint64_t             new;
+	unsigned             node;
+
+	if (pcm_emulate_socket < 0) {
+		if (syscall(SYS_getcpu, NULL, &node, NULL) != 0) {
+			node = 0;
+		}
+		pcm_emulate_socket = node % PCM_EMULATE_MAX_SOCKETS;
+	}
+	bucket = &pcm_emulate_buckets[pcm_emulate_socket];
+	cost = nbytes * pcm_emulate_cycles_per_byte;
+	now = asm_rdtsc();
+	do {
+		old = bucket->tat;
+		new = (old > now ? old : now) + cost;
+	} while (!__sync_bool_compare_and_swap(&bucket->tat, old, new));
+
+	if (new - now > pcm_emulate_burst_cycles) {
+		emulate_spin_cycles(new - now - pcm_emulate_burst_cycles);
+	}
+}
+
+
+void
+pcm_emulate_fence(void)
+{
+	if (pcm_emulate_pending_bytes && pcm_emulate_cycles_per_byte > 0) {
+		emulate_bandwidth(pcm_emulate_pending_bytes);
+	}
+	pcm_emulate_pending_bytes = 0;
+	if (pcm_emulate_fence_cycles) {
+		emulate_spin_cycles(pcm_emulate_fence_cycles);
+	}
+	if (pcm_crash_countdown > 0 && 
+	    __sync_sub_and_fetch(&pcm_crash_countdown, 1) == 0) 
+	{
+		_exit(PCM_CRASH_EXIT_STATUS);
+	}
+}
+
+
 
 void 
 pcm_check_crash(pcm_storeset_t *set)
@@ -554,3 +999,41 @@ pcm_nt_flush_emulate_crash(pcm_storeset_t *set)
 	nt_flush_buffers(set);
 	set->in_crash_emulation_code = 0;
 }
+
+
+/**
+ * \brief Writes back the cachelines of a persistent range.
+ *
+ * For code that updates persistent memory outside transactions. The write
+ * backs are weakly ordered; m_pfence orders them before later stores.
+ */
+void
+m_pflush(const void *addr, size_t length)
+{
+	uintptr_t line;
+	uintptr_t end = (uintptr_t) addr + length;
+
+	for (line = (uintptr_t) addr & ~((uintptr_t) CACHELINE_SIZE - 1); 
+	     line < end; line += CACHELINE_SIZE) 
+	{
+		PCM_WB_FLUSH(NULL, (volatile pcm_word_t *) line);
+	}
+}
+
+
+/**
+ * \brief Orders prior m_pflush write backs before any later store.
+ */
+void
+m_pfence(void)
+{
+	PCM_PERSIST_BARRIER(NULL);
+}
+
+
+void
+m_persist(const void *addr, size_t length)
+{
+	m_pflush(addr, length);
+	m_pfence();
+}
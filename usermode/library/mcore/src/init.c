@@ -32,29 +32,94 @@
 
 #include <pthread.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/mman.h>
 #include "reincarnation_callback.h"
 #include "segment.h"
 #include "log/log_i.h"
+#include "log/groupcommit.h"
 #include "thrdesc.h"
 #include "debug.h"
 #include "config.h"
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#ifdef _ENABLE_BTRACE
+#include "pm_btrace.h"
+#endif
 
 static pthread_mutex_t global_init_lock = PTHREAD_MUTEX_INITIALIZER;
 //static pthread_cond_t  global_init_cond = PTHREAD_COND_INITIALIZER;
 //static pthread_mutex_t global_fini_lock = PTHREAD_MUTEX_INITIALIZER;
 //static pthread_cond_t  global_fini_cond = PTHREAD_COND_INITIALIZER;
 volatile uint32_t      mnemosyne_initialized = 0;
+static volatile int    global_init_done = 0;
+static __thread int    global_init_running = 0;
+static int             global_config_initialized = 0;
 
 
 __thread mnemosyne_thrdesc_t *_mnemosyne_thr;
 
-static void do_global_init(void) __attribute__(( constructor ));
+static void do_global_ctor(void) __attribute__(( constructor ));
+static void do_global_init(void);
 static void do_global_fini(void) __attribute__(( destructor ));
 
+
+static void
+global_config_init(void)
+{
+	if (!global_config_initialized) {
+		mcore_config_init();
+		global_config_initialized = 1;
+	}
+}
+
+
+static void *
+global_init_thread(void *arg)
+{
+	do_global_init();
+	return NULL;
+}
+
+
+/*
+ * Mapping the persistent segments back and recovering the logs can take a 
+ * while with large segments, and with init_mode eager it delays main. lazy 
+ * leaves it to the first call into the library, background to a thread 
+ * that the first call waits for (do_global_init holds global_init_lock 
+ * throughout).
+ */
+void
+do_global_ctor(void)
+{
+	pthread_t      thread;
+	pthread_attr_t attr;
+	char           *mode;
+
+	pthread_mutex_lock(&global_init_lock);
+	global_config_init();
+	pthread_mutex_unlock(&global_init_lock);
+	mode = mcore_runtime_settings.init_mode;
+	if (strcmp(mode, "lazy") == 0) {
+		return;
+	}
+	if (strcmp(mode, "background") == 0) {
+		pthread_attr_init(&attr);
+		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+		if (pthread_create(&thread, &attr, global_init_thread, NULL) == 0) {
+			pthread_attr_destroy(&attr);
+			return;
+		}
+		pthread_attr_destroy(&attr);
+		M_WARNING("failed to start the initialization thread\n");
+	} else if (strcmp(mode, "eager") != 0) {
+		M_WARNING("Unknown init_mode %s, initializing eagerly\n", mode);
+	}
+	do_global_init();
+}
+
+
 void
 do_global_init(void)
 {
@@ -65,9 +130,15 @@ do_global_init(void)
 	unsigned long long op_time;
 #endif
 
-	if (mnemosyne_initialized) {
+	if (global_init_done || global_init_running) {
 		return;
 	}
+	pthread_mutex_lock(&global_init_lock);
+	if (global_init_done) {
+		pthread_mutex_unlock(&global_init_lock);
+		return;
+	}
+	global_init_running = 1;
 	
 	#ifdef _ENABLE_TRACE
         gettimeofday(&glb_time, NULL);          
@@ -128,24 +199,68 @@ fail:
 
 	pcm_storeset = pcm_storeset_get ();
 
-	pthread_mutex_lock(&global_init_lock);
-	if (!mnemosyne_initialized) {
-		mcore_config_init();
+	global_config_init();
+	if (pcm_flush_backend_init(mcore_runtime_settings.flush_backend) != 0) {
+		M_WARNING("PCM flush backend %s is not available on this CPU\n",
+		          mcore_runtime_settings.flush_backend);
+	}
+	M_LOG(M_LOG_CAT_CORE, M_LOG_DEBUG, "PCM flush backend: %s\n", 
+	      pcm_flush_backend_name(pcm_flush_backend));
+	if (pcm_stream_backend_init(mcore_runtime_settings.log_stream_store) != 0) {
+		M_WARNING("PCM stream backend %s is not available on this CPU\n",
+		          mcore_runtime_settings.log_stream_store);
+	}
+	if (pcm_persist_domain_init(mcore_runtime_settings.persistence_domain) != 0) {
+		M_WARNING("PCM persistence domain %s is not known\n",
+		          mcore_runtime_settings.persistence_domain);
+	}
+	if (pcm_persist_domain == PCM_PERSIST_DOMAIN_EADR) {
+		M_LOG(M_LOG_CAT_CORE, M_LOG_DEBUG, 
+		      "PCM persistence domain: eadr, flushes elided and log stores cached\n");
+	} else {
+		M_LOG(M_LOG_CAT_CORE, M_LOG_DEBUG, "PCM stream backend: %s\n", 
+		      pcm_stream_backend_name(pcm_stream_backend));
+	}
+	pcm_emulate_init(mcore_runtime_settings.pm_emulate,
+	                 mcore_runtime_settings.pm_flush_latency_ns,
+	                 mcore_runtime_settings.pm_fence_latency_ns,
+	                 mcore_runtime_settings.pm_bandwidth_mb);
+	pcm_crash_init(mcore_runtime_settings.crash_point);
+	if (pcm_emulate_enabled && mcore_runtime_settings.pm_emulate) {
+		M_LOG(M_LOG_CAT_CORE, M_LOG_DEBUG,
+		      "PM emulation: TSC %lu MHz, flush %d ns, fence %d ns, bandwidth %d MB/s\n",
+		      (unsigned long) pcm_tsc_mhz,
+		      mcore_runtime_settings.pm_flush_latency_ns,
+		      mcore_runtime_settings.pm_fence_latency_ns,
+		      mcore_runtime_settings.pm_bandwidth_mb);
+	}
+#ifdef _ENABLE_BTRACE
+	/* After pcm_emulate_init, which measures the TSC rate */
+	if (pm_btrace_init(mcore_runtime_settings.trace_file,
+	                   mcore_runtime_settings.trace_records_log2,
+	                   pcm_tsc_mhz) != 0) {
+		M_WARNING("failed to create the trace file %s\n",
+		          mcore_runtime_settings.trace_file);
+	}
+#endif
 #ifdef _M_STATS_BUILD
-		gettimeofday(&start_time, NULL);
+	gettimeofday(&start_time, NULL);
 #endif
-		m_segmentmgr_init();
-		mnemosyne_initialized = 1;
-		mnemosyne_reincarnation_callback_execute_all();
+	m_segmentmgr_init();
+	mnemosyne_initialized = 1;
+	mnemosyne_reincarnation_callback_execute_all();
 #ifdef _M_STATS_BUILD
-		gettimeofday(&stop_time, NULL);
-		op_time = 1000000 * (stop_time.tv_sec - start_time.tv_sec) +
-		                     stop_time.tv_usec - start_time.tv_usec;
-		fprintf(stderr, "reincarnation_latency = %llu (us)\n", op_time);
+	gettimeofday(&stop_time, NULL);
+	op_time = 1000000 * (stop_time.tv_sec - start_time.tv_sec) +
+	                     stop_time.tv_usec - start_time.tv_usec;
+	fprintf(stderr, "reincarnation_latency = %llu (us)\n", op_time);
 #endif
-		m_logmgr_init(pcm_storeset);
-		M_WARNING("Initialize\n");
-	}	
+	m_groupcommit_init(mcore_runtime_settings.group_commit, 
+	                   mcore_runtime_settings.group_commit_max_latency);
+	m_logmgr_init(pcm_storeset);
+	M_LOG(M_LOG_CAT_CORE, M_LOG_DEBUG, "Initialize\n");
+	global_init_done = 1;
+	global_init_running = 0;
 	pthread_mutex_unlock(&global_init_lock);
 }
 
@@ -159,9 +274,13 @@ do_global_fini(void)
 
 	pthread_mutex_lock(&global_init_lock);
 	if (mnemosyne_initialized) {
+		mnemosyne_reincarnation_callback_fini();
 		m_logmgr_fini();
 		m_segmentmgr_fini();
 		mtm_fini_global();
+#ifdef _ENABLE_BTRACE
+		pm_btrace_fini();
+#endif
 		#ifdef _ENABLE_TRACE
 		pthread_spin_lock(&tbuf_lock);
 		if(tbuf_sz && mtm_enable_trace)
@@ -186,8 +305,9 @@ do_global_fini(void)
 		pthread_spin_destroy(&tot_epoch_lock);
 		#endif
 		mnemosyne_initialized = 0;
+		global_init_done = 0;
 
-		M_WARNING("Shutdown\n");
+		M_LOG(M_LOG_CAT_CORE, M_LOG_DEBUG, "Shutdown\n");
 	}	
 	pthread_mutex_unlock(&global_init_lock);
 }
@@ -0,0 +1,202 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/*!
+ * \file 
+ *
+ * Implements epoch-based group commit of the physical log tails.
+ */
+
+#include <pthread.h>
+#include <sys/time.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include "debug.h"
+#include "groupcommit.h"
+
+int m_groupcommit_enabled = 0;
+
+static m_groupcommit_t groupcommit = { PTHREAD_MUTEX_INITIALIZER, 
+                                       PTHREAD_COND_INITIALIZER, 
+                                       PTHREAD_COND_INITIALIZER, 
+                                       1, 0, 0, 0 };
+static int             groupcommit_max_latency_us = 0;
+
+
+m_result_t
+m_groupcommit_init(int enable, int max_latency_us)
+{
+	groupcommit_max_latency_us = max_latency_us > 0 ? max_latency_us : 0;
+	m_groupcommit_enabled = enable;
+	return M_R_SUCCESS;
+}
+
+
+m_result_t
+m_groupcommit_fini(void)
+{
+#ifdef _M_STATS_BUILD
+	if (groupcommit.stat_epochs > 0) {
+		printf("groupcommit_epochs          %llu\n", (unsigned long long) groupcommit.stat_epochs);
+		printf("groupcommit_commits         %llu\n", (unsigned long long) groupcommit.stat_commits);
+		printf("groupcommit_avg_batch       %llu\n", (unsigned long long) (groupcommit.stat_commits/groupcommit.stat_epochs));
+	}
+#endif
+	m_groupcommit_enabled = 0;
+	return M_R_SUCCESS;
+}
+
+
+/** 
+ * Leader: waits for the epoch to fill or the latency budget to expire.
+ * Must be called with the group commit mutex held.
+ */
+static inline
+void
+wait_for_members(m_groupcommit_t *gc)
+{
+	struct timeval  now;
+	struct timespec deadline;
+	long long       nsec;
+
+	if (groupcommit_max_latency_us == 0) {
+		return;
+	}
+	gettimeofday(&now, NULL);
+	nsec = (now.tv_usec + (long long) groupcommit_max_latency_us) * 1000;
+	deadline.tv_sec = now.tv_sec + nsec / 1000000000;
+	deadline.tv_nsec = nsec % 1000000000;
+	while (gc->nmembers < GROUPCOMMIT_MAX_MEMBERS) {
+		if (pthread_cond_timedwait(&gc->cond_full, &gc->mutex, &deadline) == ETIMEDOUT) {
+			break;
+		}
+	}
+}
+
+
+/**
+ * Writes back the chunks of all members, then publishes their words. Two 
+ * persist barriers in all: the published words must not become durable 
+ * before the chunks they cover.
+ */
+static inline
+void
+make_durable(pcm_storeset_t *set, m_groupcommit_member_t *members, int nmembers)
+{
+	m_groupcommit_member_t *m;
+	uint64_t               i;
+	int                    publish = 0;
+
+	for (m = members; m < members + nmembers; m++) {
+		for (i = m->from; i != m->to; i = (i + CACHELINE_SIZE/sizeof(pcm_word_t)) & m->mask) {
+			PCM_WB_FLUSH(set, &m->nvphlog[i]);
+		}
+		publish |= m->addr != NULL;
+	}
+	PCM_PERSIST_BARRIER(set);
+	if (!publish) {
+		return;
+	}
+	for (m = members; m < members + nmembers; m++) {
+		if (m->addr) {
+			PCM_NT_STORE(set, m->addr, m->val);
+		}
+	}
+	PCM_PERSIST_BARRIER(set);
+}
+
+
+/**
+ * \brief Makes the chunks of a log, and the word that publishes them, 
+ * durable as part of a commit epoch.
+ *
+ * The chunks must have been written with PCM_WB_STORE_64B. Returns once 
+ * the epoch the caller joined is durable.
+ */
+void
+m_groupcommit_join(pcm_storeset_t *set, m_groupcommit_member_t *member)
+{
+	m_groupcommit_t        *gc = &groupcommit;
+	m_groupcommit_member_t members[GROUPCOMMIT_MAX_MEMBERS];
+	uint64_t               epoch;
+	int                    nmembers;
+
+	pthread_mutex_lock(&gc->mutex);
+	if (gc->nmembers == GROUPCOMMIT_MAX_MEMBERS) {
+		/* Epoch is full and its leader hasn't closed it yet; commit alone. */
+		pthread_mutex_unlock(&gc->mutex);
+		make_durable(set, member, 1);
+		return;
+	}
+	epoch = gc->open_epoch;
+	gc->members[gc->nmembers] = *member;
+	if (++gc->nmembers == GROUPCOMMIT_MAX_MEMBERS) {
+		pthread_cond_signal(&gc->cond_full);
+	}
+	if (gc->has_leader) {
+		while (gc->durable_epoch < epoch) {
+			pthread_cond_wait(&gc->cond_durable, &gc->mutex);
+		}
+		pthread_mutex_unlock(&gc->mutex);
+		return;
+	}
+
+	/* 
+	 * We lead this epoch. Epochs become durable in order, so that 
+	 * durable_epoch covers all earlier ones: while the previous leader is 
+	 * at it, more committers join ours.
+	 */
+	gc->has_leader = 1;
+	while (gc->durable_epoch < epoch - 1) {
+		pthread_cond_wait(&gc->cond_durable, &gc->mutex);
+	}
+	wait_for_members(gc);
+	/* Close the epoch; the next thread to join leads the next one. */
+	nmembers = gc->nmembers;
+	memcpy(members, gc->members, nmembers * sizeof(m_groupcommit_member_t));
+	gc->nmembers = 0;
+	gc->has_leader = 0;
+	gc->open_epoch++;
+	pthread_mutex_unlock(&gc->mutex);
+
+	make_durable(set, members, nmembers);
+
+	pthread_mutex_lock(&gc->mutex);
+	gc->durable_epoch = epoch;
+	gc->stat_epochs++;
+	gc->stat_commits += nmembers;
+	pthread_cond_broadcast(&gc->cond_durable);
+	pthread_mutex_unlock(&gc->mutex);
+}
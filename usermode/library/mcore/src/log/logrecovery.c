@@ -0,0 +1,247 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/*!
+ * \file 
+ *
+ * Implements parallel application of redo records during log recovery.
+ *
+ * The log manager still walks the log fragments in transaction order, but 
+ * the records are handed to log_recovery_threads workers partitioned by 
+ * cache line. Records of the same cache line go to the same worker in the 
+ * order they were logged, so each worker only keeps the order within its
+ * partition. Each worker ends with a single persist barrier; the logs are
+ * truncated only after all workers are done.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <debug.h>
+#include "config.h"
+#include "log_i.h"
+#include "logrecovery.h"
+#include "logical_replay.h"
+#include "hal/pcm_i.h"
+
+#define LOGRECOVERY_QUEUE_SIZE 4096 /* records per partition; power of 2 */
+#define LOGRECOVERY_PREFETCH   16   /* records ahead whose home line a worker prefetches */
+
+typedef struct logrecovery_record_s {
+	uintptr_t  addr;
+	pcm_word_t value;
+	pcm_word_t mask;
+} logrecovery_record_t;
+
+/*
+ * A single-producer single-consumer queue of records: the log manager 
+ * appends at tail and the partition's worker applies from head.
+ */
+typedef struct logrecovery_partition_s {
+	logrecovery_record_t *records;
+	volatile uint64_t    head;
+	volatile uint64_t    tail;
+	pthread_t            thread;
+} logrecovery_partition_t;
+
+static int                     npartitions = 0;  /**< 0 when records are applied inline */
+static logrecovery_partition_t *partitions;
+static volatile int            producer_done;
+static uintptr_t               inline_block;     /**< last block written when applying inline */
+
+
+/*
+ * Applies a record and writes back the previous block once the partition 
+ * moves on to another block, so runs of stores to the same block are 
+ * flushed once.
+ */
+static inline
+void
+apply_record(pcm_storeset_t *set, uintptr_t *blockp, logrecovery_record_t *r)
+{
+	PCM_WB_STORE_ALIGNED_MASKED(set, (volatile pcm_word_t *) r->addr, r->value, r->mask);
+	if ((uintptr_t) BLOCK_ADDR(r->addr) != *blockp) {
+		if (*blockp) {
+			PCM_WB_FLUSH(set, (volatile pcm_word_t *) *blockp);
+		}
+		*blockp = (uintptr_t) BLOCK_ADDR(r->addr);
+	}
+}
+
+
+static
+void *
+log_recovery_worker (void *arg)
+{
+	logrecovery_partition_t *p = (logrecovery_partition_t *) arg;
+	pcm_storeset_t          *set;
+	uintptr_t               block = 0;
+
+	set = pcm_storeset_get();
+	while (1) {
+		if (p->head == p->tail) {
+			if (producer_done && p->head == p->tail) {
+				break;
+			}
+			sched_yield();
+			continue;
+		}
+		__sync_synchronize();
+		/* The home lines are cold: fetch them ahead of their stores */
+		if (p->tail - p->head > LOGRECOVERY_PREFETCH) {
+			__builtin_prefetch((const void *) p->records[(p->head + LOGRECOVERY_PREFETCH) & (LOGRECOVERY_QUEUE_SIZE - 1)].addr, 1, 3);
+		}
+		apply_record(set, &block, &p->records[p->head & (LOGRECOVERY_QUEUE_SIZE - 1)]);
+		p->head++;
+	}
+	if (block) {
+		PCM_WB_FLUSH(set, (volatile pcm_word_t *) block);
+	}
+	PCM_PERSIST_BARRIER(set);
+
+	return 0;
+}
+
+
+/**
+ * \brief Starts the recovery workers. Records passed to 
+ * m_logrecovery_store from then on are applied by the workers.
+ */
+m_result_t
+m_logrecovery_begin(void)
+{
+	int i;
+
+	inline_block = 0;
+	npartitions = mcore_runtime_settings.log_recovery_threads;
+	if (npartitions <= 1) {
+		npartitions = 0;
+		return M_R_SUCCESS;
+	}
+	if (!(partitions = (logrecovery_partition_t *) calloc(npartitions, sizeof(logrecovery_partition_t)))) {
+		npartitions = 0;
+		return M_R_NOMEMORY;
+	}
+	producer_done = 0;
+	for (i = 0; i < npartitions; i++) {
+		if (!(partitions[i].records = (logrecovery_record_t *) malloc(LOGRECOVERY_QUEUE_SIZE * sizeof(logrecovery_record_t)))) {
+			M_INTERNALERROR("Could not allocate log recovery queue.\n");
+		}
+		pthread_create(&partitions[i].thread, NULL, &log_recovery_worker, (void *) &partitions[i]);
+	}
+
+	return M_R_SUCCESS;
+}
+
+
+/**
+ * \brief Applies a redo record of a recovered log fragment. Records must 
+ * be passed in the order the fragments are recovered.
+ *
+ * The store is durable only after m_logrecovery_end returns, so the 
+ * fragment must not be truncated before then.
+ */
+void
+m_logrecovery_store(pcm_storeset_t *set, uintptr_t addr, pcm_word_t value, pcm_word_t mask)
+{
+	logrecovery_partition_t *p;
+	logrecovery_record_t    r = { addr, value, mask };
+
+	if (mask == 0) {
+		return;
+	}
+	if (npartitions == 0) {
+		apply_record(set, &inline_block, &r);
+		return;
+	}
+	p = &partitions[((uintptr_t) BLOCK_ADDR(addr) >> CACHELINE_SIZE_LOG) % npartitions];
+	while (p->tail - p->head == LOGRECOVERY_QUEUE_SIZE) {
+		sched_yield();
+	}
+	p->records[p->tail & (LOGRECOVERY_QUEUE_SIZE - 1)] = r;
+	__sync_synchronize();
+	p->tail++;
+}
+
+
+/**
+ * \brief Replays a logical record of a recovered log fragment once the 
+ * records passed before it are applied, so that the replay routine sees 
+ * the state they leave. The routine makes its own stores durable.
+ */
+void
+m_logrecovery_logical(pcm_storeset_t *set, unsigned int opcode, const void *args, size_t size)
+{
+	void (*replay)(const void *, size_t);
+	int  i;
+
+	if (!(replay = mnemosyne_logical_replay_lookup(opcode))) {
+		M_INTERNALERROR("No replay routine registered for logical log opcode %u.\n", opcode);
+	}
+	for (i = 0; i < npartitions; i++) {
+		while (partitions[i].head != partitions[i].tail) {
+			sched_yield();
+		}
+	}
+	__sync_synchronize();
+	replay(args, size);
+}
+
+
+/**
+ * \brief Waits until all records passed to m_logrecovery_store are applied
+ * and made durable.
+ */
+m_result_t
+m_logrecovery_end(pcm_storeset_t *set)
+{
+	int i;
+
+	if (npartitions == 0) {
+		if (inline_block) {
+			PCM_WB_FLUSH(set, (volatile pcm_word_t *) inline_block);
+		}
+		PCM_PERSIST_BARRIER(set);
+		return M_R_SUCCESS;
+	}
+	__sync_synchronize();
+	producer_done = 1;
+	for (i = 0; i < npartitions; i++) {
+		pthread_join(partitions[i].thread, NULL);
+		free(partitions[i].records);
+	}
+	free(partitions);
+	npartitions = 0;
+
+	return M_R_SUCCESS;
+}
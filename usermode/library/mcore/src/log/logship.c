@@ -0,0 +1,687 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/*!
+ * \file 
+ *
+ * Implements redo log shipping to a standby (see logship.h).
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <debug.h>
+#include "config.h"
+#include "log_i.h"
+#include "logrecovery.h"
+#include "logship.h"
+
+/* A committed fragment copied out of a log */
+typedef struct logship_frag_s {
+	struct logship_frag_s *next;
+	uint64_t              sqn;
+	uint64_t              seq;      /**< order read in, to keep the merge stable */
+	uint64_t              nwords;
+	pcm_word_t            words[];
+} logship_frag_t;
+
+#define LOGSHIP_FRAG_BYTES(f) (sizeof(logship_frag_t) + (f)->nwords * sizeof(pcm_word_t))
+
+int m_logship_enabled = 0;
+int m_logship_sync_enabled = 0;
+
+static uint64_t          (*logship_watermark)(void);
+static volatile uint64_t replicated_sqn = 0;
+
+/* Fragments read but not shipped yet; used by the truncation thread only */
+static uint64_t          pass_watermark;
+static uint64_t          next_seq;
+static logship_frag_t    **held;
+static int               nheld;
+static int               maxheld;
+
+/* Fragments handed to the sender thread */
+static pthread_mutex_t   queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t    queue_cond = PTHREAD_COND_INITIALIZER;   /**< fragments queued */
+static pthread_cond_t    space_cond = PTHREAD_COND_INITIALIZER;   /**< fragments sent */
+static logship_frag_t    *queue_head = NULL;
+static logship_frag_t    **queue_tail = &queue_head;
+static uint64_t          queue_bytes = 0;
+static uint64_t          queue_limit;
+
+/* Synchronous shipping: batches sent by the committing threads */
+static int               sync_fd;
+static pthread_mutex_t   sync_send_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t   sync_ack_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t    sync_ack_cond = PTHREAD_COND_INITIALIZER;
+static uint64_t          sync_sent = 0;      /**< batches sent */
+static volatile uint64_t sync_acked = 0;     /**< batches acknowledged */
+
+
+static
+int
+write_all(int fd, const void *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		if ((n = write(fd, buf, len)) <= 0) {
+			return -1;
+		}
+		buf = (const char *) buf + n;
+		len -= n;
+	}
+	return 0;
+}
+
+
+static
+int
+read_all(int fd, void *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		if ((n = read(fd, buf, len)) <= 0) {
+			return -1;
+		}
+		buf = (char *) buf + n;
+		len -= n;
+	}
+	return 0;
+}
+
+
+/* Frees a list of fragments taken off the queue; queue_mutex must be held */
+static
+void
+free_frags(logship_frag_t *f)
+{
+	logship_frag_t *next;
+
+	for (; f; f = next) {
+		next = f->next;
+		queue_bytes -= LOGSHIP_FRAG_BYTES(f);
+		free(f);
+	}
+	pthread_cond_broadcast(&space_cond);
+}
+
+
+void
+m_logship_stream_init(m_logship_stream_t *s)
+{
+	memset(s, 0, sizeof(*s));
+	s->frag_start = INV_LOG_ORDER;
+}
+
+
+/**
+ * \brief Copies a word of a fragment into a stream. The first word of a 
+ * fragment opens it.
+ */
+void
+m_logship_stream_append(m_logship_stream_t *s, pcm_word_t word)
+{
+	if (s->nwords + 3 > s->maxwords) {
+		s->maxwords = s->maxwords ? 2 * s->maxwords : 1024;
+		if (!(s->words = (pcm_word_t *) realloc(s->words, s->maxwords * sizeof(pcm_word_t)))) {
+			M_INTERNALERROR("Could not allocate log shipping stream.\n");
+		}
+	}
+	if (s->frag_start == INV_LOG_ORDER) {
+		/* Room for the sequence number and the size */
+		s->frag_start = s->nwords;
+		s->nwords += 2;
+	}
+	s->words[s->nwords++] = word;
+}
+
+
+void
+m_logship_stream_commit(m_logship_stream_t *s, uint64_t sqn)
+{
+	if (s->frag_start != INV_LOG_ORDER) {
+		s->words[s->frag_start] = sqn;
+		s->words[s->frag_start + 1] = s->nwords - s->frag_start - 2;
+		s->frag_start = INV_LOG_ORDER;
+	}
+}
+
+
+void
+m_logship_stream_abort(m_logship_stream_t *s)
+{
+	if (s->frag_start != INV_LOG_ORDER) {
+		s->nwords = s->frag_start;
+		s->frag_start = INV_LOG_ORDER;
+	}
+}
+
+
+void
+m_logship_append(m_log_dsc_t *log_dsc, pcm_word_t word)
+{
+	if (!log_dsc->ship) {
+		if (!(log_dsc->ship = (m_logship_stream_t *) malloc(sizeof(m_logship_stream_t)))) {
+			M_INTERNALERROR("Could not allocate log shipping stream.\n");
+		}
+		m_logship_stream_init(log_dsc->ship);
+	}
+	m_logship_stream_append(log_dsc->ship, word);
+}
+
+
+void
+m_logship_commit(m_log_dsc_t *log_dsc, uint64_t sqn)
+{
+	if (log_dsc->ship) {
+		m_logship_stream_commit(log_dsc->ship, sqn);
+	}
+}
+
+
+void
+m_logship_abort(m_log_dsc_t *log_dsc)
+{
+	if (log_dsc->ship) {
+		m_logship_stream_abort(log_dsc->ship);
+	}
+}
+
+
+/**
+ * \brief Called before a truncation pass reads the logs. Every commit up 
+ * to the watermark read now is durable, so the pass or an earlier one 
+ * reads it.
+ */
+void
+m_logship_pass_begin(void)
+{
+	if (m_logship_enabled) {
+		pass_watermark = logship_watermark ? logship_watermark() : INV_LOG_ORDER;
+	}
+}
+
+
+/**
+ * \brief Takes the fragments a truncation pass read from a log.
+ */
+void
+m_logship_collect(m_log_dsc_t *log_dsc)
+{
+	m_logship_stream_t *s = log_dsc->ship;
+	logship_frag_t     *f;
+	uint64_t           i;
+	uint64_t           n;
+
+	if (!s) {
+		return;
+	}
+	for (i = 0; m_logship_enabled && i < s->nwords; i += 2 + n) {
+		n = s->words[i + 1];
+		if (!(f = (logship_frag_t *) malloc(sizeof(logship_frag_t) + n * sizeof(pcm_word_t)))) {
+			M_INTERNALERROR("Could not allocate log shipping fragment.\n");
+		}
+		f->sqn = s->words[i];
+		f->seq = next_seq++;
+		f->nwords = n;
+		memcpy(f->words, &s->words[i + 2], n * sizeof(pcm_word_t));
+		if (nheld == maxheld) {
+			maxheld = maxheld ? 2 * maxheld : 1024;
+			if (!(held = (logship_frag_t **) realloc(held, maxheld * sizeof(logship_frag_t *)))) {
+				M_INTERNALERROR("Could not allocate log shipping fragment.\n");
+			}
+		}
+		held[nheld++] = f;
+	}
+	s->nwords = 0;
+	s->frag_start = INV_LOG_ORDER;
+}
+
+
+static
+int
+frag_compare(const void *a, const void *b)
+{
+	const logship_frag_t *fa = *(const logship_frag_t **) a;
+	const logship_frag_t *fb = *(const logship_frag_t **) b;
+
+	if (fa->sqn != fb->sqn) {
+		return fa->sqn < fb->sqn ? -1 : 1;
+	}
+	return fa->seq < fb->seq ? -1 : (fa->seq > fb->seq);
+}
+
+
+/**
+ * \brief Merges the fragments collected by sequence number and queues 
+ * those up to the pass watermark for the sender thread. Waits while the
+ * standby lags by more than log_ship_buffer_mb.
+ */
+void
+m_logship_pass_end(void)
+{
+	logship_frag_t *list = NULL;
+	logship_frag_t **tail = &list;
+	uint64_t       bytes = 0;
+	int            i;
+	int            k;
+
+	if (!m_logship_enabled) {
+		for (i = 0; i < nheld; i++) {
+			free(held[i]);
+		}
+		nheld = 0;
+		return;
+	}
+	if (nheld == 0) {
+		return;
+	}
+	qsort(held, nheld, sizeof(logship_frag_t *), frag_compare);
+	for (k = 0; k < nheld && held[k]->sqn <= pass_watermark; k++) {
+		*tail = held[k];
+		tail = &held[k]->next;
+		bytes += LOGSHIP_FRAG_BYTES(held[k]);
+	}
+	*tail = NULL;
+	memmove(held, &held[k], (nheld - k) * sizeof(logship_frag_t *));
+	nheld -= k;
+	if (list == NULL) {
+		return;
+	}
+
+	pthread_mutex_lock(&queue_mutex);
+	while (m_logship_enabled && queue_bytes > 0 && queue_bytes + bytes > queue_limit) {
+		pthread_cond_wait(&space_cond, &queue_mutex);
+	}
+	*queue_tail = list;
+	queue_tail = tail;
+	queue_bytes += bytes;
+	if (!m_logship_enabled) {
+		/* The sender is gone */
+		free_frags(queue_head);
+		queue_head = NULL;
+		queue_tail = &queue_head;
+	}
+	pthread_cond_signal(&queue_cond);
+	pthread_mutex_unlock(&queue_mutex);
+}
+
+
+static
+void *
+logship_sender(void *arg)
+{
+	int            fd = (int) (long) arg;
+	logship_frag_t *batch;
+	logship_frag_t *f;
+	pcm_word_t     frame[2];
+	uint64_t       ack;
+
+	while (1) {
+		pthread_mutex_lock(&queue_mutex);
+		while (queue_head == NULL) {
+			pthread_cond_wait(&queue_cond, &queue_mutex);
+		}
+		batch = queue_head;
+		queue_head = NULL;
+		queue_tail = &queue_head;
+		pthread_mutex_unlock(&queue_mutex);
+
+		for (f = batch; f; f = f->next) {
+			frame[0] = f->sqn;
+			frame[1] = f->nwords;
+			if (write_all(fd, frame, sizeof(frame)) != 0 ||
+			    write_all(fd, f->words, f->nwords * sizeof(pcm_word_t)) != 0)
+			{
+				goto fail;
+			}
+		}
+		frame[1] = LOGSHIP_BATCH_END;
+		if (write_all(fd, frame, sizeof(frame)) != 0 ||
+		    read_all(fd, &ack, sizeof(ack)) != 0)
+		{
+			goto fail;
+		}
+		replicated_sqn = ack;
+
+		pthread_mutex_lock(&queue_mutex);
+		free_frags(batch);
+		pthread_mutex_unlock(&queue_mutex);
+	}
+
+fail:
+	fprintf(stderr, "Error: lost the log shipping standby; it must be seeded again\n");
+	close(fd);
+	pthread_mutex_lock(&queue_mutex);
+	m_logship_enabled = 0;
+	free_frags(batch);
+	free_frags(queue_head);
+	queue_head = NULL;
+	queue_tail = &queue_head;
+	pthread_mutex_unlock(&queue_mutex);
+	return 0;
+}
+
+
+static
+void
+sync_fail(void)
+{
+	pthread_mutex_lock(&sync_ack_mutex);
+	if (m_logship_sync_enabled) {
+		fprintf(stderr, "Error: lost the log shipping standby; it must be seeded again\n");
+		m_logship_sync_enabled = 0;
+		shutdown(sync_fd, SHUT_RDWR);
+	}
+	pthread_cond_broadcast(&sync_ack_cond);
+	pthread_mutex_unlock(&sync_ack_mutex);
+}
+
+
+/**
+ * \brief Sends the fragment a transaction wrote to the stream s, as a 
+ * batch of its own committed with sequence number sqn, and empties the 
+ * stream. Returns the ticket to pass to m_logship_sync_wait, 0 if there 
+ * was nothing to send.
+ */
+uint64_t
+m_logship_sync_send(m_logship_stream_t *s, uint64_t sqn)
+{
+	pcm_word_t frame[2];
+	uint64_t   ticket;
+
+	if (!m_logship_sync_enabled || s->frag_start == INV_LOG_ORDER) {
+		s->nwords = 0;
+		s->frag_start = INV_LOG_ORDER;
+		return 0;
+	}
+	m_logship_stream_commit(s, sqn);
+	frame[0] = sqn;
+	frame[1] = LOGSHIP_BATCH_END;
+	pthread_mutex_lock(&sync_send_mutex);
+	if (write_all(sync_fd, s->words, s->nwords * sizeof(pcm_word_t)) != 0 ||
+	    write_all(sync_fd, frame, sizeof(frame)) != 0)
+	{
+		pthread_mutex_unlock(&sync_send_mutex);
+		sync_fail();
+		ticket = 0;
+	} else {
+		ticket = ++sync_sent;
+		pthread_mutex_unlock(&sync_send_mutex);
+	}
+	s->nwords = 0;
+	return ticket;
+}
+
+
+/**
+ * \brief Waits until the standby has made the batch of ticket durable, or
+ * shipping has failed.
+ */
+void
+m_logship_sync_wait(uint64_t ticket)
+{
+	if (ticket == 0 || sync_acked >= ticket) {
+		return;
+	}
+	pthread_mutex_lock(&sync_ack_mutex);
+	while (m_logship_sync_enabled && sync_acked < ticket) {
+		pthread_cond_wait(&sync_ack_cond, &sync_ack_mutex);
+	}
+	pthread_mutex_unlock(&sync_ack_mutex);
+}
+
+
+/* The standby acknowledges batches in the order they were sent */
+static
+void *
+logship_sync_receiver(void *arg)
+{
+	uint64_t ack;
+
+	while (read_all(sync_fd, &ack, sizeof(ack)) == 0) {
+		pthread_mutex_lock(&sync_ack_mutex);
+		if (ack > replicated_sqn) {
+			replicated_sqn = ack;
+		}
+		sync_acked++;
+		pthread_cond_broadcast(&sync_ack_cond);
+		pthread_mutex_unlock(&sync_ack_mutex);
+	}
+	sync_fail();
+	return 0;
+}
+
+
+/* Applies the records of a fragment received by the standby */
+static
+void
+apply_fragment(pcm_storeset_t *set, pcm_word_t *words, uint64_t nwords)
+{
+	uint64_t i;
+
+	for (i = 0; i < nwords; ) {
+		if (i + 3 > nwords) {
+			M_INTERNALERROR("Malformed log shipping fragment.\n");
+		}
+		if (words[i] == LOGSHIP_LOGICAL) {
+			if (words[i + 2] > (nwords - i - 3) * sizeof(pcm_word_t)) {
+				M_INTERNALERROR("Malformed log shipping fragment.\n");
+			}
+			m_logrecovery_logical(set, (unsigned int) words[i + 1], &words[i + 3], words[i + 2]);
+			i += 3 + (words[i + 2] + sizeof(pcm_word_t) - 1) / sizeof(pcm_word_t);
+		} else {
+			m_logrecovery_store(set, (uintptr_t) words[i], words[i + 1], words[i + 2]);
+			i += 3;
+		}
+	}
+}
+
+
+static
+void *
+logship_standby(void *arg)
+{
+	int            lfd = (int) (long) arg;
+	int            fd;
+	int            open;
+	pcm_storeset_t *set;
+	pcm_word_t     frame[2];
+	pcm_word_t     *words = NULL;
+	uint64_t       maxwords = 0;
+
+	set = pcm_storeset_get();
+	while (1) {
+		if ((fd = accept(lfd, NULL, NULL)) < 0) {
+			continue;
+		}
+		open = 0;
+		while (read_all(fd, frame, sizeof(frame)) == 0) {
+			if (frame[1] == LOGSHIP_BATCH_END) {
+				if (open) {
+					m_logrecovery_end(set);
+					open = 0;
+				}
+				replicated_sqn = frame[0];
+				if (write_all(fd, &frame[0], sizeof(frame[0])) != 0) {
+					break;
+				}
+				continue;
+			}
+			if (frame[1] > maxwords) {
+				maxwords = frame[1];
+				if (!(words = (pcm_word_t *) realloc(words, maxwords * sizeof(pcm_word_t)))) {
+					M_INTERNALERROR("Could not allocate log shipping fragment.\n");
+				}
+			}
+			if (read_all(fd, words, frame[1] * sizeof(pcm_word_t)) != 0) {
+				break;
+			}
+			if (!open) {
+				m_logrecovery_begin();
+				open = 1;
+			}
+			/* Fragments arrive whole and in commit order: the applied ones are a prefix */
+			apply_fragment(set, words, frame[1]);
+		}
+		if (open) {
+			m_logrecovery_end(set);
+		}
+		close(fd);
+	}
+
+	return 0;
+}
+
+
+static
+int
+connect_target(const char *target)
+{
+	struct addrinfo hints;
+	struct addrinfo *res;
+	struct addrinfo *ai;
+	char            host[256];
+	const char      *port;
+	int             fd = -1;
+	int             one = 1;
+
+	if (!(port = strrchr(target, ':')) || port - target >= (long) sizeof(host)) {
+		return -1;
+	}
+	memcpy(host, target, port - target);
+	host[port - target] = '\0';
+	port++;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(host, port, &hints, &res) != 0) {
+		return -1;
+	}
+	for (ai = res; ai; ai = ai->ai_next) {
+		if ((fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) < 0) {
+			continue;
+		}
+		if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+			break;
+		}
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(res);
+	if (fd >= 0) {
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	}
+	return fd;
+}
+
+
+static
+int
+listen_port(int port)
+{
+	struct sockaddr_in addr;
+	int                fd;
+	int                one = 1;
+
+	if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+		return -1;
+	}
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(port);
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(fd, 1) != 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+
+/**
+ * \brief Starts shipping the logs to log_ship_target, or applying the 
+ * logs shipped to log_ship_listen_port, as configured. Must be called 
+ * once the logs are recovered.
+ *
+ * \param watermark returns a sequence number such that every commit up to
+ *  it is durable, or NULL to ship all fragments a pass reads.
+ */
+m_result_t
+m_logship_init(uint64_t (*watermark)(void))
+{
+	pthread_t thread;
+	int       fd;
+
+	if (mcore_runtime_settings.log_ship_listen_port > 0) {
+		if ((fd = listen_port(mcore_runtime_settings.log_ship_listen_port)) < 0) {
+			fprintf(stderr, "Error: cannot listen for shipped logs on port %d\n", 
+			        mcore_runtime_settings.log_ship_listen_port);
+			return M_R_FAILURE;
+		}
+		pthread_create(&thread, NULL, &logship_standby, (void *) (long) fd);
+	}
+	if (mcore_runtime_settings.log_ship_target[0] != '\0') {
+		if ((fd = connect_target(mcore_runtime_settings.log_ship_target)) < 0) {
+			fprintf(stderr, "Error: cannot connect to the log shipping standby %s\n", 
+			        mcore_runtime_settings.log_ship_target);
+			return M_R_FAILURE;
+		}
+		if (mcore_runtime_settings.log_ship_sync) {
+			sync_fd = fd;
+			m_logship_sync_enabled = 1;
+			pthread_create(&thread, NULL, &logship_sync_receiver, NULL);
+		} else {
+			logship_watermark = watermark;
+			queue_limit = (uint64_t) mcore_runtime_settings.log_ship_buffer_mb << 20;
+			m_logship_enabled = 1;
+			pthread_create(&thread, NULL, &logship_sender, (void *) (long) fd);
+		}
+	}
+	return M_R_SUCCESS;
+}
+
+
+uint64_t
+m_logship_replicated_sqn(void)
+{
+	return replicated_sqn;
+}
@@ -39,87 +39,417 @@
 #include <pthread.h>
 #include <sys/time.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <assert.h>
 #include <time.h>
 #include <sched.h>
+#include <unistd.h>
+#include "config.h"
 #include "log_i.h"
 #include "logtrunc.h"
+#include "logship.h"
 #include "hal/pcm_i.h"
 #include "phlog_tornbit.h"
 
-static m_logmgr_t *logmgr;
+/* A log taking part in a truncation pass. */
+typedef struct logtrunc_slot_s {
+	m_log_dsc_t       *log_dsc;
+} logtrunc_slot_t;
+
+/*
+ * Truncation worker pool. The truncation thread hands each pass to the 
+ * pool_size - 1 other workers as well, through the start and done barriers.
+ * Worker i truncates the logs in slots i, i + pool_size, ...
+ */
+typedef struct logtrunc_pool_s {
+	int               pool_size;
+	pthread_barrier_t start;
+	pthread_barrier_t done;
+	logtrunc_slot_t   *slots;
+	int               nslots;
+	int               maxslots;
+} logtrunc_pool_t;
+
+/*
+ * Binary min-heap of a worker's logs keyed by log_dsc->logorder, giving the
+ * next log to truncate in O(log n). Logs with no fragment left 
+ * (INV_LOG_ORDER) are not kept in the heap.
+ */
+typedef struct logtrunc_heap_s {
+	logtrunc_slot_t   **slots;
+	int               nslots;
+	int               maxslots;
+} logtrunc_heap_t;
+
+static m_logmgr_t      *logmgr;
+static logtrunc_pool_t pool = { 1 };
+static logtrunc_heap_t heap;
+
+/* High watermark checked by PHLOG_BACKPRESSURE; never reached until init */
+uint64_t               m_logtrunc_high_watermark = 100;
+
+/* 
+ * Pacing (log_truncation_bandwidth_mb). pace_rate is each worker's share of
+ * the bandwidth in the current pass, in bytes per second, or 0 if the pass 
+ * is not paced. A pass stops pacing itself while a thread waits on a full 
+ * log (stalled) or once one found its log past the high watermark 
+ * (hurried).
+ */
+static uint64_t        pace_rate;
+static volatile int    stalled;
+static volatile int    hurried;
+
+/* Moving average of the commit log flushes, see m_logtrunc_flush_sample_begin */
+int                    m_logtrunc_flush_sampled;
+volatile uint64_t      m_logtrunc_flush_cycles;
+__thread unsigned int  m_logtrunc_flush_count;
 
 static void *log_truncation_main (void *arg);
+static void *log_truncation_worker (void *arg);
 
 m_result_t
 m_logtrunc_init(m_logmgr_t *mgr)
 {
 	logmgr = mgr;
 	pthread_cond_init(&(logmgr->logtrunc_cond), NULL);
-	//FIXME: Don't create asynchronous trunc thread when doing synchronous truncations
-	//FIXME: SYNC_TRUNCATION preprocessor flag is not passed here
-#ifndef SYNC_TRUNCATION
-	pthread_create (&(logmgr->logtrunc_thread), NULL, &log_truncation_main, (void *) 0);
-#endif
+	pthread_cond_init(&(logmgr->logtrunc_done_cond), NULL);
+	logmgr->logtrunc_started = 0;
+	logmgr->trunc_count = 0;
+	logmgr->trunc_requested = 0;
+	m_logtrunc_high_watermark = mcore_runtime_settings.log_truncation_high_watermark;
+	m_logtrunc_flush_sampled = mcore_runtime_settings.log_truncation_bandwidth_mb > 0 &&
+	                           mcore_runtime_settings.log_truncation_flush_latency_ns > 0;
 	return M_R_SUCCESS;
 }
 
+
+/**
+ * \brief Starts the truncation threads unless already running.
+ *
+ * Called with the log manager lock held when the first log truncated 
+ * asynchronously is allocated, so that with synchronous truncation no 
+ * truncation thread exists.
+ */
+void
+m_logtrunc_start(void)
+{
+	pthread_t thread;
+	long      i;
+
+	if (logmgr->logtrunc_started) {
+		return;
+	}
+	logmgr->logtrunc_started = 1;
+	pool.pool_size = mcore_runtime_settings.log_truncation_threads;
+	if (pool.pool_size > 1) {
+		pthread_barrier_init(&pool.start, NULL, pool.pool_size);
+		pthread_barrier_init(&pool.done, NULL, pool.pool_size);
+		for (i = 1; i < pool.pool_size; i++) {
+			pthread_create (&thread, NULL, &log_truncation_worker, (void *) i);
+		}
+	}
+	pthread_create (&(logmgr->logtrunc_thread), NULL, &log_truncation_main, (void *) 0);
+}
+
+
+/*
+ * Pins truncation worker i. Workers go to consecutive CPUs starting at 
+ * log_truncation_cpu or, if log_truncation_node is set, to the CPUs of 
+ * that NUMA node, which should be the node of the persistent memory.
+ */
+static
+void
+pin_worker(long worker)
+{
+	cpu_set_t cpu_set;
+	int       cpus[CPU_SETSIZE];
+	int       ncpus = 0;
+	int       first;
+	int       last;
+	int       c;
+	char      path[64];
+	FILE      *fp;
+
+	if (mcore_runtime_settings.log_truncation_node >= 0) {
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", 
+		         mcore_runtime_settings.log_truncation_node);
+		if ((fp = fopen(path, "r")) != NULL) {
+			/* A list of ranges, such as 0-11,24-35 */
+			while (ncpus < CPU_SETSIZE && fscanf(fp, "%d", &first) == 1) {
+				last = first;
+				if ((c = fgetc(fp)) == '-') {
+					if (fscanf(fp, "%d", &last) != 1) {
+						break;
+					}
+					c = fgetc(fp);
+				}
+				for (; first <= last && ncpus < CPU_SETSIZE; first++) {
+					cpus[ncpus++] = first;
+				}
+				if (c != ',') {
+					break;
+				}
+			}
+			fclose(fp);
+		}
+		if (ncpus == 0) {
+			M_WARNING("Unknown NUMA node %d, log truncation threads are not pinned.\n",
+			          mcore_runtime_settings.log_truncation_node);
+			return;
+		}
+		c = cpus[worker % ncpus];
+	} else {
+		ncpus = sysconf(_SC_NPROCESSORS_CONF);
+		c = (mcore_runtime_settings.log_truncation_cpu + worker) % (ncpus > 0 ? ncpus : 1);
+	}
+	CPU_ZERO(&cpu_set);
+	CPU_SET(c, &cpu_set);
+	sched_setaffinity(0, sizeof(cpu_set), &cpu_set);
+}
+
+
+#define HEAP_ORDER(h, i) ((h)->slots[(i)]->log_dsc->logorder)
+
+static
+void
+heap_sift_down(logtrunc_heap_t *h, int i)
+{
+	logtrunc_slot_t *slot = h->slots[i];
+	int             child;
+
+	while ((child = 2 * i + 1) < h->nslots) {
+		if (child + 1 < h->nslots && HEAP_ORDER(h, child + 1) < HEAP_ORDER(h, child)) {
+			child++;
+		}
+		if (HEAP_ORDER(h, child) >= slot->log_dsc->logorder) {
+			break;
+		}
+		h->slots[i] = h->slots[child];
+		i = child;
+	}
+	h->slots[i] = slot;
+}
+
+
+static
+void
+heap_push(logtrunc_heap_t *h, logtrunc_slot_t *slot)
+{
+	int i;
+	int parent;
+
+	if (slot->log_dsc->logorder == INV_LOG_ORDER) {
+		return;
+	}
+	if (h->nslots == h->maxslots) {
+		h->maxslots = h->maxslots ? 2 * h->maxslots : 32;
+		h->slots = (logtrunc_slot_t **) realloc(h->slots, h->maxslots * sizeof(logtrunc_slot_t *));
+		assert(h->slots);
+	}
+	for (i = h->nslots++; i > 0; i = parent) {
+		parent = (i - 1) / 2;
+		if (HEAP_ORDER(h, parent) <= slot->log_dsc->logorder) {
+			break;
+		}
+		h->slots[i] = h->slots[parent];
+	}
+	h->slots[i] = slot;
+}
+
+
+/* Restores the heap after the order of its top log has changed. */
+static
+void
+heap_update_top(logtrunc_heap_t *h)
+{
+	if (HEAP_ORDER(h, 0) == INV_LOG_ORDER) {
+		h->slots[0] = h->slots[--h->nslots];
+		if (h->nslots == 0) {
+			return;
+		}
+	}
+	heap_sift_down(h, 0);
+}
+
+
+/*
+ * Bandwidth of a worker in the pass about to start: log_truncation_bandwidth_mb
+ * split among the workers, and scaled down by as much as the commit flushes
+ * take longer than log_truncation_flush_latency_ns, to 1/8 at most.
+ */
+static
+uint64_t
+pace_rate_get(void)
+{
+	uint64_t rate = (uint64_t) mcore_runtime_settings.log_truncation_bandwidth_mb << 20;
+	uint64_t target = mcore_runtime_settings.log_truncation_flush_latency_ns;
+	uint64_t latency;
+
+	if (rate == 0) {
+		return 0;
+	}
+	if (target > 0) {
+		latency = HRTIME_CYCLE2NS(m_logtrunc_flush_cycles);
+		if (latency > target) {
+			rate = latency < 8 * target ? rate * target / latency : rate / 8;
+		}
+	}
+	return rate / pool.pool_size;
+}
+
+
+/*
+ * Holds a worker back until the bytes of log it truncated in the pass so far
+ * fit its share of the bandwidth. Sleeps in slices of at most a millisecond
+ * so that a stall on a full log is noticed.
+ */
+static
+void
+pace(hrtime_t start, uint64_t bytes)
+{
+	uint64_t        due_ns;
+	uint64_t        elapsed_ns;
+	struct timespec ts;
+
+	if (pace_rate == 0) {
+		return;
+	}
+	due_ns = bytes * 1000000000ULL / pace_rate;
+	while (!stalled && !hurried) {
+		elapsed_ns = HRTIME_CYCLE2NS(hrtime_cycles() - start);
+		if (elapsed_ns >= due_ns) {
+			break;
+		}
+		ts.tv_sec = 0;
+		ts.tv_nsec = due_ns - elapsed_ns < 1000000 ? due_ns - elapsed_ns : 1000000;
+		nanosleep(&ts, NULL);
+	}
+}
+
+
+/*
+ * A worker's share of a truncation pass. Each worker prepares and truncates 
+ * its own logs, so with a pool the logs' fragments are read and their cache 
+ * blocks flushed in parallel. No log head moves during the pass: the heads
+ * are published together through a truncation checkpoint once every worker
+ * has made its flushes durable (see truncate_logs), so the workers need not
+ * agree on an order across logs.
+ */
+static
+void
+truncate_logs_worker(pcm_storeset_t *set, long worker, logtrunc_heap_t *own)
+{
+	logtrunc_slot_t *slot;
+	logtrunc_slot_t *oldest;
+	int             i;
+	hrtime_t        start = hrtime_cycles();
+	uint64_t        words = 0;
+	uint64_t        before;
+
+	/* 
+	 * First prepare each log for truncation.
+	 * A log might then pass back a log truncation order number if it cares about 
+	 * the order the truncation is performed with respect to other logs.
+	 */
+	own->nslots = 0;
+	for (i = worker; i < pool.nslots; i += pool.pool_size) {
+		slot = &pool.slots[i];
+		slot->log_dsc->trunc_words = 0;
+		slot->log_dsc->ops->truncation_init(set, slot->log_dsc);
+		heap_push(own, slot);
+	}
+	/* 
+	 * Truncate the log with the oldest fragment, update its truncation 
+	 * order, and repeat until there are no more logs to truncate. The 
+	 * truncation is paced by the fragment, before the flushes of the next.
+	 *
+	 * TODO: This process should be performed per log type to allow coexistence 
+	 *       of logs of different types
+	 */
+	while (own->nslots > 0) {
+		oldest = own->slots[0];
+		before = oldest->log_dsc->trunc_words;
+		oldest->log_dsc->ops->truncation_do(set, oldest->log_dsc);
+		words += oldest->log_dsc->trunc_words - before;
+		pace(start, words * sizeof(pcm_word_t));
+		oldest->log_dsc->ops->truncation_prepare_next(set, oldest->log_dsc);
+		heap_update_top(own);
+	}
+	PCM_PERSIST_BARRIER(set);
+}
+
+
 static 
 m_result_t
 truncate_logs (pcm_storeset_t *set, int lock)
 {
 	m_log_dsc_t       *log_dsc;
-	m_log_dsc_t       *log_dsc_to_truncate;
+	int               i;
 
 	if (lock) {
 		pthread_mutex_lock(&(logmgr->mutex));
 	}	
 
-	/* 
-	 * First prepare each log for truncation.
-	 * A log might then pass back a log truncation order number if it cares about 
-	 * the order the truncation is performed with respect to other logs.
-	 */
+	pool.nslots = 0;
 	list_for_each_entry(log_dsc, &(logmgr->active_logs_list), list) {
-		if (log_dsc->flags & LF_ASYNC_TRUNCATION) {
-			assert(log_dsc->ops);
-			assert(log_dsc->ops->truncation_init);
-			log_dsc->ops->truncation_init(set, log_dsc);
+		if (!(log_dsc->flags & LF_ASYNC_TRUNCATION)) {
+			continue;
 		}
+		if (pool.nslots == pool.maxslots) {
+			pool.maxslots = pool.maxslots ? 2 * pool.maxslots : 32;
+			pool.slots = (logtrunc_slot_t *) realloc(pool.slots, pool.maxslots * sizeof(logtrunc_slot_t));
+			assert(pool.slots);
+		}
+		assert(log_dsc->ops);
+		assert(log_dsc->ops->truncation_init);
+		assert(log_dsc->ops->truncation_do);
+		assert(log_dsc->ops->truncation_prepare_next);
+		assert(log_dsc->ops->truncation_publish);
+		pool.slots[pool.nslots].log_dsc = log_dsc;
+		pool.nslots++;
+	}
+	m_logship_pass_begin();
+	pace_rate = pace_rate_get();
+	if (pool.pool_size > 1) {
+		pthread_barrier_wait(&pool.start);
+		truncate_logs_worker(set, 0, &heap);
+		pthread_barrier_wait(&pool.done);
+	} else {
+		truncate_logs_worker(set, 0, &heap);
 	}
+
 	/* 
-	 * Find the next log to truncate, truncate it, update its truncation 
-	 * order, and repeat until there are no more logs to truncate.
-	 *
-	 * TODO: This process can be made more efficient.
-	 * TODO: This process should be performed per log type to allow coexistence 
-	 *       of logs of different types
+	 * Checkpoint the new truncation points. Recovery starts from them even
+	 * if the heads published below do not all make it to memory.
 	 */
-	do {
-		log_dsc_to_truncate = NULL; 
-		list_for_each_entry(log_dsc, &(logmgr->active_logs_list), list) {
-			if (!(log_dsc->flags & LF_ASYNC_TRUNCATION)) {
-				continue;
-			}
-			if (log_dsc->logorder == INV_LOG_ORDER) {
-				continue;
-			}
-			if (log_dsc_to_truncate == NULL) {
-				log_dsc_to_truncate = log_dsc;
-			} else {
-				if (log_dsc_to_truncate->logorder > log_dsc->logorder) {
-					log_dsc_to_truncate = log_dsc;
-				}
-			}
+	m_logmgr_checkpoint_begin(set);
+	for (i = 0; i < pool.nslots; i++) {
+		if (pool.slots[i].log_dsc->trunc_point != INV_LOG_ORDER) {
+			m_logmgr_checkpoint_add(set, pool.slots[i].log_dsc);
 		}
-		if (log_dsc_to_truncate) {
-			assert(log_dsc_to_truncate->ops);
-			assert(log_dsc_to_truncate->ops->truncation_do);
-			assert(log_dsc_to_truncate->ops->truncation_prepare_next);
-			log_dsc_to_truncate->ops->truncation_do(set, log_dsc_to_truncate);
-			log_dsc_to_truncate->ops->truncation_prepare_next(set, log_dsc_to_truncate);
-		}	
-	} while(log_dsc_to_truncate);
+	}
+	m_logmgr_checkpoint_commit(set);
+	for (i = 0; i < pool.nslots; i++) {
+		log_dsc = pool.slots[i].log_dsc;
+		log_dsc->ops->truncation_publish(set, log_dsc);
+	}
+
+	/* Ship the fragments the pass read, now that it is done with them */
+	for (i = 0; i < pool.nslots; i++) {
+		m_logship_collect(pool.slots[i].log_dsc);
+	}
+	m_logship_pass_end();
+	hurried = 0;
+
+	/* Released logs have nothing left to truncate now and can be reused */
+	for (i = 0; i < pool.nslots; i++) {
+		log_dsc = pool.slots[i].log_dsc;
+		if (log_dsc->flags & LF_RETIRED) {
+			log_dsc->flags = 0;
+			list_del_init(&(log_dsc->list));
+			list_add_tail(&(log_dsc->list), &(logmgr->free_logs_list));
+		}
+	}
 
 	if (lock) {
 		pthread_mutex_unlock(&(logmgr->mutex));
@@ -129,6 +459,30 @@ truncate_logs (pcm_storeset_t *set, int lock)
 }
 
 
+/**
+ * \brief Routine executed by the other workers of the truncation pool.
+ */
+static
+void *
+log_truncation_worker (void *arg)
+{
+	long            worker = (long) arg;
+	pcm_storeset_t  *set;
+	logtrunc_heap_t own = { NULL, 0, 0 };
+
+	set = pcm_storeset_get();
+	pin_worker(worker);
+
+	while (1) {
+		pthread_barrier_wait(&pool.start);
+		truncate_logs_worker(set, worker, &own);
+		pthread_barrier_wait(&pool.done);
+	}
+
+	return 0;
+}
+
+
 /**
  * \brief Routine executed by the log truncation thread to truncate log
  * in the background.
@@ -146,11 +500,7 @@ log_truncation_main (void *arg)
 
 	set = pcm_storeset_get();
 
-	cpu_set_t          cpu_set;
-
-	CPU_ZERO(&cpu_set);
-	CPU_SET(1 % 4, &cpu_set);
-	sched_setaffinity(0, 4, &cpu_set);
+	pin_worker(0);
 
 
 /*
@@ -160,27 +510,37 @@ log_truncation_main (void *arg)
  */
 
 	/* reset trunc statistics */
-	logmgr->trunc_count=0;									 
 	logmgr->trunc_time = 0;									 
 #if 1
 	pthread_mutex_lock(&(logmgr->mutex));
 
 	while (1) {
-		gettimeofday(&tp, NULL);
-		ts.tv_sec = tp.tv_sec;
-		ts.tv_nsec = tp.tv_usec * 1000; 
-		ts.tv_sec += 10; // sleep time 
-		pthread_cond_timedwait(&logmgr->logtrunc_cond, &logmgr->mutex, &ts);
-		//pthread_mutex_unlock(&(logmgr->mutex));
-		//pthread_mutex_lock(&(logmgr->mutex));
+		/* 
+		 * Sleep for a truncation period unless a pass is already asked for;
+		 * a signal cuts the period short.
+		 */
+		if (logmgr->trunc_requested <= logmgr->trunc_count) {
+			gettimeofday(&tp, NULL);
+			ts.tv_sec = tp.tv_sec + mcore_runtime_settings.log_truncation_period_ms / 1000;
+			ts.tv_nsec = tp.tv_usec * 1000 + 
+			             (mcore_runtime_settings.log_truncation_period_ms % 1000) * 1000000;
+			if (ts.tv_nsec >= 1000000000) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000;
+			}
+			pthread_cond_timedwait(&logmgr->logtrunc_cond, &logmgr->mutex, &ts);
+		}
 
+		M_PROBE(trunc__pass__begin);
 		gettimeofday(&start_time, NULL);
 		truncate_logs(set, 0);
 		gettimeofday(&stop_time, NULL);
 		measured_time = 1000000 * (stop_time.tv_sec - start_time.tv_sec) +
 		                                     stop_time.tv_usec - start_time.tv_usec;
+		M_PROBE1(trunc__pass__end, measured_time);
 		logmgr->trunc_count++;									 
 		logmgr->trunc_time += measured_time;									 
+		pthread_cond_broadcast(&logmgr->logtrunc_done_cond);
 	}	
 
 	pthread_mutex_unlock(&(logmgr->mutex));
@@ -209,6 +569,38 @@ m_logtrunc_truncate(pcm_storeset_t *set)
 }
 
 
+/**
+ * \brief Waits until the logs truncated asynchronously hold no fragment 
+ * committed before the call.
+ *
+ * Runs a whole truncation pass that starts after the call, so the stores 
+ * of the transactions committed so far have reached their home locations
+ * in persistent memory when it returns.
+ */
+m_result_t
+m_logtrunc_sync()
+{
+	uint64_t target;
+
+	pthread_mutex_lock(&(logmgr->mutex));
+	if (logmgr->logtrunc_started) {
+		/* No pass runs while we hold the lock, so the next one starts later */
+		target = logmgr->trunc_count + 1;
+		hurried = 1;
+		if (logmgr->trunc_requested < target) {
+			logmgr->trunc_requested = target;
+		}
+		pthread_cond_signal(&logmgr->logtrunc_cond);
+		while (logmgr->trunc_count < target) {
+			pthread_cond_wait(&logmgr->logtrunc_done_cond, &logmgr->mutex);
+		}
+	}
+	pthread_mutex_unlock(&(logmgr->mutex));
+
+	return M_R_SUCCESS;
+}
+
+
 m_result_t
 m_logtrunc_signal()
 {
@@ -216,3 +608,54 @@ m_logtrunc_signal()
 	// the async trunc thread was already truncating the log 
 	pthread_cond_signal(&logmgr->logtrunc_cond);
 }
+
+
+/**
+ * \brief Brackets the wait of a thread on its full log, during which the 
+ * truncation runs at full speed.
+ */
+void
+m_logtrunc_stall_begin(void)
+{
+	__sync_fetch_and_add(&stalled, 1);
+	m_logtrunc_signal();
+}
+
+
+void
+m_logtrunc_stall_end(void)
+{
+	__sync_fetch_and_sub(&stalled, 1);
+}
+
+
+/**
+ * \brief Applies backpressure to a thread whose log, truncated 
+ * asynchronously, is past the high watermark.
+ *
+ * Wakes up the truncation threads, lifting the pacing of their pass, and, 
+ * if the log is past the critical watermark too, waits until the truncation
+ * moves the head back under it or log_truncation_throttle_us expires. The tail is the caller's own and 
+ * does not move meanwhile.
+ */
+void
+m_logtrunc_backpressure(volatile uint64_t *head, uint64_t tail, uint64_t mask)
+{
+	uint64_t critical = mcore_runtime_settings.log_truncation_critical_watermark * (mask + 1);
+	uint64_t limit = (uint64_t) mcore_runtime_settings.log_truncation_throttle_us * 1000;
+	hrtime_t start;
+	m_spinwait_t w;
+
+	hurried = 1;
+	m_logtrunc_signal();
+	if (((tail - *head) & mask) * 100 < critical || limit == 0) {
+		return;
+	}
+	start = hrtime_cycles();
+	m_spinwait_init(&w, head);
+	do {
+		m_spinwait_pause(&w);
+	} while (((tail - *head) & mask) * 100 >= critical &&
+	         HRTIME_CYCLE2NS(hrtime_cycles() - start) < limit);
+	m_spinwait_done(&w);
+}
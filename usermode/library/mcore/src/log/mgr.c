@@ -44,16 +44,29 @@
 #include <result.h>
 #include <debug.h>
 #include <list.h>
+#include <mnemosyne.h>
+#include "config.h"
 #include "log_i.h"
 #include "logtrunc.h"
+#include "logrecovery.h"
+#include "groupcommit.h"
 #include "staticlogs.h"
 #include "../segment.h"
 #include "../pregionlayout.h"
 #include "phlog_tornbit.h"
 
 __attribute__ ((section("PERSISTENT"))) pcm_word_t log_pool = 0x0;
+__attribute__ ((section("PERSISTENT"))) pcm_word_t log_pool_nlogs = 0x0;    /**< logs mapped so far */
+__attribute__ ((section("PERSISTENT"))) pcm_word_t log_pool_log_size = 0x0; /**< physical log size the pool was created with */
 
-#define LOG_NUM 32
+/*
+ * Truncation checkpoint: entry i holds the truncation point of log i as of 
+ * the last checkpoint (see m_logmgr_checkpoint_commit). There are two copies
+ * and log_pool_checkpoint_cur selects the valid one, so that publishing a 
+ * checkpoint takes a single atomic store.
+ */
+__attribute__ ((section("PERSISTENT"))) pcm_word_t log_pool_checkpoint_cur = 0x0;
+__attribute__ ((section("PERSISTENT"))) pcm_word_t log_pool_checkpoint[2][LOG_POOL_MAX_LOGS] = { { 0 } };
 
 
 typedef struct m_logtype_entry_s m_logtype_entry_t;
@@ -85,26 +98,222 @@ static m_result_t register_static_logtypes(m_logmgr_t *mgr);
 static m_result_t do_recovery(pcm_storeset_t *set, m_logmgr_t *mgr);
 
 
+/* Log pool layout */
+static uintptr_t log_pool_logs_start;
+static int       log_pool_physical_log_size;
+static int       log_pool_max_logs;
+static int       log_pool_size_log2;        /**< size new logs are formatted with */
+
+/* Set by benchmarks measuring the cost of the log fences, see PHLOG_PERSIST_BARRIER */
+int m_log_unsafe_nobarrier = 0;
+
+
+/**
+ * \brief Creates the volatile descriptors of logs [first, first + n) of the
+ * log pool.
+ */
+static
+m_result_t
+add_log_dscs(m_logmgr_t *mgr, int first, int n, int node)
+{
+	m_log_dsc_t      *log_dscs;
+	int              i;
+
+	if (!(log_dscs = (m_log_dsc_t *) calloc(n, sizeof(m_log_dsc_t)))) {
+		return M_R_NOMEMORY;
+	}
+	for (i=0; i<n; i++) {
+		log_dscs[i].nvmd = (m_log_nvmd_t *) (LOG_POOL_START + 
+		                                        sizeof(m_log_nvmd_t)*(first+i));
+		log_dscs[i].nvphlog = (pcm_word_t *) (log_pool_logs_start + 
+		                                         log_pool_physical_log_size*(first+i));
+		log_dscs[i].log = NULL;
+		log_dscs[i].ops = NULL;
+		log_dscs[i].logorder = INV_LOG_ORDER;
+		log_dscs[i].trunc_point = INV_LOG_ORDER;
+		log_dscs[i].node = node;
+		log_dscs[i].ship = NULL;
+		if ((log_dscs[i].nvmd->generic_flags & LF_TYPE_MASK) == 
+		    LF_TYPE_FREE) 
+		{
+			list_add_tail(&(log_dscs[i].list), &(mgr->free_logs_list));
+		} else {
+			list_add_tail(&(log_dscs[i].list), &(mgr->pending_logs_list));
+		}
+	}
+
+	return M_R_SUCCESS;
+}
+
+
+/* Index of a log in the log pool */
+static inline
+int
+log_index(m_log_dsc_t *log_dsc)
+{
+	return (int) (((uintptr_t) log_dsc->nvmd - LOG_POOL_START) / sizeof(m_log_nvmd_t));
+}
+
+
+/**
+ * \brief Starts a truncation checkpoint: the spare copy of the checkpoint
+ * is brought up to date with the current one.
+ *
+ * Checkpoints are taken with the log manager's mutex held.
+ */
+void
+m_logmgr_checkpoint_begin(pcm_storeset_t *set)
+{
+	pcm_word_t *cur = log_pool_checkpoint[log_pool_checkpoint_cur];
+	pcm_word_t *next = log_pool_checkpoint[1 - log_pool_checkpoint_cur];
+	int        i;
+
+	for (i = 0; i < (int) log_pool_nlogs; i++) {
+		if (next[i] != cur[i]) {
+			PCM_NT_STORE(set, (volatile pcm_word_t *) &next[i], cur[i]);
+		}
+	}
+}
+
+
+/**
+ * \brief Records the truncation point of a log in the checkpoint being 
+ * taken.
+ */
+void
+m_logmgr_checkpoint_add(pcm_storeset_t *set, m_log_dsc_t *log_dsc)
+{
+	pcm_word_t *next = log_pool_checkpoint[1 - log_pool_checkpoint_cur];
+
+	PCM_NT_STORE(set, (volatile pcm_word_t *) &next[log_index(log_dsc)], 
+	             log_dsc->trunc_point | LF_CHECKPOINT_VALID);
+}
+
+
+/**
+ * \brief Publishes the checkpoint being taken.
+ *
+ * The fragments up to the recorded truncation points must already be 
+ * durable. From then on recovery starts each log at its checkpointed point,
+ * so the logs may publish their new heads in any order, without barriers.
+ */
+void
+m_logmgr_checkpoint_commit(pcm_storeset_t *set)
+{
+	PCM_PERSIST_BARRIER(set);
+	PCM_NT_STORE(set, (volatile pcm_word_t *) &log_pool_checkpoint_cur, 
+	             1 - log_pool_checkpoint_cur);
+	PCM_PERSIST_BARRIER(set);
+}
+
+
+/* Drops the checkpointed truncation point of a log about to be formatted. */
+static
+void
+checkpoint_invalidate(pcm_storeset_t *set, m_log_dsc_t *log_dsc)
+{
+	int i = log_index(log_dsc);
+
+	if (log_pool_checkpoint[0][i] | log_pool_checkpoint[1][i]) {
+		PCM_NT_STORE(set, (volatile pcm_word_t *) &log_pool_checkpoint[0][i], 0);
+		PCM_NT_STORE(set, (volatile pcm_word_t *) &log_pool_checkpoint[1][i], 0);
+		PCM_PERSIST_BARRIER(set);
+	}
+}
+
+
+/**
+ * \brief Maps the physical logs of LOG_POOL_EXTENT_LOGS more logs, placed on
+ * NUMA node node unless it is -1, and adds 
+ * them to the free logs list.
+ *
+ * The number of logs is made persistent only after their segment exists, so
+ * a crash in between leaves a segment that is found and reused next time. 
+ */
+static
+m_result_t
+grow_log_pool(pcm_storeset_t *set, m_logmgr_t *mgr, int node)
+{
+	int              first = (int) log_pool_nlogs;
+	uintptr_t        start_addr;
+	uint64_t         size;
+	void             *addr;
+	m_segidx_entry_t *segidx_entry;
+
+	if (first + LOG_POOL_EXTENT_LOGS > log_pool_max_logs) {
+		return M_R_FAILURE;
+	}
+	start_addr = log_pool_logs_start + log_pool_physical_log_size*first;
+	size = (unsigned long long) log_pool_physical_log_size * LOG_POOL_EXTENT_LOGS;
+	if (m_segment_find_using_addr((void *) start_addr, &segidx_entry) 
+	    != M_R_SUCCESS) 
+	{
+		addr = m_pmap_logs((void *) start_addr, size, node);
+		if (addr == MAP_FAILED) {
+			return M_R_FAILURE;
+		}
+	}
+	if (node >= 0 && m_pmap_bind_node((void *) start_addr, size, node) != 0) {
+		node = -1;
+	}
+	PCM_NT_STORE(set, (volatile pcm_word_t *) &log_pool_nlogs, 
+	             (pcm_word_t) (first + LOG_POOL_EXTENT_LOGS));
+	PCM_NT_FLUSH(set);
+
+	return add_log_dscs(mgr, first, LOG_POOL_EXTENT_LOGS, node);
+}
+
+
 /**
  * \brief Creates the log pool if doesn't exist and then initializes the
  * necessary volatile data structures to access the log pool. 
  *
  * A log descriptor volatile structure is created per non-volatile persistent
  * log but the actual volatile log structure is created when the log is 
- * later recovered or allocated by a client. 
+ * later recovered or allocated by a client. Physical logs are mapped only
+ * when clients need them (see grow_log_pool).
  */
 static
 m_result_t
 create_log_pool(pcm_storeset_t *set, m_logmgr_t *mgr)
 {
-	uintptr_t        metadata_start_addr;
-	uintptr_t        logs_start_addr;
 	int              metadata_section_size;
-	int              physical_log_size;
 	void             *addr;
-	m_log_dsc_t      *log_dscs;
 	m_segidx_entry_t *segidx_entry;
-	int              i;
+
+	/* 
+	 * Physical logs should be page aligned to get maximum bandwidth from the 
+	 * system. Since sizeof(metadata) much smaller than sizeof(PAGE) we 
+	 * aggregate the metadata of all logs together at the start of the pool.
+	 */
+	metadata_section_size = PAGE_ALIGN(LOG_POOL_MAX_LOGS * sizeof(m_log_nvmd_t));
+	log_pool_logs_start = LOG_POOL_START + metadata_section_size; /* LOG_POOL_START is already page aligned */
+	log_pool_size_log2 = mcore_runtime_settings.log_size_log2;
+	if (log_pool_size_log2 == 0) {
+		log_pool_size_log2 = PHYSICAL_LOG_NUM_ENTRIES_LOG2;
+	} else if (log_pool_size_log2 < PHYSICAL_LOG_MIN_NUM_ENTRIES_LOG2 ||
+	           log_pool_size_log2 > PHYSICAL_LOG_MAX_NUM_ENTRIES_LOG2) 
+	{
+		M_WARNING("log_size_log2 out of range; using %d.\n", PHYSICAL_LOG_NUM_ENTRIES_LOG2);
+		log_pool_size_log2 = PHYSICAL_LOG_NUM_ENTRIES_LOG2;
+	}
+	/* 
+	 * The slot each log occupies in the pool is fixed when the pool is 
+	 * created; logs formatted later may use less than their slot but never
+	 * more.
+	 */
+	if (log_pool) {
+		log_pool_physical_log_size = (int) log_pool_log_size;
+		while ((sizeof(pcm_word_t) << log_pool_size_log2) > log_pool_physical_log_size) {
+			log_pool_size_log2--;
+		}
+	} else {
+		log_pool_physical_log_size = PAGE_ALIGN(sizeof(pcm_word_t) << log_pool_size_log2);
+	}
+	log_pool_max_logs = (LOG_POOL_SIZE - metadata_section_size) / log_pool_physical_log_size;
+	if (log_pool_max_logs > LOG_POOL_MAX_LOGS) {
+		log_pool_max_logs = LOG_POOL_MAX_LOGS;
+	}
 
 	if (!log_pool) {
 		/* 
@@ -115,47 +324,19 @@ create_log_pool(pcm_storeset_t *set, m_logmgr_t *mgr)
 		if (m_segment_find_using_addr((void *) LOG_POOL_START, &segidx_entry) 
 		    != M_R_SUCCESS) 
 		{
-			addr = m_pmap2((void *) LOG_POOL_START, LOG_POOL_SIZE, 
-			               PROT_READ|PROT_WRITE, MAP_FIXED);
+			addr = m_pmap_logs((void *) LOG_POOL_START, metadata_section_size, -1);
 			if (addr == MAP_FAILED) {
 				M_INTERNALERROR("Could not allocate logs pool segment.\n");
 			}
 		}
-		PCM_NT_STORE(set, (volatile pcm_word_t *) &log_pool, (pcm_word_t) addr);
+		PCM_NT_STORE(set, (volatile pcm_word_t *) &log_pool_log_size, 
+		             (pcm_word_t) log_pool_physical_log_size);
+		PCM_NT_STORE(set, (volatile pcm_word_t *) &log_pool, (pcm_word_t) LOG_POOL_START);
 		PCM_NT_FLUSH(set);
 	}
 	
-	/* 
-	 * Now read the non-volatile log metadata and non-volatile physical logs.
-	 * 
-	 * Physical logs should be page aligned to get maximum bandwidth from the 
-	 * system. Since sizeof(metadata) much smaller than sizeof(PAGE) we 
-	 * aggregate all the metadata together.
-	 */
-	metadata_start_addr = LOG_POOL_START; /* this is already page aligned */
-	metadata_section_size = PAGE_ALIGN(LOG_NUM * sizeof(m_log_nvmd_t));
-	logs_start_addr = metadata_start_addr + metadata_section_size;
-   	physical_log_size = PAGE_ALIGN(PHYSICAL_LOG_SIZE);
-	assert(metadata_section_size + LOG_NUM*physical_log_size <= LOG_POOL_SIZE);
-	log_dscs = (m_log_dsc_t *) calloc(LOG_NUM, sizeof(m_log_dsc_t));
-	for (i=0; i<LOG_NUM; i++) {
-		log_dscs[i].nvmd = (m_log_nvmd_t *) (metadata_start_addr + 
-		                                        sizeof(m_log_nvmd_t)*i);
-		log_dscs[i].nvphlog = (pcm_word_t *) (logs_start_addr + 
-		                                         physical_log_size*i);
-		log_dscs[i].log = NULL;
-		log_dscs[i].ops = NULL;
-		log_dscs[i].logorder = INV_LOG_ORDER;
-		if ((log_dscs[i].nvmd->generic_flags & LF_TYPE_MASK) == 
-		    LF_TYPE_FREE) 
-		{
-			list_add_tail(&(log_dscs[i].list), &(mgr->free_logs_list));
-		} else {
-			list_add_tail(&(log_dscs[i].list), &(mgr->pending_logs_list));
-		}
-	}
-
-	return M_R_SUCCESS;
+	/* Now read the non-volatile log metadata of the logs mapped so far. */
+	return add_log_dscs(mgr, 0, (int) log_pool_nlogs, -1);
 }
 
 
@@ -231,6 +412,7 @@ m_logmgr_init(pcm_storeset_t *set)
 m_result_t
 m_logmgr_fini(void)
 {
+	m_groupcommit_fini();
 #ifdef _M_STATS_BUILD
 	m_logmgr_stat_print();
 	printf("total_trunc_time  %llu (ns)\n", logmgr->trunc_time);
@@ -238,6 +420,11 @@ m_logmgr_fini(void)
 	if (logmgr->trunc_count>0) {
 		printf("avg_trunc_time    %llu (ns)\n", logmgr->trunc_time/logmgr->trunc_count);
 	}	
+#else
+	/* Per log counters such as chunk padding are kept in every build */
+	if (mcore_runtime_settings.stats) {
+		m_logmgr_stat_print();
+	}
 #endif
 	return M_R_SUCCESS;
 }
@@ -325,6 +512,8 @@ do_recovery(pcm_storeset_t *set, m_logmgr_t *mgr)
 	m_log_dsc_t        *log_dsc_to_recover;
 	struct list_head   recovery_list;
 	unsigned int       nlogfragments_recovered;
+	unsigned int       nlogs;
+	pcm_word_t         checkpoint;
 #ifdef _M_STATS_BUILD
 	struct timeval     start_time;
 	struct timeval     stop_time;
@@ -340,11 +529,18 @@ do_recovery(pcm_storeset_t *set, m_logmgr_t *mgr)
 	 */
 	/* FIXME: Collect and recover logs by type. */
 	INIT_LIST_HEAD(&recovery_list);
+	nlogs = 0;
 	list_for_each_entry_safe(log_dsc, log_dsc_tmp, &(mgr->pending_logs_list), list) {
 		if (log_dsc->ops && log_dsc->ops->recovery_init) {
+			/* Fragments before a checkpointed truncation point are durable */
+			checkpoint = log_pool_checkpoint[log_pool_checkpoint_cur][log_index(log_dsc)];
+			if (checkpoint & LF_CHECKPOINT_VALID) {
+				log_dsc->trunc_point = checkpoint & ~LF_CHECKPOINT_VALID;
+			}
 			log_dsc->ops->recovery_init(set, log_dsc);
 			list_del_init(&(log_dsc->list));
 			list_add(&(log_dsc->list), &recovery_list);
+			nlogs++;
 		}
 	}
 
@@ -355,8 +551,17 @@ do_recovery(pcm_storeset_t *set, m_logmgr_t *mgr)
 	/* 
 	 * Find the next log to recover, recover it, update its recovery
 	 * order, and repeat until there are no more logs to recover.
+	 *
+	 * Fragments are walked in order but their stores are applied by the 
+	 * recovery workers (see logrecovery.c), so the logs are truncated only
+	 * after m_logrecovery_end has made all the stores durable, all at once
+	 * through a truncation checkpoint.
 	 */
 	nlogfragments_recovered = 0;
+	if (!list_empty(&recovery_list)) {
+		M_PROBE1(recovery__begin, nlogs);
+		m_logrecovery_begin();
+	}
 	do {
 		log_dsc_to_recover = NULL; 
 		list_for_each_entry(log_dsc, &recovery_list, list) {
@@ -378,9 +583,26 @@ do_recovery(pcm_storeset_t *set, m_logmgr_t *mgr)
 			log_dsc_to_recover->ops->recovery_do(set, log_dsc_to_recover);
 			log_dsc_to_recover->ops->recovery_prepare_next(set, log_dsc_to_recover);
 			nlogfragments_recovered++;
+			M_PROBE1(recovery__progress, nlogfragments_recovered);
 		}	
 	} while(log_dsc_to_recover);
 
+	if (!list_empty(&recovery_list)) {
+		m_logrecovery_end(set);
+		m_logmgr_checkpoint_begin(set);
+		list_for_each_entry(log_dsc, &recovery_list, list) {
+			assert(log_dsc->ops->truncation_do);
+			log_dsc->ops->truncation_do(set, log_dsc);
+			m_logmgr_checkpoint_add(set, log_dsc);
+		}
+		m_logmgr_checkpoint_commit(set);
+		list_for_each_entry(log_dsc, &recovery_list, list) {
+			assert(log_dsc->ops->truncation_publish);
+			log_dsc->ops->truncation_publish(set, log_dsc);
+		}
+		M_PROBE1(recovery__end, nlogfragments_recovered);
+	}
+
 	/* Make the recovered logs available for reuse */
 	list_splice(&recovery_list, &(mgr->free_logs_list));
 
@@ -407,6 +629,10 @@ m_logmgr_do_recovery(pcm_storeset_t *set)
 
 /**
  * \brief Allocates a new log and places it in the active logs list.
+ *
+ * With log_numa_local, logs on the caller's NUMA node (or of unknown 
+ * placement, such as recovered ones) are preferred and the log pool grows 
+ * on that node; logs of other nodes are only used once the pool is full.
  */
 m_result_t
 m_logmgr_alloc_log(pcm_storeset_t *set, int type, uint64_t flags, m_log_dsc_t **log_dscp)
@@ -416,9 +642,17 @@ m_logmgr_alloc_log(pcm_storeset_t *set, int type, uint64_t flags, m_log_dsc_t **
 	m_log_dsc_t       *free_log_dsc = NULL;
 	m_log_dsc_t       *free_log_dsc_notype = NULL;
 	m_logtype_entry_t *logtype_entry;
+	int               node = -1;
 
+	if (mcore_runtime_settings.log_numa_local && m_numa_nodes() > 1) {
+		node = m_numa_node_self();
+	}
 	pthread_mutex_lock(&(logmgr->mutex));
+retry:
 	list_for_each_entry(log_dsc, &(logmgr->free_logs_list), list) {
+		if (node >= 0 && log_dsc->node >= 0 && log_dsc->node != node) {
+			continue;
+		}
 		if (((log_dsc->nvmd->generic_flags & LF_TYPE_MASK) ==  type) &&
 		    free_log_dsc == NULL) 
 		{
@@ -454,6 +688,14 @@ m_logmgr_alloc_log(pcm_storeset_t *set, int type, uint64_t flags, m_log_dsc_t **
 		 * be of different type. Need to get one out of the free list 
 		 * and clean it.
 		 */
+		if (grow_log_pool(set, logmgr, node) == M_R_SUCCESS) {
+			goto retry;
+		}
+		if (node >= 0) {
+			/* Pool is full: take a log of another node */
+			node = -1;
+			goto retry;
+		}
 		rv = M_R_FAILURE;
 		goto out;
 	}
@@ -461,8 +703,15 @@ m_logmgr_alloc_log(pcm_storeset_t *set, int type, uint64_t flags, m_log_dsc_t **
 	list_del_init(&(log_dsc->list));
 	list_add_tail(&(log_dsc->list), &(logmgr->active_logs_list));
 
+	if (flags & LF_ASYNC_TRUNCATION) {
+		m_logtrunc_start();
+	}
+
 	/* Finally, initialize the log */
 	log_dsc->flags = flags;
+	log_dsc->size_log2 = log_pool_size_log2;
+	log_dsc->trunc_point = INV_LOG_ORDER;
+	checkpoint_invalidate(set, log_dsc);
 	assert(log_dsc->ops && log_dsc->ops->init);
 	assert(log_dsc->ops->init(set, log_dsc->log, log_dsc) == M_R_SUCCESS);
 	PCM_NT_STORE(set, (volatile pcm_word_t *) &(log_dsc->nvmd->generic_flags), 
@@ -478,12 +727,24 @@ out:
 
 
 /**
- * \brief Releases a log.
+ * \brief Releases a log, so that its physical log can be reused by another 
+ * client (e.g. when a thread exits).
+ *
+ * A log truncated asynchronously may still hold fragments; the truncation 
+ * thread moves it to the free logs list once they are truncated.
  */
 m_result_t 
 m_logmgr_free_log(m_log_dsc_t *log_dsc)
 {
-	//TODO
+	pthread_mutex_lock(&(logmgr->mutex));
+	if (log_dsc->flags & LF_ASYNC_TRUNCATION) {
+		log_dsc->flags |= LF_RETIRED;
+		m_logtrunc_signal();
+	} else {
+		list_del_init(&(log_dsc->list));
+		list_add_tail(&(log_dsc->list), &(logmgr->free_logs_list));
+	}
+	pthread_mutex_unlock(&(logmgr->mutex));
 	return M_R_SUCCESS;
 }
 
@@ -70,8 +70,10 @@ m_result_t
 m_phlog_base_format (pcm_storeset_t *set, 
                      m_phlog_base_nvmd_t *nvmd, 
                      pcm_word_t *nvphlog, 
-                     int type)
+                     int type,
+                     int size_log2)
 {
+	PCM_NT_STORE(set, (volatile pcm_word_t *) &nvmd->size_log2, (pcm_word_t) size_log2);
 	PCM_NT_STORE(set, (volatile pcm_word_t *) &nvmd->head, 0);
 	PCM_NT_STORE(set, (volatile pcm_word_t *) &nvmd->tail, 0);
 	PCM_NT_FLUSH(set);
@@ -88,7 +90,7 @@ m_phlog_base_alloc (m_phlog_base_t **phlog_basep)
 {
 	m_phlog_base_t      *phlog_base;
 	
-	if (posix_memalign((void **) &phlog_base, sizeof(uint64_t), sizeof(m_phlog_base_t)) != 0) 
+	if (posix_memalign((void **) &phlog_base, CACHELINE_SIZE, sizeof(m_phlog_base_t)) != 0) 
 	{
 		return M_R_FAILURE;
 	}
@@ -111,8 +113,10 @@ m_phlog_base_init(m_phlog_base_t *phlog,
 	phlog->nvphlog = nvphlog;
 	phlog->buffer_count = 0;
 	phlog->head = phlog->nvmd->head;
+	phlog->cached_head = phlog->head;
 	phlog->tail = phlog->nvmd->tail;
 	phlog->read_index = phlog->nvmd->head;
+	phlog->mask = (1ULL << PHYSICAL_LOG_NVMD_SIZE_LOG2(nvmd)) - 1;
 
 	/* initialize statistics */
 	phlog->stat_wait_for_trunc = 0;
@@ -130,9 +134,37 @@ m_phlog_base_truncate_async(pcm_storeset_t *set, m_phlog_base_t *phlog)
 {
 	phlog->head = phlog->read_index;
 
-	PCM_NT_FLUSH(set);
+	PCM_PERSIST_BARRIER(set);
 	PCM_NT_STORE(set, (volatile pcm_word_t *) &phlog->nvmd->head, (pcm_word_t) phlog->head);
-	PCM_NT_FLUSH(set);
+	PCM_PERSIST_BARRIER(set);
 	
 	return M_R_SUCCESS;
 }
+
+
+/**
+ * \brief Returns the non-volatile head the log would have if truncated up 
+ * to the read_index point.
+ */
+pcm_word_t
+m_phlog_base_truncation_point(m_phlog_base_t *phlog)
+{
+	return (pcm_word_t) phlog->read_index;
+}
+
+
+/**
+ * \brief Moves the head to a point returned by m_phlog_base_truncation_point.
+ *
+ * No persist barrier: the caller must have made the truncated fragments 
+ * durable and recorded the point in a truncation checkpoint first.
+ */
+m_result_t
+m_phlog_base_truncate_to(pcm_storeset_t *set, m_phlog_base_t *phlog, pcm_word_t point)
+{
+	phlog->head = (uint64_t) point;
+	PCM_NT_STORE(set, (volatile pcm_word_t *) &phlog->nvmd->head, point);
+	m_spinwait_wake(&phlog->head);
+
+	return M_R_SUCCESS;
+}
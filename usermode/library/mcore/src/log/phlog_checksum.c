@@ -0,0 +1,237 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+
+/**
+ * \file
+ * 
+ * \brief Physical log implemented using a CRC32C checksum per atomic log 
+ * fragment to detect fragments that did not make it to persistent memory.
+ *
+ */
+
+/* System header files */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+/* Mnemosyne common header files */
+#include <result.h>
+#include "phlog_checksum.h"
+#include "hal/pcm_i.h"
+
+
+/**
+ * \brief Check the consistency of the non-volatile log and find the consistent
+ * stable region starting from the head.
+ *
+ * The stable region ends right after the last chunk of the last fragment 
+ * whose trailer matches the checksum of its payload.
+ */
+m_result_t
+m_phlog_checksum_check_consistency(m_phlog_checksum_nvmd_t *nvmd, 
+                                   pcm_word_t *nvphlog,
+                                   uint64_t *stable_tail)
+{
+	uint64_t          head_index;
+	uint64_t          i;
+	uint64_t          pass;
+	uint64_t          generation = nvmd->generation;
+	uint64_t          crc;
+	pcm_word_t        word;
+	uint64_t          mask = (1ULL << PHYSICAL_LOG_NVMD_SIZE_LOG2(nvmd)) - 1;
+
+	pass = LF_PASS & nvmd->flags;
+	i = head_index = nvmd->flags & LF_PASS_HEAD_MASK;
+	*stable_tail = head_index;
+	crc = checksum_seed(i, pass, generation);
+	while(1) {
+		word = nvphlog[i];
+		if (word == (CHECKSUM_TRAILER_TAG | crc)) {
+			/* Valid fragment: the next one starts at the next chunk */
+			i = ((i + CHECKSUM_CHUNK_NWORDS) & ~(CHECKSUM_CHUNK_NWORDS - 1)) & mask;
+			if (i==0) {
+				pass = LF_PASS & ~pass;
+			}
+			*stable_tail = i;
+			crc = checksum_seed(i, pass, generation);
+		} else {
+			crc = checksum_crc32c(crc, word);
+			i = (i + 1) & mask;
+			if (i==0) {
+				pass = LF_PASS & ~pass;
+			}
+		}
+		if (i==head_index) {
+			break;
+		}
+	}
+
+	return M_R_SUCCESS;
+}
+
+
+/**
+ * \brief Formats the non-volatile physical log for reuse.
+ *
+ * Resetting the head does not invalidate the fragments a previous use of 
+ * the log left behind it, so the format also moves the log to a new 
+ * generation: the old fragments no longer match their checksum seed.
+ */
+m_result_t
+m_phlog_checksum_format (pcm_storeset_t *set, 
+                         m_phlog_checksum_nvmd_t *nvmd, 
+                         pcm_word_t *nvphlog, 
+                         int type,
+                         int size_log2)
+{
+	int i;
+
+	PCM_NT_STORE(set, (volatile pcm_word_t *) &nvmd->size_log2, (pcm_word_t) size_log2);
+	PCM_NT_STORE(set, (volatile pcm_word_t *) &nvmd->generation, nvmd->generation + 1);
+	PCM_NT_STORE(set, (volatile pcm_word_t *) &nvmd->flags, (pcm_word_t) LF_PASS);
+	for (i=0; i<CHECKSUM_CHUNK_NWORDS; i++) {
+		PCM_NT_STORE(set, (volatile pcm_word_t *) &nvphlog[i], (pcm_word_t) 0);
+	}
+	PCM_NT_FLUSH(set);
+
+	return M_R_SUCCESS;
+}
+
+
+/**
+ * \brief Allocates a volatile log structure.
+ */
+m_result_t
+m_phlog_checksum_alloc (m_phlog_checksum_t **phlog_checksump)
+{
+	m_phlog_checksum_t     *phlog_checksum;
+
+	if (posix_memalign((void **) &phlog_checksum, CACHELINE_SIZE, sizeof(m_phlog_checksum_t)) != 0) 
+	{
+		return M_R_FAILURE;
+	}
+	*phlog_checksump = phlog_checksum;
+
+	return M_R_SUCCESS;
+}
+
+
+/**
+ * \brief Initializes the volatile log descriptor using the non-volatile 
+ * metadata referenced by log_dsc.
+ */
+m_result_t
+m_phlog_checksum_init (m_phlog_checksum_t *phlog, 
+                       m_phlog_checksum_nvmd_t *nvmd,
+                       pcm_word_t *nvphlog)					  
+{
+	phlog->nvmd = nvmd;
+	phlog->nvphlog = nvphlog;
+	phlog->pass = LF_PASS & phlog->nvmd->flags;
+	phlog->buffer_count = 0;
+	phlog->head = phlog->tail = phlog->stable_tail = phlog->read_index = phlog->nvmd->flags & LF_PASS_HEAD_MASK;
+	phlog->cached_head = phlog->head;
+	phlog->mask = (1ULL << PHYSICAL_LOG_NVMD_SIZE_LOG2(nvmd)) - 1;
+	phlog->generation = phlog->nvmd->generation;
+	phlog->crc = checksum_seed(phlog->tail, phlog->pass, phlog->generation);
+
+	/* initialize statistics */
+	phlog->stat_wait_for_trunc = 0;
+	phlog->stat_wait_time_for_trunc = 0;
+	phlog->stat_chunks = 0;
+	phlog->stat_padded_chunks = 0;
+	phlog->stat_pad_words = 0;
+	return M_R_SUCCESS;
+}
+
+
+/**
+ * \brief Returns the non-volatile head (index and pass bit) the log would 
+ * have if truncated up to the read_index point.
+ */
+pcm_word_t
+m_phlog_checksum_truncation_point(m_phlog_checksum_t *phlog)
+{
+	pcm_word_t        pass;
+
+	pass = LF_PASS & phlog->nvmd->flags;
+	/* 
+	 * If head is larger than the read_index point, then the head wraps 
+	 * around on the way to read_index, thus the pass bit is flipped.
+	 */
+	if (phlog->head > phlog->read_index) {
+		pass = ~pass & LF_PASS;
+	}
+
+	return (pcm_word_t) (phlog->read_index | pass);
+}
+
+
+/**
+ * \brief Truncates the log up to the read_index point.
+ */
+m_result_t
+m_phlog_checksum_truncate_async(pcm_storeset_t *set, m_phlog_checksum_t *phlog) 
+{
+	pcm_word_t        point;
+
+	point = m_phlog_checksum_truncation_point(phlog);
+	phlog->head = phlog->read_index;
+
+	/* 
+	 * Drain the pending write-backs of the truncated fragments before moving 
+	 * the head; CLWB/CLFLUSHOPT are not ordered with the store below. 
+	 */
+	PCM_PERSIST_BARRIER(set);
+	PCM_NT_STORE(set, (volatile pcm_word_t *) &phlog->nvmd->flags, point);
+	PCM_PERSIST_BARRIER(set);
+	
+	return M_R_SUCCESS;
+}
+
+
+/**
+ * \brief Moves the head to a point returned by 
+ * m_phlog_checksum_truncation_point.
+ *
+ * No persist barrier: the caller must have made the truncated fragments 
+ * durable and recorded the point in a truncation checkpoint first.
+ */
+m_result_t
+m_phlog_checksum_truncate_to(pcm_storeset_t *set, m_phlog_checksum_t *phlog, pcm_word_t point)
+{
+	phlog->head = point & LF_PASS_HEAD_MASK;
+	PCM_NT_STORE(set, (volatile pcm_word_t *) &phlog->nvmd->flags, point);
+	m_spinwait_wake(&phlog->head);
+
+	return M_R_SUCCESS;
+}
@@ -33,8 +33,8 @@
 /**
  * \file
  * 
- * \brief Physical log implemented using a torn-bit per word to detect
- * torn words. 
+ * \brief Physical log implemented using a torn bit per chunk to detect
+ * torn chunks. 
  *
  */
 
@@ -50,29 +50,35 @@
 #include <smmintrin.h>
 
 
-uint64_t load_nt_word(void *addr)
+/**
+ * \brief Copies the chunk starting at index into the read buffer of the log.
+ *
+ * Four 16-byte non-temporal loads bring in the whole chunk, rather than one
+ * per word read, and reading the log does not pollute the cache. The copy
+ * stays valid until the chunk is truncated, and the reader moves past it
+ * before that happens.
+ */
+void
+m_phlog_tornbit_load_chunk(m_phlog_tornbit_t *log, uint64_t index)
 {
-	union {
-		__m128i x;
-		char b[16];
-	} u;
-
-	uintptr_t aladdr;
-	uintptr_t offset;
-
-	aladdr = ((uintptr_t) addr) & ~0xF;
-	offset = ((uintptr_t) addr) & 0xF;
-
-	u.x = _mm_stream_load_si128((__m128i *) aladdr);
-
-	return *((uint64_t *) &u.b[offset]);
-}	
+	__m128i *src = (__m128i *) &log->nvphlog[index];
+	__m128i *dst = (__m128i *) log->read_chunk;
+
+	dst[0] = _mm_stream_load_si128(&src[0]);
+	dst[1] = _mm_stream_load_si128(&src[1]);
+	dst[2] = _mm_stream_load_si128(&src[2]);
+	dst[3] = _mm_stream_load_si128(&src[3]);
+	log->read_chunk_index = index;
+}
 
 
 
 /**
  * \brief Check the consistency of the non-volatile log and find the consistent
  * stable region starting from the head.
+ *
+ * The stable region ends at the first chunk whose header does not carry the
+ * expected torn bit or does not match the checksum of the chunk's payload.
  */
 m_result_t
 m_phlog_tornbit_check_consistency(m_phlog_tornbit_nvmd_t *nvmd, 
@@ -81,21 +87,23 @@ m_phlog_tornbit_check_consistency(m_phlog_tornbit_nvmd_t *nvmd,
 {
 	uint64_t          head_index;
 	uint64_t          i;
-	uint64_t          tornbit;
+	uint64_t          header;
 	uint64_t          valid_tornbit;
-	int               flip_tornbit = 0;
+	uint64_t          mask = (1ULL << PHYSICAL_LOG_NVMD_SIZE_LOG2(nvmd)) - 1;
 
 	valid_tornbit = LF_TORNBIT & nvmd->flags;
 	i = head_index = nvmd->flags & LF_HEAD_MASK;
+	*stable_tail = head_index;
 	while(1) {
-		tornbit = (TORN_MASK & nvphlog[i]);
-		if (tornbit != valid_tornbit) {
+		header = nvphlog[i + CHUNK_PAYLOAD_NWORDS];
+		if ((header & TORN_MASK) != valid_tornbit ||
+		    (header & TORN_MASKC) != tornbit_chunk_checksum(&nvphlog[i]))
+		{
 			*stable_tail = i;
 			break;
 		}
-		i = (i + 1) & (PHYSICAL_LOG_NUM_ENTRIES - 1);
+		i = (i + CHUNK_NWORDS) & mask;
 		if (i==0) {
-			flip_tornbit = 1;
 			valid_tornbit = TORN_MASK & ~valid_tornbit;
 		}
 		if (i==head_index) {
@@ -107,6 +115,10 @@ m_phlog_tornbit_check_consistency(m_phlog_tornbit_nvmd_t *nvmd,
 }
 
 
+/*
+ * Only chunk headers need formatting: a chunk whose header carries the 
+ * wrong torn bit is invalid regardless of its payload.
+ */
 static
 m_result_t
 tornbit_format_nvlog (pcm_storeset_t *set,
@@ -116,16 +128,19 @@ tornbit_format_nvlog (pcm_storeset_t *set,
                       pcm_word_t *nvphlog)
 {
 	int i;
+	int nentries = 1 << PHYSICAL_LOG_NVMD_SIZE_LOG2(nvmd);
+	int header;
 
 	PCM_NT_STORE(set, (volatile pcm_word_t *) &nvmd->flags, head_index | tornbit);
-	for (i=0; i<PHYSICAL_LOG_NUM_ENTRIES; i++) {
+	for (i=0; i<nentries; i+=CHUNK_NWORDS) {
+		header = i + CHUNK_PAYLOAD_NWORDS;
 		if (i<head_index) {
-			if ((nvphlog[i] & TORN_MASK) != tornbit) {
-				PCM_NT_STORE(set, (volatile pcm_word_t *) &nvphlog[i], tornbit);
+			if ((nvphlog[header] & TORN_MASK) != tornbit) {
+				PCM_NT_STORE(set, (volatile pcm_word_t *) &nvphlog[header], tornbit);
 			}	
 		} else {
-			if ((nvphlog[i] & TORN_MASK) == tornbit) {
-				PCM_NT_STORE(set, (volatile pcm_word_t *) &nvphlog[i], ~tornbit & TORN_MASK);
+			if ((nvphlog[header] & TORN_MASK) == tornbit) {
+				PCM_NT_STORE(set, (volatile pcm_word_t *) &nvphlog[header], ~tornbit & TORN_MASK);
 			}	
 		}
 	}
@@ -142,10 +157,12 @@ m_result_t
 m_phlog_tornbit_format (pcm_storeset_t *set, 
                         m_phlog_tornbit_nvmd_t *nvmd, 
                         pcm_word_t *nvphlog, 
-                        int type)
+                        int type,
+                        int size_log2)
 {
 	m_result_t             rv = M_R_FAILURE;
 	
+	PCM_NT_STORE(set, (volatile pcm_word_t *) &nvmd->size_log2, (pcm_word_t) size_log2);
 	if ((nvmd->generic_flags & LF_TYPE_MASK) == type) {
 		/* 
 		 * TODO: Optimization: check consistency and perform a quick format 
@@ -175,7 +192,7 @@ m_phlog_tornbit_alloc (m_phlog_tornbit_t **phlog_tornbitp)
 {
 	m_phlog_tornbit_t      *phlog_tornbit;
 
-	if (posix_memalign((void **) &phlog_tornbit, sizeof(uint64_t),sizeof(m_phlog_tornbit_t)) != 0) 
+	if (posix_memalign((void **) &phlog_tornbit, CACHELINE_SIZE, sizeof(m_phlog_tornbit_t)) != 0) 
 	{
 		return M_R_FAILURE;
 	}
@@ -201,15 +218,17 @@ m_phlog_tornbit_init (m_phlog_tornbit_t *phlog,
 	tornbit = LF_TORNBIT & phlog->nvmd->flags;
 	phlog->tornbit = tornbit;
 	phlog->buffer_count = 0;
-	phlog->write_remainder = 0x0;
-	phlog->write_remainder_nbits = 0;
-	phlog->read_remainder = 0x0;
-	phlog->read_remainder_nbits = 0;
 	phlog->head = phlog->tail = phlog->stable_tail = phlog->read_index = phlog->nvmd->flags & LF_HEAD_MASK;
+	phlog->read_chunk_index = TORNBIT_NO_CHUNK;
+	phlog->cached_head = phlog->head;
+	phlog->mask = (1ULL << PHYSICAL_LOG_NVMD_SIZE_LOG2(nvmd)) - 1;
 
 	/* initialize statistics */
 	phlog->stat_wait_for_trunc = 0;
 	phlog->stat_wait_time_for_trunc = 0;
+	phlog->stat_chunks = 0;
+	phlog->stat_padded_chunks = 0;
+	phlog->stat_pad_words = 0;
 	return M_R_SUCCESS;
 }
 
@@ -234,14 +253,55 @@ m_phlog_tornbit_truncate_async(pcm_storeset_t *set, m_phlog_tornbit_t *phlog)
 
 	phlog->head = phlog->read_index;
 
-	//FIXME: do we need a flush? PCM_NT_FLUSH(set);
+	/* 
+	 * Drain the pending write-backs of the truncated fragments before moving 
+	 * the head; CLWB/CLFLUSHOPT are not ordered with the store below. 
+	 */
+	PCM_PERSIST_BARRIER(set);
 	PCM_NT_STORE(set, (volatile pcm_word_t *) &phlog->nvmd->flags, (pcm_word_t) (phlog->head | tornbit));
-	PCM_NT_FLUSH(set);
+	PCM_PERSIST_BARRIER(set);
 	
 	return M_R_SUCCESS;
 }
 
 
+/**
+ * \brief Returns the non-volatile head (index and torn bit) the log would 
+ * have if truncated up to the read_index point.
+ */
+pcm_word_t
+m_phlog_tornbit_truncation_point(m_phlog_tornbit_t *phlog)
+{
+	pcm_word_t        tornbit;
+
+	tornbit = LF_TORNBIT & phlog->nvmd->flags;
+	/* The head wraps around on the way to read_index; see truncate_async */
+	if (phlog->head > phlog->read_index) {
+		tornbit = ~tornbit & TORN_MASK;
+	}
+
+	return (pcm_word_t) (phlog->read_index | tornbit);
+}
+
+
+/**
+ * \brief Moves the head to a point returned by 
+ * m_phlog_tornbit_truncation_point.
+ *
+ * No persist barrier: the caller must have made the truncated fragments 
+ * durable and recorded the point in a truncation checkpoint first.
+ */
+m_result_t
+m_phlog_tornbit_truncate_to(pcm_storeset_t *set, m_phlog_tornbit_t *phlog, pcm_word_t point)
+{
+	phlog->head = point & LF_HEAD_MASK;
+	PCM_NT_STORE(set, (volatile pcm_word_t *) &phlog->nvmd->flags, point);
+	m_spinwait_wake(&phlog->head);
+
+	return M_R_SUCCESS;
+}
+
+
 void m_phlog_print_buffer(m_phlog_tornbit_t *log)
 {
 	int i;
@@ -52,6 +52,7 @@
 #include "files.h"
 #include "list.h"
 #include "debug.h"
+#include "hal/pcm_i.h"
 #include <pm_instr.h>
 
 static m_result_t persistent_shdr_open(char *module_path, uint64_t module_inode, uintptr_t module_start, module_dsr_t *module_dsr);
@@ -77,12 +78,12 @@ m_module_relocate_symbols(uintptr_t got_start,
 	uintptr_t symbol_old_addr;
 	uintptr_t symbol_new_addr;
 
-	M_DEBUG_PRINT(M_DEBUG_SEGMENT, "relocate.got_start = %lx\n", got_start);
-	M_DEBUG_PRINT(M_DEBUG_SEGMENT, "relocate.got_end   = %lx\n", got_end);
-	M_DEBUG_PRINT(M_DEBUG_SEGMENT, "relocate.old_start = %lx\n", old_start);
-	M_DEBUG_PRINT(M_DEBUG_SEGMENT, "relocate.old_end   = %lx\n", old_end);
-	M_DEBUG_PRINT(M_DEBUG_SEGMENT, "relocate.new_start = %lx\n", new_start);
-	M_DEBUG_PRINT(M_DEBUG_SEGMENT, "relocate.new_end   = %lx\n", new_end);
+	M_LOG(M_LOG_CAT_SEGMENT, M_LOG_DEBUG, "relocate.got_start = %lx\n", got_start);
+	M_LOG(M_LOG_CAT_SEGMENT, M_LOG_DEBUG, "relocate.got_end   = %lx\n", got_end);
+	M_LOG(M_LOG_CAT_SEGMENT, M_LOG_DEBUG, "relocate.old_start = %lx\n", old_start);
+	M_LOG(M_LOG_CAT_SEGMENT, M_LOG_DEBUG, "relocate.old_end   = %lx\n", old_end);
+	M_LOG(M_LOG_CAT_SEGMENT, M_LOG_DEBUG, "relocate.new_start = %lx\n", new_start);
+	M_LOG(M_LOG_CAT_SEGMENT, M_LOG_DEBUG, "relocate.new_end   = %lx\n", new_end);
 
 	mprotect(got_start - (got_start % 4096), got_end - (got_start - (got_start % 4096)), PROT_READ | PROT_WRITE | PROT_EXEC);
 	
@@ -93,7 +94,7 @@ m_module_relocate_symbols(uintptr_t got_start,
 			symbol_new_addr = symbol_old_addr - old_start + new_start;
 			*((uintptr_t *) entry) = symbol_new_addr;
 
-			M_DEBUG_PRINT(M_DEBUG_SEGMENT, "relocate_symbol: %lx ==> %lx\n", symbol_old_addr, symbol_new_addr );
+			M_LOG(M_LOG_CAT_SEGMENT, M_LOG_DEBUG, "relocate_symbol: %lx ==> %lx\n", symbol_old_addr, symbol_new_addr );
 		}
 	}
 }
@@ -103,6 +104,11 @@ m_module_relocate_symbols(uintptr_t got_start,
  * \brief Parses the .persistent and .got sections of a given module (e.g. library)
  * if a .persistent section exists.
  *
+ * A .persistent.bss section of zero-initialized data, which the linker 
+ * script places right after .persistent, counts as part of it: the 
+ * section header returned covers both, and persistent_scn holds the data
+ * of .persistent only (NULL if the module has no .persistent).
+ *
  * \param module_path The name of the library whose header will be gathered.
  * \param module_inode The inode number of the module's binary file.
  * \param module_start The virtual address where the module is loaded in the process 
@@ -129,7 +135,10 @@ persistent_shdr_open(char *module_path,
 	GElf_Shdr          shdr;
 	size_t             shstrndx;
 	GElf_Ehdr          ehdr;
+	GElf_Shdr          bss_shdr;
 	int                have_persistent = 0;
+	int                have_bss = 0;
+	uint64_t           end;
 
 	if (module_dsr == NULL) {
 		result = M_R_INVALIDARG;
@@ -169,8 +178,25 @@ persistent_shdr_open(char *module_path,
 			module_dsr->persistent_scn = scn;
 			PM_MEMCPY((void *) &module_dsr->persistent_shdr, &shdr, sizeof(GElf_Shdr));
 			have_persistent = 1;
-			break;
-		}			
+		} else if (strcmp(name, ".persistent.bss") == 0) {
+			PM_MEMCPY((void *) &bss_shdr, &shdr, sizeof(GElf_Shdr));
+			have_bss = 1;
+		}
+	}
+
+	if (have_bss && !have_persistent) {
+		module_dsr->persistent_scn = NULL;
+		PM_MEMCPY((void *) &module_dsr->persistent_shdr, &bss_shdr, sizeof(GElf_Shdr));
+		have_persistent = 1;
+	} else if (have_bss) {
+		end = module_dsr->persistent_shdr.sh_addr + module_dsr->persistent_shdr.sh_size;
+		if (bss_shdr.sh_addr + bss_shdr.sh_size > end) {
+			end = bss_shdr.sh_addr + bss_shdr.sh_size;
+		}
+		if (bss_shdr.sh_addr < module_dsr->persistent_shdr.sh_addr) {
+			module_dsr->persistent_shdr.sh_addr = bss_shdr.sh_addr;
+		}
+		module_dsr->persistent_shdr.sh_size = end - module_dsr->persistent_shdr.sh_addr;
 	}
 
 	if (have_persistent) {
@@ -214,15 +240,147 @@ persistent_shdr_close(module_dsr_t *module_dsr)
 }
 
 
+/*!
+ * \brief Opens the ELF object of a module found in the module cache, for 
+ * reading its .persistent section.
+ */
+m_result_t
+m_module_open(module_dsr_t *module_dsr)
+{
+	if (module_dsr->elf) {
+		return M_R_SUCCESS;
+	}
+	return persistent_shdr_open(module_dsr->module_path, 
+	                            module_dsr->module_inode, 
+	                            module_dsr->module_start, 
+	                            module_dsr);
+}
+
+
+static inline
+uint64_t
+modcache_mtime_ns(struct stat *st)
+{
+	return (uint64_t) st->st_mtim.tv_sec * 1000000000ULL + st->st_mtim.tv_nsec;
+}
+
+
+static inline
+uint32_t
+modcache_home(m_modcache_t *cache, uint64_t inode)
+{
+	return (uint32_t) ((inode * 0x9E3779B97F4A7C15ULL) >> 32) % cache->n;
+}
+
+
+static
+m_modcache_entry_t *
+modcache_lookup(m_modcache_t *cache, struct stat *st)
+{
+	m_modcache_entry_t *e;
+	uint32_t           home = modcache_home(cache, st->st_ino);
+	int                i;
+
+	for (i=0; i < M_MODCACHE_PROBE; i++) {
+		e = &cache->entries[(home + i) % cache->n];
+		if ((e->flags & M_MODCACHE_VALID) && 
+		    e->inode == st->st_ino && 
+		    e->mtime_ns == modcache_mtime_ns(st) && 
+		    e->size == (uint64_t) st->st_size) 
+		{
+			return e;
+		}
+	}
+	return NULL;
+}
+
+
+/*
+ * Entries are a cache line each, so an entry is made durable with a 
+ * single flush; it is invalidated while rewritten, and a crash then only 
+ * loses it from the cache.
+ */
+static
+void
+modcache_insert(m_modcache_t *cache, struct stat *st, module_dsr_t *module_dsr)
+{
+	m_modcache_entry_t *e = NULL;
+	m_modcache_entry_t *slot;
+	uint32_t           home = modcache_home(cache, st->st_ino);
+	uint64_t           val;
+	int                i;
+
+	/* A free slot, else the stale entry of the same file, else home */
+	for (i=0; i < M_MODCACHE_PROBE; i++) {
+		slot = &cache->entries[(home + i) % cache->n];
+		if (!(slot->flags & M_MODCACHE_VALID) || slot->inode == st->st_ino) {
+			e = slot;
+			break;
+		}
+	}
+	if (!e) {
+		e = &cache->entries[home];
+	}
+	val = 0;
+	PM_EQU(e->flags, val); /* PCM STORE */
+	PCM_WB_FLUSH(NULL, (volatile pcm_word_t *) &e->flags);
+	PCM_PERSIST_BARRIER(NULL);
+
+	val = st->st_ino;
+	PM_EQU(e->inode, val); /* PCM STORE */
+	val = modcache_mtime_ns(st);
+	PM_EQU(e->mtime_ns, val); /* PCM STORE */
+	val = st->st_size;
+	PM_EQU(e->size, val); /* PCM STORE */
+	val = module_dsr ? module_dsr->persistent_shdr.sh_addr : 0;
+	PM_EQU(e->persistent_addr, val); /* PCM STORE */
+	val = module_dsr ? module_dsr->persistent_shdr.sh_size : 0;
+	PM_EQU(e->persistent_size, val); /* PCM STORE */
+	val = module_dsr ? module_dsr->GOT_shdr.sh_addr : 0;
+	PM_EQU(e->GOT_addr, val); /* PCM STORE */
+	val = module_dsr ? module_dsr->GOT_shdr.sh_size : 0;
+	PM_EQU(e->GOT_size, val); /* PCM STORE */
+	PCM_WB_FLUSH(NULL, (volatile pcm_word_t *) e);
+	PCM_PERSIST_BARRIER(NULL);
+
+	val = M_MODCACHE_VALID | (module_dsr ? M_MODCACHE_PERSISTENT : 0);
+	PM_EQU(e->flags, val); /* PCM STORE */
+	PCM_WB_FLUSH(NULL, (volatile pcm_word_t *) &e->flags);
+	PCM_PERSIST_BARRIER(NULL);
+}
+
+
+/* Fills in the descriptor of a module with a .persistent section from its cache entry */
+static
+void
+modcache_fill_dsr(m_modcache_entry_t *e, char *module_path, uint64_t module_inode, 
+                  uintptr_t module_start, module_dsr_t *module_dsr)
+{
+	memset(module_dsr, 0, sizeof(*module_dsr));
+	PM_STRCPY(module_dsr->module_path, module_path);
+	module_dsr->module_start = module_start;
+	module_dsr->module_inode = module_inode;
+	module_dsr->fd = -1;
+	module_dsr->elf = NULL;
+	module_dsr->persistent_scn = NULL;
+	module_dsr->persistent_shdr.sh_addr = e->persistent_addr;
+	module_dsr->persistent_shdr.sh_size = e->persistent_size;
+	module_dsr->GOT_shdr.sh_addr = e->GOT_addr;
+	module_dsr->GOT_shdr.sh_size = e->GOT_size;
+}
+
+
 /*!
  * Retrieve the list of loaded modules (e.g. libraries) that need to have their
  * persistent data section mapped into this process.
  *
  * \param module_dsr_listp should point to the head of the list. This structure will
  *  be written with the list of modules which should be loaded in this address space.
+ * \param cache if not NULL, modules found in it are not parsed, and modules 
+ *  parsed are added to it.
  */
 m_result_t 
-m_module_create_module_dsr_list(struct list_head *module_dsr_listp)
+m_module_create_module_dsr_list(struct list_head *module_dsr_listp, m_modcache_t *cache)
 {
 	char      fname[64]; /* /proc/<pid>/exe */
 	pid_t     pid;
@@ -231,6 +389,10 @@ m_module_create_module_dsr_list(struct list_head *module_dsr_listp)
 	char      perm[5], dev[6], mapname[M_MODULE_PATH_MAX];
 	uint64_t  start, end, inode, foo;
 	char      prev_mapname[M_MODULE_PATH_MAX];
+	struct stat        st;
+	int                have_stat;
+	m_result_t         rv;
+	m_modcache_entry_t *e;
 	module_dsr_t *module_dsr = NULL;
 	prev_mapname[0] = '\0';  /* Without it we get undefined behavior for strcmp() below */
 	
@@ -257,13 +419,27 @@ m_module_create_module_dsr_list(struct list_head *module_dsr_listp)
 				return M_R_FAILURE;
 			}
 		}
+		/* A module's mappings are consecutive; the first one is its start */
 		if (strlen(mapname) > 0 && strcmp(prev_mapname, mapname) != 0) {
-			if (persistent_shdr_open(mapname, inode, start, module_dsr)
-		    	== M_R_SUCCESS)
-			{
+			PM_STRCPY(prev_mapname, mapname);
+			have_stat = cache && stat(mapname, &st) == 0 && S_ISREG(st.st_mode);
+			if (have_stat && (e = modcache_lookup(cache, &st))) {
+				if (e->flags & M_MODCACHE_PERSISTENT) {
+					modcache_fill_dsr(e, mapname, inode, start, module_dsr);
+					list_add(&module_dsr->list, module_dsr_listp);
+					module_dsr = NULL;
+				}
+				continue;
+			}
+			rv = persistent_shdr_open(mapname, inode, start, module_dsr);
+			if (rv == M_R_SUCCESS) {
+				if (have_stat) {
+					modcache_insert(cache, &st, module_dsr);
+				}
 				list_add(&module_dsr->list, module_dsr_listp);
 				module_dsr = NULL; /* to allocate a new module_dsr object */
-				PM_STRCPY(prev_mapname, mapname);
+			} else if (have_stat && (rv == M_R_FAILURE || rv == M_R_INVALIDFILE)) {
+				modcache_insert(cache, &st, NULL);
 			}
 		}
 	}
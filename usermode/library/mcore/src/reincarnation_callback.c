@@ -34,12 +34,33 @@
  * \file
  * Implements the reincarnation_callback mechanism.
  *
+ * Callbacks become ready once the callbacks they depend on are done. The 
+ * initializing thread runs the ready ones that are neither parallel nor 
+ * background, in registration order, and the others go to a pool of
+ * reincarnation_threads workers. mnemosyne_reincarnation_callback_execute_all
+ * returns when every callback but the background ones and those only they
+ * lead to is done; the pool keeps running the rest.
+ *
  * \author Andres Jaan Tack <tack@cs.wisc.edu>
  */
 #include "reincarnation_callback.h"
 #include "init.h"
+#include "config.h"
+#include <mnemosyne.h>
+#include <workpool.h>
 #include <list.h>
 #include <stdlib.h>
+#include <pthread.h>
+
+/*! Callbacks that can be waited for or depended on */
+#define REINCARNATION_CALLBACKS_MAX 1024
+
+/*! States of a registered callback */
+#define CALLBACK_WAITING  0 /*!< for its dependencies */
+#define CALLBACK_READY    1 /*!< to be run by the initializing thread */
+#define CALLBACK_QUEUED   2 /*!< on the worker pool */
+#define CALLBACK_RUNNING  3
+#define CALLBACK_DONE     4
 
 
 /*! The list of registered callbacks. */
@@ -48,32 +69,256 @@ LIST_HEAD(theRegisteredCallbacks);
 /*! A registered callback, part of a list of these. */
 struct reincarnation_callback
 {
-	void (*routine)();      /*!< The callback to be executed. */
+	void (*routine)();      /*!< The callback to be executed, if registered without an argument. */
+	void (*routine_arg)(void *); /*!< Or the callback to be executed with arg. */
+	void *arg;
+	int  id;                /*!< Identifier, 0 if too many callbacks to keep one. */
+	int  flags;             /*!< MNEMOSYNE_REINCARNATION_* */
+	int  ndeps;
+	struct reincarnation_callback **deps; /*!< The callbacks this one runs after. */
+	int  pending;           /*!< Dependencies not done yet. */
+	volatile int state;     /*!< CALLBACK_* */
 	struct list_head list;  /*!< Links this callback in the context of theRegisteredCallbacks. */
 };
 typedef struct reincarnation_callback reincarnation_callback_t;
 
+/*! Protects the callbacks' states; signaled as callbacks become ready or done. */
+static pthread_mutex_t          callbacks_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t           callbacks_cond = PTHREAD_COND_INITIALIZER;
+/*! Registered callbacks by identifier - 1 */
+static reincarnation_callback_t *callbacks[REINCARNATION_CALLBACKS_MAX];
+static volatile int             callbacks_num = 0;
+static m_workpool_t             *callbacks_pool = NULL;
+
+
+static void callback_done(reincarnation_callback_t *callback);
+
+
+static
+void
+callback_run(reincarnation_callback_t *callback)
+{
+	if (callback->routine_arg) {
+		callback->routine_arg(callback->arg);
+	} else {
+		callback->routine();
+	}
+	callback_done(callback);
+}
+
+
+static
+void
+callback_task(void *arg)
+{
+	callback_run((reincarnation_callback_t *) arg);
+}
+
+
+/* Hands a callback whose dependencies are done to whoever runs it; callbacks_lock held */
+static
+void
+callback_ready(reincarnation_callback_t *callback)
+{
+	if (callbacks_pool && 
+	    (callback->flags & (MNEMOSYNE_REINCARNATION_PARALLEL | MNEMOSYNE_REINCARNATION_BACKGROUND))) 
+	{
+		callback->state = CALLBACK_QUEUED;
+		if (m_workpool_submit(callbacks_pool, callback_task, callback) == M_R_SUCCESS) {
+			return;
+		}
+	}
+	callback->state = CALLBACK_READY;
+}
+
+
+/* Marks a callback done, and readies the ones left waiting only for it */
+static
+void
+callback_done(reincarnation_callback_t *callback)
+{
+	reincarnation_callback_t *other;
+	int                      i;
+
+	pthread_mutex_lock(&callbacks_lock);
+	callback->state = CALLBACK_DONE;
+	list_for_each_entry(other, &theRegisteredCallbacks, list) {
+		if (other->state != CALLBACK_WAITING) {
+			continue;
+		}
+		for (i = 0; i < other->ndeps; i++) {
+			if (other->deps[i] == callback && --other->pending == 0) {
+				callback_ready(other);
+			}
+		}
+	}
+	pthread_cond_broadcast(&callbacks_cond);
+	pthread_mutex_unlock(&callbacks_lock);
+}
+
+
+/* Registers a callback, NULL if a dependency is not known */
+static
+reincarnation_callback_t *
+callback_create(void (*routine)(), void (*routine_arg)(void *), void *arg, 
+                int flags, const int *deps, int ndeps)
+{
+	reincarnation_callback_t *callback;
+	int                      i;
+
+	callback = (reincarnation_callback_t *) malloc(sizeof(struct reincarnation_callback));
+	callback->deps = (reincarnation_callback_t **) malloc((ndeps > 0 ? ndeps : 1) * 
+	                                                      sizeof(reincarnation_callback_t *));
+	if (callback == NULL || callback->deps == NULL) {
+		return NULL;
+	}
+	callback->routine = routine;
+	callback->routine_arg = routine_arg;
+	callback->arg = arg;
+	callback->flags = flags;
+	callback->ndeps = ndeps;
+	callback->pending = 0;
+	callback->state = CALLBACK_WAITING;
+
+	pthread_mutex_lock(&callbacks_lock);
+	for (i = 0; i < ndeps; i++) {
+		if (deps[i] < 1 || deps[i] > callbacks_num) {
+			pthread_mutex_unlock(&callbacks_lock);
+			free(callback->deps);
+			free(callback);
+			return NULL;
+		}
+		callback->deps[i] = callbacks[deps[i] - 1];
+		if (callback->deps[i]->state != CALLBACK_DONE) {
+			callback->pending++;
+		}
+	}
+	callback->id = 0;
+	if (callbacks_num < REINCARNATION_CALLBACKS_MAX) {
+		callbacks[callbacks_num] = callback;
+		callback->id = callbacks_num + 1;
+		__sync_synchronize();
+		callbacks_num++;
+	}
+	list_add_tail(&callback->list, &theRegisteredCallbacks);
+	pthread_mutex_unlock(&callbacks_lock);
+	return callback;
+}
+
 
 void mnemosyne_reincarnation_callback_register(void(*initializer)())
 {
 	if (!mnemosyne_initialized) {
-		reincarnation_callback_t* callback = (reincarnation_callback_t*) malloc(sizeof(struct reincarnation_callback));
-		callback->routine = initializer;
-		list_add_tail(&callback->list, &theRegisteredCallbacks);
+		callback_create(initializer, NULL, NULL, 0, NULL, 0);
 	} else {
 		initializer();  // We're already ready already!
 	}
 }
 
 
+int 
+mnemosyne_reincarnation_callback_register_ordered(void (*initializer)(void *), 
+                                                  void *arg, int flags, 
+                                                  const int *deps, int ndeps)
+{
+	reincarnation_callback_t *callback;
+	int                      i;
+
+	callback = callback_create(NULL, initializer, arg, flags, deps, ndeps);
+	if (callback == NULL || callback->id == 0) {
+		/* Cannot be depended on; still runs if registered in time */
+		return -1;
+	}
+	if (mnemosyne_initialized) {
+		/* Reincarnation is over: run it here once its dependencies are */
+		for (i = 0; i < ndeps; i++) {
+			mnemosyne_reincarnation_wait(deps[i]);
+		}
+		pthread_mutex_lock(&callbacks_lock);
+		callback->state = CALLBACK_RUNNING;
+		pthread_mutex_unlock(&callbacks_lock);
+		callback_run(callback);
+	}
+	return callback->id;
+}
+
+
+void
+mnemosyne_reincarnation_wait(int id)
+{
+	reincarnation_callback_t *callback;
+
+	if (id < 1 || id > callbacks_num) {
+		return;
+	}
+	callback = callbacks[id - 1];
+	if (callback->state == CALLBACK_DONE) {
+		return;
+	}
+	pthread_mutex_lock(&callbacks_lock);
+	while (callback->state != CALLBACK_DONE) {
+		pthread_cond_wait(&callbacks_cond, &callbacks_lock);
+	}
+	pthread_mutex_unlock(&callbacks_lock);
+}
+
+
 void mnemosyne_reincarnation_callback_execute_all()
 {
-	struct list_head* callback_node;
-	struct list_head* next;
-	list_for_each_safe(callback_node, next, &theRegisteredCallbacks) {
-		list_del(callback_node);
-		reincarnation_callback_t* callback = list_entry(callback_node, reincarnation_callback_t, list);
-		callback->routine();
-		free(callback);
+	reincarnation_callback_t *callback;
+	reincarnation_callback_t *ready;
+	int                      nthreads = mcore_runtime_settings.reincarnation_threads;
+	int                      offload = 0;
+	int                      blocking;
+
+	pthread_mutex_lock(&callbacks_lock);
+	list_for_each_entry(callback, &theRegisteredCallbacks, list) {
+		if (callback->flags & (MNEMOSYNE_REINCARNATION_PARALLEL | MNEMOSYNE_REINCARNATION_BACKGROUND)) {
+			offload = 1;
+		}
+	}
+	if (offload && nthreads > 0 && m_workpool_create(&callbacks_pool, nthreads) != M_R_SUCCESS) {
+		callbacks_pool = NULL;
+	}
+	list_for_each_entry(callback, &theRegisteredCallbacks, list) {
+		if (callback->state == CALLBACK_WAITING && callback->pending == 0) {
+			callback_ready(callback);
+		}
+	}
+
+	for (;;) {
+		ready = NULL;
+		blocking = 0;
+		list_for_each_entry(callback, &theRegisteredCallbacks, list) {
+			if (callback->state == CALLBACK_READY) {
+				ready = callback;
+				break;
+			}
+			if (callback->state != CALLBACK_DONE && 
+			    !(callback->flags & MNEMOSYNE_REINCARNATION_BACKGROUND))
+			{
+				blocking = 1;
+			}
+		}
+		if (ready) {
+			ready->state = CALLBACK_RUNNING;
+			pthread_mutex_unlock(&callbacks_lock);
+			callback_run(ready);
+			pthread_mutex_lock(&callbacks_lock);
+		} else if (blocking) {
+			pthread_cond_wait(&callbacks_cond, &callbacks_lock);
+		} else {
+			break;
+		}
+	}
+	pthread_mutex_unlock(&callbacks_lock);
+}
+
+
+void mnemosyne_reincarnation_callback_fini()
+{
+	if (callbacks_pool) {
+		m_workpool_destroy(callbacks_pool);
+		callbacks_pool = NULL;
 	}
 }
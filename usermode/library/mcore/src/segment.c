@@ -34,6 +34,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/mman.h>
+#include <sys/ioctl.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
@@ -42,13 +43,21 @@
 #include <sysexits.h>
 #include <assert.h>
 #include <dirent.h> 
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sched.h>
 /* Mnemosyne common header files */
 #define _M_DEBUG_BUILD
 #include <debug.h>
 #include <result.h>
 #include <pm_instr.h>
+#include <workpool.h>
 /* Private local header files */
 #include "mcore_i.h"
+#include "init.h"
 #include "files.h"
 #include "segment.h"
 #include "module.h"
@@ -56,14 +65,32 @@
 #include "pregionlayout.h"
 #include "config.h"
 
+#ifndef MPOL_PREFERRED
+# define MPOL_PREFERRED 1
+#endif
+#ifndef MPOL_INTERLEAVE
+# define MPOL_INTERLEAVE 3
+#endif
+
+#define NUMA_MAX_NODES 256
+
 
 /**
  * The directory where persistent segment backing stores are kept.
  */
 #define SEGMENTS_DIR mcore_runtime_settings.segments_dir
 
+/**
+ * The directory where the backing stores of tiered segments are kept.
+ */
+#define SEGMENTS_TIER_DIR mcore_runtime_settings.segments_tier_dir
+
+/**
+ * The directory where the backing stores of the log pool are kept, if not
+ * in SEGMENTS_DIR; see segment_log_dir.
+ */
+#define LOG_SEGMENTS_DIR mcore_runtime_settings.log_segments_dir
 
-#define M_DEBUG_SEGMENT 1
 
 m_segtbl_t m_segtbl;
 
@@ -72,8 +99,101 @@ m_segtbl_t m_segtbl;
 #undef TRY_ALLOC_IN_HOLES
 
 
+/* Used when a device-DAX device does not report its alignment */
+#define DEVDAX_DEFAULT_ALIGN (2*1024*1024)
+
+#ifndef MADV_POPULATE_WRITE
+# define MADV_POPULATE_WRITE 23
+#endif
+
+/* Page size persistent segments are aligned to, to be mapped with huge pages */
+#define SEGMENT_PAGE_SIZE  (1ULL << mcore_runtime_settings.segments_page_log2)
+#define SEGMENT_PAGE_ALIGN(x) (((x) + SEGMENT_PAGE_SIZE - 1) & ~(SEGMENT_PAGE_SIZE - 1))
+
+/* Maximum number of threads of a prefault touch pass */
+#define PREFAULT_MAX_THREADS 64
+
+/*
+ * Backing store backend. Files are mapped through the page cache unless 
+ * they live on a DAX file system, where MAP_SYNC maps them directly and 
+ * CPU cache flushes alone make stores durable. A device-DAX segments_dir 
+ * is mapped whole at the start of the reserved region, and each segment 
+ * lives at the device offset of its address in the region.
+ */
+static m_segment_backend_t segment_backend = SEGMENT_BACKEND_FILE;
+static int                 segment_backend_probing = 0;  /* auto: fall back to FILE if MAP_SYNC fails */
+static int                 segment_flush_persistent = 0; /* flushes are enough to persist the segments */
+static int                 devdax_fd = -1;
+static size_t              devdax_size = 0;
+
+/* 
+ * Base relocatable persistent pointers are decoded against (see pptr.h). 
+ * Segments are mapped at their recorded addresses, so it is the start of 
+ * the reserved region.
+ */
+uintptr_t                  m_pregion_base = PSEGMENT_RESERVED_REGION_START;
+
+/* Whether the reserved region is mapped PROT_NONE for segments to replace */
+static int                 psegment_region_reserved = 0;
+
+/* End of the reserved region, as formatted in the segment table header */
+static uintptr_t           psegment_region_end = PSEGMENT_RESERVED_REGION_END;
+
+/* Serializes moving segments between tiers, and the number tiered out */
+static pthread_mutex_t     segment_tier_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int                 segment_ntiered = 0;
+
+/* Serializes chaining extension blocks to the segment table */
+static pthread_mutex_t     segtbl_extend_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* 
+ * A new extension block is chained when this few free entries are left, 
+ * so that concurrent pmap calls leave one for the block's own entry.
+ */
+#define SEGMENT_TABLE_EXT_RESERVE 16
+
+
 static inline void *segment_map(void *addr, size_t size, int prot, int flags, int segment_fd);
 static m_result_t segidx_find_entry_using_index(m_segidx_t *segidx, uint32_t index, m_segidx_entry_t **entryp);
+static void segment_table_reserve(m_segtbl_t *segtbl);
+static void *segment_map2(void *addr, size_t size, int prot, int flags, char *file);
+static void segment_log_dir(int node, char *dir);
+
+
+/* Flushes a range of persistent memory and waits for it to be durable */
+static
+void
+segment_persist_range(void *start, size_t size)
+{
+	uintptr_t addr;
+
+	for (addr = (uintptr_t) start & ~(CACHELINE_SIZE - 1); addr < (uintptr_t) start + size; addr += CACHELINE_SIZE) {
+		PCM_WB_FLUSH(NULL, (volatile pcm_word_t *) addr);
+	}
+	PCM_PERSIST_BARRIER(NULL);
+}
+
+
+/* 
+ * Entry of the segment table with the given index, or NULL if the index 
+ * falls in an extension block not chained yet.
+ */
+static
+m_segtbl_entry_t *
+segtbl_entry(m_segtbl_t *segtbl, uint32_t index)
+{
+	uint32_t block;
+
+	if (index < SEGMENT_TABLE_NUM_ENTRIES) {
+		return &segtbl->entries[index];
+	}
+	index -= SEGMENT_TABLE_NUM_ENTRIES;
+	block = index / SEGMENT_TABLE_EXT_ENTRIES;
+	if (block >= (uint32_t) segtbl->next) {
+		return NULL;
+	}
+	return &segtbl->ext[block]->entries[index % SEGMENT_TABLE_EXT_ENTRIES];
+}
 
 
 /**
@@ -98,7 +218,11 @@ verify_backing_stores(m_segtbl_t *segtbl)
 	uint32_t         segment_id; 
 	uint64_t         segment_module_id; /* This is valid for the .persistent backing stores */
 	m_segidx_entry_t *ientry;
+	m_segtbl_entry_t *tentry;
 	char             complete_path[256];
+	char             log_dir[256];
+	int              nnodes;
+	int              node;
 
 	d = opendir(SEGMENTS_DIR);
 	if (d) {
@@ -106,14 +230,23 @@ verify_backing_stores(m_segtbl_t *segtbl)
 			n = sscanf(dir->d_name, "%u.%lu\n", &segment_id, &segment_module_id);
 			if (n == 2) {
 				index = segment_id;
-				M_DEBUG_PRINT(M_DEBUG_SEGMENT, "Verifying backing store: %u.%lu\n", segment_id, segment_module_id);
+				M_LOG(M_LOG_CAT_SEGMENT, M_LOG_DEBUG, "Verifying backing store: %u.%lu\n", segment_id, segment_module_id);
 				/* Backing store has a valid entry in the segment table? */
-				if (!(segtbl->entries[index].flags & SGTB_VALID_ENTRY)) {
+				tentry = segtbl_entry(segtbl, index);
+				if (!tentry || !(tentry->flags & SGTB_VALID_ENTRY)) {
 					/* No valid entry; erase backing store */
 					sprintf(complete_path, "%s/%s", SEGMENTS_DIR, dir->d_name);
-					M_DEBUG_PRINT(M_DEBUG_SEGMENT, "Remove backing store: %s\n", complete_path);
+					M_LOG(M_LOG_CAT_SEGMENT, M_LOG_DEBUG, "Remove backing store: %s\n", complete_path);
 					unlink(complete_path);
+					continue;
 				}	
+				/* Tiered out after its contents reached the tier directory */
+				if (tentry->flags & SGTB_TIERED) {
+					sprintf(complete_path, "%s/%s", SEGMENTS_DIR, dir->d_name);
+					M_LOG(M_LOG_CAT_SEGMENT, M_LOG_DEBUG, "Remove tiered backing store: %s\n", complete_path);
+					unlink(complete_path);
+					continue;
+				}
 				/* If this is .persistent backing store then update the index */
 				if (segment_module_id != (uint64_t) (-1LLU)) {
 					if (segidx_find_entry_using_index(segtbl->idx, index, &ientry)
@@ -127,38 +260,316 @@ verify_backing_stores(m_segtbl_t *segtbl)
 		}
 		closedir(d);
 	}
+	/* Log pool backing stores of entries no longer valid */
+	if (LOG_SEGMENTS_DIR[0] != '\0' && segment_backend != SEGMENT_BACKEND_DEVDAX) {
+		nnodes = strstr(LOG_SEGMENTS_DIR, "%d") ? m_numa_nodes() : 1;
+		for (node = 0; node < nnodes; node++) {
+			segment_log_dir(node, log_dir);
+			if (strcmp(log_dir, SEGMENTS_DIR) == 0 || !(d = opendir(log_dir))) {
+				continue;
+			}
+			while ((dir = readdir(d)) != NULL) {
+				if (sscanf(dir->d_name, "%u.%lu\n", &segment_id, &segment_module_id) != 2) {
+					continue;
+				}
+				tentry = segtbl_entry(segtbl, segment_id);
+				if (!tentry || !(tentry->flags & SGTB_VALID_ENTRY) || !(tentry->flags & SGTB_LOGS)) {
+					sprintf(complete_path, "%s/%s", log_dir, dir->d_name);
+					M_LOG(M_LOG_CAT_SEGMENT, M_LOG_DEBUG, "Remove stale log backing store: %s\n", complete_path);
+					unlink(complete_path);
+				}
+			}
+			closedir(d);
+		}
+	}
+	/* Copies in the tier directory of segments tiered in, or not tiered out */
+	if (SEGMENTS_TIER_DIR[0] != '\0' && (d = opendir(SEGMENTS_TIER_DIR))) {
+		while ((dir = readdir(d)) != NULL) {
+			if (sscanf(dir->d_name, "%u.%lu\n", &segment_id, &segment_module_id) != 2) {
+				continue;
+			}
+			tentry = segtbl_entry(segtbl, segment_id);
+			if (!tentry || !(tentry->flags & SGTB_VALID_ENTRY) || !(tentry->flags & SGTB_TIERED)) {
+				sprintf(complete_path, "%s/%s", SEGMENTS_TIER_DIR, dir->d_name);
+				M_LOG(M_LOG_CAT_SEGMENT, M_LOG_DEBUG, "Remove stale tier copy: %s\n", complete_path);
+				unlink(complete_path);
+			}
+		}
+		closedir(d);
+	}
+}
+
+
+static
+int
+devdax_sysfs_read(struct stat *st, const char *attr, unsigned long long *valp)
+{
+	char path[256];
+	FILE *fp;
+	int  rv = -1;
+
+	sprintf(path, "/sys/dev/char/%u:%u/%s", major(st->st_rdev), minor(st->st_rdev), attr);
+	if ((fp = fopen(path, "r")) != NULL) {
+		if (fscanf(fp, "%llu", valp) == 1) {
+			rv = 0;
+		}
+		fclose(fp);
+	}
+	return rv;
+}
+
+
+/* Device-DAX devices are the character devices of the dax subsystem */
+static
+int
+is_devdax(const char *path, struct stat *st)
+{
+	char    link[256];
+	char    target[256];
+	char    *name;
+	ssize_t n;
+
+	if (stat(path, st) != 0 || !S_ISCHR(st->st_mode)) {
+		return 0;
+	}
+	sprintf(link, "/sys/dev/char/%u:%u/subsystem", major(st->st_rdev), minor(st->st_rdev));
+	if ((n = readlink(link, target, sizeof(target) - 1)) < 0) {
+		return 0;
+	}
+	target[n] = '\0';
+	name = strrchr(target, '/');
+	return strcmp(name ? name + 1 : target, "dax") == 0;
+}
+
+
+/**
+ * \brief Maps as much of the device-DAX device as fits the reserved region.
+ */
+static
+m_result_t
+devdax_map_device(struct stat *st)
+{
+	unsigned long long size;
+	unsigned long long align;
+	void               *p;
+
+	if ((devdax_fd = open(SEGMENTS_DIR, O_RDWR)) < 0) {
+		return M_R_FAILURE;
+	}
+	if (devdax_sysfs_read(st, "size", &size) != 0) {
+		return M_R_FAILURE;
+	}
+	if (devdax_sysfs_read(st, "align", &align) != 0 || align == 0) {
+		align = DEVDAX_DEFAULT_ALIGN;
+	}
+	/* The segment table header, read later, may reserve less */
+	if (size > PSEGMENT_RESERVED_REGION_SIZE) {
+		size = PSEGMENT_RESERVED_REGION_SIZE;
+	}
+	size &= ~(align - 1);
+	p = mmap((void *) PSEGMENT_RESERVED_REGION_START, size, PROT_READ|PROT_WRITE, 
+	         MAP_SHARED_VALIDATE | MAP_SYNC | MAP_FIXED, devdax_fd, 0);
+	if (p == MAP_FAILED) {
+		return M_R_FAILURE;
+	}
+	devdax_size = size;
+	M_LOG(M_LOG_CAT_SEGMENT, M_LOG_DEBUG, "Mapped device-DAX %s: %llu bytes\n", SEGMENTS_DIR, size);
+	return M_R_SUCCESS;
+}
+
+
+/**
+ * \brief Reserves the address space region of persistent segments.
+ *
+ * Runs ahead of the library's other constructors, before the runtime 
+ * configuration is read, so it reserves the largest region there may be. 
+ * Kernels without MAP_FIXED_NOREPLACE take the address as a hint, hence 
+ * the check of where the reservation went.
+ */
+static void segment_reserve_region(void) __attribute__(( constructor(101) ));
+
+static
+void
+segment_reserve_region(void)
+{
+	void *p;
+
+	if (psegment_region_reserved) {
+		return;
+	}
+	p = mmap((void *) PSEGMENT_RESERVED_REGION_START, PSEGMENT_RESERVED_REGION_SIZE, 
+	         PROT_NONE, 
+	         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED_NOREPLACE, 
+	         -1, 0);
+	if (p == MAP_FAILED) {
+		M_WARNING("Cannot reserve the persistent segment region: %s\n", strerror(errno));
+		return;
+	}
+	if (p != (void *) PSEGMENT_RESERVED_REGION_START) {
+		munmap(p, PSEGMENT_RESERVED_REGION_SIZE);
+		M_WARNING("Cannot reserve the persistent segment region: address taken\n");
+		return;
+	}
+	psegment_region_reserved = 1;
+}
+
+
+/**
+ * \brief Picks the backing store backend for segments_dir.
+ *
+ * A device-DAX device is always used as such. Otherwise segments_backend 
+ * chooses between page cache files ("file"), DAX files ("fsdax") or DAX 
+ * files where the file system supports them ("auto").
+ */
+static
+void
+segment_backend_select(void)
+{
+	struct stat st;
+	char        *backend = mcore_runtime_settings.segments_backend;
+
+	if (is_devdax(SEGMENTS_DIR, &st)) {
+		if (devdax_map_device(&st) != M_R_SUCCESS) {
+			M_ERROR("Cannot map device-DAX device %s\n", SEGMENTS_DIR);
+		}
+		segment_backend = SEGMENT_BACKEND_DEVDAX;
+		segment_flush_persistent = 1;
+		return;
+	}
+	if (strcmp(backend, "devdax") == 0) {
+		M_ERROR("segments_dir %s is not a device-DAX device\n", SEGMENTS_DIR);
+	} else if (strcmp(backend, "file") == 0) {
+		segment_backend = SEGMENT_BACKEND_FILE;
+	} else if (strcmp(backend, "fsdax") == 0) {
+		segment_backend = SEGMENT_BACKEND_FSDAX;
+	} else {
+		segment_backend = SEGMENT_BACKEND_FSDAX;
+		segment_backend_probing = 1;
+	}
+}
+
+
+/* Clears the segment table of a device-DAX device, which has no files to remove */
+static
+void
+devdax_reset(void)
+{
+	PM_MEMSET((void *) SEGMENT_TABLE_START, 0, SEGMENT_TABLE_MAP_SIZE);
+	segment_persist_range((void *) SEGMENT_TABLE_START, SEGMENT_TABLE_MAP_SIZE);
+}
+
+
+typedef struct {
+	uintptr_t start;
+	uintptr_t end;
+	size_t    step;
+} prefault_range_t;
+
+
+/*
+ * Faults a page in for writing without changing its contents, so that it 
+ * is safe on segments holding live data.
+ */
+static
+void
+prefault_worker(void *arg, int i)
+{
+	prefault_range_t *r = &((prefault_range_t *) arg)[i];
+	uintptr_t        addr;
+
+	for (addr = r->start; addr < r->end; addr += r->step) {
+		__sync_fetch_and_add((volatile uint64_t *) addr, 0);
+	}
+}
+
+
+/**
+ * \brief Faults in the pages of a mapped segment so that the first 
+ * transactions do not take the page faults.
+ *
+ * "populate" asks the kernel to do it: MADV_POPULATE_WRITE maps the pages 
+ * writable, which MAP_POPULATE does not do for shared mappings of file 
+ * systems that track dirty pages, and MAP_POPULATE is what older kernels 
+ * have. "touch", and populate for a device-DAX device on older kernels, 
+ * touches every page from segments_prefault_threads threads.
+ */
+static
+void
+segment_prefault(void *addr, size_t size, int populated)
+{
+	prefault_range_t ranges[PREFAULT_MAX_THREADS];
+	m_workpool_t     *pool;
+	char             *mode = mcore_runtime_settings.segments_prefault;
+	int              nthreads = mcore_runtime_settings.segments_prefault_threads;
+	size_t           step = SEGMENT_PAGE_SIZE;
+	size_t           chunk;
+	int              i;
+
+	if (strcmp(mode, "populate") == 0) {
+		if (madvise(addr, size, MADV_POPULATE_WRITE) == 0 || populated) {
+			return;
+		}
+	} else if (strcmp(mode, "touch") != 0) {
+		return;
+	}
+	if (((uintptr_t) addr | size) & (step - 1)) {
+		step = PAGE_SIZE;
+	}
+	if (nthreads > PREFAULT_MAX_THREADS) {
+		nthreads = PREFAULT_MAX_THREADS;
+	}
+	chunk = ((size / step + nthreads - 1) / nthreads) * step;
+	for (i = 0; i < nthreads; i++) {
+		ranges[i].start = (uintptr_t) addr + i * chunk;
+		ranges[i].end = ranges[i].start + chunk;
+		if (ranges[i].end > (uintptr_t) addr + size) {
+			ranges[i].end = (uintptr_t) addr + size;
+		}
+		ranges[i].step = step;
+	}
+	if (m_workpool_create(&pool, nthreads - 1) != M_R_SUCCESS) {
+		for (i = 0; i < nthreads; i++) {
+			prefault_worker(ranges, i);
+		}
+		return;
+	}
+	m_workpool_parallel_for(pool, nthreads, prefault_worker, ranges);
+	m_workpool_destroy(pool);
 }
 
 
+/*
+ * Sizes a new backing store with a single call. The file ends one byte past
+ * its pages, which m_check_backing_store relies on. Setting the size rather
+ * than writing that byte keeps the last page out of the page cache until it
+ * is mapped, and fallocate also allocates the blocks up front so that the 
+ * first touches do not. hugetlbfs files can only be sized in huge pages.
+ */
 static
 int 
 create_backing_store(char *file, unsigned long long size)
 {
-	int      fd;
+	int                 fd;
+	int                 rc;
 	unsigned long long  roundup_size;
-	char     buf[1]; 
-	buf[0] = 0;        /* Keeps valgrind happy by writting a well defined byte */
 	
+	if (segment_backend == SEGMENT_BACKEND_DEVDAX) {
+		return devdax_fd;
+	}
 	fd = open(file, O_RDWR|O_CREAT|O_TRUNC, S_IRUSR | S_IWUSR);
 	if (fd < 0) {
 		return fd;
 	}
-	/* TRICK: We could create an empty file by seeking to the end of the file 
-	 * and writing a single zero byte there. However this would cause a page 
-	 * fault at the last page of the file and bring the page into the OS page 
-	 * cache. This would prevent us from observing the virtual to 
-	 * physical persistent frame mapping later after the file is mmaped to a persistent
-	 * memory region. This is an artifact of our implementation of the persistent 
-	 * mapping subsystem in the kernel. To avoid this problem we round up the file
-	 * of the size to N * PAGE_SIZE, where N=NUM_PAGES(size), and write a single 
-	 * byte at location N*PAGE_SIZE+1. 
-	 *
-	 * Another way would be to bypass the file cache and use DIRECT I/O.
-	 */
-	printf("file = %s, size = %llu, size_of_pages = %llu \n", file, size, SIZEOF_PAGES(size));
+	M_LOG(M_LOG_CAT_SEGMENT, M_LOG_DEBUG, "file = %s, size = %llu, size_of_pages = %llu\n", file, size, (unsigned long long) SIZEOF_PAGES(size));
 	roundup_size = SIZEOF_PAGES(size);
-	assert(lseek64(fd, roundup_size, SEEK_SET) !=  (off_t) -1);
-	write(fd, buf, 1);
+	if (segment_backend == SEGMENT_BACKEND_FSDAX || mcore_runtime_settings.segments_preallocate) {
+		rc = fallocate(fd, 0, 0, roundup_size + 1);
+	} else {
+		rc = ftruncate(fd, roundup_size + 1);
+	}
+	if (rc != 0) {
+		ftruncate(fd, roundup_size + SEGMENT_PAGE_SIZE);
+	}
 	fsync(fd); /* make sure the file metadata is synced */
 	/* FIXME: sync directory as well to reflect the new file entry. */
 
@@ -183,6 +594,32 @@ m_check_backing_store(char *path, ssize_t size)
 	return rv;
 }
 
+/*
+ * The lookup array is a sequence lock protected copy of the mapped list: 
+ * writers, serialized by the index lock, make the sequence number odd 
+ * while they shift entries, and lookups retry when it changed under them.
+ */
+static
+void
+segidx_ranges_insert(m_segidx_t *segidx, m_segidx_entry_t *new_entry)
+{
+	m_segidx_range_t *ranges = segidx->ranges;
+	uintptr_t        start = new_entry->segtbl_entry->start;
+	int              n = segidx->nranges;
+	int              i;
+
+	__sync_fetch_and_add(&segidx->seq, 1);
+	for (i = n; i > 0 && ranges[i-1].start > start; i--) {
+		ranges[i] = ranges[i-1];
+	}
+	ranges[i].start = start;
+	ranges[i].end = start + new_entry->segtbl_entry->size;
+	ranges[i].entry = new_entry;
+	segidx->nranges = n + 1;
+	__sync_fetch_and_add(&segidx->seq, 1);
+}
+
+
 static 
 m_result_t
 segidx_insert_entry_ordered(m_segidx_t *segidx, m_segidx_entry_t *new_entry, int lock)
@@ -190,8 +627,9 @@ segidx_insert_entry_ordered(m_segidx_t *segidx, m_segidx_entry_t *new_entry, int
 	m_segidx_entry_t *ientry;
 
 	if (lock) {
-		pthread_mutex_lock(&(segidx->mutex));
+		m_mcslock_lock(&(segidx->lock));
 	}
+	segidx_ranges_insert(segidx, new_entry);
 	/* 
 	 * Find the right location of the entry so that the list is ordered
 	 * incrementally by start address. 
@@ -206,19 +644,50 @@ segidx_insert_entry_ordered(m_segidx_t *segidx, m_segidx_entry_t *new_entry, int
 
 out:
 	if (lock) {
-		pthread_mutex_unlock(&(segidx->mutex));
+		m_mcslock_unlock(&(segidx->lock));
 	}
 	return M_R_SUCCESS;
 }
 
 
+/* 
+ * Adds the entries of a block of the segment table, numbered from first, 
+ * to the index. Called with the index lock held, or before the index is 
+ * shared.
+ */
+static
+void
+segidx_add_block(m_segidx_t *segidx, m_segtbl_entry_t *block, uint32_t first, uint32_t n)
+{
+	m_segidx_entry_t *entries = segidx->all_entries;
+	m_segtbl_entry_t *segtbl_entry;
+	uint32_t         i;
+
+	for (i=first; i < first + n; i++) {
+		segtbl_entry = entries[i].segtbl_entry = &block[i - first];
+		entries[i].index = i;
+		entries[i].module_id = (uint64_t) (-1ULL);
+		if (segtbl_entry->flags & SGTB_VALID_ENTRY) {
+			segidx_insert_entry_ordered(segidx, &(entries[i]), 0);
+		} else {
+			list_add_tail(&(entries[i].list), &(segidx->free_entries.list));
+			segidx->nfree++;
+		}
+	}
+}
+
+
+/*
+ * The index has room for the extension blocks there are and for 
+ * segments_table_extensions more.
+ */
 m_result_t
 segidx_create(m_segtbl_t *_segtbl, m_segidx_t **_segidxp)
 {
 	m_result_t       rv;
 	m_segidx_t       *_segidx;
 	m_segidx_entry_t *entries;
-	m_segtbl_entry_t *segtbl_entry;
+	uint32_t         nentries;
 	int              i;
 
 	if (!(_segidx = (m_segidx_t *) malloc(sizeof(m_segidx_t)))) {
@@ -226,25 +695,34 @@ segidx_create(m_segtbl_t *_segtbl, m_segidx_t **_segidxp)
 		goto out;
 	}
 	
-	if (!(entries = (m_segidx_entry_t *) calloc(SEGMENT_TABLE_NUM_ENTRIES,
+	nentries = SEGMENT_TABLE_NUM_ENTRIES + 
+	           (uint32_t) _segtbl->max_next * SEGMENT_TABLE_EXT_ENTRIES;
+	if (!(entries = (m_segidx_entry_t *) calloc(nentries,
 	                                            sizeof(m_segidx_entry_t))))
 	{
 		rv = M_R_NOMEMORY;
 		goto err_calloc;
 	}
-	pthread_mutex_init(&(_segidx->mutex), NULL);
+	if (!(_segidx->ranges = (m_segidx_range_t *) calloc(nentries,
+	                                                    sizeof(m_segidx_range_t))))
+	{
+		free(entries);
+		rv = M_R_NOMEMORY;
+		goto err_calloc;
+	}
+	_segidx->seq = 0;
+	_segidx->nranges = 0;
+	_segidx->nentries = nentries;
+	_segidx->nfree = 0;
+	m_mcslock_init(&(_segidx->lock));
 	_segidx->all_entries = entries;
 	INIT_LIST_HEAD(&(_segidx->mapped_entries.list));
 	INIT_LIST_HEAD(&(_segidx->free_entries.list));
-	for (i=0; i < SEGMENT_TABLE_NUM_ENTRIES; i++) {
-		segtbl_entry = entries[i].segtbl_entry = &_segtbl->entries[i];
-		entries[i].index = i;
-		entries[i].module_id = (uint64_t) (-1ULL);
-		if (segtbl_entry->flags & SGTB_VALID_ENTRY) {
-			segidx_insert_entry_ordered(_segidx, &(entries[i]), 0);
-		} else {
-			list_add_tail(&(entries[i].list), &(_segidx->free_entries.list));
-		}
+	segidx_add_block(_segidx, _segtbl->entries, 0, SEGMENT_TABLE_NUM_ENTRIES);
+	for (i=0; i < _segtbl->next; i++) {
+		segidx_add_block(_segidx, _segtbl->ext[i]->entries, 
+		                 SEGMENT_TABLE_NUM_ENTRIES + i * SEGMENT_TABLE_EXT_ENTRIES, 
+		                 SEGMENT_TABLE_EXT_ENTRIES);
 	}
 	*_segidxp = _segidx;
 	rv = M_R_SUCCESS;
@@ -274,10 +752,11 @@ segidx_alloc_entry(m_segidx_t *segidx, m_segidx_entry_t **entryp)
 	struct list_head *free_head;
 	
 
-	pthread_mutex_lock(&(segidx->mutex));
-	if ((free_head = segidx->free_entries.list.next)) {
+	m_mcslock_lock(&(segidx->lock));
+	if ((free_head = segidx->free_entries.list.next) != &(segidx->free_entries.list)) {
 		entry = list_entry(free_head, m_segidx_entry_t, list);
 		list_del_init(&(entry->list));
+		segidx->nfree--;
 	} else {
 		rv = M_R_NOMEMORY;
 		goto out;
@@ -287,7 +766,7 @@ segidx_alloc_entry(m_segidx_t *segidx, m_segidx_entry_t **entryp)
 	goto out;
 
 out:
-	pthread_mutex_unlock(&(segidx->mutex));
+	m_mcslock_unlock(&(segidx->lock));
 	return rv;
 }
 
@@ -303,36 +782,56 @@ segidx_free_entry(m_segidx_t *segidx, m_segidx_entry_t *entry)
 		return rv;
 	}	
 
-	pthread_mutex_lock(&(segidx->mutex));
+	m_mcslock_lock(&(segidx->lock));
 	list_del_init(&(entry->list));
 	list_add(&(entry->list), &(segidx->free_entries.list));
+	segidx->nfree++;
 	rv = M_R_SUCCESS;
 	goto unlock;
 
 unlock:
-	pthread_mutex_unlock(&(segidx->mutex));
+	m_mcslock_unlock(&(segidx->lock));
 	return rv;
 }
 
 
-/* Not thread safe */
+/* Takes no locks; binary searches the lookup array */
 static
 m_result_t 
 segidx_find_entry_using_addr(m_segidx_t *segidx, void *addr, m_segidx_entry_t **entryp)
 {
-	m_segidx_entry_t *ientry;
-	m_segtbl_entry_t *tentry;
-	uintptr_t        start;
-	uint32_t         size;
-
-	list_for_each_entry(ientry, &segidx->mapped_entries.list, list) {
-		tentry = ientry->segtbl_entry;
-		start = tentry->start;
-		size = tentry->size;
-		if ((uintptr_t) addr >= start && (uintptr_t) addr < start+size) {
-			*entryp = ientry;
-			return M_R_SUCCESS;
+	volatile m_segidx_range_t *ranges = segidx->ranges;
+	m_segidx_entry_t          *ientry;
+	uint64_t                  seq;
+	int                       lo;
+	int                       hi;
+	int                       mid;
+
+	do {
+		while ((seq = __atomic_load_n(&segidx->seq, __ATOMIC_ACQUIRE)) & 1) {
+			;
+		}
+		ientry = NULL;
+		/* Find the last segment starting at or below addr */
+		lo = 0;
+		hi = segidx->nranges;
+		while (lo < hi) {
+			mid = (lo + hi) / 2;
+			if (ranges[mid].start <= (uintptr_t) addr) {
+				lo = mid + 1;
+			} else {
+				hi = mid;
+			}
+		}
+		if (lo > 0 && (uintptr_t) addr < ranges[lo-1].end) {
+			ientry = ranges[lo-1].entry;
 		}
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (__atomic_load_n(&segidx->seq, __ATOMIC_RELAXED) != seq);
+
+	if (ientry) {
+		*entryp = ientry;
+		return M_R_SUCCESS;
 	}
 	return M_R_FAILURE;
 }
@@ -344,7 +843,7 @@ static
 m_result_t 
 segidx_find_entry_using_index(m_segidx_t *segidx, uint32_t index, m_segidx_entry_t **entryp)
 {
-	if (index >= SEGMENT_TABLE_NUM_ENTRIES) {
+	if (index >= segidx->nentries || !segidx->all_entries[index].segtbl_entry) {
 		return M_R_INVALIDARG;
 	}
 	*entryp = &segidx->all_entries[index];
@@ -372,32 +871,34 @@ static
 uintptr_t
 segidx_find_free_region(m_segidx_t *segidx, uintptr_t start_addr, size_t length)
 {
-	struct list_head *tmp_list;
-	m_segidx_entry_t *max_ientry;
+	m_segidx_range_t *ranges = segidx->ranges;
+	int              n;
+#ifdef TRY_ALLOC_IN_HOLES
+	uintptr_t        prev_end_addr;
+	int              i;
+#endif
 
-	pthread_mutex_lock(&segidx->mutex); 
-	if ((tmp_list = segidx->mapped_entries.list.prev) !=  &segidx->mapped_entries.list) {
-		max_ientry = list_entry(tmp_list, m_segidx_entry_t, list);
-		if (start_addr < (max_ientry->segtbl_entry->start +	max_ientry->segtbl_entry->size)) {
-			start_addr = 0x0;
+	m_mcslock_lock(&segidx->lock);
+	n = segidx->nranges;
+	if (n > 0 && start_addr < ranges[n-1].end) {
+		start_addr = 0x0;
 #ifdef TRY_ALLOC_IN_HOLES
-			/* Check whether there is a hole where we can allocate memory */
-			prev_end_addr = SEGMENT_MAP_START;
-			list_for_each_entry(ientry, &(segidx->mapped_entries.list), list) {
-				if (ientry->segtbl_entry->start - prev_end_addr > length) {
-					start_addr = prev_end_addr;
-					break;
-				}
-				prev_end_addr = ientry->segtbl_entry->start + ientry->segtbl_entry->size;
+		/* Check whether there is a hole where we can allocate memory */
+		prev_end_addr = SEGMENT_MAP_START;
+		for (i = 0; i < n; i++) {
+			if (ranges[i].start > prev_end_addr && ranges[i].start - prev_end_addr > length) {
+				start_addr = prev_end_addr;
+				break;
 			}
-#endif			
-			/* If not found a hole then start from the maximum allocated address so far */
-			if (!start_addr) {
-				start_addr = max_ientry->segtbl_entry->start +	max_ientry->segtbl_entry->size;
-			}	
+			prev_end_addr = ranges[i].end;
 		}
+#endif			
+		/* If not found a hole then start from the maximum allocated address so far */
+		if (!start_addr) {
+			start_addr = ranges[n-1].end;
+		}	
 	}
-	pthread_mutex_unlock(&segidx->mutex);
+	m_mcslock_unlock(&segidx->lock);
 	return start_addr;
 }
 
@@ -409,15 +910,29 @@ segment_table_map(m_segtbl_t *segtbl)
 	char              segtbl_path[256];
 	int               segtbl_fd;
 
+	if (segment_backend == SEGMENT_BACKEND_DEVDAX) {
+		segtbl->entries = (m_segtbl_entry_t *) SEGMENT_TABLE_START;
+		if (mcore_runtime_settings.reset_segments) {
+			devdax_reset();
+		}
+		return M_R_SUCCESS;
+	}
 	sprintf(segtbl_path, "%s/segment_table", SEGMENTS_DIR);
+	/* Tables from before the header only cover the entries */
 	if (m_check_backing_store(segtbl_path, SEGMENT_TABLE_SIZE) != M_R_SUCCESS) {
 		mkdir_r(SEGMENTS_DIR, S_IRWXU);
-		segtbl_fd = create_backing_store(segtbl_path, SEGMENT_TABLE_SIZE);
+		segtbl_fd = create_backing_store(segtbl_path, SEGMENT_TABLE_MAP_SIZE);
 	} else {
 		segtbl_fd = open(segtbl_path, O_RDWR);
+		if (segtbl_fd >= 0 && 
+		    m_check_backing_store(segtbl_path, SEGMENT_TABLE_MAP_SIZE) != M_R_SUCCESS) 
+		{
+			/* The header page reads as zeroes: not formatted yet */
+			ftruncate(segtbl_fd, SIZEOF_PAGES(SEGMENT_TABLE_MAP_SIZE) + 1);
+		}
 	}
 	segtbl->entries = segment_map((void *) SEGMENT_TABLE_START, 
-	                              SEGMENT_TABLE_SIZE, 
+	                              SEGMENT_TABLE_MAP_SIZE, 
 	                              PROT_READ|PROT_WRITE,
 	                              MAP_PERSISTENT | MAP_SHARED,
 		                          segtbl_fd);
@@ -430,49 +945,170 @@ segment_table_map(m_segtbl_t *segtbl)
 
 
 /**
- * \brief (Re)incarnates the segment table.
+ * \brief Formats the segment table header if needed and sets the size of 
+ * the reserved region from it.
  *
- * It maps the persistent segment table, fleshes out an index on top of it
- * and verifies existing backing stores.
- *
- * It does not map any other segments.
+ * A table without a header is either new, and gets a region of 
+ * segments_region_gb GB, or from before the header, and keeps the 1TB 
+ * region it was created with.
  */
-static 
-m_result_t
-segment_table_incarnate()
+static
+void
+segment_table_format_header(m_segtbl_t *segtbl)
 {
-	m_result_t rv;
-
-	if ((rv = segment_table_map(&m_segtbl)) != M_R_SUCCESS) {
-		return rv;
-	}
-	if ((rv = segidx_create(&m_segtbl, &(m_segtbl.idx))) != M_R_SUCCESS) {
-
+	m_segtbl_header_t  *header;
+	unsigned long long region_size;
+	uint64_t           magic = SEGMENT_TABLE_MAGIC;
+	int                i;
+
+	header = segtbl->header = (m_segtbl_header_t *) SEGMENT_TABLE_HEADER_START;
+	if (header->magic != SEGMENT_TABLE_MAGIC) {
+		region_size = (unsigned long long) mcore_runtime_settings.segments_region_gb << 30;
+		for (i=0; i < SEGMENT_TABLE_NUM_ENTRIES; i++) {
+			if (segtbl->entries[i].flags & SGTB_VALID_ENTRY) {
+				region_size = PSEGMENT_LEGACY_REGION_SIZE;
+				break;
+			}
+		}
+		if (region_size > PSEGMENT_RESERVED_REGION_SIZE) {
+			region_size = PSEGMENT_RESERVED_REGION_SIZE;
+		}
+		PM_EQU(header->region_size, region_size); /* PCM STORE */
+		PM_EQU(header->next, 0); /* PCM STORE */
+		segment_persist_range(header, sizeof(*header));
+		/* The header is only valid once the magic is durable */
+		PM_EQU(header->magic, magic); /* PCM STORE */
+		segment_persist_range(header, sizeof(*header));
 	}
-	verify_backing_stores(&m_segtbl);
-
-	return M_R_SUCCESS;
+	psegment_region_end = PSEGMENT_RESERVED_REGION_START + header->region_size;
+	/* Zeroes in tables from before the module cache: an empty cache */
+	segtbl->modcache.entries = (m_modcache_entry_t *) SEGMENT_TABLE_MODCACHE_START;
+	segtbl->modcache.n = SEGMENT_TABLE_MODCACHE_SIZE / sizeof(m_modcache_entry_t);
 }
 
 
-static inline
-void
-segment_table_print(m_segtbl_t *segtbl)
-{
-	m_segidx_entry_t *ientry;
-	m_segtbl_entry_t *tentry;
+/**
+ * \brief Maps the extension blocks chained to the segment table.
+ *
+ * The entry of each block is in the block before it. Valid extension 
+ * block entries off the chain belong to blocks whose chaining a crash 
+ * interrupted; they are released.
+ */
+static
+m_result_t
+segment_table_map_extensions(m_segtbl_t *segtbl)
+{
+	m_segtbl_entry_t *block = segtbl->entries;
+	uint32_t         first = 0;
+	uint32_t         n = SEGMENT_TABLE_NUM_ENTRIES;
+	uintptr_t        next = segtbl->header->next;
+	uint32_t         flags_val;
+	uint32_t         i;
+	uint32_t         j;
+	char             path[256];
+	void             *map_addr;
+	int              k;
+
+	/* Chained blocks first, then the room segments_table_extensions asks for */
+	while (next) {
+		for (i=0; i < n; i++) {
+			if ((block[i].flags & (SGTB_VALID_ENTRY | SGTB_TYPE_TABLE)) == 
+			    (SGTB_VALID_ENTRY | SGTB_TYPE_TABLE) && block[i].start == next) 
+			{
+				break;
+			}
+		}
+		if (i == n) {
+			M_INTERNALERROR("Cannot find the entry of a segment table extension block.\n");
+		}
+		sprintf(path, "%s/%u.0", SEGMENTS_DIR, first + i);
+		map_addr = segment_map2((void *) block[i].start, (size_t) block[i].size, 
+		                        PROT_READ|PROT_WRITE, MAP_FIXED, path);
+		if (map_addr == MAP_FAILED) {
+			return M_R_FAILURE;
+		}
+		segtbl->ext = (m_segtbl_ext_t **) realloc(segtbl->ext, (segtbl->next + 1) * sizeof(m_segtbl_ext_t *));
+		segtbl->ext[segtbl->next++] = (m_segtbl_ext_t *) map_addr;
+		first = SEGMENT_TABLE_NUM_ENTRIES + (segtbl->next - 1) * SEGMENT_TABLE_EXT_ENTRIES;
+		n = SEGMENT_TABLE_EXT_ENTRIES;
+		block = ((m_segtbl_ext_t *) map_addr)->entries;
+		next = ((m_segtbl_ext_t *) map_addr)->next;
+	}
+	segtbl->max_next = segtbl->next + mcore_runtime_settings.segments_table_extensions;
+	segtbl->ext = (m_segtbl_ext_t **) realloc(segtbl->ext, (segtbl->max_next + 1) * sizeof(m_segtbl_ext_t *));
+
+	for (k = -1; k < segtbl->next; k++) {
+		block = k < 0 ? segtbl->entries : segtbl->ext[k]->entries;
+		n = k < 0 ? SEGMENT_TABLE_NUM_ENTRIES : SEGMENT_TABLE_EXT_ENTRIES;
+		for (i=0; i < n; i++) {
+			if (!(block[i].flags & SGTB_TYPE_TABLE) || !(block[i].flags & SGTB_VALID_ENTRY)) {
+				continue;
+			}
+			for (j=0; j < (uint32_t) segtbl->next; j++) {
+				if ((uintptr_t) segtbl->ext[j] == block[i].start) {
+					break;
+				}
+			}
+			if (j == (uint32_t) segtbl->next) {
+				flags_val = 0;
+				PM_EQU(block[i].flags, flags_val); /* PCM STORE */
+				PCM_WB_FLUSH(NULL, &(block[i].flags));
+				PCM_PERSIST_BARRIER(NULL);
+			}
+		}
+	}
+	return M_R_SUCCESS;
+}
+
+
+/**
+ * \brief (Re)incarnates the segment table.
+ *
+ * It maps the persistent segment table, fleshes out an index on top of it
+ * and verifies existing backing stores.
+ *
+ * It does not map any other segments.
+ */
+static 
+m_result_t
+segment_table_incarnate()
+{
+	m_result_t rv;
+
+	if ((rv = segment_table_map(&m_segtbl)) != M_R_SUCCESS) {
+		return rv;
+	}
+	segment_table_format_header(&m_segtbl);
+	if ((rv = segment_table_map_extensions(&m_segtbl)) != M_R_SUCCESS) {
+		return rv;
+	}
+	if ((rv = segidx_create(&m_segtbl, &(m_segtbl.idx))) != M_R_SUCCESS) {
+
+	}
+	verify_backing_stores(&m_segtbl);
+
+	return M_R_SUCCESS;
+}
+
+
+static inline
+void
+segment_table_print(m_segtbl_t *segtbl)
+{
+	m_segidx_entry_t *ientry;
+	m_segtbl_entry_t *tentry;
 	uintptr_t        start;
 	uintptr_t        end;
 
-	M_DEBUG_PRINT(M_DEBUG_SEGMENT, "PERSISTENT SEGMENT TABLE\n");
-	M_DEBUG_PRINT(M_DEBUG_SEGMENT, "========================\n");
-	M_DEBUG_PRINT(M_DEBUG_SEGMENT, "%16s   %16s %17s %10s\n", "start", "end", "size", "flags");
+	M_LOG(M_LOG_CAT_SEGMENT, M_LOG_DEBUG, "PERSISTENT SEGMENT TABLE\n");
+	M_LOG(M_LOG_CAT_SEGMENT, M_LOG_DEBUG, "========================\n");
+	M_LOG(M_LOG_CAT_SEGMENT, M_LOG_DEBUG, "%16s   %16s %17s %10s\n", "start", "end", "size", "flags");
 	list_for_each_entry(ientry, &segtbl->idx->mapped_entries.list, list) {
 		tentry = ientry->segtbl_entry;
 		start = (uintptr_t) tentry->start;
 		end   = (uintptr_t) tentry->start + (uintptr_t) tentry->size;
-		M_DEBUG_PRINT(M_DEBUG_SEGMENT, "0x%016lx - 0x%016lx %16luK", start, end, (long unsigned int) tentry->size/1024);
-		M_DEBUG_PRINT(M_DEBUG_SEGMENT, " %7c%c%c%c\n", ' ',
+		M_LOG(M_LOG_CAT_SEGMENT, M_LOG_DEBUG, "0x%016lx - 0x%016lx %16luK", start, end, (long unsigned int) tentry->size/1024);
+		M_LOG(M_LOG_CAT_SEGMENT, M_LOG_DEBUG, " %7c%c%c%c\n", ' ',
 		              (tentry->flags & SGTB_VALID_ENTRY)? 'V': '-',
 		              (tentry->flags & SGTB_VALID_DATA)? 'D': '-',
 		              (tentry->flags & SGTB_TYPE_SECTION)? 'S': '-'
@@ -515,15 +1151,65 @@ segment_map(void *addr, size_t size, int prot, int flags, int segment_fd)
 	void      *segmentp;
 	uintptr_t start;
 	uintptr_t end;
+	int       populate = 0;
 
 
 	if (segment_fd < 0) {
 		return ((void *) -1);
 	}
-	segmentp = mmap(addr, size, prot, 
-	                flags | MAP_PERSISTENT| MAP_SHARED, 
-		            segment_fd,
-		            0);
+	if (strcmp(mcore_runtime_settings.segments_prefault, "populate") == 0) {
+		populate = MAP_POPULATE;
+	}
+	/* 
+	 * A hint into the reservation would be ignored: segments replace it, 
+	 * at addresses the index knows to be free. 
+	 */
+	start = (uintptr_t) addr;
+	if (psegment_region_reserved && 
+	    start >= PSEGMENT_RESERVED_REGION_START && 
+	    start + size <= PSEGMENT_RESERVED_REGION_END) 
+	{
+		flags |= MAP_FIXED;
+	}
+	if (segment_backend == SEGMENT_BACKEND_DEVDAX) {
+		/* Already mapped with the device; the segment must fit in it */
+		start = (uintptr_t) addr;
+		if (start < PSEGMENT_RESERVED_REGION_START || 
+		    start + size > PSEGMENT_RESERVED_REGION_START + devdax_size) 
+		{
+			M_LOG(M_LOG_CAT_SEGMENT, M_LOG_DEBUG, "Segment %016lx - %016lx beyond the device-DAX device\n", start, start + size);
+			return MAP_FAILED;
+		}
+		segment_prefault(addr, size, 0);
+		return addr;
+	}
+	if (segment_backend == SEGMENT_BACKEND_FSDAX) {
+		segmentp = mmap(addr, size, prot, 
+		                flags | MAP_PERSISTENT | MAP_SHARED_VALIDATE | MAP_SYNC | populate, 
+		                segment_fd,
+		                0);
+		if (segmentp == MAP_FAILED) {
+			/* 
+			 * EOPNOTSUPP: not a DAX file system. EINVAL: a kernel 
+			 * without MAP_SHARED_VALIDATE. 
+			 */
+			if (!segment_backend_probing || (errno != EOPNOTSUPP && errno != EINVAL)) {
+				M_ERROR("Cannot map %s with MAP_SYNC\n", SEGMENTS_DIR);
+				return segmentp;
+			}
+			M_LOG(M_LOG_CAT_SEGMENT, M_LOG_DEBUG, "No MAP_SYNC in %s: falling back to the page cache\n", SEGMENTS_DIR);
+			segment_backend = SEGMENT_BACKEND_FILE;
+		} else {
+			segment_flush_persistent = 1;
+		}
+		segment_backend_probing = 0;
+	}
+	if (segment_backend == SEGMENT_BACKEND_FILE) {
+		segmentp = mmap(addr, size, prot, 
+		                flags | MAP_PERSISTENT| MAP_SHARED | populate, 
+			            segment_fd,
+			            0);
+	}
 				   
 	if (segmentp == MAP_FAILED) {
 		return segmentp;
@@ -535,13 +1221,13 @@ segment_map(void *addr, size_t size, int prot, int flags, int segment_fd)
 	start = (uintptr_t) segmentp;
 	end = start + size;
 	if (start < PSEGMENT_RESERVED_REGION_START || 
-	    start > PSEGMENT_RESERVED_REGION_END ||
-	    end > PSEGMENT_RESERVED_REGION_END) 
+	    start > psegment_region_end ||
+	    end > psegment_region_end) 
 	{
 		/* FIXME: unmap the segment */
-		M_DEBUG_PRINT(M_DEBUG_SEGMENT, "   limits : %016lx - %016lx\n", PSEGMENT_RESERVED_REGION_START, PSEGMENT_RESERVED_REGION_END);
-		M_DEBUG_PRINT(M_DEBUG_SEGMENT, "asked for : %016lx - %016lx\n", (uintptr_t) addr, (uintptr_t) addr + size);
-		M_DEBUG_PRINT(M_DEBUG_SEGMENT, "      got : %016lx - %016lx\n", start, end);
+		M_LOG(M_LOG_CAT_SEGMENT, M_LOG_DEBUG, "   limits : %016lx - %016lx\n", PSEGMENT_RESERVED_REGION_START, psegment_region_end);
+		M_LOG(M_LOG_CAT_SEGMENT, M_LOG_DEBUG, "asked for : %016lx - %016lx\n", (uintptr_t) addr, (uintptr_t) addr + size);
+		M_LOG(M_LOG_CAT_SEGMENT, M_LOG_DEBUG, "      got : %016lx - %016lx\n", start, end);
 		M_INTERNALERROR("Persistent segment not in the reserved address space region.\n");
 		return MAP_FAILED;
 	}
@@ -550,6 +1236,17 @@ segment_map(void *addr, size_t size, int prot, int flags, int segment_fd)
 	if (madvise(segmentp, size, MADV_RANDOM) < 0) {
 		return MAP_FAILED;
 	}
+	/* 
+	 * Aligned DAX mappings get PMD/PUD pages on their own; page cache 
+	 * (shmem) files need the hint. Not fatal if transparent huge pages 
+	 * are not available.
+	 */
+	if (SEGMENT_PAGE_SIZE > PAGE_SIZE && 
+	    !((start | size) & (SEGMENT_PAGE_SIZE - 1))) 
+	{
+		madvise(segmentp, size, MADV_HUGEPAGE);
+	}
+	segment_prefault(segmentp, size, populate);
 	return segmentp;
 }
 
@@ -564,6 +1261,9 @@ segment_map2(void *addr, size_t size, int prot, int flags, char *segment_path)
 	int  segment_fd;
 	void *segmentp;
 
+	if (segment_backend == SEGMENT_BACKEND_DEVDAX) {
+		return segment_map(addr, size, prot, flags, devdax_fd);
+	}
 	segment_fd = open(segment_path, O_RDWR);
 	if (segment_fd < 0) {
 		return ((void *) -1);
@@ -579,45 +1279,299 @@ segment_map2(void *addr, size_t size, int prot, int flags, char *segment_path)
 }
 
 
+/*
+ * Maps a tiered segment: its backing store is a file in the tier 
+ * directory, whose pages the kernel reads in on access and writes back 
+ * from the page cache, whatever the backend of the other segments.
+ */
+static
+void *
+segment_map_tiered(void *addr, size_t size, char *segment_path)
+{
+	int  segment_fd;
+	void *segmentp;
+
+	if ((segment_fd = open(segment_path, O_RDWR)) < 0) {
+		return MAP_FAILED;
+	}
+	segmentp = mmap(addr, size, PROT_READ|PROT_WRITE, 
+	                MAP_FIXED | MAP_SHARED, segment_fd, 0);
+	close(segment_fd);
+	if (segmentp != MAP_FAILED) {
+		madvise(segmentp, size, MADV_RANDOM);
+	}
+	return segmentp;
+}
+
+
+/* States of a lazily reincarnated segment */
+#define LAZY_PENDING  0
+#define LAZY_MAPPING  1
+#define LAZY_MAPPED   2
+
+/* A segment reserved at reincarnation and mapped when first touched */
+typedef struct {
+	uintptr_t    start;
+	size_t       size;
+	volatile int state;
+	char         path[256];
+} lazy_segment_t;
+
+static lazy_segment_t   *lazy_segments = NULL;
+static int              lazy_nsegments = 0;
+static struct sigaction lazy_prev_sigsegv;
+
+
+static
+lazy_segment_t *
+lazy_segment_find(uintptr_t addr)
+{
+	int i;
+
+	for (i = 0; i < lazy_nsegments; i++) {
+		if (addr >= lazy_segments[i].start && 
+		    addr < lazy_segments[i].start + lazy_segments[i].size) 
+		{
+			return &lazy_segments[i];
+		}
+	}
+	return NULL;
+}
+
+
+/* Maps a lazy segment over its reservation, once; safe in a signal handler */
+static
+void
+lazy_segment_map(lazy_segment_t *l)
+{
+	void *map_addr;
+
+	if (__sync_bool_compare_and_swap(&l->state, LAZY_PENDING, LAZY_MAPPING)) {
+		map_addr = segment_map2((void *) l->start, l->size, PROT_READ|PROT_WRITE, 
+		                        MAP_FIXED, l->path);
+		if (map_addr == MAP_FAILED) {
+			M_INTERNALERROR("Cannot reincarnate persistent segment.\n");
+		}
+		__sync_synchronize();
+		l->state = LAZY_MAPPED;
+		return;
+	}
+	while (l->state != LAZY_MAPPED) {
+		sched_yield();
+	}
+}
+
+
+/*
+ * Maps lazy segments on their first touch. Faults anywhere else go to the 
+ * handler installed before ours, or get the default action.
+ */
+static
+void
+lazy_sigsegv_handler(int sig, siginfo_t *si, void *uc)
+{
+	lazy_segment_t *l = lazy_segment_find((uintptr_t) si->si_addr);
+
+	if (l && l->state != LAZY_MAPPED) {
+		lazy_segment_map(l);
+		return;
+	}
+	if (lazy_prev_sigsegv.sa_flags & SA_SIGINFO) {
+		lazy_prev_sigsegv.sa_sigaction(sig, si, uc);
+	} else if (lazy_prev_sigsegv.sa_handler == SIG_DFL || 
+	           lazy_prev_sigsegv.sa_handler == SIG_IGN) 
+	{
+		/* Returning re-executes the faulting access, which now kills us */
+		signal(SIGSEGV, SIG_DFL);
+	} else {
+		lazy_prev_sigsegv.sa_handler(sig);
+	}
+}
+
+
+/**
+ * \brief Maps the lazily reincarnated segment addr falls into, if not 
+ * mapped yet.
+ *
+ * Segments are also mapped on their first touch; this lets callers take 
+ * the cost up front, or outside of a latency-critical path.
+ */
+void
+m_segment_touch(void *addr)
+{
+	lazy_segment_t *l = lazy_segment_find((uintptr_t) addr);
+
+	if (l && l->state != LAZY_MAPPED) {
+		lazy_segment_map(l);
+	}
+}
+
+
+/*
+ * Directory of the log pool backing stores of NUMA node node (-1 if none):
+ * log_segments_dir, with a %d in it standing for the node, or SEGMENTS_DIR
+ * if not set. Device-DAX keeps all segments in the device.
+ */
+static
+void
+segment_log_dir(int node, char *dir)
+{
+	char *p;
+
+	if (LOG_SEGMENTS_DIR[0] == '\0' || segment_backend == SEGMENT_BACKEND_DEVDAX) {
+		strcpy(dir, SEGMENTS_DIR);
+	} else if ((p = strstr(LOG_SEGMENTS_DIR, "%d"))) {
+		sprintf(dir, "%.*s%d%s", (int) (p - LOG_SEGMENTS_DIR), LOG_SEGMENTS_DIR, 
+		        node < 0 ? 0 : node, p + 2);
+	} else {
+		strcpy(dir, LOG_SEGMENTS_DIR);
+	}
+}
+
+
+/* Path of the backing store of a segment */
+static
+void
+segment_backing_store_path(m_segidx_entry_t *ientry, char *path)
+{
+	m_segtbl_entry_t *tentry = ientry->segtbl_entry;
+	char             dir[256];
+
+	if (tentry->flags & SGTB_TIERED) {
+		sprintf(path, "%s/%d.0", SEGMENTS_TIER_DIR, ientry->index);
+	} else if (tentry->flags & SGTB_LOGS) {
+		segment_log_dir(SGTB_NODE(tentry->flags), dir);
+		sprintf(path, "%s/%d.0", dir, ientry->index);
+	} else if (tentry->flags & (SGTB_TYPE_PMAP | SGTB_TYPE_TABLE)) {
+		sprintf(path, "%s/%d.0", SEGMENTS_DIR, ientry->index);
+	} else if (tentry->flags & SGTB_TYPE_SECTION) {
+		sprintf(path, "%s/%d.%lu", SEGMENTS_DIR, ientry->index, (long unsigned int) ientry->module_id);
+	} else {
+		M_INTERNALERROR("Unknown persistent segment type.\n");
+	}
+}
+
+
+/* Maps the i-th segment of the reincarnation list */
+static
+void
+reincarnate_worker(void *arg, int i)
+{
+	m_segidx_entry_t   **entries = (m_segidx_entry_t **) arg;
+	m_segtbl_entry_t   *tentry;
+	char               path[256];
+	void               *map_addr;
+
+	tentry = entries[i]->segtbl_entry;
+	segment_backing_store_path(entries[i], path);
+	/* 
+	 * We pass MAP_FIXED to force the segment be mapped in its previous 
+	 * address space region.
+	 */
+	/* FIXME: protection flags should be stored in the segment table */
+	if (tentry->flags & SGTB_TIERED) {
+		map_addr = segment_map_tiered((void *) tentry->start, (size_t) tentry->size, path);
+	} else {
+		map_addr = segment_map2((void *) tentry->start, (size_t) tentry->size, 
+		                        PROT_READ|PROT_WRITE,
+		                        MAP_FIXED,
+		                        path);
+	}
+	if (map_addr == MAP_FAILED) {
+		M_INTERNALERROR("Cannot reincarnate persistent segment.\n");
+	}
+}
+
+
 /**
  * \brief Reincarnates valid segments
  *
+ * Segments are mapped by segments_map_threads threads. Segments of 
+ * segments_lazy_map_mb MB or more are only reserved, and mapped when 
+ * first touched or passed to m_segment_touch. This includes the segments 
+ * of .persistent sections: relocating a module only needs their address.
+ *
  * Assumes segment table already has an index attached to it.
  */
 void
 segment_reincarnate_segments(m_segtbl_t *segtbl)
 {
-	m_segidx_entry_t *ientry;
-	m_segtbl_entry_t *tentry;
-	uintptr_t        start;
-	uintptr_t        end;
-	char             path[256];
-	void             *map_addr;
+	m_segidx_entry_t   *ientry;
+	m_segtbl_entry_t   *tentry;
+	m_segidx_entry_t   **entries;
+	m_workpool_t       *pool;
+	struct sigaction   sa;
+	unsigned long long lazy_size;
+	int                nthreads = mcore_runtime_settings.segments_map_threads;
+	int                n = 0;
+	int                nentries = 0;
+	int                i;
+
+	list_for_each_entry(ientry, &segtbl->idx->mapped_entries.list, list) {
+		n++;
+	}
+	if (n == 0) {
+		return;
+	}
+	entries = (m_segidx_entry_t **) malloc(n * sizeof(m_segidx_entry_t *));
+	lazy_segments = (lazy_segment_t *) calloc(n, sizeof(lazy_segment_t));
+	if (!entries || !lazy_segments) {
+		M_INTERNALERROR("Cannot allocate the segment reincarnation list.\n");
+	}
+	lazy_size = (unsigned long long) mcore_runtime_settings.segments_lazy_map_mb << 20;
 
 	list_for_each_entry(ientry, &segtbl->idx->mapped_entries.list, list) {
 		tentry = ientry->segtbl_entry;
-		if (tentry->flags & SGTB_TYPE_PMAP) {
-			sprintf(path, "%s/%d.0", SEGMENTS_DIR, ientry->index);
-		} else if (tentry->flags & SGTB_TYPE_SECTION) {
-			sprintf(path, "%s/%d.%lu", SEGMENTS_DIR, ientry->index, (long unsigned int) ientry->module_id);
+		/* Mapped with the segment table */
+		if (tentry->flags & SGTB_TYPE_TABLE) {
+			continue;
+		}
+		if (tentry->flags & SGTB_TIERED) {
+			segment_ntiered++;
+		}
+		if (lazy_size && tentry->size >= lazy_size && 
+		    (tentry->flags & (SGTB_TYPE_PMAP | SGTB_TYPE_SECTION)) && 
+		    !(tentry->flags & SGTB_TIERED) &&
+		    segment_backend != SEGMENT_BACKEND_DEVDAX) 
+		{
+			lazy_segment_t *l = &lazy_segments[lazy_nsegments];
+			l->start = tentry->start;
+			l->size = tentry->size;
+			l->state = LAZY_PENDING;
+			segment_backing_store_path(ientry, l->path);
+			/* Keep the region from being handed out until mapped */
+			if (mmap((void *) l->start, l->size, PROT_NONE, 
+			         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, 
+			         -1, 0) == MAP_FAILED) 
+			{
+				M_INTERNALERROR("Cannot reserve persistent segment.\n");
+			}
+			lazy_nsegments++;
 		} else {
-			M_INTERNALERROR("Unknown persistent segment type.\n");
+			entries[nentries++] = ientry;
 		}
-		start = (uintptr_t) tentry->start;
-		end   = (uintptr_t) tentry->start + (uintptr_t) tentry->size;
-		/* 
-		 * We pass MAP_FIXED to force the segment be mapped in its previous 
-		 * address space region.
-		 */
-		/* FIXME: protection flags should be stored in the segment table */
-		map_addr = segment_map2((void *) start, (size_t) tentry->size, 
-								PROT_READ|PROT_WRITE,
-								MAP_FIXED,
-								path);
-		if (map_addr == MAP_FAILED) {
-			M_INTERNALERROR("Cannot reincarnate persistent segment.\n");
+	}
+
+	if (lazy_nsegments > 0) {
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_sigaction = lazy_sigsegv_handler;
+		sa.sa_flags = SA_SIGINFO | SA_NODEFER;
+		sigemptyset(&sa.sa_mask);
+		sigaction(SIGSEGV, &sa, &lazy_prev_sigsegv);
+	}
+
+	if (nthreads > nentries) {
+		nthreads = nentries;
+	}
+	if (nthreads > 1 && m_workpool_create(&pool, nthreads - 1) == M_R_SUCCESS) {
+		m_workpool_parallel_for(pool, nentries, reincarnate_worker, entries);
+		m_workpool_destroy(pool);
+	} else {
+		for (i = 0; i < nentries; i++) {
+			reincarnate_worker(entries, i);
 		}
 	}
+	free(entries);
 }
 
 
@@ -627,6 +1581,7 @@ pmap_internal_abs(void *start, unsigned long long length, int prot, int flags,
                   m_segidx_entry_t **entryp, uint32_t segtbl_entry_flags, uint64_t module_id)
 {
 	char             path[256];
+	char             dir[256];
 	uintptr_t        start_addr = (uintptr_t) start;
 	void             *map_addr;
 	int              fd;
@@ -636,11 +1591,21 @@ pmap_internal_abs(void *start, unsigned long long length, int prot, int flags,
 	uint32_t         flags_val;
 	
 
+	/* Extension blocks are mapped from the entries left in reserve */
+	if (!(segtbl_entry_flags & SGTB_TYPE_TABLE)) {
+		segment_table_reserve(&m_segtbl);
+	}
 	if ((segidx_alloc_entry(m_segtbl.idx, &new_ientry)) != M_R_SUCCESS) {
 		rv = MAP_FAILED;
 		goto out;
 	}	
-	sprintf(path, "%s/%d.%lu", SEGMENTS_DIR, new_ientry->index, module_id);
+	if (segtbl_entry_flags & SGTB_LOGS) {
+		segment_log_dir(SGTB_NODE(segtbl_entry_flags), dir);
+		mkdir_r(dir, S_IRWXU);
+	} else {
+		strcpy(dir, SEGMENTS_DIR);
+	}
+	sprintf(path, "%s/%d.%lu", dir, new_ientry->index, module_id);
 
 	/* 
 	 * Round-up the size of the segment to be an integer multiple of 4K pages.
@@ -648,6 +1613,13 @@ pmap_internal_abs(void *start, unsigned long long length, int prot, int flags,
 	 * round-ups and makes segment management simpler.
 	 */
 	length = SIZEOF_PAGES(length);
+	/* 
+	 * With huge segment pages, segments placed by us start and end at a 
+	 * huge page boundary, as 2MB/1GB mappings need that. 
+	 */
+	if ((flags & MAP_FIXED) != MAP_FIXED || !(start_addr & (SEGMENT_PAGE_SIZE - 1))) {
+		length = SEGMENT_PAGE_ALIGN(length);
+	}
 
 	if ((fd = create_backing_store(path, length)) < 0) {
 		rv = MAP_FAILED;
@@ -655,20 +1627,18 @@ pmap_internal_abs(void *start, unsigned long long length, int prot, int flags,
 	}
 	
 	/* 
-	 * Passing a start_addr that overlaps with a region will cause segment_map 
-	 * (which in turn calls mmap) to return an address that is not always the 
-	 * first address starting from start_addr to be found free. 
-	 * I don't understand why so I make sure that I pass an address that 
-	 * is guaranteed not to overlap with any other persistent segment.
+	 * The index picks an address guaranteed not to overlap with any other 
+	 * persistent segment, which segment_map maps at over the reservation.
 	 */
-	M_DEBUG_PRINT(M_DEBUG_SEGMENT, "start_addr = %p\n", (void *) start_addr);
+	M_LOG(M_LOG_CAT_SEGMENT, M_LOG_DEBUG, "start_addr = %p\n", (void *) start_addr);
 
 	if ((flags & MAP_FIXED) != MAP_FIXED) {
 		start_addr = segidx_find_free_region(m_segtbl.idx, start_addr, length);
+		start_addr = SEGMENT_PAGE_ALIGN(start_addr);
 	}	
 	map_addr = segment_map((void *)start_addr, length, prot, flags, fd);
-	M_DEBUG_PRINT(M_DEBUG_SEGMENT, "new_start_addr = %p\n", (void *) start_addr);
-	M_DEBUG_PRINT(M_DEBUG_SEGMENT, "map_addr = %p\n", map_addr);
+	M_LOG(M_LOG_CAT_SEGMENT, M_LOG_DEBUG, "new_start_addr = %p\n", (void *) start_addr);
+	M_LOG(M_LOG_CAT_SEGMENT, M_LOG_DEBUG, "map_addr = %p\n", map_addr);
 	if (map_addr == MAP_FAILED) {
 		rv = MAP_FAILED;
 		goto err_segment_map;
@@ -678,13 +1648,14 @@ pmap_internal_abs(void *start, unsigned long long length, int prot, int flags,
 	tentry = new_ientry->segtbl_entry;
 	PM_EQU(tentry->start, map_addr); /* PCM STORE */ 
 	PM_EQU(tentry->size, length);  /* PCM STORE */
-	PCM_WB_FENCE(NULL);
 	PCM_WB_FLUSH(NULL, &(tentry->start));
 	PCM_WB_FLUSH(NULL, &(tentry->size));
+	/* start and size must be durable before flags marks the entry valid */
+	PCM_PERSIST_BARRIER(NULL);
 	flags_val = segtbl_entry_flags;
 	PM_EQU(tentry->flags, flags_val);  /* PCM STORE */
-	PCM_WB_FENCE(NULL);
 	PCM_WB_FLUSH(NULL, &(tentry->flags));
+	PCM_PERSIST_BARRIER(NULL);
 
 	/* Insert the entry into the ordered index */
 	segidx_insert_entry_ordered(m_segtbl.idx, new_ientry, 1);
@@ -701,6 +1672,73 @@ out:
 }
 
 
+/**
+ * \brief Chains a new extension block to the segment table.
+ *
+ * The block is mapped as a segment of its own, whose entry is taken from the 
+ * last block. It only becomes part of the table once the previous block 
+ * links to it; a crash before that leaves an orphan entry that recovery 
+ * releases.
+ */
+static
+m_result_t
+segment_table_extend(m_segtbl_t *segtbl)
+{
+	m_segidx_entry_t *ientry;
+	m_segtbl_ext_t   *ext;
+	uintptr_t        *linkp;
+	uintptr_t        link;
+	uint32_t         first;
+
+	ext = (m_segtbl_ext_t *) pmap_internal_abs((void *) SEGMENT_MAP_START, 
+	                                           sizeof(m_segtbl_ext_t), 
+	                                           PROT_READ|PROT_WRITE, 0, &ientry, 
+	                                           SGTB_TYPE_TABLE | SGTB_VALID_ENTRY | SGTB_VALID_DATA, 
+	                                           0);
+	if (ext == MAP_FAILED) {
+		return M_R_FAILURE;
+	}
+	/* Backing stores read as zeroes, but device-DAX extents may not */
+	PM_MEMSET(ext, 0, sizeof(m_segtbl_ext_t));
+	segment_persist_range(ext, sizeof(m_segtbl_ext_t));
+
+	linkp = segtbl->next ? &(segtbl->ext[segtbl->next - 1]->next) : &(segtbl->header->next);
+	link = (uintptr_t) ext;
+	PM_EQU(*linkp, link); /* PCM STORE */
+	PCM_WB_FLUSH(NULL, (volatile pcm_word_t *) linkp);
+	PCM_PERSIST_BARRIER(NULL);
+
+	first = SEGMENT_TABLE_NUM_ENTRIES + segtbl->next * SEGMENT_TABLE_EXT_ENTRIES;
+	m_mcslock_lock(&(segtbl->idx->lock));
+	segidx_add_block(segtbl->idx, ext->entries, first, SEGMENT_TABLE_EXT_ENTRIES);
+	segtbl->ext[segtbl->next++] = ext;
+	m_mcslock_unlock(&(segtbl->idx->lock));
+	M_LOG(M_LOG_CAT_SEGMENT, M_LOG_DEBUG, "Segment table extended with block %d at %p\n", segtbl->next, ext);
+
+	return M_R_SUCCESS;
+}
+
+
+/**
+ * \brief Extends the segment table ahead of running out of free entries.
+ */
+static
+void
+segment_table_reserve(m_segtbl_t *segtbl)
+{
+	if (segtbl->idx->nfree > SEGMENT_TABLE_EXT_RESERVE || segtbl->next >= segtbl->max_next) {
+		return;
+	}
+	pthread_mutex_lock(&segtbl_extend_mutex);
+	if (segtbl->idx->nfree <= SEGMENT_TABLE_EXT_RESERVE && segtbl->next < segtbl->max_next) {
+		if (segment_table_extend(segtbl) != M_R_SUCCESS) {
+			M_LOG(M_LOG_CAT_SEGMENT, M_LOG_DEBUG, "Couldn't extend the segment table\n");
+		}
+	}
+	pthread_mutex_unlock(&segtbl_extend_mutex);
+}
+
+
 static
 void *
 pmap_internal(void *start, unsigned long long length, int prot, int flags, 
@@ -715,6 +1753,67 @@ pmap_internal(void *start, unsigned long long length, int prot, int flags,
 
 
 
+/* Whether the n bytes at p are all zero */
+static inline
+int
+segment_zero_range(const char *p, size_t n)
+{
+	return n == 0 || (p[0] == 0 && memcmp(p, p + 1, n - 1) == 0);
+}
+
+
+/*
+ * Loads the initial contents of a module's .persistent section into its
+ * segment. A new backing store reads as zeroes, so the pages that are all
+ * zeroes in the file, and the .persistent.bss part, are left alone: they
+ * take no memory or storage until written. A segment left by a crash 
+ * during its first load, or on a device-DAX device, is zeroed first.
+ */
+static
+void
+segment_section_load(module_dsr_t *module_dsr, void *mapped_addr, size_t length, int fresh)
+{
+	Elf_Data  *elfdata;
+	GElf_Shdr shdr;
+	char      *base;
+	char      *dst;
+	char      *src;
+	size_t    off;
+	size_t    n;
+
+	if (!fresh) {
+		PM_MEMSET(mapped_addr, 0, length);
+	}
+	if (module_dsr->persistent_scn == NULL) {
+		return;
+	}
+	gelf_getshdr(module_dsr->persistent_scn, &shdr);
+	base = (char *) mapped_addr + (shdr.sh_addr - module_dsr->persistent_shdr.sh_addr);
+	elfdata = NULL;
+	while ((elfdata = elf_getdata(module_dsr->persistent_scn, elfdata)))
+	{
+		M_LOG(M_LOG_CAT_SEGMENT, M_LOG_DEBUG, "data.d_size = %d\n", (int) elfdata->d_size);	
+		M_LOG(M_LOG_CAT_SEGMENT, M_LOG_DEBUG, "data.d_off = %d\n", (int) elfdata->d_off);	
+		M_LOG(M_LOG_CAT_SEGMENT, M_LOG_DEBUG, "start_addr = %lx\n", (uintptr_t) mapped_addr);	
+		M_LOG(M_LOG_CAT_SEGMENT, M_LOG_DEBUG, "length     = %u\n", (unsigned int) length);	
+		if (elfdata->d_buf == NULL) {
+			continue;
+		}
+		dst = base + elfdata->d_off;
+		src = (char *) elfdata->d_buf;
+		for (off = 0; off < elfdata->d_size; off += n) {
+			n = PAGE_SIZE - ((uintptr_t) (dst + off) & (PAGE_SIZE - 1));
+			if (n > elfdata->d_size - off) {
+				n = elfdata->d_size - off;
+			}
+			if (!segment_zero_range(src + off, n)) {
+				PM_MEMCPY(dst + off, src + off, n);
+			}
+		}
+	}
+}
+
+
 /**
  * \brief Checks if there are any new .persistent sections and creates them
  *
@@ -732,18 +1831,20 @@ segment_create_sections(m_segtbl_t *segtbl)
 	m_segtbl_entry_t *tentry;
 	m_segidx_entry_t *ientry;
 	uint32_t         flags_val;
-	Elf_Data         *elfdata;
+	int              fresh;
 
-	rv = m_module_create_module_dsr_list(&module_dsr_list);
+	rv = m_module_create_module_dsr_list(&module_dsr_list, 
+	                                     mcore_runtime_settings.module_cache ? &segtbl->modcache : NULL);
 
 	list_for_each_entry(module_dsr, &module_dsr_list, list) {
-		M_DEBUG_PRINT(M_DEBUG_SEGMENT, "module_path = %s\n", module_dsr->module_path);
-		M_DEBUG_PRINT(M_DEBUG_SEGMENT, "module_id   = %lu\n", module_dsr->module_inode);
+		M_LOG(M_LOG_CAT_SEGMENT, M_LOG_DEBUG, "module_path = %s\n", module_dsr->module_path);
+		M_LOG(M_LOG_CAT_SEGMENT, M_LOG_DEBUG, "module_id   = %lu\n", module_dsr->module_inode);
 
 		/* 
 		 * If there is no valid entry for the persistent section of this module 
 		 * then create it and map the segment.
 		 */
+		fresh = 0;
 		if (segidx_find_entry_using_module_id(segtbl->idx, module_dsr->module_inode, &ientry) 
 		    != M_R_SUCCESS)
 		{
@@ -753,6 +1854,7 @@ segment_create_sections(m_segtbl_t *segtbl)
 			if (mapped_addr == MAP_FAILED) {
 				M_INTERNALERROR("Cannot map .persistent section's segment.\n");
 			}
+			fresh = segment_backend != SEGMENT_BACKEND_DEVDAX;
 		} else {
 			mapped_addr = (void *) ientry->segtbl_entry->start;
 			length = ientry->segtbl_entry->size;
@@ -766,20 +1868,20 @@ segment_create_sections(m_segtbl_t *segtbl)
 		persistent_section_absolute_addr = (uintptr_t) (module_dsr->persistent_shdr.sh_addr+module_dsr->module_start-0x400000);
 		GOT_section_absolute_addr = (uintptr_t) (module_dsr->GOT_shdr.sh_addr+module_dsr->module_start-0x400000);
 
-		M_DEBUG_PRINT(M_DEBUG_SEGMENT, "persistent_section.start         = %p\n", 
+		M_LOG(M_LOG_CAT_SEGMENT, M_LOG_DEBUG, "persistent_section.start         = %p\n", 
 		              (void *) persistent_section_absolute_addr);
-		M_DEBUG_PRINT(M_DEBUG_SEGMENT, "persistent_section.end           = %p\n", 
+		M_LOG(M_LOG_CAT_SEGMENT, M_LOG_DEBUG, "persistent_section.end           = %p\n", 
 		              (void *) (persistent_section_absolute_addr + 
 		              module_dsr->persistent_shdr.sh_size));
-		M_DEBUG_PRINT(M_DEBUG_SEGMENT, "persistent_section.sh_size       = %d\n", 
+		M_LOG(M_LOG_CAT_SEGMENT, M_LOG_DEBUG, "persistent_section.sh_size       = %d\n", 
 		              (int) module_dsr->persistent_shdr.sh_size);
-		M_DEBUG_PRINT(M_DEBUG_SEGMENT, "persistent_section.sh_size_pages = %d\n", 
+		M_LOG(M_LOG_CAT_SEGMENT, M_LOG_DEBUG, "persistent_section.sh_size_pages = %d\n", 
 		              (int) SIZEOF_PAGES(module_dsr->persistent_shdr.sh_size));
-		M_DEBUG_PRINT(M_DEBUG_SEGMENT, "GOT_section.start                = %p\n", 
+		M_LOG(M_LOG_CAT_SEGMENT, M_LOG_DEBUG, "GOT_section.start                = %p\n", 
 		              (void *) GOT_section_absolute_addr);
-		M_DEBUG_PRINT(M_DEBUG_SEGMENT, "GOT_section.end                  = %p\n", 
+		M_LOG(M_LOG_CAT_SEGMENT, M_LOG_DEBUG, "GOT_section.end                  = %p\n", 
 		              (void *) GOT_section_absolute_addr+module_dsr->GOT_shdr.sh_size);
-		M_DEBUG_PRINT(M_DEBUG_SEGMENT, "GOT_section.sh_size              = %d\n", 
+		M_LOG(M_LOG_CAT_SEGMENT, M_LOG_DEBUG, "GOT_section.sh_size              = %d\n", 
 		              (int) module_dsr->GOT_shdr.sh_size);
 
 
@@ -794,22 +1896,16 @@ segment_create_sections(m_segtbl_t *segtbl)
 		/* If data not valid then load them using the data found in the .persistent section */
 		if (!(ientry->segtbl_entry->flags & SGTB_VALID_DATA))
 		{
-			elfdata = NULL;
-			while ((elfdata = elf_getdata(module_dsr->persistent_scn, elfdata)))
-			{
-				M_DEBUG_PRINT(M_DEBUG_SEGMENT, "data.d_size = %d\n", (int) elfdata->d_size);	
-				M_DEBUG_PRINT(M_DEBUG_SEGMENT, "data.d_buf = %p\n", elfdata->d_buf);	
-				M_DEBUG_PRINT(M_DEBUG_SEGMENT, "start_addr = %lx\n", (uintptr_t) mapped_addr);	
-				M_DEBUG_PRINT(M_DEBUG_SEGMENT, "end_addr = %lx\n", (uintptr_t) mapped_addr + length);	
-				M_DEBUG_PRINT(M_DEBUG_SEGMENT, "length     = %u\n", (unsigned int) length);	
-				PM_MEMCPY(mapped_addr, elfdata->d_buf, elfdata->d_size);
+			if (m_module_open(module_dsr) != M_R_SUCCESS) {
+				M_INTERNALERROR("Cannot read .persistent section of %s.\n", module_dsr->module_path);
 			}
+			segment_section_load(module_dsr, mapped_addr, length, fresh);
 
 			tentry = ientry->segtbl_entry;
 			flags_val = tentry->flags | SGTB_VALID_DATA; // PM_LOAD
 			PM_EQU(tentry->flags, flags_val); /* PCM STORE */
-			PCM_WB_FENCE(NULL);
 			PCM_WB_FLUSH(NULL, &(tentry->flags));
+			PCM_PERSIST_BARRIER(NULL);
 		}
 
 	} /* end of list_for_each_entry */
@@ -828,8 +1924,17 @@ m_segmentmgr_init()
 {
 	char buf[256];
 
-	/* Clear previous life segments? */
-	if (mcore_runtime_settings.reset_segments) {
+	/* In case the library's constructors were not run first */
+	segment_reserve_region();
+	segment_backend_select();
+
+	/* 
+	 * Clear previous life segments? A device-DAX device has its segment 
+	 * table cleared instead when mapped.
+	 */
+	if (mcore_runtime_settings.reset_segments && 
+	    segment_backend != SEGMENT_BACKEND_DEVDAX) 
+	{
 		/* what if buffer overflow attack -- who cares, this is a prototype */
 		sprintf(buf, "rm -rf %s", SEGMENTS_DIR);
 		system(buf);
@@ -840,6 +1945,10 @@ m_segmentmgr_init()
 	segment_create_sections(&m_segtbl);
 
 	segment_table_print(&m_segtbl);
+	M_LOG(M_LOG_CAT_SEGMENT, M_LOG_DEBUG, "Segment backend: %s, flush-only persistence: %s\n",
+	              segment_backend == SEGMENT_BACKEND_DEVDAX ? "devdax" :
+	              segment_backend == SEGMENT_BACKEND_FSDAX ? "fsdax" : "file",
+	              segment_flush_persistent ? "yes" : "no");
 
 	return M_R_SUCCESS;
 }
@@ -856,7 +1965,6 @@ m_segmentmgr_fini()
 }
 
 
-/* Not thread safe */
 m_result_t 
 m_segment_find_using_addr(void *addr, m_segidx_entry_t **entryp)
 {
@@ -865,6 +1973,31 @@ m_segment_find_using_addr(void *addr, m_segidx_entry_t **entryp)
 
 
 
+/**
+ * \brief Returns the backend of the persistent segments' backing stores.
+ */
+m_segment_backend_t
+m_segment_backend(void)
+{
+	return segment_backend;
+}
+
+
+/**
+ * \brief Returns whether flushing CPU caches is enough to make stores to 
+ * the persistent segments durable.
+ *
+ * True for device-DAX and for DAX files mapped with MAP_SYNC; the page 
+ * cache files of the file backend also need to be written back by the 
+ * kernel.
+ */
+int
+m_segment_flush_persistent(void)
+{
+	return segment_flush_persistent;
+}
+
+
 /**
  * \brief Maps an address space region into persistent memory.
  *
@@ -875,6 +2008,8 @@ m_pmap(void *start, unsigned long long length, int prot, int flags)
 {
 	m_segidx_entry_t *ientry;
 	void             *rv;
+
+	mnemosyne_init_global();
 	rv = pmap_internal(start, length, prot, flags, &ientry, 
 	                   SGTB_TYPE_PMAP | SGTB_VALID_ENTRY | SGTB_VALID_DATA, 0);
 	return rv;
@@ -891,12 +2026,574 @@ m_pmap2(void *start, unsigned long long length, int prot, int flags)
 	m_segidx_entry_t *ientry;
 	void             *rv;
 
+	mnemosyne_init_global();
 	rv = pmap_internal_abs(start, length, prot, flags, &ientry, 
 	                       SGTB_TYPE_PMAP | SGTB_VALID_ENTRY | SGTB_VALID_DATA, 0);
 	return rv;
 }
 
 
+/**
+ * \brief Maps a segment of the log pool at start. If log_segments_dir is 
+ * set, its backing store goes there, in the directory of NUMA node node if
+ * there is one per node (-1 if the logs have no node).
+ */
+void *
+m_pmap_logs(void *start, unsigned long long length, int node)
+{
+	m_segidx_entry_t *ientry;
+	uint32_t         flags = SGTB_TYPE_PMAP | SGTB_VALID_ENTRY | SGTB_VALID_DATA;
+
+	mnemosyne_init_global();
+	if (LOG_SEGMENTS_DIR[0] != '\0' && segment_backend != SEGMENT_BACKEND_DEVDAX) {
+		flags |= SGTB_LOGS;
+		if (node >= 0 && node < NUMA_MAX_NODES - 1) {
+			flags |= (uint32_t) (node + 1) << SGTB_NODE_SHIFT;
+		}
+	}
+	return pmap_internal_abs(start, length, PROT_READ|PROT_WRITE, MAP_FIXED, 
+	                         &ientry, flags, 0);
+}
+
+
+
+/**
+ * \brief Returns the number of NUMA nodes the system may have (1 if 
+ * unknown).
+ */
+int
+m_numa_nodes(void)
+{
+	static int nnodes = 0;
+	FILE       *fp;
+	int        first;
+	int        last;
+
+	if (nnodes) {
+		return nnodes;
+	}
+	/* A range such as 0-1, or just 0 */
+	last = 0;
+	if ((fp = fopen("/sys/devices/system/node/possible", "r")) != NULL) {
+		if (fscanf(fp, "%d-%d", &first, &last) < 2) {
+			last = 0;
+		}
+		fclose(fp);
+	}
+	nnodes = last < NUMA_MAX_NODES ? last + 1 : NUMA_MAX_NODES;
+	return nnodes;
+}
+
+
+/**
+ * \brief Returns the NUMA node of the CPU the calling thread runs on.
+ */
+int
+m_numa_node_self(void)
+{
+	unsigned int cpu;
+	unsigned int node;
+
+	if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0) {
+		return 0;
+	}
+	return (int) node;
+}
+
+
+/**
+ * \brief Makes the pages of a (page aligned) persistent region not yet 
+ * touched prefer the memory of a NUMA node.
+ */
+int
+m_pmap_bind_node(void *start, unsigned long long length, int node)
+{
+	unsigned long nodemask[NUMA_MAX_NODES / (8 * sizeof(unsigned long))];
+
+	if (node < 0 || node >= NUMA_MAX_NODES) {
+		return -1;
+	}
+	memset(nodemask, 0, sizeof(nodemask));
+	nodemask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+	return (int) syscall(SYS_mbind, start, length, MPOL_PREFERRED, nodemask, 
+	                     NUMA_MAX_NODES + 1, 0);
+}
+
+
+/**
+ * \brief Spreads the pages of a (page aligned) region not yet touched 
+ * round-robin over the NUMA nodes of the system.
+ */
+int
+m_numa_interleave(void *start, unsigned long long length)
+{
+	unsigned long nodemask[NUMA_MAX_NODES / (8 * sizeof(unsigned long))];
+	int           nnodes = m_numa_nodes();
+	int           node;
+
+	memset(nodemask, 0, sizeof(nodemask));
+	for (node = 0; node < nnodes; node++) {
+		nodemask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+	}
+	return (int) syscall(SYS_mbind, start, length, MPOL_INTERLEAVE, nodemask, 
+	                     NUMA_MAX_NODES + 1, 0);
+}
+
+
+/**
+ * \brief Returns the storage behind the pages of a persistent region to the 
+ * file system.
+ *
+ * Punches a hole in the backing store of the segment the region falls 
+ * into, so the pages read as zeroes and use no space until written again. 
+ * Only whole pages inside the region are discarded. Returns -1 if the 
+ * region is not in a single segment or the backing store cannot have holes 
+ * (device-DAX).
+ */
+int
+m_pdiscard(void *start, unsigned long long length)
+{
+	m_segidx_entry_t *ientry;
+	m_segtbl_entry_t *tentry;
+	uintptr_t        first;
+	uintptr_t        last;
+	char             path[256];
+	int              fd;
+	int              rv;
+
+	if (segment_backend == SEGMENT_BACKEND_DEVDAX) {
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+	if (segidx_find_entry_using_addr(m_segtbl.idx, start, &ientry) != M_R_SUCCESS) {
+		errno = EINVAL;
+		return -1;
+	}
+	tentry = ientry->segtbl_entry;
+	first = PAGE_ALIGN((uintptr_t) start);
+	last = ((uintptr_t) start + length) & ~(PAGE_SIZE - 1);
+	if ((uintptr_t) start + length > tentry->start + tentry->size) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (last <= first) {
+		return 0;
+	}
+	segment_backing_store_path(ientry, path);
+	if ((fd = open(path, O_RDWR)) < 0) {
+		return -1;
+	}
+	rv = fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, 
+	               (off_t) (first - tentry->start), (off_t) (last - first));
+	close(fd);
+	return rv;
+}
+
+
+/* 
+ * Copies a backing store, sharing its extents with a reflink where the file 
+ * system can, else with copy_file_range, which may still avoid copying the 
+ * data through user space.
+ */
+static
+int
+segment_clone_file(const char *src_path, const char *dst_path)
+{
+	struct stat stat_buf;
+	int         src_fd;
+	int         dst_fd;
+	ssize_t     n;
+	off_t       done = 0;
+	int         rv = -1;
+
+	if ((src_fd = open(src_path, O_RDONLY)) < 0) {
+		return -1;
+	}
+	if ((dst_fd = open(dst_path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR)) < 0) {
+		close(src_fd);
+		return -1;
+	}
+	if (ioctl(dst_fd, FICLONE, src_fd) == 0) {
+		rv = 0;
+		goto out;
+	}
+	if (fstat(src_fd, &stat_buf) < 0) {
+		goto out;
+	}
+	while (done < stat_buf.st_size) {
+		n = copy_file_range(src_fd, NULL, dst_fd, NULL, stat_buf.st_size - done, 0);
+		if (n <= 0) {
+			goto out;
+		}
+		done += n;
+	}
+	rv = 0;
+out:
+	if (rv == 0) {
+		rv = fsync(dst_fd);
+	}
+	close(dst_fd);
+	close(src_fd);
+	return rv;
+}
+
+
+/* Clones the backing stores in src_dir into dir */
+static
+int
+snapshot_dir(const char *src_dir, const char *dir)
+{
+	DIR           *d;
+	struct dirent *dentry;
+	unsigned int  segment_id;
+	uint64_t      segment_module_id;
+	char          src_path[256];
+	char          dst_path[256];
+	int           rv = 0;
+
+	if (!(d = opendir(src_dir))) {
+		return -1;
+	}
+	while ((dentry = readdir(d)) != NULL) {
+		if (strcmp(dentry->d_name, "segment_table") != 0 && 
+		    sscanf(dentry->d_name, "%u.%lu", &segment_id, &segment_module_id) != 2) 
+		{
+			continue;
+		}
+		snprintf(src_path, sizeof(src_path), "%s/%s", src_dir, dentry->d_name);
+		snprintf(dst_path, sizeof(dst_path), "%s/%s", dir, dentry->d_name);
+		M_LOG(M_LOG_CAT_SEGMENT, M_LOG_DEBUG, "Snapshot %s to %s\n", src_path, dst_path);
+		if (segment_clone_file(src_path, dst_path) < 0) {
+			M_WARNING("Cannot snapshot %s: %s\n", src_path, strerror(errno));
+			rv = -1;
+			break;
+		}
+	}
+	closedir(d);
+	return rv;
+}
+
+
+/**
+ * \brief Clones the backing stores of all persistent segments into dir.
+ *
+ * The clone is consistent only if nothing writes persistent memory while 
+ * it is taken and the logs hold no committed fragment not yet written back 
+ * (mtm_snapshot sees to both for transactions). Mnemosyne started with 
+ * segments_dir set to dir then finds the segments as they were, with 
+ * nothing to recover from the logs. The log pool backing stores kept in 
+ * log_segments_dir go to dir as well, where they are found as long as
+ * log_segments_dir is not set. Device-DAX devices cannot be cloned, nor 
+ * can the segments while some are tiered out.
+ */
+int
+m_psnapshot(const char *dir)
+{
+	char log_dir[256];
+	int  nnodes;
+	int  node;
+
+	if (segment_backend == SEGMENT_BACKEND_DEVDAX || segment_ntiered > 0) {
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+	mkdir_r(dir, S_IRWXU);
+	if (snapshot_dir(SEGMENTS_DIR, dir) < 0) {
+		return -1;
+	}
+	if (LOG_SEGMENTS_DIR[0] != '\0') {
+		nnodes = strstr(LOG_SEGMENTS_DIR, "%d") ? m_numa_nodes() : 1;
+		for (node = 0; node < nnodes; node++) {
+			segment_log_dir(node, log_dir);
+			if (strcmp(log_dir, SEGMENTS_DIR) != 0 && 
+			    access(log_dir, F_OK) == 0 && snapshot_dir(log_dir, dir) < 0) 
+			{
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+
+/* Writes size bytes of buf to fd */
+static
+int
+segment_write_file(int fd, const void *buf, size_t size)
+{
+	ssize_t n;
+
+	while (size > 0) {
+		if ((n = write(fd, buf, size)) <= 0) {
+			return -1;
+		}
+		buf = (const char *) buf + n;
+		size -= n;
+	}
+	return 0;
+}
+
+
+/* The pmap segment starting at start, mapped and ready to be tiered */
+static
+m_segtbl_entry_t *
+segment_tier_entry(void *start, m_segidx_entry_t **ientryp)
+{
+	m_segtbl_entry_t *tentry;
+
+	if (SEGMENTS_TIER_DIR[0] == '\0' || segment_backend == SEGMENT_BACKEND_DEVDAX) {
+		errno = EOPNOTSUPP;
+		return NULL;
+	}
+	if (segidx_find_entry_using_addr(m_segtbl.idx, start, ientryp) != M_R_SUCCESS) {
+		errno = EINVAL;
+		return NULL;
+	}
+	tentry = (*ientryp)->segtbl_entry;
+	if (!(tentry->flags & SGTB_TYPE_PMAP) || (tentry->flags & SGTB_LOGS) || 
+	    tentry->start != (uintptr_t) start) 
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+	m_segment_touch(start);
+	return tentry;
+}
+
+
+/**
+ * \brief Moves the pmap segment starting at start out of persistent memory
+ * into a file in segments_tier_dir, e.g. on an NVMe drive.
+ *
+ * The segment stays mapped at its address, now over the file: its pages 
+ * are read in when touched and written back by the kernel, as with the 
+ * file backend. The persistent memory backing store is removed once the 
+ * copy is durable and the segment table says the segment is tiered, so a
+ * crash leaves one or the other in use. Nothing may write the segment 
+ * meanwhile, and the logs must hold no committed store to it not yet 
+ * written back (mtm_sync). Returns 0, or -1 with errno set.
+ */
+int
+m_segment_tier_out(void *start)
+{
+	m_segidx_entry_t *ientry;
+	m_segtbl_entry_t *tentry;
+	char             pm_path[256];
+	char             tier_path[256];
+	int              fd;
+	int              rv = -1;
+
+	pthread_mutex_lock(&segment_tier_mutex);
+	if (!(tentry = segment_tier_entry(start, &ientry))) {
+		goto out;
+	}
+	if (tentry->flags & SGTB_TIERED) {
+		rv = 0;
+		goto out;
+	}
+	mkdir_r(SEGMENTS_TIER_DIR, S_IRWXU);
+	segment_backing_store_path(ientry, pm_path);
+	sprintf(tier_path, "%s/%d.0", SEGMENTS_TIER_DIR, ientry->index);
+	if ((fd = open(tier_path, O_RDWR|O_CREAT|O_TRUNC, S_IRUSR | S_IWUSR)) < 0) {
+		goto out;
+	}
+	if (segment_write_file(fd, start, tentry->size) != 0 ||
+	    ftruncate(fd, SIZEOF_PAGES(tentry->size) + 1) != 0 ||
+	    fsync(fd) != 0) 
+	{
+		close(fd);
+		unlink(tier_path);
+		goto out;
+	}
+	close(fd);
+
+	tentry->flags |= SGTB_TIERED;
+	segment_persist_range(&tentry->flags, sizeof(tentry->flags));
+	if (segment_map_tiered(start, tentry->size, tier_path) == MAP_FAILED) {
+		M_INTERNALERROR("Cannot map tiered persistent segment.\n");
+	}
+	unlink(pm_path);
+	segment_ntiered++;
+	rv = 0;
+out:
+	pthread_mutex_unlock(&segment_tier_mutex);
+	return rv;
+}
+
+
+/**
+ * \brief Moves a segment tiered out by m_segment_tier_out back into 
+ * persistent memory. Same conditions and crash behavior. Returns 0, or -1
+ * with errno set.
+ */
+int
+m_segment_tier_in(void *start)
+{
+	m_segidx_entry_t *ientry;
+	m_segtbl_entry_t *tentry;
+	char             pm_path[256];
+	char             tier_path[256];
+	int              fd;
+	int              rv = -1;
+
+	pthread_mutex_lock(&segment_tier_mutex);
+	if (!(tentry = segment_tier_entry(start, &ientry))) {
+		goto out;
+	}
+	if (!(tentry->flags & SGTB_TIERED)) {
+		rv = 0;
+		goto out;
+	}
+	segment_backing_store_path(ientry, tier_path);
+	sprintf(pm_path, "%s/%d.0", SEGMENTS_DIR, ientry->index);
+	if ((fd = create_backing_store(pm_path, tentry->size)) < 0) {
+		goto out;
+	}
+	if (segment_write_file(fd, start, tentry->size) != 0 || fsync(fd) != 0) {
+		close(fd);
+		unlink(pm_path);
+		goto out;
+	}
+	close(fd);
+
+	tentry->flags &= ~SGTB_TIERED;
+	segment_persist_range(&tentry->flags, sizeof(tentry->flags));
+	if (segment_map2(start, tentry->size, PROT_READ|PROT_WRITE, MAP_FIXED, pm_path) == MAP_FAILED) {
+		M_INTERNALERROR("Cannot map persistent segment.\n");
+	}
+	unlink(tier_path);
+	segment_ntiered--;
+	rv = 0;
+out:
+	pthread_mutex_unlock(&segment_tier_mutex);
+	return rv;
+}
+
+
+/**
+ * \brief Samples which pmap segments went untouched: stores in starts the
+ * start addresses of up to max segments in persistent memory none of whose
+ * pages were accessed since the previous call, and returns how many.
+ *
+ * Uses the accessed bits of the page tables, read from /proc/self/smaps 
+ * and cleared through /proc/self/clear_refs, which clears them for the 
+ * whole process. The first call returns every segment. Returns -1 if the
+ * bits cannot be read.
+ */
+int
+m_segment_sample_cold(void **starts, int max)
+{
+	m_segidx_entry_t   *ientry;
+	m_segtbl_entry_t   *tentry;
+	FILE               *f;
+	char               line[512];
+	unsigned long      vma_start;
+	unsigned long      vma_end;
+	unsigned long      referenced_kb;
+	int                in_region = 0;
+	int                n = 0;
+
+	if (!(f = fopen("/proc/self/smaps", "r"))) {
+		return -1;
+	}
+	m_mcslock_lock(&m_segtbl.idx->lock);
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%lx-%lx ", &vma_start, &vma_end) == 2) {
+			in_region = vma_start >= PSEGMENT_RESERVED_REGION_START && vma_end <= psegment_region_end;
+			continue;
+		}
+		if (!in_region || sscanf(line, "Referenced: %lu kB", &referenced_kb) != 1 || referenced_kb == 0) {
+			continue;
+		}
+		/* Mark the segments the mapping overlaps as hot */
+		list_for_each_entry(ientry, &m_segtbl.idx->mapped_entries.list, list) {
+			tentry = ientry->segtbl_entry;
+			if (tentry->start < vma_end && tentry->start + tentry->size > vma_start) {
+				ientry->hot = 1;
+			}
+		}
+	}
+	fclose(f);
+	list_for_each_entry(ientry, &m_segtbl.idx->mapped_entries.list, list) {
+		tentry = ientry->segtbl_entry;
+		if (ientry->hot) {
+			ientry->hot = 0;
+		} else if ((tentry->flags & SGTB_TYPE_PMAP) && 
+		           !(tentry->flags & (SGTB_TIERED | SGTB_LOGS)) && n < max) 
+		{
+			starts[n++] = (void *) tentry->start;
+		}
+	}
+	m_mcslock_unlock(&m_segtbl.idx->lock);
+	if ((f = fopen("/proc/self/clear_refs", "w"))) {
+		fputs("1", f);
+		fclose(f);
+	}
+	return n;
+}
+
+
+/**
+ * \brief Returns the named root called name, adding it if there is none.
+ *
+ * Slots are taken in order and never freed, so the first free one ends
+ * the search. The name is durable before the slot is returned; the 
+ * pointer was zeroed with the header.
+ */
+m_pptr_t *
+m_root(const char *name)
+{
+	m_segtbl_root_t *roots;
+	m_pptr_t        *ptr = NULL;
+	int             i;
+
+	if (strlen(name) >= SEGMENT_TABLE_ROOT_NAME_MAX) {
+		return NULL;
+	}
+	mnemosyne_init_global();
+	roots = m_segtbl.header->roots;
+	m_mcslock_lock(&m_segtbl.idx->lock);
+	for (i = 0; i < SEGMENT_TABLE_ROOTS; i++) {
+		if (roots[i].name[0] == '\0') {
+			PM_STRCPY(roots[i].name, name); /* PCM STORE */
+			segment_persist_range(roots[i].name, sizeof(roots[i].name));
+			ptr = &roots[i].ptr;
+			break;
+		}
+		if (strcmp(roots[i].name, name) == 0) {
+			ptr = &roots[i].ptr;
+			break;
+		}
+	}
+	m_mcslock_unlock(&m_segtbl.idx->lock);
+	return ptr;
+}
+
+
+/**
+ * \brief Calls fn(start, size, arg) on each mapped pmap segment and 
+ * persistent section segment.
+ *
+ * Runs with the segment index locked, so fn must not map or unmap 
+ * segments; segments mapped lazily may not be populated yet (see 
+ * m_segment_touch).
+ */
+void
+m_segment_foreach(void (*fn)(void *start, size_t size, void *arg), void *arg)
+{
+	m_segidx_entry_t   *ientry;
+	m_segtbl_entry_t   *tentry;
+
+	m_mcslock_lock(&m_segtbl.idx->lock);
+	list_for_each_entry(ientry, &m_segtbl.idx->mapped_entries.list, list) {
+		tentry = ientry->segtbl_entry;
+		if (tentry->flags & (SGTB_TYPE_PMAP | SGTB_TYPE_SECTION)) {
+			fn((void *) tentry->start, tentry->size, arg);
+		}
+	}
+	m_mcslock_unlock(&m_segtbl.idx->lock);
+}
+
 
 int 
 m_punmap(void *start, size_t length)
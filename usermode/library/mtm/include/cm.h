@@ -54,23 +54,222 @@
 #ifndef _CM_H
 #define _CM_H
 
+#include <spinwait.h>
+
 #define CM_RESTART          1
 #define CM_RESTART_NO_LOAD  2
 #define CM_RESTART_LOCKED   3
 
+#if CM == CM_BACKOFF || CM == CM_POLICY
+# if CM == CM_POLICY
+#  define CM_BACKOFF_MAX    mtm_cm_backoff_max
+# else
+#  define CM_BACKOFF_MAX    MAX_BACKOFF
+# endif
+
+/* 
+ * Spin for a random number of iterations below tx->backoff, then double
+ * tx->backoff up to the maximum. 
+ */
+static inline
+void
+cm_backoff(mtm_tx_t *tx)
+{
+	unsigned long wait;
+	volatile int  j;
+
+	/* Simple RNG (good enough for backoff) */
+	tx->seed ^= (tx->seed << 17);
+	tx->seed ^= (tx->seed >> 13);
+	tx->seed ^= (tx->seed << 5);
+	wait = tx->seed % tx->backoff;
+	for (j = 0; j < wait; j++) {
+		/* Do nothing */
+	}
+	if (tx->backoff < CM_BACKOFF_MAX) {
+		tx->backoff <<= 1;
+	}
+}
+#endif /* CM == CM_BACKOFF || CM == CM_POLICY */
+
+
+#if CM == CM_DELAY || CM == CM_PRIORITY || CM == CM_POLICY
+/* Wait until the contended lock that caused the abort (if any) is free */
+static inline
+void
+cm_wait_lock(mtm_tx_t *tx)
+{
+# ifdef WAIT_YIELD
+	m_spinwait_t w;
+# endif /* WAIT_YIELD */
+
+	if (tx->c_lock != NULL) {
+# ifdef WAIT_YIELD
+		/* Back off, then park until the owner releases its locks */
+		m_spinwait_init(&w, tx->c_lock);
+		while (LOCK_GET_OWNED(ATOMIC_LOAD(tx->c_lock))) {
+			m_spinwait_pause(&w);
+		}
+		m_spinwait_done(&w);
+# else /* ! WAIT_YIELD */
+		/* Busy waiting */
+		while (LOCK_GET_OWNED(ATOMIC_LOAD(tx->c_lock))) {
+		}
+# endif /* ! WAIT_YIELD */
+		tx->c_lock = NULL;
+	}
+}
+#endif /* CM == CM_DELAY || CM == CM_PRIORITY || CM == CM_POLICY */
+
+
+#if CM == CM_PRIORITY || CM == CM_POLICY
+/*
+ * Another transaction is reached through the write-set entry its lock 
+ * points to, and that entry and the descriptor behind it are freed when 
+ * the owner's thread exits. A transaction reading them first announces 
+ * itself in mtm_cm_owner_readers, and an exiting thread waits for the 
+ * count to drop to zero before freeing anything (see mtm_fini_thread). 
+ * As the owner released its locks before exiting, a lock word still equal
+ * to l after the announcement points to a live entry.
+ *
+ * cm_owner_enter returns the owner of lock, or NULL if lock no longer 
+ * holds l; either way it must be followed by cm_owner_exit.
+ */
+static inline
+mtm_tx_t *
+cm_owner_enter(volatile mtm_word_t *lock, mtm_word_t l)
+{
+	ATOMIC_FETCH_INC_FULL(&mtm_cm_owner_readers);
+	if (!LOCK_GET_OWNED(l) || ATOMIC_LOAD(lock) != l) {
+		return NULL;
+	}
+	return ((w_entry_t *) LOCK_GET_ADDR(l))->tx;
+}
+
+
+static inline
+void
+cm_owner_exit(void)
+{
+	ATOMIC_FETCH_DEC_FULL(&mtm_cm_owner_readers);
+}
+#endif /* CM == CM_PRIORITY || CM == CM_POLICY */
+
+
+#if CM == CM_PRIORITY
+
+
+/*
+ * Breaks a tie between transactions of equal priority: the one with more 
+ * entries in its write set (over all its chunks) wins, and among equal 
+ * write sets the one with the higher descriptor address.
+ */
+static inline
+int
+cm_priority_wins(mtm_tx_t *tx, volatile mtm_word_t *lock, mtm_word_t l)
+{
+	mode_data_t *modedata = (mode_data_t *) tx->active_modedata;
+	mtm_tx_t    *owner;
+	int         owner_nb;
+	int         wins = 0;
+
+	if ((owner = cm_owner_enter(lock, l)) != NULL) {
+		owner_nb = ((mode_data_t *) owner->active_modedata)->w_set.nb_entries;
+		wins = owner_nb < modedata->w_set.nb_entries ||
+		       (owner_nb == modedata->w_set.nb_entries && owner < tx);
+	}
+	cm_owner_exit();
+	return wins;
+}
+#endif /* CM == CM_PRIORITY */
+
+
+#if CM == CM_POLICY
+/* Maximum number of backoff intervals the winner of a karma comparison waits */
+# define CM_KARMA_MAX_INTERVALS 64
+
+/*
+ * Work done by the transaction: the accesses of its current execution plus
+ * those of the executions aborted by conflicts since it last committed.
+ * The sets of another thread's transaction are read without 
+ * synchronization, which is fine for an estimate, but only between
+ * cm_owner_enter and cm_owner_exit.
+ */
+static inline
+unsigned long
+cm_karma(mtm_tx_t *tx)
+{
+	mode_data_t *modedata = (mode_data_t *) tx->active_modedata;
+
+	return tx->karma + modedata->r_set.nb_entries + modedata->w_set.nb_entries;
+}
+
+
+/*
+ * Karma and Polka. The owner of a lock cannot be aborted by another 
+ * transaction, so instead of aborting the owner the transaction that has 
+ * done more work waits for the lock, for as many backoff intervals as it 
+ * has done more work (up to CM_KARMA_MAX_INTERVALS). Karma's intervals are
+ * cm_backoff_min iterations long, Polka's grow exponentially. If the lock 
+ * is still taken after that, or if the transaction has done less work, it
+ * aborts and waits until the lock is free as with CM_DELAY. As waiting is 
+ * bounded, transactions waiting for each other's locks cannot deadlock.
+ */
+static inline
+int
+cm_conflict_karma(mtm_tx_t *tx, volatile mtm_word_t *lock, mtm_word_t *l)
+{
+	unsigned long karma = cm_karma(tx);
+	unsigned long owner_karma = 0;
+	mtm_tx_t      *owner;
+	mtm_word_t    lw;
+	volatile int  j;
+	int           n;
+
+	if (LOCK_GET_OWNED(*l)) {
+		if ((owner = cm_owner_enter(lock, *l)) != NULL) {
+			owner_karma = cm_karma(owner);
+		}
+		cm_owner_exit();
+		if (owner == NULL) {
+			/* The lock changed hands meanwhile */
+			*l = ATOMIC_LOAD(lock);
+			return CM_RESTART_NO_LOAD;
+		}
+		for (n = 0; karma > owner_karma + n && n < CM_KARMA_MAX_INTERVALS; n++) {
+			if (mtm_cm_policy == CM_POLICY_POLKA) {
+				cm_backoff(tx);
+			} else {
+				for (j = 0; j < mtm_cm_backoff_min; j++) {
+					/* Do nothing */
+				}
+			}
+			lw = ATOMIC_LOAD(lock);
+			if (*l != lw) {
+				*l = lw;
+				return CM_RESTART_NO_LOAD;
+			}
+		}
+	}
+	tx->karma = karma;
+	tx->c_lock = lock;
+	return CM_RESTART_LOCKED;
+}
+#endif /* CM == CM_POLICY */
+
 static inline
 int 
 cm_conflict(mtm_tx_t *tx, volatile mtm_word_t *lock, mtm_word_t *l)
 {
-	mode_data_t *modedata = (mode_data_t *) tx->modedata[tx->mode];
+	mode_data_t *modedata = (mode_data_t *) tx->active_modedata;
 	w_entry_t   *w;
 
+	tx->conflict_lock = lock;
 #if CM == CM_PRIORITY
 	if (tx->retries >= cm_threshold) {
 		if (LOCK_GET_PRIORITY(*l) < tx->priority ||
 			(LOCK_GET_PRIORITY(*l) == tx->priority &&
-			*l < (mtm_word_t)modedata->w_set.entries
-			&& !LOCK_GET_WAIT(*l))) 
+			!LOCK_GET_WAIT(*l) && cm_priority_wins(tx, lock, *l))) 
 		{
 			/* We have higher priority */
 			if (ATOMIC_CAS_FULL(lock, *l, LOCK_SET_PRIORITY_WAIT(*l, tx->priority)) == 0) {
@@ -80,11 +279,11 @@ cm_conflict(mtm_tx_t *tx, volatile mtm_word_t *lock, mtm_word_t *l)
 		}
 		/* Wait until lock is free or another transaction waits for one of our locks */
 		while (1) {
+			int        c;
 			int        nb;
 			mtm_word_t lw;
 
-			w = modedata->w_set.entries;
-			for (nb = modedata->w_set.nb_entries; nb > 0; nb--, w++) {
+			W_SET_FOR_EACH_ENTRY(&modedata->w_set, c, nb, w) {
 				lw = ATOMIC_LOAD(w->lock);
 				if (LOCK_GET_WAIT(lw)) {
 					/* Another transaction waits for one of our locks */
@@ -108,7 +307,16 @@ give_up:
 	}
 #elif CM == CM_DELAY
 	tx->c_lock = lock;
-#endif /* CM == CM_DELAY */
+#elif CM == CM_POLICY
+	switch (mtm_cm_policy) {
+		case CM_POLICY_DELAY:
+			tx->c_lock = lock;
+			break;
+		case CM_POLICY_KARMA:
+		case CM_POLICY_POLKA:
+			return cm_conflict_karma(tx, lock, l);
+	}
+#endif /* CM == CM_POLICY */
 	return CM_RESTART_LOCKED;
 }
 
@@ -133,34 +341,20 @@ void
 cm_delay(mtm_tx_t *tx)
 {
 #if CM == CM_BACKOFF
-	unsigned long wait;
-	volatile int  j;
-
-	/* Simple RNG (good enough for backoff) */
-	tx->seed ^= (tx->seed << 17);
-	tx->seed ^= (tx->seed >> 13);
-	tx->seed ^= (tx->seed << 5);
-	wait = tx->seed % tx->backoff;
-	for (j = 0; j < wait; j++) {
-		/* Do nothing */
-	}
-	if (tx->backoff < MAX_BACKOFF) {
-		tx->backoff <<= 1;
-	}
+	cm_backoff(tx);
 #endif /* CM == CM_BACKOFF */
 
 #if CM == CM_DELAY || CM == CM_PRIORITY
-	/* Wait until contented lock is free */
-	if (tx->c_lock != NULL) {
-		/* Busy waiting (yielding is expensive) */
-		while (LOCK_GET_OWNED(ATOMIC_LOAD(tx->c_lock))) {
-# ifdef WAIT_YIELD
-			sched_yield();
-# endif /* WAIT_YIELD */
-		}
-		tx->c_lock = NULL;
-	}
+	cm_wait_lock(tx);
 #endif /* CM == CM_DELAY || CM == CM_PRIORITY */
+
+#if CM == CM_POLICY
+	if (mtm_cm_policy == CM_POLICY_BACKOFF) {
+		cm_backoff(tx);
+	} else {
+		cm_wait_lock(tx);
+	}
+#endif /* CM == CM_POLICY */
 }
 
 
@@ -178,9 +372,7 @@ static inline
 void
 cm_reset(mtm_tx_t *tx)
 {
-#if CM == CM_PRIORITY || defined(INTERNAL_STATS)
 	tx->retries = 0;
-#endif /* CM == CM_PRIORITY || defined(INTERNAL_STATS) */
 
 #if CM == CM_BACKOFF
 	/* Reset backoff */
@@ -192,6 +384,11 @@ cm_reset(mtm_tx_t *tx)
 	tx->priority = 0;
 	tx->visible_reads = 0;
 #endif /* CM == CM_PRIORITY */
+
+#if CM == CM_POLICY
+	tx->backoff = mtm_cm_backoff_min;
+	tx->karma = 0;
+#endif /* CM == CM_POLICY */
 }
 
 
@@ -39,7 +39,47 @@
 #define FOREACH_RUNTIME_CONFIG_SETTING(ACTION, group, config, values)                        \
   ACTION(config, values, group, stats, bool, int, 0, CONFIG_NO_CHECK, 0)                     \
   ACTION(config, values, group, force_mode, string, char *, "pwbetl", CONFIG_NO_CHECK, 0)     \
-  ACTION(config, values, group, stats_file, string, char *, "mtm.stats", CONFIG_NO_CHECK, 0)
+  ACTION(config, values, group, stats_file, string, char *, "mtm.stats", CONFIG_NO_CHECK, 0) \
+  ACTION(config, values, group, stats_conflict_sampling, int, int, 4,                       \
+         CONFIG_RANGE_CHECK, 0, 1 << 20)                                                    \
+  ACTION(config, values, group, stats_commit_phases, bool, int, 0, CONFIG_NO_CHECK, 0)       \
+  ACTION(config, values, group, stats_abort_stacks, int, int, 0,                            \
+         CONFIG_RANGE_CHECK, 0, 1 << 20)                                                    \
+  ACTION(config, values, group, stats_abort_stacks_file, string, char *, "mtm_aborts.folded", \
+         CONFIG_NO_CHECK, 0)                                                                \
+  ACTION(config, values, group, stats_export_file, string, char *, "", CONFIG_NO_CHECK, 0)  \
+  ACTION(config, values, group, stats_export_format, string, char *, "json",                \
+         CONFIG_NO_CHECK, 0)                                                                \
+  ACTION(config, values, group, stats_export_period_ms, int, int, 1000,                     \
+         CONFIG_RANGE_CHECK, 1, 3600000)                                                    \
+  ACTION(config, values, group, lock_array_log_size, int, int, LOCK_ARRAY_LOG_SIZE,         \
+         CONFIG_RANGE_CHECK, LOCK_ARRAY_LOG_SIZE_MIN, LOCK_ARRAY_LOG_SIZE_MAX)              \
+  ACTION(config, values, group, lock_shift, int, int, LOCK_SHIFT_DEFAULT,                   \
+         CONFIG_RANGE_CHECK, 2, 12) \
+  ACTION(config, values, group, lock_array_interleave, bool, int, 1, CONFIG_NO_CHECK, 0)    \
+  ACTION(config, values, group, serial_threshold, int, int, 100, CONFIG_NO_CHECK, 0)     \
+  ACTION(config, values, group, sched_threshold, int, int, 0,                             \
+         CONFIG_RANGE_CHECK, 0, 1 << 20)                                                  \
+  ACTION(config, values, group, serial_site_retries, int, int, 0,                         \
+         CONFIG_RANGE_CHECK, 0, 1 << 20)                                                  \
+  ACTION(config, values, group, serial_site_period, int, int, 64,                         \
+         CONFIG_RANGE_CHECK, 1, 1 << 20)                                                  \
+  ACTION(config, values, group, htm_attempts, int, int, 3, CONFIG_NO_CHECK, 0)          \
+  ACTION(config, values, group, cm_policy, string, char *, "suicide", CONFIG_NO_CHECK, 0) \
+  ACTION(config, values, group, cm_backoff_min, int, int, 4,                              \
+         CONFIG_RANGE_CHECK, 1, 1 << 30)                                                  \
+  ACTION(config, values, group, cm_backoff_max, int, int, 65536,                          \
+         CONFIG_RANGE_CHECK, 1, 1 << 30)                                                  \
+  ACTION(config, values, group, commit_prefetch_max, int, int, 512,                       \
+         CONFIG_RANGE_CHECK, 0, 1 << 20)                                                  \
+  ACTION(config, values, group, read_cache_mb, int, int, 0,                               \
+         CONFIG_RANGE_CHECK, 0, 1 << 20)                                                  \
+  ACTION(config, values, group, log_per_cpu, bool, int, 0, CONFIG_NO_CHECK, 0)            \
+  ACTION(config, values, group, version_store_kb, int, int, 0,                            \
+         CONFIG_RANGE_CHECK, 0, 1 << 22)                                                  \
+  ACTION(config, values, group, lock_elision_attempts, int, int, 3,                       \
+         CONFIG_RANGE_CHECK, 0, 64)                                                       \
+  ACTION(config, values, group, unsafe_disable, string, char *, "", CONFIG_NO_CHECK, 0)
 
 
 typedef CONFIG_GROUP_STRUCT(mtm) mtm_config_t;
@@ -56,6 +56,7 @@
 # define _GC_H_
 
 # include <stdlib.h>
+# include <stdint.h>
 
 # ifdef __cplusplus
 extern "C" {
@@ -73,6 +74,8 @@ void gc_set_epoch(gc_word_t epoch);
 
 void gc_free(void *addr, gc_word_t epoch);
 
+void gc_free_fn(void *addr, void (*release)(void *), gc_word_t epoch);
+
 void gc_cleanup();
 
 void gc_cleanup_all();
@@ -290,6 +290,13 @@ extern __m256 _ITM_CALL_CONVENTION _ITM_RaWM256(const __m256 *);
 extern __m256 _ITM_CALL_CONVENTION _ITM_RfWM256(const __m256 *);
 #endif /* __AVX__ */
 
+#ifdef __AVX512F__
+extern __m512 _ITM_CALL_CONVENTION _ITM_RM512(const __m512 *);
+extern __m512 _ITM_CALL_CONVENTION _ITM_RaRM512(const __m512 *);
+extern __m512 _ITM_CALL_CONVENTION _ITM_RaWM512(const __m512 *);
+extern __m512 _ITM_CALL_CONVENTION _ITM_RfWM512(const __m512 *);
+#endif /* __AVX512F__ */
+
 extern float _Complex _ITM_CALL_CONVENTION _ITM_RCF(const float _Complex *);
 extern float _Complex _ITM_CALL_CONVENTION _ITM_RaRCF(const float _Complex *);
 extern float _Complex _ITM_CALL_CONVENTION _ITM_RaWCF(const float _Complex *);
@@ -348,6 +355,12 @@ extern void _ITM_CALL_CONVENTION _ITM_WaRM256(const __m256 *, __m256);
 extern void _ITM_CALL_CONVENTION _ITM_WaWM256(const __m256 *, __m256);
 #endif /* __AVX__ */
 
+#ifdef __AVX512F__
+extern void _ITM_CALL_CONVENTION _ITM_WM512(const __m512 *, __m512);
+extern void _ITM_CALL_CONVENTION _ITM_WaRM512(const __m512 *, __m512);
+extern void _ITM_CALL_CONVENTION _ITM_WaWM512(const __m512 *, __m512);
+#endif /* __AVX512F__ */
+
 extern void _ITM_CALL_CONVENTION _ITM_WCF(const float _Complex *, float _Complex);
 extern void _ITM_CALL_CONVENTION _ITM_WaRCF(const float _Complex *, float _Complex);
 extern void _ITM_CALL_CONVENTION _ITM_WaWCF(const float _Complex *, float _Complex);
@@ -384,6 +397,10 @@ extern void _ITM_CALL_CONVENTION _ITM_LM128(const __m128 *);
 extern void _ITM_CALL_CONVENTION _ITM_LM256(const __m256 *);
 #endif /* __AVX__ */
 
+#ifdef __AVX512F__
+extern void _ITM_CALL_CONVENTION _ITM_LM512(const __m512 *);
+#endif /* __AVX512F__ */
+
 /*** memcpy functions ***/
 
 extern void _ITM_CALL_CONVENTION _ITM_memcpyRnWt(void *, const void *, size_t);
@@ -460,6 +477,7 @@ GENERATE (ACTION, long double,E, __VA_ARGS__)                           \
 GENERATE (ACTION, __m64,M64, __VA_ARGS__)                               \
 GENERATE (ACTION, __m128,M128, __VA_ARGS__)                             \
 GENERATE (ACTION, __m256,M256, __VA_ARGS__)                             \
+GENERATE (ACTION, __m512,M512, __VA_ARGS__)                             \
 GENERATE (ACTION, float _Complex, CF, __VA_ARGS__)                      \
 GENERATE (ACTION, double _Complex, CD, __VA_ARGS__)                     \
 GENERATE (ACTION, long double _Complex, CE, __VA_ARGS__) 
@@ -474,7 +492,8 @@ GENERATE (ACTION, double,D, __VA_ARGS__)                                \
 GENERATE (ACTION, long double,E, __VA_ARGS__)                           \
 GENERATE (ACTION, __m64,M64, __VA_ARGS__)                               \
 GENERATE (ACTION, __m128,M128, __VA_ARGS__)                             \
-GENERATE (ACTION, __m256,M256, __VA_ARGS__)
+GENERATE (ACTION, __m256,M256, __VA_ARGS__)                             \
+GENERATE (ACTION, __m512,M512, __VA_ARGS__)
 # endif
 
 # define _ITM_FOREACH_MEMCPY0(ACTION, NAME, ...)                                                            \
@@ -3,17 +3,37 @@
 
 typedef struct mtm_local_undo_s mtm_local_undo_t;
 typedef struct mtm_local_undo_entry_s mtm_local_undo_entry_t;
+typedef struct mtm_local_segment_s mtm_local_segment_t;
+
+/* 
+ * The local undo log is a list of segments that are filled in order. 
+ * Entries never straddle segments and are never moved, so the log grows 
+ * without copying what it already holds. The first segment is kept for the
+ * life of the thread; the others are freed once no transaction of the 
+ * last LOCAL_TRIM_PERIOD has needed them.
+ */
+struct mtm_local_segment_s {
+	mtm_local_segment_t    *prev;
+	mtm_local_segment_t    *next;
+	size_t                 base;     /* Log offset of data[0] */
+	size_t                 size;     /* Bytes of data */
+	size_t                 used;     /* Bytes of data holding entries */
+	char                   data[];
+};
 
 struct mtm_local_undo_s {
-	mtm_local_undo_entry_t *last_entry;
-	char                   *buf;
-	size_t                 n;
-	size_t                 size;
+	mtm_local_segment_t    *first;
+	mtm_local_segment_t    *cur;     /* Segment entries are appended to */
+	int                    commits;  /* Commits since the segments were last trimmed */
+	int                    spilled;  /* Whether one of them went past the first segment */
 };	
 
 void mtm_local_init (mtm_tx_t *tx);
+void mtm_local_fini (mtm_tx_t *tx);
 void mtm_local_rollback (mtm_tx_t *tx);
 void mtm_local_commit (mtm_tx_t *tx);
+size_t mtm_local_savepoint (mtm_tx_t *tx);
+void mtm_local_rollback_to_savepoint (mtm_tx_t *tx, size_t savepoint, void *jb);
 
 void _ITM_CALL_CONVENTION mtm_local_LB (mtm_tx_t *, const void *, size_t); 
 
@@ -113,21 +113,32 @@
 /*
  * We use an array of locks and hash the address to find the location of the lock.
  * We try to avoid collisions as much as possible (two addresses covered by the same lock).
+ *
+ * The size of the array and the stripe covered by each lock are runtime
+ * settings (mtm.lock_array_log_size and mtm.lock_shift); LOCK_ARRAY_LOG_SIZE 
+ * only provides the default size. The array is allocated by init_global().
  */
-#define LOCK_ARRAY_SIZE                 (1 << LOCK_ARRAY_LOG_SIZE)
-#define LOCK_MASK                       (LOCK_ARRAY_SIZE - 1)
+#define LOCK_ARRAY_SIZE                 ((mtm_word_t) 1 << mtm_lock_array_log_size)
+#define LOCK_MASK                       mtm_lock_mask
 //#define LOCK_SHIFT                      (((sizeof(mtm_word_t) == 4) ? 2 : 3) + LOCK_SHIFT_EXTRA)
-// Map the words of a cacheline on the same lock
-#define LOCK_SHIFT                      6
+// By default map the words of a cacheline on the same lock
+#define LOCK_SHIFT_DEFAULT              6
+#define LOCK_SHIFT                      mtm_lock_shift
 #define LOCK_IDX(a)                     (((mtm_word_t)((a)) >> LOCK_SHIFT) & LOCK_MASK)
 #ifdef LOCK_IDX_SWAP
 # if LOCK_ARRAY_LOG_SIZE < 16
 #  error "LOCK_IDX_SWAP requires LOCK_ARRAY_LOG_SIZE to be at least 16"
 # endif /* LOCK_ARRAY_LOG_SIZE < 16 */
+# define LOCK_ARRAY_LOG_SIZE_MIN        16
 # define GET_LOCK(a)                    (locks + lock_idx_swap(LOCK_IDX((a))))
 #else /* ! LOCK_IDX_SWAP */
+# define LOCK_ARRAY_LOG_SIZE_MIN        8
 # define GET_LOCK(a)                    (locks + LOCK_IDX((a)))
 #endif /* ! LOCK_IDX_SWAP */
+#define LOCK_ARRAY_LOG_SIZE_MAX         30
+
+/* Two addresses alias when they map to the same lock but different stripes. */
+#define LOCK_STRIPE(a)                  ((mtm_word_t)((a)) >> LOCK_SHIFT)
 
 
 
@@ -70,10 +70,11 @@ void mtm_##NAME##_load_bytes(mtm_tx_t *tx,                                     \
     a = (mtm_word_t *)addr;                                                    \
   }	                                                                       \
   /* Full words */                                                             \
-  while (size >= sizeof(mtm_word_t)) {                                         \
-    *((mtm_word_t *)buf) = mtm_##NAME##_load(tx, a++);                         \
-    buf += sizeof(mtm_word_t);                                                 \
-    size -= sizeof(mtm_word_t);                                                \
+  if (size >= sizeof(mtm_word_t)) {                                            \
+    mtm_##NAME##_load_words(tx, a, buf, size / sizeof(mtm_word_t));            \
+    a += size / sizeof(mtm_word_t);                                            \
+    buf += size & ~(size_t)(sizeof(mtm_word_t) - 1);                           \
+    size &= sizeof(mtm_word_t) - 1;                                            \
   }                                                                            \
   if (size > 0) {                                                              \
     /* Last bytes */                                                           \
@@ -114,10 +115,11 @@ void mtm_##NAME##_store_bytes(mtm_tx_t *tx,                                    \
     a = (mtm_word_t *)addr;                                                    \
   }	                                                                       \
   /* Full words */                                                             \
-  while (size >= sizeof(mtm_word_t)) {                                         \
-    mtm_##NAME##_store(tx, a++, *((mtm_word_t *)buf));                         \
-    buf += sizeof(mtm_word_t);                                                 \
-    size -= sizeof(mtm_word_t);                                                \
+  if (size >= sizeof(mtm_word_t)) {                                            \
+    mtm_##NAME##_store_words(tx, a, buf, size / sizeof(mtm_word_t));           \
+    a += size / sizeof(mtm_word_t);                                            \
+    buf += size & ~(size_t)(sizeof(mtm_word_t) - 1);                           \
+    size &= sizeof(mtm_word_t) - 1;                                            \
   }                                                                            \
   if (size > 0) {                                                              \
     /* Last bytes */                                                           \
@@ -130,12 +132,76 @@ void mtm_##NAME##_store_bytes(mtm_tx_t *tx,                                    \
   }                                                                            \
 }
 
+/*
+ * The compiler calls the typed barriers below with the type known, so an 
+ * access that falls within one word goes straight to the word barrier with
+ * a mask fixed by the type. For word-sized types the mask folds to a full
+ * word. Only accesses that straddle words, and larger types, take the 
+ * generic byte path.
+ */
+
+/* Size of an access of type T if it can fit in one word, 0 otherwise */
+#define WORD_ACCESS_SIZE(T)                                                    \
+  (sizeof(T) <= sizeof(mtm_word_t) ? sizeof(T) : 0)
+
+/* Mask of the n low bytes of a word */
+#define WORD_ACCESS_MASK(n)                                                    \
+  ((n) >= sizeof(mtm_word_t) ? ~(mtm_word_t)0                                  \
+                             : ((mtm_word_t)1 << (8 * ((n) & (sizeof(mtm_word_t) - 1)))) - 1)
+
+/* Whether an access of type T at addr (offset off in its word) fits in it */
+#define WORD_ACCESS_FITS(T, off)                                               \
+  (WORD_ACCESS_SIZE(T) > 0 && (off) + sizeof(T) <= sizeof(mtm_word_t))
+
+
+/*
+ * A mode may have the typed barriers run its inline word barriers by 
+ * defining these before including this file. Otherwise they call its 
+ * exported entry points, which the compiler cannot inline into them in a 
+ * shared library: another object could interpose them.
+ */
+#ifndef BARRIER_WORD_LOAD
+# define BARRIER_WORD_LOAD(NAME, tx, addr)                                     \
+  mtm_##NAME##_load(tx, addr)
+#endif
+#ifndef BARRIER_WORD_STORE
+# define BARRIER_WORD_STORE(NAME, tx, addr, value, mask)                       \
+  mtm_##NAME##_store2(tx, addr, value, mask)
+#endif
+
+/*
+ * The read barriers of one word for each ABI variant (plain, read after 
+ * read, read after write, read for write). A mode that can exploit what the
+ * compiler knows about the access defines its own; the rest read plainly.
+ */
+#ifndef BARRIER_WORD_LOAD_R
+# define BARRIER_WORD_LOAD_R(NAME, tx, addr)   BARRIER_WORD_LOAD(NAME, tx, addr)
+#endif
+#ifndef BARRIER_WORD_LOAD_RaR
+# define BARRIER_WORD_LOAD_RaR(NAME, tx, addr) BARRIER_WORD_LOAD(NAME, tx, addr)
+#endif
+#ifndef BARRIER_WORD_LOAD_RaW
+# define BARRIER_WORD_LOAD_RaW(NAME, tx, addr) BARRIER_WORD_LOAD(NAME, tx, addr)
+#endif
+#ifndef BARRIER_WORD_LOAD_RfW
+# define BARRIER_WORD_LOAD_RfW(NAME, tx, addr) BARRIER_WORD_LOAD(NAME, tx, addr)
+#endif
+
+
 #define READ_BARRIER(NAME, T, LOCK)                                            \
 _ITM_TYPE_##T _ITM_CALL_CONVENTION                                             \
 _ITM_##LOCK##T(        const _ITM_TYPE_##T *addr)                              \
 {                                                                              \
   mtm_tx_t *tx = mtm_get_tx();						       \
   _ITM_TYPE_##T val;                                                           \
+  uintptr_t off = (uintptr_t)addr & (sizeof(mtm_word_t) - 1);                  \
+  convert_t word;                                                              \
+                                                                               \
+  if (WORD_ACCESS_FITS(_ITM_TYPE_##T, off)) {                                  \
+    word.w = BARRIER_WORD_LOAD_##LOCK(NAME, tx, (volatile mtm_word_t *)((uintptr_t)addr - off)); \
+    memcpy(&val, &word.b[off], WORD_ACCESS_SIZE(_ITM_TYPE_##T));               \
+    return val;                                                                \
+  }                                                                            \
   mtm_##NAME##_load_bytes(tx,                                                  \
                           (volatile uint8_t *)addr,                            \
                           (uint8_t *)&val,                                     \
@@ -149,6 +215,17 @@ void _ITM_CALL_CONVENTION _ITM_##LOCK##T( const  _ITM_TYPE_##T *addr,          \
                                                  _ITM_TYPE_##T value)          \
 {                                                                              \
   mtm_tx_t *tx = mtm_get_tx();						       \
+  uintptr_t off = (uintptr_t)addr & (sizeof(mtm_word_t) - 1);                  \
+  convert_t word;                                                              \
+                                                                               \
+  if (WORD_ACCESS_FITS(_ITM_TYPE_##T, off)) {                                  \
+    word.w = 0;                                                                \
+    memcpy(&word.b[off], &value, WORD_ACCESS_SIZE(_ITM_TYPE_##T));             \
+    BARRIER_WORD_STORE(NAME, tx, (volatile mtm_word_t *)((uintptr_t)addr - off), \
+                       word.w,                                                 \
+                       WORD_ACCESS_MASK(WORD_ACCESS_SIZE(_ITM_TYPE_##T)) << (8 * off)); \
+    return;                                                                    \
+  }                                                                            \
   mtm_##NAME##_store_bytes(tx,                                                 \
                            (volatile uint8_t *)addr,                           \
                            (uint8_t *)&value,                                  \
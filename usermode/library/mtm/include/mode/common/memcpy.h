@@ -33,9 +33,15 @@
 #ifndef _MEMCPY_H
 #define _MEMCPY_H
 
-#define BUFSIZE (sizeof(mtm_word_t)*16)
+#define BUFSIZE (sizeof(mtm_word_t)*64)
 
-/* FIXME: The implementations here are not the most efficient possible. */
+/* 
+ * The transactional side(s) of a copy go through the byte barriers, which
+ * handle whole lock stripes at a time (see pwb_load_words/pwb_store_words);
+ * the non-transactional side (Rn, Wn) is a plain memcpy. A memcpy copies 
+ * straight from or into the non-transactional side; a memmove bounces 
+ * through a buffer as source and destination may overlap.
+ */
 
 #define MEMCPY_DEFINITION(PREFIX, VARIANT, READ, WRITE)                        \
 void _ITM_CALL_CONVENTION _ITM_memcpy##VARIANT(    void *dst,                  \
@@ -46,24 +52,45 @@ void _ITM_CALL_CONVENTION _ITM_memcpy##VARIANT(    void *dst,                  \
   volatile uint8_t *saddr=((volatile uint8_t *) src);                          \
   volatile uint8_t *daddr=((volatile uint8_t *) dst);                          \
   uint8_t buf[BUFSIZE];                                                        \
+  size_t  n;                                                                   \
                                                                                \
   if (size == 0) {                                                             \
     return;                                                                    \
   }	                                                                       \
-  while (size>BUFSIZE) {                                                       \
-    mtm_##PREFIX##_load_bytes(tx, saddr, buf, BUFSIZE);                        \
-    mtm_##PREFIX##_store_bytes(tx, daddr, buf, BUFSIZE);                       \
-    saddr += BUFSIZE;                                                          \
-    daddr += BUFSIZE;                                                          \
-    size -= BUFSIZE;                                                           \
-  }	                                                                           \
-  if (size > 0) {                                                              \
-    mtm_##PREFIX##_load_bytes(tx, saddr, buf, size);                           \
-    mtm_##PREFIX##_store_bytes(tx, daddr, buf, size);                          \
+  if (!(READ)) {                                                               \
+    mtm_##PREFIX##_store_bytes(tx, daddr, (uint8_t *) src, size);              \
+    return;                                                                    \
+  }                                                                            \
+  if (!(WRITE)) {                                                              \
+    mtm_##PREFIX##_load_bytes(tx, saddr, (uint8_t *) dst, size);               \
+    return;                                                                    \
   }                                                                            \
+  while (size > 0) {                                                           \
+    n = size > BUFSIZE ? BUFSIZE : size;                                       \
+    mtm_##PREFIX##_load_bytes(tx, saddr, buf, n);                              \
+    mtm_##PREFIX##_store_bytes(tx, daddr, buf, n);                             \
+    saddr += n;                                                                \
+    daddr += n;                                                                \
+    size -= n;                                                                 \
+  }	                                                                       \
 }
 
 
+#define MEMMOVE_CHUNK(PREFIX, READ, WRITE, daddr, saddr, buf, n)               \
+  do {                                                                         \
+    if (READ) {                                                                \
+      mtm_##PREFIX##_load_bytes(tx, saddr, buf, n);                            \
+    } else {                                                                   \
+      memcpy(buf, (const void *) (saddr), n);                                  \
+    }                                                                          \
+    if (WRITE) {                                                               \
+      mtm_##PREFIX##_store_bytes(tx, daddr, buf, n);                           \
+    } else {                                                                   \
+      memcpy((void *) (daddr), buf, n);                                        \
+    }                                                                          \
+  } while (0)
+
+
 #define MEMMOVE_DEFINITION(PREFIX, VARIANT, READ, WRITE)                       \
 void _ITM_CALL_CONVENTION _ITM_memmove##VARIANT(    void *dst,                 \
                                                     const void *src,           \
@@ -73,6 +100,7 @@ void _ITM_CALL_CONVENTION _ITM_memmove##VARIANT(    void *dst,                 \
   volatile uint8_t *saddr=((volatile uint8_t *) src);                          \
   volatile uint8_t *daddr=((volatile uint8_t *) dst);                          \
   uint8_t buf[BUFSIZE];                                                        \
+  size_t  n;                                                                   \
                                                                                \
   if (size == 0) {                                                             \
     return;                                                                    \
@@ -81,31 +109,21 @@ void _ITM_CALL_CONVENTION _ITM_memmove##VARIANT(    void *dst,                 \
     /* Destructive overlap...have to copy backwards */                         \
     saddr=((volatile uint8_t *) src) +size;                                    \
     daddr=((volatile uint8_t *) dst) +size;                                    \
-    while (size>BUFSIZE) {                                                     \
-      mtm_##PREFIX##_load_bytes(tx, saddr-BUFSIZE, buf, BUFSIZE);              \
-      mtm_##PREFIX##_store_bytes(tx, daddr-BUFSIZE, buf, BUFSIZE);             \
-      saddr -= BUFSIZE;                                                        \
-      daddr -= BUFSIZE;                                                        \
-      size -= BUFSIZE;                                                         \
+    while (size > 0) {                                                         \
+      n = size > BUFSIZE ? BUFSIZE : size;                                     \
+      MEMMOVE_CHUNK(PREFIX, READ, WRITE, daddr-n, saddr-n, buf, n);            \
+      saddr -= n;                                                              \
+      daddr -= n;                                                              \
+      size -= n;                                                               \
     }	                                                                       \
-    if (size > 0) {                                                            \
-      mtm_##PREFIX##_load_bytes(tx, saddr-size, buf, size);                    \
-      mtm_##PREFIX##_store_bytes(tx, daddr-size, buf, size);                   \
-    }                                                                          \
   } else {                                                                     \
-    saddr=((volatile uint8_t *) src);                                          \
-    daddr=((volatile uint8_t *) dst);                                          \
-    while (size>BUFSIZE) {                                                     \
-      mtm_##PREFIX##_load_bytes(tx, saddr, buf, BUFSIZE);                      \
-      mtm_##PREFIX##_store_bytes(tx, daddr, buf, BUFSIZE);                     \
-      saddr += BUFSIZE;                                                        \
-      daddr += BUFSIZE;                                                        \
-      size -= BUFSIZE;                                                         \
+    while (size > 0) {                                                         \
+      n = size > BUFSIZE ? BUFSIZE : size;                                     \
+      MEMMOVE_CHUNK(PREFIX, READ, WRITE, daddr, saddr, buf, n);                \
+      saddr += n;                                                              \
+      daddr += n;                                                              \
+      size -= n;                                                               \
     }	                                                                       \
-    if (size > 0) {                                                            \
-      mtm_##PREFIX##_load_bytes(tx, saddr, buf, size);                         \
-      mtm_##PREFIX##_store_bytes(tx, daddr, buf, size);                        \
-    }                                                                          \
   }                                                                            \
 }
 
@@ -33,9 +33,12 @@
 #ifndef _MEMSET_H
 #define _MEMSET_H
 
-#define BUFSIZE (sizeof(mtm_word_t)*16)
+#define BUFSIZE (sizeof(mtm_word_t)*64)
 
-/* TODO: A more efficient implementation of memset */
+/* 
+ * Fill through the byte barriers, which handle whole lock stripes at a 
+ * time (see pwb_store_words), from a buffer holding the pattern.
+ */
 
 #define MEMSET_DEFINITION(PREFIX, VARIANT)                                     \
 void _ITM_CALL_CONVENTION _ITM_memset##VARIANT(         void *dst,             \
@@ -45,22 +48,18 @@ void _ITM_CALL_CONVENTION _ITM_memset##VARIANT(         void *dst,             \
   mtm_tx_t *tx = mtm_get_tx();						       \
   volatile uint8_t *daddr=dst;                                                 \
   uint8_t          buf[BUFSIZE];                                               \
-  int              i;                                                          \
+  size_t           n;                                                          \
                                                                                \
   if (size == 0) {                                                             \
     return;                                                                    \
   }                                                                            \
-  for (i=0; i<BUFSIZE; i++) {                                                  \
-    buf[i] = c;                                                                \
-  }                                                                            \
-  while (size>BUFSIZE) {                                                       \
-    mtm_##PREFIX##_store_bytes(tx, daddr, buf, BUFSIZE);                       \
-    daddr += BUFSIZE;                                                          \
-    size -= BUFSIZE;                                                           \
+  memset(buf, c, size > BUFSIZE ? BUFSIZE : size);                             \
+  while (size > 0) {                                                           \
+    n = size > BUFSIZE ? BUFSIZE : size;                                       \
+    mtm_##PREFIX##_store_bytes(tx, daddr, buf, n);                             \
+    daddr += n;                                                                \
+    size -= n;                                                                 \
   }	                                                                       \
-  if (size > 0) {                                                              \
-    mtm_##PREFIX##_store_bytes(tx, daddr, buf, size);                          \
-  }                                                                            \
 }
 
 
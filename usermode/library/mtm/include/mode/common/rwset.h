@@ -62,6 +62,55 @@
 #ifndef _RWSET_H
 #define _RWSET_H
 
+
+#ifdef READ_SET_FILTER
+# define R_SET_FILTER_BITS (R_SET_FILTER_WORDS * sizeof(mtm_word_t) * 8)
+
+/*
+ * Two bit positions of the read set bloom filter for a lock. Locks are 
+ * consecutive words so the low bits of the lock index spread well; the 
+ * second position takes the high bits of a multiplicative hash.
+ */
+# define R_SET_FILTER_HASH1(lock) \
+	((((uintptr_t) (lock)) >> 3) & (R_SET_FILTER_BITS - 1))
+# define R_SET_FILTER_HASH2(lock) \
+	(((((uintptr_t) (lock)) >> 3) * 0x9E3779B97F4A7C15ULL >> 56) & (R_SET_FILTER_BITS - 1))
+
+# define R_SET_FILTER_BIT(filter, h) \
+	((filter)[(h) / (sizeof(mtm_word_t) * 8)] & ((mtm_word_t) 1 << ((h) % (sizeof(mtm_word_t) * 8))))
+
+static inline 
+void
+mtm_rs_filter_add(mode_data_t *modedata, volatile mtm_word_t *lock)
+{
+	unsigned int h1 = R_SET_FILTER_HASH1(lock);
+	unsigned int h2 = R_SET_FILTER_HASH2(lock);
+
+	modedata->r_set.filter[h1 / (sizeof(mtm_word_t) * 8)] |= (mtm_word_t) 1 << (h1 % (sizeof(mtm_word_t) * 8));
+	modedata->r_set.filter[h2 / (sizeof(mtm_word_t) * 8)] |= (mtm_word_t) 1 << (h2 % (sizeof(mtm_word_t) * 8));
+}
+
+static inline 
+int
+mtm_rs_filter_test(mode_data_t *modedata, volatile mtm_word_t *lock)
+{
+	return R_SET_FILTER_BIT(modedata->r_set.filter, R_SET_FILTER_HASH1(lock)) &&
+	       R_SET_FILTER_BIT(modedata->r_set.filter, R_SET_FILTER_HASH2(lock));
+}
+
+static inline 
+void
+mtm_rs_filter_clear(mode_data_t *modedata)
+{
+	int i;
+
+	for (i = 0; i < R_SET_FILTER_WORDS; i++) {
+		modedata->r_set.filter[i] = 0;
+	}
+}
+#endif /* READ_SET_FILTER */
+
+
 /*
  * Check if stripe has been read previously.
  */
@@ -70,6 +119,7 @@ r_entry_t *
 mtm_has_read(mtm_tx_t *tx, mode_data_t *modedata, volatile mtm_word_t *lock)
 {
 	r_entry_t   *r;
+	uint32_t    idx = (uint32_t) (lock - locks);
 	int         i;
 
 	PRINT_DEBUG("==> mtm_has_read(%p[%lu-%lu],%p)\n", tx, 
@@ -78,18 +128,53 @@ mtm_has_read(mtm_tx_t *tx, mode_data_t *modedata, volatile mtm_word_t *lock)
 	/* Check status */
 	assert(tx->status == TX_ACTIVE);
 
+#ifdef READ_SET_FILTER
+	/* Definitely not read? */
+	if (!mtm_rs_filter_test(modedata, lock)) {
+		return NULL;
+	}
+# ifdef _M_STATS_BUILD
+	m_stats_statset_increment(mtm_statsmgr, tx->statset, XACT, rsfilter_hits, 1);
+# endif
+#endif /* READ_SET_FILTER */
+
 	/* Look for read */
 	r = modedata->r_set.entries;
 	for (i = modedata->r_set.nb_entries; i > 0; i--, r++) {
-		if (r->lock == lock) {
+		if (r->lock == idx) {
 			/* Return first match*/
 			return r;
 		}
 	}
+#if defined(READ_SET_FILTER) && defined(_M_STATS_BUILD)
+	m_stats_statset_increment(mtm_statsmgr, tx->statset, XACT, rsfilter_false_positives, 1);
+#endif
 	return NULL;
 }
 
 
+/*
+ * Check whether a write-set entry pointer (taken from a lock) belongs to 
+ * this transaction's write set. Only compares addresses, so it is safe to 
+ * call with entries of other transactions.
+ */
+static inline 
+int 
+mtm_ws_owns_entry(mode_data_t *data, w_entry_t *w)
+{
+	int c;
+
+	for (c = 0; c <= data->w_set.cur_chunk; c++) {
+		if (data->w_set.chunks[c].entries <= w && 
+		    w < data->w_set.chunks[c].entries + data->w_set.chunks[c].nb_entries)
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
 /*
  * Validate read set (check if all read addresses are still valid now).
  */
@@ -111,26 +196,23 @@ mtm_validate(mtm_tx_t *tx, mode_data_t *modedata)
 	r = modedata->r_set.entries;
 	for (i = modedata->r_set.nb_entries; i > 0; i--, r++) {
 		/* Read lock */
-		l = ATOMIC_LOAD(r->lock);
+		l = ATOMIC_LOAD(R_ENTRY_LOCK(r));
 		/* Unlocked and still the same version? */
 		if (LOCK_GET_OWNED(l)) {
 			/* Do we own the lock? */
-#if DESIGN == WRITE_THROUGH
-			if ((mtm_tx_t *)LOCK_GET_ADDR(l) != tx)
-#else /* DESIGN != WRITE_THROUGH */
 			w_entry_t *w = (w_entry_t *)LOCK_GET_ADDR(l);
 			/* Simply check if address falls inside our write set (avoids non-faulting load) */
-			if (!(modedata->w_set.entries <= w && 
-			    w < modedata->w_set.entries + modedata->w_set.nb_entries))
-#endif /* DESIGN != WRITE_THROUGH */
+			if (!mtm_ws_owns_entry(modedata, w))
 			{
 				/* Locked by another transaction: cannot validate */
+				tx->conflict_lock = R_ENTRY_LOCK(r);
 				return 0;
 			}
 			/* We own the lock: OK */
 		} else {
-			if (LOCK_GET_TIMESTAMP(l) != r->version) {
+			if (!R_ENTRY_VALID(modedata, r, l)) {
 				/* Other version: cannot validate */
+				tx->conflict_lock = R_ENTRY_LOCK(r);
 				return 0;
 			}
 			/* Same version: OK */
@@ -140,6 +222,38 @@ mtm_validate(mtm_tx_t *tx, mode_data_t *modedata)
 }
 
 
+#ifdef INCREMENTAL_VALIDATION
+/*
+ * Validate the read set unless no commit other than the own ones of this
+ * transaction has begun since it was last validated with no commit in 
+ * flight, in which case no lock it covers can have changed. Each full 
+ * validation notes whether that shortcut holds for the next one.
+ */
+static inline 
+int 
+mtm_validate_incremental(mtm_tx_t *tx, mode_data_t *modedata, mtm_word_t own)
+{
+	mtm_word_t begun;
+	mtm_word_t done;
+
+	if (modedata->valid_quiescent && 
+	    ATOMIC_LOAD_ACQ(&mtm_commit_counters.begun) == modedata->valid_begun + own) 
+	{
+		return 1;
+	}
+	/* Done first: done <= begun, so equal counts mean none in flight */
+	done = ATOMIC_LOAD_ACQ(&mtm_commit_counters.done);
+	begun = ATOMIC_LOAD_ACQ(&mtm_commit_counters.begun);
+	if (!mtm_validate(tx, modedata)) {
+		return 0;
+	}
+	modedata->valid_quiescent = (begun == done);
+	modedata->valid_begun = begun;
+	return 1;
+}
+#endif /* INCREMENTAL_VALIDATION */
+
+
 /*
  * (Re)allocate read set entries.
  */
@@ -173,56 +287,558 @@ mtm_allocate_rs_entries(mtm_tx_t *tx, mode_data_t *data, int extend)
 }
 
 
+#ifdef WRITE_SET_INDEX
+/*
+ * Forget all write-set entries recorded in the index.
+ */
+static inline 
+void 
+mtm_ws_index_clear(mode_data_t *data)
+{
+	if (PointerHash_count(data->w_set.index) > 0) {
+		PointerHash_clean(data->w_set.index);
+	}
+}
+
+
+/*
+ * Return the write-set entry for addr, or NULL if addr hasn't been written.
+ */
+static inline 
+w_entry_t *
+mtm_ws_index_lookup(mode_data_t *data, volatile mtm_word_t *addr)
+{
+	return (w_entry_t *) PointerHash_at_(data->w_set.index, (void *) addr);
+}
+#endif /* WRITE_SET_INDEX */
+
+
 /*
- * (Re)allocate write set entries.
+ * Allocate a new write-set chunk of the given size.
  */
 static inline 
 void 
-mtm_allocate_ws_entries(mtm_tx_t *tx, mode_data_t *data, int extend)
+mtm_allocate_ws_chunk(mtm_tx_t *tx, mode_data_t *data, int size)
 {
-#if defined(READ_LOCKED_DATA) || defined(CONFLICT_TRACKING)
+	w_chunk_t *chunk;
+#if defined(READ_LOCKED_DATA) || defined(CONFLICT_TRACKING) || CM == CM_PRIORITY || CM == CM_POLICY
 	int i;
-	int first = (extend ? data->w_set.size : 0);
-#endif /* defined(READ_LOCKED_DATA) || defined(CONFLICT_TRACKING) */
+#endif /* defined(READ_LOCKED_DATA) || defined(CONFLICT_TRACKING) || CM == CM_PRIORITY || CM == CM_POLICY */
 
-	if (extend) {
-		/* Extend write set */
-		data->w_set.size *= 2;
-		PRINT_DEBUG("==> reallocate write set (%p[%lu-%lu],%d)\n", tx, 
-		            (unsigned long)data->start, (unsigned long)data->end, data->w_set.size);
-		if ((data->w_set.entries = 
-		     (w_entry_t *)realloc(data->w_set.entries, 
-		                          data->w_set.size * sizeof(w_entry_t))) == NULL) 
-		{
-			perror("realloc");
-			exit(1);
+	if (data->w_set.nb_chunks == W_SET_MAX_CHUNKS) {
+		fprintf(stderr, "Error: write set cannot grow beyond %d entries\n", data->w_set.size);
+		exit(1);
+	}
+	chunk = &data->w_set.chunks[data->w_set.nb_chunks];
+	PRINT_DEBUG("==> allocate write set chunk (%p[%lu-%lu],%d,%d)\n", tx, 
+	            (unsigned long)data->start, (unsigned long)data->end, 
+	            data->w_set.nb_chunks, size);
+	/* Cacheline aligned, which also meets the lock's ALIGNMENT requirement */
+	if (posix_memalign((void **)&chunk->entries, 
+	                   ALIGNMENT > CACHELINE_SIZE ? ALIGNMENT : CACHELINE_SIZE, 
+	                   size * sizeof(w_entry_t)) != 0) 
+	{
+		fprintf(stderr, "Error: cannot allocate aligned memory\n");
+		exit(1);
+	}
+	chunk->size = size;
+	chunk->nb_entries = 0;
+	data->w_set.nb_chunks++;
+	data->w_set.size += size;
+
+#if defined(READ_LOCKED_DATA) || defined(CONFLICT_TRACKING) || CM == CM_PRIORITY || CM == CM_POLICY
+	/* Initialize fields */
+	for (i = 0; i < size; i++) {
+		chunk->entries[i].tx = tx;
+	}	
+#endif /* defined(READ_LOCKED_DATA) || defined(CONFLICT_TRACKING) || CM == CM_PRIORITY || CM == CM_POLICY */
+}
+
+
+/*
+ * Allocate the write set with a first chunk of the given size.
+ */
+static inline 
+void 
+mtm_allocate_ws_entries(mtm_tx_t *tx, mode_data_t *data, int size)
+{
+	data->w_set.nb_entries = 0;
+	data->w_set.size = 0;
+	data->w_set.nb_chunks = 0;
+	data->w_set.cur_chunk = 0;
+	mtm_allocate_ws_chunk(tx, data, size);
+	data->w_set.entries = data->w_set.chunks[0].entries;
+	data->w_set.sorted = NULL;
+	data->w_set.sort_tmp = NULL;
+	data->w_set.sort_size = 0;
+
+#ifdef WRITE_SET_INDEX
+	data->w_set.index = PointerHash_new();
+#endif /* WRITE_SET_INDEX */
+}
+
+
+/*
+ * Free all write set chunks.
+ */
+static inline 
+void 
+mtm_free_ws_entries(mode_data_t *data)
+{
+	int c;
+#ifdef EPOCH_GC
+	mtm_word_t t = GET_CLOCK;
+#endif /* EPOCH_GC */
+
+	for (c = 0; c < data->w_set.nb_chunks; c++) {
+#ifdef EPOCH_GC
+		gc_free(data->w_set.chunks[c].entries, t);
+#else /* ! EPOCH_GC */
+		free(data->w_set.chunks[c].entries);
+#endif /* ! EPOCH_GC */
+	}
+	data->w_set.nb_chunks = 0;
+	free(data->w_set.sorted);
+	free(data->w_set.sort_tmp);
+	data->w_set.sort_size = 0;
+#ifdef WRITE_SET_INDEX
+	PointerHash_free(data->w_set.index);
+#endif /* WRITE_SET_INDEX */
+}
+
+
+/*
+ * Empty the write set, keeping its chunks for reuse.
+ */
+static inline 
+void 
+mtm_clear_ws_entries(mode_data_t *data)
+{
+	int c;
+
+	for (c = 0; c <= data->w_set.cur_chunk; c++) {
+		data->w_set.chunks[c].nb_entries = 0;
+	}
+	data->w_set.cur_chunk = 0;
+	data->w_set.nb_entries = 0;
+#ifdef WRITE_SET_INDEX
+	mtm_ws_index_clear(data);
+#endif /* WRITE_SET_INDEX */
+}
+
+
+/*
+ * Sizing of the read and write sets by transaction site, the call site of 
+ * the outermost begin. A thread keeps the high-water marks of the sets the
+ * transactions of each site commit with, which decay while they commit 
+ * with less, and grows the sets to them before a transaction of the site 
+ * runs rather than by doubling while it runs. Every RW_SET_SHRINK_PERIOD 
+ * transactions, sets RW_SET_SHRINK_FACTOR times larger than the largest 
+ * ones used meanwhile shrink back. Write-set chunks are only freed with 
+ * EPOCH_GC, as other threads may still follow a lock to their entries.
+ */
+#define RW_SET_SHRINK_PERIOD  1024
+#define RW_SET_SHRINK_FACTOR  4
+
+#define RW_SET_SITE(data, site)                                                \
+	(&(data)->sites[(((site) * 0x9E3779B97F4A7C15ULL) >> 32) & (RW_SET_SITES - 1)])
+
+/* A high-water mark moves up at once and an eighth of the way down */
+#define RW_SET_HWM(hwm, n)                                                     \
+	((n) >= (hwm) ? (n) : (hwm) - (((hwm) - (n)) >> 3))
+
+
+/*
+ * Reallocate the (empty) read set with size entries.
+ */
+static inline 
+void 
+mtm_resize_rs_entries(mtm_tx_t *tx, mode_data_t *data, int size)
+{
+#ifdef EPOCH_GC
+	gc_free(data->r_set.entries, GET_CLOCK);
+#else /* ! EPOCH_GC */
+	free(data->r_set.entries);
+#endif /* ! EPOCH_GC */
+	data->r_set.size = size;
+	mtm_allocate_rs_entries(tx, data, 0);
+}
+
+
+/*
+ * Smallest power-of-2 multiple of RW_SET_SIZE of at least n entries.
+ */
+static inline 
+int 
+mtm_rwset_fit(int n)
+{
+	int size = RW_SET_SIZE;
+
+	while (size < n) {
+		size *= 2;
+	}
+	return size;
+}
+
+
+/*
+ * Size the empty sets for the outermost transaction about to run.
+ */
+static inline 
+void 
+mtm_rwset_site_begin(mtm_tx_t *tx, mode_data_t *data)
+{
+	mtm_pwb_site_t *s = RW_SET_SITE(data, tx->site);
+	int            size;
+#ifdef EPOCH_GC
+	int            c;
+	mtm_word_t     t;
+#endif /* EPOCH_GC */
+
+	if (unlikely(++data->sized_begins == RW_SET_SHRINK_PERIOD)) {
+		size = mtm_rwset_fit(data->r_peak);
+		if (data->r_set.size >= size * RW_SET_SHRINK_FACTOR) {
+			mtm_resize_rs_entries(tx, data, size);
+		}
+		size = mtm_rwset_fit(data->w_peak);
+		if (data->w_set.sort_size >= size * RW_SET_SHRINK_FACTOR) {
+			free(data->w_set.sorted);
+			free(data->w_set.sort_tmp);
+			data->w_set.sorted = NULL;
+			data->w_set.sort_tmp = NULL;
+			data->w_set.sort_size = 0;
+		}
+#ifdef EPOCH_GC
+		if (data->w_set.nb_chunks > 1 && data->w_set.size >= size * RW_SET_SHRINK_FACTOR) {
+			t = GET_CLOCK;
+			for (c = 1; c < data->w_set.nb_chunks; c++) {
+				gc_free(data->w_set.chunks[c].entries, t);
+				data->w_set.size -= data->w_set.chunks[c].size;
+			}
+			data->w_set.nb_chunks = 1;
 		}
+#endif /* EPOCH_GC */
+		data->sized_begins = 0;
+		data->r_peak = 0;
+		data->w_peak = 0;
+	}
+
+	if (s->site != tx->site) {
+		return;
+	}
+	if (s->r_hwm > data->r_set.size) {
+		mtm_resize_rs_entries(tx, data, mtm_rwset_fit(s->r_hwm));
+	}
+	if (s->w_hwm > data->w_set.size && data->w_set.nb_chunks < W_SET_MAX_CHUNKS) {
+		mtm_allocate_ws_chunk(tx, data, s->w_hwm - data->w_set.size);
+	}
+}
+
+
+/*
+ * Record the sets the outermost transaction commits with.
+ */
+static inline 
+void 
+mtm_rwset_site_commit(mtm_tx_t *tx, mode_data_t *data)
+{
+	mtm_pwb_site_t *s = RW_SET_SITE(data, tx->site);
+	int            r = data->r_set.nb_entries;
+	int            w = data->w_set.nb_entries;
+
+	if (s->site != tx->site) {
+		s->site = tx->site;
+		s->r_hwm = r;
+		s->w_hwm = w;
 	} else {
-		/* Allocate write set */
-#if ALIGNMENT == 1 /* no alignment requirement */
-		if ((data->w_set.entries = 
-		     (w_entry_t *)malloc(data->w_set.size * sizeof(w_entry_t))) == NULL)
+		s->r_hwm = RW_SET_HWM(s->r_hwm, r);
+		s->w_hwm = RW_SET_HWM(s->w_hwm, w);
+	}
+	if (r > data->r_peak) {
+		data->r_peak = r;
+	}
+	if (w > data->w_peak) {
+		data->w_peak = w;
+	}
+}
+
+
+/* Write sets up to this size are sorted by insertion instead of radix sort */
+#define W_SET_SORT_INSERTION_MAX 32
+
+/* Sort key of write-set entry w: its address, or the address of its lock */
+#define W_SET_SORT_KEY(w, by_lock)                                             \
+	((by_lock) ? (uintptr_t) (w)->lock : (uintptr_t) (w)->addr)
+
+/*
+ * Sort the write-set entries by address (or by lock) into w_set.sorted and
+ * return their number.
+ *
+ * Larger write sets are radix sorted one byte of the key at a time, 
+ * skipping the bytes in which all keys agree (usually all but two or 
+ * three of them).
+ */
+static inline
+int
+mtm_ws_sort_by(mode_data_t *data, int by_lock)
+{
+	w_entry_t **a;
+	w_entry_t **b;
+	w_entry_t **t;
+	w_entry_t *w;
+	uintptr_t first;
+	uintptr_t diff = 0;
+	int       count[256];
+	int       shift;
+	int       sum;
+	int       n;
+	int       c;
+	int       i;
+	int       j;
+
+	if (data->w_set.sort_size < data->w_set.nb_entries) {
+		free(data->w_set.sorted);
+		free(data->w_set.sort_tmp);
+		data->w_set.sort_size = data->w_set.size;
+		if ((data->w_set.sorted = (w_entry_t **) malloc(data->w_set.sort_size * sizeof(w_entry_t *))) == NULL ||
+		    (data->w_set.sort_tmp = (w_entry_t **) malloc(data->w_set.sort_size * sizeof(w_entry_t *))) == NULL)
 		{
 			perror("malloc");
 			exit(1);
 		}
-#else
-		if (posix_memalign((void **)&data->w_set.entries, 
-		                   ALIGNMENT, 
-		                   data->w_set.size * sizeof(w_entry_t)) != 0) 
+	}
+	a = data->w_set.sorted;
+	b = data->w_set.sort_tmp;
+	n = 0;
+	W_SET_FOR_EACH_ENTRY(&data->w_set, c, i, w) {
+		a[n++] = w;
+	}
+	if (n <= W_SET_SORT_INSERTION_MAX) {
+		for (i = 1; i < n; i++) {
+			w = a[i];
+			for (j = i; j > 0 && W_SET_SORT_KEY(a[j-1], by_lock) > W_SET_SORT_KEY(w, by_lock); j--) {
+				a[j] = a[j-1];
+			}
+			a[j] = w;
+		}
+		return n;
+	}
+
+	first = W_SET_SORT_KEY(a[0], by_lock);
+	for (i = 1; i < n; i++) {
+		diff |= W_SET_SORT_KEY(a[i], by_lock) ^ first;
+	}
+	for (shift = 0; shift < 8 * sizeof(uintptr_t); shift += 8) {
+		if (((diff >> shift) & 0xFF) == 0) {
+			continue;
+		}
+		memset(count, 0, sizeof(count));
+		for (i = 0; i < n; i++) {
+			count[(W_SET_SORT_KEY(a[i], by_lock) >> shift) & 0xFF]++;
+		}
+		for (c = 0, sum = 0; c < 256; c++) {
+			j = count[c];
+			count[c] = sum;
+			sum += j;
+		}
+		for (i = 0; i < n; i++) {
+			b[count[(W_SET_SORT_KEY(a[i], by_lock) >> shift) & 0xFF]++] = a[i];
+		}
+		t = a;
+		a = b;
+		b = t;
+	}
+	data->w_set.sorted = a;
+	data->w_set.sort_tmp = b;
+	return n;
+}
+
+
+/*
+ * Sort the write-set entries by address. Entries of the same cacheline end
+ * up next to each other, so that write-back visits each line once and 
+ * consecutive lines back to back.
+ */
+static inline
+int
+mtm_ws_sort(mode_data_t *data)
+{
+	return mtm_ws_sort_by(data, 0);
+}
+
+
+/*
+ * Sort the write-set entries by lock, so that the locks are acquired in 
+ * the same global order by every transaction (commit-time locking).
+ */
+static inline
+int
+mtm_ws_sort_locks(mode_data_t *data)
+{
+	return mtm_ws_sort_by(data, 1);
+}
+
+
+/*
+ * Return the next free write-set entry without consuming it, linking in a 
+ * new chunk if the current one is full. Existing entries never move.
+ */
+static inline 
+w_entry_t *
+mtm_ws_next_free_entry(mtm_tx_t *tx, mode_data_t *data)
+{
+	w_chunk_t *chunk = &data->w_set.chunks[data->w_set.cur_chunk];
+
+	if (chunk->nb_entries == chunk->size) {
+		if (data->w_set.cur_chunk + 1 == data->w_set.nb_chunks) {
+			mtm_allocate_ws_chunk(tx, data, chunk->size * 2);
+		}
+		chunk = &data->w_set.chunks[++data->w_set.cur_chunk];
+	}
+	return &chunk->entries[chunk->nb_entries];
+}
+
+
+/*
+ * Consume the entry returned by the last call to mtm_ws_next_free_entry.
+ */
+static inline 
+void 
+mtm_ws_consume_entry(mode_data_t *data)
+{
+	data->w_set.chunks[data->w_set.cur_chunk].nb_entries++;
+	data->w_set.nb_entries++;
+}
+
+
+#ifdef CLOSED_NESTING
+/*
+ * Check whether entry w was in the write set when the innermost savepoint 
+ * was taken.
+ */
+static inline 
+int 
+mtm_ws_entry_before_savepoint(mode_data_t *data, w_entry_t *w)
+{
+	mtm_pwb_savepoint_t *sp = &data->savepoints[data->nb_savepoints - 1];
+	int                 c;
+
+	for (c = 0; c < sp->w_chunk; c++) {
+		if (data->w_set.chunks[c].entries <= w && 
+		    w < data->w_set.chunks[c].entries + data->w_set.chunks[c].nb_entries)
 		{
-			fprintf(stderr, "Error: cannot allocate aligned memory\n");
-			exit(1);
+			return 1;
 		}
-#endif
 	}
+	return (data->w_set.chunks[c].entries <= w && 
+	        w < data->w_set.chunks[c].entries + sp->w_chunk_entries);
+}
 
-#if defined(READ_LOCKED_DATA) || defined(CONFLICT_TRACKING)
-	/* Initialize fields */
-	for (i = first; i < data->w_set.size; i++) {
-		data->w_set.entries[i].tx = tx;
+
+/*
+ * (Re)allocate write-set undo log entries.
+ */
+static inline 
+void 
+mtm_allocate_ws_undo_entries(mtm_tx_t *tx, mode_data_t *data, int extend)
+{
+	if (extend) {
+		data->w_undo.size *= 2;
 	}	
-#endif /* defined(READ_LOCKED_DATA) || defined(CONFLICT_TRACKING) */
+	if ((data->w_undo.entries = 
+	     (mtm_pwb_w_undo_entry_t *)realloc(data->w_undo.entries, 
+	                                       data->w_undo.size * sizeof(mtm_pwb_w_undo_entry_t))) == NULL) 
+	{
+		perror("realloc");
+		exit(1);
+	}
 }
 
+
+/*
+ * Remember the current value of an entry that is about to be overwritten 
+ * by a nested transaction, if the entry belongs to an enclosing one.
+ */
+static inline 
+void 
+mtm_ws_undo_log(mtm_tx_t *tx, mode_data_t *data, w_entry_t *w)
+{
+	mtm_pwb_w_undo_entry_t *u;
+
+	if (data->nb_savepoints == 0 || !mtm_ws_entry_before_savepoint(data, w)) {
+		return;
+	}
+	if (data->w_undo.nb_entries == data->w_undo.size) {
+		mtm_allocate_ws_undo_entries(tx, data, 1);
+	}
+	u = &data->w_undo.entries[data->w_undo.nb_entries++];
+	u->entry = w;
+	u->value = w->value;
+	u->mask = w->mask;
+}
+#endif /* CLOSED_NESTING */
+
+
+
+#ifdef _M_STATS_BUILD
+/*
+ * Sample a conflict detected on lock into the conflict hot spot report.
+ * addr is NULL when the conflicting address is unknown.
+ */
+static inline
+void
+mtm_count_conflict(mtm_tx_t *tx, volatile mtm_word_t *lock, 
+                   volatile mtm_word_t *addr, const char *reason)
+{
+	m_stats_threadstat_conflict(tx->threadstat, tx->site, 
+	                            (uintptr_t) (lock - locks), (uintptr_t) addr, 
+	                            reason);
+	tx->stats_abort_owner = 0;
+}
+
+
+# define LOCK_ALIAS_SCAN_MAX 16
+/*
+ * Account for an abort caused by finding addr's lock owned by another 
+ * transaction. If none of the owner's entries chained on the lock covers
+ * the stripe of addr then the conflict is only due to two stripes hashing
+ * to the same lock (a false conflict) and a larger lock array would have 
+ * avoided it.
+ *
+ * The owner's entries are read without synchronization, so the result is
+ * a best-effort estimate. This is fine for statistics: write-set chunks are
+ * only freed when the owning thread exits.
+ */
+static inline
+void
+mtm_count_lock_conflict(mtm_tx_t *tx, volatile mtm_word_t *addr, mtm_word_t l, 
+                        const char *reason)
+{
+	w_entry_t *w;
+	int       n;
+
+	m_stats_statset_increment(mtm_statsmgr, tx->statset, XACT, aborts_locked, 1);
+	mtm_count_conflict(tx, GET_LOCK(addr), addr, reason);
+	if (!LOCK_GET_OWNED(l)) {
+		return;
+	}
+	w = (w_entry_t *) LOCK_GET_ADDR(l);
+#if defined(READ_LOCKED_DATA) || defined(CONFLICT_TRACKING) || CM == CM_PRIORITY || CM == CM_POLICY
+	/* For the abort stack sampler; the owner may have moved on already */
+	if (w != NULL && w->tx != NULL) {
+		tx->stats_abort_owner = w->tx->site;
+	}
+#endif /* defined(READ_LOCKED_DATA) || defined(CONFLICT_TRACKING) || CM == CM_PRIORITY || CM == CM_POLICY */
+	for (n = 0; w != NULL && n < LOCK_ALIAS_SCAN_MAX; n++, w = w->next) {
+		if (LOCK_STRIPE(w->addr) == LOCK_STRIPE(addr)) {
+			return;
+		}
+	}
+	if (n < LOCK_ALIAS_SCAN_MAX) {
+		m_stats_statset_increment(mtm_statsmgr, tx->statset, XACT, aborts_locked_aliased, 1);
+	}
+}
+#endif /* _M_STATS_BUILD */
+
+
 #endif
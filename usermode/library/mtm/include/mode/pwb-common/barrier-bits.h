@@ -63,6 +63,8 @@
 #include <cm.h>
 #include <rwset.h>
 #include <mask.h>
+#include <readcache.h>
+#include <mvstore.h>
 
 
 #ifndef _PWB_COMMON_BARRIER_BITS_JKI671_H
@@ -94,7 +96,11 @@ pwb_extend (mtm_tx_t *tx, mode_data_t *modedata)
 	}
 #endif /* ROLLOVER_CLOCK */
 	/* Try to validate read set */
+#ifdef INCREMENTAL_VALIDATION
+	if (mtm_validate_incremental(tx, modedata, 0)) {
+#else /* ! INCREMENTAL_VALIDATION */
 	if (mtm_validate(tx, modedata)) {
+#endif /* ! INCREMENTAL_VALIDATION */
 		/* It works: we can extend until now */
 		modedata->end = now;
 		return 1;
@@ -103,6 +109,72 @@ pwb_extend (mtm_tx_t *tx, mode_data_t *modedata)
 }
 
 
+/*
+ * Take the start snapshot. This is done at the first access to shared 
+ * data rather than at begin: every commit writes the clock, so reading it
+ * is likely a cache miss, which transactions that only touch their stack
+ * need not pay.
+ */
+static inline 
+void 
+pwb_snapshot (mtm_tx_t *tx, mode_data_t *modedata)
+{
+start:
+	modedata->start = modedata->end = GET_CLOCK;
+#ifdef ROLLOVER_CLOCK
+	if (modedata->start >= VERSION_MAX) {
+		/* Overflow: we must reset clock (we hold no lock yet) */
+		mtm_overflow(tx);
+		goto start;
+	}
+#endif /* ROLLOVER_CLOCK */
+#ifdef EPOCH_GC
+	gc_set_epoch(modedata->start);
+#endif /* EPOCH_GC */
+	modedata->has_snapshot = 1;
+}
+
+
+/*
+ * Stores to persistent blocks the transaction itself allocated go straight
+ * to memory: no other thread can reach a block before the transaction 
+ * commits, and an abort frees it, so neither locking nor the redo log is
+ * needed. The blocks are flushed at commit instead (see pwb_trycommit).
+ * Savepoints end the capture of the blocks allocated before them, whose 
+ * contents a rollback to the savepoint would have to restore.
+ */
+static inline
+void
+pwb_captured_add(mtm_tx_t *tx, mode_data_t *modedata, const void *addr, size_t size)
+{
+	mtm_pwb_captured_t *c;
+
+	if (PWB_IN_HTM(tx) || modedata->nb_captured == PWB_MAX_CAPTURED) {
+		return;
+	}
+	c = &modedata->captured[modedata->nb_captured++];
+	c->start = (uintptr_t) addr;
+	c->end = (uintptr_t) addr + size;
+}
+
+
+static inline
+int
+pwb_captured_find(mode_data_t *modedata, volatile mtm_word_t *addr)
+{
+	int i;
+
+	for (i = 0; i < modedata->nb_captured; i++) {
+		if ((uintptr_t) addr - modedata->captured[i].start < 
+		    modedata->captured[i].end - modedata->captured[i].start) 
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
 /*!
  * Write the value to an uninitialized write-set entry. This should be done, for
  * instance, if this transaction has not previously written to the address given,
@@ -142,8 +214,8 @@ w_entry_t* initialize_write_set_entry(w_entry_t* entry,
 	mask_new_value(entry, address, value, mask);
 	entry->version = version;
 	entry->next = NULL;
-	entry->next_cache_neighbor = NULL;
 	entry->is_nonvolatile = is_nonvolatile;
+	entry->is_logical = 0;
 	
 	return entry;
 }
@@ -160,14 +232,11 @@ w_entry_t* initialize_write_set_entry(w_entry_t* entry,
  * \param new_entry is a correctly-initialized entry. This must not be NULL.
  * \param transaction is the transaction under which the insertion is made. This is
  *  necessary for bookkeeping on the total size of the list.
- * \param cache_neigbor is a write entry whose address places it in the same cache line
- *  as new_entry. The new cacheline will be appended after 
  */
 static
-void insert_write_set_entry_after(w_entry_t* new_entry, 
-                                  w_entry_t* tail, 
-                                  mtm_tx_t* transaction, 
-                                  w_entry_t* cache_neighbor)
+void link_write_set_entry_after(w_entry_t* new_entry, 
+                                w_entry_t* tail, 
+                                mtm_tx_t* transaction)
 {
 	/* Append the entry to the list. */
 	if (tail != NULL) {
@@ -177,20 +246,31 @@ void insert_write_set_entry_after(w_entry_t* new_entry,
 		new_entry->next = NULL;
 	}
 	
-	/* Attach the new entry to others in the same cache block/line. */
-	if (cache_neighbor != NULL) {
-		new_entry->next_cache_neighbor = cache_neighbor->next_cache_neighbor;
-		cache_neighbor->next_cache_neighbor = new_entry;
-	} else {
-		new_entry->next_cache_neighbor = NULL;
-	}
-	
 	/* Update the total number of entries. */
-	mode_data_t* modedata = (mode_data_t *) transaction->modedata[transaction->mode];
-	modedata->w_set.nb_entries++;
+	mode_data_t* modedata = (mode_data_t *) transaction->active_modedata;
+	mtm_ws_consume_entry(modedata);
+
+#ifdef WRITE_SET_INDEX
+	PointerHash_at_put_(modedata->w_set.index, (void *) new_entry->addr, new_entry);
+#endif /* WRITE_SET_INDEX */
+}
 
-	/* Write the new entry to the persistent TM log as well? */
-	if (new_entry->is_nonvolatile) {
+
+/*!
+ * Same as link_write_set_entry_after, and writes the new entry to the 
+ * persistent TM log as well.
+ */
+static
+void insert_write_set_entry_after(w_entry_t* new_entry, 
+                                  w_entry_t* tail, 
+                                  mtm_tx_t* transaction)
+{
+	mode_data_t* modedata = (mode_data_t *) transaction->active_modedata;
+
+	link_write_set_entry_after(new_entry, tail, transaction);
+
+	/* Write the new entry to the persistent TM log as well? (may be deferred to commit) */
+	if (new_entry->is_nonvolatile && !PWB_DEFER_LOG(transaction)) {
 		M_TMLOG_WRITE(transaction->pcm_storeset, modedata->ptmlog, (uintptr_t) new_entry->addr, new_entry->value, new_entry->mask);
 	}
 }
@@ -206,9 +286,6 @@ void insert_write_set_entry_after(w_entry_t* new_entry,
  *  this output parameter is set to the tail of the write-set to aid in the appending
  *  of a new entry. If the given parameter is NULL or a matching entry is located,
  *  this value is undefined.
- * \param last_cache_neighbor is written with the last entry discovered whose address
- *  would be stored in the same cache line. This may be useful if entries are flushed
- *  to persistent storage by cache line (instead of by word). This parameter may be NULL.
  *
  * \return NULL, if the address is not referenced in the write set. Otherwise, returns
  *  a pointer to the write-set entry that contained that address.
@@ -217,14 +294,10 @@ static inline
 w_entry_t *
 matching_write_set_entry(w_entry_t* const list_head,
                          volatile mtm_word_t* address,
-                         w_entry_t** list_tail,
-                         w_entry_t** last_cache_neighbor)
+                         w_entry_t** list_tail)
 {
 	w_entry_t* this_entry = list_head;  // The entry examined in "this" iteration of the loop.
 	while (true) {
-		if (last_cache_neighbor != NULL  &&  BLOCK_ADDR(address) == BLOCK_ADDR(this_entry->addr))
-			*last_cache_neighbor = this_entry;
-		
 		if (address == this_entry->addr) {
 			// Found a matching entry!
 			return this_entry;
@@ -243,6 +316,56 @@ matching_write_set_entry(w_entry_t* const list_head,
 }
 
 
+#if DESIGN == WRITE_BACK_CTL
+/*!
+ * Returns the write-set entry of address, or NULL if the transaction has not 
+ * written it. With commit-time locking the entries hang off private 
+ * pseudo-locks, which are all ours, until commit.
+ */
+static inline
+w_entry_t *
+pwb_ctl_lookup(mtm_tx_t *tx, mode_data_t *modedata, volatile mtm_word_t *address)
+{
+	mtm_word_t l = *PRIVATE_GET_LOCK(tx, address);
+
+	if (!LOCK_GET_OWNED(l)) {
+		return NULL;
+	}
+#ifdef WRITE_SET_INDEX
+	return mtm_ws_index_lookup(modedata, address);
+#else /* !WRITE_SET_INDEX */
+	return matching_write_set_entry((w_entry_t *) LOCK_GET_ADDR(l), address, NULL);
+#endif /* !WRITE_SET_INDEX */
+}
+#endif /* DESIGN == WRITE_BACK_CTL */
+
+
+#if DESIGN == WRITE_THROUGH
+/*!
+ * Stores a masked value in place through write-set entry w, whose lock the
+ * transaction holds. The first store through w saves the old word in the 
+ * entry, for rollback, and in the undo log if it is persistent. The log 
+ * record is durable before the store can reach persistent memory.
+ */
+static inline
+void
+pwb_wt_store(mtm_tx_t *tx, mode_data_t *modedata, w_entry_t *w, mtm_word_t value, mtm_word_t mask)
+{
+	if (mask == 0) {
+		return;
+	}
+	if (w->mask == 0) {
+		w->value = ATOMIC_LOAD(w->addr);
+		w->mask = ~(mtm_word_t) 0;
+		if (w->is_nonvolatile && !PWB_NO_LOG) {
+			M_TMLOG_WRITE(tx->pcm_storeset, modedata->ptmlog, (uintptr_t) w->addr, w->value, w->mask);
+		}
+	}
+	pwb_store_aligned_masked(tx, w->addr, value, mask);
+}
+#endif /* DESIGN == WRITE_THROUGH */
+
+
 /**
  * \brief Store a masked value of size less than or equal to a word, creating or
  * updating a write-set entry as necessary.
@@ -264,6 +387,9 @@ matching_write_set_entry(w_entry_t* const list_head,
  * \param value includes the bits which are being written.
  * \param mask determines the relevant bits of value. Only these bits are written
  *  to the write set entry and/or memory.
+ * \param log_write tells whether the updated entry is written to the persistent
+ *  TM log. Callers that pass 0 must log the write themselves. Write-through
+ *  logs old values to the undo log regardless.
  *
  * \return If addr is a stack address, this routine returns NULL (stack addresses
  *  are not logged). Otherwise, returns a pointer to the updated write-set entry
@@ -271,15 +397,17 @@ matching_write_set_entry(w_entry_t* const list_head,
  */
 static inline 
 w_entry_t *
-pwb_write_internal(mtm_tx_t *tx, 
-                   volatile mtm_word_t *addr, 
-                   mtm_word_t value,
-                   mtm_word_t mask,
-		           int enable_isolation)
+pwb_write_entry(mtm_tx_t *tx, 
+                volatile mtm_word_t *addr, 
+                mtm_word_t value,
+                mtm_word_t mask,
+                int enable_isolation,
+                int log_write)
 {
 	assert(tx->mode == MTM_MODE_pwbnl || tx->mode == MTM_MODE_pwbetl);
-	mode_data_t         *modedata = (mode_data_t *) tx->modedata[tx->mode];
+	mode_data_t         *modedata = (mode_data_t *) tx->active_modedata;
 	volatile mtm_word_t *lock;
+	volatile mtm_word_t *chain;
 	mtm_word_t          l;
 	mtm_word_t          version;
 	w_entry_t           *w;
@@ -299,6 +427,10 @@ pwb_write_internal(mtm_tx_t *tx,
 	if (tx->status != TX_ACTIVE) {
 		assert(0);
 	}
+	/* Inside a logical operation its record stands for the stores */
+	if (modedata->logical_op) {
+		log_write = 0;
+	}
 
 #if 0
 /* ENABLES NULL BARRIERS */
@@ -330,6 +462,15 @@ pwb_write_internal(mtm_tx_t *tx,
 	     (uintptr_t) addr < (PSEGMENT_RESERVED_REGION_START + PSEGMENT_RESERVED_REGION_SIZE)))
 	{
 		access_is_nonvolatile = 1;
+
+		/* A block the transaction allocated: store in place */
+		if (modedata->nb_captured > 0 && pwb_captured_find(modedata, addr)) {
+#ifdef _M_STATS_BUILD
+			m_stats_statset_increment(mtm_statsmgr, tx->statset, XACT, captured_writes, 1);
+#endif
+			PCM_WB_STORE_MASKED(tx->pcm_storeset, addr, value, mask);
+			return NULL;
+		}
 	} else {
 		access_is_nonvolatile = 0;
 
@@ -382,6 +523,23 @@ pwb_write_internal(mtm_tx_t *tx,
 		}
 	}
 
+
+	if (enable_isolation && unlikely(!modedata->has_snapshot) && !PWB_IN_HTM(tx)) {
+		pwb_snapshot(tx, modedata);
+	}
+
+	/* Read-only transactions have no read set to validate a write against */
+	if (modedata->read_only) {
+#ifdef HTM_FASTPATH
+		if (PWB_IN_HTM(tx)) {
+			htm_abort(HTM_CODE_RESTART);
+		}
+#endif /* HTM_FASTPATH */
+		mtm_pwb_restart_transaction(tx, RESTART_NOT_READONLY);
+	}
+	if (access_is_nonvolatile) {
+		modedata->has_nvwrite = 1;
+	}
 	
 #ifdef _M_STATS_BUILD
 	m_stats_statset_increment(mtm_statsmgr, tx->statset, XACT, writes, 1);
@@ -405,10 +563,17 @@ pwb_write_internal(mtm_tx_t *tx,
 		 */
 		lock = PRIVATE_GET_LOCK(tx, addr);
 	}
+	/* The entries covered by the lock hang off the lock itself, or off a
+	 * private pseudo-lock until commit acquires the lock (CTL) */
+	if (PWB_LOCK_AT_COMMIT && enable_isolation) {
+		chain = PRIVATE_GET_LOCK(tx, addr);
+	} else {
+		chain = lock;
+	}
 
 	/* Try to acquire lock */
 restart:
-	l = ATOMIC_LOAD_ACQ(lock);
+	l = ATOMIC_LOAD_ACQ(chain);
 restart_no_load:
 	if (LOCK_GET_OWNED(l)) {
 		/* Locked */
@@ -417,56 +582,64 @@ restart_no_load:
 		write_set_head = (w_entry_t *)LOCK_GET_ADDR(l);
 		
 		/* Simply check if address falls inside our write set (avoids non-faulting load) */
-		if (modedata->w_set.entries <= write_set_head &&
-		    write_set_head < modedata->w_set.entries + modedata->w_set.nb_entries) 
-		{
+		if (mtm_ws_owns_entry(modedata, write_set_head)) {
 			/* The written address already hashes into our write set. */
 			/* Did we previously write the exact same address? */
 			w_entry_t* write_set_tail = NULL;
-			w_entry_t* last_entry_in_same_cache_block = NULL;
-			w_entry_t* matching_entry = matching_write_set_entry(write_set_head, addr, &write_set_tail, &last_entry_in_same_cache_block);
+#ifdef WRITE_SET_INDEX
+			/* Chain order doesn't matter, so a new entry goes right after the head */
+			w_entry_t* matching_entry = mtm_ws_index_lookup(modedata, addr);
+			if (matching_entry == NULL) {
+				write_set_tail = write_set_head;
+			}
+#else /* !WRITE_SET_INDEX */
+			w_entry_t* matching_entry = matching_write_set_entry(write_set_head, addr, &write_set_tail);
+#endif /* !WRITE_SET_INDEX */
 			if (matching_entry != NULL) {
-				if (matching_entry->mask != 0) {
+				if (mask != 0) {
+#if DESIGN == WRITE_THROUGH
+					pwb_wt_store(tx, modedata, matching_entry, value, mask);
+#else /* DESIGN != WRITE_THROUGH */
+#ifdef CLOSED_NESTING
+					mtm_ws_undo_log(tx, modedata, matching_entry);
+#endif /* CLOSED_NESTING */
 					mask_new_value(matching_entry, addr, value, mask);
-					/* Write out the entry to the persistent TM log? */
-					if (access_is_nonvolatile) {
+					matching_entry->is_logical = modedata->logical_op;
+					/* Write out the entry to the persistent TM log? (may be deferred to commit) */
+					if (access_is_nonvolatile && !PWB_DEFER_LOG(tx) && log_write) {
 						M_TMLOG_WRITE(tx->pcm_storeset, modedata->ptmlog, (uintptr_t) matching_entry->addr, matching_entry->value, matching_entry->mask);
 					}	
+#endif /* DESIGN != WRITE_THROUGH */
 				}
 				return matching_entry;
 			} else {
-				if (modedata->w_set.nb_entries == modedata->w_set.size) {
-					/* Extend write set (invalidate pointers to write set entries => abort and reallocate) */
-					modedata->w_set.size *= 2;
-					modedata->w_set.reallocate = 1;
 #ifdef _M_STATS_BUILD
-					m_stats_statset_increment(mtm_statsmgr, tx->statset, XACT, aborts, 1);
-#endif					
-					#ifdef INTERNAL_STATS
-						tx->aborts_reallocate++;
-					#endif
-					
-					mtm_pwb_restart_transaction (tx, RESTART_REALLOCATE);  // Does not return!
+				m_stats_statset_increment(mtm_statsmgr, tx->statset, XACT, writes_distinct, 1);
+				if (access_is_nonvolatile) {
+					m_stats_statset_increment(mtm_statsmgr, tx->statset, XACT, nvwrites_distinct, 1);
 				} else {
-#ifdef _M_STATS_BUILD
-					m_stats_statset_increment(mtm_statsmgr, tx->statset, XACT, writes_distinct, 1);
-					if (access_is_nonvolatile) {
-						m_stats_statset_increment(mtm_statsmgr, tx->statset, XACT, nvwrites_distinct, 1);
-					} else {
-						m_stats_statset_increment(mtm_statsmgr, tx->statset, XACT, vwrites_distinct, 1);
-					}
+					m_stats_statset_increment(mtm_statsmgr, tx->statset, XACT, vwrites_distinct, 1);
+				}
 #endif					
-					// Build a new write set entry
-					w = &modedata->w_set.entries[modedata->w_set.nb_entries];
-					version = write_set_tail->version;  // Get version from previous write set entry (all
-					                                    // entries in linked list have same version)
-					w_entry_t* initialized_entry = initialize_write_set_entry(w, addr, value, mask, version, lock, access_is_nonvolatile);
+				// Build a new write set entry (links in a new chunk if the write set is full)
+				w = mtm_ws_next_free_entry(tx, modedata);
+				version = write_set_tail->version;  // Get version from previous write set entry (all
+				                                    // entries in linked list have same version)
+				// With write-through the entry gets the old value at the store below
+				w_entry_t* initialized_entry = initialize_write_set_entry(w, addr, value, PWB_WRITE_THROUGH ? 0 : mask, version, lock, access_is_nonvolatile);
+				initialized_entry->is_logical = modedata->logical_op;
 
-	
-					// Add entry to the write set
-					insert_write_set_entry_after(initialized_entry, write_set_tail, tx, last_entry_in_same_cache_block);					
-					return initialized_entry;
+
+				// Add entry to the write set
+				if (log_write) {
+					insert_write_set_entry_after(initialized_entry, write_set_tail, tx);
+				} else {
+					link_write_set_entry_after(initialized_entry, write_set_tail, tx);
 				}
+#if DESIGN == WRITE_THROUGH
+				pwb_wt_store(tx, modedata, initialized_entry, value, mask);
+#endif /* DESIGN == WRITE_THROUGH */
+				return initialized_entry;
 			}
 		}
 		/* If isolation is off and the pseudo-lock was set then we should have already 
@@ -474,6 +647,11 @@ restart_no_load:
 		assert(enable_isolation);
 
 		/* Conflict: CM kicks in */
+#ifdef HTM_FASTPATH
+		if (PWB_IN_HTM(tx)) {
+			htm_abort(HTM_CODE_LOCKED);
+		}
+#endif /* HTM_FASTPATH */
 		ret = cm_conflict(tx, lock, &l);
 		switch (ret) {
 			case CM_RESTART:
@@ -484,6 +662,7 @@ restart_no_load:
 				/* Abort */
 #ifdef _M_STATS_BUILD
 				m_stats_statset_increment(mtm_statsmgr, tx->statset, XACT, aborts, 1);
+				mtm_count_lock_conflict(tx, addr, l, "locked_write");
 #endif					
 #ifdef INTERNAL_STATS
 				tx->aborts_locked_write++;
@@ -494,19 +673,25 @@ restart_no_load:
 		assert(0);
 	} else {
 		/* This region has not been locked by this thread. */
-		if (enable_isolation) {
+		/* With commit-time locking, the write is checked against the reads at commit */
+		if (enable_isolation && !PWB_LOCK_AT_COMMIT) {
 			/* Handle write after reads (before CAS) */
 			version = LOCK_GET_TIMESTAMP(l);
 
-			if (version > modedata->end) {
+			/* In hardware, the processor keeps our reads consistent */
+			if (version > modedata->end && !PWB_IN_HTM(tx)) {
+				/* Our commit timestamp must end up greater than version */
+				mtm_clock_advance(version);
 				/* We might have read an older version previously */
 				if (!tx->can_extend || mtm_has_read(tx, modedata, lock) != NULL) {
 					/* Read version must be older (otherwise, tx->end >= version) */
 					/* Not much we can do: abort */
 					/* Abort caused by invisible reads */
 					cm_visible_read(tx);
+					tx->conflict_lock = lock;
 #ifdef _M_STATS_BUILD
 					m_stats_statset_increment(mtm_statsmgr, tx->statset, XACT, aborts, 1);
+					mtm_count_conflict(tx, lock, addr, "validate_write");
 #endif					
 #ifdef INTERNAL_STATS
 					tx->aborts_validate_write++;
@@ -517,20 +702,9 @@ restart_no_load:
 		}
 		
 		/* Acquire lock (ETL) */
-		if (modedata->w_set.nb_entries == modedata->w_set.size) {
-			/* Extend write set (invalidate pointers to write set entries => abort and reallocate) */
-			modedata->w_set.size *= 2;
-			modedata->w_set.reallocate = 1;
-#ifdef _M_STATS_BUILD
-			m_stats_statset_increment(mtm_statsmgr, tx->statset, XACT, aborts, 1);
-#endif					
-# ifdef INTERNAL_STATS
-			tx->aborts_reallocate++;
-# endif /* INTERNAL_STATS */
-			mtm_pwb_restart_transaction (tx, RESTART_REALLOCATE);
-		}
-	    w = &modedata->w_set.entries[modedata->w_set.nb_entries];
-		if (enable_isolation) {
+		/* Links in a new chunk if the write set is full; existing entries never move. */
+		w = mtm_ws_next_free_entry(tx, modedata);
+		if (enable_isolation && !PWB_LOCK_AT_COMMIT) {
 # ifdef READ_LOCKED_DATA
 			w->version = version;
 # endif /* READ_LOCKED_DATA */
@@ -546,16 +720,26 @@ restart_no_load:
 		} else {
 			/* Don't need a CAS; just use a regular STORE. */
 			/* We also set the lock bit to ensure that the next write will 
-			 * see the write entry as valid. */
+			 * see the write entry as valid. The version overwritten is only 
+			 * known once commit acquires the lock (CTL). */
+			version = 0;
 # if CM == CM_PRIORITY
-			*lock = LOCK_SET_ADDR((mtm_word_t)w, tx->priority);
+			*chain = LOCK_SET_ADDR((mtm_word_t)w, tx->priority);
 # else
-			*lock = LOCK_SET_ADDR((mtm_word_t)w);
+			*chain = LOCK_SET_ADDR((mtm_word_t)w);
 # endif
 		}
 		
-		w_entry_t* initialized_entry = 	initialize_write_set_entry(w, addr, value, mask, version, lock, access_is_nonvolatile);
-		insert_write_set_entry_after(initialized_entry, write_set_tail, tx, NULL);					
+		w_entry_t* initialized_entry = 	initialize_write_set_entry(w, addr, value, PWB_WRITE_THROUGH ? 0 : mask, version, lock, access_is_nonvolatile);
+		initialized_entry->is_logical = modedata->logical_op;
+		if (log_write) {
+			insert_write_set_entry_after(initialized_entry, write_set_tail, tx);
+		} else {
+			link_write_set_entry_after(initialized_entry, write_set_tail, tx);
+		}					
+#if DESIGN == WRITE_THROUGH
+		pwb_wt_store(tx, modedata, initialized_entry, value, mask);
+#endif /* DESIGN == WRITE_THROUGH */
 #ifdef _M_STATS_BUILD
 		m_stats_statset_increment(mtm_statsmgr, tx->statset, XACT, writes_distinct, 1);
 		if (access_is_nonvolatile) {
@@ -569,12 +753,24 @@ restart_no_load:
 }
 
 
+static inline 
+w_entry_t *
+pwb_write_internal(mtm_tx_t *tx, 
+                   volatile mtm_word_t *addr, 
+                   mtm_word_t value,
+                   mtm_word_t mask,
+                   int enable_isolation)
+{
+	return pwb_write_entry(tx, addr, value, mask, enable_isolation, 1);
+}
+
+
 static inline
 mtm_word_t 
 pwb_load_internal(mtm_tx_t *tx, volatile mtm_word_t *addr, int enable_isolation)
 {
 	assert(tx->mode == MTM_MODE_pwbnl || tx->mode == MTM_MODE_pwbetl);
-	mode_data_t         *modedata = (mode_data_t *) tx->modedata[tx->mode];
+	mode_data_t         *modedata = (mode_data_t *) tx->active_modedata;
 	volatile mtm_word_t *lock;
 	mtm_word_t          l;
 	mtm_word_t          l2;
@@ -583,6 +779,9 @@ pwb_load_internal(mtm_tx_t *tx, volatile mtm_word_t *addr, int enable_isolation)
 	r_entry_t           *r;
 	w_entry_t           *w;
 	int                 ret;
+#if DESIGN == WRITE_BACK_CTL
+	w_entry_t           *own = NULL;
+#endif /* DESIGN == WRITE_BACK_CTL */
 
 	MTM_DEBUG_PRINT("==> mtm_pwb_load(t=%p[%lu-%lu],a=%p)\n", tx, 
 	                (unsigned long)modedata->start,
@@ -607,6 +806,11 @@ pwb_load_internal(mtm_tx_t *tx, volatile mtm_word_t *addr, int enable_isolation)
 	     (uintptr_t) addr < (PSEGMENT_RESERVED_REGION_START + PSEGMENT_RESERVED_REGION_SIZE)))
 	{
 		/* Access is non-volatile */
+		if (modedata->nb_captured > 0 && pwb_captured_find(modedata, addr)) {
+			/* Only this transaction has written the block */
+			value = ATOMIC_LOAD(addr);
+			return value;
+		}
 		/* Fall through */
 	} else {
 		/* Is it a stack access? */
@@ -633,7 +837,11 @@ pwb_load_internal(mtm_tx_t *tx, volatile mtm_word_t *addr, int enable_isolation)
 	}
 
 
-	if (enable_isolation) {
+	if (enable_isolation && unlikely(!modedata->has_snapshot) && !PWB_IN_HTM(tx)) {
+		pwb_snapshot(tx, modedata);
+	}
+
+	if (enable_isolation && !modedata->read_only) {
 		/* Check with contention manager whether to upgrade to write lock. */
 		if (cm_upgrade_lock(tx)) {
 			w = pwb_write_internal(tx, addr, 0, 0, enable_isolation);
@@ -643,10 +851,25 @@ pwb_load_internal(mtm_tx_t *tx, volatile mtm_word_t *addr, int enable_isolation)
 			}
 			assert(w != NULL);
 			/* We now own the lock */
-			return w->mask == 0 ? ATOMIC_LOAD(addr) : w->value;
+			return (PWB_WRITE_THROUGH || w->mask == 0) ? ATOMIC_LOAD(addr) : w->value;
 		}
 	}
 
+#if DESIGN == WRITE_BACK_CTL
+	/* 
+	 * Our writes are not behind the lock yet: look for one in the write set.
+	 * The bytes it did not write are read from memory below.
+	 */
+	if (enable_isolation && (own = pwb_ctl_lookup(tx, modedata, addr)) != NULL) {
+		if (own->mask == whole_word_mask) {
+			return own->value;
+		}
+		if (own->mask == 0) {
+			own = NULL;
+		}
+	}
+#endif /* DESIGN == WRITE_BACK_CTL */
+
 	/* Get reference to lock */
 	if (enable_isolation) {
 		lock = GET_LOCK(addr);
@@ -667,10 +890,20 @@ restart_no_load:
     	/* Do we own the lock? */
 		w = (w_entry_t *)LOCK_GET_ADDR(l);
 		/* Simply check if address falls inside our write set (avoids non-faulting load) */
-		if (modedata->w_set.entries <= w && 
-		    w < modedata->w_set.entries + modedata->w_set.nb_entries)
-		{
+		if (mtm_ws_owns_entry(modedata, w)) {
 			/* Yes: did we previously write the same address? */
+#if DESIGN == WRITE_THROUGH
+			/* Memory holds what we wrote */
+			value = ATOMIC_LOAD(addr);
+#elif defined(WRITE_SET_INDEX)
+			if ((w = mtm_ws_index_lookup(modedata, addr)) != NULL) {
+				value = (w->mask == 0 ? ATOMIC_LOAD(addr) : w->value);
+				MTM_DEBUG_PRINT("==> mtm_load[OWN LOCK|READ FROM WSET]");
+			} else {
+				value = ATOMIC_LOAD(addr);
+				MTM_DEBUG_PRINT("==> mtm_load[OWN LOCK|READ FROM MEMORY]");
+			}
+#else /* !WRITE_SET_INDEX */
 			while (1) {
 				if (addr == w->addr) {
 					/* Yes: get value from write set (or from memory if mask was empty) */
@@ -686,6 +919,7 @@ restart_no_load:
 				}
 				w = w->next;
 			}
+#endif /* DESIGN != WRITE_THROUGH && !WRITE_SET_INDEX */
 			/* No need to add to read set (will remain valid) */
 			MTM_DEBUG_PRINT("(t=%p[%lu-%lu],a=%p,l=%p,*l=%lu,d=%p-%lu)\n",
 			                tx, (unsigned long)modedata->start, 
@@ -701,6 +935,40 @@ restart_no_load:
 		 * found a written-back value entry and never reach here. */
 		assert(enable_isolation);
 
+#ifdef HTM_FASTPATH
+		if (PWB_IN_HTM(tx)) {
+			htm_abort(HTM_CODE_LOCKED);
+		}
+#endif /* HTM_FASTPATH */
+#ifdef READ_LOCKED_DATA
+		/* 
+		 * Read the version the owner overwrote. Memory keeps it until the 
+		 * owner writes back, which it only does with an odd instance number;
+		 * a write back that started, and a release and relock of the lock 
+		 * since, both change the instance number. The owner's write set and
+		 * descriptor stay valid under epoch GC even if its thread exits.
+		 * Validation still fails while the lock is held, so the read pays 
+		 * off for read-only transactions and for commits that need no 
+		 * validation.
+		 */
+		{
+			mtm_tx_t   *owner = w->tx;
+			mtm_word_t id = ATOMIC_LOAD_ACQ(&owner->id);
+
+			version = w->version;
+			if (id % 2 == 0 && version <= modedata->end) {
+				value = ATOMIC_LOAD_ACQ(addr);
+				if (ATOMIC_LOAD_ACQ(lock) != l || ATOMIC_LOAD_ACQ(&owner->id) != id) {
+					goto restart;
+				}
+#ifdef _M_STATS_BUILD
+				m_stats_statset_increment(mtm_statsmgr, tx->statset, XACT, locked_reads, 1);
+#endif
+				goto add_to_read_set;
+			}
+		}
+#endif /* READ_LOCKED_DATA */
+
 		/* Conflict: CM kicks in */
 		/* TODO: we could check for duplicate reads and get value from read set (should be rare) */
 		ret = cm_conflict(tx, lock, &l);
@@ -713,6 +981,7 @@ restart_no_load:
 				/* Abort */
 #ifdef _M_STATS_BUILD
 				m_stats_statset_increment(mtm_statsmgr, tx->statset, XACT, aborts, 1);
+				mtm_count_lock_conflict(tx, addr, l, "locked_read");
 #endif					
 #ifdef INTERNAL_STATS
 				tx->aborts_locked_write++;
@@ -723,7 +992,15 @@ restart_no_load:
 		assert(0);
 	} else {
 		/* Not locked */
-		value = ATOMIC_LOAD_ACQ(addr);
+		if (!(unlikely(mtm_readcache_nregions > 0) &&
+		      mtm_readcache_load(addr, &value, !PWB_IN_HTM(tx))))
+		{
+			value = ATOMIC_LOAD_ACQ(addr);
+		}
+		if (PWB_IN_HTM(tx)) {
+			/* The hardware tracks the lock word we just read; no read set */
+			return value;
+		}
 		if (enable_isolation) {
 			l2 = ATOMIC_LOAD_ACQ(lock);
 			if (l != l2) {
@@ -732,15 +1009,24 @@ restart_no_load:
 			}
 			/* Check timestamp */
 			version = LOCK_GET_TIMESTAMP(l);
-			/* Valid version? */
-			if (version > modedata->end) {
+			/* 
+			 * Valid version? A snapshot read takes the version of its 
+			 * snapshot from the version store when there is one.
+			 */
+			if (version > modedata->end &&
+			    !(modedata->snapshot && mtm_mvstore_lookup(addr, modedata->end, value, &value))) 
+			{
 				/* No: try to extend first (except for read-only transactions: no read set) */
-				if (!tx->can_extend || !pwb_extend(tx, modedata)) {
+				mtm_clock_advance(version);
+				/* Blamed for the abort unless validation finds another lock */
+				tx->conflict_lock = lock;
+				if (modedata->read_only || !tx->can_extend || !pwb_extend(tx, modedata)) {
 					/* Not much we can do: abort */
 					/* Abort caused by invisible reads */
 					cm_visible_read(tx);
 #ifdef _M_STATS_BUILD
 					m_stats_statset_increment(mtm_statsmgr, tx->statset, XACT, aborts, 1);
+					mtm_count_conflict(tx, lock, addr, "validate_read");
 #endif					
 #ifdef INTERNAL_STATS
 					tx->aborts_validate_read++;
@@ -761,14 +1047,19 @@ restart_no_load:
 	}
 
 	/* We have a good version: add to read set (update transactions) and return value */
-	if (enable_isolation) {
+#ifdef READ_LOCKED_DATA
+add_to_read_set:
+#endif /* READ_LOCKED_DATA */
+	if (enable_isolation && !modedata->read_only) {
 		/* Add address and version to read set */
 		if (modedata->r_set.nb_entries == modedata->r_set.size) {
 			mtm_allocate_rs_entries(tx, modedata, 1);
 		}
 		r = &modedata->r_set.entries[modedata->r_set.nb_entries++];
-		r->version = version;
-		r->lock = lock;
+		R_ENTRY_SET(r, lock, version);
+#ifdef READ_SET_FILTER
+		mtm_rs_filter_add(modedata, lock);
+#endif /* READ_SET_FILTER */
 	}
 
 	MTM_DEBUG_PRINT("==> mtm_pwb_load(t=%p[%lu-%lu],a=%p,l=%p,*l=%lu,d=%p-%lu,v=%lu)\n",
@@ -781,8 +1072,410 @@ restart_no_load:
 	                (unsigned long)value,
 	                (unsigned long)version);
 
+#if DESIGN == WRITE_BACK_CTL
+	if (own != NULL) {
+		value = masked_word(value, own->value, own->mask);
+	}
+#endif /* DESIGN == WRITE_BACK_CTL */
+	return value;
+}
+
+
+/*
+ * Read-for-write (_ITM_RfW*): the word is about to be written, so take its
+ * write lock now instead of adding a read-set entry that the write would 
+ * then have to validate against. The entry has an empty mask: it writes 
+ * nothing back until the store fills it in. Words that take no lock (stack,
+ * captured blocks), read-only transactions and commit-time locking use the
+ * plain read barrier.
+ */
+static inline
+mtm_word_t
+pwb_load_for_write(mtm_tx_t *tx, volatile mtm_word_t *addr)
+{
+	mode_data_t *modedata = (mode_data_t *) tx->active_modedata;
+	w_entry_t   *w;
+
+	if (PWB_LOCK_AT_COMMIT || PWB_IN_HTM(tx) || modedata->read_only ||
+	    ((uintptr_t) addr <= tx->stack_base && 
+	     (uintptr_t) addr > tx->stack_base - tx->stack_size) ||
+	    (modedata->nb_captured > 0 && pwb_captured_find(modedata, addr)))
+	{
+		return pwb_load_internal(tx, addr, 1);
+	}
+	w = pwb_write_entry(tx, addr, 0, 0, 1, 0);
+	if (w == NULL) {
+		return pwb_load_internal(tx, addr, 1);
+	}
+	if (PWB_WRITE_THROUGH || w->mask == 0) {
+		return ATOMIC_LOAD(addr);
+	}
+	return masked_word(ATOMIC_LOAD(addr), w->value, w->mask);
+}
+
+
+/*
+ * Read-after-read (_ITM_RaR*): the read set already has an entry for the
+ * word's lock, which commit validates, so a word still unlocked at a 
+ * version within the snapshot needs no second entry.
+ */
+static inline
+mtm_word_t
+pwb_load_after_read(mtm_tx_t *tx, volatile mtm_word_t *addr)
+{
+	mode_data_t         *modedata = (mode_data_t *) tx->active_modedata;
+	volatile mtm_word_t *lock;
+	mtm_word_t          l;
+	mtm_word_t          value;
+
+	if (PWB_LOCK_AT_COMMIT || PWB_IN_HTM(tx) || modedata->read_only ||
+	    unlikely(!modedata->has_snapshot))
+	{
+		return pwb_load_internal(tx, addr, 1);
+	}
+	lock = GET_LOCK(addr);
+	l = ATOMIC_LOAD_ACQ(lock);
+	if (LOCK_GET_OWNED(l) || LOCK_GET_TIMESTAMP(l) > modedata->end) {
+		return pwb_load_internal(tx, addr, 1);
+	}
+	if (!(unlikely(mtm_readcache_nregions > 0) &&
+	      mtm_readcache_load(addr, &value, 1)))
+	{
+		value = ATOMIC_LOAD_ACQ(addr);
+	}
+	if (ATOMIC_LOAD_ACQ(lock) != l) {
+		return pwb_load_internal(tx, addr, 1);
+	}
 	return value;
 }
 
 
+
+/*
+ * Number of words from addr up to the end of its lock stripe (at most n). 
+ */
+static inline
+size_t
+pwb_stripe_words(volatile mtm_word_t *addr, size_t n)
+{
+	mtm_word_t end = (LOCK_STRIPE(addr) + 1) << LOCK_SHIFT;
+	size_t     words = (end - (mtm_word_t) addr) / sizeof(mtm_word_t);
+
+	if (words == 0) {
+		words = 1;
+	}
+	return words < n ? words : n;
+}
+
+
+/*
+ * Writes the words stored at [addr, addr + n) to the persistent TM log as a 
+ * single range record.
+ */
+static inline
+void
+pwb_log_words(mtm_tx_t *tx, volatile mtm_word_t *addr, const uint8_t *buf, size_t n)
+{
+	mode_data_t *modedata = (mode_data_t *) tx->active_modedata;
+
+	if (n > 0 && !PWB_IN_HTM(tx) && !PWB_NO_LOG) {
+		M_TMLOG_WRITE_RANGE(tx->pcm_storeset, modedata->ptmlog, (uintptr_t) addr, buf, n);
+	}
+}
+
+
+/*
+ * Bulk word barriers, used by the byte barriers and so by the transactional
+ * memcpy, memmove and memset. Words covered by the same lock stripe are 
+ * handled together: the first word goes through the normal barrier, which
+ * acquires (or validates) the lock and handles conflicts. When that word 
+ * acquired a lock we did not own, the other words of the stripe cannot be 
+ * in the write set yet and are appended as full-mask entries right away; 
+ * on loads, the rest of the stripe is copied at once and validated by 
+ * checking that the lock still holds the version just read. In all other 
+ * cases, with commit-time locking where the lock tells nothing about the 
+ * write set, and with write-through where each store is logged on its own,
+ * the remaining words go through the normal barrier.
+ *
+ * Stores are not logged one word at a time: each run of consecutive words 
+ * to persistent memory is logged with a single range record once it ends.
+ * If the transaction restarts before that, nothing is lost, since the 
+ * restart discards (or compensates for) what the unlogged words did.
+ */
+static inline
+void
+pwb_store_words(mtm_tx_t *tx, volatile mtm_word_t *addr, const uint8_t *buf, size_t n, int enable_isolation)
+{
+	mode_data_t         *modedata = (mode_data_t *) tx->active_modedata;
+	volatile mtm_word_t *lock;
+	volatile mtm_word_t *log_addr = addr;
+	const uint8_t       *log_buf = buf;
+	size_t              log_words = 0;
+	mtm_word_t          l;
+	mtm_word_t          value;
+	w_entry_t           *w;
+	w_entry_t           *prev;
+	size_t              run;
+	size_t              i;
+	int                 fresh;
+
+	while (n > 0) {
+		run = pwb_stripe_words(addr, n);
+		fresh = 0;
+		lock = NULL;
+		if (enable_isolation && run > 1 && !PWB_LOCK_AT_COMMIT && !PWB_WRITE_THROUGH) {
+			lock = GET_LOCK(addr);
+			l = ATOMIC_LOAD_ACQ(lock);
+			fresh = !LOCK_GET_OWNED(l) || !mtm_ws_owns_entry(modedata, (w_entry_t *) LOCK_GET_ADDR(l));
+		}
+		for (i = 0, prev = NULL; i < run; i++) {
+			memcpy(&value, buf + i * sizeof(mtm_word_t), sizeof(mtm_word_t));
+			if (i > 0 && fresh) {
+#ifdef _M_STATS_BUILD
+				m_stats_statset_increment(mtm_statsmgr, tx->statset, XACT, writes, 1);
+				m_stats_statset_increment(mtm_statsmgr, tx->statset, XACT, writes_distinct, 1);
+				if (prev->is_nonvolatile) {
+					m_stats_statset_increment(mtm_statsmgr, tx->statset, XACT, nvwrites, 1);
+					m_stats_statset_increment(mtm_statsmgr, tx->statset, XACT, nvwrites_distinct, 1);
+				} else {
+					m_stats_statset_increment(mtm_statsmgr, tx->statset, XACT, vwrites, 1);
+					m_stats_statset_increment(mtm_statsmgr, tx->statset, XACT, vwrites_distinct, 1);
+				}
+#endif
+				w = initialize_write_set_entry(mtm_ws_next_free_entry(tx, modedata), 
+				                               addr + i, value, ~(mtm_word_t)0, 
+				                               prev->version, lock, prev->is_nonvolatile);
+				w->is_logical = modedata->logical_op;
+				link_write_set_entry_after(w, prev, tx);
+			} else {
+				w = pwb_write_entry(tx, addr + i, value, ~(mtm_word_t)0, enable_isolation, 0);
+				if (i == 0) {
+					fresh = fresh && w != NULL && w->lock == lock;
+				}
+			}
+			prev = w;
+			/* Extend the run of words to log, or end it */
+			if (w != NULL && w->is_nonvolatile && !PWB_DEFER_LOG(tx) && !modedata->logical_op) {
+				if (log_words++ == 0) {
+					log_addr = addr + i;
+					log_buf = buf + i * sizeof(mtm_word_t);
+				}
+			} else {
+				pwb_log_words(tx, log_addr, log_buf, log_words);
+				log_words = 0;
+			}
+		}
+		addr += run;
+		buf += run * sizeof(mtm_word_t);
+		n -= run;
+	}
+	pwb_log_words(tx, log_addr, log_buf, log_words);
+}
+
+
+static inline
+void
+pwb_load_words(mtm_tx_t *tx, volatile mtm_word_t *addr, uint8_t *buf, size_t n, int enable_isolation)
+{
+	mode_data_t         *modedata = (mode_data_t *) tx->active_modedata;
+	volatile mtm_word_t *lock;
+	r_entry_t           *r;
+	mtm_word_t          l;
+	mtm_word_t          version;
+	mtm_word_t          value;
+	size_t              run;
+	size_t              i;
+	size_t              first;
+	int                 nb_reads;
+	int                 batch;
+
+	while (n > 0) {
+		run = pwb_stripe_words(addr, n);
+		nb_reads = modedata->r_set.nb_entries;
+		value = pwb_load_internal(tx, addr, enable_isolation);
+		memcpy(buf, &value, sizeof(mtm_word_t));
+		i = 1;
+		batch = 0;
+		if (run > 1 && enable_isolation && !PWB_IN_HTM(tx) && !PWB_LOCK_AT_COMMIT) {
+			lock = GET_LOCK(addr);
+			if (modedata->r_set.nb_entries == nb_reads + 1 &&
+			    R_ENTRY_LOCK(r = &modedata->r_set.entries[nb_reads]) == lock)
+			{
+				/* Still unlocked at the version the first word was read at? */
+				l = ATOMIC_LOAD_ACQ(lock);
+				version = LOCK_GET_TIMESTAMP(l);
+				batch = !LOCK_GET_OWNED(l) && R_ENTRY_VALID(modedata, r, l);
+			} else if (modedata->read_only) {
+				/* 
+				 * No read set to check the first word against: read the 
+				 * whole stripe again between two loads of its lock, at a 
+				 * version within the snapshot.
+				 */
+				l = ATOMIC_LOAD_ACQ(lock);
+				version = LOCK_GET_TIMESTAMP(l);
+				if (!LOCK_GET_OWNED(l) && version <= modedata->end) {
+					i = 0;
+					batch = 1;
+				}
+			}
+		}
+		if (batch) {
+			first = i;
+			memcpy(buf + i * sizeof(mtm_word_t), (const void *) (addr + i), (run - i) * sizeof(mtm_word_t));
+			ATOMIC_MB_READ;
+			l = ATOMIC_LOAD_ACQ(lock);
+			if (!LOCK_GET_OWNED(l) && LOCK_GET_TIMESTAMP(l) == version) {
+				i = run;
+			} else {
+				/* Fall back to word loads over what the copy may have torn */
+				i = first;
+			}
+		}
+		for (; i < run; i++) {
+			value = pwb_load_internal(tx, addr + i, enable_isolation);
+			memcpy(buf + i * sizeof(mtm_word_t), &value, sizeof(mtm_word_t));
+		}
+		addr += run;
+		buf += run * sizeof(mtm_word_t);
+		n -= run;
+	}
+}
+
+
+/*
+ * Writes the current contents of [addr, addr + size) to the persistent TM 
+ * log, so that recovery redoes them if the transaction commits. This is for
+ * persistent memory the transaction wrote with plain stores and that no 
+ * other thread can see yet, such as blocks it allocated: the range is not 
+ * locked and does not enter the write set. Whole words are logged with a 
+ * range record, partial words at either end with masked records. Memory 
+ * outside the persistent region is skipped. With write-through the range 
+ * is flushed instead, and made durable by the commit.
+ */
+static inline
+void
+pwb_log_range(mtm_tx_t *tx, const void *addr, size_t size)
+{
+	mode_data_t *modedata = (mode_data_t *) tx->active_modedata;
+	uintptr_t   start = (uintptr_t) addr;
+	uintptr_t   end = start + size;
+	uintptr_t   head;
+	uintptr_t   tail;
+	uintptr_t   words;
+	uintptr_t   line;
+	mtm_word_t  mask;
+
+	if (start < PSEGMENT_RESERVED_REGION_START) {
+		start = PSEGMENT_RESERVED_REGION_START;
+	}
+	if (end > PSEGMENT_RESERVED_REGION_START + PSEGMENT_RESERVED_REGION_SIZE) {
+		end = PSEGMENT_RESERVED_REGION_START + PSEGMENT_RESERVED_REGION_SIZE;
+	}
+	if (start >= end) {
+		return;
+	}
+	modedata->has_nvwrite = 1;
+#ifdef HTM_FASTPATH
+	/* Log records are written by the software path only */
+	if (PWB_IN_HTM(tx)) {
+		htm_abort(HTM_CODE_RESTART);
+	}
+#endif /* HTM_FASTPATH */
+	if (PWB_WRITE_THROUGH) {
+		/* Nothing to undo: the range only has to be durable before commit */
+		for (line = (uintptr_t) BLOCK_ADDR(start); line < end; line += CACHELINE_SIZE) {
+			PCM_WB_FLUSH(tx->pcm_storeset, (volatile mtm_word_t *) line);
+		}
+		mtm_readcache_invalidate((const void *) start, end - start);
+		return;
+	}
+	if (PWB_NO_LOG) {
+		mtm_readcache_invalidate((const void *) start, end - start);
+		return;
+	}
+	head = start & ~(uintptr_t) (sizeof(mtm_word_t) - 1);
+	tail = end & ~(uintptr_t) (sizeof(mtm_word_t) - 1);
+	words = head;
+	if (start != head) {
+		/* Bytes [start - head, min(end - head, word size)) of the first word */
+		mask = ~(mtm_word_t) 0 << (8 * (start - head));
+		if (end - head < sizeof(mtm_word_t)) {
+			mask &= ~(~(mtm_word_t) 0 << (8 * (end - head)));
+		}
+		M_TMLOG_WRITE(tx->pcm_storeset, modedata->ptmlog, head, ATOMIC_LOAD((volatile mtm_word_t *) head), mask);
+		words = head + sizeof(mtm_word_t);
+	}
+	if (tail > words) {
+		pwb_log_words(tx, (volatile mtm_word_t *) words, (const uint8_t *) words, 
+		              (tail - words) / sizeof(mtm_word_t));
+	}
+	if (end != tail && tail >= words) {
+		/* Bytes [0, end - tail) of the last word */
+		mask = ~(~(mtm_word_t) 0 << (8 * (end - tail)));
+		M_TMLOG_WRITE(tx->pcm_storeset, modedata->ptmlog, tail, ATOMIC_LOAD((volatile mtm_word_t *) tail), mask);
+	}
+	/* The plain stores bypassed the write-back to the read cache */
+	mtm_readcache_invalidate((const void *) start, end - start);
+}
+
+
+/*
+ * Opens a logical operation: logs a record with its opcode and arguments,
+ * which recovery passes to the replay routine registered for the opcode 
+ * (see mnemosyne_logical_replay_register), and stops writing redo records
+ * for the transaction's stores until pwb_logical_end. The stores still go 
+ * through the write set; they are flagged so that commit does not log 
+ * them (TMLOG_AT_COMMIT), and their cachelines are flushed by the commit 
+ * since no redo record names them to the log truncation. With 
+ * write-through there is no redo log and the stores are undo-logged as
+ * usual. Returns -1 if an operation is already open or the arguments do
+ * not fit in a record.
+ */
+static inline
+int
+pwb_logical_begin(mtm_tx_t *tx, unsigned int opcode, const void *args, size_t size)
+{
+	mode_data_t *modedata = (mode_data_t *) tx->active_modedata;
+
+	if (modedata->logical_op) {
+		return -1;
+	}
+#if DESIGN != WRITE_THROUGH
+	if (size > XACT_LOGICAL_ARGS_MAX) {
+		return -1;
+	}
+#ifdef HTM_FASTPATH
+	/* Log records are written by the software path only */
+	if (PWB_IN_HTM(tx)) {
+		htm_abort(HTM_CODE_RESTART);
+	}
+#endif /* HTM_FASTPATH */
+	modedata->has_nvwrite = 1;
+	modedata->has_logical = 1;
+	if (!PWB_NO_LOG) {
+		M_TMLOG_WRITE_LOGICAL(tx->pcm_storeset, modedata->ptmlog, opcode, args, size);
+	}
+#endif /* DESIGN != WRITE_THROUGH */
+	modedata->logical_op = 1;
+	return 0;
+}
+
+
+/*
+ * Closes the logical operation opened by pwb_logical_begin: later stores 
+ * are logged again. Returns -1 if no operation is open.
+ */
+static inline
+int
+pwb_logical_end(mtm_tx_t *tx)
+{
+	mode_data_t *modedata = (mode_data_t *) tx->active_modedata;
+
+	if (!modedata->logical_op) {
+		return -1;
+	}
+	modedata->logical_op = 0;
+	return 0;
+}
+
 #endif /* _PWB_COMMON_BARRIER_BITS_JKI671_H */
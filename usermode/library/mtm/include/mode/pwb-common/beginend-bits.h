@@ -58,9 +58,246 @@
 #include <pwb_i.h>
 #include <rwset.h>
 #include <cm.h>
+#include <readcache.h>
+#include <mvstore.h>
+#include <txsched.h>
+#include <hrtime.h>
+#include <usdt.h>
+
+
+/* 
+ * Timestamps the end of a commit phase, which is the start of the next 
+ * one; ts[0] is the start of the first. 
+ */
+#ifdef _M_STATS_BUILD
+# define PWB_COMMIT_PHASE_START(tx, ts)                                     \
+	if (unlikely((tx)->stats_commit_phases)) (ts)[0] = hrtime_cycles_ordered()
+# define PWB_COMMIT_PHASE_END(tx, ts, phase)                                \
+	if (unlikely((tx)->stats_commit_phases))                                \
+		(ts)[m_stats_##phase##_phase + 1] = hrtime_cycles_ordered()
+#else
+# define PWB_COMMIT_PHASE_START(tx, ts)       ((void) 0)
+# define PWB_COMMIT_PHASE_END(tx, ts, phase)  ((void) 0)
+#endif
+
+
+/* 
+ * Flushes the blocks the transaction allocated and stored to in place 
+ * (see pwb_captured_add).
+ */
+static inline
+void
+pwb_captured_flush(mtm_tx_t *tx, mode_data_t *modedata)
+{
+	mtm_pwb_captured_t *c;
+	uintptr_t          line;
+	int                i;
+
+	for (i = 0; i < modedata->nb_captured; i++) {
+		c = &modedata->captured[i];
+		for (line = (uintptr_t) BLOCK_ADDR(c->start); line < c->end; line += CACHELINE_SIZE) {
+			PCM_WB_FLUSH(tx->pcm_storeset, (volatile mtm_word_t *) line);
+		}
+		/* The stores bypassed the write-back to the read cache */
+		mtm_readcache_invalidate((const void *) c->start, c->end - c->start);
+	}
+	if (modedata->nb_captured > 0) {
+		PCM_PERSIST_BARRIER(tx->pcm_storeset);
+	}
+}
+
+
+#if DESIGN == WRITE_BACK_CTL
+/*
+ * Commit-time locking: acquire the locks covering the write set in lock 
+ * order, so that committing transactions never wait for each other in a 
+ * cycle. Locks are only held by transactions that are writing back, so a 
+ * lock found taken is waited for instead of aborting. Each lock is taken 
+ * through the first of its entries, which records the version it 
+ * overwrote. Returns 0 if a lock covers data the transaction read at an 
+ * older version; the rollback drops the locks acquired so far.
+ */
+static inline
+int
+pwb_ctl_acquire(mtm_tx_t *tx, mode_data_t *modedata)
+{
+	volatile mtm_word_t *lock = NULL;
+	w_entry_t           **sorted;
+	w_entry_t           *w;
+	mtm_word_t          l;
+	int                 n;
+	int                 i;
+#ifdef WAIT_YIELD
+	m_spinwait_t        sw;
+#endif /* WAIT_YIELD */
+
+	n = mtm_ws_sort_locks(modedata);
+	sorted = modedata->w_set.sorted;
+	for (i = 0; i < n; i++) {
+		w = sorted[i];
+		if (w->lock == lock) {
+			/* Taken through a previous entry */
+			continue;
+		}
+		lock = w->lock;
+		while (1) {
+			l = ATOMIC_LOAD_ACQ(lock);
+			if (!LOCK_GET_OWNED(l)) {
+				if (ATOMIC_CAS_FULL(lock, l, LOCK_SET_ADDR((mtm_word_t)w)) != 0) {
+					break;
+				}
+				continue;
+			}
+#ifdef WAIT_YIELD
+			m_spinwait_init(&sw, lock);
+			while (LOCK_GET_OWNED(ATOMIC_LOAD(lock))) {
+				m_spinwait_pause(&sw);
+			}
+			m_spinwait_done(&sw);
+#else /* ! WAIT_YIELD */
+			while (LOCK_GET_OWNED(ATOMIC_LOAD(lock))) {
+			}
+#endif /* ! WAIT_YIELD */
+		}
+		w->version = LOCK_GET_TIMESTAMP(l);
+		/* Handle write after reads (see pwb_write_entry) */
+		if (w->version > modedata->end) {
+			/* Our commit timestamp must end up greater than version */
+			mtm_clock_advance(w->version);
+			if (mtm_has_read(tx, modedata, lock) != NULL) {
+				/* Abort caused by invisible reads */
+				cm_visible_read(tx);
+#ifdef _M_STATS_BUILD
+				m_stats_statset_increment(mtm_statsmgr, tx->statset, XACT, aborts, 1);
+				mtm_count_conflict(tx, lock, w->addr, "validate_write");
+#endif					
+#ifdef INTERNAL_STATS
+				tx->aborts_validate_write++;
+#endif /* INTERNAL_STATS */
+				return 0;
+			}
+		}
+	}
+	return 1;
+}
+#endif /* DESIGN == WRITE_BACK_CTL */
+
+
+#if DESIGN != WRITE_THROUGH
+/* 
+ * Whether the entries of the sorted write set from i on overwrite every 
+ * word of a persistent cacheline, as bulk copies of values do. If so, 
+ * gathers the line in vals.
+ */
+static inline
+int
+pwb_line_overwritten(w_entry_t **sorted, int i, int n, mtm_word_t *vals)
+{
+	const int  nwords = CACHELINE_SIZE / sizeof(mtm_word_t);
+	uintptr_t  line = (uintptr_t) BLOCK_ADDR(sorted[i]->addr);
+	unsigned   bitmap = 0;
+	w_entry_t  *w;
+	int        k;
+	int        j;
+
+	if (i + nwords > n || (i > 0 && (uintptr_t) BLOCK_ADDR(sorted[i-1]->addr) == line) ||
+	    (i + nwords < n && (uintptr_t) BLOCK_ADDR(sorted[i+nwords]->addr) == line))
+	{
+		return 0;
+	}
+	for (j = i; j < i + nwords; j++) {
+		w = sorted[j];
+		if ((uintptr_t) BLOCK_ADDR(w->addr) != line || !w->is_nonvolatile || 
+		    w->mask != ~((mtm_word_t) 0))
+		{
+			return 0;
+		}
+		k = ((uintptr_t) w->addr - line) / sizeof(mtm_word_t);
+		bitmap |= 1 << k;
+		vals[k] = w->value;
+	}
+	return bitmap == (1U << nwords) - 1;
+}
+
+
+/* 
+ * Gathers the entries of the sorted write set from i on that fall in the 
+ * cacheline of entry i into vals, with a mask of the bytes they write. 
+ * Returns the index past the last of them.
+ */
+static inline
+int
+pwb_line_gather(w_entry_t **sorted, int i, int n, mtm_word_t *vals, uint64_t *bytemask)
+{
+	uintptr_t  line = (uintptr_t) BLOCK_ADDR(sorted[i]->addr);
+	uint64_t   m = 0;
+	w_entry_t  *w;
+	int        k;
+	int        b;
+
+	for (; i < n && (uintptr_t) BLOCK_ADDR(sorted[i]->addr) == line; i++) {
+		w = sorted[i];
+		k = ((uintptr_t) w->addr - line) / sizeof(mtm_word_t);
+		vals[k] = w->value;
+		for (b = 0; b < sizeof(mtm_word_t); b++) {
+			if ((w->mask >> (b * 8)) & 0xff) {
+				m |= 1ULL << (k * sizeof(mtm_word_t) + b);
+			}
+		}
+	}
+	*bytemask = m;
+	return i;
+}
+#endif /* DESIGN != WRITE_THROUGH */
+
+
+#if defined(TMLOG_AT_COMMIT) && defined(M_TMLOG_RESERVE)
+/* 
+ * Number of log words of the redo records the commit logs for the sorted 
+ * write set: three for a partial word and, for the full words of a line, 
+ * one per word plus the line (or address) word.
+ */
+static inline
+uint64_t
+pwb_commit_log_nwords(w_entry_t **sorted, int n)
+{
+	uint64_t   nwords = 0;
+	uintptr_t  line = 1;
+	w_entry_t  *w;
+	int        i;
+
+	for (i = 0; i < n; i++) {
+		w = sorted[i];
+		if (!w->is_nonvolatile || w->is_logical || w->mask == 0) {
+			continue;
+		}
+		if (w->mask != ~((mtm_word_t) 0)) {
+			nwords += 3;
+			continue;
+		}
+		nwords += XACT_LINE_ADDR((uintptr_t) w->addr) == line ? 1 : 2;
+		line = XACT_LINE_ADDR((uintptr_t) w->addr);
+	}
+	return nwords;
+}
+#endif /* TMLOG_AT_COMMIT && M_TMLOG_RESERVE */
+
+
+/* Releases the CPU log the transaction claimed, once it is done with it */
+static inline
+void
+pwb_cpu_log_release(mode_data_t *modedata)
+{
+	mtm_pwb_cpu_log_t *cl = modedata->cpu_log;
+
+	if (cl != NULL) {
+		modedata->cpu_log = NULL;
+		modedata->ptmlog_dsc = NULL;
+		modedata->ptmlog = NULL;
+		ATOMIC_STORE_REL(&cl->owner, 0);
+	}
+}
 
-//#define PRINT_DEBUG printf
-//#define MTM_DEBUG_PRINT printf
 
 static inline 
 bool
@@ -69,13 +306,34 @@ pwb_trycommit (mtm_tx_t *tx, int enable_isolation)
 	assert((tx->mode == MTM_MODE_pwbnl && !enable_isolation) || 
 	       (tx->mode == MTM_MODE_pwbetl && enable_isolation));
 
-	mode_data_t *modedata = (mode_data_t *) tx->modedata[tx->mode];
+	mode_data_t *modedata = (mode_data_t *) tx->active_modedata;
 	w_entry_t   *w;
+	w_entry_t   **sorted;
 	mtm_word_t  t;
 	int         i;
+	int         c;
+	int         n;
+	int         alone;
+	int         wbflush_cnt = 0;
+	int         wbstream_cnt = 0;
+	int         nvwrite_bytes = 0;
+#if DESIGN != WRITE_THROUGH
+	mtm_word_t  wb_line[CACHELINE_SIZE / sizeof(mtm_word_t)];
+	uint64_t    wb_bytemask;
+	int         j;
+#endif /* DESIGN != WRITE_THROUGH */
 #ifdef READ_LOCKED_DATA
 	mtm_word_t  id;
 #endif /* READ_LOCKED_DATA */
+#ifdef TMLOG_AT_COMMIT
+	uintptr_t   line;
+	unsigned    line_bitmap;
+	int         line_nwords;
+	pcm_word_t  line_vals[XACT_LINE_SIZE / sizeof(pcm_word_t)];
+#endif /* TMLOG_AT_COMMIT */
+#ifdef _M_STATS_BUILD
+	uint64_t    phase_ts[m_stats_numofphases + 1];
+#endif
 
 	PRINT_DEBUG("==> mtm_commit(%p[%lu-%lu] nest_level:%d-->%d)\n", tx, 
 	            (unsigned long)modedata->start, (unsigned long)modedata->end, tx->nesting, tx->nesting-1);
@@ -85,17 +343,49 @@ pwb_trycommit (mtm_tx_t *tx, int enable_isolation)
 
 	/* Decrement nesting level */
 	if (--tx->nesting > 0) {
+#ifdef CLOSED_NESTING
+		/* Merge the nested transaction, and the savepoints it took, into its parent */
+		while (modedata->nb_savepoints > 0 && 
+		       modedata->savepoints[modedata->nb_savepoints - 1].nesting > tx->nesting)
+		{
+			if (--modedata->nb_savepoints == 0) {
+				modedata->w_undo.nb_entries = 0;
+			}
+		}
+#endif /* CLOSED_NESTING */
 		return true;
 	}	
 
 	if (modedata->w_set.nb_entries > 0) {
 		/* Update transaction */
+		PWB_COMMIT_PHASE_START(tx, phase_ts);
+
+#if DESIGN == WRITE_BACK_CTL
+		if (enable_isolation && !pwb_ctl_acquire(tx, modedata)) {
+			return false;
+		}
+#endif /* DESIGN == WRITE_BACK_CTL */
+
+		/* 
+		 * Hold back mtm_durable_sqn until the commit is durable: the bound
+		 * is published before the timestamp is taken, so a thread that 
+		 * reads the clock at or past our timestamp also sees the bound.
+		 */
+		ATOMIC_STORE(&tx->pending_sqn, GET_CLOCK + 1);
+		ATOMIC_MB_FULL;
 
 		/* Get commit timestamp */
-		t = FETCH_INC_CLOCK + 1;
+#ifdef INCREMENTAL_VALIDATION
+		mtm_commit_begin();
+#endif /* INCREMENTAL_VALIDATION */
+		t = mtm_clock_commit_ts(&alone);
 		if (t >= VERSION_MAX) {
 #ifdef ROLLOVER_CLOCK
 			/* Abort: will reset the clock on next transaction start or delete */
+			mtm_clock_advance(t);
+#ifdef INCREMENTAL_VALIDATION
+			mtm_commit_done();
+#endif /* INCREMENTAL_VALIDATION */
 #ifdef _M_STATS_BUILD
 			m_stats_statset_increment(mtm_statsmgr, tx->statset, XACT, aborts, 1);
 #endif					
@@ -111,12 +401,18 @@ pwb_trycommit (mtm_tx_t *tx, int enable_isolation)
 
 		/* Try to validate (only if a concurrent transaction has committed since tx->start) */
 		if (enable_isolation) {
-			if (modedata->start != t - 1 && !mtm_validate(tx, modedata)) {
+#ifdef INCREMENTAL_VALIDATION
+			if ((!alone || modedata->start != t - 1) && !mtm_validate_incremental(tx, modedata, 1)) {
+				mtm_commit_done();
+#else /* ! INCREMENTAL_VALIDATION */
+			if ((!alone || modedata->start != t - 1) && !mtm_validate(tx, modedata)) {
+#endif /* ! INCREMENTAL_VALIDATION */
 				/* Cannot commit */
 				/* Abort caused by invisible reads. */
 				cm_visible_read(tx);
 #ifdef _M_STATS_BUILD
 				m_stats_statset_increment(mtm_statsmgr, tx->statset, XACT, aborts, 1);
+				mtm_count_conflict(tx, tx->conflict_lock, NULL, "validate_commit");
 #endif					
 #ifdef INTERNAL_STATS
 				tx->aborts_validate_commit++;
@@ -132,8 +428,125 @@ pwb_trycommit (mtm_tx_t *tx, int enable_isolation)
 		ATOMIC_STORE_REL(&tx->id, id + 1);
 # endif /* READ_LOCKED_DATA */
 
-		/* Make sure the persistent tm log is made stable */
-		M_TMLOG_COMMIT(tx->pcm_storeset, modedata->ptmlog, t);
+		PWB_COMMIT_PHASE_END(tx, phase_ts, validate);
+
+		/* Visit the write set in cacheline order */
+		n = mtm_ws_sort(modedata);
+		sorted = modedata->w_set.sorted;
+
+#if DESIGN != WRITE_THROUGH
+		/* 
+		 * The home lines written back below are often cold. Prefetch them 
+		 * for writing now, so that their misses overlap with writing and 
+		 * persisting the log. Beyond mtm.commit_prefetch_max entries the 
+		 * first lines would be evicted again before their write-back.
+		 */
+		if (n <= mtm_commit_prefetch_max) {
+			for (i = 0; i < n; i++) {
+				if (i == 0 || BLOCK_ADDR(sorted[i]->addr) != BLOCK_ADDR(sorted[i-1]->addr)) {
+					__builtin_prefetch((const void *) sorted[i]->addr, 1, 3);
+				}
+			}
+		}
+#endif /* DESIGN != WRITE_THROUGH */
+
+#ifdef TMLOG_AT_COMMIT
+		/* 
+		 * One redo record per written word, carrying its final value. The
+		 * full words of a cacheline are next to each other in sorted order
+		 * and share a single line record: one address word and a bitmap of
+		 * the words present instead of an address per word. Words stored
+		 * inside a logical operation are redone by its record instead.
+		 * Where the log type supports it, room for all the records is 
+		 * reserved up front and the records are appended unchecked.
+		 */
+		if (!PWB_NO_LOG) {
+#ifdef M_TMLOG_RESERVE
+			M_TMLOG_RESERVE(tx->pcm_storeset, modedata->ptmlog, pwb_commit_log_nwords(sorted, n));
+#endif /* M_TMLOG_RESERVE */
+			for (i = 0; i < n; i++) {
+				w = sorted[i];
+				if (!w->is_nonvolatile || w->is_logical || w->mask == 0) {
+					continue;
+				}
+				if (w->mask != ~((mtm_word_t) 0)) {
+					M_TMLOG_APPEND(tx->pcm_storeset, modedata->ptmlog, (uintptr_t) w->addr, w->value, w->mask);
+					continue;
+				}
+				line = XACT_LINE_ADDR((uintptr_t) w->addr);
+				line_bitmap = 0;
+				line_nwords = 0;
+				for (; i < n; i++) {
+					w = sorted[i];
+					if (XACT_LINE_ADDR((uintptr_t) w->addr) != line) {
+						break;
+					}
+					if (!w->is_nonvolatile || w->is_logical) {
+						continue;
+					}
+					if (w->mask == ~((mtm_word_t) 0)) {
+						line_bitmap |= 1 << (((uintptr_t) w->addr - line) / sizeof(mtm_word_t));
+						line_vals[line_nwords++] = w->value;
+					} else if (w->mask != 0) {
+						M_TMLOG_APPEND(tx->pcm_storeset, modedata->ptmlog, (uintptr_t) w->addr, w->value, w->mask);
+					}
+				}
+				i--;
+				if (line_nwords == 1) {
+					M_TMLOG_APPEND(tx->pcm_storeset, modedata->ptmlog, line + __builtin_ctz(line_bitmap) * sizeof(mtm_word_t), line_vals[0], ~((mtm_word_t) 0));
+				} else {
+					M_TMLOG_APPEND_LINE(tx->pcm_storeset, modedata->ptmlog, line, line_bitmap, line_vals);
+				}
+			}
+		}
+#endif /* TMLOG_AT_COMMIT */
+
+		/* 
+		 * Blocks the transaction allocated were stored to in place and not 
+		 * logged: they must be durable before the commit marker. Without a
+		 * write set nothing can point to them, so read-only commits skip this.
+		 */
+		pwb_captured_flush(tx, modedata);
+
+#if DESIGN == WRITE_THROUGH
+		/* 
+		 * The stores are in memory already: they must be durable before the
+		 * undo log is marked or truncated. Volatile entries need no flush.
+		 */
+		for (i = 0; i < n; i++) {
+			w = sorted[i];
+			if (!w->is_nonvolatile) {
+				continue;
+			}
+			if (w->mask != 0) {
+				nvwrite_bytes += sizeof(mtm_word_t);
+			}
+			if ((i + 1 == n || BLOCK_ADDR(sorted[i+1]->addr) != BLOCK_ADDR(w->addr)) &&
+			    !PWB_NO_HOME_FLUSH)
+			{
+				PCM_WB_FLUSH(tx->pcm_storeset, w->addr);
+				wbflush_cnt++;
+			}
+		}
+		if (modedata->has_nvwrite) {
+			PCM_PERSIST_BARRIER(tx->pcm_storeset);
+		}
+#endif /* DESIGN == WRITE_THROUGH */
+
+		/* 
+		 * Make sure the persistent tm log is made stable. A transaction that 
+		 * wrote only volatile memory logged nothing and needs no commit marker.
+		 */
+		if (modedata->has_nvwrite) {
+			M_TMLOG_COMMIT(tx->pcm_storeset, modedata->ptmlog, t);
+			tx->last_sqn = t;
+		}
+		ATOMIC_STORE_REL(&tx->pending_sqn, 0);
+		PWB_COMMIT_PHASE_END(tx, phase_ts, log_commit);
+#ifdef _M_STATS_BUILD
+		m_stats_statset_increment(mtm_statsmgr, tx->statset, XACT, log_bytes, 
+		                          M_TMLOG_WRITTEN_BYTES(modedata->ptmlog));
+#endif
 
 		/* Make sure previous stores are not reordered with the cl-flushes below  freud : unnecessary fence */
 		/* PCM_WB_FENCE(tx->pcm_storeset);  moved this info M_TMLOG_COMMIT. It replaces PCM_NT_FLUSH in m_tmlog_base_? */
@@ -141,47 +554,120 @@ pwb_trycommit (mtm_tx_t *tx, int enable_isolation)
 		/* Install new versions, drop locks and set new timestamp */
 		/* In the case when isolation is off, the write set contains entries 
 		 * that point to private pseudo-locks. */
-		w = modedata->w_set.entries;
-		int wbflush_cnt=0;
-		for (i = modedata->w_set.nb_entries; i > 0; i--, w++) {
+#if DESIGN != WRITE_THROUGH
+		/* 
+		 * Snapshot reads may still need the words about to be overwritten:
+		 * they go to the version store before the locks are dropped.
+		 */
+		if (enable_isolation && unlikely(mtm_mvstore_buckets != NULL)) {
+			for (i = 0; i < n; i++) {
+				w = sorted[i];
+				if (w->mask != 0) {
+					mtm_mvstore_record(w->addr, ATOMIC_LOAD(w->addr), t);
+				}
+			}
+		}
+		for (i = 0; i < n; i++) {
+			w = sorted[i];
+			/* 
+			 * A persistent cacheline whose words are all overwritten goes 
+			 * out in one non-temporal store: no read for ownership of the 
+			 * old line, and nothing to flush. Read-cached regions keep a 
+			 * shadow copy up to date and take the regular path.
+			 */
+			if (likely(mtm_readcache_nregions == 0) && 
+			    pwb_line_overwritten(sorted, i, n, wb_line)) 
+			{
+				PCM_NT_STORE_64B(tx->pcm_storeset, BLOCK_ADDR(w->addr), wb_line);
+				nvwrite_bytes += CACHELINE_SIZE;
+				wbstream_cnt++;
+				i += CACHELINE_SIZE / sizeof(mtm_word_t) - 1;
+				continue;
+			}
 			MTM_DEBUG_PRINT("==> write(t=%p[%lu-%lu],a=%p,d=%p-%d,m=%llx,v=%d)\n", tx,
 			                (unsigned long)modedata->start, (unsigned long)modedata->end,
 			                w->addr, (void *)w->value, (int)w->value, (unsigned long long) w->mask, (int)w->version);
-			/* Write the value in this entry to memory (it will probably land in the cache; that's okay.) */
-			if (w->mask != 0) {
-				PCM_WB_STORE_ALIGNED_MASKED(tx->pcm_storeset, w->addr, w->value, w->mask);
-			}	
-# ifdef	SYNC_TRUNCATION
-			/* Flush the cacheline to persistent memory if this is the last entry in this cache line. */
-			if (w->next_cache_neighbor == NULL) {
-				/* If isolation is enabled, then the write set may contain non-persistent 
-				 * writes as well. Need to filter those out as we don't need to flush them 
-				 * out of the cache.
-				 * FIXME: Would it be better if we had marked them as non-persistent and
-				 *        avoid the bounds checking?
-				 */
-				if (enable_isolation) {
-					if (((uintptr_t) w->addr >= PSEGMENT_RESERVED_REGION_START &&
-						 (uintptr_t) w->addr < (PSEGMENT_RESERVED_REGION_START + PSEGMENT_RESERVED_REGION_SIZE)))
-					{
-						/* access is persistent -- flush, freud : why flush individual entries ? */
-						PCM_WB_FLUSH(tx->pcm_storeset, w->addr);
-						wbflush_cnt++;
+			/* 
+			 * Several entries, or partial words, of a line are merged into 
+			 * one byte-masked vector store instead of a store per word and
+			 * byte loops for partial words.
+			 */
+			if (pcm_masked_store_avx512 && likely(mtm_readcache_nregions == 0) &&
+			    ((i + 1 < n && BLOCK_ADDR(sorted[i+1]->addr) == BLOCK_ADDR(w->addr)) ||
+			     (w->mask != 0 && w->mask != ~((mtm_word_t) 0))))
+			{
+				j = pwb_line_gather(sorted, i, n, wb_line, &wb_bytemask);
+				if (wb_bytemask != 0) {
+					if (w->is_nonvolatile) {
+						nvwrite_bytes += __builtin_popcountll(wb_bytemask);
 					}
-				} else {
-					PCM_WB_FLUSH(tx->pcm_storeset, w->addr);
-					wbflush_cnt++;
+					PCM_WB_STORE_LINE_MASKED(tx->pcm_storeset, BLOCK_ADDR(w->addr), 
+					                         wb_line, wb_bytemask);
 				}
+				i = j - 1;
+				w = sorted[i];
+			} else if (w->mask != 0) {
+				/* Write the value in this entry to memory (it will probably land in the cache; that's okay.) */
+				if (w->is_nonvolatile) {
+					nvwrite_bytes += __builtin_popcountll(w->mask) / 8;
+				}
+				/* Both copies are written before the lock is dropped */
+				pwb_store_aligned_masked(tx, w->addr, w->value, w->mask);
+			}	
+# ifdef	SYNC_TRUNCATION
+			/* 
+			 * Flush the cacheline to persistent memory once its last entry is 
+			 * written back. Volatile entries, which the write set holds when 
+			 * isolation is enabled, need no flush.
+			 */
+			if (w->is_nonvolatile && !PWB_NO_HOME_FLUSH &&
+			    (i + 1 == n || BLOCK_ADDR(sorted[i+1]->addr) != BLOCK_ADDR(w->addr)))
+			{
+				PCM_WB_FLUSH(tx->pcm_storeset, w->addr);
+				wbflush_cnt++;
+			}	
+# else
+			/* 
+			 * Words redone by a logical record are not named in the log, so 
+			 * the log truncation would not flush them.
+			 */
+			if (modedata->has_logical && w->is_nonvolatile && !PWB_NO_HOME_FLUSH &&
+			    (i + 1 == n || BLOCK_ADDR(sorted[i+1]->addr) != BLOCK_ADDR(w->addr)))
+			{
+				PCM_WB_FLUSH(tx->pcm_storeset, w->addr);
+				wbflush_cnt++;
 			}	
 # endif
-			/* Only drop lock for last covered address in write set */
-			if (w->next == NULL) {
+		}
+		/* Streamed lines must be visible before the locks are dropped */
+		if (wbstream_cnt > 0) {
+			PCM_NT_FLUSH(tx->pcm_storeset);
+		}
+#endif /* DESIGN != WRITE_THROUGH */
+		PWB_COMMIT_PHASE_END(tx, phase_ts, writeback);
+		/* 
+		 * Drop locks only now: the entries covered by a lock are spread over 
+		 * the sorted order. Only drop lock through the entry holding it.
+		 */
+		W_SET_FOR_EACH_ENTRY(&modedata->w_set, c, i, w) {
+			if (PWB_ENTRY_HOLDS_LOCK(w)) {
 				ATOMIC_STORE_REL(w->lock, LOCK_SET_TIMESTAMP(t));
 			}	
 		}
-		PCM_WB_FENCE(tx->pcm_storeset);
+		PWB_WAKE_LOCK_WAITERS(&modedata->w_set, c, i, w);
+#ifdef INCREMENTAL_VALIDATION
+		mtm_commit_done();
+#endif /* INCREMENTAL_VALIDATION */
+		PWB_COMMIT_PHASE_END(tx, phase_ts, lock_release);
+		/* One store-ordering barrier drains the whole batch of flushes. */
+		if (modedata->has_nvwrite && !PWB_WRITE_THROUGH) {
+			PCM_PERSIST_BARRIER(tx->pcm_storeset);
+		}
+		PWB_COMMIT_PHASE_END(tx, phase_ts, persist_barrier);
 #ifdef _M_STATS_BUILD
 		m_stats_statset_increment(mtm_statsmgr, tx->statset, XACT, wbflush, wbflush_cnt);
+		m_stats_statset_increment(mtm_statsmgr, tx->statset, XACT, wbstream, wbstream_cnt);
+		m_stats_statset_increment(mtm_statsmgr, tx->statset, XACT, nvwrite_bytes, nvwrite_bytes);
 #endif		
 		//printf("w_set.nb_entries= %d\n", modedata->w_set.nb_entries);
 		//printf("cachelines flushed= %d\n", wbflush_cnt);
@@ -191,15 +677,32 @@ pwb_trycommit (mtm_tx_t *tx, int enable_isolation)
 # endif /* READ_LOCKED_DATA */
 
 # ifdef	SYNC_TRUNCATION
+		if (modedata->has_nvwrite) {
+#  ifdef _M_STATS_BUILD
+			m_stats_statset_increment(mtm_statsmgr, tx->statset, XACT, trunc_bytes, 
+			                          M_TMLOG_UNTRUNCATED_BYTES(modedata->ptmlog));
+#  endif
 			M_TMLOG_TRUNCATE_SYNC(tx->pcm_storeset, modedata->ptmlog);
+		}
 # endif
+		PWB_COMMIT_PHASE_END(tx, phase_ts, truncate);
+#ifdef _M_STATS_BUILD
+		if (unlikely(tx->stats_commit_phases)) {
+			m_stats_threadstat_commit_phases(tx->threadstat, phase_ts);
+		}
+#endif
 	}
 
 #ifdef _M_STATS_BUILD	
+	m_stats_statset_increment(mtm_statsmgr, tx->statset, XACT, fences, 
+	                          pcm_stat_fences - tx->stats_fences);
+	tx->statset->site = tx->site;
 	m_stats_threadstat_aggregate(tx->threadstat, tx->statset);
-	assert(m_stats_statset_destroy(&tx->statset) == M_R_SUCCESS);
 #endif	
 
+	mtm_rwset_site_commit(tx, modedata);
+	mtm_sched_serial_end(tx);
+	pwb_cpu_log_release(modedata);
 	cm_reset(tx);
 	return true;
 }
@@ -208,17 +711,53 @@ pwb_trycommit (mtm_tx_t *tx, int enable_isolation)
 /*
  * Rollback transaction.
  */
+#if DESIGN == WRITE_THROUGH
+/*
+ * Write-through: put the old values saved in the write set back in place,
+ * and make them durable before the undo log is marked or truncated.
+ */
+static inline
+void
+pwb_wt_undo(mtm_tx_t *tx, mode_data_t *modedata)
+{
+	w_entry_t *w;
+	int       c;
+	int       i;
+	int       flushed = 0;
+
+	W_SET_FOR_EACH_ENTRY(&modedata->w_set, c, i, w) {
+		if (w->mask == 0) {
+			continue;
+		}
+		pwb_store_aligned_masked(tx, w->addr, w->value, w->mask);
+		if (w->is_nonvolatile) {
+			PCM_WB_FLUSH(tx->pcm_storeset, w->addr);
+			flushed = 1;
+		}
+	}
+	if (flushed) {
+		PCM_PERSIST_BARRIER(tx->pcm_storeset);
+	}
+}
+#endif /* DESIGN == WRITE_THROUGH */
+
+
 static inline 
 void 
 pwb_rollback(mtm_tx_t *tx)
 {
 	assert(tx->mode == MTM_MODE_pwbnl || MTM_MODE_pwbetl);
-	mode_data_t   *modedata = (mode_data_t *) tx->modedata[tx->mode];
+	mode_data_t   *modedata = (mode_data_t *) tx->active_modedata;
 	w_entry_t     *w;
 	int           i;
+	int           c;
 #ifdef READ_LOCKED_DATA
 	mtm_word_t    id;
 #endif /* READ_LOCKED_DATA */
+#if DESIGN == WRITE_THROUGH
+	mtm_word_t    t;
+	int           alone;
+#endif /* DESIGN == WRITE_THROUGH */
 
 	MTM_DEBUG_PRINT("==> pwb_rollback(%p[%lu-%lu])\n", tx,
 	                (unsigned long)modedata->start,
@@ -228,25 +767,44 @@ pwb_rollback(mtm_tx_t *tx)
 	assert(tx->status == TX_ACTIVE);
 
 	/* Mark the transaction in the persistent log as aborted. */
-	M_TMLOG_ABORT(tx->pcm_storeset, modedata->ptmlog, 0);
+	if (!modedata->read_only) {
+#if DESIGN == WRITE_THROUGH
+		pwb_wt_undo(tx, modedata);
+#endif /* DESIGN == WRITE_THROUGH */
+		M_TMLOG_ABORT(tx->pcm_storeset, modedata->ptmlog, 0);
 # ifdef	SYNC_TRUNCATION
-	M_TMLOG_TRUNCATE_SYNC(tx->pcm_storeset, modedata->ptmlog);
+		M_TMLOG_TRUNCATE_SYNC(tx->pcm_storeset, modedata->ptmlog);
 # endif
+	}
+	/* The next execution claims a CPU log again, possibly another one */
+	pwb_cpu_log_release(modedata);
+	/* An abort at commit leaves its bound on mtm_durable_sqn behind */
+	ATOMIC_STORE_REL(&tx->pending_sqn, 0);
 
 	/* Drop locks */
-	i = modedata->w_set.nb_entries;
-	if (i > 0) {
+	if (modedata->w_set.nb_entries > 0) {
 # ifdef READ_LOCKED_DATA
 		/* Update instance number (becomes odd) */
 		id = tx->id;
 		assert(id % 2 == 0);
 		ATOMIC_STORE_REL(&tx->id, id + 1);
 # endif /* READ_LOCKED_DATA */
-		w = modedata->w_set.entries;
-		for (; i > 0; i--, w++) {
-			if (w->next == NULL) {
-				/* Only drop lock for last covered address in write set */
+#if DESIGN == WRITE_THROUGH
+		/* 
+		 * Memory changed under the locks: release them with a new version, 
+		 * or a reader that loaded a lock before we took it could validate 
+		 * a value it loaded in between.
+		 */
+		t = mtm_clock_commit_ts(&alone);
+#endif /* DESIGN == WRITE_THROUGH */
+		W_SET_FOR_EACH_ENTRY(&modedata->w_set, c, i, w) {
+			if (PWB_ENTRY_HOLDS_LOCK(w)) {
+				/* Only drop lock through the entry holding it (none before commit with CTL) */
+#if DESIGN == WRITE_THROUGH
+				ATOMIC_STORE(w->lock, LOCK_SET_TIMESTAMP(t > w->version ? t : w->version + 1));
+#else /* DESIGN != WRITE_THROUGH */
 				ATOMIC_STORE(w->lock, LOCK_SET_TIMESTAMP(w->version));
+#endif /* DESIGN != WRITE_THROUGH */
 			}
 			PRINT_DEBUG2("==> discard(t=%p[%lu-%lu],a=%p,d=%p-%lu,v=%lu)\n", tx,
 			             (unsigned long)modedata->start, 
@@ -258,6 +816,7 @@ pwb_rollback(mtm_tx_t *tx)
 		}
 		/* Make sure that all lock releases become visible */
 		ATOMIC_MB_WRITE;
+		PWB_WAKE_LOCK_WAITERS(&modedata->w_set, c, i, w);
 # ifdef READ_LOCKED_DATA
 		/* Update instance number (becomes even) */
 		ATOMIC_STORE_REL(&tx->id, id + 2);
@@ -294,21 +853,23 @@ pwb_rollback(mtm_tx_t *tx)
 static void
 rollback_transaction (mtm_tx_t *tx)
 {
+#if (!defined(ALLOW_ABORTS))
+	/* Without isolation, volatile data was updated in place and cannot be restored */
+	if (tx->mode == MTM_MODE_pwbnl) {
+		fprintf(stderr, "Error: transaction without isolation aborted (build with ALLOW_ABORTS)\n");
+		abort();
+	}
+#endif /* ! ALLOW_ABORTS */
 	pwb_rollback (tx);
 	switch (tx->mode) {
 		case MTM_MODE_pwbnl:
-			assert(0);
-#if (defined(ALLOW_ABORTS))
-			mtm_local_rollback (tx);
-#endif
-			break;
 		case MTM_MODE_pwbetl:
 			mtm_local_rollback (tx);
 			break;
 		default:
 			assert(0);
 	}
-	mtm_useraction_list_run (tx->undo_action_list, 1);
+	mtm_useraction_list_run (&tx->undo_action_list, 1);
 
 	//FIXME: revert exceptions
 	/*
@@ -326,38 +887,51 @@ static inline
 void pwb_prepare_transaction(mtm_tx_t *tx)
 {
 	assert(tx->mode == MTM_MODE_pwbnl || MTM_MODE_pwbetl);
-	mode_data_t *modedata = (mode_data_t *) tx->modedata[tx->mode];
+	mode_data_t *modedata = (mode_data_t *) tx->active_modedata;
+#if DESIGN == WRITE_BACK_CTL
+	w_entry_t   *w;
+	int         c;
+	int         i;
+
+	/* Unhook the entries of the previous execution from the pseudo-locks */
+	W_SET_FOR_EACH_ENTRY(&modedata->w_set, c, i, w) {
+		*PRIVATE_GET_LOCK(tx, w->addr) = 0;
+	}
+#endif /* DESIGN == WRITE_BACK_CTL */
 
-start:
-	/* Start timestamp */
-	modedata->start = modedata->end = GET_CLOCK; /* OPT: Could be delayed until first read/write, why bother ? */
+	/* Start timestamp: taken by the first barrier (see pwb_snapshot) */
+	modedata->start = modedata->end = 0;
+	modedata->has_snapshot = 0;
 	/* Allow extensions */
 	tx->can_extend = 1;
-#ifdef ROLLOVER_CLOCK
-	if (modedata->start >= VERSION_MAX) {
-		/* Overflow: we must reset clock */
-		mtm_overflow(tx);
-		goto start;
-	}
-#endif /* ROLLOVER_CLOCK */
 	/* Read/write set */
-	
-	/* Because of the current state of the recoverable write-set block, reallocation is not
-	   possible. This program cannot be run until the recoverable blocks are
-	   somehow extendable. */
-	   //FIXME: What does the above comment mean?
-	assert(modedata->w_set.reallocate == 0);
-	
-	modedata->w_set.nb_entries = 0;
+	mtm_clear_ws_entries(modedata);
 	modedata->r_set.nb_entries = 0;
-	mtm_useraction_clear (tx->commit_action_list);
-	mtm_useraction_clear (tx->undo_action_list);
-
-	M_TMLOG_BEGIN(modedata->ptmlog);
+	modedata->has_nvwrite = 0;
+	modedata->logical_op = 0;
+	modedata->has_logical = 0;
+	modedata->nb_captured = 0;
+#ifdef INCREMENTAL_VALIDATION
+	modedata->valid_quiescent = 0;
+#endif /* INCREMENTAL_VALIDATION */
+#ifdef READ_SET_FILTER
+	mtm_rs_filter_clear(modedata);
+#endif /* READ_SET_FILTER */
+	mtm_useraction_clear (&tx->precommit_action_list);
+	mtm_useraction_clear (&tx->commit_action_list);
+	mtm_useraction_clear (&tx->undo_action_list);
+#ifdef CLOSED_NESTING
+	modedata->nb_savepoints = 0;
+	modedata->w_undo.nb_entries = 0;
+#endif /* CLOSED_NESTING */
 
-#ifdef EPOCH_GC
-	gc_set_epoch(modedata->start);
-#endif /* EPOCH_GC */
+	/* A read-only transaction writes nothing to the log, not even its begin */
+	if (!modedata->read_only) {
+		if (unlikely(modedata->ptmlog == NULL)) {
+			mtm_pwb_log_attach(tx, modedata);
+		}
+		M_TMLOG_BEGIN(modedata->ptmlog);
+	}
 
 	tx->nesting = 1;
 	tx->status = TX_ACTIVE;	/* Set status (no need for CAS or atomic op) */
@@ -366,6 +940,212 @@ start:
 
 }
 
+/*
+ * Serial mode. With isolation, a transaction holds mtm_serial_lock for 
+ * reading from its outermost begin until it commits or aborts, across 
+ * restarts. Irrevocable transactions, and transactions that exceed 
+ * mtm.serial_threshold consecutive retries, hold it for writing instead:
+ * they run alone and so can no longer lose a conflict.
+ */
+static inline
+void
+pwb_serial_enter(mtm_tx_t *tx, int serial)
+{
+	if (serial & MTM_SERIAL_WRITE) {
+		mtm_rwlock_wrlock(&mtm_serial_lock);
+	} else {
+		mtm_rwlock_rdlock(&mtm_serial_lock);
+	}
+	tx->serial = serial;
+}
+
+
+static inline
+void
+pwb_serial_exit(mtm_tx_t *tx)
+{
+	if (tx->serial & MTM_SERIAL_WRITE) {
+		mtm_rwlock_write_unlock(&mtm_serial_lock);
+	} else if (tx->serial != MTM_SERIAL_NONE) {
+		mtm_rwlock_read_unlock(&mtm_serial_lock);
+	}
+	tx->serial = MTM_SERIAL_NONE;
+}
+
+
+#ifdef HTM_FASTPATH
+/*
+ * Hardware fast path. The transaction body runs inside an RTM transaction
+ * using the normal barriers: loads read memory directly after checking the
+ * lock, and stores acquire locks and fill the write set as usual, but no 
+ * read set is kept and nothing is written to the persistent log. The 
+ * transaction thus leaves the hardware transaction owning the locks of 
+ * everything it wrote, and it commits through the software commit path.
+ *
+ * On an abort the processor rolls back to htm_begin, and after 
+ * mtm_htm_attempts failures (or a capacity abort, or a request for the 
+ * software path) the transaction runs in software.
+ */
+static inline
+void
+pwb_htm_begin(mtm_tx_t *tx)
+{
+	unsigned int status;
+	int          attempts;
+
+	for (attempts = 0; attempts < mtm_htm_attempts; attempts++) {
+		status = htm_begin();
+		if (status == HTM_STARTED) {
+			tx->htm = 1;
+			return;
+		}
+#ifdef _M_STATS_BUILD
+		m_stats_statset_increment(mtm_statsmgr, tx->statset, XACT, htm_aborts, 1);
+#endif
+		if (!(status & HTM_ABORT_RETRY) || 
+		    ((status & HTM_ABORT_EXPLICIT) && HTM_ABORT_CODE(status) == HTM_CODE_RESTART))
+		{
+			break;
+		}
+	}
+}
+
+
+/*
+ * Leave the hardware transaction and write the redo log records that the
+ * barriers deferred. The write set holds the final value of each word.
+ * With TMLOG_AT_COMMIT the software commit writes them instead.
+ */
+static inline
+void
+pwb_htm_commit(mtm_tx_t *tx)
+{
+	mode_data_t *modedata = (mode_data_t *) tx->active_modedata;
+	w_entry_t   *w;
+	int         i;
+	int         c;
+
+	htm_end();
+	tx->htm = 0;
+#ifdef _M_STATS_BUILD
+	m_stats_statset_increment(mtm_statsmgr, tx->statset, XACT, htm_commits, 1);
+#endif
+	W_SET_FOR_EACH_ENTRY(&modedata->w_set, c, i, w) {
+		mtm_clock_advance(w->version);
+#ifndef TMLOG_AT_COMMIT
+		if (w->is_nonvolatile && w->mask != 0 && !PWB_NO_LOG) {
+			M_TMLOG_WRITE(tx->pcm_storeset, modedata->ptmlog, (uintptr_t) w->addr, w->value, w->mask);
+		}
+#endif /* ! TMLOG_AT_COMMIT */
+	}
+}
+#endif /* HTM_FASTPATH */
+
+
+#ifdef CLOSED_NESTING
+/*
+ * Closed nesting. A nested transaction takes a savepoint at begin and 
+ * drops it when it commits into its parent; savepoints taken by the 
+ * application through mtm_savepoint() work the same way and are dropped
+ * at the latest when the transaction they were taken in commits. Rolling
+ * back to a savepoint undoes only what ran after it:
+ *
+ *  - entries of the parent that were overwritten get their old value back
+ *    from the write-set undo log,
+ *  - entries created after it are emptied (mask 0) but stay in the write set: 
+ *    the locks they cover are released with the parent, and the entries
+ *    remain linked from the locks, the chains of other entries and the 
+ *    index,
+ *  - the read set, the local undo log and the user-action lists are cut 
+ *    back to their size at the savepoint; undo actions registered after 
+ *    it are run.
+ *
+ * Memory is not modified until commit, so the persistent log only needs a
+ * record restoring the bytes written after the savepoint: it is a redo 
+ * log and the last record for an address wins. With TMLOG_AT_COMMIT it 
+ * needs no record at all.
+ */
+static inline
+mtm_pwb_savepoint_t *
+pwb_savepoint_push(mtm_tx_t *tx, int kind, uint32_t resume, uint32_t prop)
+{
+	mode_data_t         *modedata = (mode_data_t *) tx->active_modedata;
+	mtm_pwb_savepoint_t *sp;
+
+	if (modedata->nb_savepoints == PWB_MAX_SAVEPOINTS) {
+		return NULL;
+	}
+	sp = &modedata->savepoints[modedata->nb_savepoints++];
+	sp->kind = kind;
+	sp->resume = resume;
+	sp->prop = prop;
+	sp->nesting = tx->nesting;
+	sp->retries = 0;
+	sp->w_chunk = modedata->w_set.cur_chunk;
+	sp->w_chunk_entries = modedata->w_set.chunks[sp->w_chunk].nb_entries;
+	sp->w_entries = modedata->w_set.nb_entries;
+	sp->r_entries = modedata->r_set.nb_entries;
+	sp->w_undo_entries = modedata->w_undo.nb_entries;
+	sp->local_undo = mtm_local_savepoint(tx);
+	sp->precommit_actions = mtm_useraction_list_length(&tx->precommit_action_list);
+	sp->commit_actions = mtm_useraction_list_length(&tx->commit_action_list);
+	sp->undo_actions = mtm_useraction_list_length(&tx->undo_action_list);
+	/* A rollback would have to restore what is stored to the blocks from now on */
+	modedata->nb_captured = 0;
+	return sp;
+}
+
+
+static inline
+void
+pwb_savepoint_rollback(mtm_tx_t *tx, mtm_pwb_savepoint_t *sp)
+{
+	mode_data_t            *modedata = (mode_data_t *) tx->active_modedata;
+	mtm_pwb_w_undo_entry_t *u;
+	w_entry_t              *w;
+	int                    c;
+	int                    i;
+
+	MTM_DEBUG_PRINT("==> pwb_savepoint_rollback(%p, nest_level:%d)\n", tx, sp->nesting);
+
+	/* Restore the parent's entries, last write first */
+	while (modedata->w_undo.nb_entries > sp->w_undo_entries) {
+		u = &modedata->w_undo.entries[--modedata->w_undo.nb_entries];
+		w = u->entry;
+		if (w->is_nonvolatile && !PWB_DEFER_LOG(tx)) {
+			M_TMLOG_WRITE(tx->pcm_storeset, modedata->ptmlog, (uintptr_t) w->addr, 
+			              (ATOMIC_LOAD(w->addr) & ~u->mask) | (u->value & u->mask), 
+			              w->mask | u->mask);
+		}
+		w->value = u->value;
+		w->mask = u->mask;
+	}
+
+	/* Empty the entries created by the nested transaction */
+	for (c = sp->w_chunk; c <= modedata->w_set.cur_chunk; c++) {
+		i = (c == sp->w_chunk) ? sp->w_chunk_entries : 0;
+		for (w = &modedata->w_set.chunks[c].entries[i]; 
+		     i < modedata->w_set.chunks[c].nb_entries; i++, w++) 
+		{
+			if (w->is_nonvolatile && w->mask != 0 && !PWB_DEFER_LOG(tx)) {
+				M_TMLOG_WRITE(tx->pcm_storeset, modedata->ptmlog, (uintptr_t) w->addr, 
+				              ATOMIC_LOAD(w->addr), w->mask);
+			}
+			w->mask = 0;
+		}
+	}
+
+	modedata->r_set.nb_entries = sp->r_entries;
+	/* The undo actions below free the blocks allocated since the savepoint */
+	modedata->nb_captured = 0;
+	mtm_local_rollback_to_savepoint(tx, sp->local_undo, &sp->jb);
+	mtm_useraction_list_rollback(&tx->precommit_action_list, sp->precommit_actions, 0);
+	mtm_useraction_list_rollback(&tx->commit_action_list, sp->commit_actions, 0);
+	mtm_useraction_list_rollback(&tx->undo_action_list, sp->undo_actions, 1);
+}
+#endif /* CLOSED_NESTING */
+
+
 static inline
 uint32_t
 beginTransaction_internal (mtm_tx_t *tx, 
@@ -380,32 +1160,115 @@ beginTransaction_internal (mtm_tx_t *tx,
 
 	/* Increment nesting level, freud : we did not enter here */
 	if (tx->nesting++ > 0) {
+#ifdef CLOSED_NESTING
+		mtm_pwb_savepoint_t *sp;
+
+		/* No savepoint when running alone irrevocably (or in hardware): 
+		 * nothing can abort the nested transaction alone. */
+		if (!(tx->serial & MTM_SERIAL_IRREVOCABLE) && !PWB_IN_HTM(tx) &&
+		    (sp = pwb_savepoint_push(tx, PWB_SAVEPOINT_NESTED, 
+		                             a_runInstrumentedCode | a_restoreLiveVariables, prop)) != NULL) 
+		{
+			*__env = &(sp->jb);
+			return a_runInstrumentedCode | a_saveLiveVariables;
+		}
+#endif /* CLOSED_NESTING */
 		*__env = NULL;
 		return a_runInstrumentedCode | a_saveLiveVariables;
 	}	
 
-	memcpy(&tx->jb, &tx->tmp_jb, sizeof(jmp_buf));
+	/* The caller copies the checkpoint into the buffer returned, if any */
 	*__env = &(tx->jb);
 	tx->prop = prop;
 
+	/* 
+	 * Transactions the compiler found to never write run read-only: their
+	 * reads must all be valid at the start snapshot, so they keep no read 
+	 * set and have nothing to validate or log at commit. A write, or a read
+	 * of data newer than the snapshot, restarts them as update transactions.
+	 */
+	((mode_data_t *) tx->active_modedata)->read_only = 
+		enable_isolation && (prop & pr_readOnly) && (prop & pr_instrumentedCode) &&
+		!(prop & pr_doesGoIrrevocable);
+
+	/* 
+	 * Snapshot reads run read-only whatever the compiler found, and read 
+	 * the versions of their snapshot from the version store (mvstore.h),
+	 * which only write-back commits fill.
+	 */
+	((mode_data_t *) tx->active_modedata)->snapshot = 
+		!PWB_WRITE_THROUGH && enable_isolation && tx->snapshot_reads && 
+		mtm_mvstore_buckets != NULL && (prop & pr_instrumentedCode) && 
+		!(prop & pr_doesGoIrrevocable);
+	if (((mode_data_t *) tx->active_modedata)->snapshot) {
+		((mode_data_t *) tx->active_modedata)->read_only = 1;
+	}
+
+	/* 
+	 * Block while a serial transaction runs, or run alone if irrevocable or
+	 * if the call site keeps aborting (see txsched.h)
+	 */
+	if (enable_isolation) {
+		if ((prop & pr_doesGoIrrevocable) || !(prop & pr_instrumentedCode)) {
+			pwb_serial_enter(tx, MTM_SERIAL_WRITE | MTM_SERIAL_IRREVOCABLE);
+		} else if (mtm_sched_serial_begin(tx)) {
+			pwb_serial_enter(tx, MTM_SERIAL_WRITE);
+		} else {
+			mtm_sched_begin(tx);
+			pwb_serial_enter(tx, MTM_SERIAL_READ);
+		}
+	}
+
+	/* 
+	 * Nothing resumes at the checkpoint of a transaction that can never
+	 * restart: one running alone irrevocably, whose aborts are fatal, or
+	 * one without isolation, which has no conflicts and can only be 
+	 * cancelled, if the compiler found it never is or if rolling it back
+	 * is fatal anyway. Leave the checkpoint of the last one in place.
+	 */
+	if (tx->serial & MTM_SERIAL_IRREVOCABLE) {
+		*__env = NULL;
+	} else if (!enable_isolation) {
+#ifdef ALLOW_ABORTS
+		if (prop & pr_hasNoAbort) {
+			*__env = NULL;
+		}
+#else
+		*__env = NULL;
+#endif /* ALLOW_ABORTS */
+	}
+
 	/* Initialize transaction descriptor */
 	pwb_prepare_transaction(tx);
+	mtm_rwset_site_begin(tx, (mode_data_t *) tx->active_modedata);
+	M_PROBE2(tx__begin, tx, prop);
 
 #ifdef _M_STATS_BUILD	
-	assert(m_stats_statset_create(&tx->statset) == M_R_SUCCESS);
-	assert(m_stats_statset_init(tx->statset, NULL /*srcloc->psource*/) == M_R_SUCCESS);
+	m_stats_statset_init(tx->statset, srcloc ? srcloc->psource : NULL);
+	tx->stats_fences = pcm_stat_fences;
+	if (tx->sched_class >= 0) {
+		m_stats_statset_increment(mtm_statsmgr, tx->statset, XACT, sched_queued, 1);
+	}
+	if (tx->serial == MTM_SERIAL_WRITE) {
+		m_stats_statset_increment(mtm_statsmgr, tx->statset, XACT, serial_starts, 1);
+	}
 #endif	
 
 	if ((prop & pr_doesGoIrrevocable) || !(prop & pr_instrumentedCode))
 	{
-		// TODO: Implement serial mode 
-		return (prop & pr_uninstrumentedCode
+		/* With isolation we run alone, so uninstrumented code is safe 
+		 * w.r.t. other transactions. Its stores bypass the persistent 
+		 * log though, so prefer instrumented code when we have it for 
+		 * a transaction that only may go irrevocable. */
+		return (prop & pr_uninstrumentedCode && !(prop & pr_instrumentedCode)
 		        ? a_runUninstrumentedCode : a_runInstrumentedCode);
 	}
 
-	if (enable_isolation) {
-		// TODO: Implement serial mode 
+#ifdef HTM_FASTPATH
+	if (enable_isolation && mtm_htm_attempts > 0) {
+		pwb_htm_begin(tx);
 	}
+#endif /* HTM_FASTPATH */
 
 	return a_runInstrumentedCode | a_saveLiveVariables;
 }
@@ -415,17 +1278,24 @@ static
 bool
 trycommit_transaction (mtm_tx_t *tx, int enable_isolation)
 {
+	/* 
+	 * Pre-commit actions still run inside the outermost transaction, so 
+	 * that the stores they make commit (or abort) with it.
+	 */
+	if (tx->nesting == 1) {
+		mtm_useraction_list_run (&tx->precommit_action_list, 0);
+	}
+#ifdef HTM_FASTPATH
+	if (tx->htm && tx->nesting == 1) {
+		pwb_htm_commit(tx);
+	}
+#endif /* HTM_FASTPATH */
 	if (pwb_trycommit(tx, enable_isolation)) {
 		if (tx->nesting > 0) {
 			return true;
 		}
 		switch (tx->mode) {
 			case MTM_MODE_pwbnl:
-				assert(0);
-#if (defined(ALLOW_ABORTS))
-				mtm_local_commit (tx);
-#endif
-				break;
 			case MTM_MODE_pwbetl:
 				mtm_local_commit (tx);
 				break;
@@ -433,10 +1303,13 @@ trycommit_transaction (mtm_tx_t *tx, int enable_isolation)
 				assert(0);
 		}
 
-		mtm_useraction_list_run (tx->commit_action_list, 0);
+		pwb_serial_exit(tx);
+		mtm_sched_end(tx);
+		mtm_useraction_list_run (&tx->commit_action_list, 0);
 
 		/* Set status (no need for CAS or atomic op) */
 		tx->status = TX_COMMITTED;
+		M_PROBE2(tx__commit, tx, tx->last_sqn);
 		return true;
 	}
 	return false;
@@ -0,0 +1,224 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/**
+ * \file flushset.h
+ *
+ * \brief Set of cachelines to flush once during log truncation.
+ *
+ * Open addressing over buckets of eight keys, so that a bucket fills one 
+ * cacheline and is compared against a key with one vector compare. A key
+ * is the cacheline address with the set's epoch in its low (always zero) 
+ * bits, so clearing the set only increments the epoch: a slot holding 
+ * another epoch is free. The table is wiped once every 
+ * M_FLUSHSET_EPOCHS clears. The lines added since the last clear are also
+ * kept in order, so flushing them does not scan the table.
+ */
+
+#ifndef _FLUSHSET_H_3KD8W1
+#define _FLUSHSET_H_3KD8W1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pcm.h>
+
+/* Keys per bucket */
+#define M_FLUSHSET_WAYS          8
+
+/* Epochs tag the low bits of a cacheline address; 0 marks a free slot */
+#define M_FLUSHSET_EPOCHS        (CACHELINE_SIZE - 1)
+
+#define M_FLUSHSET_MIN_BUCKETS   64
+
+typedef uint64_t m_flushset_bucket_t __attribute__((vector_size(M_FLUSHSET_WAYS * sizeof(uint64_t))));
+
+typedef struct m_flushset_s {
+	m_flushset_bucket_t *buckets;
+	uint64_t            nbuckets;      /**< Power of 2 */
+	uint64_t            epoch;         /**< Tag of the keys added since the last clear */
+	uintptr_t           *lines;        /**< Lines added since the last clear */
+	uint64_t            nlines;
+	uint64_t            size;          /**< Capacity of lines */
+} m_flushset_t;
+
+
+static inline
+int
+m_flushset_alloc_table(m_flushset_t *fs, uint64_t nbuckets)
+{
+	void *buckets;
+
+	if (posix_memalign(&buckets, sizeof(m_flushset_bucket_t), 
+	                   nbuckets * sizeof(m_flushset_bucket_t)) != 0) 
+	{
+		return -1;
+	}
+	memset(buckets, 0, nbuckets * sizeof(m_flushset_bucket_t));
+	fs->buckets = (m_flushset_bucket_t *) buckets;
+	fs->nbuckets = nbuckets;
+	return 0;
+}
+
+
+static inline
+m_flushset_t *
+m_flushset_new(void)
+{
+	m_flushset_t *fs;
+
+	if ((fs = (m_flushset_t *) calloc(1, sizeof(m_flushset_t))) == NULL) {
+		return NULL;
+	}
+	fs->size = M_FLUSHSET_MIN_BUCKETS * M_FLUSHSET_WAYS / 2;
+	if ((fs->lines = (uintptr_t *) malloc(fs->size * sizeof(uintptr_t))) == NULL ||
+	    m_flushset_alloc_table(fs, M_FLUSHSET_MIN_BUCKETS) != 0) 
+	{
+		free(fs->lines);
+		free(fs);
+		return NULL;
+	}
+	fs->epoch = 1;
+	return fs;
+}
+
+
+static inline
+uint64_t
+m_flushset_hash(m_flushset_t *fs, uintptr_t line)
+{
+	return ((line >> CACHELINE_SIZE_LOG) * 0x9E3779B97F4A7C15ULL >> 32) & (fs->nbuckets - 1);
+}
+
+
+/* 
+ * Puts key in the first bucket of its probe sequence with a free slot,
+ * unless it finds it first. Returns 1 if it was put. Since no key is 
+ * removed within an epoch, every bucket before that one was full when key
+ * was put there and still is, so probing stops at the first free slot.
+ */
+static inline
+int
+m_flushset_put(m_flushset_t *fs, uint64_t key)
+{
+	m_flushset_bucket_t *b;
+	m_flushset_bucket_t hit;
+	m_flushset_bucket_t stale;
+	uint64_t            i;
+	int                 j;
+
+	for (i = m_flushset_hash(fs, key);; i = (i + 1) & (fs->nbuckets - 1)) {
+		b = &fs->buckets[i];
+		hit = (m_flushset_bucket_t) (*b == key);
+		stale = (m_flushset_bucket_t) ((*b & M_FLUSHSET_EPOCHS) != fs->epoch);
+		for (j = 0; j < M_FLUSHSET_WAYS; j++) {
+			if (hit[j]) {
+				return 0;
+			}
+		}
+		for (j = 0; j < M_FLUSHSET_WAYS; j++) {
+			if (stale[j]) {
+				(*b)[j] = key;
+				return 1;
+			}
+		}
+	}
+}
+
+
+/* Doubles the table and the line array, keeping the load at most 1/2 */
+static inline
+void
+m_flushset_grow(m_flushset_t *fs)
+{
+	m_flushset_bucket_t *old = fs->buckets;
+	uintptr_t           *lines;
+	uint64_t            i;
+
+	if (m_flushset_alloc_table(fs, fs->nbuckets * 2) != 0 ||
+	    (lines = (uintptr_t *) realloc(fs->lines, 2 * fs->size * sizeof(uintptr_t))) == NULL) 
+	{
+		perror("m_flushset_grow");
+		exit(1);
+	}
+	free(old);
+	fs->lines = lines;
+	fs->size *= 2;
+	for (i = 0; i < fs->nlines; i++) {
+		m_flushset_put(fs, fs->lines[i] | fs->epoch);
+	}
+}
+
+
+/* Adds the cacheline at line; returns 1 if it was not in the set */
+static inline
+int
+m_flushset_add(m_flushset_t *fs, uintptr_t line)
+{
+	if (fs->nlines == fs->size) {
+		m_flushset_grow(fs);
+	}
+	if (m_flushset_put(fs, line | fs->epoch)) {
+		fs->lines[fs->nlines++] = line;
+		return 1;
+	}
+	return 0;
+}
+
+
+static inline
+void
+m_flushset_clear(m_flushset_t *fs)
+{
+	fs->nlines = 0;
+	if (++fs->epoch > M_FLUSHSET_EPOCHS) {
+		memset(fs->buckets, 0, fs->nbuckets * sizeof(m_flushset_bucket_t));
+		fs->epoch = 1;
+	}
+}
+
+
+/* Flushes the lines in the set and clears it */
+static inline
+void
+m_flushset_flush(pcm_storeset_t *set, m_flushset_t *fs)
+{
+	uint64_t i;
+
+	for (i = 0; i < fs->nlines; i++) {
+		PCM_WB_FLUSH(set, (volatile pcm_word_t *) fs->lines[i]);
+	}
+	m_flushset_clear(fs);
+}
+
+#endif /* _FLUSHSET_H_3KD8W1 */
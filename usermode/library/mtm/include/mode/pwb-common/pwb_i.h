@@ -48,10 +48,96 @@
 #include "local.h"
 #include "locks.h"
 #include "tmlog.h"
+#include "readcache.h"
+#include <spinwait.h>
+#ifdef HTM_FASTPATH
+# include "sysdeps/x86/htm.h"
+# define PWB_IN_HTM(tx)       ((tx)->htm)
+#else /* ! HTM_FASTPATH */
+# define PWB_IN_HTM(tx)       0
+#endif /* ! HTM_FASTPATH */
+/* Write-back design (the mode headers may have chosen it already) */
+#ifndef DESIGN
+# if defined(UNDO_LOGGING)
+#  define DESIGN WRITE_THROUGH
+# elif defined(COMMIT_TIME_LOCKING)
+#  define DESIGN WRITE_BACK_CTL
+# else /* ! COMMIT_TIME_LOCKING */
+#  define DESIGN WRITE_BACK_ETL
+# endif /* ! COMMIT_TIME_LOCKING */
+#endif /* ! DESIGN */
 
+/* 
+ * With commit-time locking the barriers buffer writes in the write set 
+ * without touching the locks; the entries covering a lock stripe hang off
+ * a private pseudo-lock (see PRIVATE_GET_LOCK) until commit acquires the 
+ * real locks in lock order. The hardware fast path and the priority 
+ * contention manager rely on writes owning their locks.
+ */
+#if DESIGN == WRITE_BACK_CTL
+# define PWB_LOCK_AT_COMMIT   1
+# ifdef HTM_FASTPATH
+#  error "COMMIT_TIME_LOCKING does not support HTM_FASTPATH"
+# endif /* HTM_FASTPATH */
+# if CM == CM_PRIORITY
+#  error "COMMIT_TIME_LOCKING does not support CM_PRIORITY"
+# endif /* CM == CM_PRIORITY */
+#else /* DESIGN != WRITE_BACK_CTL */
+# define PWB_LOCK_AT_COMMIT   0
+#endif /* DESIGN != WRITE_BACK_CTL */
+/* 
+ * With write-through the barriers store in place, with encounter-time 
+ * locking, and a write-set entry keeps the old value of its word instead
+ * of the new one. The first store to a persistent word logs the old value
+ * to the undo log (see tmlog_undo.h); the redo records of the write-back 
+ * designs are never written. The hardware fast path, reads of locked data
+ * and the write-set savepoints of closed nesting all rely on memory 
+ * holding the old values until commit.
+ */
+#if DESIGN == WRITE_THROUGH
+# define PWB_WRITE_THROUGH    1
+# ifdef HTM_FASTPATH
+#  error "UNDO_LOGGING does not support HTM_FASTPATH"
+# endif /* HTM_FASTPATH */
+# ifdef READ_LOCKED_DATA
+#  error "UNDO_LOGGING does not support READ_LOCKED_DATA"
+# endif /* READ_LOCKED_DATA */
+# ifdef CLOSED_NESTING
+#  error "UNDO_LOGGING does not support CLOSED_NESTING"
+# endif /* CLOSED_NESTING */
+# ifdef TMLOG_AT_COMMIT
+#  error "UNDO_LOGGING does not support TMLOG_AT_COMMIT"
+# endif /* TMLOG_AT_COMMIT */
+#else /* DESIGN != WRITE_THROUGH */
+# define PWB_WRITE_THROUGH    0
+#endif /* DESIGN != WRITE_THROUGH */
+/* No log record is written at all (benchmarks only, see mtm_unsafe_disable) */
+#define PWB_NO_LOG            MTM_UNSAFE_DISABLED(MTM_UNSAFE_LOGGING)
+/* Home locations are not written back (benchmarks only, likewise) */
+#define PWB_NO_HOME_FLUSH     MTM_UNSAFE_DISABLED(MTM_UNSAFE_HOME_FLUSH)
+/* The barriers leave persistent logging to commit time (or write no redo log) */
+#if defined(TMLOG_AT_COMMIT) || DESIGN == WRITE_THROUGH
+# define PWB_DEFER_LOG(tx)    1
+#else /* ! TMLOG_AT_COMMIT */
+# define PWB_DEFER_LOG(tx)    (PWB_IN_HTM(tx) || PWB_NO_LOG)
+#endif /* ! TMLOG_AT_COMMIT */
+/* 
+ * A thread that turned isolation off (see mtm_set_isolation) runs its 
+ * transactions in mode pwbnl through the pwbetl entry points, sharing the
+ * pwbetl mode data: their barriers skip the lock table for the private 
+ * pseudo-locks and their commits skip validation. The mode only changes
+ * between transactions.
+ */
+#define PWB_ISOLATION(tx)     likely((tx)->mode == MTM_MODE_pwbetl)
+
+
+/* Logs are truncated by the committing thread or by the truncation threads */
+#ifdef SYNC_TRUNCATION
+# define PWB_TMLOG_FLAGS      0
+#else /* ! SYNC_TRUNCATION */
+# define PWB_TMLOG_FLAGS      LF_ASYNC_TRUNCATION
+#endif /* ! SYNC_TRUNCATION */
 
-//#undef MTM_DEBUG_PRINT
-//# define MTM_DEBUG_PRINT(...)               printf(__VA_ARGS__); fflush(NULL)
 
 void ITM_NORETURN mtm_pwb_restart_transaction (mtm_tx_t *tx, mtm_restart_reason r);
 
@@ -59,46 +145,83 @@ void ITM_NORETURN mtm_pwb_restart_transaction (mtm_tx_t *tx, mtm_restart_reason
 typedef struct mtm_pwb_r_entry_s      mtm_pwb_r_entry_t;
 typedef struct mtm_pwb_r_set_s        mtm_pwb_r_set_t;
 typedef struct mtm_pwb_w_entry_s      mtm_pwb_w_entry_t;
+typedef struct mtm_pwb_w_chunk_s      mtm_pwb_w_chunk_t;
 typedef struct mtm_pwb_w_set_s        mtm_pwb_w_set_t;
 typedef struct mtm_pwb_mode_data_s    mtm_pwb_mode_data_t;
 typedef struct mtm_pwb_r_entry_s      r_entry_t;
 typedef struct mtm_pwb_r_set_s        r_set_t;
 typedef struct mtm_pwb_w_entry_s      w_entry_t;
+typedef struct mtm_pwb_w_chunk_s      w_chunk_t;
 typedef struct mtm_pwb_w_set_s        w_set_t;
 typedef struct mtm_pwb_mode_data_s    mode_data_t;
 
 
 
-/* Read set entry */
+/* 
+ * Read set entry 
+ *
+ * Eight bytes: the lock as its index in the lock array and the low 32 bits
+ * of the version read. A lock released after the read carries a commit 
+ * timestamp past the snapshot end (its writer took the timestamp after 
+ * acquiring it), so an entry is still valid if the lock is unlocked at a 
+ * version within the snapshot that matches the low bits. The second check
+ * alone would already do; the first rules out aliasing of the low bits.
+ */
 struct mtm_pwb_r_entry_s {
-  mtm_word_t          version;          /* Version read */
-  volatile mtm_word_t *lock;            /* Pointer to lock (for fast access) */
+  uint32_t            version;          /* Low bits of the version read */
+  uint32_t            lock;             /* Index of the lock in the lock array */
 };
 
+#define R_ENTRY_LOCK(r)                 (locks + (r)->lock)
+#define R_ENTRY_SET(r, l, v)                                                   \
+  do {                                                                         \
+    (r)->lock = (uint32_t) ((l) - locks);                                      \
+    (r)->version = (uint32_t) (v);                                             \
+  } while (0)
+/* Whether the unlocked lock word l still holds the version of entry r */
+#define R_ENTRY_VALID(modedata, r, l)                                          \
+  (LOCK_GET_TIMESTAMP(l) <= (modedata)->end &&                                 \
+   (uint32_t) LOCK_GET_TIMESTAMP(l) == (r)->version)
+
+
+/* Number of words of the read set bloom filter (must be a power of 2) */
+#define R_SET_FILTER_WORDS 4
+
 
 /* Read set */
 struct mtm_pwb_r_set_s {                  
   mtm_pwb_r_entry_t   *entries;         /* Array of entries */
   int                 nb_entries;       /* Number of entries */
   int                 size;             /* Size of array */
+#ifdef READ_SET_FILTER
+  mtm_word_t          filter[R_SET_FILTER_WORDS]; /* Bloom filter over the locks read */
+#endif /* READ_SET_FILTER */
 };
 
 
-/* Volatile write set entry */
+/* 
+ * Volatile write set entry 
+ *
+ * The fields the commit write-back and logging read for every entry come
+ * first, so that they share a cacheline; the lock release and the 
+ * barriers' chain walks use the rest. Chunks are cacheline aligned.
+ */
 struct mtm_pwb_w_entry_s {
 	union {                                                  /* For padding... */
 		struct {
+			/* Write-back and logging */
 			volatile mtm_word_t         *addr;               /* Address written */
 			mtm_word_t                  value;               /* New (write-back) or old (write-through) value */
 			mtm_word_t                  mask;                /* Write mask */
-			mtm_word_t                  version;             /* Version overwritten */
 			int                         is_nonvolatile;      /* Write access is to non-volatile memory */
+			int                         is_logical;          /* Last written inside a logical operation: no redo record */
+			/* Locking */
 			volatile mtm_word_t         *lock;               /* Pointer to lock (for fast access) */
-#if defined(CONFLICT_TRACKING)
-			struct mtm_tx_s             *tx;                 /* Transaction owning the write set */
-#endif /* defined(CONFLICT_TRACKING) */
+			mtm_word_t                  version;             /* Version overwritten */
 			struct mtm_pwb_w_entry_s    *next;               /* Next address covered by same lock (if any) */
-			struct mtm_pwb_w_entry_s*   next_cache_neighbor; /* Next address covered by same lock and falls within the same cacheline. These entries can be written together with a single cache-line flush. */
+#if defined(READ_LOCKED_DATA) || defined(CONFLICT_TRACKING) || CM == CM_PRIORITY || CM == CM_POLICY
+			struct mtm_tx_s             *tx;                 /* Transaction owning the write set */
+#endif /* defined(READ_LOCKED_DATA) || defined(CONFLICT_TRACKING) || CM == CM_PRIORITY || CM == CM_POLICY */
 		};
 #if CM == CM_PRIORITY
 		mtm_word_t padding[12];                              /* Padding (must be a multiple of 32 bytes) */
@@ -107,29 +230,260 @@ struct mtm_pwb_w_entry_s {
 };
 
 
-/* Write set */
-struct mtm_pwb_w_set_s {             
+/* 
+ * Initial size of the read set and of the first write-set chunk. Both grow
+ * as needed, and to the size the transactions of a site need before they
+ * run (see mtm_rwset_site_begin).
+ */
+#ifndef RW_SET_SIZE
+#define RW_SET_SIZE 4096
+#endif
+
+
+/* 
+ * Maximum number of write-set chunks. Each chunk is twice the size of the 
+ * previous one, so this bounds the write set to RW_SET_SIZE * (2^n - 1) 
+ * entries.
+ */
+#define W_SET_MAX_CHUNKS 24
+
+
+/* Write set chunk */
+struct mtm_pwb_w_chunk_s {             
 	mtm_pwb_w_entry_t *entries;           /* Array of entries */
-	int               nb_entries;         /* Number of entries */
+	int               nb_entries;         /* Number of entries used */
 	int               size;               /* Size of array */
-	int               reallocate;         /* Reallocate on next start */
 };
 
 
+/* 
+ * Write set 
+ *
+ * Locks point directly to write-set entries, so entries must never move 
+ * while the transaction is active. Instead of reallocating the array 
+ * (and restarting the transaction) when it fills up, the write set grows 
+ * by linking in a new chunk. Chunks are kept across transactions.
+ */
+struct mtm_pwb_w_set_s {             
+	mtm_pwb_w_entry_t *entries;           /* Entries of the first chunk */
+	int               nb_entries;         /* Number of entries in all chunks */
+	int               size;               /* Size of all allocated chunks */
+	int               nb_chunks;          /* Number of allocated chunks */
+	int               cur_chunk;          /* Chunk new entries are taken from */
+	mtm_pwb_w_chunk_t chunks[W_SET_MAX_CHUNKS];
+	mtm_pwb_w_entry_t **sorted;           /* Entries sorted by address at commit */
+	mtm_pwb_w_entry_t **sort_tmp;         /* Scratch array of the sort */
+	int               sort_size;          /* Size of the two arrays above */
+#ifdef WRITE_SET_INDEX
+	PointerHash       *index;             /* Address -> entry */
+#endif /* WRITE_SET_INDEX */
+};
+
+
+/* 
+ * Maximum number of blocks a transaction allocates whose stores skip the 
+ * write set and the log; stores to blocks allocated beyond it are logged.
+ */
+#define PWB_MAX_CAPTURED 16
+
+
+/* Persistent block allocated by the running transaction */
+typedef struct mtm_pwb_captured_s {
+	uintptr_t           start;
+	uintptr_t           end;
+} mtm_pwb_captured_t;
+
+
+#ifdef CLOSED_NESTING
+/* Maximum depth of nested transactions with a savepoint; deeper ones are flattened */
+#define PWB_MAX_SAVEPOINTS 16
+
+/* Number of times a nested transaction is retried before restarting the outermost one */
+#define PWB_NESTED_RETRIES 8
+
+
+/* Old value of a write-set entry that a nested transaction wrote again */
+typedef struct mtm_pwb_w_undo_entry_s {
+	mtm_pwb_w_entry_t   *entry;
+	mtm_word_t          value;
+	mtm_word_t          mask;
+} mtm_pwb_w_undo_entry_t;
+
+
+/* Write-set undo log */
+typedef struct mtm_pwb_w_undo_s {
+	mtm_pwb_w_undo_entry_t *entries;      /* Array of entries */
+	int                    nb_entries;    /* Number of entries */
+	int                    size;          /* Size of array */
+} mtm_pwb_w_undo_t;
+
+
+/* Kinds of savepoints */
+#define PWB_SAVEPOINT_NESTED 0            /* Taken by the begin of a nested transaction */
+#define PWB_SAVEPOINT_USER   1            /* Taken by mtm_savepoint() */
+
+
+/* 
+ * Savepoint taken when a nested transaction begins or when the application 
+ * asks for one. Records a register checkpoint to resume at and the size of
+ * every log the transaction may append to, so that what ran after it can be
+ * rolled back without touching what ran before.
+ */
+typedef struct mtm_pwb_savepoint_s {
+	jmp_buf             jb;               /* Register checkpoint to resume at */
+	int                 kind;             /* PWB_SAVEPOINT_NESTED or PWB_SAVEPOINT_USER */
+	uint32_t            resume;           /* Value returned at jb when re-executing after a conflict */
+	uint32_t            prop;             /* Properties of the nested transaction */
+	int                 nesting;          /* Nesting level the savepoint was taken at */
+	int                 retries;          /* Number of times it has been retried */
+	int                 w_chunk;          /* Write-set chunk in use... */
+	int                 w_chunk_entries;  /* ...and its number of entries */
+	int                 w_entries;        /* Write-set entries */
+	int                 r_entries;        /* Read-set entries */
+	int                 w_undo_entries;   /* Write-set undo log entries */
+	size_t              local_undo;       /* Local undo log offset */
+	int                 precommit_actions; /* User pre-commit actions */
+	int                 commit_actions;   /* User commit actions */
+	int                 undo_actions;     /* User undo actions */
+} mtm_pwb_savepoint_t;
+#endif /* CLOSED_NESTING */
+
+
+/*!
+ * A persistent tm log bound to a CPU (log_per_cpu). A transaction claims 
+ * the log of the CPU it begins on, or of the next free one, before it 
+ * logs anything and releases it once it commits or rolls back, so that the
+ * logs scale with the cores instead of the threads.
+ */
+typedef struct mtm_pwb_cpu_log_s {
+	volatile mtm_word_t owner;   /**< Non-zero while a transaction holds the log */
+	m_log_dsc_t         *dsc;    /**< Allocated by the first transaction to claim the log */
+	M_TMLOG_T           *log;
+} __attribute__((aligned(CACHELINE_SIZE))) mtm_pwb_cpu_log_t;
+
+void mtm_pwb_cpu_logs_init(void);
+void mtm_pwb_cpu_log_claim(mtm_tx_t *tx, mtm_pwb_mode_data_t *modedata);
+void mtm_pwb_log_attach(mtm_tx_t *tx, mtm_pwb_mode_data_t *modedata);
+
+
 /*!
  * A descriptor associated with each transaction, holding that transaction's read/write
  * set and other statistics about the transaction specific to this mode.
  */
+/* 
+ * High-water marks of the read and write sets of the transactions begun 
+ * at a site. The table is direct-mapped by site (a power of 2).
+ */
+#define RW_SET_SITES 64
+
+typedef struct mtm_pwb_site_s {
+	uintptr_t site;
+	int       r_hwm;
+	int       w_hwm;
+} mtm_pwb_site_t;
+
+
 struct mtm_pwb_mode_data_s
 {
 	mtm_word_t      start;
 	mtm_word_t      end;
+	int             read_only;   /**< Reads are validated against the start snapshot alone; no read set, no log markers */
+	int             snapshot;    /**< Read-only, and reads of newer data are served from the version store */
+	int             has_nvwrite; /**< Something was written to persistent memory, so the log must be committed */
+	int             has_snapshot; /**< start and end hold a snapshot; taken at the first shared access */
+	int             logical_op;  /**< Inside mtm_logical_begin/end: stores are redone by the logical record */
+	int             has_logical; /**< A logical record was logged, so the write-back is flushed at commit */
+#ifdef INCREMENTAL_VALIDATION
+	int             valid_quiescent; /**< The read set was last validated with no commit in flight... */
+	mtm_word_t      valid_begun;     /**< ...and this many commits begun */
+#endif /* INCREMENTAL_VALIDATION */
 
 	mtm_pwb_r_set_t r_set;
 	mtm_pwb_w_set_t w_set;
+	mtm_pwb_site_t  sites[RW_SET_SITES]; /**< Set sizes by transaction site */
+	int             sized_begins;        /**< Transactions begun since the sets were last shrunk */
+	int             r_peak;              /**< Largest read set since then */
+	int             w_peak;              /**< Largest write set since then */
 	
 	m_log_dsc_t     *ptmlog_dsc; /**< The persistent tm log descriptor */
 	M_TMLOG_T       *ptmlog;     /**< The persistent tm log; this is to avoid dereferencing ptmlog_dsc in the fast path */
+	mtm_pwb_cpu_log_t *cpu_log;  /**< The CPU log claimed by the running transaction (log_per_cpu), or NULL */
+
+	mtm_pwb_captured_t captured[PWB_MAX_CAPTURED]; /**< Blocks allocated by the transaction, stored to in place */
+	int                nb_captured;                /**< Number of captured blocks */
+
+#ifdef CLOSED_NESTING
+	mtm_pwb_w_undo_t    w_undo;                           /**< Old values of entries overwritten by nested transactions */
+	mtm_pwb_savepoint_t savepoints[PWB_MAX_SAVEPOINTS];   /**< Savepoints of the active nested transactions */
+	int                 nb_savepoints;                    /**< Number of active nested transactions with a savepoint */
+#endif /* CLOSED_NESTING */
 };
 
+/* Iterates over all write-set entries in the order they were inserted. */
+#define W_SET_FOR_EACH_ENTRY(w_set, c, i, w)                                   \
+	for ((c) = 0; (c) <= (w_set)->cur_chunk; (c)++)                            \
+		for ((i) = (w_set)->chunks[(c)].nb_entries,                            \
+		     (w) = (w_set)->chunks[(c)].entries;                               \
+		     (i) > 0; (i)--, (w)++)
+
+/* 
+ * Tells whether write-set entry w holds its lock for the write set, which
+ * then drops it through w. With encounter-time locking that is the last
+ * entry of the chain covered by the lock. With commit-time locking the 
+ * lock points to the entry that acquired it at commit, if any.
+ */
+#if DESIGN == WRITE_BACK_CTL
+# define PWB_ENTRY_HOLDS_LOCK(w)                                               \
+	(ATOMIC_LOAD((w)->lock) == LOCK_SET_ADDR((mtm_word_t) (w)))
+# define PWB_ENTRY_HELD_LOCK(w)  1
+#else /* DESIGN != WRITE_BACK_CTL */
+# define PWB_ENTRY_HOLDS_LOCK(w) ((w)->next == NULL)
+# define PWB_ENTRY_HELD_LOCK(w)  ((w)->next == NULL)
+#endif /* DESIGN != WRITE_BACK_CTL */
+
+/* 
+ * Wakes the transactions parked in cm_wait_lock on the locks just released.
+ * Costs a fence and a load when no thread is parked. Once released, the 
+ * entries of a lock acquired at commit can no longer be told apart, so 
+ * all of them wake their lock.
+ */
+#ifdef WAIT_YIELD
+# define PWB_WAKE_LOCK_WAITERS(w_set, c, i, w)                                 \
+	do {                                                                       \
+		if (m_spinwait_any_parked()) {                                         \
+			W_SET_FOR_EACH_ENTRY(w_set, c, i, w) {                             \
+				if (PWB_ENTRY_HELD_LOCK(w)) {                                  \
+					m_spinwait_wake_nofence((w)->lock);                        \
+				}                                                              \
+			}                                                                  \
+		}                                                                      \
+	} while (0)
+#else /* ! WAIT_YIELD */
+# define PWB_WAKE_LOCK_WAITERS(w_set, c, i, w)
+#endif /* ! WAIT_YIELD */
+
+/* 
+ * Stores the masked value to memory, and to the word's copy in the read 
+ * cache if it has one. The caller holds the word's lock.
+ */
+static inline
+void
+pwb_store_aligned_masked(mtm_tx_t *tx, volatile mtm_word_t *addr, mtm_word_t value, mtm_word_t mask)
+{
+	mtm_readcache_page_t *rcpage;
+	volatile mtm_word_t  *shadow;
+
+	if (unlikely(mtm_readcache_nregions > 0) &&
+	    (rcpage = mtm_readcache_write_begin(addr, &shadow)) != NULL)
+	{
+		PCM_WB_STORE_ALIGNED_MASKED(tx->pcm_storeset, addr, value, mask);
+		if (shadow) {
+			*shadow = (*shadow & ~mask) | (value & mask);
+		}
+		mtm_readcache_write_end(rcpage);
+	} else {
+		PCM_WB_STORE_ALIGNED_MASKED(tx->pcm_storeset, addr, value, mask);
+	}
+}
+
 #endif /* _PWB_COMMON_INTERNAL_IOK811_H */
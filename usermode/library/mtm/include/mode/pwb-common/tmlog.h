@@ -35,5 +35,7 @@
 
 #include "tmlog_base.h"
 #include "tmlog_tornbit.h"
+#include "tmlog_checksum.h"
+#include "tmlog_undo.h"
 
 #endif
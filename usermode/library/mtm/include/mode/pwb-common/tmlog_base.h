@@ -34,13 +34,36 @@
 #define _TMLOG_BASE_H
 
 #include <sys/mman.h>
+#include <string.h>
 #include <mnemosyne.h>
 #include <log.h>
 #include <debug.h>
 #include "mtm_i.h"
+#include "flushset.h"
 
 #define XACT_COMMIT_MARKER 0x0010000000000000
 #define XACT_ABORT_MARKER  0x0100000000000000
+#define XACT_LOGICAL_MARKER 0x0001000000000000
+#define XACT_RANGE_MARKER  0x1000000000000000
+/* 
+ * Set in the address word of a record of a full word, which then carries no
+ * mask: (addr | XACT_FULL_MASK_BIT, value) instead of (addr, value, mask). 
+ * Addresses are word aligned and the markers have the bit clear.
+ */
+#define XACT_FULL_MASK_BIT 0x1
+/* 
+ * Set in the address word of a line record: full words of one 64-byte line,
+ * as (line | bitmap << 48 | XACT_LINE_BIT) followed by the words present in
+ * the bitmap, in address order. User addresses leave bits 48-55 clear.
+ */
+#define XACT_LINE_BIT          0x2
+#define XACT_LINE_SIZE         64
+#define XACT_LINE_BITMAP_SHIFT 48
+#define XACT_LINE_ADDR(a)      ((a) & 0x0000FFFFFFFFFFC0ULL)
+#define XACT_LINE_BITMAP(a)    (((a) >> XACT_LINE_BITMAP_SHIFT) & 0xFF)
+
+/* Largest argument block of a logical record, in bytes */
+#define XACT_LOGICAL_ARGS_MAX  1024
 
 enum {
 	LF_TYPE_TM_BASE = 2
@@ -50,13 +73,13 @@ extern m_log_ops_t tmlog_base_ops;
 
 typedef struct m_tmlog_base_s m_tmlog_base_t;
 
-typedef void set_t;
 
-
-/* Must ensure that phlog_base is word aligned. */
+/* Must ensure that phlog_base is cacheline aligned (see m_phlog_*_s). */
 struct m_tmlog_base_s {
 	m_phlog_base_t   phlog_base;
-	set_t            *flush_set;
+	m_flushset_t     *flush_set;
+	uint64_t         begin_tail;          /**< phlog tail when the transaction began */
+	uint64_t         begin_buffer_count;  /**< phlog buffered words when the transaction began */
 };
 
 
@@ -71,13 +94,136 @@ m_tmlog_base_write(pcm_storeset_t *set,
 	m_phlog_base_t *phlog_base = &(tmlog->phlog_base);
 
 # ifdef	SYNC_TRUNCATION
+	if (mask == ~((pcm_word_t) 0)) {
+		PHLOG_WRITE(base, set, phlog_base, (pcm_word_t) addr | XACT_FULL_MASK_BIT);
+		PHLOG_WRITE(base, set, phlog_base, (pcm_word_t) val);
+	} else {
+		PHLOG_WRITE(base, set, phlog_base, (pcm_word_t) addr);
+		PHLOG_WRITE(base, set, phlog_base, (pcm_word_t) val);
+		PHLOG_WRITE(base, set, phlog_base, (pcm_word_t) mask);
+	}
+# else
+	if (mask == ~((pcm_word_t) 0)) {
+		PHLOG_WRITE_ASYNCTRUNC(base, set, phlog_base, (pcm_word_t) addr | XACT_FULL_MASK_BIT);
+		PHLOG_WRITE_ASYNCTRUNC(base, set, phlog_base, (pcm_word_t) val);
+	} else {
+		PHLOG_WRITE_ASYNCTRUNC(base, set, phlog_base, (pcm_word_t) addr);
+		PHLOG_WRITE_ASYNCTRUNC(base, set, phlog_base, (pcm_word_t) val);
+		PHLOG_WRITE_ASYNCTRUNC(base, set, phlog_base, (pcm_word_t) mask);
+	}
+# endif
+	return M_R_SUCCESS;
+}
+
+
+/*
+ * Logs nwords consecutive full words starting at addr as a single range 
+ * record: XACT_RANGE_MARKER, addr, nwords, followed by the words. This costs
+ * nwords + 3 log words instead of 2 * nwords, so fewer than four words are 
+ * logged one by one.
+ */
+static inline
+m_result_t
+m_tmlog_base_write_range(pcm_storeset_t *set, 
+                         m_tmlog_base_t *tmlog, 
+                         uintptr_t addr, 
+                         const void *buf, 
+                         size_t nwords)
+{
+	m_phlog_base_t *phlog_base = &(tmlog->phlog_base);
+	const uint8_t  *src = (const uint8_t *) buf;
+	pcm_word_t     val;
+	size_t         i;
+
+	if (nwords < 4) {
+		for (i = 0; i < nwords; i++) {
+			memcpy(&val, src + i * sizeof(pcm_word_t), sizeof(pcm_word_t));
+			m_tmlog_base_write(set, tmlog, addr + i * sizeof(pcm_word_t), val, ~((pcm_word_t) 0));
+		}
+		return M_R_SUCCESS;
+	}
+# ifdef	SYNC_TRUNCATION
+	PHLOG_WRITE(base, set, phlog_base, (pcm_word_t) XACT_RANGE_MARKER);
 	PHLOG_WRITE(base, set, phlog_base, (pcm_word_t) addr);
-	PHLOG_WRITE(base, set, phlog_base, (pcm_word_t) val);
-	PHLOG_WRITE(base, set, phlog_base, (pcm_word_t) mask);
+	PHLOG_WRITE(base, set, phlog_base, (pcm_word_t) nwords);
+	for (i = 0; i < nwords; i++) {
+		memcpy(&val, src + i * sizeof(pcm_word_t), sizeof(pcm_word_t));
+		PHLOG_WRITE(base, set, phlog_base, val);
+	}
 # else
+	PHLOG_WRITE_ASYNCTRUNC(base, set, phlog_base, (pcm_word_t) XACT_RANGE_MARKER);
 	PHLOG_WRITE_ASYNCTRUNC(base, set, phlog_base, (pcm_word_t) addr);
-	PHLOG_WRITE_ASYNCTRUNC(base, set, phlog_base, (pcm_word_t) val);
-	PHLOG_WRITE_ASYNCTRUNC(base, set, phlog_base, (pcm_word_t) mask);
+	PHLOG_WRITE_ASYNCTRUNC(base, set, phlog_base, (pcm_word_t) nwords);
+	for (i = 0; i < nwords; i++) {
+		memcpy(&val, src + i * sizeof(pcm_word_t), sizeof(pcm_word_t));
+		PHLOG_WRITE_ASYNCTRUNC(base, set, phlog_base, val);
+	}
+# endif
+	return M_R_SUCCESS;
+}
+
+
+/*
+ * Logs the full words of the 64-byte line at line whose indexes are set in
+ * bitmap as a single line record: nwords + 1 log words instead of 
+ * 2 * nwords. vals holds the words in address order.
+ */
+static inline
+m_result_t
+m_tmlog_base_write_line(pcm_storeset_t *set, m_tmlog_base_t *tmlog, uintptr_t line, unsigned int bitmap, const pcm_word_t *vals)
+{
+	m_phlog_base_t *phlog_base = &(tmlog->phlog_base);
+	pcm_word_t       head = (pcm_word_t) line | ((pcm_word_t) bitmap << XACT_LINE_BITMAP_SHIFT) | XACT_LINE_BIT;
+	int              nwords = __builtin_popcount(bitmap);
+	int              i;
+
+# ifdef	SYNC_TRUNCATION
+	PHLOG_WRITE(base, set, phlog_base, head);
+	for (i = 0; i < nwords; i++) {
+		PHLOG_WRITE(base, set, phlog_base, vals[i]);
+	}
+# else
+	PHLOG_WRITE_ASYNCTRUNC(base, set, phlog_base, head);
+	for (i = 0; i < nwords; i++) {
+		PHLOG_WRITE_ASYNCTRUNC(base, set, phlog_base, vals[i]);
+	}
+# endif
+	return M_R_SUCCESS;
+}
+
+
+/*
+ * Logs a logical record: XACT_LOGICAL_MARKER, opcode, size, followed by the
+ * size bytes of args padded to whole words. Recovery passes the arguments 
+ * to the replay routine registered for opcode.
+ */
+static inline
+m_result_t
+m_tmlog_base_write_logical(pcm_storeset_t *set, m_tmlog_base_t *tmlog, unsigned int opcode, const void *args, size_t size)
+{
+	m_phlog_base_t *phlog_base = &(tmlog->phlog_base);
+	const uint8_t    *src = (const uint8_t *) args;
+	pcm_word_t       val;
+	size_t           i;
+
+# ifdef	SYNC_TRUNCATION
+	PHLOG_WRITE(base, set, phlog_base, (pcm_word_t) XACT_LOGICAL_MARKER);
+	PHLOG_WRITE(base, set, phlog_base, (pcm_word_t) opcode);
+	PHLOG_WRITE(base, set, phlog_base, (pcm_word_t) size);
+	for (i = 0; i < size; i += sizeof(pcm_word_t)) {
+		val = 0;
+		memcpy(&val, src + i, size - i < sizeof(pcm_word_t) ? size - i : sizeof(pcm_word_t));
+		PHLOG_WRITE(base, set, phlog_base, val);
+	}
+# else
+	PHLOG_WRITE_ASYNCTRUNC(base, set, phlog_base, (pcm_word_t) XACT_LOGICAL_MARKER);
+	PHLOG_WRITE_ASYNCTRUNC(base, set, phlog_base, (pcm_word_t) opcode);
+	PHLOG_WRITE_ASYNCTRUNC(base, set, phlog_base, (pcm_word_t) size);
+	for (i = 0; i < size; i += sizeof(pcm_word_t)) {
+		val = 0;
+		memcpy(&val, src + i, size - i < sizeof(pcm_word_t) ? size - i : sizeof(pcm_word_t));
+		PHLOG_WRITE_ASYNCTRUNC(base, set, phlog_base, val);
+	}
 # endif
 	return M_R_SUCCESS;
 }
@@ -87,6 +233,13 @@ static inline
 m_result_t
 m_tmlog_base_begin(m_tmlog_base_t *tmlog)
 {
+	tmlog->begin_tail = tmlog->phlog_base.tail;
+	tmlog->begin_buffer_count = tmlog->phlog_base.buffer_count;
+
+# ifndef SYNC_TRUNCATION
+	PHLOG_BACKPRESSURE(&(tmlog->phlog_base));
+# endif
+
 	return M_R_SUCCESS;
 }
 
@@ -116,6 +269,15 @@ m_tmlog_base_abort(pcm_storeset_t *set, m_tmlog_base_t *tmlog, uint64_t sqn)
 {
 	m_phlog_base_t *phlog_base = &(tmlog->phlog_base);
 
+	/* 
+	 * If no chunk has been written out since the transaction began then its
+	 * records are all still in the volatile buffer: drop them instead of 
+	 * logging an abort marker.
+	 */
+	if (phlog_base->tail == tmlog->begin_tail) {
+		phlog_base->buffer_count = tmlog->begin_buffer_count;
+		return M_R_SUCCESS;
+	}
 # ifdef	SYNC_TRUNCATION
 	PHLOG_WRITE(base, set, phlog_base, (pcm_word_t) XACT_ABORT_MARKER);
 	PHLOG_WRITE(base, set, phlog_base, (pcm_word_t) sqn);
@@ -139,11 +301,34 @@ m_tmlog_base_truncate_sync(pcm_storeset_t *set, m_tmlog_base_t *tmlog)
 }
 
 
+/* Bytes of log written out since the transaction began, padding included */
+static inline
+uint64_t
+m_tmlog_base_written_bytes(m_tmlog_base_t *tmlog)
+{
+	m_phlog_base_t *phlog_base = &(tmlog->phlog_base);
+
+	return ((phlog_base->tail - tmlog->begin_tail) & phlog_base->mask) * sizeof(pcm_word_t);
+}
+
+
+/* Bytes of log a truncation to the tail would drop */
+static inline
+uint64_t
+m_tmlog_base_untruncated_bytes(m_tmlog_base_t *tmlog)
+{
+	m_phlog_base_t *phlog_base = &(tmlog->phlog_base);
+
+	return ((phlog_base->tail - phlog_base->head) & phlog_base->mask) * sizeof(pcm_word_t);
+}
+
+
 m_result_t m_tmlog_base_alloc (m_log_dsc_t *log_dsc);
 m_result_t m_tmlog_base_init (pcm_storeset_t *set, m_log_t *log, m_log_dsc_t *log_dsc);
 m_result_t m_tmlog_base_truncation_init(pcm_storeset_t *set, m_log_dsc_t *log_dsc);
 m_result_t m_tmlog_base_truncation_prepare_next(pcm_storeset_t *set, m_log_dsc_t *log_dsc);
 m_result_t m_tmlog_base_truncation_do(pcm_storeset_t *set, m_log_dsc_t *log_dsc);
+m_result_t m_tmlog_base_truncation_publish(pcm_storeset_t *set, m_log_dsc_t *log_dsc);
 m_result_t m_tmlog_base_recovery_init(pcm_storeset_t *set, m_log_dsc_t *log_dsc);
 m_result_t m_tmlog_base_recovery_prepare_next(pcm_storeset_t *set, m_log_dsc_t *log_dsc);
 m_result_t m_tmlog_base_recovery_do(pcm_storeset_t *set, m_log_dsc_t *log_dsc);
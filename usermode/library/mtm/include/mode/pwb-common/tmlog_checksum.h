@@ -0,0 +1,337 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+#ifndef _TMLOG_CHECKSUM_H
+#define _TMLOG_CHECKSUM_H
+
+#include <sys/mman.h>
+#include <string.h>
+#include <mnemosyne.h>
+#include <log.h>
+#include <debug.h>
+#include "mtm_i.h"
+#include "flushset.h"
+
+#define XACT_COMMIT_MARKER 0x0010000000000000
+#define XACT_ABORT_MARKER  0x0100000000000000
+#define XACT_LOGICAL_MARKER 0x0001000000000000
+#define XACT_RANGE_MARKER  0x1000000000000000
+/* 
+ * Set in the address word of a record of a full word, which then carries no
+ * mask: (addr | XACT_FULL_MASK_BIT, value) instead of (addr, value, mask). 
+ * Addresses are word aligned and the markers have the bit clear.
+ */
+#define XACT_FULL_MASK_BIT 0x1
+/* 
+ * Set in the address word of a line record: full words of one 64-byte line,
+ * as (line | bitmap << 48 | XACT_LINE_BIT) followed by the words present in
+ * the bitmap, in address order. User addresses leave bits 48-55 clear.
+ */
+#define XACT_LINE_BIT          0x2
+#define XACT_LINE_SIZE         64
+#define XACT_LINE_BITMAP_SHIFT 48
+#define XACT_LINE_ADDR(a)      ((a) & 0x0000FFFFFFFFFFC0ULL)
+#define XACT_LINE_BITMAP(a)    (((a) >> XACT_LINE_BITMAP_SHIFT) & 0xFF)
+
+/* Largest argument block of a logical record, in bytes */
+#define XACT_LOGICAL_ARGS_MAX  1024
+
+enum {
+	LF_TYPE_TM_CHECKSUM = 4
+};
+
+extern m_log_ops_t tmlog_checksum_ops;
+
+typedef struct m_tmlog_checksum_s m_tmlog_checksum_t;
+
+
+/* Must ensure that phlog_checksum is cacheline aligned (see m_phlog_*_s). */
+struct m_tmlog_checksum_s {
+	m_phlog_checksum_t   phlog_checksum;
+	m_flushset_t         *flush_set;
+	uint64_t             begin_tail;                  /**< phlog tail when the transaction began */
+	uint64_t             begin_buffer_count;          /**< phlog buffered words when the transaction began */
+	uint64_t             begin_crc;                   /**< phlog fragment CRC when the transaction began */
+};
+
+static inline
+m_result_t
+m_tmlog_checksum_write(pcm_storeset_t *set, m_tmlog_checksum_t *tmlog, uintptr_t addr, pcm_word_t val, pcm_word_t mask)
+{
+	m_phlog_checksum_t *phlog_checksum = &(tmlog->phlog_checksum);
+
+# ifdef	SYNC_TRUNCATION
+	if (mask == ~((pcm_word_t) 0)) {
+		PHLOG_WRITE(checksum, set, phlog_checksum, (pcm_word_t) addr | XACT_FULL_MASK_BIT);
+		PHLOG_WRITE(checksum, set, phlog_checksum, (pcm_word_t) val);
+	} else {
+		PHLOG_WRITE(checksum, set, phlog_checksum, (pcm_word_t) addr);
+		PHLOG_WRITE(checksum, set, phlog_checksum, (pcm_word_t) val);
+		PHLOG_WRITE(checksum, set, phlog_checksum, (pcm_word_t) mask);
+	}
+# else
+	if (mask == ~((pcm_word_t) 0)) {
+		PHLOG_WRITE_ASYNCTRUNC(checksum, set, phlog_checksum, (pcm_word_t) addr | XACT_FULL_MASK_BIT);
+		PHLOG_WRITE_ASYNCTRUNC(checksum, set, phlog_checksum, (pcm_word_t) val);
+	} else {
+		PHLOG_WRITE_ASYNCTRUNC(checksum, set, phlog_checksum, (pcm_word_t) addr);
+		PHLOG_WRITE_ASYNCTRUNC(checksum, set, phlog_checksum, (pcm_word_t) val);
+		PHLOG_WRITE_ASYNCTRUNC(checksum, set, phlog_checksum, (pcm_word_t) mask);
+	}
+# endif
+
+	return M_R_SUCCESS;
+}
+
+
+/*
+ * Logs nwords consecutive full words starting at addr as a single range 
+ * record: XACT_RANGE_MARKER, addr, nwords, followed by the words. This costs
+ * nwords + 3 log words instead of 2 * nwords, so fewer than four words are 
+ * logged one by one.
+ */
+static inline
+m_result_t
+m_tmlog_checksum_write_range(pcm_storeset_t *set, m_tmlog_checksum_t *tmlog, uintptr_t addr, const void *buf, size_t nwords)
+{
+	m_phlog_checksum_t *phlog_checksum = &(tmlog->phlog_checksum);
+	const uint8_t     *src = (const uint8_t *) buf;
+	pcm_word_t        val;
+	size_t            i;
+
+	if (nwords < 4) {
+		for (i = 0; i < nwords; i++) {
+			memcpy(&val, src + i * sizeof(pcm_word_t), sizeof(pcm_word_t));
+			m_tmlog_checksum_write(set, tmlog, addr + i * sizeof(pcm_word_t), val, ~((pcm_word_t) 0));
+		}
+		return M_R_SUCCESS;
+	}
+# ifdef	SYNC_TRUNCATION
+	PHLOG_WRITE(checksum, set, phlog_checksum, (pcm_word_t) XACT_RANGE_MARKER);
+	PHLOG_WRITE(checksum, set, phlog_checksum, (pcm_word_t) addr);
+	PHLOG_WRITE(checksum, set, phlog_checksum, (pcm_word_t) nwords);
+	for (i = 0; i < nwords; i++) {
+		memcpy(&val, src + i * sizeof(pcm_word_t), sizeof(pcm_word_t));
+		PHLOG_WRITE(checksum, set, phlog_checksum, val);
+	}
+# else
+	PHLOG_WRITE_ASYNCTRUNC(checksum, set, phlog_checksum, (pcm_word_t) XACT_RANGE_MARKER);
+	PHLOG_WRITE_ASYNCTRUNC(checksum, set, phlog_checksum, (pcm_word_t) addr);
+	PHLOG_WRITE_ASYNCTRUNC(checksum, set, phlog_checksum, (pcm_word_t) nwords);
+	for (i = 0; i < nwords; i++) {
+		memcpy(&val, src + i * sizeof(pcm_word_t), sizeof(pcm_word_t));
+		PHLOG_WRITE_ASYNCTRUNC(checksum, set, phlog_checksum, val);
+	}
+# endif
+	return M_R_SUCCESS;
+}
+
+
+/*
+ * Logs the full words of the 64-byte line at line whose indexes are set in
+ * bitmap as a single line record: nwords + 1 log words instead of 
+ * 2 * nwords. vals holds the words in address order.
+ */
+static inline
+m_result_t
+m_tmlog_checksum_write_line(pcm_storeset_t *set, m_tmlog_checksum_t *tmlog, uintptr_t line, unsigned int bitmap, const pcm_word_t *vals)
+{
+	m_phlog_checksum_t *phlog_checksum = &(tmlog->phlog_checksum);
+	pcm_word_t       head = (pcm_word_t) line | ((pcm_word_t) bitmap << XACT_LINE_BITMAP_SHIFT) | XACT_LINE_BIT;
+	int              nwords = __builtin_popcount(bitmap);
+	int              i;
+
+# ifdef	SYNC_TRUNCATION
+	PHLOG_WRITE(checksum, set, phlog_checksum, head);
+	for (i = 0; i < nwords; i++) {
+		PHLOG_WRITE(checksum, set, phlog_checksum, vals[i]);
+	}
+# else
+	PHLOG_WRITE_ASYNCTRUNC(checksum, set, phlog_checksum, head);
+	for (i = 0; i < nwords; i++) {
+		PHLOG_WRITE_ASYNCTRUNC(checksum, set, phlog_checksum, vals[i]);
+	}
+# endif
+	return M_R_SUCCESS;
+}
+
+
+/*
+ * Logs a logical record: XACT_LOGICAL_MARKER, opcode, size, followed by the
+ * size bytes of args padded to whole words. Recovery passes the arguments 
+ * to the replay routine registered for opcode.
+ */
+static inline
+m_result_t
+m_tmlog_checksum_write_logical(pcm_storeset_t *set, m_tmlog_checksum_t *tmlog, unsigned int opcode, const void *args, size_t size)
+{
+	m_phlog_checksum_t *phlog_checksum = &(tmlog->phlog_checksum);
+	const uint8_t    *src = (const uint8_t *) args;
+	pcm_word_t       val;
+	size_t           i;
+
+# ifdef	SYNC_TRUNCATION
+	PHLOG_WRITE(checksum, set, phlog_checksum, (pcm_word_t) XACT_LOGICAL_MARKER);
+	PHLOG_WRITE(checksum, set, phlog_checksum, (pcm_word_t) opcode);
+	PHLOG_WRITE(checksum, set, phlog_checksum, (pcm_word_t) size);
+	for (i = 0; i < size; i += sizeof(pcm_word_t)) {
+		val = 0;
+		memcpy(&val, src + i, size - i < sizeof(pcm_word_t) ? size - i : sizeof(pcm_word_t));
+		PHLOG_WRITE(checksum, set, phlog_checksum, val);
+	}
+# else
+	PHLOG_WRITE_ASYNCTRUNC(checksum, set, phlog_checksum, (pcm_word_t) XACT_LOGICAL_MARKER);
+	PHLOG_WRITE_ASYNCTRUNC(checksum, set, phlog_checksum, (pcm_word_t) opcode);
+	PHLOG_WRITE_ASYNCTRUNC(checksum, set, phlog_checksum, (pcm_word_t) size);
+	for (i = 0; i < size; i += sizeof(pcm_word_t)) {
+		val = 0;
+		memcpy(&val, src + i, size - i < sizeof(pcm_word_t) ? size - i : sizeof(pcm_word_t));
+		PHLOG_WRITE_ASYNCTRUNC(checksum, set, phlog_checksum, val);
+	}
+# endif
+	return M_R_SUCCESS;
+}
+
+
+static inline
+m_result_t
+m_tmlog_checksum_begin(m_tmlog_checksum_t *tmlog)
+{
+	m_phlog_checksum_t *phlog_checksum = &(tmlog->phlog_checksum);
+
+	tmlog->begin_tail = phlog_checksum->tail;
+	tmlog->begin_buffer_count = phlog_checksum->buffer_count;
+	tmlog->begin_crc = phlog_checksum->crc;
+
+# ifndef SYNC_TRUNCATION
+	PHLOG_BACKPRESSURE(phlog_checksum);
+# endif
+
+	return M_R_SUCCESS;
+}
+
+
+static inline
+m_result_t
+m_tmlog_checksum_commit(pcm_storeset_t *set, m_tmlog_checksum_t *tmlog, uint64_t sqn)
+{
+	m_phlog_checksum_t *phlog_checksum = &(tmlog->phlog_checksum);
+
+# ifdef	SYNC_TRUNCATION
+	PHLOG_WRITE(checksum, set, phlog_checksum, (pcm_word_t) XACT_COMMIT_MARKER);
+	PHLOG_WRITE(checksum, set, phlog_checksum, (pcm_word_t) sqn);
+	PHLOG_FLUSH(checksum, set, phlog_checksum);
+# else
+	PHLOG_WRITE_ASYNCTRUNC(checksum, set, phlog_checksum, (pcm_word_t) XACT_COMMIT_MARKER);
+	PHLOG_WRITE_ASYNCTRUNC(checksum, set, phlog_checksum, (pcm_word_t) sqn);
+	PHLOG_FLUSH_ASYNCTRUNC(checksum, set, phlog_checksum);
+# endif
+	return M_R_SUCCESS;
+}
+
+
+static inline
+m_result_t
+m_tmlog_checksum_abort(pcm_storeset_t *set, m_tmlog_checksum_t *tmlog, uint64_t sqn)
+{
+	m_phlog_checksum_t *phlog_checksum = &(tmlog->phlog_checksum);
+
+	/* 
+	 * If no chunk has been written out since the transaction began then its
+	 * records are all still in the volatile buffer: drop them instead of 
+	 * logging an abort marker.
+	 */
+	if (phlog_checksum->tail == tmlog->begin_tail) {
+		phlog_checksum->buffer_count = tmlog->begin_buffer_count;
+		phlog_checksum->crc = tmlog->begin_crc;
+		return M_R_SUCCESS;
+	}
+# ifdef	SYNC_TRUNCATION
+	PHLOG_WRITE(checksum, set, phlog_checksum, (pcm_word_t) XACT_ABORT_MARKER);
+	PHLOG_WRITE(checksum, set, phlog_checksum, (pcm_word_t) sqn);
+	PHLOG_FLUSH(checksum, set, phlog_checksum);
+# else
+	PHLOG_WRITE_ASYNCTRUNC(checksum, set, phlog_checksum, (pcm_word_t) XACT_ABORT_MARKER);
+	PHLOG_WRITE_ASYNCTRUNC(checksum, set, phlog_checksum, (pcm_word_t) sqn);
+	PHLOG_FLUSH_ASYNCTRUNC(checksum, set, phlog_checksum);
+# endif
+
+	return M_R_SUCCESS;
+}
+
+
+static inline
+m_result_t
+m_tmlog_checksum_truncate_sync(pcm_storeset_t *set, m_tmlog_checksum_t *tmlog)
+{
+	m_phlog_checksum_truncate_sync(set, &tmlog->phlog_checksum);
+
+	return M_R_SUCCESS;
+}
+
+
+/* Bytes of log written out since the transaction began, padding included */
+static inline
+uint64_t
+m_tmlog_checksum_written_bytes(m_tmlog_checksum_t *tmlog)
+{
+	m_phlog_checksum_t *phlog_checksum = &(tmlog->phlog_checksum);
+
+	return ((phlog_checksum->tail - tmlog->begin_tail) & phlog_checksum->mask) * sizeof(pcm_word_t);
+}
+
+
+/* Bytes of log a truncation to the tail would drop */
+static inline
+uint64_t
+m_tmlog_checksum_untruncated_bytes(m_tmlog_checksum_t *tmlog)
+{
+	m_phlog_checksum_t *phlog_checksum = &(tmlog->phlog_checksum);
+
+	return ((phlog_checksum->tail - phlog_checksum->head) & phlog_checksum->mask) * sizeof(pcm_word_t);
+}
+
+
+
+m_result_t m_tmlog_checksum_alloc (m_log_dsc_t *log_dsc);
+m_result_t m_tmlog_checksum_init (pcm_storeset_t *set, m_log_t *log, m_log_dsc_t *log_dsc);
+m_result_t m_tmlog_checksum_truncation_init(pcm_storeset_t *set, m_log_dsc_t *log_dsc);
+m_result_t m_tmlog_checksum_truncation_prepare_next(pcm_storeset_t *set, m_log_dsc_t *log_dsc);
+m_result_t m_tmlog_checksum_truncation_do(pcm_storeset_t *set, m_log_dsc_t *log_dsc);
+m_result_t m_tmlog_checksum_truncation_publish(pcm_storeset_t *set, m_log_dsc_t *log_dsc);
+m_result_t m_tmlog_checksum_recovery_init(pcm_storeset_t *set, m_log_dsc_t *log_dsc);
+m_result_t m_tmlog_checksum_recovery_prepare_next(pcm_storeset_t *set, m_log_dsc_t *log_dsc);
+m_result_t m_tmlog_checksum_recovery_do(pcm_storeset_t *set, m_log_dsc_t *log_dsc);
+m_result_t m_tmlog_checksum_report_stats(m_log_dsc_t *log_dsc);
+
+
+#endif /* _TMLOG_CHECKSUM_H */
@@ -34,13 +34,46 @@
 #define _TMLOG_TORNBIT_H
 
 #include <sys/mman.h>
+#include <string.h>
 #include <mnemosyne.h>
 #include <log.h>
 #include <debug.h>
 #include "mtm_i.h"
+#include "flushset.h"
 
 #define XACT_COMMIT_MARKER 0x0010000000000000
 #define XACT_ABORT_MARKER  0x0100000000000000
+#define XACT_LOGICAL_MARKER 0x0001000000000000
+#define XACT_RANGE_MARKER  0x1000000000000000
+/* 
+ * Inline commit record: the commit marker and the sequence number share one
+ * word, XACT_COMMIT_INLINE_BIT | sqn. With it, the records and the commit 
+ * of a transaction writing up to three full words (or two partial ones) 
+ * fit in a single chunk, written out with one streaming store and made 
+ * durable with one fence, so that the chunk commits itself. Addresses and 
+ * the other markers leave the bit clear; a sequence number that does not 
+ * fit below it is logged as XACT_COMMIT_MARKER followed by the number.
+ */
+#define XACT_COMMIT_INLINE_BIT 0x2000000000000000
+/* 
+ * Set in the address word of a record of a full word, which then carries no
+ * mask: (addr | XACT_FULL_MASK_BIT, value) instead of (addr, value, mask). 
+ * Addresses are word aligned and the markers have the bit clear.
+ */
+#define XACT_FULL_MASK_BIT 0x1
+/* 
+ * Set in the address word of a line record: full words of one 64-byte line,
+ * as (line | bitmap << 48 | XACT_LINE_BIT) followed by the words present in
+ * the bitmap, in address order. User addresses leave bits 48-55 clear.
+ */
+#define XACT_LINE_BIT          0x2
+#define XACT_LINE_SIZE         64
+#define XACT_LINE_BITMAP_SHIFT 48
+#define XACT_LINE_ADDR(a)      ((a) & 0x0000FFFFFFFFFFC0ULL)
+#define XACT_LINE_BITMAP(a)    (((a) >> XACT_LINE_BITMAP_SHIFT) & 0xFF)
+
+/* Largest argument block of a logical record, in bytes */
+#define XACT_LOGICAL_ARGS_MAX  1024
 
 enum {
 	LF_TYPE_TM_TORNBIT = 3
@@ -50,30 +83,173 @@ extern m_log_ops_t tmlog_tornbit_ops;
 
 typedef struct m_tmlog_tornbit_s m_tmlog_tornbit_t;
 
-typedef void tornbit_flush_set_t;
 
-/* Must ensure that phlog_tornbit is word aligned. */
+/* Must ensure that phlog_tornbit is cacheline aligned (see m_phlog_*_s). */
 struct m_tmlog_tornbit_s {
 	m_phlog_tornbit_t   phlog_tornbit;
-	tornbit_flush_set_t *flush_set;
+	m_flushset_t        *flush_set;
+	uint64_t            begin_tail;                  /**< phlog tail when the transaction began */
+	uint64_t            begin_buffer_count;          /**< phlog buffered words when the transaction began */
+	m_logship_stream_t  remote;                      /**< records of the transaction for a log_ship_sync standby */
 };
 
+/*
+ * Reserves room in the log for records of nwords log words in total, 
+ * checking for room (and waiting for the log truncation) once. The records
+ * are then appended with the m_tmlog_tornbit_append routines, which do not
+ * check; the write routines reserve room for their own record.
+ */
 static inline
-m_result_t
-m_tmlog_tornbit_write(pcm_storeset_t *set, m_tmlog_tornbit_t *tmlog, uintptr_t addr, pcm_word_t val, pcm_word_t mask)
+void
+m_tmlog_tornbit_reserve(pcm_storeset_t *set, m_tmlog_tornbit_t *tmlog, uint64_t nwords)
 {
 	m_phlog_tornbit_t *phlog_tornbit = &(tmlog->phlog_tornbit);
 
 # ifdef	SYNC_TRUNCATION
-	PHLOG_WRITE(tornbit, set, phlog_tornbit, (pcm_word_t) addr);
-	PHLOG_WRITE(tornbit, set, phlog_tornbit, (pcm_word_t) val);
-	PHLOG_WRITE(tornbit, set, phlog_tornbit, (pcm_word_t) mask);
+	PHLOG_RESERVE(tornbit, set, phlog_tornbit, nwords);
 # else
-	PHLOG_WRITE_ASYNCTRUNC(tornbit, set, phlog_tornbit, (pcm_word_t) addr);
-	PHLOG_WRITE_ASYNCTRUNC(tornbit, set, phlog_tornbit, (pcm_word_t) val);
-	PHLOG_WRITE_ASYNCTRUNC(tornbit, set, phlog_tornbit, (pcm_word_t) mask);
+	PHLOG_RESERVE_ASYNCTRUNC(tornbit, set, phlog_tornbit, nwords);
 # endif
+}
+
+
+static inline
+void
+m_tmlog_tornbit_append(pcm_storeset_t *set, m_tmlog_tornbit_t *tmlog, uintptr_t addr, pcm_word_t val, pcm_word_t mask)
+{
+	m_phlog_tornbit_t *phlog_tornbit = &(tmlog->phlog_tornbit);
+
+	if (mask == ~((pcm_word_t) 0)) {
+		m_phlog_tornbit_append(set, phlog_tornbit, (pcm_word_t) addr | XACT_FULL_MASK_BIT);
+		m_phlog_tornbit_append(set, phlog_tornbit, (pcm_word_t) val);
+	} else {
+		m_phlog_tornbit_append(set, phlog_tornbit, (pcm_word_t) addr);
+		m_phlog_tornbit_append(set, phlog_tornbit, (pcm_word_t) val);
+		m_phlog_tornbit_append(set, phlog_tornbit, (pcm_word_t) mask);
+	}
+	m_logship_sync_store(&tmlog->remote, addr, val, mask);
+}
+
+
+static inline
+m_result_t
+m_tmlog_tornbit_write(pcm_storeset_t *set, m_tmlog_tornbit_t *tmlog, uintptr_t addr, pcm_word_t val, pcm_word_t mask)
+{
+	m_tmlog_tornbit_reserve(set, tmlog, mask == ~((pcm_word_t) 0) ? 2 : 3);
+	m_tmlog_tornbit_append(set, tmlog, addr, val, mask);
+
+	return M_R_SUCCESS;
+}
+
+
+/*
+ * Logs nwords consecutive full words starting at addr as a single range 
+ * record: XACT_RANGE_MARKER, addr, nwords, followed by the words. This costs
+ * nwords + 3 log words instead of 2 * nwords, so fewer than four words are 
+ * logged one by one.
+ */
+static inline
+m_result_t
+m_tmlog_tornbit_write_range(pcm_storeset_t *set, m_tmlog_tornbit_t *tmlog, uintptr_t addr, const void *buf, size_t nwords)
+{
+	m_phlog_tornbit_t *phlog_tornbit = &(tmlog->phlog_tornbit);
+	const uint8_t     *src = (const uint8_t *) buf;
+	pcm_word_t        val;
+	size_t            i;
+
+	if (nwords < 4) {
+		for (i = 0; i < nwords; i++) {
+			memcpy(&val, src + i * sizeof(pcm_word_t), sizeof(pcm_word_t));
+			m_tmlog_tornbit_write(set, tmlog, addr + i * sizeof(pcm_word_t), val, ~((pcm_word_t) 0));
+		}
+		return M_R_SUCCESS;
+	}
+	m_tmlog_tornbit_reserve(set, tmlog, nwords + 3);
+	m_phlog_tornbit_append(set, phlog_tornbit, (pcm_word_t) XACT_RANGE_MARKER);
+	m_phlog_tornbit_append(set, phlog_tornbit, (pcm_word_t) addr);
+	m_phlog_tornbit_append(set, phlog_tornbit, (pcm_word_t) nwords);
+	for (i = 0; i < nwords; i++) {
+		memcpy(&val, src + i * sizeof(pcm_word_t), sizeof(pcm_word_t));
+		m_phlog_tornbit_append(set, phlog_tornbit, val);
+	}
+	if (m_logship_sync_enabled) {
+		for (i = 0; i < nwords; i++) {
+			memcpy(&val, src + i * sizeof(pcm_word_t), sizeof(pcm_word_t));
+			m_logship_sync_store(&tmlog->remote, addr + i * sizeof(pcm_word_t), val, ~((pcm_word_t) 0));
+		}
+	}
+	return M_R_SUCCESS;
+}
+
+
+/*
+ * Logs the full words of the 64-byte line at line whose indexes are set in
+ * bitmap as a single line record: nwords + 1 log words instead of 
+ * 2 * nwords. vals holds the words in address order.
+ */
+static inline
+void
+m_tmlog_tornbit_append_line(pcm_storeset_t *set, m_tmlog_tornbit_t *tmlog, uintptr_t line, unsigned int bitmap, const pcm_word_t *vals)
+{
+	m_phlog_tornbit_t *phlog_tornbit = &(tmlog->phlog_tornbit);
+	pcm_word_t       head = (pcm_word_t) line | ((pcm_word_t) bitmap << XACT_LINE_BITMAP_SHIFT) | XACT_LINE_BIT;
+	int              nwords = __builtin_popcount(bitmap);
+	int              i;
+
+	m_phlog_tornbit_append(set, phlog_tornbit, head);
+	for (i = 0; i < nwords; i++) {
+		m_phlog_tornbit_append(set, phlog_tornbit, vals[i]);
+	}
+	if (m_logship_sync_enabled) {
+		for (i = 0; bitmap; bitmap &= bitmap - 1, i++) {
+			m_logship_sync_store(&tmlog->remote, line + __builtin_ctz(bitmap) * sizeof(pcm_word_t), vals[i], ~((pcm_word_t) 0));
+		}
+	}
+}
 
+
+static inline
+m_result_t
+m_tmlog_tornbit_write_line(pcm_storeset_t *set, m_tmlog_tornbit_t *tmlog, uintptr_t line, unsigned int bitmap, const pcm_word_t *vals)
+{
+	m_tmlog_tornbit_reserve(set, tmlog, __builtin_popcount(bitmap) + 1);
+	m_tmlog_tornbit_append_line(set, tmlog, line, bitmap, vals);
+
+	return M_R_SUCCESS;
+}
+
+
+/*
+ * Logs a logical record: XACT_LOGICAL_MARKER, opcode, size, followed by the
+ * size bytes of args padded to whole words. Recovery passes the arguments 
+ * to the replay routine registered for opcode.
+ */
+static inline
+m_result_t
+m_tmlog_tornbit_write_logical(pcm_storeset_t *set, m_tmlog_tornbit_t *tmlog, unsigned int opcode, const void *args, size_t size)
+{
+	m_phlog_tornbit_t *phlog_tornbit = &(tmlog->phlog_tornbit);
+	const uint8_t    *src = (const uint8_t *) args;
+	pcm_word_t       val;
+	size_t           i;
+
+	m_tmlog_tornbit_reserve(set, tmlog, 3 + (size + sizeof(pcm_word_t) - 1) / sizeof(pcm_word_t));
+	m_phlog_tornbit_append(set, phlog_tornbit, (pcm_word_t) XACT_LOGICAL_MARKER);
+	m_phlog_tornbit_append(set, phlog_tornbit, (pcm_word_t) opcode);
+	m_phlog_tornbit_append(set, phlog_tornbit, (pcm_word_t) size);
+	for (i = 0; i < size; i += sizeof(pcm_word_t)) {
+		val = 0;
+		memcpy(&val, src + i, size - i < sizeof(pcm_word_t) ? size - i : sizeof(pcm_word_t));
+		m_phlog_tornbit_append(set, phlog_tornbit, val);
+	}
+	if (m_logship_sync_enabled) {
+		m_logship_sync_logical(&tmlog->remote, opcode, size);
+		for (i = 0; i < size; i += sizeof(pcm_word_t)) {
+			val = 0;
+			memcpy(&val, src + i, size - i < sizeof(pcm_word_t) ? size - i : sizeof(pcm_word_t));
+			m_logship_sync_word(&tmlog->remote, val);
+		}
+	}
 	return M_R_SUCCESS;
 }
 
@@ -82,6 +258,18 @@ static inline
 m_result_t
 m_tmlog_tornbit_begin(m_tmlog_tornbit_t *tmlog)
 {
+	m_phlog_tornbit_t *phlog_tornbit = &(tmlog->phlog_tornbit);
+
+	tmlog->begin_tail = phlog_tornbit->tail;
+	tmlog->begin_buffer_count = phlog_tornbit->buffer_count;
+	if (m_logship_sync_enabled) {
+		m_logship_stream_abort(&tmlog->remote);
+	}
+
+# ifndef SYNC_TRUNCATION
+	PHLOG_BACKPRESSURE(phlog_tornbit);
+# endif
+
 	return M_R_SUCCESS;
 }
 
@@ -91,16 +279,26 @@ m_result_t
 m_tmlog_tornbit_commit(pcm_storeset_t *set, m_tmlog_tornbit_t *tmlog, uint64_t sqn)
 {
 	m_phlog_tornbit_t *phlog_tornbit = &(tmlog->phlog_tornbit);
-
+	uint64_t          ticket = 0;
+
+	/* The standby persists the records while the local log is flushed */
+	if (m_logship_sync_enabled) {
+		ticket = m_logship_sync_send(&tmlog->remote, sqn);
+	}
+	if (sqn < XACT_COMMIT_INLINE_BIT) {
+		m_tmlog_tornbit_reserve(set, tmlog, 1);
+		m_phlog_tornbit_append(set, phlog_tornbit, (pcm_word_t) (XACT_COMMIT_INLINE_BIT | sqn));
+	} else {
+		m_tmlog_tornbit_reserve(set, tmlog, 2);
+		m_phlog_tornbit_append(set, phlog_tornbit, (pcm_word_t) XACT_COMMIT_MARKER);
+		m_phlog_tornbit_append(set, phlog_tornbit, (pcm_word_t) sqn);
+	}
 # ifdef	SYNC_TRUNCATION
-	PHLOG_WRITE(tornbit, set, phlog_tornbit, (pcm_word_t) XACT_COMMIT_MARKER);
-	PHLOG_WRITE(tornbit, set, phlog_tornbit, (pcm_word_t) sqn);
 	PHLOG_FLUSH(tornbit, set, phlog_tornbit);
 # else
-	PHLOG_WRITE_ASYNCTRUNC(tornbit, set, phlog_tornbit, (pcm_word_t) XACT_COMMIT_MARKER);
-	PHLOG_WRITE_ASYNCTRUNC(tornbit, set, phlog_tornbit, (pcm_word_t) sqn);
 	PHLOG_FLUSH_ASYNCTRUNC(tornbit, set, phlog_tornbit);
 # endif
+	m_logship_sync_wait(ticket);
 	return M_R_SUCCESS;
 }
 
@@ -111,6 +309,15 @@ m_tmlog_tornbit_abort(pcm_storeset_t *set, m_tmlog_tornbit_t *tmlog, uint64_t sq
 {
 	m_phlog_tornbit_t *phlog_tornbit = &(tmlog->phlog_tornbit);
 
+	/* 
+	 * If no chunk has been written out since the transaction began then its
+	 * records are all still in the volatile buffer: drop them instead of 
+	 * logging an abort marker.
+	 */
+	if (phlog_tornbit->tail == tmlog->begin_tail) {
+		phlog_tornbit->buffer_count = tmlog->begin_buffer_count;
+		return M_R_SUCCESS;
+	}
 # ifdef	SYNC_TRUNCATION
 	PHLOG_WRITE(tornbit, set, phlog_tornbit, (pcm_word_t) XACT_ABORT_MARKER);
 	PHLOG_WRITE(tornbit, set, phlog_tornbit, (pcm_word_t) sqn);
@@ -135,12 +342,35 @@ m_tmlog_tornbit_truncate_sync(pcm_storeset_t *set, m_tmlog_tornbit_t *tmlog)
 }
 
 
+/* Bytes of log written out since the transaction began, padding included */
+static inline
+uint64_t
+m_tmlog_tornbit_written_bytes(m_tmlog_tornbit_t *tmlog)
+{
+	m_phlog_tornbit_t *phlog_tornbit = &(tmlog->phlog_tornbit);
+
+	return ((phlog_tornbit->tail - tmlog->begin_tail) & phlog_tornbit->mask) * sizeof(pcm_word_t);
+}
+
+
+/* Bytes of log a truncation to the tail would drop */
+static inline
+uint64_t
+m_tmlog_tornbit_untruncated_bytes(m_tmlog_tornbit_t *tmlog)
+{
+	m_phlog_tornbit_t *phlog_tornbit = &(tmlog->phlog_tornbit);
+
+	return ((phlog_tornbit->tail - phlog_tornbit->head) & phlog_tornbit->mask) * sizeof(pcm_word_t);
+}
+
+
 
 m_result_t m_tmlog_tornbit_alloc (m_log_dsc_t *log_dsc);
 m_result_t m_tmlog_tornbit_init (pcm_storeset_t *set, m_log_t *log, m_log_dsc_t *log_dsc);
 m_result_t m_tmlog_tornbit_truncation_init(pcm_storeset_t *set, m_log_dsc_t *log_dsc);
 m_result_t m_tmlog_tornbit_truncation_prepare_next(pcm_storeset_t *set, m_log_dsc_t *log_dsc);
 m_result_t m_tmlog_tornbit_truncation_do(pcm_storeset_t *set, m_log_dsc_t *log_dsc);
+m_result_t m_tmlog_tornbit_truncation_publish(pcm_storeset_t *set, m_log_dsc_t *log_dsc);
 m_result_t m_tmlog_tornbit_recovery_init(pcm_storeset_t *set, m_log_dsc_t *log_dsc);
 m_result_t m_tmlog_tornbit_recovery_prepare_next(pcm_storeset_t *set, m_log_dsc_t *log_dsc);
 m_result_t m_tmlog_tornbit_recovery_do(pcm_storeset_t *set, m_log_dsc_t *log_dsc);
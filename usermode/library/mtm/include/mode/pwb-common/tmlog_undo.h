@@ -0,0 +1,240 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+#ifndef _TMLOG_UNDO_H
+#define _TMLOG_UNDO_H
+
+#include <sys/mman.h>
+#include <string.h>
+#include <mnemosyne.h>
+#include <log.h>
+#include <debug.h>
+#include "mtm_i.h"
+#include "tmlog_base.h"
+
+/*
+ * Undo log of the write-through design. A record holds the old value of a 
+ * word that is about to be stored to in place, and is made durable before 
+ * the store: each record is flushed on its own and so starts a new chunk.
+ * A transaction's fragment ends with a commit or abort marker once the 
+ * stores it covers, or the old values restored, are durable. Recovery 
+ * writes back the old values of the fragment that has no marker.
+ *
+ * With synchronous truncation the log is truncated instead of marked, so 
+ * only the fragment of a transaction in flight can be found in it.
+ */
+
+enum {
+	LF_TYPE_TM_UNDO = 5
+};
+
+extern m_log_ops_t tmlog_undo_ops;
+
+typedef struct m_tmlog_undo_s m_tmlog_undo_t;
+
+
+/* Must ensure that phlog_base is cacheline aligned (see m_phlog_*_s). */
+struct m_tmlog_undo_s {
+	m_phlog_base_t   phlog_base;
+	uint64_t         begin_tail;          /**< phlog tail when the transaction began */
+};
+
+
+static inline
+m_result_t
+m_tmlog_undo_write(pcm_storeset_t *set, 
+                   m_tmlog_undo_t *tmlog, 
+                   uintptr_t addr, 
+                   pcm_word_t val, 
+                   pcm_word_t mask)
+{
+	m_phlog_base_t *phlog_base = &(tmlog->phlog_base);
+
+# ifdef	SYNC_TRUNCATION
+	PHLOG_WRITE(base, set, phlog_base, (pcm_word_t) addr);
+	PHLOG_WRITE(base, set, phlog_base, (pcm_word_t) val);
+	PHLOG_WRITE(base, set, phlog_base, (pcm_word_t) mask);
+	PHLOG_FLUSH(base, set, phlog_base);
+# else
+	PHLOG_WRITE_ASYNCTRUNC(base, set, phlog_base, (pcm_word_t) addr);
+	PHLOG_WRITE_ASYNCTRUNC(base, set, phlog_base, (pcm_word_t) val);
+	PHLOG_WRITE_ASYNCTRUNC(base, set, phlog_base, (pcm_word_t) mask);
+	PHLOG_FLUSH_ASYNCTRUNC(base, set, phlog_base);
+# endif
+	return M_R_SUCCESS;
+}
+
+
+/*
+ * Logs the old values of nwords consecutive words starting at addr as a 
+ * single range record: XACT_RANGE_MARKER, addr, nwords, followed by the 
+ * words.
+ */
+static inline
+m_result_t
+m_tmlog_undo_write_range(pcm_storeset_t *set, 
+                         m_tmlog_undo_t *tmlog, 
+                         uintptr_t addr, 
+                         const void *buf, 
+                         size_t nwords)
+{
+	m_phlog_base_t *phlog_base = &(tmlog->phlog_base);
+	const uint8_t  *src = (const uint8_t *) buf;
+	pcm_word_t     val;
+	size_t         i;
+
+	if (nwords == 1) {
+		memcpy(&val, src, sizeof(pcm_word_t));
+		return m_tmlog_undo_write(set, tmlog, addr, val, ~((pcm_word_t) 0));
+	}
+# ifdef	SYNC_TRUNCATION
+	PHLOG_WRITE(base, set, phlog_base, (pcm_word_t) XACT_RANGE_MARKER);
+	PHLOG_WRITE(base, set, phlog_base, (pcm_word_t) addr);
+	PHLOG_WRITE(base, set, phlog_base, (pcm_word_t) nwords);
+	for (i = 0; i < nwords; i++) {
+		memcpy(&val, src + i * sizeof(pcm_word_t), sizeof(pcm_word_t));
+		PHLOG_WRITE(base, set, phlog_base, val);
+	}
+	PHLOG_FLUSH(base, set, phlog_base);
+# else
+	PHLOG_WRITE_ASYNCTRUNC(base, set, phlog_base, (pcm_word_t) XACT_RANGE_MARKER);
+	PHLOG_WRITE_ASYNCTRUNC(base, set, phlog_base, (pcm_word_t) addr);
+	PHLOG_WRITE_ASYNCTRUNC(base, set, phlog_base, (pcm_word_t) nwords);
+	for (i = 0; i < nwords; i++) {
+		memcpy(&val, src + i * sizeof(pcm_word_t), sizeof(pcm_word_t));
+		PHLOG_WRITE_ASYNCTRUNC(base, set, phlog_base, val);
+	}
+	PHLOG_FLUSH_ASYNCTRUNC(base, set, phlog_base);
+# endif
+	return M_R_SUCCESS;
+}
+
+
+static inline
+m_result_t
+m_tmlog_undo_begin(m_tmlog_undo_t *tmlog)
+{
+	tmlog->begin_tail = tmlog->phlog_base.tail;
+
+# ifndef SYNC_TRUNCATION
+	PHLOG_BACKPRESSURE(&(tmlog->phlog_base));
+# endif
+
+	return M_R_SUCCESS;
+}
+
+
+/* 
+ * Ends the transaction's fragment. The caller must have made durable the 
+ * stores it covers (commit) or the old values restored (abort).
+ */
+static inline
+m_result_t
+m_tmlog_undo_end(pcm_storeset_t *set, m_tmlog_undo_t *tmlog, pcm_word_t marker, uint64_t sqn)
+{
+	m_phlog_base_t *phlog_base = &(tmlog->phlog_base);
+
+	/* Nothing logged, nothing to undo */
+	if (phlog_base->tail == tmlog->begin_tail) {
+		return M_R_SUCCESS;
+	}
+# ifdef	SYNC_TRUNCATION
+	m_phlog_base_truncate_sync(set, phlog_base);
+# else
+	PHLOG_WRITE_ASYNCTRUNC(base, set, phlog_base, marker);
+	PHLOG_WRITE_ASYNCTRUNC(base, set, phlog_base, (pcm_word_t) sqn);
+	PHLOG_FLUSH_ASYNCTRUNC(base, set, phlog_base);
+# endif
+	return M_R_SUCCESS;
+}
+
+
+static inline
+m_result_t
+m_tmlog_undo_commit(pcm_storeset_t *set, m_tmlog_undo_t *tmlog, uint64_t sqn)
+{
+	return m_tmlog_undo_end(set, tmlog, (pcm_word_t) XACT_COMMIT_MARKER, sqn);
+}
+
+
+static inline
+m_result_t
+m_tmlog_undo_abort(pcm_storeset_t *set, m_tmlog_undo_t *tmlog, uint64_t sqn)
+{
+	return m_tmlog_undo_end(set, tmlog, (pcm_word_t) XACT_ABORT_MARKER, sqn);
+}
+
+
+/* The fragment was dropped by m_tmlog_undo_end already */
+static inline
+m_result_t
+m_tmlog_undo_truncate_sync(pcm_storeset_t *set, m_tmlog_undo_t *tmlog)
+{
+	return M_R_SUCCESS;
+}
+
+
+/* Bytes of log written out since the transaction began, padding included */
+static inline
+uint64_t
+m_tmlog_undo_written_bytes(m_tmlog_undo_t *tmlog)
+{
+	m_phlog_base_t *phlog_base = &(tmlog->phlog_base);
+
+	return ((phlog_base->tail - tmlog->begin_tail) & phlog_base->mask) * sizeof(pcm_word_t);
+}
+
+
+/* Bytes of log a truncation to the tail would drop */
+static inline
+uint64_t
+m_tmlog_undo_untruncated_bytes(m_tmlog_undo_t *tmlog)
+{
+	m_phlog_base_t *phlog_base = &(tmlog->phlog_base);
+
+	return ((phlog_base->tail - phlog_base->head) & phlog_base->mask) * sizeof(pcm_word_t);
+}
+
+
+m_result_t m_tmlog_undo_alloc (m_log_dsc_t *log_dsc);
+m_result_t m_tmlog_undo_init (pcm_storeset_t *set, m_log_t *log, m_log_dsc_t *log_dsc);
+m_result_t m_tmlog_undo_truncation_init(pcm_storeset_t *set, m_log_dsc_t *log_dsc);
+m_result_t m_tmlog_undo_truncation_prepare_next(pcm_storeset_t *set, m_log_dsc_t *log_dsc);
+m_result_t m_tmlog_undo_truncation_do(pcm_storeset_t *set, m_log_dsc_t *log_dsc);
+m_result_t m_tmlog_undo_truncation_publish(pcm_storeset_t *set, m_log_dsc_t *log_dsc);
+m_result_t m_tmlog_undo_recovery_init(pcm_storeset_t *set, m_log_dsc_t *log_dsc);
+m_result_t m_tmlog_undo_recovery_prepare_next(pcm_storeset_t *set, m_log_dsc_t *log_dsc);
+m_result_t m_tmlog_undo_recovery_do(pcm_storeset_t *set, m_log_dsc_t *log_dsc);
+m_result_t m_tmlog_undo_report_stats(m_log_dsc_t *log_dsc);
+
+
+#endif /* _TMLOG_UNDO_H */
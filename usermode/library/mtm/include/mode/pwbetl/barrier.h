@@ -35,5 +35,10 @@
 
 #include "pwb_i.h"
 
+extern void mtm_pwbetl_log_range (mtm_tx_t *, const void *, size_t);
+extern int mtm_pwbetl_logical_begin (mtm_tx_t *, unsigned int, const void *, size_t);
+extern int mtm_pwbetl_logical_end (mtm_tx_t *);
+extern void mtm_pwbetl_capture_range (mtm_tx_t *, const void *, size_t);
+
 
 #endif /* _PWBETL_BARRIER_QWE393_H */
@@ -39,5 +39,8 @@ extern void     _ITM_CALL_CONVENTION mtm_pwbetl_commitTransaction (mtm_tx_t *td,
 extern bool     _ITM_CALL_CONVENTION mtm_pwbetl_tryCommitTransaction (mtm_tx_t *, const _ITM_srcLocation *);
 extern void     _ITM_CALL_CONVENTION mtm_pwbetl_commitTransactionToId (mtm_tx_t *, const _ITM_transactionId, const _ITM_srcLocation *);
 extern uint32_t _ITM_CALL_CONVENTION mtm_pwbetl_beginTransaction (mtm_tx_t *, uint32, const _ITM_srcLocation *);
+extern int      mtm_pwbetl_setSavepoint (mtm_tx_t *, jmp_buf *, uint32_t);
+extern int      mtm_pwbetl_rollbackToSavepoint (mtm_tx_t *, uint32_t);
+extern int      mtm_pwbetl_releaseSavepoint (mtm_tx_t *);
 
 #endif /* _PWBETL_BEGINEND_JUI111_H */
@@ -33,7 +33,9 @@
 /**
  * \file pwb_i.h
  *
- * \brief Private header file for write-back with encounter-time locking.
+ * \brief Private header file for write-back with encounter-time locking,
+ * or commit-time locking when built with COMMIT_TIME_LOCKING, or 
+ * write-through when built with UNDO_LOGGING.
  *
  */
 
@@ -41,7 +43,13 @@
 #define _PWBNL_INTERNAL_HJA891_H
 
 #undef  DESIGN
-#define DESIGN WRITE_BACK_ETL
+#if defined(UNDO_LOGGING)
+# define DESIGN WRITE_THROUGH
+#elif defined(COMMIT_TIME_LOCKING)
+# define DESIGN WRITE_BACK_CTL
+#else /* ! COMMIT_TIME_LOCKING */
+# define DESIGN WRITE_BACK_ETL
+#endif /* ! COMMIT_TIME_LOCKING */
 
 
 #include "mode/pwb-common/pwb_i.h"
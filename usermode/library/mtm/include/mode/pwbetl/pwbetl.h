@@ -39,6 +39,15 @@
  * when encountering write operations and buffers updates (they are
  * committed to main memory at commit time).
  *
+ * WRITE_BACK_CTL (COMMIT_TIME_LOCKING): write-back with commit-time
+ * locking buffers updates in the write set without taking any lock, and
+ * acquires the locks of the write set in lock order only at commit, so
+ * that transactions hold them for the duration of the write back alone.
+ *
+ * WRITE_THROUGH (UNDO_LOGGING): write-through with encounter-time locking
+ * stores in place and logs old values to an undo log; commit flushes the
+ * written data instead of writing it back, and rollback restores it.
+ *
  */
 
 #ifndef _PWB_H
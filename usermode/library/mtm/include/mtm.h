@@ -41,6 +41,9 @@
 #ifndef MTM_H_CFA9SVDY
 #define MTM_H_CFA9SVDY
 
+#include <stddef.h>
+#include <stdint.h>
+
 /*!
  * Opens a durability transaction. This should be used as
  *   MNEMOSYNE_ATOMIC {
@@ -60,6 +63,197 @@ extern "C" {
 void mtm_fini_global();
 extern int mtm_enable_trace;
 
+/*!
+ * Savepoints. A long transaction can checkpoint its progress with
+ *
+ *   switch (mtm_savepoint()) {
+ *     case MTM_SAVEPOINT_SET:       // savepoint taken
+ *     case MTM_SAVEPOINT_NONE:      // no savepoint (outside a transaction, 
+ *                                   // irrevocable, or too many savepoints)
+ *     case MTM_SAVEPOINT_RETRY:     // re-executing after a conflict
+ *     case MTM_SAVEPOINT_ROLLBACK:  // after mtm_rollback_to_savepoint()
+ *   }
+ *
+ * If a conflict happens after the savepoint, only the code after it is 
+ * re-executed (a few times, as long as what was read before it is still 
+ * valid). Like setjmp, mtm_savepoint returns again in that case, and local 
+ * variables modified after it should be volatile (GCC does not accept 
+ * returns_twice functions in transactions, so the compiler is not told). 
+ * The function that took the savepoint must not return while the savepoint
+ * exists.
+ *
+ * mtm_rollback_to_savepoint undoes everything done since the innermost 
+ * savepoint of the current (nested) transaction and resumes at it. 
+ * mtm_release_savepoint drops that savepoint. Both return -1 if there is 
+ * no such savepoint. Savepoints are released when the transaction they 
+ * were taken in commits or aborts.
+ */
+#define MTM_SAVEPOINT_SET       0
+#define MTM_SAVEPOINT_RETRY     1
+#define MTM_SAVEPOINT_ROLLBACK  2
+#define MTM_SAVEPOINT_NONE      3
+
+int mtm_savepoint(void) __attribute__((transaction_pure));
+int mtm_rollback_to_savepoint(void) __attribute__((transaction_pure));
+int mtm_release_savepoint(void) __attribute__((transaction_pure));
+
+/*!
+ * Logs the current contents of [addr, addr + size) in the calling 
+ * transaction's persistent log, so that they become durable if and when the
+ * transaction commits. This is for persistent memory written with plain 
+ * stores (e.g. by a transaction_pure function) that no other thread can see
+ * yet, such as a block allocated by the transaction; the range is neither 
+ * locked nor rolled back on abort. Does nothing outside a transaction.
+ */
+void mtm_log_range(const void *addr, size_t size) __attribute__((transaction_pure));
+
+/*!
+ * Logical logging. An operation that updates many words, such as moving 
+ * a counter or appending to a list, can log a single record with an 
+ * application-defined opcode and arguments instead of a redo record per
+ * word:
+ *
+ *   MNEMOSYNE_ATOMIC {
+ *     mtm_logical_begin(OP_SET_COUNTERS, &args, sizeof(args));
+ *     // stores of the operation
+ *     mtm_logical_end();
+ *   }
+ *
+ * The stores in between are isolated, rolled back on abort and written 
+ * back at commit as usual, but no redo record is written for them: if the
+ * commit marker of the transaction is found at recovery, the record is 
+ * passed to the replay routine registered for opcode with 
+ * mnemosyne_logical_replay_register (see mnemosyne.h), in log order with
+ * the transaction's other records. The replay routine must be idempotent
+ * and redo every store of the operation, and a transaction that logs an
+ * operation flushes its write-back at commit. The operation must not be 
+ * undone by the abort of a nested transaction or a rollback to a savepoint
+ * alone, since its record stays in the log. Arguments are copied and 
+ * limited to 1 KB. mtm_logical_begin returns -1 outside a transaction, if
+ * an operation is open already or the arguments are too large; 
+ * mtm_logical_end returns -1 if no operation is open. Both return 0 
+ * otherwise.
+ */
+int mtm_logical_begin(unsigned int opcode, const void *args, size_t size) __attribute__((transaction_pure));
+int mtm_logical_end(void) __attribute__((transaction_pure));
+
+/*!
+ * Durable single-word updates outside transactions: a store, a 
+ * compare-and-swap (returns 1 if it swapped) and a fetch-and-add (returns 
+ * the old value). Each update is durable and visible when it returns, at 
+ * the cost of one lock acquisition, one flush and one fence instead of a 
+ * transaction with its log record and commit marker. Concurrent 
+ * transactions that access the word are kept consistent through the lock 
+ * table as if the update were a one-word transaction. Must be called 
+ * outside a transaction on an 8-byte aligned persistent word. Without 
+ * SYNC_TRUNCATION, call mtm_sync() before updating a word that recently 
+ * committed transactions wrote, or log recovery may replay their older 
+ * value over it.
+ */
+void     mtm_pstore(volatile uint64_t *addr, uint64_t value);
+int      mtm_pcas(volatile uint64_t *addr, uint64_t expected, uint64_t desired);
+uint64_t mtm_pfetch_add(volatile uint64_t *addr, uint64_t delta);
+
+/*!
+ * Sets whether the transactions the calling thread begins from now on run
+ * with isolation (mode pwbetl, the default unless force_mode says 
+ * otherwise) or without it (mode pwbnl). Without isolation a transaction
+ * is still atomic and durable, but it takes no locks and is not validated:
+ * it is meant for data partitioned so that only the calling thread ever 
+ * accesses it, such as a shard with a single writer. Other threads may 
+ * keep running transactions with isolation on other data. Unless the 
+ * library is built with ALLOW_ABORTS, such a transaction must not abort.
+ * Must be called outside a transaction; returns the previous setting, or 
+ * -1 inside a transaction.
+ */
+int mtm_set_isolation(int enable);
+
+/*!
+ * Sets whether the transactions the calling thread begins from now on run
+ * as snapshot reads: read-only transactions that see the data as it was 
+ * when they first read shared memory, long scans included. Instead of 
+ * restarting on data committed after their snapshot, they read the value
+ * it replaced from a version store that write-back commits and the 
+ * updates of mtm_pstore and friends fill, sized by version_store_kb. They 
+ * restart, with a new snapshot, only if the store evicted a version they 
+ * may need, and as update transactions if they write. Without the store 
+ * (version_store_kb 0, or a write-through build), transactions run as 
+ * usual. Must be called outside a transaction; returns the previous 
+ * setting, or -1 inside a transaction.
+ */
+int mtm_set_snapshot_reads(int enable);
+
+/*!
+ * Waits until the stores of all transactions committed so far have reached
+ * their home locations in persistent memory. Commit itself only makes a 
+ * transaction durable in its log; without SYNC_TRUNCATION the home 
+ * locations are written back later by the log truncation threads. Must be
+ * called outside a transaction.
+ */
+void mtm_sync(void);
+
+/*!
+ * Commit sequence numbers. Every transaction that writes persistent memory
+ * commits with a sequence number, its commit timestamp; they grow with
+ * commit order but are not dense, and concurrent commits may share one.
+ * mtm_last_committed_sqn returns the sequence number of the last such
+ * transaction the calling thread committed (0 if none). mtm_durable_sqn
+ * returns a sequence number such that every transaction that committed
+ * with a sequence number up to it is durable; it does not block and may be
+ * polled from any thread, e.g. by a thread that acknowledges requests on
+ * behalf of the ones that served them. mtm_wait_durable blocks until
+ * mtm_durable_sqn reaches sqn. A transaction is durable when its commit
+ * returns, so the watermark lags behind only the commits in flight.
+ */
+uint64_t mtm_last_committed_sqn(void);
+uint64_t mtm_durable_sqn(void);
+void mtm_wait_durable(uint64_t sqn);
+
+/*!
+ * Transaction descriptors owned by fibers or coroutines rather than by
+ * threads. A thread otherwise gets its own descriptor, with its log, at
+ * its first transaction. mtm_tx_create returns a descriptor bound to no
+ * thread, reusing one released by mtm_tx_destroy (and its log) when there
+ * is one. mtm_tx_attach makes tx the descriptor the calling thread runs
+ * transactions with and returns the one it had (NULL detaches); a fiber
+ * scheduler attaches the descriptor of the fiber it resumes. Descriptors
+ * may be switched between transactions only, and attached to one thread
+ * at a time. Stores to a fiber stack take the regular (locked) path.
+ * A thread must have its own descriptor attached again when it exits, and
+ * mtm_tx_destroy takes a detached descriptor.
+ */
+void *mtm_tx_create(void);
+void *mtm_tx_attach(void *tx);
+void mtm_tx_destroy(void *tx);
+
+/*!
+ * Takes a snapshot of all persistent segments, logs included, into the 
+ * directory dir. Blocks new commits and waits for the running transactions
+ * (with isolation; without it the application must quiesce them) and for 
+ * the logs to be truncated, then clones the backing stores, with reflinks 
+ * where the file system supports them. An instance started with 
+ * segments_dir set to dir has nothing to replay at recovery. Persistent 
+ * memory written outside transactions must not change meanwhile. Must be 
+ * called outside a transaction; returns 0 on success.
+ */
+int mtm_snapshot(const char *dir);
+
+/*!
+ * Designates [addr, addr + size) of persistent memory as read-mostly: 
+ * transactional reads of it are served from DRAM copies of its pages, 
+ * which fill on demand and are kept coherent by the commit write-back. Up
+ * to read_cache_mb of copies stay resident. Only transactions may write the 
+ * region; after writing it otherwise, call mtm_readcache_invalidate on the 
+ * range. Must be registered again after a restart. Returns 0 on success, 
+ * -1 if the read cache is disabled or the range is not persistent.
+ */
+int mtm_readcache_register(void *addr, size_t size);
+
+/*!
+ * Drops the DRAM copies of [addr, addr + size); see mtm_readcache_register.
+ */
+void mtm_readcache_invalidate(const void *addr, size_t size);
+
 /* GCC specific. For function pointers */
 struct clone_entry
 {
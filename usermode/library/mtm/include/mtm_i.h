@@ -47,6 +47,7 @@ typedef long double          _ITM_TYPE_E;
 typedef __m64                _ITM_TYPE_M64;
 typedef __m128               _ITM_TYPE_M128;
 typedef __m256               _ITM_TYPE_M256;
+typedef __m512               _ITM_TYPE_M512;
 typedef float _Complex       _ITM_TYPE_CF;
 typedef double _Complex      _ITM_TYPE_CD;
 typedef long double _Complex _ITM_TYPE_CE;
@@ -67,6 +68,7 @@ ACTION (name,long double,E)             \
 ACTION (name,__m64,M64)                 \
 ACTION (name,__m128,M128)               \
 ACTION (name,__m256,M256)               \
+ACTION (name,__m512,M512)               \
 ACTION (name,float _Complex,CF)         \
 ACTION (name,double _Complex,CD)        \
 ACTION (name,long double _Complex,CE)
@@ -81,19 +83,34 @@ ACTION (name,double,D)                  \
 ACTION (name,long double,E)             \
 ACTION (name,__m64,M64)                 \
 ACTION (name,__m128,M128)               \
-ACTION (name,__m256,M256)
+ACTION (name,__m256,M256)               \
+ACTION (name,__m512,M512)
 # endif
 
 #include <result.h>
+#include <debug.h>
 
 
 /* Persistent log type */
 #define TMLOG_TYPE_BASE    0
 #define TMLOG_TYPE_TORNBIT 1
+#define TMLOG_TYPE_CHECKSUM 2
+#define TMLOG_TYPE_UNDO    3
+
+/* The write-through design (UNDO_LOGGING) keeps an undo log instead */
+#ifdef UNDO_LOGGING
+# undef TMLOG_TYPE
+# define TMLOG_TYPE TMLOG_TYPE_UNDO
+#endif /* UNDO_LOGGING */
 
 #if TMLOG_TYPE == TMLOG_TYPE_BASE
 # define M_TMLOG_WRITE          m_tmlog_base_write
+# define M_TMLOG_WRITE_RANGE    m_tmlog_base_write_range
+# define M_TMLOG_WRITE_LINE     m_tmlog_base_write_line
+# define M_TMLOG_WRITE_LOGICAL  m_tmlog_base_write_logical
 # define M_TMLOG_TRUNCATE_SYNC  m_tmlog_base_truncate_sync
+# define M_TMLOG_WRITTEN_BYTES  m_tmlog_base_written_bytes
+# define M_TMLOG_UNTRUNCATED_BYTES m_tmlog_base_untruncated_bytes
 # define M_TMLOG_BEGIN          m_tmlog_base_begin
 # define M_TMLOG_COMMIT         m_tmlog_base_commit
 # define M_TMLOG_ABORT          m_tmlog_base_abort
@@ -102,17 +119,60 @@ ACTION (name,__m256,M256)
 # define M_TMLOG_OPS            tmlog_base_ops
 #elif TMLOG_TYPE == TMLOG_TYPE_TORNBIT
 # define M_TMLOG_WRITE          m_tmlog_tornbit_write
+# define M_TMLOG_WRITE_RANGE    m_tmlog_tornbit_write_range
+# define M_TMLOG_WRITE_LINE     m_tmlog_tornbit_write_line
+# define M_TMLOG_WRITE_LOGICAL  m_tmlog_tornbit_write_logical
+# define M_TMLOG_RESERVE        m_tmlog_tornbit_reserve
+# define M_TMLOG_APPEND         m_tmlog_tornbit_append
+# define M_TMLOG_APPEND_LINE    m_tmlog_tornbit_append_line
 # define M_TMLOG_TRUNCATE_SYNC  m_tmlog_tornbit_truncate_sync
+# define M_TMLOG_WRITTEN_BYTES  m_tmlog_tornbit_written_bytes
+# define M_TMLOG_UNTRUNCATED_BYTES m_tmlog_tornbit_untruncated_bytes
 # define M_TMLOG_BEGIN          m_tmlog_tornbit_begin
 # define M_TMLOG_COMMIT         m_tmlog_tornbit_commit
 # define M_TMLOG_ABORT          m_tmlog_tornbit_abort
 # define M_TMLOG_T              m_tmlog_tornbit_t
 # define M_TMLOG_LF_TYPE        LF_TYPE_TM_TORNBIT
 # define M_TMLOG_OPS            tmlog_tornbit_ops
+#elif TMLOG_TYPE == TMLOG_TYPE_CHECKSUM
+# define M_TMLOG_WRITE          m_tmlog_checksum_write
+# define M_TMLOG_WRITE_RANGE    m_tmlog_checksum_write_range
+# define M_TMLOG_WRITE_LINE     m_tmlog_checksum_write_line
+# define M_TMLOG_WRITE_LOGICAL  m_tmlog_checksum_write_logical
+# define M_TMLOG_TRUNCATE_SYNC  m_tmlog_checksum_truncate_sync
+# define M_TMLOG_WRITTEN_BYTES  m_tmlog_checksum_written_bytes
+# define M_TMLOG_UNTRUNCATED_BYTES m_tmlog_checksum_untruncated_bytes
+# define M_TMLOG_BEGIN          m_tmlog_checksum_begin
+# define M_TMLOG_COMMIT         m_tmlog_checksum_commit
+# define M_TMLOG_ABORT          m_tmlog_checksum_abort
+# define M_TMLOG_T              m_tmlog_checksum_t
+# define M_TMLOG_LF_TYPE        LF_TYPE_TM_CHECKSUM
+# define M_TMLOG_OPS            tmlog_checksum_ops
+#elif TMLOG_TYPE == TMLOG_TYPE_UNDO
+# define M_TMLOG_WRITE          m_tmlog_undo_write
+# define M_TMLOG_WRITE_RANGE    m_tmlog_undo_write_range
+# define M_TMLOG_TRUNCATE_SYNC  m_tmlog_undo_truncate_sync
+# define M_TMLOG_WRITTEN_BYTES  m_tmlog_undo_written_bytes
+# define M_TMLOG_UNTRUNCATED_BYTES m_tmlog_undo_untruncated_bytes
+# define M_TMLOG_BEGIN          m_tmlog_undo_begin
+# define M_TMLOG_COMMIT         m_tmlog_undo_commit
+# define M_TMLOG_ABORT          m_tmlog_undo_abort
+# define M_TMLOG_T              m_tmlog_undo_t
+# define M_TMLOG_LF_TYPE        LF_TYPE_TM_UNDO
+# define M_TMLOG_OPS            tmlog_undo_ops
 #else
 # error "Unknown persistent log type."
 #endif
 
+/* 
+ * Log types without M_TMLOG_RESERVE check for room on every record, so 
+ * their appends are plain writes.
+ */
+#ifndef M_TMLOG_RESERVE
+# define M_TMLOG_APPEND         M_TMLOG_WRITE
+# define M_TMLOG_APPEND_LINE    M_TMLOG_WRITE_LINE
+#endif
+
 /*
  * The library does not require to pass the current transaction as a
  * parameter to the functions (the current transaction is stored in a
@@ -148,11 +208,28 @@ struct mtm_tx *mtm_current_tx();
 
 #define WRITE_BACK_ETL                  0
 #define WRITE_THROUGH                   1
+#define WRITE_BACK_CTL                  2
 
 #define CM_SUICIDE                      0
 #define CM_DELAY                        1
 #define CM_BACKOFF                      2
 #define CM_PRIORITY                     3
+#define CM_POLICY                       4
+
+/* Contention management policies of CM_POLICY, chosen by cm_policy */
+#define CM_POLICY_SUICIDE               0
+#define CM_POLICY_DELAY                 1
+#define CM_POLICY_BACKOFF               2
+#define CM_POLICY_KARMA                 3
+#define CM_POLICY_POLKA                 4
+
+#define CLOCK_GV1                       0
+#define CLOCK_GV4                       1
+#define CLOCK_GV5                       2
+
+#ifndef CLOCK_SCHEME
+# define CLOCK_SCHEME                   CLOCK_GV1
+#endif /* ! CLOCK_SCHEME */
 
 #include <assert.h>
 #include <stdio.h>
@@ -176,25 +253,19 @@ struct mtm_tx *mtm_current_tx();
 #endif /* defined(READ_LOCKED_DATA) && ! defined(EPOCH_GC) */
 
 #define TLS
+#define MTM_TLS_MODEL                   __attribute__((tls_model("initial-exec")))
 
-# define MTM_DEBUG_PRINT(...)
-//# define MTM_DEBUG_PRINT(...)               printf(__VA_ARGS__); fflush(NULL)
+/* Compiled out, arguments included, unless M_LOG_LEVEL_MAX lets them in */
+#define MTM_DEBUG_PRINT(...)            M_LOG(M_LOG_CAT_MTM, M_LOG_TRACE, __VA_ARGS__)
+#define PRINT_DEBUG(...)                M_LOG(M_LOG_CAT_MTM, M_LOG_DEBUG, __VA_ARGS__)
+#define PRINT_DEBUG2(...)               M_LOG(M_LOG_CAT_MTM, M_LOG_TRACE, __VA_ARGS__)
 
 #ifdef DEBUG
-/* Note: stdio is thread-safe */
 # define IO_FLUSH                       fflush(NULL)
-# define PRINT_DEBUG(...)               printf(__VA_ARGS__); fflush(NULL)
 #else /* ! DEBUG */
 # define IO_FLUSH
-# define PRINT_DEBUG(...)
 #endif /* ! DEBUG */
 
-#ifdef DEBUG2
-# define PRINT_DEBUG2(...)              PRINT_DEBUG(__VA_ARGS__)
-#else /* ! DEBUG2 */
-# define PRINT_DEBUG2(...)
-#endif /* ! DEBUG2 */
-
 #ifndef LOCK_SHIFT_EXTRA
 # define LOCK_SHIFT_EXTRA               2                   /* 2 extra shift */
 #endif /* LOCK_SHIFT_EXTRA */
@@ -207,6 +278,12 @@ struct mtm_tx *mtm_current_tx();
 extern int vr_threshold;
 extern int cm_threshold;
 
+#if CM == CM_POLICY
+extern int           mtm_cm_policy;
+extern unsigned long mtm_cm_backoff_min;
+extern unsigned long mtm_cm_backoff_max;
+#endif /* CM == CM_POLICY */
+
 
 
 #define STR2(str1, str2)                str1##str2
@@ -228,6 +305,9 @@ extern int cm_threshold;
 #include "locks.h"
 #include "local.h"
 #include "stats.h"
+#ifdef EPOCH_GC
+# include "gc.h"
+#endif /* EPOCH_GC */
 
 /**
  * Size of a word (accessible atomically) on the target architecture.
@@ -244,6 +324,12 @@ enum {                                  /* Transaction status */
   TX_SERIAL = 8,
 };
 
+/* How a transaction holds mtm_serial_lock (see mtm_tx_s.serial) */
+#define MTM_SERIAL_NONE                 0x0
+#define MTM_SERIAL_READ                 0x1  /* Runs concurrently with other transactions */
+#define MTM_SERIAL_WRITE                0x2  /* Runs alone (serial mode) */
+#define MTM_SERIAL_IRREVOCABLE          0x4  /* Runs alone and may not abort */
+
 
 /* 
  * These values are given to mtm_restart_transaction and indicate the
@@ -260,6 +346,7 @@ typedef enum mtm_restart_reason
 	RESTART_VALIDATE_COMMIT,
 	RESTART_NOT_READONLY,
 	RESTART_USER_RETRY,
+	RESTART_SERIAL_IRR,
 	NUM_RESTARTS
 } mtm_restart_reason;
 
@@ -267,51 +354,87 @@ typedef enum mtm_restart_reason
 /* This type is private to local.c.  */
 struct mtm_local_undo;
 
-/* Transaction descriptor */
+/* 
+ * Transaction descriptor
+ *
+ * Laid out by access frequency. The first cacheline holds what every 
+ * begin, barrier and commit reads; the register checkpoint fills the 
+ * second, so an outermost begin writes the checkpoint with one line and 
+ * updates the first. Everything after it is only touched by aborts, 
+ * contention management, user actions, statistics or thread setup.
+ */
 struct mtm_tx_s {
+	/* Hot: read on every begin, barrier and commit */
 	uintptr_t              dummy1;           /* ICC expects to find the dtable pointer at offset 2*WORD_SIZE. */
 	uintptr_t              dummy2;
 	mtm_dtable_t           *dtable;          /* The dispatch table for the active transaction mode. */
-
-	jmp_buf                *tmp_jb_ptr;      /* Pointer to the temporary register checkpoint. This simplifies the assembly checkpoint code. */
-	jmp_buf                tmp_jb;           /* Temporary register checkpoint; this is where the assebly register checkpoint code will save the registers.  */
-	jmp_buf                jb;               /* Register checkpoint of this transaction. Keeping this separate from tmp_jb allows a nested transaction to transparently execute the assembly checkpoint code without destroying the active register checkpoint.  */
-
-	mtm_mode_data_t        *modedata[MTM_NUM_MODES];
-	mtm_mode_t             mode;
+	mtm_mode_data_t        *active_modedata; /* modedata[mode], without the indexed load */
+	pcm_storeset_t         *pcm_storeset;    /* PCM emulation bookkeeping structure */
 	mtm_word_t             status;           /* Transaction status (not read by other threads). */
-
+	mtm_mode_t             mode;
 	uint32_t               prop;             /* The _ITM_codeProperties of this transaction as given by the compiler.  */
 	int                    nesting;          /* Nesting level. */
-	int                    can_extend;       /* Can this transaction be extended? */
+	int                    serial;           /* MTM_SERIAL_* hold on mtm_serial_lock */
+
+	/* 
+	 * Register checkpoint of the outermost transaction, written straight 
+	 * from the checkpoint _ITM_beginTransaction takes on the stack.
+	 */
+	jmp_buf                jb __attribute__((aligned(CACHELINE_SIZE)));
+
+	/* Warm: aborts and contention management */
 	_ITM_transactionId     id;               /* Instance number of the transaction */
-	int                    thread_num;
-#ifdef CONFLICT_TRACKING
-	pthread_t              thread_id;        /* Thread identifier (immutable) */
-#endif /* CONFLICT_TRACKING */
-#if CM == CM_DELAY || CM == CM_PRIORITY
+	int                    can_extend;       /* Can this transaction be extended? */
+	int                    snapshot_reads;   /* Begin transactions as snapshot reads (see mtm_set_snapshot_reads) */
+#ifdef HTM_FASTPATH
+	int                    htm;              /* Running inside a hardware transaction? */
+#endif /* HTM_FASTPATH */
+	unsigned long          retries;          /* Number of consecutive aborts (retries) */
+#if CM == CM_DELAY || CM == CM_PRIORITY || CM == CM_POLICY
 	volatile mtm_word_t    *c_lock;          /* Pointer to contented lock (cause of abort). */
-#endif /* CM == CM_DELAY || CM == CM_PRIORITY */
-#if CM == CM_BACKOFF
+#endif /* CM == CM_DELAY || CM == CM_PRIORITY || CM == CM_POLICY */
+#if CM == CM_BACKOFF || CM == CM_POLICY
 	unsigned long          backoff;          /* Maximum backoff duration. */
 	unsigned long          seed;             /* RNG seed. */
-#endif /* CM == CM_BACKOFF */
+#endif /* CM == CM_BACKOFF || CM == CM_POLICY */
+#if CM == CM_POLICY
+	unsigned long          karma;            /* Accesses of the executions aborted by conflicts. */
+#endif /* CM == CM_POLICY */
 #if CM == CM_PRIORITY
 	int                    priority;         /* Transaction priority */
 	int                    visible_reads;    /* Should we use visible reads? */
 #endif /* CM == CM_PRIORITY */
-	unsigned long          retries;          /* Number of consecutive aborts (retries) */
-
-	uintptr_t              stack_base;       /* Stack base address */
-	uintptr_t              stack_size;       /* Stack size */
 	mtm_local_undo_t       local_undo;       /* Data used by local.c for the local memory undo log.  */
 	mtm_word_t             *wb_table;        /* Private write-back table for use when isolation is off. */
-	pcm_storeset_t         *pcm_storeset;    /* PCM emulation bookkeeping structure */
 	m_stats_threadstat_t   *threadstat;      /* Thread statistics */
 	m_stats_statset_t      *statset;         /* Per transaction instance statistics */
-	mtm_user_action_list_t *commit_action_list;
-	mtm_user_action_list_t *undo_action_list;
-};
+	uintptr_t              site;             /* Call site of the outermost transaction begin (0 if unknown) */
+	volatile mtm_word_t    *conflict_lock;   /* Lock of the last conflict (see txsched.h) */
+	int                    sched_class;      /* Conflict class queue held (-1 if none) */
+#ifdef _M_STATS_BUILD
+	uint64_t               stats_fences;     /* Fences the thread had issued when the transaction began */
+	int                    stats_commit_phases; /* Whether commit phases are timed */
+	uintptr_t              stats_abort_owner;   /* Begin call site of the lock owner of the last conflict (0 if unknown) */
+#endif /* _M_STATS_BUILD */
+	mtm_user_action_list_t precommit_action_list; /* Run by the outermost commit before it commits */
+	mtm_user_action_list_t commit_action_list;
+	mtm_user_action_list_t undo_action_list;
+
+	/* Shared: read by mtm_durable_sqn in other threads */
+	volatile mtm_word_t    pending_sqn __attribute__((aligned(CACHELINE_SIZE))); /* Lower bound of the timestamp of the commit in flight (0 if none) */
+	mtm_word_t             last_sqn;         /* Timestamp of the last commit that wrote persistent memory */
+	mtm_tx_t               *durable_next;    /* Next descriptor scanned by mtm_durable_sqn */
+
+	/* Cold: thread setup */
+	mtm_mode_data_t        *modedata[MTM_NUM_MODES];
+	mtm_tx_t               *pool_next;       /* Next released descriptor (see mtm_tx_destroy) */
+	int                    thread_num;
+#ifdef CONFLICT_TRACKING
+	pthread_t              thread_id;        /* Thread identifier (immutable) */
+#endif /* CONFLICT_TRACKING */
+	uintptr_t              stack_base;       /* Stack base address */
+	uintptr_t              stack_size;       /* Stack size */
+} __attribute__((aligned(CACHELINE_SIZE)));
 
 
 /*
@@ -373,7 +496,10 @@ struct mtm_tx_s {
  *
  * \see locks.h
  */
-extern volatile mtm_word_t locks[];
+extern volatile mtm_word_t *locks;
+extern unsigned int        mtm_lock_array_log_size;
+extern unsigned int        mtm_lock_shift;
+extern mtm_word_t          mtm_lock_mask;
 
 #ifdef CLOCK_IN_CACHE_LINE
 extern volatile mtm_word_t gclock[];
@@ -383,6 +509,38 @@ extern volatile mtm_word_t gclock;
 # define CLOCK                          (gclock)
 #endif /* ! CLOCK_IN_CACHE_LINE */
 
+#if CM == CM_PRIORITY || CM == CM_POLICY
+/* Transactions reading another thread's descriptor (see cm.h) */
+extern volatile mtm_word_t mtm_cm_owner_readers;
+#endif /* CM == CM_PRIORITY || CM == CM_POLICY */
+
+#ifdef INCREMENTAL_VALIDATION
+/*
+ * Number of update commits that have begun and that are done. A commit is
+ * counted as begun before it takes its timestamp and as done after it has
+ * released its locks, so a read set validated while the two were equal
+ * stays valid for as long as no other commit begins.
+ */
+typedef struct {
+	volatile mtm_word_t begun;
+	char                pad1[CACHELINE_SIZE - sizeof(mtm_word_t)];
+	volatile mtm_word_t done;
+	char                pad2[CACHELINE_SIZE - sizeof(mtm_word_t)];
+} mtm_commit_counters_t;
+
+extern mtm_commit_counters_t mtm_commit_counters;
+
+static inline void mtm_commit_begin(void)
+{
+  ATOMIC_FETCH_INC_FULL(&mtm_commit_counters.begun);
+}
+
+static inline void mtm_commit_done(void)
+{
+  ATOMIC_FETCH_INC_FULL(&mtm_commit_counters.done);
+}
+#endif /* INCREMENTAL_VALIDATION */
+
 #ifdef _M_STATS_BUILD	
 extern m_statsmgr_t *mtm_statsmgr;
 #endif
@@ -393,9 +551,37 @@ extern m_statsmgr_t *mtm_statsmgr;
  */
 extern mtm_rwlock_t mtm_serial_lock;
 
+#ifdef HTM_FASTPATH
+/* Hardware attempts per transaction before falling back (0 if no RTM). */
+extern int mtm_htm_attempts;
+#endif /* HTM_FASTPATH */
+
+/* Largest write set whose home lines commit prefetches (0 disables). */
+extern int mtm_commit_prefetch_max;
+
+/* Hardware attempts per elided m_txmutex acquisition (0 if no RTM). */
+extern int mtm_txlock_elide_attempts;
+
+/* 
+ * Components of a transaction turned off by the unsafe_disable setting, to
+ * break the commit cost down in benchmarks. Transactions are then neither
+ * isolated nor durable as promised: never set outside of measurements.
+ */
+#define MTM_UNSAFE_ISOLATION  0x1  /* run in mode pwbnl, without locks */
+#define MTM_UNSAFE_LOGGING    0x2  /* write no redo (or undo) log records */
+#define MTM_UNSAFE_LOG_FLUSH  0x4  /* no persist barrier in the log flush */
+#define MTM_UNSAFE_HOME_FLUSH 0x8  /* no write-back of the home locations */
+extern int mtm_unsafe_disable;
+
+#define MTM_UNSAFE_DISABLED(component) unlikely(mtm_unsafe_disable & (component))
+
 extern uint32_t mtm_begin_transaction(uint32_t, const mtm_jmpbuf_t *);
 extern uint32_t mtm_longjmp (const mtm_jmpbuf_t *, uint32_t)
 	ITM_NORETURN;
+/* Resume at a register checkpoint; the checkpointed begin returns the actions. */
+extern void _ITM_siglongjmp (jmp_buf, uint32_t) ITM_NORETURN;
+/* Bytes of a jmp_buf the checkpoint of sysdeps/x86/arch.S fills: rsp, rbx, rbp, r12-r15 and rip */
+#define MTM_CHECKPOINT_SIZE (8 * sizeof(uintptr_t))
 
 extern void mtm_commit_local (TXPARAM);
 extern void mtm_rollback_local (TXPARAM);
@@ -427,14 +613,73 @@ extern void *mtm_null_write_lock (mtm_tx_t *td, uintptr_t);
 #define GET_CLOCK                       (ATOMIC_LOAD_ACQ(&CLOCK))
 #define FETCH_INC_CLOCK                 (ATOMIC_FETCH_INC_FULL(&CLOCK))
 
+/*
+ * Returns the commit timestamp of an update transaction. The timestamp is 
+ * strictly greater than the version of any lock released before the call.
+ * *alone is set when no other transaction may have committed with a
+ * timestamp between the current one and ours, i.e. when a transaction that
+ * started at t - 1 does not need to validate its read set.
+ *
+ * - CLOCK_GV1: every commit atomically increments the clock.
+ * - CLOCK_GV4: try to increment the clock once; if the CAS fails another 
+ *   transaction has just incremented it and we share its timestamp (TL2 
+ *   "pass on failure"). This halves the traffic on the clock line when
+ *   commits are frequent.
+ * - CLOCK_GV5: never increment at commit; use clock + 1. The clock is 
+ *   instead advanced lazily by transactions that encounter a version ahead 
+ *   of it (see mtm_clock_advance), so read-mostly phases never write it.
+ */
+static inline mtm_word_t mtm_clock_commit_ts(int *alone)
+{
+#if CLOCK_SCHEME == CLOCK_GV4
+  mtm_word_t c = GET_CLOCK;
+
+  if (ATOMIC_CAS_FULL(&CLOCK, c, c + 1) != 0) {
+    *alone = 1;
+    return c + 1;
+  }
+  *alone = 0;
+  return GET_CLOCK;
+#elif CLOCK_SCHEME == CLOCK_GV5
+  *alone = 0;
+  return GET_CLOCK + 1;
+#else /* CLOCK_SCHEME == CLOCK_GV1 */
+  *alone = 1;
+  return FETCH_INC_CLOCK + 1;
+#endif /* CLOCK_SCHEME == CLOCK_GV1 */
+}
+
+/*
+ * Make sure the clock is not behind a version observed in a lock. Only 
+ * CLOCK_GV5 may publish versions ahead of the clock.
+ */
+static inline void mtm_clock_advance(mtm_word_t version)
+{
+#if CLOCK_SCHEME == CLOCK_GV5
+  mtm_word_t c;
+
+  while ((c = GET_CLOCK) < version) {
+    if (ATOMIC_CAS_FULL(&CLOCK, c, version) != 0) {
+      break;
+    }
+  }
+#endif /* CLOCK_SCHEME == CLOCK_GV5 */
+}
+
 
 /* ################################################################### *
  * STATIC
  * ################################################################### */
 
-/* Don't access this variable directly; use the functions below.  */
+/* 
+ * Don't access this variable directly; use the functions below. 
+ *
+ * Initial-exec TLS: the library is loaded with the program, so the 
+ * descriptor is one load off the thread pointer instead of a call to 
+ * __tls_get_addr in every barrier.
+ */
 #ifdef TLS
-extern __thread mtm_tx_t *_mtm_thread_tx;
+extern __thread mtm_tx_t *_mtm_thread_tx MTM_TLS_MODEL;
 #else /* !TLS */
 extern pthread_key_t _mtm_thread_tx;
 #endif /* !TLS */
@@ -503,7 +748,7 @@ static inline void mtm_rollover_enter(mtm_tx_t *tx)
  */
 static inline void mtm_rollover_exit(mtm_tx_t *tx)
 {
-  PRINT_DEBUG("==> mtm_rollover_exit(%p[%lu-%lu])\n", tx, (unsigned long)tx->start, (unsigned long)tx->end);
+  PRINT_DEBUG("==> mtm_rollover_exit(%p)\n", tx);
 
   pthread_mutex_lock(&tx_count_mutex);
   /* One less (active) transaction */
@@ -535,7 +780,7 @@ static inline void mtm_rollover_exit(mtm_tx_t *tx)
  */
 static inline void mtm_overflow(mtm_tx_t *tx)
 {
-  PRINT_DEBUG("==> mtm_overflow(%p[%lu-%lu])\n", tx, (unsigned long)tx->start, (unsigned long)tx->end);
+  PRINT_DEBUG("==> mtm_overflow(%p)\n", tx);
 
   pthread_mutex_lock(&tx_count_mutex);
   /* Set overflow flag (might already be set) */
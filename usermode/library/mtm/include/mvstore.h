@@ -0,0 +1,173 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/**
+ * \file
+ *
+ * \brief Version store for snapshot reads.
+ *
+ * Commits record the word each write-back overwrites, with the commit 
+ * timestamp, before they drop their locks. A snapshot transaction (see 
+ * mtm_set_snapshot_reads) that meets a word newer than its snapshot finds
+ * the value the word had then here, instead of restarting: it is the old
+ * value of the earliest commit to the word after the snapshot, or the 
+ * current value if no commit after the snapshot wrote the word.
+ *
+ * The store is a table of buckets indexed by lock stripe, each a ring of 
+ * the last MTM_MVSTORE_WAYS words recorded in its stripes. A bucket 
+ * remembers the newest timestamp it evicted: a snapshot older than that 
+ * may have lost the version it needs and restarts as before. Its sequence
+ * word is odd while a commit records into it; readers retry if it changed
+ * under them. Nothing is persistent.
+ */
+
+#ifndef _M_MVSTORE_H_QP7W3D
+#define _M_MVSTORE_H_QP7W3D
+
+#include <stdint.h>
+#include "mtm_i.h"
+
+#define MTM_MVSTORE_WAYS  8
+
+typedef struct mtm_mvstore_entry_s mtm_mvstore_entry_t;
+typedef struct mtm_mvstore_bucket_s mtm_mvstore_bucket_t;
+
+struct mtm_mvstore_entry_s {
+	volatile uintptr_t  addr;  /**< word overwritten (0 if none yet) */
+	volatile mtm_word_t value; /**< value it had before the commit */
+	volatile mtm_word_t ts;    /**< commit timestamp */
+};
+
+struct mtm_mvstore_bucket_s {
+	volatile mtm_word_t seq;        /**< odd while a commit records */
+	volatile mtm_word_t evicted_ts; /**< newest timestamp evicted */
+	mtm_word_t          next;       /**< entry the next record replaces */
+	mtm_mvstore_entry_t entries[MTM_MVSTORE_WAYS];
+} __attribute__((aligned(CACHELINE_SIZE)));
+
+extern mtm_mvstore_bucket_t *mtm_mvstore_buckets;
+extern mtm_word_t           mtm_mvstore_mask;
+
+void mtm_mvstore_init(void);
+
+
+static inline
+mtm_mvstore_bucket_t *
+mtm_mvstore_bucket(volatile mtm_word_t *addr)
+{
+	return &mtm_mvstore_buckets[LOCK_IDX(addr) & mtm_mvstore_mask];
+}
+
+
+/**
+ * \brief Records that the commit at timestamp ts overwrites value at addr.
+ *
+ * Called with the lock of addr held, before the word is written back or 
+ * the lock is released.
+ */
+static inline
+void
+mtm_mvstore_record(volatile mtm_word_t *addr, mtm_word_t value, mtm_word_t ts)
+{
+	mtm_mvstore_bucket_t *b = mtm_mvstore_bucket(addr);
+	mtm_mvstore_entry_t  *e;
+	mtm_word_t           s;
+
+	for (;;) {
+		s = ATOMIC_LOAD_ACQ(&b->seq);
+		if (s % 2 == 0 && ATOMIC_CAS_FULL(&b->seq, s, s + 1) != 0) {
+			break;
+		}
+		cpu_relax();
+	}
+	e = &b->entries[b->next];
+	if (e->addr != 0 && e->ts > b->evicted_ts) {
+		b->evicted_ts = e->ts;
+	}
+	e->addr = (uintptr_t) addr;
+	e->value = value;
+	e->ts = ts;
+	b->next = (b->next + 1) % MTM_MVSTORE_WAYS;
+	ATOMIC_STORE_REL(&b->seq, s + 2);
+}
+
+
+/**
+ * \brief Finds the value addr had at snapshot timestamp ts.
+ *
+ * current is a value of addr loaded, under an unowned lock, before the 
+ * call. Returns 0 if the bucket evicted a version newer than ts.
+ */
+static inline
+int
+mtm_mvstore_lookup(volatile mtm_word_t *addr, mtm_word_t ts, mtm_word_t current, 
+                   mtm_word_t *valuep)
+{
+	mtm_mvstore_bucket_t *b = mtm_mvstore_bucket(addr);
+	mtm_mvstore_entry_t  *e;
+	mtm_word_t           s;
+	mtm_word_t           found_ts;
+	mtm_word_t           value;
+	mtm_word_t           evicted_ts;
+	int                  i;
+
+	do {
+		s = ATOMIC_LOAD_ACQ(&b->seq);
+		if (s % 2 != 0) {
+			cpu_relax();
+			continue;
+		}
+		found_ts = 0;
+		value = current;
+		for (i = 0; i < MTM_MVSTORE_WAYS; i++) {
+			e = &b->entries[i];
+			if (e->addr == (uintptr_t) addr && e->ts > ts && 
+			    (found_ts == 0 || e->ts < found_ts)) 
+			{
+				found_ts = e->ts;
+				value = e->value;
+			}
+		}
+		evicted_ts = b->evicted_ts;
+		/* x86 keeps loads in order; keep the compiler from reordering them */
+		__asm__ __volatile__ ("" ::: "memory");
+	} while (s % 2 != 0 || b->seq != s);
+
+	/* An older version of the word after ts may be the one evicted */
+	if (evicted_ts > ts) {
+		return 0;
+	}
+	*valuep = value;
+	return 1;
+}
+
+#endif /* _M_MVSTORE_H_QP7W3D */
@@ -0,0 +1,442 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department,
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory,
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/*!
+ * \file
+ * Persistent B+-tree from 64-bit keys to 64-bit values.
+ *
+ * Only the leaves are persistent. A leaf keeps its entries unsorted in
+ * append slots, with a bitmap word of valid slots and a one-byte hash
+ * fingerprint per slot to skip most key compares. Inserting writes a free
+ * slot, then sets its bit; updating writes a new slot and swaps the two
+ * bits in one store; removing clears a bit. Each is durable linearizable
+ * through an 8-byte bitmap store, needs no log, and costs two flush/fence
+ * pairs at most, where a rebalancing tree logs and flushes dozens of
+ * lines. Only a split, which moves the upper half of a full leaf into a
+ * new one, runs as a transaction. Keys are sorted on demand, when a split
+ * or a scan needs them.
+ *
+ * The inner nodes are a volatile array of leaf separators, built from the
+ * leaf chain by m_pbtree_open after every reincarnation. That is also
+ * when fingerprints are recomputed, so they need not be flushed.
+ *
+ * Updates take a single writer. The caller must keep lookups and scans
+ * out while an update runs, because a split may grow the volatile index.
+ */
+#ifndef MNEMOSYNE_PBTREE_H_5FK2PL7R
+#define MNEMOSYNE_PBTREE_H_5FK2PL7R
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mnemosyne.h>
+#include <mtm.h>
+#include <pmalloc.h>
+
+# ifdef __cplusplus
+extern "C" {
+# endif
+
+#define M_PBTREE_LEAF_SLOTS 32
+
+typedef struct {
+	uint64_t key;
+	uint64_t value;
+} m_pbtree_kv_t;
+
+typedef struct m_pbtree_leaf_s m_pbtree_leaf_t;
+
+/* Bitmap, chain link and fingerprints share the first cacheline */
+struct m_pbtree_leaf_s {
+	uint64_t        bitmap;
+	m_pbtree_leaf_t *next;
+	uint8_t         fp[M_PBTREE_LEAF_SLOTS];
+	uint64_t        pad[2];
+	m_pbtree_kv_t   kv[M_PBTREE_LEAF_SLOTS];
+};
+
+/*! Persistent root: the leaf chain in key order */
+typedef struct {
+	m_pbtree_leaf_t *head;
+} m_pbtree_t;
+
+/*! Volatile index: leaves[i] holds the keys in [lows[i], lows[i+1]) */
+typedef struct {
+	m_pbtree_t      *tree;
+	uint64_t        *lows;
+	m_pbtree_leaf_t **leaves;
+	size_t          nleaves;
+	size_t          capacity;
+} m_pbtree_index_t;
+
+#define M_PBTREE_FULL ((uint64_t) -1 >> (64 - M_PBTREE_LEAF_SLOTS))
+
+
+static inline uint8_t
+m_pbtree_fp(uint64_t key)
+{
+	key *= 0x9e3779b97f4a7c15ULL;
+	return (uint8_t) (key >> 56);
+}
+
+
+/*! Allocates an empty tree; returns NULL if persistent memory runs out */
+static inline m_pbtree_t *
+m_pbtree_create(void)
+{
+	m_pbtree_t *tree;
+
+	MNEMOSYNE_ATOMIC {
+		tree = (m_pbtree_t *) pmalloc(sizeof(m_pbtree_t));
+		if (tree) {
+			tree->head = (m_pbtree_leaf_t *) pcalloc(1, sizeof(m_pbtree_leaf_t));
+			if (!tree->head) {
+				pfree(tree);
+				tree = NULL;
+			}
+		}
+	}
+	return tree;
+}
+
+
+static inline void
+m_pbtree_destroy(m_pbtree_t *tree)
+{
+	m_pbtree_leaf_t *leaf;
+	m_pbtree_leaf_t *next;
+
+	MNEMOSYNE_ATOMIC {
+		for (leaf = tree->head; leaf; leaf = next) {
+			next = leaf->next;
+			pfree(leaf);
+		}
+		pfree(tree);
+	}
+}
+
+
+static inline int
+m_pbtree_index_append(m_pbtree_index_t *index, size_t pos, uint64_t low, 
+                      m_pbtree_leaf_t *leaf)
+{
+	if (index->nleaves == index->capacity) {
+		size_t          capacity = index->capacity ? 2 * index->capacity : 64;
+		uint64_t        *lows = (uint64_t *) realloc(index->lows, capacity * sizeof(uint64_t));
+		m_pbtree_leaf_t **leaves;
+
+		if (!lows) {
+			return -1;
+		}
+		index->lows = lows;
+		leaves = (m_pbtree_leaf_t **) realloc(index->leaves, capacity * sizeof(m_pbtree_leaf_t *));
+		if (!leaves) {
+			return -1;
+		}
+		index->leaves = leaves;
+		index->capacity = capacity;
+	}
+	memmove(&index->lows[pos + 1], &index->lows[pos], 
+	        (index->nleaves - pos) * sizeof(uint64_t));
+	memmove(&index->leaves[pos + 1], &index->leaves[pos], 
+	        (index->nleaves - pos) * sizeof(m_pbtree_leaf_t *));
+	index->lows[pos] = low;
+	index->leaves[pos] = leaf;
+	index->nleaves++;
+	return 0;
+}
+
+
+/*!
+ * Builds the volatile index of a tree from its leaf chain and recomputes
+ * the fingerprints. Returns NULL if volatile memory runs out.
+ *
+ * Leaves emptied by removals stay in the chain but, except the head, are
+ * left out of the index: the separators are the smallest keys, which an
+ * empty leaf does not have.
+ */
+static inline m_pbtree_index_t *
+m_pbtree_open(m_pbtree_t *tree)
+{
+	m_pbtree_index_t *index;
+	m_pbtree_leaf_t  *leaf;
+	uint64_t         low;
+	int              i;
+
+	if (!(index = (m_pbtree_index_t *) calloc(1, sizeof(m_pbtree_index_t)))) {
+		return NULL;
+	}
+	index->tree = tree;
+	for (leaf = tree->head; leaf; leaf = leaf->next) {
+		low = UINT64_MAX;
+		for (i = 0; i < M_PBTREE_LEAF_SLOTS; i++) {
+			if (leaf->bitmap & (1ULL << i)) {
+				leaf->fp[i] = m_pbtree_fp(leaf->kv[i].key);
+				if (leaf->kv[i].key < low) {
+					low = leaf->kv[i].key;
+				}
+			}
+		}
+		if (leaf == tree->head) {
+			low = 0;
+		} else if (!leaf->bitmap) {
+			continue;
+		}
+		if (m_pbtree_index_append(index, index->nleaves, low, leaf) < 0) {
+			free(index->lows);
+			free(index->leaves);
+			free(index);
+			return NULL;
+		}
+	}
+	return index;
+}
+
+
+/*! Frees the volatile index; the tree itself is untouched */
+static inline void
+m_pbtree_close(m_pbtree_index_t *index)
+{
+	free(index->lows);
+	free(index->leaves);
+	free(index);
+}
+
+
+/* Position in the index of the leaf that holds key */
+static inline size_t
+m_pbtree_route(m_pbtree_index_t *index, uint64_t key)
+{
+	size_t lo = 0;
+	size_t hi = index->nleaves;
+	size_t mid;
+
+	while (hi - lo > 1) {
+		mid = (lo + hi) / 2;
+		if (index->lows[mid] <= key) {
+			lo = mid;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+
+static inline int
+m_pbtree_leaf_find(m_pbtree_leaf_t *leaf, uint64_t key)
+{
+	uint64_t bits = leaf->bitmap;
+	uint8_t  fp = m_pbtree_fp(key);
+	int      i;
+
+	while (bits) {
+		i = __builtin_ctzll(bits);
+		bits &= bits - 1;
+		if (leaf->fp[i] == fp && leaf->kv[i].key == key) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+
+/*! Looks up key; returns 1 and its value if present, 0 otherwise */
+static inline int
+m_pbtree_get(m_pbtree_index_t *index, uint64_t key, uint64_t *value)
+{
+	m_pbtree_leaf_t *leaf = index->leaves[m_pbtree_route(index, key)];
+	int             i = m_pbtree_leaf_find(leaf, key);
+
+	if (i < 0) {
+		return 0;
+	}
+	*value = leaf->kv[i].value;
+	return 1;
+}
+
+
+/* Sorts the valid slots of a leaf by key into slots; returns their number */
+static inline int
+m_pbtree_leaf_sort(m_pbtree_leaf_t *leaf, int *slots)
+{
+	uint64_t bits = leaf->bitmap;
+	int      n = 0;
+	int      i;
+	int      j;
+
+	while (bits) {
+		i = __builtin_ctzll(bits);
+		bits &= bits - 1;
+		for (j = n++; j > 0 && leaf->kv[slots[j - 1]].key > leaf->kv[i].key; j--) {
+			slots[j] = slots[j - 1];
+		}
+		slots[j] = i;
+	}
+	return n;
+}
+
+
+/*
+ * Moves the upper half of a full leaf into a new leaf linked after it, in
+ * one transaction, then adds the new leaf to the index.
+ */
+static inline int
+m_pbtree_split(m_pbtree_index_t *index, size_t pos)
+{
+	m_pbtree_leaf_t *leaf = index->leaves[pos];
+	m_pbtree_leaf_t *sibling;
+	int             slots[M_PBTREE_LEAF_SLOTS];
+	uint64_t        upper = 0;
+	int             n;
+	int             i;
+
+	n = m_pbtree_leaf_sort(leaf, slots);
+	for (i = n / 2; i < n; i++) {
+		upper |= 1ULL << slots[i];
+	}
+	MNEMOSYNE_ATOMIC {
+		sibling = (m_pbtree_leaf_t *) pmalloc(sizeof(m_pbtree_leaf_t));
+		if (sibling) {
+			for (i = n / 2; i < n; i++) {
+				sibling->kv[i - n / 2] = leaf->kv[slots[i]];
+				sibling->fp[i - n / 2] = leaf->fp[slots[i]];
+			}
+			sibling->bitmap = M_PBTREE_FULL >> (M_PBTREE_LEAF_SLOTS - (n - n / 2));
+			sibling->next = leaf->next;
+			leaf->next = sibling;
+			leaf->bitmap &= ~upper;
+		}
+	}
+	if (!sibling) {
+		return -1;
+	}
+	return m_pbtree_index_append(index, pos + 1, sibling->kv[0].key, sibling);
+}
+
+
+/*!
+ * Inserts or updates key. Returns 1 if the key was inserted, 0 if it was
+ * updated and -1 if memory ran out. The update is durable on return.
+ */
+static inline int
+m_pbtree_put(m_pbtree_index_t *index, uint64_t key, uint64_t value)
+{
+	m_pbtree_leaf_t *leaf;
+	size_t          pos;
+	uint64_t        bitmap;
+	int             old;
+	int             i;
+
+	for (;;) {
+		pos = m_pbtree_route(index, key);
+		leaf = index->leaves[pos];
+		if (leaf->bitmap != M_PBTREE_FULL) {
+			break;
+		}
+		if (m_pbtree_split(index, pos) < 0) {
+			return -1;
+		}
+	}
+	old = m_pbtree_leaf_find(leaf, key);
+	i = __builtin_ctzll(~leaf->bitmap);
+	leaf->kv[i].key = key;
+	leaf->kv[i].value = value;
+	leaf->fp[i] = m_pbtree_fp(key);
+	m_pflush(&leaf->kv[i], sizeof(m_pbtree_kv_t));
+	m_pfence();
+	bitmap = leaf->bitmap | (1ULL << i);
+	if (old >= 0) {
+		bitmap &= ~(1ULL << old);
+	}
+	__atomic_store_n(&leaf->bitmap, bitmap, __ATOMIC_RELEASE);
+	m_pflush(&leaf->bitmap, sizeof(leaf->bitmap));
+	m_pfence();
+	return old < 0;
+}
+
+
+/*! Removes key; returns 1 if it was present. Durable on return. */
+static inline int
+m_pbtree_remove(m_pbtree_index_t *index, uint64_t key)
+{
+	m_pbtree_leaf_t *leaf = index->leaves[m_pbtree_route(index, key)];
+	int             i = m_pbtree_leaf_find(leaf, key);
+
+	if (i < 0) {
+		return 0;
+	}
+	__atomic_store_n(&leaf->bitmap, leaf->bitmap & ~(1ULL << i), __ATOMIC_RELEASE);
+	m_pflush(&leaf->bitmap, sizeof(leaf->bitmap));
+	m_pfence();
+	return 1;
+}
+
+
+/*!
+ * Calls fn on every key in [lo, hi] in ascending order, until fn returns
+ * nonzero. Returns the number of keys visited.
+ */
+static inline size_t
+m_pbtree_scan(m_pbtree_index_t *index, uint64_t lo, uint64_t hi,
+              int (*fn)(uint64_t key, uint64_t value, void *arg), void *arg)
+{
+	m_pbtree_leaf_t *leaf;
+	int             slots[M_PBTREE_LEAF_SLOTS];
+	size_t          visited = 0;
+	size_t          pos;
+	uint64_t        key;
+	int             n;
+	int             i;
+
+	for (pos = m_pbtree_route(index, lo); pos < index->nleaves && index->lows[pos] <= hi; pos++) {
+		leaf = index->leaves[pos];
+		n = m_pbtree_leaf_sort(leaf, slots);
+		for (i = 0; i < n; i++) {
+			key = leaf->kv[slots[i]].key;
+			if (key < lo || key > hi) {
+				continue;
+			}
+			visited++;
+			if (fn(key, leaf->kv[slots[i]].value, arg)) {
+				return visited;
+			}
+		}
+	}
+	return visited;
+}
+
+# ifdef __cplusplus
+}
+# endif
+
+#endif /* end of include guard: MNEMOSYNE_PBTREE_H_5FK2PL7R */
@@ -0,0 +1,413 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department,
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory,
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/*!
+ * \file
+ * Persistent cuckoo hash map from 64-bit keys to 64-bit values.
+ *
+ * Each key lives in one of two buckets of M_PCUCKOO_SLOTS slots, and each
+ * bucket fills one cacheline. An insert into two full buckets moves keys
+ * to their other bucket along a displacement path; the moves and the 
+ * insert are one transaction, so a crash leaves the map before or after 
+ * the whole update. A key's second bucket is its first one xor a tag 
+ * derived from the key, so a bucket's keys find their other bucket 
+ * without knowing which of the two they sit in.
+ *
+ * Lookups are not instrumented. Each bucket has a volatile version, odd 
+ * while a transaction that writes the bucket is in flight; m_pcuckoo_get
+ * reads both buckets between two reads of their versions and retries if
+ * either changed. Updates are serialized by a mutex, so any number of 
+ * threads may update and look up the map concurrently.
+ *
+ * The versions and the mutex live in a volatile handle, m_pcuckoo_open
+ * attaches one to the persistent map after each restart. A pointer set is
+ * the map with values ignored.
+ */
+#ifndef MNEMOSYNE_PCUCKOO_H_7TQ2LW9D
+#define MNEMOSYNE_PCUCKOO_H_7TQ2LW9D
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <mnemosyne.h>
+#include <mtm.h>
+#include <pmalloc.h>
+
+# ifdef __cplusplus
+extern "C" {
+# endif
+
+#define M_PCUCKOO_SLOTS    3
+#define M_PCUCKOO_MAX_PATH 32   /*!< longest displacement path tried */
+
+typedef struct {
+	uint64_t          used;                     /*!< bit i: slot i holds a key */
+	uint64_t          key[M_PCUCKOO_SLOTS];
+	uint64_t          value[M_PCUCKOO_SLOTS];
+	uint64_t          pad;
+} m_pcuckoo_bucket_t;
+
+typedef struct {
+	uint64_t           mask;       /*!< number of buckets - 1 */
+	uint64_t           count;      /*!< number of keys */
+	uint64_t           pad[6];
+	m_pcuckoo_bucket_t buckets[];
+} m_pcuckoo_t;
+
+typedef struct {
+	m_pcuckoo_t        *map;
+	volatile uint32_t  *versions;  /*!< one per bucket; odd while being written */
+	pthread_mutex_t    mutex;      /*!< serializes updates */
+	uint64_t           walk;       /*!< picks the slot a displacement evicts */
+} m_pcuckoo_handle_t;
+
+
+static inline uint64_t
+m_pcuckoo_hash(uint64_t key)
+{
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	key *= 0xc4ceb9fe1a85ec53ULL;
+	key ^= key >> 33;
+	return key;
+}
+
+
+static inline uint64_t
+m_pcuckoo_bucket1(m_pcuckoo_t *map, uint64_t key)
+{
+	return m_pcuckoo_hash(key) & map->mask;
+}
+
+
+/* The other bucket of key when it is in bucket b; never b itself */
+static inline uint64_t
+m_pcuckoo_alt(m_pcuckoo_t *map, uint64_t b, uint64_t key)
+{
+	return b ^ (((m_pcuckoo_hash(key) >> 32) & map->mask) | 1);
+}
+
+
+/*!
+ * Allocates a map with nbuckets (rounded up to a power of two, at least 2)
+ * empty buckets. Returns NULL if persistent memory runs out.
+ */
+static inline m_pcuckoo_t *
+m_pcuckoo_create(uint64_t nbuckets)
+{
+	m_pcuckoo_t *map;
+	uint64_t    n = 2;
+
+	while (n < nbuckets) {
+		n <<= 1;
+	}
+	MNEMOSYNE_ATOMIC {
+		map = (m_pcuckoo_t *) pcalloc(1, sizeof(m_pcuckoo_t) +
+		                                 n * sizeof(m_pcuckoo_bucket_t));
+		if (map) {
+			map->mask = n - 1;
+		}
+	}
+	return map;
+}
+
+
+static inline void
+m_pcuckoo_destroy(m_pcuckoo_t *map)
+{
+	MNEMOSYNE_ATOMIC {
+		pfree(map);
+	}
+}
+
+
+/*! Attaches a volatile handle to map. Returns -1 if memory runs out. */
+static inline int
+m_pcuckoo_open(m_pcuckoo_handle_t *h, m_pcuckoo_t *map)
+{
+	h->map = map;
+	h->walk = 0;
+	h->versions = (volatile uint32_t *) calloc(map->mask + 1, sizeof(uint32_t));
+	if (!h->versions) {
+		return -1;
+	}
+	pthread_mutex_init(&h->mutex, NULL);
+	return 0;
+}
+
+
+static inline void
+m_pcuckoo_close(m_pcuckoo_handle_t *h)
+{
+	free((void *) h->versions);
+	pthread_mutex_destroy(&h->mutex);
+}
+
+
+static inline int
+m_pcuckoo_find(m_pcuckoo_bucket_t *bucket, uint64_t key)
+{
+	int i;
+
+	for (i = 0; i < M_PCUCKOO_SLOTS; i++) {
+		if ((bucket->used & (1ULL << i)) && bucket->key[i] == key) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+
+static inline int
+m_pcuckoo_free_slot(m_pcuckoo_bucket_t *bucket)
+{
+	int i;
+
+	for (i = 0; i < M_PCUCKOO_SLOTS; i++) {
+		if (!(bucket->used & (1ULL << i))) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+
+/*! Looks up key without instrumentation; returns 1 and its value if present */
+static inline int
+m_pcuckoo_get(m_pcuckoo_handle_t *h, uint64_t key, uint64_t *value)
+{
+	m_pcuckoo_t                 *map = h->map;
+	uint64_t                    b[2];
+	volatile m_pcuckoo_bucket_t *bucket;
+	uint32_t                    v1;
+	uint32_t                    v2;
+	uint64_t                    val = 0;
+	int                         found = 0;
+	int                         i;
+	int                         s;
+
+	b[0] = m_pcuckoo_bucket1(map, key);
+	b[1] = m_pcuckoo_alt(map, b[0], key);
+	do {
+		/* A key moving between its buckets has both of them odd */
+		while (((v1 = __atomic_load_n(&h->versions[b[0]], __ATOMIC_ACQUIRE)) |
+		        (v2 = __atomic_load_n(&h->versions[b[1]], __ATOMIC_ACQUIRE))) & 1) 
+		{
+			__builtin_ia32_pause();
+		}
+		found = 0;
+		for (i = 0; i < 2 && !found; i++) {
+			bucket = &map->buckets[b[i]];
+			for (s = 0; s < M_PCUCKOO_SLOTS; s++) {
+				if ((bucket->used & (1ULL << s)) && bucket->key[s] == key) {
+					val = bucket->value[s];
+					found = 1;
+					break;
+				}
+			}
+		}
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (v1 != __atomic_load_n(&h->versions[b[0]], __ATOMIC_RELAXED) ||
+	         v2 != __atomic_load_n(&h->versions[b[1]], __ATOMIC_RELAXED));
+	if (found) {
+		*value = val;
+	}
+	return found;
+}
+
+
+/* Makes the version of bucket b odd, unless it already is */
+static inline void
+m_pcuckoo_write_begin(m_pcuckoo_handle_t *h, uint64_t b)
+{
+	if (!(h->versions[b] & 1)) {
+		__atomic_add_fetch(&h->versions[b], 1, __ATOMIC_SEQ_CST);
+	}
+}
+
+
+static inline void
+m_pcuckoo_write_end(m_pcuckoo_handle_t *h, uint64_t b)
+{
+	if (h->versions[b] & 1) {
+		__atomic_add_fetch(&h->versions[b], 1, __ATOMIC_RELEASE);
+	}
+}
+
+
+/* 
+ * Finds a path of full buckets from b whose keys can each move to their
+ * other bucket, ending at a bucket with a free slot. path_b/path_s get 
+ * the bucket and slot of each key to move, in order; returns the path 
+ * length, or -1 if there is none within M_PCUCKOO_MAX_PATH moves.
+ */
+static inline int
+m_pcuckoo_path(m_pcuckoo_handle_t *h, uint64_t b, 
+               uint64_t *path_b, int *path_s, uint64_t *last_b, int *last_s)
+{
+	m_pcuckoo_t *map = h->map;
+	int         len;
+	int         s;
+	int         j;
+	int         k;
+
+	for (len = 0; len < M_PCUCKOO_MAX_PATH; len++) {
+		if ((s = m_pcuckoo_free_slot(&map->buckets[b])) >= 0) {
+			*last_b = b;
+			*last_s = s;
+			return len;
+		}
+		/* Evict a slot that is not already on the path */
+		for (k = 0; k < M_PCUCKOO_SLOTS; k++) {
+			s = (int) ((h->walk + k) % M_PCUCKOO_SLOTS);
+			for (j = 0; j < len; j++) {
+				if (path_b[j] == b && path_s[j] == s) {
+					break;
+				}
+			}
+			if (j == len) {
+				break;
+			}
+		}
+		if (k == M_PCUCKOO_SLOTS) {
+			return -1;
+		}
+		h->walk++;
+		path_b[len] = b;
+		path_s[len] = s;
+		b = m_pcuckoo_alt(map, b, map->buckets[b].key[s]);
+	}
+	return -1;
+}
+
+
+/*!
+ * Inserts or updates key. Returns 1 if the key was inserted, 0 if it was
+ * updated and -1 if no displacement path was found; the map should then
+ * be rebuilt larger. The update is durable on return.
+ */
+static inline int
+m_pcuckoo_put(m_pcuckoo_handle_t *h, uint64_t key, uint64_t value)
+{
+	m_pcuckoo_t *map = h->map;
+	uint64_t    b1 = m_pcuckoo_bucket1(map, key);
+	uint64_t    b2 = m_pcuckoo_alt(map, b1, key);
+	uint64_t    path_b[M_PCUCKOO_MAX_PATH];
+	int         path_s[M_PCUCKOO_MAX_PATH];
+	uint64_t    b;
+	uint64_t    db;
+	uint64_t    last_b;
+	int         s;
+	int         ds;
+	int         last_s;
+	int         len;
+	int         i;
+
+	pthread_mutex_lock(&h->mutex);
+	if ((s = m_pcuckoo_find(&map->buckets[b = b1], key)) >= 0 ||
+	    (s = m_pcuckoo_find(&map->buckets[b = b2], key)) >= 0) 
+	{
+		m_pcuckoo_write_begin(h, b);
+		MNEMOSYNE_ATOMIC {
+			map->buckets[b].value[s] = value;
+		}
+		m_pcuckoo_write_end(h, b);
+		pthread_mutex_unlock(&h->mutex);
+		return 0;
+	}
+	if ((len = m_pcuckoo_path(h, b1, path_b, path_s, &last_b, &last_s)) < 0 &&
+	    (len = m_pcuckoo_path(h, b2, path_b, path_s, &last_b, &last_s)) < 0)
+	{
+		pthread_mutex_unlock(&h->mutex);
+		return -1;
+	}
+	for (i = 0; i < len; i++) {
+		m_pcuckoo_write_begin(h, path_b[i]);
+	}
+	m_pcuckoo_write_begin(h, last_b);
+	MNEMOSYNE_ATOMIC {
+		/* Move the keys back to front, each into the slot the next one left */
+		db = last_b;
+		ds = last_s;
+		map->buckets[db].used |= 1ULL << ds;
+		for (i = len - 1; i >= 0; i--) {
+			b = path_b[i];
+			s = path_s[i];
+			map->buckets[db].key[ds] = map->buckets[b].key[s];
+			map->buckets[db].value[ds] = map->buckets[b].value[s];
+			db = b;
+			ds = s;
+		}
+		map->buckets[db].key[ds] = key;
+		map->buckets[db].value[ds] = value;
+		map->count++;
+	}
+	for (i = 0; i < len; i++) {
+		m_pcuckoo_write_end(h, path_b[i]);
+	}
+	m_pcuckoo_write_end(h, last_b);
+	pthread_mutex_unlock(&h->mutex);
+	return 1;
+}
+
+
+/*! Removes key; returns 1 if it was present. The removal is durable on return. */
+static inline int
+m_pcuckoo_remove(m_pcuckoo_handle_t *h, uint64_t key)
+{
+	m_pcuckoo_t *map = h->map;
+	uint64_t    b = m_pcuckoo_bucket1(map, key);
+	int         s;
+
+	pthread_mutex_lock(&h->mutex);
+	if ((s = m_pcuckoo_find(&map->buckets[b], key)) < 0 &&
+	    (s = m_pcuckoo_find(&map->buckets[b = m_pcuckoo_alt(map, b, key)], key)) < 0)
+	{
+		pthread_mutex_unlock(&h->mutex);
+		return 0;
+	}
+	m_pcuckoo_write_begin(h, b);
+	MNEMOSYNE_ATOMIC {
+		map->buckets[b].used &= ~(1ULL << s);
+		map->count--;
+	}
+	m_pcuckoo_write_end(h, b);
+	pthread_mutex_unlock(&h->mutex);
+	return 1;
+}
+
+# ifdef __cplusplus
+}
+# endif
+
+#endif /* end of include guard: MNEMOSYNE_PCUCKOO_H_7TQ2LW9D */
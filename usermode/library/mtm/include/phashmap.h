@@ -0,0 +1,334 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department,
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory,
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/*!
+ * \file
+ * Persistent hash map from 64-bit keys to 64-bit values.
+ *
+ * Chained buckets; each node fills one cacheline, so writing back a new
+ * node is a single flush, and the map header fills another so the bucket
+ * array starts on a cacheline boundary.
+ *
+ * The map comes in two flavors, which must not be mixed on one map:
+ *
+ *  - m_phashmap_tx_*: transaction safe, for use inside MNEMOSYNE_ATOMIC
+ *    blocks alongside other persistent updates. An update writes the value
+ *    word only, an insert the new node and one bucket word, a removal one
+ *    link word.
+ *
+ *  - m_phashmap_put/remove: durable linearizable updates outside
+ *    transactions for a single writer thread. Each update is durable when
+ *    it returns and costs two or three flush/fence pairs instead of a
+ *    logged transaction. Concurrent m_phashmap_get calls are safe against
+ *    inserts and updates; removals free nodes, so the caller must keep
+ *    readers out while they run. After a restart, call m_phashmap_recover
+ *    before the first update.
+ *
+ * m_phashmap_get serves both flavors.
+ */
+#ifndef MNEMOSYNE_PHASHMAP_H_2QW8XN4B
+#define MNEMOSYNE_PHASHMAP_H_2QW8XN4B
+
+#include <stdint.h>
+#include <mnemosyne.h>
+#include <mtm.h>
+#include <pmalloc.h>
+
+# ifdef __cplusplus
+extern "C" {
+# endif
+
+#define M_PHASHMAP_SAFE __attribute__((transaction_safe))
+
+typedef struct m_phashmap_node_s m_phashmap_node_t;
+
+struct m_phashmap_node_s {
+	uint64_t          key;
+	uint64_t          value;
+	m_phashmap_node_t *next;
+	uint64_t          pad[5];
+};
+
+typedef struct {
+	uint64_t          mask;       /*!< number of buckets - 1 */
+	m_phashmap_node_t *spare;     /*!< single writer: node being inserted */
+	m_phashmap_node_t *garbage;   /*!< single writer: node being removed */
+	uint64_t          pad[5];
+	m_phashmap_node_t *buckets[];
+} m_phashmap_t;
+
+
+M_PHASHMAP_SAFE
+static inline uint64_t
+m_phashmap_hash(uint64_t key)
+{
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	key *= 0xc4ceb9fe1a85ec53ULL;
+	key ^= key >> 33;
+	return key;
+}
+
+
+/*!
+ * Allocates a map with nbuckets (rounded up to a power of two) empty
+ * buckets. Returns NULL if persistent memory runs out.
+ */
+static inline m_phashmap_t *
+m_phashmap_create(uint64_t nbuckets)
+{
+	m_phashmap_t *map;
+	uint64_t     n = 8;
+
+	while (n < nbuckets) {
+		n <<= 1;
+	}
+	MNEMOSYNE_ATOMIC {
+		map = (m_phashmap_t *) pcalloc(1, sizeof(m_phashmap_t) +
+		                                  n * sizeof(m_phashmap_node_t *));
+		if (map) {
+			map->mask = n - 1;
+		}
+	}
+	return map;
+}
+
+
+/*! Frees the map and all its nodes in one transaction */
+static inline void
+m_phashmap_destroy(m_phashmap_t *map)
+{
+	m_phashmap_node_t *node;
+	m_phashmap_node_t *next;
+	uint64_t          i;
+
+	MNEMOSYNE_ATOMIC {
+		for (i = 0; i <= map->mask; i++) {
+			for (node = map->buckets[i]; node; node = next) {
+				next = node->next;
+				pfree(node);
+			}
+		}
+		if (map->spare) {
+			pfree(map->spare);
+		}
+		pfree(map);
+	}
+}
+
+
+/*! Looks up key; returns 1 and its value if present, 0 otherwise */
+M_PHASHMAP_SAFE
+static inline int
+m_phashmap_get(m_phashmap_t *map, uint64_t key, uint64_t *value)
+{
+	m_phashmap_node_t *node;
+
+	for (node = map->buckets[m_phashmap_hash(key) & map->mask]; node; node = node->next) {
+		if (node->key == key) {
+			*value = node->value;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+/*!
+ * Inserts or updates key inside a transaction. Returns 1 if the key was
+ * inserted, 0 if it was updated and -1 if persistent memory ran out.
+ */
+M_PHASHMAP_SAFE
+static inline int
+m_phashmap_tx_put(m_phashmap_t *map, uint64_t key, uint64_t value)
+{
+	m_phashmap_node_t **bucket = &map->buckets[m_phashmap_hash(key) & map->mask];
+	m_phashmap_node_t *node;
+
+	for (node = *bucket; node; node = node->next) {
+		if (node->key == key) {
+			if (node->value != value) {
+				node->value = value;
+			}
+			return 0;
+		}
+	}
+	if (!(node = (m_phashmap_node_t *) pmalloc(sizeof(m_phashmap_node_t)))) {
+		return -1;
+	}
+	node->key = key;
+	node->value = value;
+	node->next = *bucket;
+	*bucket = node;
+	return 1;
+}
+
+
+/*! Removes key inside a transaction; returns 1 if it was present */
+M_PHASHMAP_SAFE
+static inline int
+m_phashmap_tx_remove(m_phashmap_t *map, uint64_t key)
+{
+	m_phashmap_node_t **link = &map->buckets[m_phashmap_hash(key) & map->mask];
+	m_phashmap_node_t *node;
+
+	for (node = *link; node; link = &node->next, node = *link) {
+		if (node->key == key) {
+			*link = node->next;
+			pfree(node);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+static inline void
+m_phashmap_persist_word(void *addr, void *value)
+{
+	__atomic_store_n((void **) addr, value, __ATOMIC_RELEASE);
+	m_pflush(addr, sizeof(void *));
+	m_pfence();
+}
+
+
+/*!
+ * Inserts or updates key outside transactions (single writer). Returns 1
+ * if the key was inserted, 0 if it was updated and -1 if persistent memory
+ * ran out. The update is durable on return.
+ *
+ * The new node is allocated into map->spare first, so a crash before it
+ * is linked leaves it reachable for reuse instead of leaking it.
+ */
+static inline int
+m_phashmap_put(m_phashmap_t *map, uint64_t key, uint64_t value)
+{
+	m_phashmap_node_t **bucket = &map->buckets[m_phashmap_hash(key) & map->mask];
+	m_phashmap_node_t *node;
+
+	for (node = *bucket; node; node = node->next) {
+		if (node->key == key) {
+			m_phashmap_persist_word(&node->value, (void *) value);
+			return 0;
+		}
+	}
+	if (!map->spare) {
+		MNEMOSYNE_ATOMIC {
+			map->spare = (m_phashmap_node_t *) pmalloc(sizeof(m_phashmap_node_t));
+		}
+		if (!map->spare) {
+			return -1;
+		}
+	}
+	node = map->spare;
+	node->key = key;
+	node->value = value;
+	node->next = *bucket;
+	m_pflush(node, sizeof(*node));
+	m_pfence();
+	m_phashmap_persist_word(bucket, node);
+	m_phashmap_persist_word(&map->spare, NULL);
+	return 1;
+}
+
+
+/*!
+ * Removes key outside transactions (single writer, no concurrent
+ * readers). Returns 1 if it was present. The removal is durable on return.
+ *
+ * The node is parked in map->garbage while it is unlinked, so a crash
+ * between unlinking and freeing it does not leak it.
+ */
+static inline int
+m_phashmap_remove(m_phashmap_t *map, uint64_t key)
+{
+	m_phashmap_node_t **link = &map->buckets[m_phashmap_hash(key) & map->mask];
+	m_phashmap_node_t *node;
+
+	for (node = *link; node; link = &node->next, node = *link) {
+		if (node->key == key) {
+			m_phashmap_persist_word(&map->garbage, node);
+			m_phashmap_persist_word(link, node->next);
+			MNEMOSYNE_ATOMIC {
+				pfree(map->garbage);
+				map->garbage = NULL;
+			}
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+static inline int
+m_phashmap_linked(m_phashmap_t *map, m_phashmap_node_t *target)
+{
+	m_phashmap_node_t *node;
+
+	for (node = map->buckets[m_phashmap_hash(target->key) & map->mask]; node; node = node->next) {
+		if (node == target) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+/*!
+ * Completes a single-writer update interrupted by a crash: forgets a spare
+ * node that made it into the map and frees a removed node that did not
+ * get freed.
+ */
+static inline void
+m_phashmap_recover(m_phashmap_t *map)
+{
+	if (map->spare && m_phashmap_linked(map, map->spare)) {
+		m_phashmap_persist_word(&map->spare, NULL);
+	}
+	if (map->garbage) {
+		if (m_phashmap_linked(map, map->garbage)) {
+			m_phashmap_persist_word(&map->garbage, NULL);
+		} else {
+			MNEMOSYNE_ATOMIC {
+				pfree(map->garbage);
+				map->garbage = NULL;
+			}
+		}
+	}
+}
+
+# ifdef __cplusplus
+}
+# endif
+
+#endif /* end of include guard: MNEMOSYNE_PHASHMAP_H_2QW8XN4B */
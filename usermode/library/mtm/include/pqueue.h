@@ -0,0 +1,187 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department,
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory,
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/*!
+ * \file
+ * Persistent bounded FIFO queue of 64-bit values.
+ *
+ * A ring of slots with the consumer's head and the producer's tail on
+ * cachelines of their own, so the two sides do not write back each
+ * other's lines. Two flavors, which must not be mixed on one queue:
+ *
+ *  - m_pqueue_tx_*: transaction safe, for use inside MNEMOSYNE_ATOMIC
+ *    blocks with any number of producers and consumers. An enqueue writes
+ *    a slot and the tail, a dequeue the head.
+ *
+ *  - m_pqueue_enqueue/dequeue: durable linearizable operations outside
+ *    transactions for one producer thread and one consumer thread. Each
+ *    is durable when it returns, at the cost of one or two flush/fence
+ *    pairs.
+ */
+#ifndef MNEMOSYNE_PQUEUE_H_8JD3MV1C
+#define MNEMOSYNE_PQUEUE_H_8JD3MV1C
+
+#include <stdint.h>
+#include <mnemosyne.h>
+#include <mtm.h>
+#include <pmalloc.h>
+
+# ifdef __cplusplus
+extern "C" {
+# endif
+
+#define M_PQUEUE_SAFE __attribute__((transaction_safe))
+
+typedef struct {
+	uint64_t mask;         /*!< number of slots - 1 */
+	uint64_t pad0[7];
+	uint64_t head;         /*!< next slot to dequeue */
+	uint64_t pad1[7];
+	uint64_t tail;         /*!< next slot to enqueue */
+	uint64_t pad2[7];
+	uint64_t slots[];
+} m_pqueue_t;
+
+
+/*!
+ * Allocates an empty queue of capacity (rounded up to a power of two)
+ * slots. Returns NULL if persistent memory runs out.
+ */
+static inline m_pqueue_t *
+m_pqueue_create(uint64_t capacity)
+{
+	m_pqueue_t *queue;
+	uint64_t   n = 8;
+
+	while (n < capacity) {
+		n <<= 1;
+	}
+	MNEMOSYNE_ATOMIC {
+		queue = (m_pqueue_t *) pcalloc(1, sizeof(m_pqueue_t) + n * sizeof(uint64_t));
+		if (queue) {
+			queue->mask = n - 1;
+		}
+	}
+	return queue;
+}
+
+
+static inline void
+m_pqueue_destroy(m_pqueue_t *queue)
+{
+	MNEMOSYNE_ATOMIC {
+		pfree(queue);
+	}
+}
+
+
+/*! Appends value inside a transaction; returns -1 if the queue is full */
+M_PQUEUE_SAFE
+static inline int
+m_pqueue_tx_enqueue(m_pqueue_t *queue, uint64_t value)
+{
+	uint64_t tail = queue->tail;
+
+	if (tail - queue->head > queue->mask) {
+		return -1;
+	}
+	queue->slots[tail & queue->mask] = value;
+	queue->tail = tail + 1;
+	return 0;
+}
+
+
+/*! Removes the oldest value inside a transaction; returns -1 if empty */
+M_PQUEUE_SAFE
+static inline int
+m_pqueue_tx_dequeue(m_pqueue_t *queue, uint64_t *value)
+{
+	uint64_t head = queue->head;
+
+	if (head == queue->tail) {
+		return -1;
+	}
+	*value = queue->slots[head & queue->mask];
+	queue->head = head + 1;
+	return 0;
+}
+
+
+/*!
+ * Appends value outside transactions (single producer); returns -1 if
+ * the queue is full. The slot is written back before the tail that
+ * publishes it, so recovery never sees a tail covering a lost slot.
+ */
+static inline int
+m_pqueue_enqueue(m_pqueue_t *queue, uint64_t value)
+{
+	uint64_t tail = queue->tail;
+	uint64_t *slot;
+
+	if (tail - __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE) > queue->mask) {
+		return -1;
+	}
+	slot = &queue->slots[tail & queue->mask];
+	*slot = value;
+	m_pflush(slot, sizeof(*slot));
+	m_pfence();
+	__atomic_store_n(&queue->tail, tail + 1, __ATOMIC_RELEASE);
+	m_pflush(&queue->tail, sizeof(queue->tail));
+	m_pfence();
+	return 0;
+}
+
+
+/*!
+ * Removes the oldest value outside transactions (single consumer);
+ * returns -1 if the queue is empty.
+ */
+static inline int
+m_pqueue_dequeue(m_pqueue_t *queue, uint64_t *value)
+{
+	uint64_t head = queue->head;
+
+	if (head == __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE)) {
+		return -1;
+	}
+	*value = queue->slots[head & queue->mask];
+	__atomic_store_n(&queue->head, head + 1, __ATOMIC_RELEASE);
+	m_pflush(&queue->head, sizeof(queue->head));
+	m_pfence();
+	return 0;
+}
+
+# ifdef __cplusplus
+}
+# endif
+
+#endif /* end of include guard: MNEMOSYNE_PQUEUE_H_8JD3MV1C */
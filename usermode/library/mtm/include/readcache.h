@@ -0,0 +1,199 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/**
+ * \file
+ *
+ * \brief DRAM read cache for designated persistent regions.
+ *
+ * Each registered region has a volatile shadow mapping of the same size. 
+ * Pages of it are filled from persistent memory on a transactional read 
+ * miss and then serve the reads of the region; commits write back to both 
+ * persistent memory and resident shadow pages before dropping their locks, 
+ * so the usual lock version validation covers reads from the shadow too. 
+ * Residency is bounded by read_cache_mb and managed with a CLOCK 
+ * approximation of LRU. Nothing is persistent: the cache refills lazily 
+ * after a restart.
+ *
+ * A page's state word holds its state in the low bits and counts state 
+ * transitions in the rest. A reader uses the shadow only if the word read 
+ * before and after the load is the same and says RESIDENT. A page's writers 
+ * word counts write-backs started (high half) and in progress (low half); 
+ * a fill whose copy overlapped a write-back does not make the page 
+ * resident.
+ */
+
+#ifndef _M_READCACHE_H_KLE102
+#define _M_READCACHE_H_KLE102
+
+#include <stdint.h>
+#include <stddef.h>
+#include "mtm_i.h"
+
+#define MTM_READCACHE_MAX_REGIONS  16
+#define MTM_READCACHE_PAGE_SHIFT   12
+#define MTM_READCACHE_PAGE_SIZE    (1UL << MTM_READCACHE_PAGE_SHIFT)
+
+#define MTM_READCACHE_INVALID      0x0
+#define MTM_READCACHE_FILLING      0x1
+#define MTM_READCACHE_RESIDENT     0x2
+#define MTM_READCACHE_STATE_MASK   0x3
+#define MTM_READCACHE_EPOCH_INC    0x4
+
+#define MTM_READCACHE_WRITER_START ((1ULL << 32) | 1)
+#define MTM_READCACHE_WRITERS_MASK 0xFFFFFFFFULL
+
+typedef struct mtm_readcache_page_s mtm_readcache_page_t;
+typedef struct mtm_readcache_region_s mtm_readcache_region_t;
+
+struct mtm_readcache_page_s {
+	volatile uint64_t state;      /**< state and transition count */
+	volatile uint64_t writers;    /**< write-backs started and in progress */
+	volatile uint32_t referenced; /**< read since the CLOCK hand last passed */
+	uint32_t          pad;
+};
+
+struct mtm_readcache_region_s {
+	uintptr_t            start;
+	uintptr_t            size;
+	char                 *shadow;
+	mtm_readcache_page_t *pages;
+	uint64_t             npages;
+};
+
+extern volatile int           mtm_readcache_nregions;
+extern mtm_readcache_region_t mtm_readcache_regions[MTM_READCACHE_MAX_REGIONS];
+
+int mtm_readcache_register(void *addr, size_t size);
+void mtm_readcache_invalidate(const void *addr, size_t size);
+void mtm_readcache_fill(mtm_readcache_region_t *region, mtm_readcache_page_t *page);
+
+
+static inline
+mtm_readcache_region_t *
+mtm_readcache_region(uintptr_t a)
+{
+	mtm_readcache_region_t *r;
+	int                    i;
+	int                    n = mtm_readcache_nregions;
+
+	for (i = 0; i < n; i++) {
+		r = &mtm_readcache_regions[i];
+		if (a - r->start < r->size) {
+			return r;
+		}
+	}
+	return NULL;
+}
+
+
+/**
+ * \brief Reads a word of a cached region from its shadow page.
+ *
+ * Returns 0 if the page is not resident, after trying to fill it when 
+ * may_fill is set; the caller then reads persistent memory.
+ */
+static inline
+int
+mtm_readcache_load(volatile mtm_word_t *addr, mtm_word_t *valuep, int may_fill)
+{
+	mtm_readcache_region_t *r = mtm_readcache_region((uintptr_t) addr);
+	mtm_readcache_page_t   *pg;
+	uintptr_t              off;
+	uint64_t               s1;
+	mtm_word_t             v;
+
+	if (r == NULL) {
+		return 0;
+	}
+	off = (uintptr_t) addr - r->start;
+	pg = &r->pages[off >> MTM_READCACHE_PAGE_SHIFT];
+	s1 = pg->state;
+	if ((s1 & MTM_READCACHE_STATE_MASK) != MTM_READCACHE_RESIDENT) {
+		if (may_fill) {
+			mtm_readcache_fill(r, pg);
+		}
+		return 0;
+	}
+	v = *(volatile mtm_word_t *) (r->shadow + off);
+	/* x86 keeps loads in order; keep the compiler from reordering them */
+	__asm__ __volatile__ ("" ::: "memory");
+	if (pg->state != s1) {
+		return 0;
+	}
+	if (!pg->referenced) {
+		pg->referenced = 1;
+	}
+	*valuep = v;
+	return 1;
+}
+
+
+/**
+ * \brief Announces a write-back to a word of a cached region.
+ *
+ * Returns the page to pass to mtm_readcache_write_end, or NULL if addr is 
+ * not cached. *shadowp is set to the shadow copy of the word if it must be 
+ * written too, else to NULL.
+ */
+static inline
+mtm_readcache_page_t *
+mtm_readcache_write_begin(volatile mtm_word_t *addr, volatile mtm_word_t **shadowp)
+{
+	mtm_readcache_region_t *r = mtm_readcache_region((uintptr_t) addr);
+	mtm_readcache_page_t   *pg;
+	uintptr_t              off;
+
+	if (r == NULL) {
+		return NULL;
+	}
+	off = (uintptr_t) addr - r->start;
+	pg = &r->pages[off >> MTM_READCACHE_PAGE_SHIFT];
+	/* A locked add is a full barrier: the state is read after it */
+	__sync_fetch_and_add(&pg->writers, MTM_READCACHE_WRITER_START);
+	if ((pg->state & MTM_READCACHE_STATE_MASK) != MTM_READCACHE_INVALID) {
+		*shadowp = (volatile mtm_word_t *) (r->shadow + off);
+	} else {
+		*shadowp = NULL;
+	}
+	return pg;
+}
+
+
+static inline
+void
+mtm_readcache_write_end(mtm_readcache_page_t *pg)
+{
+	__sync_fetch_and_sub(&pg->writers, 1);
+}
+
+#endif /* _M_READCACHE_H_KLE102 */
@@ -40,6 +40,7 @@
 #ifndef _M_STATS_H
 #define _M_STATS_H
 
+#include <stdint.h>
 #include "result.h"
 
 /* 
@@ -64,7 +65,47 @@
   ACTION(nvwrites_distinct)                                                 \
   ACTION(vwrites)                                                           \
   ACTION(vwrites_distinct)                                                  \
-  ACTION(wbflush)                                                            
+  ACTION(wbflush)                                                           \
+  ACTION(wbstream)                                                          \
+  ACTION(nvwrite_bytes)                                                     \
+  ACTION(log_bytes)                                                         \
+  ACTION(trunc_bytes)                                                       \
+  ACTION(fences)                                                            \
+  ACTION(rsfilter_hits)                                                     \
+  ACTION(rsfilter_false_positives)                                          \
+  ACTION(aborts_locked)                                                     \
+  ACTION(aborts_locked_aliased)                                             \
+  ACTION(serial_fallbacks)                                                  \
+  ACTION(sched_queued)                                                      \
+  ACTION(serial_starts)                                                     \
+  ACTION(irrevocable_upgrades)                                              \
+  ACTION(htm_commits)                                                       \
+  ACTION(htm_aborts)                                                        \
+  ACTION(nested_restarts)                                                   \
+  ACTION(readonly_demotions)                                                \
+  ACTION(locked_reads)                                                      \
+  ACTION(captured_writes)
+
+
+/** 
+ * Phases of the commit of an update transaction, in the order they run. 
+ * With the stats_commit_phases setting each is timed in cycles into a 
+ * per-thread histogram.
+ */
+#define FOREACH_COMMIT_PHASE(ACTION)                                        \
+  ACTION(validate)                                                          \
+  ACTION(log_commit)                                                        \
+  ACTION(writeback)                                                         \
+  ACTION(lock_release)                                                      \
+  ACTION(persist_barrier)                                                   \
+  ACTION(truncate)
+
+typedef enum {
+#define PHASEENTRY(name) m_stats_##name##_phase,
+	FOREACH_COMMIT_PHASE (PHASEENTRY)
+#undef PHASEENTRY
+	m_stats_numofphases
+} m_stats_commit_phase_t;
 
 
 #ifdef _M_STATS_BUILD
@@ -100,7 +141,8 @@ typedef enum {
 	m_stats_numofstats
 } m_stats_statentry_t; 
 
-typedef unsigned int m_stats_statcounter_t;
+/* Wide enough for the byte counts of a whole run */
+typedef unsigned long long m_stats_statcounter_t;
 typedef struct m_stats_threadstat_s m_stats_threadstat_t;
 typedef struct m_statsmgr_s m_statsmgr_t;
 typedef struct m_stats_statset_s m_stats_statset_t;
@@ -119,6 +161,7 @@ struct m_stats_stat_s
 /**Statistics set */
 struct m_stats_statset_s {
 	const char             *name;       /**< Name tag. */
+	uintptr_t              site;        /**< Call site of the transaction begin, which tells unnamed transactions apart (0 if unknown). */
 	m_stats_statcounter_t  count;       /**< Number of instances. */
 	m_stats_stat_t         stats[m_stats_numofstats]; /**< Statistics collection. */
 }; 
@@ -214,13 +257,20 @@ FOREACH_VOIDSTATPROBE (GENERATE_VOIDSTATPROBES)
                                             val);
 
 
-m_result_t m_statsmgr_create(m_statsmgr_t **statsmgrp, char *output_file);
+m_result_t m_statsmgr_create(m_statsmgr_t **statsmgrp, char *output_file, unsigned int conflict_sampling, int commit_phases);
 m_result_t m_statsmgr_destroy(m_statsmgr_t **statsmgrp);
+m_result_t m_statsmgr_abort_stacks(m_statsmgr_t *statsmgr, char *output_file, unsigned int sampling);
 m_result_t m_stats_threadstat_create(m_statsmgr_t *statsmgr, unsigned int tid, m_stats_threadstat_t **threadstatp);
 m_result_t m_stats_statset_create(m_stats_statset_t **statsetp);
 m_result_t m_stats_statset_destroy(m_stats_statset_t **statsetp);
 m_result_t m_stats_statset_init(m_stats_statset_t *statset, const char *name);
+m_stats_statset_t *m_stats_threadstat_statset(m_stats_threadstat_t *threadstat);
 void m_stats_threadstat_aggregate(m_stats_threadstat_t *threadstat, m_stats_statset_t *source_statset);
+void m_stats_threadstat_commit_phases(m_stats_threadstat_t *threadstat, const uint64_t *ts);
+void m_stats_threadstat_conflict(m_stats_threadstat_t *threadstat, uintptr_t site, uintptr_t lock_idx, uintptr_t addr, const char *reason);
+void m_stats_threadstat_abort(m_stats_threadstat_t *threadstat, const char *reason, uintptr_t owner);
 void m_stats_print(m_statsmgr_t *statsmgr);
+m_result_t m_statsmgr_export_start(m_statsmgr_t *statsmgr, char *export_file, char *format, unsigned int period_ms);
+void m_statsmgr_export_stop(m_statsmgr_t *statsmgr);
 
 #endif /* _M_STATS_H */
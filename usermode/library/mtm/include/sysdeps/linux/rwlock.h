@@ -39,14 +39,35 @@
 #ifndef MTM_RWLOCK_H_AGH190
 #define MTM_RWLOCK_H_AGH190
 
+#include <stdint.h>
+#include <pthread.h>
+#include "sysdeps/x86/target.h"
+
+/*
+ * Reader-writer lock biased towards readers. Each reader increments a 
+ * counter in a cache-line-sized slot picked per thread, so read acquisition
+ * only touches a line shared with the few threads that hash to the same 
+ * slot. A writer announces itself and waits for all slots to drain.
+ */
+#define MTM_RWLOCK_READER_SLOTS 64
+
+typedef struct {
+	volatile uintptr_t count;
+	char               pad[CACHELINE_SIZE - sizeof(uintptr_t)];
+} mtm_rwlock_slot_t;
+
 typedef struct {
-	//TODO: fields
+	mtm_rwlock_slot_t  readers[MTM_RWLOCK_READER_SLOTS]; /* Active readers per slot */
+	volatile uintptr_t writer;                           /* Set while a writer holds or waits for the lock */
+	pthread_mutex_t    writer_mutex;                     /* Serializes writers */
 } mtm_rwlock_t;
 
 extern int mtm_rwlock_init (mtm_rwlock_t *);
 extern int mtm_rwlock_rdlock (mtm_rwlock_t *);
 extern int mtm_rwlock_wrlock (mtm_rwlock_t *);
 extern int mtm_rwlock_trywrlock (mtm_rwlock_t *);
-extern int mtm_rwlock_unlock (mtm_rwlock_t *);
+extern int mtm_rwlock_upgrade (mtm_rwlock_t *);
+extern int mtm_rwlock_read_unlock (mtm_rwlock_t *);
+extern int mtm_rwlock_write_unlock (mtm_rwlock_t *);
 
 #endif /* MTM_RWLOCK_H_AGH190 */
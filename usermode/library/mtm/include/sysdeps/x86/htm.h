@@ -0,0 +1,105 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/**
+ * \file
+ * Restricted Transactional Memory (RTM) primitives.
+ *
+ * The instructions are emitted by their encoding so that the library does
+ * not need to be built with -mrtm; callers must check mtm_htm_available
+ * before using them.
+ */
+
+#ifndef HTM_H_RT7LQ2PA
+#define HTM_H_RT7LQ2PA
+
+#include <stddef.h>
+#include <stdint.h>
+#include <cpuid.h>
+
+#define HTM_STARTED              (~0u)
+
+/* Abort status bits (EAX after an abort) */
+#define HTM_ABORT_EXPLICIT       (1 << 0)
+#define HTM_ABORT_RETRY          (1 << 1)
+#define HTM_ABORT_CONFLICT       (1 << 2)
+#define HTM_ABORT_CAPACITY       (1 << 3)
+#define HTM_ABORT_CODE(status)   (((status) >> 24) & 0xff)
+
+/* Codes passed to htm_abort by the STM */
+#define HTM_CODE_LOCKED          0x01   /* Found a lock owned by another transaction */
+#define HTM_CODE_RESTART         0x02   /* Transaction needs the software path */
+
+static inline unsigned int
+htm_begin(void)
+{
+	unsigned int status = HTM_STARTED;
+
+	/* xbegin with the fallback address right after the instruction */
+	__asm__ __volatile__ (".byte 0xc7,0xf8 ; .long 0" : "+a" (status) :: "memory");
+	return status;
+}
+
+static inline void
+htm_end(void)
+{
+	/* xend */
+	__asm__ __volatile__ (".byte 0x0f,0x01,0xd5" ::: "memory");
+}
+
+#define htm_abort(code)                                                        \
+	__asm__ __volatile__ (".byte 0xc6,0xf8,%P0" :: "i" (code) : "memory")
+
+/* Returns nonzero inside a hardware transaction */
+static inline int
+htm_test(void)
+{
+	unsigned char active;
+
+	/* xtest clears ZF inside a transaction */
+	__asm__ __volatile__ (".byte 0x0f,0x01,0xd6 ; setnz %0" : "=q" (active) :: "memory", "cc");
+	return active;
+}
+
+static inline int
+htm_cpu_has_rtm(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if (__get_cpuid_max(0, NULL) < 7) {
+		return 0;
+	}
+	__cpuid_count(7, 0, eax, ebx, ecx, edx);
+	return (ebx >> 11) & 1;
+}
+
+#endif /* HTM_H_RT7LQ2PA */
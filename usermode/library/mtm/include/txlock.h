@@ -47,31 +47,76 @@
 #undef pthread_rwlock_unlock
 
 
-//FIXME: These locks are not deadlock safe -- need to 
-//drop locks if can't get a lock to avoid deadlock
-//See Volos Transact 08
+/*
+ * Locks taken inside a transaction are released when it commits, so two 
+ * transactions that take locks in different orders could deadlock (see 
+ * Volos Transact 08). Inside a retryable transaction a lock is therefore 
+ * only tried for a while: if it stays held, the transaction restarts, and
+ * rolling it back drops the locks it took. An irrevocable transaction, or
+ * code outside transactions, blocks on the lock.
+ */
+
+#include <errno.h>
+#include <pthread.h>
 
+/* itm.h names the transaction descriptor, which applications see as opaque */
+typedef struct mtm_tx_s mtm_tx_t;
 #include <itm.h>
-#include <pthread.h>
 
 #define DEBUG_PRINTF(format, ...)
 //#define DEBUG_PRINTF(format, a, b) printf(format, a, b)
 
+/* Attempts on a held lock before a retryable transaction restarts */
+#define M_TXLOCK_TRIES 1024
+
+
+__attribute__((transaction_pure))
+static inline
+int m_txlock_try_or_restart(int tries)
+{
+	if (tries < M_TXLOCK_TRIES) {
+		__asm__ __volatile__("pause" ::: "memory");
+		return tries + 1;
+	}
+	_ITM_abortTransaction(userRetry, NULL);
+	return 0;
+}
+
+
 /* MUTEX TXSAFE LOCKS */
 
-typedef pthread_mutex_t m_txmutex_t;
+/*
+ * Outside transactions, on CPUs with RTM, a mutex is elided: the critical
+ * section runs as a hardware transaction that only reads depth, so 
+ * critical sections on different data run in parallel, and it takes the
+ * mutex itself after lock_elision_attempts aborts. A mutex whose elisions
+ * fail skips elision for elide_penalty acquisitions, which doubles with 
+ * every failed round and halves with every elided section that commits.
+ */
+typedef struct m_txmutex_s {
+	pthread_mutex_t mutex;
+	volatile int    depth;         /* Times held through the mutex itself */
+	int             elide_skip;    /* Acquisitions left that take the mutex without eliding */
+	int             elide_penalty; /* elide_skip after the next failed round */
+} m_txmutex_t;
 
 void _ITM_CALL_CONVENTION m_txmutex_unlock_commit_action(void *arg);
+int m_txmutex_elide(m_txmutex_t *txmutex) __attribute__((transaction_pure));
+int m_txmutex_elide_end(m_txmutex_t *txmutex) __attribute__((transaction_pure));
 
 
 __attribute__((transaction_pure))
 static inline 
 int m_txmutex_init(m_txmutex_t *txmutex)
 {
-	pthread_mutex_t *mutex = (pthread_mutex_t *) txmutex;
+	pthread_mutex_t *mutex = &txmutex->mutex;
 	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
 	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
 
+	txmutex->depth = 0;
+	txmutex->elide_skip = 0;
+	txmutex->elide_penalty = 0;
 	return pthread_mutex_init(mutex, &attr);
 }
 
@@ -80,7 +125,7 @@ __attribute__((transaction_pure))
 static inline 
 int m_txmutex_destroy(m_txmutex_t *txmutex)
 {
-	pthread_mutex_t *mutex = (pthread_mutex_t *) txmutex;
+	pthread_mutex_t *mutex = &txmutex->mutex;
 
 	return pthread_mutex_destroy(mutex);
 }
@@ -93,47 +138,50 @@ __attribute__((transaction_pure))
 static inline 
 int m_txmutex_lock(m_txmutex_t *txmutex)
 {
-	pthread_mutex_t *mutex = (pthread_mutex_t *) txmutex;
+	pthread_mutex_t *mutex = &txmutex->mutex;
+	_ITM_howExecuting how = _ITM_inTransaction();
 	int ret;
+	int tries = 0;
 
 	DEBUG_PRINTF("[%d] NOW  : MUTEX  LOCK   %p\n", pthread_self(), mutex);
-	ret = pthread_mutex_lock(mutex);
+	if (how == inRetryableTransaction) {
+		while ((ret = pthread_mutex_trylock(mutex)) == EBUSY) {
+			tries = m_txlock_try_or_restart(tries);
+		}
+		if (ret == 0) {
+			txmutex->depth++;
+			_ITM_addUserUndoAction(m_txmutex_unlock_commit_action, txmutex);
+		}
+	} else if (how == outsideTransaction && m_txmutex_elide(txmutex)) {
+		ret = 0;
+	} else {
+		ret = pthread_mutex_lock(mutex);
+		if (ret == 0) {
+			txmutex->depth++;
+		}
+	}
 	DEBUG_PRINTF("[%d] NOW  : MUTEX  LOCK   %p DONE\n", pthread_self(), mutex);
 
 	return ret;
 }
 
 
-void _ITM_CALL_CONVENTION m_txmutex_unlock_commit_action_local(void *arg)
-{
-	m_txmutex_t *txmutex = (m_txmutex_t *) arg;
-	pthread_mutex_t *mutex = (pthread_mutex_t *) txmutex;
-
-	//printf("[%d] COMMIT: MUTEX  UNLOCK %p\n", pthread_self(), mutex);
-	pthread_mutex_unlock(mutex);
-
-	return;
-}
-
-
-
 __attribute__((transaction_pure))
 static inline 
 int m_txmutex_unlock(m_txmutex_t *txmutex)
 {
 	int             ret;
-	pthread_mutex_t *mutex = (pthread_mutex_t *) txmutex;
-
-	_ITM_transaction * td;
-	td = _ITM_getTransaction();
+	pthread_mutex_t *mutex = &txmutex->mutex;
 
 	if (_ITM_inTransaction() > 0) {
 		DEBUG_PRINTF("[%d] DEFER: MUTEX  UNLOCK %p\n", pthread_self(), mutex);
-		_ITM_addUserCommitAction (m_txmutex_unlock_commit_action_local, 2, txmutex);
-		//_ITM_addUserCommitAction (td, m_txmutex_unlock_commit_action_local, 2, txmutex);
+		_ITM_addUserCommitAction (m_txmutex_unlock_commit_action, 2, txmutex);
+		ret = 0;
+	} else if (m_txmutex_elide_end(txmutex)) {
 		ret = 0;
 	} else {
 		DEBUG_PRINTF("[%d] NOW  : MUTEX  UNLOCK %p\n", pthread_self(), mutex);
+		txmutex->depth--;
 		ret = pthread_mutex_unlock (mutex);
 	}
 
@@ -142,7 +190,16 @@ int m_txmutex_unlock(m_txmutex_t *txmutex)
 
 /* READER/WRITER TXSAFE LOCKS */
 
-typedef pthread_rwlock_t m_txrwlock_t;
+/*
+ * Readers share the lock. The writer may lock it again, for reading or 
+ * writing, as a transaction that unlocks and relocks it still holds it 
+ * until it commits.
+ */
+typedef struct m_txrwlock_s {
+	pthread_rwlock_t    rwlock;
+	volatile pthread_t  writer;  /* Thread holding the lock for writing */
+	int                 depth;   /* Number of times the writer holds it */
+} m_txrwlock_t;
 
 void _ITM_CALL_CONVENTION m_txrwlock_unlock_commit_action(void *arg);
 
@@ -151,9 +208,9 @@ __attribute__((transaction_pure))
 static inline 
 int m_txrwlock_init(m_txrwlock_t *txrwlock)
 {
-	pthread_rwlock_t *rwlock = (pthread_rwlock_t *) txrwlock;
-
-	return pthread_rwlock_init(rwlock, NULL);
+	txrwlock->writer = 0;
+	txrwlock->depth = 0;
+	return pthread_rwlock_init(&txrwlock->rwlock, NULL);
 }
 
 
@@ -161,9 +218,38 @@ __attribute__((transaction_pure))
 static inline 
 int m_txrwlock_destroy(m_txrwlock_t *txrwlock)
 {
-	pthread_rwlock_t *rwlock = (pthread_rwlock_t *) txrwlock;
+	return pthread_rwlock_destroy(&txrwlock->rwlock);
+}
+
+
+__attribute__((transaction_pure))
+static inline 
+int m_txrwlock_lock(m_txrwlock_t *txrwlock, int write)
+{
+	pthread_rwlock_t *rwlock = &txrwlock->rwlock;
+	int              ret;
+	int              tries = 0;
 
-	return pthread_rwlock_destroy(rwlock);
+	if (txrwlock->depth > 0 && pthread_equal(txrwlock->writer, pthread_self())) {
+		txrwlock->depth++;
+		ret = 0;
+	} else if (_ITM_inTransaction() == inRetryableTransaction) {
+		while ((ret = write ? pthread_rwlock_trywrlock(rwlock) 
+		                    : pthread_rwlock_tryrdlock(rwlock)) == EBUSY) 
+		{
+			tries = m_txlock_try_or_restart(tries);
+		}
+	} else {
+		ret = write ? pthread_rwlock_wrlock(rwlock) : pthread_rwlock_rdlock(rwlock);
+	}
+	if (ret == 0 && write && txrwlock->depth == 0) {
+		txrwlock->writer = pthread_self();
+		txrwlock->depth = 1;
+	}
+	if (ret == 0 && _ITM_inTransaction() == inRetryableTransaction) {
+		_ITM_addUserUndoAction(m_txrwlock_unlock_commit_action, txrwlock);
+	}
+	return ret;
 }
 
 
@@ -171,14 +257,8 @@ __attribute__((transaction_pure))
 static inline 
 int m_txrwlock_rdlock(m_txrwlock_t *txrwlock)
 {
-	pthread_rwlock_t *rwlock = (pthread_rwlock_t *) txrwlock;
-
-	/* 
-	 * TODO: Support a thread re-locking a lock it owns as 
-	 * locks are not released till commit
-	 */
-	DEBUG_PRINTF("[%d] NOW  : RWLOCK RDLOCK %p\n", pthread_self(), rwlock);
-	return pthread_rwlock_rdlock(rwlock);
+	DEBUG_PRINTF("[%d] NOW  : RWLOCK RDLOCK %p\n", pthread_self(), txrwlock);
+	return m_txrwlock_lock(txrwlock, 0);
 }
 
 
@@ -186,14 +266,8 @@ __attribute__((transaction_pure))
 static inline 
 int m_txrwlock_wrlock(m_txrwlock_t *txrwlock)
 {
-	pthread_rwlock_t *rwlock = (pthread_rwlock_t *) txrwlock;
-
-	/* 
-	 * TODO: Support a thread re-locking a lock it owns as 
-	 * locks are not released till commit
-	 */
-	DEBUG_PRINTF("[%d] NOW  : RWLOCK WRLOCK %p\n", pthread_self(), rwlock);
-	return pthread_rwlock_wrlock(rwlock);
+	DEBUG_PRINTF("[%d] NOW  : RWLOCK WRLOCK %p\n", pthread_self(), txrwlock);
+	return m_txrwlock_lock(txrwlock, 1);
 }
 
 
@@ -201,19 +275,16 @@ __attribute__((transaction_pure))
 static inline 
 int m_txrwlock_unlock(m_txrwlock_t *txrwlock)
 {
-	int             ret;
-	pthread_rwlock_t *rwlock = (pthread_rwlock_t *) txrwlock;
-
-	_ITM_transaction * td;
-	td = _ITM_getTransaction();
+	int ret;
 
 	if (_ITM_inTransaction() > 0) {
-		DEBUG_PRINTF("[%d] DEFER: RWLOCK UNLOCK %p\n", pthread_self(), rwlock);
+		DEBUG_PRINTF("[%d] DEFER: RWLOCK UNLOCK %p\n", pthread_self(), txrwlock);
 		_ITM_addUserCommitAction (m_txrwlock_unlock_commit_action, 2, txrwlock);
 		ret = 0;
 	} else {
-		DEBUG_PRINTF("[%d] NOW  : RWLOCK UNLOCK %p\n", pthread_self(), rwlock);
-		ret = pthread_rwlock_unlock (rwlock);
+		DEBUG_PRINTF("[%d] NOW  : RWLOCK UNLOCK %p\n", pthread_self(), txrwlock);
+		m_txrwlock_unlock_commit_action(txrwlock);
+		ret = 0;
 	}
 
 	return ret;
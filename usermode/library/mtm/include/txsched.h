@@ -0,0 +1,191 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/**
+ * \file
+ *
+ * \brief Conflict-aware scheduling of transactions.
+ *
+ * Transactions that keep aborting each other over the same data are better
+ * run one after the other than retried against each other. Every conflict 
+ * restart counts a (call site, lock index) pair: the site of the outermost
+ * begin of the transaction that restarts, and the lock that made it 
+ * restart. Once a pair has been counted sched_threshold times, its site is
+ * hot and gets the lock's conflict class, one of MTM_SCHED_CLASSES FIFO 
+ * queues the lock index hashes to. A transaction of a hot site queues on 
+ * its class before it begins, and one that restarts because of a hot pair
+ * queues before it re-executes; it leaves the queue when it commits or 
+ * aborts. Transactions of two sites that conflict on a lock thus end up 
+ * in the queue of that lock, while those of other sites run as before. 
+ * Counters are halved every MTM_SCHED_DECAY_PERIOD conflicts, and sites 
+ * whose pair drops below the threshold cool down.
+ *
+ * A transaction holds at most one class, and never waits for one while 
+ * holding mtm_serial_lock, so queues cannot deadlock with each other or 
+ * with serial transactions. The tables are hints updated without locks: a
+ * race can only queue a transaction needlessly or let it run unqueued.
+ *
+ * Sites that abort over and over even so start serial instead. Each site
+ * keeps a decaying average of the retries its transactions needed to 
+ * commit; once it reaches serial_site_retries, the next serial_site_period
+ * transactions of the site begin holding mtm_serial_lock for writing, and
+ * so run alone without a single abort. Then the average is halved and the
+ * site runs optimistically again, to find out whether it still has to.
+ */
+
+#ifndef _M_TXSCHED_H_R81JQA
+#define _M_TXSCHED_H_R81JQA
+
+#include <stdint.h>
+#include "mtm_i.h"
+
+#define MTM_SCHED_PAIRS         4096   /* conflict counters (power of two) */
+#define MTM_SCHED_SITES         256    /* hot site slots (power of two) */
+#define MTM_SCHED_CLASSES       64     /* conflict class queues (power of two) */
+#define MTM_SCHED_DECAY_PERIOD  4096   /* conflicts between two decays */
+
+#define MTM_SCHED_SERIAL_SCALE  16     /* fixed point unit of the retry averages */
+#define MTM_SCHED_SERIAL_WEIGHT 8      /* 1/weight of a commit in the average */
+
+#define MTM_SCHED_HASH(x)       ((((uintptr_t) (x)) * 0x9E3779B97F4A7C15ULL) >> 32)
+
+typedef struct mtm_sched_site_s mtm_sched_site_t;
+typedef struct mtm_sched_queue_s mtm_sched_queue_t;
+typedef struct mtm_sched_serial_s mtm_sched_serial_t;
+
+struct mtm_sched_site_s {
+	volatile uintptr_t site;      /**< call site (0 if the slot is free) */
+	volatile uint32_t  pair;      /**< counter of the pair that made it hot */
+	volatile int32_t   klass;     /**< conflict class its transactions queue on */
+};
+
+struct mtm_sched_queue_s {
+	volatile uint32_t  next;      /**< next ticket */
+	volatile uint32_t  serving;   /**< ticket of the holder */
+} __attribute__((aligned(CACHELINE_SIZE)));
+
+struct mtm_sched_serial_s {
+	volatile uintptr_t site;      /**< call site (0 if the slot is free) */
+	volatile uint32_t  retries;   /**< average retries per commit, in 1/MTM_SCHED_SERIAL_SCALE */
+	volatile int32_t   left;      /**< transactions left to start serial */
+};
+
+extern int                mtm_sched_threshold;
+extern int                mtm_sched_serial_retries;
+extern int                mtm_sched_serial_period;
+extern mtm_sched_site_t   mtm_sched_sites[MTM_SCHED_SITES];
+extern mtm_sched_serial_t mtm_sched_serial_sites[MTM_SCHED_SITES];
+
+int mtm_sched_conflict(mtm_tx_t *tx);
+void mtm_sched_acquire(mtm_tx_t *tx, int klass);
+void mtm_sched_release(mtm_tx_t *tx);
+int mtm_sched_serial_start(mtm_sched_serial_t *s);
+void mtm_sched_serial_commit(mtm_tx_t *tx);
+
+
+/* Conflict class of the transactions of site, or -1 if it is not hot */
+static inline
+int
+mtm_sched_site_class(uintptr_t site)
+{
+	mtm_sched_site_t *s = &mtm_sched_sites[MTM_SCHED_HASH(site) & (MTM_SCHED_SITES - 1)];
+	int              klass;
+
+	if (s->site != site) {
+		return -1;
+	}
+	klass = s->klass;
+	ATOMIC_MB_READ;
+	return s->site == site ? klass : -1;
+}
+
+
+/* 
+ * Called at the outermost begin of a transaction with isolation, before 
+ * it takes mtm_serial_lock: queues the transactions of a hot site.
+ */
+static inline
+void
+mtm_sched_begin(mtm_tx_t *tx)
+{
+	int klass;
+
+	if (mtm_sched_threshold > 0 && tx->site != 0 && tx->sched_class < 0 &&
+	    (klass = mtm_sched_site_class(tx->site)) >= 0)
+	{
+		mtm_sched_acquire(tx, klass);
+	}
+}
+
+
+/* Whether the outermost transaction beginning should start serial */
+static inline
+int
+mtm_sched_serial_begin(mtm_tx_t *tx)
+{
+	mtm_sched_serial_t *s;
+
+	if (mtm_sched_serial_retries == 0 || tx->site == 0) {
+		return 0;
+	}
+	s = &mtm_sched_serial_sites[MTM_SCHED_HASH(tx->site) & (MTM_SCHED_SITES - 1)];
+	return s->site == tx->site && s->left > 0 && mtm_sched_serial_start(s);
+}
+
+
+/* 
+ * Called when the outermost transaction commits, before its retries are 
+ * reset. One that ran alone from its begin tells nothing about contention.
+ */
+static inline
+void
+mtm_sched_serial_end(mtm_tx_t *tx)
+{
+	if (mtm_sched_serial_retries > 0 && tx->site != 0 && 
+	    !(tx->retries == 0 && (tx->serial & MTM_SERIAL_WRITE)))
+	{
+		mtm_sched_serial_commit(tx);
+	}
+}
+
+
+/* Called when the outermost transaction commits or aborts */
+static inline
+void
+mtm_sched_end(mtm_tx_t *tx)
+{
+	if (tx->sched_class >= 0) {
+		mtm_sched_release(tx);
+	}
+}
+
+#endif /* _M_TXSCHED_H_R81JQA */
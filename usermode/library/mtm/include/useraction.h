@@ -33,13 +33,57 @@
 #ifndef _USERACTION_H
 #define _USERACTION_H
 
+/* Number of actions a list holds before it spills into its arena */
+#define USERACTION_INLINE_SIZE 8
+
+typedef struct mtm_user_action_s      mtm_user_action_t;
 typedef struct mtm_user_action_list_s mtm_user_action_list_t;
 
-int mtm_useraction_list_alloc(mtm_user_action_list_t **listp);
-int mtm_useraction_list_free(mtm_user_action_list_t **listp);
-int mtm_useraction_clear(mtm_user_action_list_t *list);
+struct mtm_user_action_s
+{
+	_ITM_userCommitFunction  fn;
+	void                     *arg;
+};
+
+/*
+ * User actions, which also carry the pmalloc undo and pfree commit work, 
+ * are stored inline in the transaction descriptor. A list that outgrows
+ * its inline array spills into an arena owned by the thread; the arena 
+ * only ever grows and is kept across transactions, so adding an action 
+ * does not allocate once the thread has seen its largest transaction.
+ */
+struct mtm_user_action_list_s
+{
+	mtm_user_action_t *array;          /* inline_array, or arena once spilled */
+	int               nb_entries;      /* Number of entries */
+	int               size;            /* Size of array */
+	mtm_user_action_t inline_array[USERACTION_INLINE_SIZE];
+};
+
+void mtm_useraction_list_init(mtm_user_action_list_t *list);
+void mtm_useraction_list_fini(mtm_user_action_list_t *list);
 void mtm_useraction_list_run(mtm_user_action_list_t *list, int reverse);
+void mtm_useraction_list_rollback(mtm_user_action_list_t *list, int length, int run);
+void mtm_useraction_addUserPrecommitAction(mtm_tx_t * __td, _ITM_userCommitFunction fn, void *arg);
 void mtm_useraction_addUserCommitAction(mtm_tx_t * __td, _ITM_userCommitFunction fn, _ITM_transactionId tid, void *arg);
 void mtm_useraction_addUserUndoAction(mtm_tx_t * __td, const _ITM_userUndoFunction fn, void *arg);
 
+
+/* Run on every transaction begin; an arena the list spilled into is kept */
+static inline
+int
+mtm_useraction_clear(mtm_user_action_list_t *list)
+{
+	list->nb_entries = 0;
+	return 0;
+}
+
+
+static inline
+int
+mtm_useraction_list_length(mtm_user_action_list_t *list)
+{
+	return list->nb_entries;
+}
+
 #endif
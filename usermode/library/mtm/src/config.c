@@ -32,6 +32,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include "mtm_i.h"
 #include "config.h"
 
 mtm_config_t mtm_runtime_settings;
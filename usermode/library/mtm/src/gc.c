@@ -67,7 +67,21 @@
 #include "mtm_i.h"
 
 
-/* TODO: could be made much more efficient by allocating large chunks. */
+/*
+ * Each thread batches the blocks it frees into regions of GC_BATCH_SIZE
+ * blocks, tagged with the latest epoch at which one of them was freed. A
+ * region is reclaimed, running the release function of each block, once
+ * every active thread has started a transaction after that epoch. Freeing
+ * a block takes no allocation and no synchronization, and reclaimed 
+ * regions are kept for reuse; the minimum epoch is computed once per
+ * batch rather than once per block.
+ *
+ * Volatile blocks are released with free(). Persistent blocks are released
+ * with the pmalloc function that returns them to the volatile free lists
+ * (their persistent block maps were already updated by the transaction
+ * that freed them), so a transaction reading a node that another one just
+ * freed never sees it reallocated.
+ */
 
 /* ################################################################### *
  * DEFINES
@@ -76,11 +90,10 @@
 #define MAX_THREADS                     1024
 #define EPOCH_MAX                       (~(gc_word_t)0)
 
-#ifndef NO_PERIODIC_CLEANUP
-# ifndef CLEANUP_FREQUENCY
-#  define CLEANUP_FREQUENCY             1
-# endif /* ! CLEANUP_FREQUENCY */
-#endif /* ! NO_PERIODIC_CLEANUP */
+#ifndef GC_BATCH_SIZE
+# define GC_BATCH_SIZE                  64
+#endif /* ! GC_BATCH_SIZE */
+#define GC_MAX_SPARE_REGIONS            16
 
 
 /* ################################################################### *
@@ -96,12 +109,13 @@ enum {                                  /* Descriptor status */
 
 typedef struct mem_block {              /* Block of allocated memory */
   void *addr;                           /* Address of memory */
-  struct mem_block *next;               /* Next block */
+  void (*release)(void *);              /* Function returning it to its allocator */
 } mem_block_t;
 
-typedef struct mem_region {             /* A list of allocated memory blocks */
-  struct mem_block *blocks;             /* Memory blocks */
-  gc_word_t ts;                         /* Allocation timestamp */
+typedef struct mem_region {             /* A batch of freed memory blocks */
+  gc_word_t ts;                         /* Latest epoch the blocks were freed at */
+  int nb_blocks;                        /* Number of blocks */
+  mem_block_t blocks[GC_BATCH_SIZE];    /* Memory blocks */
   struct mem_region *next;              /* Next region */
 } mem_region_t;
 
@@ -109,15 +123,15 @@ typedef struct tm_thread {              /* Descriptor of an active thread */
   gc_word_t used;                       /* Is this entry used? */
   pthread_t thread;                     /* Thread descriptor */
   gc_word_t ts;                         /* Start timestamp */
-  mem_region_t *head;                   /* First memory region(s) assigned to thread */
-  mem_region_t *tail;                   /* Last memory region(s) assigned to thread */
-#ifndef NO_PERIODIC_CLEANUP
-  unsigned int frees;                   /* How many blocks have been freed? */
-#endif /* ! NO_PERIODIC_CLEANUP */
+  mem_region_t *head;                   /* Oldest region assigned to thread */
+  mem_region_t *tail;                   /* Region being filled */
+  mem_region_t *spare;                  /* Reclaimed regions kept for reuse */
+  int nb_spare;                         /* Number of spare regions */
 } tm_thread_t;
 
 static volatile tm_thread_t *threads;   /* Array of active threads */
 static volatile gc_word_t nb_threads;   /* Number of active threads */
+static volatile gc_word_t next_idx;     /* Entries handed out so far (never reused by index) */
 
 static gc_word_t (*current_epoch)();    /* Read the value of the current epoch */
 
@@ -139,26 +153,35 @@ static inline int gc_get_idx()
 #ifdef TLS
   return thread_idx;
 #else /* ! TLS */
-  return (int)pthread_getspecific(thread_idx);
+  return (int)(intptr_t)pthread_getspecific(thread_idx);
 #endif /* ! TLS */
 }
 
+/*
+ * Number of entries of the threads array that may be in use.
+ */
+static inline int gc_nb_entries()
+{
+  gc_word_t n = (gc_word_t)ATOMIC_LOAD(&next_idx);
+
+  return n < MAX_THREADS ? (int)n : MAX_THREADS;
+}
+
 /*
  * Compute a lower bound on the minimum start time of all active transactions.
  */
 static inline gc_word_t gc_compute_min(gc_word_t now)
 {
-  int i;
+  int i, n;
   gc_word_t min, ts;
   mtm_word_t used;
 
   PRINT_DEBUG("==> gc_compute_min(%d)\n", gc_get_idx());
 
   min = now;
-  for (i = 0; i < MAX_THREADS; i++) {
+  n = gc_nb_entries();
+  for (i = 0; i < n; i++) {
     used = (gc_word_t)ATOMIC_LOAD(&threads[i].used);
-    if (used == GC_NULL)
-      break;
     if (used != GC_BUSY)
       continue;
     /* Used entry */
@@ -173,36 +196,53 @@ static inline gc_word_t gc_compute_min(gc_word_t now)
 }
 
 /*
- * Free block list.
+ * Release the blocks of a region.
  */
-static inline void gc_clean_blocks(mem_block_t *mb)
+static inline void gc_clean_blocks(mem_region_t *mr)
 {
-  mem_block_t *next_mb;
-
-  while (mb != NULL) {
-    PRINT_DEBUG("==> free(%d,a=%p)\n", gc_get_idx(), mb->addr);
-    free(mb->addr);
-    next_mb = mb->next;
-    free(mb);
-    mb = next_mb;
+  int i;
+
+  for (i = 0; i < mr->nb_blocks; i++) {
+    PRINT_DEBUG("==> free(%d,a=%p)\n", gc_get_idx(), mr->blocks[i].addr);
+    mr->blocks[i].release(mr->blocks[i].addr);
   }
+  mr->nb_blocks = 0;
 }
 
 /*
- * Free region list.
+ * Release and free a region list.
  */
 static inline void gc_clean_regions(mem_region_t *mr)
 {
   mem_region_t *next_mr;
 
   while (mr != NULL) {
-    gc_clean_blocks(mr->blocks);
+    gc_clean_blocks(mr);
     next_mr = mr->next;
     free(mr);
     mr = next_mr;
   }
 }
 
+/*
+ * Get an empty region for a thread, reusing a reclaimed one if possible.
+ */
+static inline mem_region_t *gc_new_region(int idx)
+{
+  mem_region_t *mr;
+
+  if ((mr = threads[idx].spare) != NULL) {
+    threads[idx].spare = mr->next;
+    threads[idx].nb_spare--;
+  } else if ((mr = (mem_region_t *)malloc(sizeof(mem_region_t))) == NULL) {
+    perror("malloc");
+    exit(1);
+  }
+  mr->nb_blocks = 0;
+  mr->next = NULL;
+  return mr;
+}
+
 /*
  * Garbage-collect old data associated with a thread.
  */
@@ -212,22 +252,21 @@ void gc_cleanup_thread(int idx, gc_word_t min)
 
   PRINT_DEBUG("==> gc_cleanup_thread(%d,m=%lu)\n", idx, (unsigned long)min);
 
-  if (threads[idx].head == NULL) {
-    /* Nothing to clean up */
-    return;
-  }
-
-  while (min > threads[idx].head->ts) {
-    gc_clean_blocks(threads[idx].head->blocks);
-    mr = threads[idx].head->next;
-    free(threads[idx].head);
-    threads[idx].head = mr;
-    if(mr == NULL) {
-      /* All memory regions deleted */
-      threads[idx].tail = NULL;
-      break;
+  while ((mr = threads[idx].head) != NULL && min > mr->ts) {
+    gc_clean_blocks(mr);
+    threads[idx].head = mr->next;
+    if (threads[idx].nb_spare < GC_MAX_SPARE_REGIONS) {
+      mr->next = threads[idx].spare;
+      threads[idx].spare = mr;
+      threads[idx].nb_spare++;
+    } else {
+      free(mr);
     }
   }
+  if (threads[idx].head == NULL) {
+    /* All memory regions reclaimed */
+    threads[idx].tail = NULL;
+  }
 }
 
 /* ################################################################### *
@@ -252,11 +291,11 @@ void gc_init(gc_word_t (*epoch)())
     threads[i].used = GC_NULL;
     threads[i].ts = EPOCH_MAX;
     threads[i].head = threads[i].tail = NULL;
-#ifndef NO_PERIODIC_CLEANUP
-    threads[i].frees = 0;
-#endif /* ! NO_PERIODIC_CLEANUP */
+    threads[i].spare = NULL;
+    threads[i].nb_spare = 0;
   }
   nb_threads = 0;
+  next_idx = 0;
 #ifndef TLS
   if (pthread_key_create(&thread_idx, NULL) != 0) {
     fprintf(stderr, "Error creating thread local\n");
@@ -270,7 +309,7 @@ void gc_init(gc_word_t (*epoch)())
  */
 void gc_exit()
 {
-  int i;
+  int i, n;
 
   PRINT_DEBUG("==> gc_exit()\n");
 
@@ -280,18 +319,26 @@ void gc_exit()
     exit(1);
   }
   /* Clean up memory */
-  for (i = 0; i < MAX_THREADS; i++)
+  n = gc_nb_entries();
+  for (i = 0; i < n; i++) {
     gc_clean_regions(threads[i].head);
+    gc_clean_regions(threads[i].spare);
+  }
 
   free((void *)threads);
 }
 
 /*
  * Initialize thread-specific GC resources (to be called once by each thread).
+ *
+ * Wait-free: a thread takes a fresh entry with one fetch-and-increment
+ * while there are some left, and otherwise makes a single pass over the 
+ * entries released by threads that exited. A reused entry comes with the
+ * regions its previous thread left behind.
  */
 void gc_init_thread()
 {
-  int i, idx;
+  int i, idx = -1;
   gc_word_t used;
 
   PRINT_DEBUG("==> gc_init_thread()\n");
@@ -300,28 +347,31 @@ void gc_init_thread()
     fprintf(stderr, "Error: too many concurrent threads created\n");
     exit(1);
   }
-  /* Find entry in threads array */
-  i = 0;
-  /* TODO: not wait-free */
-  while (1) {
-    used = (gc_word_t)ATOMIC_LOAD(&threads[i].used);
-    if (used != GC_BUSY) {
-      if (ATOMIC_CAS_FULL(&threads[i].used, used, GC_BUSY) != 0) {
+  if ((gc_word_t)ATOMIC_LOAD(&next_idx) < MAX_THREADS &&
+      (i = (int)ATOMIC_FETCH_INC_FULL(&next_idx)) < MAX_THREADS) {
+    idx = i;
+    /* Sets lower bound to current time (transactions by this thread cannot happen before) */
+    ATOMIC_STORE(&threads[idx].ts, current_epoch());
+    ATOMIC_STORE(&threads[idx].used, GC_BUSY);
+  } else {
+    for (i = 0; i < MAX_THREADS; i++) {
+      used = (gc_word_t)ATOMIC_LOAD(&threads[i].used);
+      if ((used == GC_FREE_EMPTY || used == GC_FREE_FULL) &&
+          ATOMIC_CAS_FULL(&threads[i].used, used, GC_BUSY) != 0) {
         idx = i;
-        /* Sets lower bound to current time (transactions by this thread cannot happen before) */
         ATOMIC_STORE(&threads[idx].ts, current_epoch());
         break;
       }
-      /* CAS failed: anotehr thread must have acquired slot */
-      assert (threads[i].used != GC_NULL);
     }
-    if (++i >= MAX_THREADS)
-      i = 0;
+  }
+  if (idx < 0) {
+    fprintf(stderr, "Error: no free thread entry\n");
+    exit(1);
   }
 #ifdef TLS
   thread_idx = idx;
 #else /* ! TLS */
-  pthread_setspecific(thread_idx, (void *)idx);
+  pthread_setspecific(thread_idx, (void *)(intptr_t)idx);
 #endif /* ! TLS */
 
   PRINT_DEBUG("==> gc_init_thread(i=%d)\n", idx);
@@ -365,50 +415,48 @@ void gc_set_epoch(gc_word_t epoch)
 }
 
 /*
- * Free memory (the thread must indicate the current timestamp).
+ * Free memory with the given release function once no transaction that
+ * started before epoch is active (the thread must indicate the current 
+ * timestamp).
  */
-void gc_free(void *addr, gc_word_t epoch)
+void gc_free_fn(void *addr, void (*release)(void *), gc_word_t epoch)
 {
   mem_region_t *mr;
-  mem_block_t *mb;
   int idx = gc_get_idx();
 
   PRINT_DEBUG("==> gc_free(%d,%lu)\n", idx, (unsigned long)epoch);
 
-  if (threads[idx].head == NULL || threads[idx].head->ts < epoch) {
-    /* Allocate a new region */
-    if ((mr = (mem_region_t *)malloc(sizeof(mem_region_t))) == NULL) {
-      perror("malloc");
-      exit(1);
-    }
+  mr = threads[idx].tail;
+  if (mr == NULL || mr->nb_blocks == GC_BATCH_SIZE) {
+    mr = gc_new_region(idx);
     mr->ts = epoch;
-    mr->blocks = NULL;
-    mr->next = NULL;
-    if (threads[idx].head == NULL) {
+    if (threads[idx].tail == NULL) {
       threads[idx].head = threads[idx].tail = mr;
     } else {
       threads[idx].tail->next = mr;
       threads[idx].tail = mr;
     }
-  } else {
-    /* Add to current region */
-    mr = threads[idx].head;
-  }
-
-  /* Allocate block */
-  if ((mb = (mem_block_t *)malloc(sizeof(mem_block_t))) == NULL) {
-    perror("malloc");
-    exit(1);
+  } else if (mr->ts < epoch) {
+    mr->ts = epoch;
   }
-  mb->addr = addr;
-  mb->next = mr->blocks;
-  mr->blocks = mb;
+  mr->blocks[mr->nb_blocks].addr = addr;
+  mr->blocks[mr->nb_blocks].release = release;
 
 #ifndef NO_PERIODIC_CLEANUP
-  threads[idx].frees++;
-  if (threads[idx].frees % CLEANUP_FREQUENCY == 0)
+  /* Once per batch */
+  if (++mr->nb_blocks == GC_BATCH_SIZE)
     gc_cleanup();
-#endif /* ! NO_PERIODIC_CLEANUP */
+#else /* NO_PERIODIC_CLEANUP */
+  mr->nb_blocks++;
+#endif /* NO_PERIODIC_CLEANUP */
+}
+
+/*
+ * Free memory (the thread must indicate the current timestamp).
+ */
+void gc_free(void *addr, gc_word_t epoch)
+{
+  gc_free_fn(addr, free, epoch);
 }
 
 /*
@@ -438,14 +486,13 @@ void gc_cleanup()
  */
 void gc_cleanup_all()
 {
-  int i;
+  int i, n;
   gc_word_t min = EPOCH_MAX;
 
   PRINT_DEBUG("==> gc_cleanup_all()\n");
 
-  for (i = 0; i < MAX_THREADS; i++) {
-    if ((gc_word_t)ATOMIC_LOAD(&threads[i].used) == GC_NULL)
-      break;
+  n = gc_nb_entries();
+  for (i = 0; i < n; i++) {
     if ((gc_word_t)ATOMIC_LOAD(&threads[i].used) == GC_FREE_FULL) {
       if (ATOMIC_CAS_FULL(&threads[i].used, GC_FREE_FULL, GC_BUSY) != 0) {
         if (min == EPOCH_MAX)
@@ -463,20 +510,16 @@ void gc_cleanup_all()
  */
 void gc_reset()
 {
-  int i;
+  int i, n;
 
   PRINT_DEBUG("==> gc_reset()\n");
 
   assert(nb_threads == 0);
 
-  for (i = 0; i < MAX_THREADS; i++) {
-    if (threads[i].used == GC_NULL)
-      break;
+  n = gc_nb_entries();
+  for (i = 0; i < n; i++) {
     gc_clean_regions(threads[i].head);
     threads[i].ts = EPOCH_MAX;
     threads[i].head = threads[i].tail = NULL;
-#ifndef NO_PERIODIC_CLEANUP
-    threads[i].frees = 0;
-#endif /* ! NO_PERIODIC_CLEANUP */
   }
 }
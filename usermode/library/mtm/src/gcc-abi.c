@@ -37,26 +37,35 @@
  */
 
 #include "mtm_i.h"
+#include "mode/pwbetl/beginend.h"
+#include "mode/pwbetl/barrier.h"
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
 #include "init.h"
 #include "useraction.h"
+#include "mtm.h"
+#include <mnemosyne.h>
 #include <setjmp.h>
+#include <sched.h>
 
 extern void* mtm_pmalloc(size_t);
+extern void* mtm_pmalloc_from(void *, size_t);
 extern void* mtm_pmalloc_undo(size_t);
 extern void* mtm_pcalloc (size_t, size_t);
+extern int mtm_pmalloc_refill_defer (size_t);
+extern void mtm_pmalloc_refill (void*);
 extern void mtm_pfree (void*);
 extern void mtm_pfree_prepare (void*);
 extern void mtm_pfree_commit (void*);
+extern int mtm_pfree_defer (void*);
+extern void mtm_pfree_cancel (void*);
+extern void mtm_pfree_flush (void*);
 extern void* mtm_prealloc (void *, size_t);
 extern size_t mtm_get_obj_size(void*);
+extern void mtm_pwbetl_capture_range(mtm_tx_t *, const void *, size_t);
 
 
-struct clone_entry
-{
-  void *orig, *clone;
-};
-
 /* This is a list, not a table per se */
 struct clone_table
 {
@@ -67,8 +76,8 @@ struct clone_table
 
 static struct clone_table *all_tables;
 
-static void *
-find_clone (void *ptr)
+static struct clone_entry *
+find_clone_entry (void *ptr)
 {
   struct clone_table *table;
 
@@ -91,7 +100,7 @@ find_clone (void *ptr)
 	    lo = i + 1;
 	  else
 	    {
-	      return t[i].clone;
+	      return &t[i];
 	    }
 	}
 
@@ -103,27 +112,116 @@ find_clone (void *ptr)
 }
 
 
+/*
+ * Clone lookups are cached in two levels so that the common indirect call
+ * does not walk the table list. Both levels hold pointers to entries of the
+ * registered tables, which keeps a cache slot a single word that can be
+ * filled with one CAS. Only hits are cached: a miss may still turn into a
+ * hit when a library is loaded later.
+ *
+ * The global cache is open addressed with a bounded probe sequence; when
+ * all probed slots are taken the lookup simply goes uncached. The
+ * per-thread cache is direct mapped and validated against a generation
+ * number that _ITM_deregisterTMCloneTable bumps after clearing the global
+ * cache, since the entries it points to go away with the table.
+ */
+#define CLONE_CACHE_SIZE         1024   /* Must be a power of 2 */
+#define CLONE_CACHE_PROBES       8
+#define CLONE_LOCAL_CACHE_SIZE   64     /* Must be a power of 2 */
+
+static struct clone_entry *clone_cache[CLONE_CACHE_SIZE];
+static volatile unsigned long clone_cache_gen = 1;
+
+static __thread struct {
+  unsigned long gen;
+  struct clone_entry *entries[CLONE_LOCAL_CACHE_SIZE];
+} clone_local_cache;
+
+static inline size_t
+clone_cache_hash (void *ptr)
+{
+  return (size_t) (((uintptr_t) ptr >> 4) * 0x9E3779B97F4A7C15ULL >> 32);
+}
+
+static struct clone_entry *
+clone_cache_lookup (void *ptr, size_t h)
+{
+  struct clone_entry *e, *cur;
+  unsigned long gen;
+  size_t i, slot;
+
+  for (i = 0; i < CLONE_CACHE_PROBES; i++)
+    {
+      e = clone_cache[(h + i) & (CLONE_CACHE_SIZE - 1)];
+      if (e == NULL)
+	break;
+      if (e->orig == ptr)
+	return e;
+    }
+
+  if ((e = find_clone_entry (ptr)) == NULL)
+    return NULL;
+
+  gen = clone_cache_gen;
+  for (i = 0; i < CLONE_CACHE_PROBES; i++)
+    {
+      slot = (h + i) & (CLONE_CACHE_SIZE - 1);
+      if (__sync_bool_compare_and_swap (&clone_cache[slot], NULL, e))
+	{
+	  // A table was deregistered meanwhile and E may be gone with it 
+	  if (gen != clone_cache_gen)
+	    __sync_bool_compare_and_swap (&clone_cache[slot], e, NULL);
+	  break;
+	}
+      if ((cur = clone_cache[slot]) != NULL && cur->orig == ptr)
+	break;
+    }
+  return e;
+}
+
+static void *
+find_clone_cached (void *ptr)
+{
+  size_t h = clone_cache_hash (ptr);
+  struct clone_entry **local;
+  struct clone_entry *e;
+
+  if (clone_local_cache.gen != clone_cache_gen)
+    {
+      memset (clone_local_cache.entries, 0, sizeof (clone_local_cache.entries));
+      clone_local_cache.gen = clone_cache_gen;
+    }
+  local = &clone_local_cache.entries[h & (CLONE_LOCAL_CACHE_SIZE - 1)];
+  if ((e = *local) != NULL && e->orig == ptr)
+    return e->clone;
+
+  if ((e = clone_cache_lookup (ptr, h)) == NULL)
+    return NULL;
+  *local = e;
+  return e->clone;
+}
+
+
 void * _ITM_CALL_CONVENTION
 _ITM_getTMCloneOrIrrevocable (void *ptr)
 {
   // if the function (ptr) have a TM version, give the pointer to the TM function 
   // otherwise, set transaction to irrevocable mode
-	void *ret = find_clone (ptr);
+	void *ret = find_clone_cached (ptr);
 	if (ret)
 		return ret;
 
   //  TODO Check we are in an active transaction 
   //  if (stm_current_tx() != NULL && stm_is_active(tx))
   //  GCC always use implicit transaction descriptor 
-	mtm_tx_t *tx = mtm_get_tx();
-	tx->status = TX_IRREVOCABLE;
+	mtm_serialmode (false, true);
 	return ptr;
 }
 
 void * _ITM_CALL_CONVENTION
 _ITM_getTMCloneSafe (void *ptr)
 {
-  void *ret = find_clone(ptr);
+  void *ret = find_clone_cached (ptr);
   if (ret == NULL) {
     fprintf(stderr, "libitm: cannot find clone for %p\n", ptr);
     abort();
@@ -182,6 +280,10 @@ _ITM_deregisterTMCloneTable (void *xent)
     continue;
   *pprev = tab->next;
 
+  // Forget cached entries pointing into the table before it goes away 
+  memset (clone_cache, 0, sizeof (clone_cache));
+  __sync_fetch_and_add (&clone_cache_gen, 1);
+
   free (tab);
 }
 
@@ -202,11 +304,22 @@ uint32_t _ITM_CALL_CONVENTION MTM_begin_transaction(uint32_t attr, jmp_buf * buf
 		tx = mtm_init_thread();
 	}
 	assert(tx != NULL);
+	/* 
+	 * The checkpoint of arch.S starts with the stack pointer of the caller
+	 * of _ITM_beginTransaction, right above its return address.
+	 */
+	if (tx->nesting == 0) {
+		tx->site = ((uintptr_t *) *((uintptr_t *) buf))[-1];
+	}
 	ret = mtm_pwbetl_beginTransaction_internal(tx, attr, NULL, &env);
 
-  /* Save thread context only when outermost transaction */
-  	if (likely(env != NULL))
-		memcpy(env, buf, sizeof(jmp_buf)); /* TODO limit size to real size */
+	/* 
+	 * Save the thread context only for an outermost transaction, or a 
+	 * nested one with a savepoint, that may restart or be cancelled
+	 */
+	if (likely(env != NULL)) {
+		memcpy(env, buf, MTM_CHECKPOINT_SIZE);
+	}
   // freud : This is where you intialized the jump buffer. 
   // And then use a code like _ITM_siglongjmp to parse the buffer 
   // and jump to the appropriate routine.
@@ -214,6 +327,137 @@ uint32_t _ITM_CALL_CONVENTION MTM_begin_transaction(uint32_t attr, jmp_buf * buf
 	return ret;
 }
 
+/* Called by mtm_savepoint (sysdeps/x86/arch.S) with the caller's registers */
+int MTM_savepoint(jmp_buf * buf)
+{
+	mtm_tx_t *tx = mtm_get_tx();
+
+	if (tx == NULL || tx->status != TX_ACTIVE) {
+		return MTM_SAVEPOINT_NONE;
+	}
+	if (mtm_pwbetl_setSavepoint(tx, buf, MTM_SAVEPOINT_RETRY) != 0) {
+		return MTM_SAVEPOINT_NONE;
+	}
+	return MTM_SAVEPOINT_SET;
+}
+
+int mtm_rollback_to_savepoint(void)
+{
+	mtm_tx_t *tx = mtm_get_tx();
+
+	if (tx == NULL || tx->status != TX_ACTIVE) {
+		return -1;
+	}
+	return mtm_pwbetl_rollbackToSavepoint(tx, MTM_SAVEPOINT_ROLLBACK);
+}
+
+int mtm_release_savepoint(void)
+{
+	mtm_tx_t *tx = mtm_get_tx();
+
+	if (tx == NULL || tx->status != TX_ACTIVE) {
+		return -1;
+	}
+	return mtm_pwbetl_releaseSavepoint(tx);
+}
+
+void mtm_log_range(const void *addr, size_t size)
+{
+	mtm_tx_t *tx = mtm_get_tx();
+
+	if (tx == NULL || tx->status != TX_ACTIVE || size == 0) {
+		return;
+	}
+	mtm_pwbetl_log_range(tx, addr, size);
+}
+
+int mtm_logical_begin(unsigned int opcode, const void *args, size_t size)
+{
+	mtm_tx_t *tx = mtm_get_tx();
+
+	if (tx == NULL || tx->status != TX_ACTIVE) {
+		return -1;
+	}
+	return mtm_pwbetl_logical_begin(tx, opcode, args, size);
+}
+
+int mtm_logical_end(void)
+{
+	mtm_tx_t *tx = mtm_get_tx();
+
+	if (tx == NULL || tx->status != TX_ACTIVE) {
+		return -1;
+	}
+	return mtm_pwbetl_logical_end(tx);
+}
+
+int mtm_set_isolation(int enable)
+{
+	mtm_tx_t *tx = mtm_get_tx();
+	int      prev;
+
+	if (unlikely(tx == NULL)) {
+		tx = mtm_init_thread();
+	}
+	if (tx->nesting > 0) {
+		return -1;
+	}
+	prev = (tx->mode == MTM_MODE_pwbetl);
+	tx->mode = enable ? MTM_MODE_pwbetl : MTM_MODE_pwbnl;
+	return prev;
+}
+
+int mtm_set_snapshot_reads(int enable)
+{
+	mtm_tx_t *tx = mtm_get_tx();
+	int      prev;
+
+	if (unlikely(tx == NULL)) {
+		tx = mtm_init_thread();
+	}
+	if (tx->nesting > 0) {
+		return -1;
+	}
+	prev = tx->snapshot_reads;
+	tx->snapshot_reads = (enable != 0);
+	return prev;
+}
+
+void mtm_sync(void)
+{
+#ifndef SYNC_TRUNCATION
+	m_logtrunc_sync();
+#endif
+}
+
+uint64_t mtm_last_committed_sqn(void)
+{
+	mtm_tx_t *tx = mtm_get_tx();
+
+	return tx ? tx->last_sqn : 0;
+}
+
+void mtm_wait_durable(uint64_t sqn)
+{
+	/* Commits may take a timestamp ahead of the clock without advancing it */
+	mtm_clock_advance(sqn);
+	while (mtm_durable_sqn() < sqn) {
+		sched_yield();
+	}
+}
+
+int mtm_snapshot(const char *dir)
+{
+	int rv;
+
+	/* Serial transactions hold the lock for writing: none can be running */
+	mtm_rwlock_wrlock(&mtm_serial_lock);
+	mtm_sync();
+	rv = m_psnapshot(dir);
+	mtm_rwlock_write_unlock(&mtm_serial_lock);
+	return rv;
+}
+
 void _ITM_CALL_CONVENTION _ITM_abortTransaction(_ITM_abortReason __reason,
                               const _ITM_srcLocation *__src)
 {
@@ -267,7 +511,7 @@ _ITM_inTransaction ()
 {
 	mtm_tx_t *tx = mtm_get_tx();
 	if (tx && tx->status != TX_IDLE) {
-		if (tx->status & TX_IRREVOCABLE) {
+		if (tx->serial & MTM_SERIAL_IRREVOCABLE) {
 			return inIrrevocableTransaction;
 		} else {
 			return inRetryableTransaction;
@@ -281,7 +525,8 @@ _ITM_transactionId _ITM_CALL_CONVENTION
 _ITM_getTransactionId ()
 {
 	mtm_tx_t *tx = mtm_get_tx();
-	return tx ? tx->id : _ITM_noTransactionId;
+	/* Transactions are identified by their nesting level */
+	return (tx && tx->nesting > 0) ? _ITM_noTransactionId + tx->nesting : _ITM_noTransactionId;
 }
 
 
@@ -419,11 +664,8 @@ void _ITM_CALL_CONVENTION
 _ITM_changeTransactionMode(_ITM_transactionState __mode,
                            const _ITM_srcLocation * __loc)
 {
-	assert(0);
-	/* This mode is not implemented yet */
-	//TODO: Support compiler instructed switching of transaction execution mode
-	//assert (state == modeSerialIrrevocable);
-	//MTM_serialmode (false, true);
+	assert (__mode == modeSerialIrrevocable);
+	mtm_serialmode (false, true);
 }
 
 void * _ITM_malloc(size_t size)
@@ -454,11 +696,34 @@ out:
   return ptr;
 }   
 
+#ifdef EPOCH_GC
+/*
+ * Transactional frees are handed to the epoch collector when the freeing
+ * transaction commits, so that transactions that started before it and
+ * may still be reading the block never see it reused.
+ */
+static void
+free_commit_epoch (void *ptr)
+{
+  gc_free(ptr, GET_CLOCK);
+}
+
+static void
+pfree_commit_epoch (void *ptr)
+{
+  gc_free_fn(ptr, mtm_pfree_commit, GET_CLOCK);
+}
+#endif /* EPOCH_GC */
+
 void _ITM_free(void *ptr)
 {   
   mtm_tx_t *tx = mtm_get_tx();
   if (tx) {
+#ifdef EPOCH_GC
+    _ITM_addUserCommitAction(free_commit_epoch, tx->id, ptr);
+#else /* ! EPOCH_GC */
     _ITM_addUserCommitAction(free, tx->id, ptr);
+#endif /* ! EPOCH_GC */
     return;
   }
   free(ptr);
@@ -473,8 +738,31 @@ void * _ITM_pmalloc(size_t size)
 	goto out;
 
   mtm_tx_t *tx = mtm_get_tx();
-  if(tx)
+  if(tx) {
+	_ITM_addUserUndoAction(mtm_pmalloc_undo, ptr);
+	mtm_pwbetl_capture_range(tx, ptr, size);
+	/* The block cache is topped up once the write locks are released */
+	if (mtm_pmalloc_refill_defer(size)) {
+	  _ITM_addUserCommitAction(mtm_pmalloc_refill, tx->id, NULL);
+	}
+  }
+out:
+  return ptr;
+}
+
+_ITM_TRANSACTION_PURE
+void * _ITM_pmalloc_from(void *pool, size_t size)
+{
+  void *ptr = NULL;
+  ptr = mtm_pmalloc_from(pool, size);
+  if(!ptr)
+	goto out;
+
+  mtm_tx_t *tx = mtm_get_tx();
+  if(tx) {
 	_ITM_addUserUndoAction(mtm_pmalloc_undo, ptr);
+	mtm_pwbetl_capture_range(tx, ptr, size);
+  }
 out:
   return ptr;
 }
@@ -488,8 +776,13 @@ void * _ITM_pcalloc(size_t nm, size_t size)
 	goto out;
 
   mtm_tx_t *tx = mtm_get_tx();
-  if(tx)
-	_ITM_addUserUndoAction(mtm_pfree, ptr);
+  if(tx) {
+	_ITM_addUserUndoAction(mtm_pmalloc_undo, ptr);
+	mtm_pwbetl_capture_range(tx, ptr, nm * size);
+	if (mtm_pmalloc_refill_defer(nm * size)) {
+	  _ITM_addUserCommitAction(mtm_pmalloc_refill, tx->id, NULL);
+	}
+  }
 out:
   return ptr;
 }   
@@ -499,8 +792,16 @@ void _ITM_pfree(void *ptr)
 {   
   mtm_tx_t *tx = mtm_get_tx();
   if (tx) {
-    mtm_pfree_prepare(ptr);
+    /* The block maps are updated for the whole batch right before commit */
+    if (mtm_pfree_defer(ptr)) {
+      mtm_useraction_addUserPrecommitAction(tx, mtm_pfree_flush, NULL);
+    }
+    _ITM_addUserUndoAction(mtm_pfree_cancel, ptr);
+#ifdef EPOCH_GC
+    _ITM_addUserCommitAction(pfree_commit_epoch, tx->id, ptr);
+#else /* ! EPOCH_GC */
     _ITM_addUserCommitAction(mtm_pfree_commit, tx->id, ptr);
+#endif /* ! EPOCH_GC */
     return;
   }
   mtm_pfree(ptr);
@@ -526,6 +827,10 @@ void * _ITM_prealloc (void * ptr, size_t sz)
 	if(obj_size >= sz || obj_size == -1) 
 		return ptr;
 
+	/* Grow in place when the blocks following the object are free */
+	if(mtm_prealloc(ptr, sz))
+		return ptr;
+
 	assert(obj_size < sz);
 	void *buf = _ITM_pmalloc(sz);
 	_ITM_memcpyRtWt (buf, ptr, obj_size);
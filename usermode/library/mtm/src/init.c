@@ -55,17 +55,31 @@
 #include <execinfo.h>
 #include <signal.h>
 #include <pthread.h>
+#include <sys/mman.h>
+#include <mnemosyne.h>
 #include "mtm_i.h"
 #include "config.h"
 #include "locks.h"
 #include "mode/pwb-common/tmlog.h"
 #include "sysdeps/x86/target.h"
 #include "stats.h"
+#include "txsched.h"
+#include "mvstore.h"
+#include "mtm.h"
+#include "sysdeps/x86/htm.h"
 
 static pthread_mutex_t global_init_lock = PTHREAD_MUTEX_INITIALIZER;
 volatile uint32_t mtm_initialized = 0;
 static int global_num=0;
 
+/* Descriptors of the threads that may commit, scanned by mtm_durable_sqn */
+static pthread_mutex_t durable_list_lock = PTHREAD_MUTEX_INITIALIZER;
+static mtm_tx_t *durable_list = NULL;
+
+/* Descriptors released by mtm_tx_destroy, handed out again by mtm_tx_create */
+static pthread_mutex_t tx_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static mtm_tx_t *tx_pool = NULL;
+
 m_statsmgr_t *mtm_statsmgr;
 
 
@@ -99,6 +113,129 @@ signal_catcher(int sig)
 
 
 
+/*
+ * Allocates the global lock array using the size and stripe shift taken
+ * from the runtime settings. The array is the hottest shared structure of
+ * the STM and is accessed at random, so we back it with huge pages when 
+ * the system has them reserved, and otherwise ask for transparent huge 
+ * pages to keep TLB misses on the lock lookup low. On a NUMA system its 
+ * pages are interleaved over the nodes (lock_array_interleave), so that 
+ * the lock checks of every socket find half or more of the locks remote 
+ * rather than all of them on the node of the initializing thread.
+ */
+static
+void
+lock_array_alloc()
+{
+	size_t size;
+	void   *addr;
+
+	mtm_lock_array_log_size = mtm_runtime_settings.lock_array_log_size;
+	mtm_lock_shift = mtm_runtime_settings.lock_shift;
+	mtm_lock_mask = LOCK_ARRAY_SIZE - 1;
+	size = LOCK_ARRAY_SIZE * sizeof(mtm_word_t);
+
+#ifdef MAP_HUGETLB
+	addr = mmap(NULL, size, PROT_READ | PROT_WRITE, 
+	            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (addr == MAP_FAILED) 
+#endif /* MAP_HUGETLB */
+	{
+		addr = mmap(NULL, size, PROT_READ | PROT_WRITE, 
+		            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (addr == MAP_FAILED) {
+			perror("Error allocating lock array");
+			exit(1);
+		}
+#ifdef MADV_HUGEPAGE
+		madvise(addr, size, MADV_HUGEPAGE);
+#endif /* MADV_HUGEPAGE */
+	}
+	/* Before the first touch places the pages */
+	if (mtm_runtime_settings.lock_array_interleave && m_numa_nodes() > 1) {
+		m_numa_interleave(addr, size);
+	}
+	locks = (volatile mtm_word_t *) addr;
+	PRINT_DEBUG("\tLOCK_ARRAY_SIZE=%lu LOCK_SHIFT=%u\n", 
+	            (unsigned long) LOCK_ARRAY_SIZE, mtm_lock_shift);
+}
+
+
+#if CM == CM_POLICY
+/* Names of the CM_POLICY_* policies, as given to the cm_policy setting */
+static char *cm_policy_str[] = {
+	"suicide",
+	"delay",
+	"backoff",
+	"karma",
+	"polka"
+};
+
+
+static
+int
+cm_str2policy(char *str)
+{
+	int i;
+
+	for (i = 0; i < sizeof(cm_policy_str) / sizeof(cm_policy_str[0]); i++) {
+		if (strcasecmp(str, cm_policy_str[i]) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+#endif /* CM == CM_POLICY */
+
+
+/* Names of the MTM_UNSAFE_* components, as given to the unsafe_disable setting */
+static struct {
+	char *name;
+	int  flag;
+} unsafe_component[] = {
+	{ "isolation",  MTM_UNSAFE_ISOLATION },
+	{ "logging",    MTM_UNSAFE_LOGGING },
+	{ "log_flush",  MTM_UNSAFE_LOG_FLUSH },
+	{ "home_flush", MTM_UNSAFE_HOME_FLUSH }
+};
+
+
+/* 
+ * Turns a comma separated list of component names into MTM_UNSAFE_* flags.
+ * Returns -1 if a name is unknown.
+ */
+static
+int
+unsafe_str2mask(char *str)
+{
+	char *list;
+	char *name;
+	char *saveptr;
+	int  mask = 0;
+	int  i;
+
+	if ((list = strdup(str)) == NULL) {
+		return -1;
+	}
+	for (name = strtok_r(list, ", ", &saveptr); name != NULL; 
+	     name = strtok_r(NULL, ", ", &saveptr)) 
+	{
+		for (i = 0; i < sizeof(unsafe_component) / sizeof(unsafe_component[0]); i++) {
+			if (strcasecmp(name, unsafe_component[i].name) == 0) {
+				break;
+			}
+		}
+		if (i == sizeof(unsafe_component) / sizeof(unsafe_component[0])) {
+			free(list);
+			return -1;
+		}
+		mask |= unsafe_component[i].flag;
+	}
+	free(list);
+	return mask;
+}
+
+
 static inline
 void 
 init_global()
@@ -116,6 +253,30 @@ init_global()
 	COMPILE_TIME_ASSERT(sizeof(mtm_word_t) == sizeof(atomic_t));
 
 	mtm_config_init();
+	lock_array_alloc();
+	mtm_mvstore_init();
+	mtm_rwlock_init(&mtm_serial_lock);
+	mtm_sched_threshold = mtm_runtime_settings.sched_threshold;
+	mtm_sched_serial_retries = mtm_runtime_settings.serial_site_retries;
+	mtm_sched_serial_period = mtm_runtime_settings.serial_site_period;
+	mtm_commit_prefetch_max = mtm_runtime_settings.commit_prefetch_max;
+	mtm_txlock_elide_attempts = htm_cpu_has_rtm() ? mtm_runtime_settings.lock_elision_attempts : 0;
+	mtm_unsafe_disable = unsafe_str2mask(mtm_runtime_settings.unsafe_disable);
+	if (mtm_unsafe_disable < 0) {
+		fprintf(stderr, "Error: unknown component in unsafe_disable %s\n", 
+		        mtm_runtime_settings.unsafe_disable);
+		exit(1);
+	}
+	if (mtm_unsafe_disable != 0) {
+		fprintf(stderr, "Warning: unsafe_disable=%s, transactions are not "
+		        "isolated or durable (benchmarking only)\n", 
+		        mtm_runtime_settings.unsafe_disable);
+	}
+	m_log_unsafe_nobarrier = MTM_UNSAFE_DISABLED(MTM_UNSAFE_LOG_FLUSH);
+#ifdef HTM_FASTPATH
+	mtm_htm_attempts = htm_cpu_has_rtm() ? mtm_runtime_settings.htm_attempts : 0;
+	PRINT_DEBUG("\tHTM attempts=%d\n", mtm_htm_attempts);
+#endif /* HTM_FASTPATH */
 
 #ifdef EPOCH_GC
 	gc_init(mtm_get_clock);
@@ -142,6 +303,20 @@ init_global()
 	}	
 	PRINT_DEBUG("\tCM_THRESHOLD=%d\n", cm_threshold);
 #endif /* CM == CM_PRIORITY */
+#if CM == CM_POLICY
+	mtm_cm_policy = cm_str2policy(mtm_runtime_settings.cm_policy);
+	if (mtm_cm_policy < 0) {
+		fprintf(stderr, "Error: unknown contention management policy %s\n", 
+		        mtm_runtime_settings.cm_policy);
+		exit(1);
+	}
+	mtm_cm_backoff_min = mtm_runtime_settings.cm_backoff_min;
+	mtm_cm_backoff_max = mtm_runtime_settings.cm_backoff_max;
+	if (mtm_cm_backoff_max < mtm_cm_backoff_min) {
+		mtm_cm_backoff_max = mtm_cm_backoff_min;
+	}
+	PRINT_DEBUG("\tCM_POLICY=%s\n", cm_policy_str[mtm_cm_policy]);
+#endif /* CM == CM_POLICY */
 
 	CLOCK = 0;
 #ifdef ROLLOVER_CLOCK
@@ -171,12 +346,33 @@ init_global()
 	m_logmgr_register_logtype(pcm_storeset, M_TMLOG_LF_TYPE, &M_TMLOG_OPS);
 	/* Ask log manager to perform recovery on the new log type */
 	m_logmgr_do_recovery(pcm_storeset);
+	/* Ship the logs to a standby, or apply those shipped to us, if configured */
+	if (m_logship_init(mtm_durable_sqn) != M_R_SUCCESS) {
+		exit(1);
+	}
 
 #ifdef _M_STATS_BUILD	
 	/* Create a statistics manager if need to dynamically profile */
 	if (1) {
-		m_statsmgr_create(&mtm_statsmgr, mtm_runtime_settings.stats_file);
+		m_statsmgr_create(&mtm_statsmgr, mtm_runtime_settings.stats_file,
+		                  mtm_runtime_settings.stats_conflict_sampling,
+		                  mtm_runtime_settings.stats_commit_phases);
 	}	
+	if (mtm_runtime_settings.stats_abort_stacks > 0) {
+		m_statsmgr_abort_stacks(mtm_statsmgr, 
+		                        mtm_runtime_settings.stats_abort_stacks_file,
+		                        mtm_runtime_settings.stats_abort_stacks);
+	}
+	if (mtm_runtime_settings.stats_export_file[0] != '\0' &&
+	    m_statsmgr_export_start(mtm_statsmgr, 
+	                            mtm_runtime_settings.stats_export_file,
+	                            mtm_runtime_settings.stats_export_format,
+	                            mtm_runtime_settings.stats_export_period_ms) != M_R_SUCCESS)
+	{
+		fprintf(stderr, "Error: cannot export statistics in format %s\n", 
+		        mtm_runtime_settings.stats_export_format);
+		exit(1);
+	}
 #endif	
 
 	/* Catch signals for non-faulting load 
@@ -199,6 +395,9 @@ mtm_init_global(void)
 		return 0;
 	}
 
+	/* With init_mode lazy or background, the first transaction maps back
+	 * the persistent segments and recovers the logs. */
+	mnemosyne_init_global();
 	pthread_mutex_lock(&global_init_lock);
 	if (!mtm_initialized) {
 		init_global();
@@ -227,6 +426,7 @@ fini_global()
 	gc_exit();
 #endif /* EPOCH_GC */
 #ifdef _M_STATS_BUILD	
+	m_statsmgr_export_stop(mtm_statsmgr);
 	m_stats_print(mtm_statsmgr);
 #endif  
 }
@@ -251,41 +451,23 @@ mtm_fini_global(void)
 
 
 /*
- * Called by the CURRENT thread to initialize thread-local STM data.
+ * Allocates and sets up a transaction descriptor, not bound to any thread.
  */
-TXTYPE 
-mtm_init_thread(void)
+static mtm_tx_t *
+tx_create(void)
 {
-	mtm_tx_t       *tx = mtm_get_tx();
+	mtm_tx_t       *tx;
 	mtm_mode_t     txmode;
-	pthread_attr_t attr;
-
-
-	if (tx) {
-		TX_RETURN;
-	}
-
-	mtm_init_global();
-
-	PRINT_DEBUG("==> mtm_init_thread()\n");
-
-#ifdef EPOCH_GC
-	gc_init_thread();
-#endif /* EPOCH_GC */
-
 
 	/* freud : Allocate descriptor */
-#if ALIGNMENT == 1 /* no alignment requirement */
-	if ((tx = (mtm_tx_t *)malloc(sizeof(mtm_tx_t))) == NULL) {
-		perror("malloc");
-		exit(1);
-	}
-#else
-	if (posix_memalign((void **)&tx, ALIGNMENT, sizeof(mtm_tx_t)) != 0) {
+	/* The descriptor is laid out in cachelines */
+	if (posix_memalign((void **)&tx, 
+	                   ALIGNMENT > CACHELINE_SIZE ? ALIGNMENT : CACHELINE_SIZE, 
+	                   sizeof(mtm_tx_t)) != 0) 
+	{
 		fprintf(stderr, "Error: cannot allocate aligned memory\n");
 		exit(1);
 	}
-#endif
 
 	/* Get current thread's PCM emulation bookkeeping structure */
 	tx->pcm_storeset = pcm_storeset_get();
@@ -301,20 +483,22 @@ mtm_init_thread(void)
 #undef ACTION  
 
 	txmode = mtm_str2mode(mtm_runtime_settings.force_mode);
+	if (MTM_UNSAFE_DISABLED(MTM_UNSAFE_ISOLATION)) {
+		txmode = MTM_MODE_pwbnl;
+	}
 
 	switch (txmode) {
 		case MTM_MODE_pwbnl:
-			// assert(0); /* freud : unsupported transaction mode */
-			// hack break;
 		case MTM_MODE_pwbetl:
-			/* freud : get rid of this */
-			tx->mode = MTM_MODE_pwbetl;
+			/* Both modes run through the pwbetl entry points (see mtm_set_isolation) */
+			tx->mode = txmode;
 			/* We do not use the dispatch table though we construct it */
 			// tx->dtable = default_dtable_group->mtm_pwbetl;
 			break;
 		default:
 			assert(0); /* unknown transaction mode */
 	}
+	tx->active_modedata = tx->modedata[MTM_MODE_pwbetl];
 
 
 	/* Nesting level */
@@ -330,23 +514,32 @@ mtm_init_thread(void)
 	/* Thread identifier */
 	tx->thread_id = pthread_self();
 #endif /* CONFLICT_TRACKING */
-#if CM == CM_DELAY || CM == CM_PRIORITY
+#if CM == CM_DELAY || CM == CM_PRIORITY || CM == CM_POLICY
 	/* Contented lock */
 	tx->c_lock = NULL;
-#endif /* CM == CM_DELAY || CM == CM_PRIORITY */
+#endif /* CM == CM_DELAY || CM == CM_PRIORITY || CM == CM_POLICY */
 #if CM == CM_BACKOFF
 	/* Backoff */
 	tx->backoff = MIN_BACKOFF;
 	tx->seed = 123456789UL;
 #endif /* CM == CM_BACKOFF */
+#if CM == CM_POLICY
+	/* Backoff and karma */
+	tx->backoff = mtm_cm_backoff_min;
+	tx->seed = 123456789UL;
+	tx->karma = 0;
+#endif /* CM == CM_POLICY */
 #if CM == CM_PRIORITY
 	/* Priority */
 	tx->priority = 0;
 	tx->visible_reads = 0;
 #endif /* CM == CM_PRIORITY */
-#if CM == CM_PRIORITY || defined(INTERNAL_STATS)
 	tx->retries = 0;
-#endif /* CM == CM_PRIORITY || defined(INTERNAL_STATS) */
+	tx->serial = MTM_SERIAL_NONE;
+	tx->snapshot_reads = 0;
+#ifdef HTM_FASTPATH
+	tx->htm = 0;
+#endif /* HTM_FASTPATH */
 #ifdef INTERNAL_STATS
 	/* Statistics */
 	tx->aborts = 0;
@@ -367,21 +560,11 @@ mtm_init_thread(void)
 # endif /* READ_LOCKED_DATA */
 	tx->max_retries = 0;
 #endif /* INTERNAL_STATS */
-	/* Store as thread-local data */
-#ifdef TLS
-	_mtm_thread_tx = tx;
-#else /* ! TLS */
-	pthread_setspecific(_mtm_thread_tx, tx);
-#endif /* ! TLS */
 #ifdef ROLLOVER_CLOCK
 	mtm_rollover_enter(tx);
 #endif /* ROLLOVER_CLOCK */
-
-	tx->tmp_jb_ptr = &(tx->tmp_jb);
-
-	tx->stack_base = get_stack_base();
-	pthread_attr_init(&attr);
-	pthread_attr_getstacksize(&attr, &tx->stack_size);
+	tx->stack_base = 0;
+	tx->stack_size = 0;
 
 	mtm_local_init(tx);
 
@@ -391,14 +574,70 @@ mtm_init_thread(void)
 		exit(1);
 	}	
 
-	mtm_useraction_list_alloc(&tx->commit_action_list);
-	mtm_useraction_list_alloc(&tx->undo_action_list);
+	mtm_useraction_list_init(&tx->precommit_action_list);
+	mtm_useraction_list_init(&tx->commit_action_list);
+	mtm_useraction_list_init(&tx->undo_action_list);
+
+	tx->pending_sqn = 0;
+	tx->last_sqn = 0;
+	pthread_mutex_lock(&durable_list_lock);
+	tx->durable_next = durable_list;
+	durable_list = tx;
+	pthread_mutex_unlock(&durable_list_lock);
 
 	tx->thread_num = __sync_add_and_fetch (&global_num, 1);
+	tx->site = 0;
+	tx->conflict_lock = NULL;
+	tx->sched_class = -1;
 #ifdef _M_STATS_BUILD	
 	m_stats_threadstat_create(mtm_statsmgr, tx->thread_num, &tx->threadstat);
+	tx->statset = m_stats_threadstat_statset(tx->threadstat);
+	tx->stats_fences = 0;
+	tx->stats_commit_phases = mtm_runtime_settings.stats_commit_phases;
+	tx->stats_abort_owner = 0;
 #endif
 
+	return tx;
+}
+
+
+/*
+ * Called by the CURRENT thread to initialize thread-local STM data.
+ */
+TXTYPE 
+mtm_init_thread(void)
+{
+	mtm_tx_t       *tx = mtm_get_tx();
+	pthread_attr_t attr;
+
+
+	if (tx) {
+		TX_RETURN;
+	}
+
+	mtm_init_global();
+
+	PRINT_DEBUG("==> mtm_init_thread()\n");
+
+#ifdef EPOCH_GC
+	gc_init_thread();
+#endif /* EPOCH_GC */
+
+
+	tx = tx_create();
+
+	/* Stores to the stack of the thread need neither locks nor logging */
+	tx->stack_base = get_stack_base();
+	pthread_attr_init(&attr);
+	pthread_attr_getstacksize(&attr, &tx->stack_size);
+
+	/* Store as thread-local data */
+#ifdef TLS
+	_mtm_thread_tx = tx;
+#else /* ! TLS */
+	pthread_setspecific(_mtm_thread_tx, tx);
+#endif /* ! TLS */
+
 	TX_RETURN;
 }
 
@@ -413,6 +652,7 @@ mtm_fini_thread(void)
 	mtm_word_t t;
 #endif /* EPOCH_GC */
 	mtm_tx_t *tx = mtm_get_tx();
+	mtm_tx_t **txp;
 
 	PRINT_DEBUG("==> mtm_exit_thread(%p)\n", tx);
 
@@ -430,6 +670,13 @@ mtm_fini_thread(void)
 	mtm_rollover_exit(tx);
 #endif /* ROLLOVER_CLOCK */
 
+#if CM == CM_PRIORITY || CM == CM_POLICY
+	/* Contending transactions may still be reading our write set (see cm.h) */
+	ATOMIC_MB_FULL;
+	while (ATOMIC_LOAD(&mtm_cm_owner_readers) != 0) {
+	}
+#endif /* CM == CM_PRIORITY || CM == CM_POLICY */
+
 	/* Create mode specific descriptors */
 #undef ACTION
 #define ACTION(mode) \
@@ -437,7 +684,24 @@ mtm_fini_thread(void)
 	FOREACH_MODE(ACTION)
 #undef ACTION  
 
+	mtm_useraction_list_fini(&tx->precommit_action_list);
+	mtm_useraction_list_fini(&tx->commit_action_list);
+	mtm_useraction_list_fini(&tx->undo_action_list);
+	mtm_local_fini(tx);
+
+	pthread_mutex_lock(&durable_list_lock);
+	for (txp = &durable_list; *txp != tx; txp = &(*txp)->durable_next);
+	*txp = tx->durable_next;
+	pthread_mutex_unlock(&durable_list_lock);
+
 	pcm_storeset_put();
+	/* Code running later in the thread's exit (e.g. pmalloc's thread heap 
+	 * release) must not see the freed descriptor */
+#ifdef TLS
+	_mtm_thread_tx = NULL;
+#else /* ! TLS */
+	pthread_setspecific(_mtm_thread_tx, NULL);
+#endif /* ! TLS */
 #ifdef EPOCH_GC
 	t = GET_CLOCK;
 	gc_free(tx, t);
@@ -446,3 +710,100 @@ mtm_fini_thread(void)
 	free(tx);
 #endif /* ! EPOCH_GC */
 }
+
+
+/*
+ * Descriptors not bound to a thread (see mtm.h). A released descriptor 
+ * keeps its mode data, and with it its log, for the next mtm_tx_create.
+ */
+void *
+mtm_tx_create(void)
+{
+	mtm_tx_t *tx;
+
+	mtm_init_global();
+
+	pthread_mutex_lock(&tx_pool_lock);
+	if ((tx = tx_pool) != NULL) {
+		tx_pool = tx->pool_next;
+	}
+	pthread_mutex_unlock(&tx_pool_lock);
+	if (tx == NULL) {
+		return tx_create();
+	}
+#ifdef ROLLOVER_CLOCK
+	mtm_rollover_enter(tx);
+#endif /* ROLLOVER_CLOCK */
+	tx->retries = 0;
+	tx->last_sqn = 0;
+	return tx;
+}
+
+
+void *
+mtm_tx_attach(void *desc)
+{
+	mtm_tx_t *prev = mtm_get_tx();
+	mtm_tx_t *tx = (mtm_tx_t *) desc;
+
+	if ((prev && prev->nesting > 0) || (tx && tx->nesting > 0)) {
+		fprintf(stderr, "Error: transaction descriptor switched inside a transaction\n");
+		abort();
+	}
+	if (tx) {
+		/* The PCM bookkeeping follows the thread */
+		tx->pcm_storeset = pcm_storeset_get();
+	}
+#ifdef TLS
+	_mtm_thread_tx = tx;
+#else /* ! TLS */
+	pthread_setspecific(_mtm_thread_tx, tx);
+#endif /* ! TLS */
+	return prev;
+}
+
+
+void
+mtm_tx_destroy(void *desc)
+{
+	mtm_tx_t *tx = (mtm_tx_t *) desc;
+
+	if (tx == NULL) {
+		return;
+	}
+	assert(tx != mtm_get_tx() && tx->nesting == 0);
+	/* A pooled descriptor must not hold back a clock rollover */
+#ifdef ROLLOVER_CLOCK
+	mtm_rollover_exit(tx);
+#endif /* ROLLOVER_CLOCK */
+	pthread_mutex_lock(&tx_pool_lock);
+	tx->pool_next = tx_pool;
+	tx_pool = tx;
+	pthread_mutex_unlock(&tx_pool_lock);
+}
+
+
+/*
+ * Every commit with a timestamp up to the returned one is durable. A 
+ * commit in flight publishes a lower bound of its timestamp before taking 
+ * it; reading the clock first makes sure that every commit with a 
+ * timestamp up to the value read is either seen in flight or done.
+ */
+uint64_t
+mtm_durable_sqn(void)
+{
+	mtm_word_t sqn;
+	mtm_word_t pending;
+	mtm_tx_t   *tx;
+
+	pthread_mutex_lock(&durable_list_lock);
+	sqn = GET_CLOCK;
+	for (tx = durable_list; tx != NULL; tx = tx->durable_next) {
+		pending = ATOMIC_LOAD_ACQ(&tx->pending_sqn);
+		if (pending != 0 && pending - 1 < sqn) {
+			sqn = pending - 1;
+		}
+	}
+	pthread_mutex_unlock(&durable_list_lock);
+	return sqn;
+}
@@ -32,71 +32,86 @@
 
 #include <mtm_i.h>
 
-#define LOCAL_LOG_SIZE (256*1024)
+#define LOCAL_SEGMENT_SIZE (64*1024)
+#define LOCAL_TRIM_PERIOD  1024
 
 struct mtm_local_undo_entry_s {
   void   *addr;
   size_t len;
-  char   *saved;
 };
 
 /*
- * Layout of the local undo log
+ * Layout of a local undo log segment
  *
  *
+ *  +------------+  <--   segment->data
+ *  |   saved    |
+ *  |            |
+ *  +------------+   _
+ *  |   addr     |    |   mtm_local_undo_entry_t
+ *  |   len      |   _|
  *  +------------+
- *  |            | <--+  <--   local_undo->buf
- *  |            |    |
- *  |            |    |
- *  |            |    |
- *  |            |    |
- *  +------------+    |   _
- *  |   addr     |    |    |  
- *  |   len      |    |     >  mtm_local_undo_entry_t
- *  |   saved    | ---+   _|
- *  +------------+        
- *  |            | <--+
- *  |            |    |
- *  |            |    |
- *  +------------+    |
- *  |   addr     |    |  <--   local_undo->last_entry
- *  |   len      |    |
- *  |   saved    | ---+
+ *  |   saved    |
  *  +------------+
+ *  |   addr     |   <--  segment->data + segment->used 
+ *  |   len      |        - sizeof(mtm_local_undo_entry_t)
+ *  +------------+
+ *  |            |
  *
  *
- * Rollback proceeds backwards first starting at local_undo->last_entry then 
- * finding the previous mtm_local_undo_entry_t by doing arithmetic on saved 
- * and len.
+ * Each entry follows the bytes it saved. Rollback proceeds backwards from
+ * the last entry of the current segment, finding the previous entry by 
+ * doing arithmetic on len, and then continues with the previous segment.
+ * Savepoints are log offsets: the base of a segment is the offset at 
+ * which it started to be filled.
  */
 
-static void
-local_allocate (mtm_tx_t *tx, int extend)
+static mtm_local_segment_t *
+local_segment_alloc (size_t size)
 {
-	mtm_local_undo_t *local_undo = &tx->local_undo;
+	mtm_local_segment_t *segment;
 
-	if (extend) {
-		/* Extend read set */
-		local_undo->size *= 2;
-		PRINT_DEBUG2("==> reallocate read set (%p[%lu-%lu],%d)\n", tx, 
-		             (unsigned long)data->start, 
-		             (unsigned long)data->end, 
-		             data->r_set.size);
-		if ((local_undo->buf = 
-		     (char *)realloc((void*) local_undo->buf, 
-		                     local_undo->size)) == NULL) 
-		{
-			perror("realloc");
-			exit(1);
-		}
-	} else {
-		if ((local_undo->buf = 
-		     (char *)malloc(local_undo->size)) == NULL) 
-		{
-			perror("malloc");
-			exit(1);
+	if ((segment = (mtm_local_segment_t *) malloc(sizeof(mtm_local_segment_t) + size)) == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+	segment->prev = segment->next = NULL;
+	segment->size = size;
+	segment->base = 0;
+	segment->used = 0;
+	return segment;
+}
+
+
+/*
+ * Moves on to the segment after the current one, making sure it can hold
+ * need bytes. A segment past the current one holds no live entries, so 
+ * one that is too small is simply replaced.
+ */
+static void
+local_next_segment (mtm_local_undo_t *local_undo, size_t need)
+{
+	mtm_local_segment_t *cur = local_undo->cur;
+	mtm_local_segment_t *next = cur->next;
+
+	if (next == NULL || next->size < need) {
+		mtm_local_segment_t *segment;
+
+		segment = local_segment_alloc(need > LOCAL_SEGMENT_SIZE ? need : LOCAL_SEGMENT_SIZE);
+		if (next) {
+			segment->next = next->next;
+			if (next->next) {
+				next->next->prev = segment;
+			}
+			free(next);
 		}
+		segment->prev = cur;
+		cur->next = segment;
+		next = segment;
 	}
+	next->base = cur->base + cur->used;
+	next->used = 0;
+	local_undo->cur = next;
 }
 
 
@@ -105,10 +120,41 @@ mtm_local_init(mtm_tx_t *tx)
 {
 	mtm_local_undo_t *local_undo = &tx->local_undo;
 
-	local_undo->size = LOCAL_LOG_SIZE;
-	local_undo->last_entry = NULL;
-	local_undo->n = 0;
-	local_allocate(tx, 0);
+	local_undo->first = local_undo->cur = local_segment_alloc(LOCAL_SEGMENT_SIZE);
+	local_undo->commits = 0;
+	local_undo->spilled = 0;
+}
+
+
+void
+mtm_local_fini(mtm_tx_t *tx)
+{
+	mtm_local_undo_t    *local_undo = &tx->local_undo;
+	mtm_local_segment_t *segment;
+	mtm_local_segment_t *next;
+
+	for (segment = local_undo->first; segment; segment = next) {
+		next = segment->next;
+		free(segment);
+	}
+	local_undo->first = local_undo->cur = NULL;
+}
+
+
+/*
+ * Frees the segments after the first one.
+ */
+static void
+local_trim (mtm_local_undo_t *local_undo)
+{
+	mtm_local_segment_t *segment;
+	mtm_local_segment_t *next;
+
+	for (segment = local_undo->first->next; segment; segment = next) {
+		next = segment->next;
+		free(segment);
+	}
+	local_undo->first->next = NULL;
 }
 
 
@@ -117,69 +163,119 @@ mtm_local_commit (mtm_tx_t *tx)
 {
 	mtm_local_undo_t *local_undo = &tx->local_undo;
 
-	local_undo->last_entry = NULL;
-	local_undo->n = 0;
+	if (__builtin_expect(local_undo->first->next != NULL, 0)) {
+		/* Keep the segments of a burst only while bursts recur */
+		if (local_undo->cur != local_undo->first) {
+			local_undo->spilled = 1;
+		}
+		if (++local_undo->commits == LOCAL_TRIM_PERIOD) {
+			if (!local_undo->spilled) {
+				local_trim(local_undo);
+			}
+			local_undo->commits = 0;
+			local_undo->spilled = 0;
+		}
+	}
+	local_undo->cur = local_undo->first;
+	local_undo->cur->used = 0;
 }
 
 
-void
-mtm_local_rollback (mtm_tx_t *tx)
+/*
+ * Undo the writes logged at or after offset n of the undo log. sp is the 
+ * stack pointer of the checkpoint we are going to restart from.
+ */
+static void
+local_rollback_to (mtm_tx_t *tx, size_t n, uintptr_t *sp)
 {
 	mtm_local_undo_t       *local_undo = &tx->local_undo;
+	mtm_local_segment_t    *segment = local_undo->cur;
 	mtm_local_undo_entry_t *local_undo_entry;
-	char                   *buf;
-	uintptr_t              entryp;
+	char                   *saved;
 	void                   *addr;
-    uintptr_t              *sp;
-	memcpy(&sp, &(tx->jb), sizeof(uintptr_t)); /* Stack pointer is in the first 8 bytes */
     uintptr_t              *current_sp = get_stack_pointer();
  
-	local_undo_entry = local_undo->last_entry;
-	while(local_undo_entry) {
+	while (1) {
+		if (segment->used == 0) {
+			if (segment->prev == NULL) {
+				break;
+			}
+			segment = segment->prev;
+			continue;
+		}
+		if (segment->base + segment->used <= n) {
+			break;
+		}
+		local_undo_entry = (mtm_local_undo_entry_t *) 
+		                   (segment->data + segment->used - sizeof(mtm_local_undo_entry_t));
+		saved = (char *) local_undo_entry - local_undo_entry->len;
 		/* 
 		 * Make sure I don't corrupt the stack I am operating on. 
 		 * See Wang et al [CGO'07] for more information. 
 		 */
 		addr = local_undo_entry->addr;
 		if (sp+1 < (uintptr_t*) addr || ((uintptr_t*) addr) <= current_sp) {
-			PM_MEMCPY(addr, local_undo_entry->saved, local_undo_entry->len);
-		}
-		/* Get next local_undo_entry */
-		entryp = (uintptr_t) local_undo_entry - local_undo_entry->len - sizeof(mtm_local_undo_entry_t);
-		if (entryp > (uintptr_t) local_undo->buf) {
-			local_undo_entry = (mtm_local_undo_entry_t *) entryp;
-		} else {
-			local_undo_entry = NULL;
+			PM_MEMCPY(addr, saved, local_undo_entry->len);
 		}
+		segment->used = saved - segment->data;
 	}
+	local_undo->cur = segment;
+}
+
+
+void
+mtm_local_rollback (mtm_tx_t *tx)
+{
+    uintptr_t              *sp;
+	memcpy(&sp, &(tx->jb), sizeof(uintptr_t)); /* Stack pointer is in the first 8 bytes */
 
-	local_undo->last_entry = NULL;
-	local_undo->n = 0;
+	local_rollback_to(tx, 0, sp);
 }
 
 
-static
-void _ITM_CALL_CONVENTION
+size_t
+mtm_local_savepoint (mtm_tx_t *tx)
+{
+	return tx->local_undo.cur->base + tx->local_undo.cur->used;
+}
+
+
+void
+mtm_local_rollback_to_savepoint (mtm_tx_t *tx, size_t savepoint, void *jb)
+{
+    uintptr_t              *sp;
+	memcpy(&sp, jb, sizeof(uintptr_t)); /* Stack pointer is in the first 8 bytes */
+
+	local_rollback_to(tx, savepoint, sp);
+}
+
+
+/*
+ * Saves len bytes at ptr. Always inlined so that callers passing a 
+ * constant len get the copy specialized for that size.
+ */
+static inline __attribute__((always_inline))
+void
 log_arbitrarily (mtm_tx_t *tx, const volatile void *ptr, size_t len)
 {
 	mtm_local_undo_t       *local_undo = &tx->local_undo;
+	mtm_local_segment_t    *segment = local_undo->cur;
 	mtm_local_undo_entry_t *local_undo_entry;
-	char                   *buf;
+	char                   *saved;
+	size_t                 need = len + sizeof(mtm_local_undo_entry_t);
 
-	if ((local_undo->n + len + sizeof(mtm_local_undo_entry_t)) > local_undo->size) {
-		local_allocate(tx, 1);	
+	if (__builtin_expect(segment->used + need > segment->size, 0)) {
+		local_next_segment(local_undo, need);
+		segment = local_undo->cur;
 	}
 	
-	buf = &local_undo->buf[local_undo->n];
-	local_undo_entry = (mtm_local_undo_entry_t *) &local_undo->buf[local_undo->n + len];
-	local_undo->n += (len + sizeof(mtm_local_undo_entry_t));
+	saved = &segment->data[segment->used];
+	local_undo_entry = (mtm_local_undo_entry_t *) (saved + len);
+	segment->used += need;
 	local_undo_entry->addr = (void*) ptr;
 	local_undo_entry->len = len;
-	local_undo_entry->saved = buf;
 
-	PM_MEMCPY(local_undo_entry->saved, (const void*) ptr, len);
-
-	local_undo->last_entry = local_undo_entry;
+	PM_MEMCPY(saved, (const void*) ptr, len);
 }
 
 
@@ -196,5 +292,14 @@ FOR_ALL_TYPES(DEFINE_LOG_BARRIER, local_)
 void _ITM_CALL_CONVENTION 
 mtm_local_LB (mtm_tx_t *tx, const void *ptr, size_t len)
 { 
-	log_arbitrarily (TXARGS ptr, len); 
+	/* Common sizes get a copy specialized at compile time */
+	switch (len) {
+		case 1:  log_arbitrarily (tx, ptr, 1); break;
+		case 2:  log_arbitrarily (tx, ptr, 2); break;
+		case 4:  log_arbitrarily (tx, ptr, 4); break;
+		case 8:  log_arbitrarily (tx, ptr, 8); break;
+		case 16: log_arbitrarily (tx, ptr, 16); break;
+		case 32: log_arbitrarily (tx, ptr, 32); break;
+		default: log_arbitrarily (tx, ptr, len);
+	}
 }
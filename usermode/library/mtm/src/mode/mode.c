@@ -49,11 +49,14 @@ mtm_dtable_group_t normal_dtable_group = { FOREACH_MODE (ACTION) };
 
 #undef ACTION
 
-#define ACTION(mode) #mode,
-char *mtm_mode_str[] = {
-  FOREACH_MODE(ACTION)
+/* 
+ * Indexed by mtm_mode_t. Mode pwbnl has no entry points of its own and is 
+ * not in FOREACH_MODE (see mtm_set_isolation), but can be forced by name.
+ */
+char *mtm_mode_str[MTM_NUM_MODES] = {
+  [MTM_MODE_pwbnl] = "pwbnl",
+  [MTM_MODE_pwbetl] = "pwbetl",
 };
-#undef ACTION
 
 mtm_dtable_group_t *default_dtable_group = NULL;
 
@@ -69,6 +72,7 @@ mtm_str2mode(char *str)
 			return (mtm_mode_t) i;
 		}
 	}
+	return MTM_MODE_none;
 }
 
 
@@ -0,0 +1,198 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/*!
+ * \file
+ * Durable updates of single persistent words outside transactions.
+ *
+ * An update takes the word's lock in the lock table like a committing 
+ * transaction would, writes the word, flushes it, and releases the lock 
+ * with a fresh commit timestamp. Transactions that read the word before 
+ * the update fail validation; transactions that meet the lock wait or 
+ * restart as for any other owner. The lock records the thread's own 
+ * transaction descriptor as owner through a write set entry of its own, 
+ * so contention management sees a well-formed owner.
+ */
+
+#include "mtm_i.h"
+#include "config.h"
+#include "init.h"
+#include "pwb_i.h"
+#include "readcache.h"
+#include "mvstore.h"
+
+static __thread w_entry_t durable_owner __attribute__((aligned(64)));
+
+
+static inline
+mtm_tx_t *
+durable_enter(volatile mtm_word_t *addr, volatile mtm_word_t **lockp, mtm_word_t *oldp)
+{
+	mtm_tx_t            *tx = mtm_get_tx();
+	volatile mtm_word_t *lock = GET_LOCK(addr);
+	mtm_word_t          l;
+	mtm_word_t          owned;
+
+	if (unlikely(tx == NULL)) {
+		tx = mtm_init_thread();
+	}
+	/* Would wait forever on a lock the caller's transaction holds */
+	assert(tx->status == TX_IDLE);
+
+	durable_owner.addr = addr;
+#if defined(READ_LOCKED_DATA) || defined(CONFLICT_TRACKING) || CM == CM_POLICY
+	durable_owner.tx = tx;
+#endif
+	durable_owner.lock = lock;
+	durable_owner.next = NULL;
+#if CM == CM_PRIORITY
+	owned = LOCK_SET_ADDR((mtm_word_t) &durable_owner, 0);
+#else
+	owned = LOCK_SET_ADDR((mtm_word_t) &durable_owner);
+#endif
+
+	/* Serial transactions count on running alone */
+	mtm_rwlock_rdlock(&mtm_serial_lock);
+#ifdef READ_LOCKED_DATA
+	/* The value is written in place: keep readers from peeking at it */
+	ATOMIC_STORE_REL(&tx->id, tx->id + 1);
+#endif /* READ_LOCKED_DATA */
+	for (;;) {
+		l = ATOMIC_LOAD_ACQ(lock);
+		if (!LOCK_GET_OWNED(l) && ATOMIC_CAS_FULL(lock, l, owned) != 0) {
+			break;
+		}
+		cpu_relax();
+	}
+	durable_owner.version = LOCK_GET_TIMESTAMP(l);
+	*lockp = lock;
+	*oldp = l;
+	return tx;
+}
+
+
+/* 
+ * Makes the new value durable, then publishes it with a new version. The
+ * value it replaced goes to the version store for snapshot reads.
+ */
+static inline
+void
+durable_exit_written(mtm_tx_t *tx, volatile mtm_word_t *addr, volatile mtm_word_t *lock,
+                     mtm_word_t replaced)
+{
+	mtm_word_t t;
+	int        alone;
+
+	if (unlikely(mtm_readcache_nregions > 0)) {
+		mtm_readcache_invalidate((const void *) addr, sizeof(mtm_word_t));
+	}
+	PCM_WB_FLUSH(tx->pcm_storeset, addr);
+	PCM_PERSIST_BARRIER(tx->pcm_storeset);
+#ifdef INCREMENTAL_VALIDATION
+	mtm_commit_begin();
+#endif /* INCREMENTAL_VALIDATION */
+	t = mtm_clock_commit_ts(&alone);
+	if (unlikely(mtm_mvstore_buckets != NULL)) {
+		mtm_mvstore_record(addr, replaced, t);
+	}
+	ATOMIC_STORE_REL(lock, LOCK_SET_TIMESTAMP(t));
+#ifdef INCREMENTAL_VALIDATION
+	mtm_commit_done();
+#endif /* INCREMENTAL_VALIDATION */
+#ifdef READ_LOCKED_DATA
+	ATOMIC_STORE_REL(&tx->id, tx->id + 1);
+#endif /* READ_LOCKED_DATA */
+#ifdef WAIT_YIELD
+	m_spinwait_wake(lock);
+#endif /* WAIT_YIELD */
+	mtm_rwlock_read_unlock(&mtm_serial_lock);
+}
+
+
+/* Nothing was written: the old version stays valid */
+static inline
+void
+durable_exit_unchanged(volatile mtm_word_t *lock, mtm_word_t old)
+{
+	ATOMIC_STORE_REL(lock, old);
+#ifdef READ_LOCKED_DATA
+	ATOMIC_STORE_REL(&durable_owner.tx->id, durable_owner.tx->id + 1);
+#endif /* READ_LOCKED_DATA */
+#ifdef WAIT_YIELD
+	m_spinwait_wake(lock);
+#endif /* WAIT_YIELD */
+	mtm_rwlock_read_unlock(&mtm_serial_lock);
+}
+
+
+void
+mtm_pstore(volatile uint64_t *addr, uint64_t value)
+{
+	volatile mtm_word_t *lock;
+	mtm_word_t          old;
+	mtm_tx_t            *tx = durable_enter((volatile mtm_word_t *) addr, &lock, &old);
+	mtm_word_t          replaced = ATOMIC_LOAD((volatile mtm_word_t *) addr);
+
+	ATOMIC_STORE((volatile mtm_word_t *) addr, value);
+	durable_exit_written(tx, (volatile mtm_word_t *) addr, lock, replaced);
+}
+
+
+int
+mtm_pcas(volatile uint64_t *addr, uint64_t expected, uint64_t desired)
+{
+	volatile mtm_word_t *lock;
+	mtm_word_t          old;
+	mtm_tx_t            *tx = durable_enter((volatile mtm_word_t *) addr, &lock, &old);
+
+	if (ATOMIC_LOAD((volatile mtm_word_t *) addr) != expected) {
+		durable_exit_unchanged(lock, old);
+		return 0;
+	}
+	ATOMIC_STORE((volatile mtm_word_t *) addr, desired);
+	durable_exit_written(tx, (volatile mtm_word_t *) addr, lock, expected);
+	return 1;
+}
+
+
+uint64_t
+mtm_pfetch_add(volatile uint64_t *addr, uint64_t delta)
+{
+	volatile mtm_word_t *lock;
+	mtm_word_t          old;
+	mtm_tx_t            *tx = durable_enter((volatile mtm_word_t *) addr, &lock, &old);
+	uint64_t            value = ATOMIC_LOAD((volatile mtm_word_t *) addr);
+
+	ATOMIC_STORE((volatile mtm_word_t *) addr, value + delta);
+	durable_exit_written(tx, (volatile mtm_word_t *) addr, lock, value);
+	return value;
+}
@@ -30,29 +30,234 @@
 ### END HEADER ###
 */
 
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
+#include <sched.h>
+#include <unistd.h>
 #include "mtm_i.h"
+#include "config.h"
 #include "beginend-bits.h"
 
+
+/* CPU logs (log_per_cpu), indexed by CPU number */
+static mtm_pwb_cpu_log_t *cpu_logs;
+static int               cpu_logs_num;
+static pthread_once_t    cpu_logs_once = PTHREAD_ONCE_INIT;
+
+#ifdef _M_STATS_BUILD
+/* Restart reasons as the abort stack sampler reports them */
+static const char *restart_reason_strings[NUM_RESTARTS] = {
+	"reallocate", "locked_read", "locked_write", "validate_read", 
+	"validate_write", "validate_commit", "not_readonly", "user_retry", 
+	"serial_irr"
+};
+#endif /* _M_STATS_BUILD */
+
+
+static void
+cpu_logs_alloc(void)
+{
+	long n = sysconf(_SC_NPROCESSORS_CONF);
+
+	cpu_logs_num = n > 0 ? (int) n : 1;
+	if (posix_memalign((void **) &cpu_logs, CACHELINE_SIZE, 
+	                   cpu_logs_num * sizeof(mtm_pwb_cpu_log_t)) != 0) 
+	{
+		fprintf(stderr, "Error: cannot allocate the CPU logs\n");
+		exit(1);
+	}
+	memset(cpu_logs, 0, cpu_logs_num * sizeof(mtm_pwb_cpu_log_t));
+}
+
+
+/* Called by the threads that use CPU logs as they start */
+void
+mtm_pwb_cpu_logs_init(void)
+{
+	pthread_once(&cpu_logs_once, cpu_logs_alloc);
+}
+
+
+/*
+ * Claims a CPU log for the transaction that is (re)starting, before it 
+ * logs anything: the log of the CPU it runs on (sched_getcpu reads it from
+ * the thread's rseq area), or of the next one if a transaction preempted 
+ * on that CPU still holds it. The physical log is allocated on first use, 
+ * on the claiming thread's NUMA node with log_numa_local. If every log is 
+ * held, the transaction waits without holding mtm_serial_lock: it has not 
+ * done anything yet, and a holder may be waiting for the readers to drain.
+ */
+void
+mtm_pwb_cpu_log_claim(mtm_tx_t *tx, mode_data_t *modedata)
+{
+	mtm_pwb_cpu_log_t *cl;
+	int               serial;
+	int               cpu;
+	int               i;
+
+	if ((cpu = sched_getcpu()) < 0) {
+		cpu = 0;
+	}
+	for (i = 0; ; i++) {
+		cl = &cpu_logs[(cpu + i) % cpu_logs_num];
+		if (cl->owner == 0 && ATOMIC_CAS_FULL(&cl->owner, 0, 1)) {
+			break;
+		}
+		if ((i + 1) % cpu_logs_num == 0) {
+			serial = tx->serial;
+			pwb_serial_exit(tx);
+			sched_yield();
+			if (serial != MTM_SERIAL_NONE) {
+				pwb_serial_enter(tx, serial);
+			}
+		}
+	}
+	if (cl->dsc == NULL) {
+		if (m_logmgr_alloc_log(tx->pcm_storeset, M_TMLOG_LF_TYPE, PWB_TMLOG_FLAGS, 
+		                       &cl->dsc) != M_R_SUCCESS) 
+		{
+			fprintf(stderr, "Error: cannot allocate a CPU log\n");
+			exit(1);
+		}
+		cl->log = (M_TMLOG_T *) cl->dsc->log;
+	}
+	modedata->cpu_log = cl;
+	modedata->ptmlog_dsc = cl->dsc;
+	modedata->ptmlog = cl->log;
+}
+
+
+/*
+ * Gives the update transaction that is (re)starting a log to write to: a
+ * CPU log with log_per_cpu, otherwise the thread's own log, allocated from
+ * the log pool when the thread begins its first update transaction. 
+ * Threads that only run read-only transactions thus take no log, and a
+ * thread returns its log to the pool when it exits.
+ */
+void
+mtm_pwb_log_attach(mtm_tx_t *tx, mode_data_t *modedata)
+{
+	if (mtm_runtime_settings.log_per_cpu) {
+		mtm_pwb_cpu_log_claim(tx, modedata);
+		return;
+	}
+	if (m_logmgr_alloc_log(tx->pcm_storeset, M_TMLOG_LF_TYPE, PWB_TMLOG_FLAGS, 
+	                       &modedata->ptmlog_dsc) != M_R_SUCCESS) 
+	{
+		fprintf(stderr, "Error: cannot allocate a log\n");
+		exit(1);
+	}
+	modedata->ptmlog = (M_TMLOG_T *) modedata->ptmlog_dsc->log;
+}
+
 void ITM_NORETURN
 mtm_pwb_restart_transaction (mtm_tx_t *tx, mtm_restart_reason r)
 {
-	uint32_t actions;
+	mode_data_t *modedata = (mode_data_t *) tx->active_modedata;
+	uint32_t    actions;
+	int         klass;
+#ifdef HTM_FASTPATH
+	/* The software path will take it from here */
+	if (tx->htm) {
+		htm_abort(HTM_CODE_RESTART);
+	}
+#endif /* HTM_FASTPATH */
 	//fprintf(stderr,"%d %s-%d restart_reason=%d\n",syscall(SYS_gettid),__func__,__LINE__, r);
-#if (!defined(ALLOW_ABORTS))
-	if (tx->mode == MTM_MODE_pwbnl) {
-		assert(0 && "Aborts disabled for current mode pwbnl but want to abort.\n");
-	}	
-#endif
 
 	if (r == RESTART_REALLOCATE) {
 		assert(0 && "Currently we don't support extending the read/write set size");
 	}
+	M_PROBE2(tx__abort, tx, r);
+#ifdef _M_STATS_BUILD
+	m_stats_threadstat_abort(tx->threadstat, restart_reason_strings[r], 
+	                         tx->stats_abort_owner);
+	tx->stats_abort_owner = 0;
+#endif /* _M_STATS_BUILD */
+
+#ifdef CLOSED_NESTING
+	/* 
+	 * A conflict after a savepoint: re-execute from the savepoint if what 
+	 * was read before it is still valid. We do not 
+	 * back off as we keep holding the enclosing transactions' locks. 
+	 */
+	{
+		mtm_pwb_savepoint_t *sp;
+
+		/* A read-only transaction has no read set to revalidate the savepoint with */
+		if (!modedata->read_only && modedata->nb_savepoints > 0 && 
+		    (r == RESTART_LOCKED_READ || r == RESTART_LOCKED_WRITE ||
+		     r == RESTART_VALIDATE_READ || r == RESTART_VALIDATE_WRITE))
+		{
+			sp = &modedata->savepoints[modedata->nb_savepoints - 1];
+			if (sp->retries < PWB_NESTED_RETRIES) {
+				pwb_savepoint_rollback(tx, sp);
+				if (mtm_validate(tx, modedata)) {
+					sp->retries++;
+#ifdef _M_STATS_BUILD
+					m_stats_statset_increment(mtm_statsmgr, tx->statset, XACT, nested_restarts, 1);
+#endif
+					tx->nesting = sp->nesting;
+					_ITM_siglongjmp (sp->jb, sp->resume);
+				}
+			}
+		}
+	}
+#endif /* CLOSED_NESTING */
 
 	rollback_transaction(tx);
-	cm_delay(tx);
-	/* TODO: decide whether to transition to a different execution mode 
-	 * after a restart. For example, transition to serial mode
+
+	/* 
+	 * A read-only transaction that wrote, or outlived its snapshot, retries
+	 * as an update one. A snapshot read that outlived the version store 
+	 * retries with a new snapshot instead.
 	 */
+	if (modedata->read_only && 
+	    (r == RESTART_NOT_READONLY || (r == RESTART_VALIDATE_READ && !modedata->snapshot))) 
+	{
+#ifdef _M_STATS_BUILD
+		m_stats_statset_increment(mtm_statsmgr, tx->statset, XACT, readonly_demotions, 1);
+#endif
+		modedata->read_only = 0;
+		modedata->snapshot = 0;
+	}
+
+	/* 
+	 * A repeat conflict of this call site over the lock queues the next
+	 * execution behind the other transactions of its conflict class. The
+	 * read hold is dropped while waiting, as the queue holder may need to 
+	 * go serial.
+	 */
+	if (mtm_sched_threshold > 0 && tx->serial == MTM_SERIAL_READ &&
+	    (r == RESTART_LOCKED_READ || r == RESTART_LOCKED_WRITE ||
+	     r == RESTART_VALIDATE_READ || r == RESTART_VALIDATE_WRITE ||
+	     r == RESTART_VALIDATE_COMMIT) &&
+	    (klass = mtm_sched_conflict(tx)) >= 0)
+	{
+#ifdef _M_STATS_BUILD
+		m_stats_statset_increment(mtm_statsmgr, tx->statset, XACT, sched_queued, 1);
+#endif
+		pwb_serial_exit(tx);
+		mtm_sched_acquire(tx, klass);
+		pwb_serial_enter(tx, MTM_SERIAL_READ);
+	}
+
+	/* Bound the number of retries by re-executing in serial mode. We must
+	 * drop the read hold first, as the writer waits for all readers. */
+	if (tx->serial == MTM_SERIAL_READ &&
+	    (r == RESTART_SERIAL_IRR ||
+	     (mtm_runtime_settings.serial_threshold > 0 && 
+	      tx->retries >= mtm_runtime_settings.serial_threshold)))
+	{
+#ifdef _M_STATS_BUILD
+		m_stats_statset_increment(mtm_statsmgr, tx->statset, XACT, serial_fallbacks, 1);
+#endif
+		pwb_serial_exit(tx);
+		pwb_serial_enter(tx, MTM_SERIAL_WRITE | 
+		                     (r == RESTART_SERIAL_IRR ? MTM_SERIAL_IRREVOCABLE : 0));
+	} else {
+		cm_delay(tx);
+	}
 
 	/* Reset field to restart transaction */
 	pwb_prepare_transaction(tx);
@@ -66,3 +271,83 @@ mtm_pwb_restart_transaction (mtm_tx_t *tx, mtm_restart_reason r)
 }
 
 
+/*
+ * Upgrades a transaction holding mtm_serial_lock for reading to run alone
+ * without restarting it. Once the other transactions have drained, the
+ * reads so far are validated; if they still hold, nothing can invalidate
+ * them anymore and the transaction goes on where it is. Returns 0 if the
+ * lock could not be upgraded and the transaction still holds it for 
+ * reading.
+ *
+ * The write-back barriers stay in use: running alone they never conflict,
+ * and the buffered write set is what makes the updates atomic in
+ * persistent memory at commit.
+ */
+static int
+pwb_serial_upgrade(mtm_tx_t *tx, int serial)
+{
+	mode_data_t *modedata = (mode_data_t *) tx->active_modedata;
+	mtm_word_t  now;
+	int         valid;
+
+	if (PWB_IN_HTM(tx) || mtm_rwlock_upgrade(&mtm_serial_lock) != 0) {
+		return 0;
+	}
+	tx->serial = serial;
+
+	now = GET_CLOCK;
+	if (!modedata->has_snapshot) {
+		/* Nothing read yet: the snapshot starts now */
+		modedata->start = now;
+		modedata->has_snapshot = 1;
+		valid = 1;
+	} else if (modedata->read_only) {
+		/* No read set: the snapshot holds only if nothing committed since */
+		valid = (now == modedata->end);
+	} else {
+		valid = mtm_validate(tx, modedata);
+	}
+	if (!valid) {
+		/* Re-execute, alone from the start */
+		mtm_pwb_restart_transaction(tx, RESTART_SERIAL_IRR);
+	}
+	modedata->end = now;
+#ifdef _M_STATS_BUILD
+	m_stats_statset_increment(mtm_statsmgr, tx->statset, XACT, irrevocable_upgrades, 1);
+#endif
+	return 1;
+}
+
+
+/*
+ * Switch the current transaction to serial mode. Called when the 
+ * transaction is about to perform an action that cannot be undone, such as
+ * calling a function that has no transactional clone. A transaction that 
+ * does not yet run alone is upgraded in place; only if another thread is 
+ * going serial at the same time is it restarted in serial-irrevocable 
+ * mode, in which case its next execution will get here again and proceed.
+ */
+void
+mtm_serialmode (bool initial, bool irrevocable)
+{
+	mtm_tx_t *tx = mtm_get_tx();
+	int      serial = MTM_SERIAL_WRITE | (irrevocable ? MTM_SERIAL_IRREVOCABLE : 0);
+
+	if (tx->serial & MTM_SERIAL_WRITE) {
+		tx->serial |= serial;
+		return;
+	}
+	if (tx->mode != MTM_MODE_pwbetl) {
+		/* No isolation: there is no one to serialize against. */
+		return;
+	}
+	if (initial) {
+		pwb_serial_exit(tx);
+		pwb_serial_enter(tx, serial);
+		return;
+	}
+	if (tx->serial == MTM_SERIAL_READ && pwb_serial_upgrade(tx, serial)) {
+		return;
+	}
+	mtm_pwb_restart_transaction(tx, RESTART_SERIAL_IRR);
+}
@@ -42,7 +42,6 @@
 #include <assert.h>
 #include <mnemosyne.h>
 #include <pcm.h>
-#include <cuckoo_hash/PointerHashInline.h>
 #include <debug.h>
 #include "tmlog_base.h"
 
@@ -52,6 +51,7 @@ m_log_ops_t tmlog_base_ops = {
 	m_tmlog_base_truncation_init,
 	m_tmlog_base_truncation_prepare_next,
 	m_tmlog_base_truncation_do,
+	m_tmlog_base_truncation_publish,
 	m_tmlog_base_recovery_init,
 	m_tmlog_base_recovery_prepare_next,
 	m_tmlog_base_recovery_do,
@@ -74,7 +74,7 @@ m_tmlog_base_alloc(m_log_dsc_t *log_dsc)
 {
 	m_tmlog_base_t *tmlog_base;
 
-	if (posix_memalign((void **) &tmlog_base, sizeof(uint64_t), sizeof(m_tmlog_base_t)) != 0) 
+	if (posix_memalign((void **) &tmlog_base, CACHELINE_SIZE, sizeof(m_tmlog_base_t)) != 0) 
 	{
 		return M_R_FAILURE;
 	}
@@ -83,7 +83,10 @@ m_tmlog_base_alloc(m_log_dsc_t *log_dsc)
 	 * word aligned.
 	 */
 	assert((( (uintptr_t) &tmlog_base->phlog_base) & (sizeof(uint64_t)-1)) == 0);
-	tmlog_base->flush_set = (set_t *) PointerHash_new();
+	if ((tmlog_base->flush_set = m_flushset_new()) == NULL) {
+		free(tmlog_base);
+		return M_R_FAILURE;
+	}
 	log_dsc->log = (m_log_t *) tmlog_base;
 
 	return M_R_SUCCESS;
@@ -99,7 +102,8 @@ m_tmlog_base_init(pcm_storeset_t *set, m_log_t *log, m_log_dsc_t *log_dsc)
 	m_phlog_base_format(set, 
 	                    (m_phlog_base_nvmd_t *) log_dsc->nvmd, 
 	                    log_dsc->nvphlog, 
-	                    LF_TYPE_TM_BASE);
+	                    LF_TYPE_TM_BASE, 
+	                    log_dsc->size_log2);
 	m_phlog_base_init(phlog_base, 
 	                  (m_phlog_base_nvmd_t *) log_dsc->nvmd, 
 	                  log_dsc->nvphlog);
@@ -108,6 +112,22 @@ m_tmlog_base_init(pcm_storeset_t *set, m_log_t *log, m_log_dsc_t *log_dsc)
 }
 
 
+/* Makes sure the cache block written by a log record reaches memory. */
+static inline
+void
+truncation_flush_block(pcm_storeset_t *set, m_tmlog_base_t *tmlog, uintptr_t block_addr)
+{
+	if (MTM_UNSAFE_DISABLED(MTM_UNSAFE_HOME_FLUSH)) {
+		return;
+	}
+#ifdef FLUSH_CACHELINE_ONCE
+	m_flushset_add(tmlog->flush_set, block_addr);
+#else
+	PCM_WB_FLUSH(set, (volatile pcm_word_t *) block_addr);
+#endif
+}
+
+
 static inline
 m_result_t 
 truncation_prepare(pcm_storeset_t *set, m_log_dsc_t *log_dsc)
@@ -117,9 +137,14 @@ truncation_prepare(pcm_storeset_t *set, m_log_dsc_t *log_dsc)
 	uint64_t          sqn = INV_LOG_ORDER;
 	uintptr_t         addr;
 	pcm_word_t        mask;
+	pcm_word_t        nwords;
+	pcm_word_t        opcode;
+	pcm_word_t        size;
+	pcm_word_t        n;
 	uintptr_t         block_addr;
+	uintptr_t         line;
+	pcm_word_t        bitmap;
 	int               val;
-	int               i;
 
 #ifdef _DEBUG_THIS
 	printf("truncation_prepare: log_dsc = %p\n", log_dsc);
@@ -138,6 +163,7 @@ retry:
 			if (m_phlog_base_read(&(tmlog->phlog_base), &addr) == M_R_SUCCESS) {
 				if (addr == XACT_COMMIT_MARKER) {
 					assert(m_phlog_base_read(&(tmlog->phlog_base), &sqn) == M_R_SUCCESS);
+					m_logship_commit(log_dsc, sqn);
 					m_phlog_base_next_chunk(&tmlog->phlog_base);
 					break;
 				} else if (addr == XACT_ABORT_MARKER) {
@@ -147,31 +173,52 @@ retry:
 					 */
 					assert(m_phlog_base_read(&(tmlog->phlog_base), &sqn) == M_R_SUCCESS);
 					m_phlog_base_next_chunk(&tmlog->phlog_base);
+					m_logship_abort(log_dsc);
 #ifdef FLUSH_CACHELINE_ONCE
-					for(i = 0; i < ((PointerHash *) tmlog->flush_set)->size; i++) {
-						PointerHashRecord *r = PointerHashRecords_recordAt_(((PointerHash *) tmlog->flush_set)->records, i);
-						if (block_addr = (uintptr_t) r->k) {
-							PointerHash_removeKey_((PointerHash *) tmlog->flush_set, (void *) block_addr);
-						}
-					}
+					m_flushset_clear(tmlog->flush_set);
 #endif					
-					m_phlog_base_truncate_async(set, &tmlog->phlog_base);
+					log_dsc->trunc_point = m_phlog_base_truncation_point(&tmlog->phlog_base);
 					sqn = INV_LOG_ORDER;
 					goto retry;
+				} else if (addr == XACT_RANGE_MARKER) {
+					assert(m_phlog_base_read(&(tmlog->phlog_base), &addr) == M_R_SUCCESS);
+					assert(m_phlog_base_read(&(tmlog->phlog_base), &nwords) == M_R_SUCCESS);
+					for (n = 0, block_addr = 0; n < nwords; n++, addr += sizeof(pcm_word_t)) {
+						assert(m_phlog_base_read(&(tmlog->phlog_base), &value) == M_R_SUCCESS);
+						m_logship_store(log_dsc, addr, value, ~((pcm_word_t) 0));
+						if ((uintptr_t) BLOCK_ADDR(addr) != block_addr) {
+							block_addr = (uintptr_t) BLOCK_ADDR(addr);
+							truncation_flush_block(set, tmlog, block_addr);
+						}
+					}
+				} else if (addr == XACT_LOGICAL_MARKER) {
+					assert(m_phlog_base_read(&(tmlog->phlog_base), &opcode) == M_R_SUCCESS);
+					assert(m_phlog_base_read(&(tmlog->phlog_base), &size) == M_R_SUCCESS);
+					m_logship_logical(log_dsc, opcode, size);
+					for (n = 0; n < size; n += sizeof(pcm_word_t)) {
+						assert(m_phlog_base_read(&(tmlog->phlog_base), &value) == M_R_SUCCESS);
+						m_logship_word(log_dsc, value);
+					}
+				} else if (addr & XACT_LINE_BIT) {
+					line = XACT_LINE_ADDR(addr);
+					bitmap = XACT_LINE_BITMAP(addr);
+					for (n = 0; n < XACT_LINE_SIZE / sizeof(pcm_word_t); n++) {
+						if (bitmap & (1 << n)) {
+							assert(m_phlog_base_read(&(tmlog->phlog_base), &value) == M_R_SUCCESS);
+							m_logship_store(log_dsc, line + n * sizeof(pcm_word_t), value, ~((pcm_word_t) 0));
+						}
+					}
+					truncation_flush_block(set, tmlog, (uintptr_t) BLOCK_ADDR(line));
 				} else {
 					assert(m_phlog_base_read(&(tmlog->phlog_base), &value) == M_R_SUCCESS);
-					assert(m_phlog_base_read(&(tmlog->phlog_base), &mask) == M_R_SUCCESS);
-					block_addr = (uintptr_t) BLOCK_ADDR(addr);
-
-#ifdef FLUSH_CACHELINE_ONCE
-					if (!PointerHash_at_((PointerHash *) tmlog->flush_set, (void *) block_addr)) {
-						PointerHash_at_put_((PointerHash *) tmlog->flush_set, 
-						                    (void *) block_addr, 
-						                    (void *) 1);
+					if (addr & XACT_FULL_MASK_BIT) {
+						addr &= ~((uintptr_t) XACT_FULL_MASK_BIT);
+						mask = ~((pcm_word_t) 0);
+					} else {
+						assert(m_phlog_base_read(&(tmlog->phlog_base), &mask) == M_R_SUCCESS);
 					}
-#else 					
-					PCM_WB_FLUSH(set, (volatile pcm_word_t *) block_addr);
-#endif					
+					m_logship_store(log_dsc, addr, value, mask);
+					truncation_flush_block(set, tmlog, (uintptr_t) BLOCK_ADDR(addr));
 				}
 			} else {
 				M_INTERNALERROR("Invariant violation: there must be at least one atomic log fragment.");
@@ -203,9 +250,7 @@ m_tmlog_base_truncation_prepare_next(pcm_storeset_t *set, m_log_dsc_t *log_dsc)
 m_result_t 
 m_tmlog_base_truncation_do(pcm_storeset_t *set, m_log_dsc_t *log_dsc)
 {
-	int            i;
 	m_tmlog_base_t *tmlog = (m_tmlog_base_t *) log_dsc->log;
-	uintptr_t      block_addr;
 
 #ifdef _DEBUG_THIS
 	printf("m_tmlog_base_truncation_do: START: log_dsc = %p\n", log_dsc);
@@ -214,15 +259,12 @@ m_tmlog_base_truncation_do(pcm_storeset_t *set, m_log_dsc_t *log_dsc)
 
 
 #ifdef FLUSH_CACHELINE_ONCE
-	for(i = 0; i < ((PointerHash *) tmlog->flush_set)->size; i++) {
-		PointerHashRecord *r = PointerHashRecords_recordAt_(((PointerHash *) tmlog->flush_set)->records, i);
-		if (block_addr = (uintptr_t) r->k) {
-			PointerHash_removeKey_((PointerHash *) tmlog->flush_set, (void *) block_addr);
-			PCM_WB_FLUSH(set, (volatile pcm_word_t *) block_addr);
-		}
-	}
+	m_flushset_flush(set, tmlog->flush_set);
 #endif	
-	m_phlog_base_truncate_async(set, &tmlog->phlog_base);
+	/* The head moves once the truncation checkpoint is taken */
+	log_dsc->trunc_point = m_phlog_base_truncation_point(&tmlog->phlog_base);
+	log_dsc->trunc_words = (tmlog->phlog_base.read_index - tmlog->phlog_base.head) & 
+	                       tmlog->phlog_base.mask;
 
 #ifdef _DEBUG_THIS
 	printf("m_tmlog_base_truncation_do: DONE: log_dsc = %p\n", log_dsc);
@@ -233,6 +275,20 @@ m_tmlog_base_truncation_do(pcm_storeset_t *set, m_log_dsc_t *log_dsc)
 }
 
 
+m_result_t 
+m_tmlog_base_truncation_publish(pcm_storeset_t *set, m_log_dsc_t *log_dsc)
+{
+	m_tmlog_base_t *tmlog = (m_tmlog_base_t *) log_dsc->log;
+
+	if (log_dsc->trunc_point != INV_LOG_ORDER) {
+		m_phlog_base_truncate_to(set, &tmlog->phlog_base, log_dsc->trunc_point);
+		log_dsc->trunc_point = INV_LOG_ORDER;
+	}
+
+	return M_R_SUCCESS;
+}
+
+
 static inline
 m_result_t 
 recovery_prepare_next(pcm_storeset_t *set, m_log_dsc_t *log_dsc)
@@ -242,6 +298,10 @@ recovery_prepare_next(pcm_storeset_t *set, m_log_dsc_t *log_dsc)
 	uint64_t          sqn = INV_LOG_ORDER;
 	uintptr_t         addr;
 	pcm_word_t        mask;
+	pcm_word_t        nwords;
+	pcm_word_t        opcode;
+	pcm_word_t        size;
+	pcm_word_t        n;
 	uintptr_t         block_addr;
 	int               val;
 	uint64_t          readindex_checkpoint;
@@ -277,13 +337,37 @@ retry:
 				} else if (addr == XACT_ABORT_MARKER) {
 					assert(m_phlog_base_read(&(tmlog->phlog_base), &sqn) == M_R_SUCCESS);
 					m_phlog_base_next_chunk(&tmlog->phlog_base);
-					/* Ignore an aborted transaction's log fragment */
-					m_phlog_base_truncate_async(set, &tmlog->phlog_base);
+					/* 
+					 * Ignore an aborted transaction's log fragment. It is 
+					 * truncated along with the recovered fragments once 
+					 * their stores are durable.
+					 */
 					sqn = INV_LOG_ORDER;
 					goto retry;
+				} else if (addr == XACT_RANGE_MARKER) {
+					assert(m_phlog_base_read(&(tmlog->phlog_base), &addr) == M_R_SUCCESS);
+					assert(m_phlog_base_read(&(tmlog->phlog_base), &nwords) == M_R_SUCCESS);
+					for (n = 0; n < nwords; n++) {
+						assert(m_phlog_base_read(&(tmlog->phlog_base), &value) == M_R_SUCCESS);
+					}
+				} else if (addr == XACT_LOGICAL_MARKER) {
+					assert(m_phlog_base_read(&(tmlog->phlog_base), &opcode) == M_R_SUCCESS);
+					assert(m_phlog_base_read(&(tmlog->phlog_base), &size) == M_R_SUCCESS);
+					for (n = 0; n < size; n += sizeof(pcm_word_t)) {
+						assert(m_phlog_base_read(&(tmlog->phlog_base), &value) == M_R_SUCCESS);
+					}
+				} else if (addr & XACT_LINE_BIT) {
+					for (n = __builtin_popcount(XACT_LINE_BITMAP(addr)); n > 0; n--) {
+						assert(m_phlog_base_read(&(tmlog->phlog_base), &value) == M_R_SUCCESS);
+					}
 				} else {
 					assert(m_phlog_base_read(&(tmlog->phlog_base), &value) == M_R_SUCCESS);
-					assert(m_phlog_base_read(&(tmlog->phlog_base), &mask) == M_R_SUCCESS);
+					if (addr & XACT_FULL_MASK_BIT) {
+						addr &= ~((uintptr_t) XACT_FULL_MASK_BIT);
+						mask = ~((pcm_word_t) 0);
+					} else {
+						assert(m_phlog_base_read(&(tmlog->phlog_base), &mask) == M_R_SUCCESS);
+					}
 				}	
 			} else {
 				M_INTERNALERROR("Invariant violation: there must be at least one atomic log fragment.");
@@ -303,6 +387,14 @@ m_tmlog_base_recovery_init(pcm_storeset_t *set, m_log_dsc_t *log_dsc)
 {
 	m_tmlog_base_t *tmlog = (m_tmlog_base_t *) log_dsc->log;
 
+	if (log_dsc->trunc_point != INV_LOG_ORDER) {
+		/* Skip the fragments the last truncation checkpoint found durable */
+		PCM_NT_STORE(set, 
+		             (volatile pcm_word_t *) &((m_phlog_base_nvmd_t *) log_dsc->nvmd)->head, 
+		             log_dsc->trunc_point);
+		PCM_PERSIST_BARRIER(set);
+		log_dsc->trunc_point = INV_LOG_ORDER;
+	}
 	m_phlog_base_init(&tmlog->phlog_base, 
 	                  (m_phlog_base_nvmd_t *) log_dsc->nvmd, 
 	                  log_dsc->nvphlog);
@@ -328,7 +420,14 @@ m_tmlog_base_recovery_do(pcm_storeset_t *set, m_log_dsc_t *log_dsc)
 	uint64_t          sqn = INV_LOG_ORDER;
 	uintptr_t         addr;
 	pcm_word_t        mask;
+	pcm_word_t        nwords;
+	pcm_word_t        opcode;
+	pcm_word_t        size;
+	pcm_word_t        args[XACT_LOGICAL_ARGS_MAX / sizeof(pcm_word_t)];
+	pcm_word_t        n;
 	uintptr_t         block_addr;
+	uintptr_t         line;
+	pcm_word_t        bitmap;
 	int               val;
 	uint64_t          readindex_checkpoint;
 
@@ -348,8 +447,10 @@ m_tmlog_base_recovery_do(pcm_storeset_t *set, m_log_dsc_t *log_dsc)
 			if (addr == XACT_COMMIT_MARKER) {
 				assert(m_phlog_base_read(&(tmlog->phlog_base), &sqn) == M_R_SUCCESS);
 				m_phlog_base_next_chunk(&tmlog->phlog_base);
-				/* Drop the recovered log fragment */
-				m_phlog_base_truncate_async(set, &tmlog->phlog_base);
+				/* 
+				 * The log manager drops the recovered fragment once 
+				 * m_logrecovery_store has made its stores durable.
+				 */
 				break;
 			} else if (addr == XACT_ABORT_MARKER) {
 				/* 
@@ -357,13 +458,39 @@ m_tmlog_base_recovery_do(pcm_storeset_t *set, m_log_dsc_t *log_dsc)
 				 * an aborted transaction.
 				 */
 				M_INTERNALERROR("Trying to recover an aborted transaction!\n");
+			} else if (addr == XACT_RANGE_MARKER) {
+				assert(m_phlog_base_read(&(tmlog->phlog_base), &addr) == M_R_SUCCESS);
+				assert(m_phlog_base_read(&(tmlog->phlog_base), &nwords) == M_R_SUCCESS);
+				for (n = 0; n < nwords; n++, addr += sizeof(pcm_word_t)) {
+					assert(m_phlog_base_read(&(tmlog->phlog_base), &value) == M_R_SUCCESS);
+					m_logrecovery_store(set, addr, value, ~((pcm_word_t) 0));
+				}
+			} else if (addr == XACT_LOGICAL_MARKER) {
+				assert(m_phlog_base_read(&(tmlog->phlog_base), &opcode) == M_R_SUCCESS);
+				assert(m_phlog_base_read(&(tmlog->phlog_base), &size) == M_R_SUCCESS);
+				assert(size <= XACT_LOGICAL_ARGS_MAX);
+				for (n = 0; n < size; n += sizeof(pcm_word_t)) {
+					assert(m_phlog_base_read(&(tmlog->phlog_base), &args[n / sizeof(pcm_word_t)]) == M_R_SUCCESS);
+				}
+				m_logrecovery_logical(set, (unsigned int) opcode, args, size);
+			} else if (addr & XACT_LINE_BIT) {
+				line = XACT_LINE_ADDR(addr);
+				bitmap = XACT_LINE_BITMAP(addr);
+				for (n = 0; n < XACT_LINE_SIZE / sizeof(pcm_word_t); n++) {
+					if (bitmap & (1 << n)) {
+						assert(m_phlog_base_read(&(tmlog->phlog_base), &value) == M_R_SUCCESS);
+						m_logrecovery_store(set, line + n * sizeof(pcm_word_t), value, ~((pcm_word_t) 0));
+					}
+				}
 			} else {
 				assert(m_phlog_base_read(&(tmlog->phlog_base), &value) == M_R_SUCCESS);
-				assert(m_phlog_base_read(&(tmlog->phlog_base), &mask) == M_R_SUCCESS);
-				if (mask!=0) {
-					PCM_WB_STORE_ALIGNED_MASKED(set, (volatile pcm_word_t *) addr, value, mask);
-					PCM_WB_FLUSH(set, (volatile pcm_word_t *) addr);
-				}	
+				if (addr & XACT_FULL_MASK_BIT) {
+					addr &= ~((uintptr_t) XACT_FULL_MASK_BIT);
+					mask = ~((pcm_word_t) 0);
+				} else {
+					assert(m_phlog_base_read(&(tmlog->phlog_base), &mask) == M_R_SUCCESS);
+				}
+				m_logrecovery_store(set, addr, value, mask);
 			}	
 		} else {
 			M_INTERNALERROR("Invariant violation: there must be at least one atomic log fragment.");
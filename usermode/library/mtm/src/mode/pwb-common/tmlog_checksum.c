@@ -0,0 +1,531 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/*!
+ * \file
+ *
+ * \brief Implements the checksum log for persistent writeback transactions.
+ *
+ */
+
+#include <stdio.h>
+#include <assert.h>
+#include <mnemosyne.h>
+#include <pcm.h>
+#include <debug.h>
+#include "tmlog_checksum.h"
+
+m_log_ops_t tmlog_checksum_ops = {
+	m_tmlog_checksum_alloc,
+	m_tmlog_checksum_init,
+	m_tmlog_checksum_truncation_init,
+	m_tmlog_checksum_truncation_prepare_next,
+	m_tmlog_checksum_truncation_do,
+	m_tmlog_checksum_truncation_publish,
+	m_tmlog_checksum_recovery_init,
+	m_tmlog_checksum_recovery_prepare_next,
+	m_tmlog_checksum_recovery_do,
+	m_tmlog_checksum_report_stats,
+};
+
+/* Print debug messages */
+#undef _DEBUG_THIS
+//#define _DEBUG_THIS
+
+
+#define _DEBUG_PRINT_TMLOG(tmlog)                                 \
+  printf("nvmd       : %p\n", tmlog->phlog_checksum.nvmd);         \
+  printf("nvphlog    : %p\n", tmlog->phlog_checksum.nvphlog);      \
+  printf("stable_tail: %lu\n", tmlog->phlog_checksum.stable_tail); \
+  printf("tail       : %lu\n", tmlog->phlog_checksum.tail);        \
+  printf("head       : %lu\n", tmlog->phlog_checksum.head);        \
+  printf("read_index : %lu\n", tmlog->phlog_checksum.read_index);
+
+m_result_t 
+m_tmlog_checksum_alloc(m_log_dsc_t *log_dsc)
+{
+	m_tmlog_checksum_t *tmlog_checksum;
+
+	if (posix_memalign((void **) &tmlog_checksum, CACHELINE_SIZE, sizeof(m_tmlog_checksum_t)) != 0) 
+	{
+		return M_R_FAILURE;
+	}
+	/* 
+	 * The underlying physical log volatile structure requires to be
+	 * word aligned.
+	 */
+	assert((( (uintptr_t) &tmlog_checksum->phlog_checksum) & (sizeof(uint64_t)-1)) == 0);
+	if ((tmlog_checksum->flush_set = m_flushset_new()) == NULL) {
+		free(tmlog_checksum);
+		return M_R_FAILURE;
+	}
+	log_dsc->log = (m_log_t *) tmlog_checksum;
+
+	return M_R_SUCCESS;
+}
+
+
+m_result_t 
+m_tmlog_checksum_init(pcm_storeset_t *set, m_log_t *log, m_log_dsc_t *log_dsc)
+{
+	m_tmlog_checksum_t *tmlog_checksum = (m_tmlog_checksum_t *) log;
+	m_phlog_checksum_t *phlog_checksum = &(tmlog_checksum->phlog_checksum);
+
+	m_phlog_checksum_format(set, 
+	                        (m_phlog_checksum_nvmd_t *) log_dsc->nvmd, 
+	                        log_dsc->nvphlog, 
+	                        LF_TYPE_TM_CHECKSUM, 
+	                        log_dsc->size_log2);
+	m_phlog_checksum_init(phlog_checksum, 
+	                      (m_phlog_checksum_nvmd_t *) log_dsc->nvmd, 
+	                      log_dsc->nvphlog);
+
+	return M_R_SUCCESS;
+}
+
+
+/* Makes sure the cache block written by a log record reaches memory. */
+static inline
+void
+truncation_flush_block(pcm_storeset_t *set, m_tmlog_checksum_t *tmlog, uintptr_t block_addr)
+{
+	if (MTM_UNSAFE_DISABLED(MTM_UNSAFE_HOME_FLUSH)) {
+		return;
+	}
+#ifdef FLUSH_CACHELINE_ONCE
+	m_flushset_add(tmlog->flush_set, block_addr);
+#else
+	PCM_WB_FLUSH(set, (volatile pcm_word_t *) block_addr);
+#endif
+}
+
+
+static inline
+m_result_t 
+truncation_prepare(pcm_storeset_t *set, m_log_dsc_t *log_dsc)
+{
+	m_tmlog_checksum_t *tmlog = (m_tmlog_checksum_t *) log_dsc->log;
+	pcm_word_t        value;
+	uint64_t          sqn = INV_LOG_ORDER;
+	uintptr_t         addr;
+	pcm_word_t        mask;
+	pcm_word_t        nwords;
+	pcm_word_t        opcode;
+	pcm_word_t        size;
+	pcm_word_t        n;
+	uintptr_t         block_addr;
+	uintptr_t         line;
+	pcm_word_t        bitmap;
+	int               val;
+
+#ifdef _DEBUG_THIS
+	printf("prepare_truncate: log_dsc = %p\n", log_dsc);
+	_DEBUG_PRINT_TMLOG(tmlog)
+#endif
+
+	/*
+	 * Invariant: If there is a stable region to read from then there is at 
+	 * least one atomic log fragment which corresponds to one logical 
+	 * transaction. 
+	 */
+retry:	 
+	if (m_phlog_checksum_stable_exists(&(tmlog->phlog_checksum))) {
+		while(1) {
+			if (m_phlog_checksum_read(&(tmlog->phlog_checksum), &addr) == M_R_SUCCESS) {
+				if (addr == XACT_COMMIT_MARKER) {
+					assert(m_phlog_checksum_read(&(tmlog->phlog_checksum), &sqn) == M_R_SUCCESS);
+					m_logship_commit(log_dsc, sqn);
+					m_phlog_checksum_next_chunk(&tmlog->phlog_checksum);
+					break;
+				} else if (addr == XACT_ABORT_MARKER) {
+					/* 
+					 * Log fragment corresponds to an aborted transaction.
+					 * Ignore it, truncate the log up to here, and retry.
+					 */
+					assert(m_phlog_checksum_read(&(tmlog->phlog_checksum), &sqn) == M_R_SUCCESS);
+					m_phlog_checksum_next_chunk(&tmlog->phlog_checksum);
+					m_logship_abort(log_dsc);
+#ifdef FLUSH_CACHELINE_ONCE
+					m_flushset_clear(tmlog->flush_set);
+#endif					
+					log_dsc->trunc_point = m_phlog_checksum_truncation_point(&tmlog->phlog_checksum);
+					sqn = INV_LOG_ORDER;
+					goto retry;
+				} else if (addr == XACT_RANGE_MARKER) {
+					assert(m_phlog_checksum_read(&(tmlog->phlog_checksum), &addr) == M_R_SUCCESS);
+					assert(m_phlog_checksum_read(&(tmlog->phlog_checksum), &nwords) == M_R_SUCCESS);
+					for (n = 0, block_addr = 0; n < nwords; n++, addr += sizeof(pcm_word_t)) {
+						assert(m_phlog_checksum_read(&(tmlog->phlog_checksum), &value) == M_R_SUCCESS);
+						m_logship_store(log_dsc, addr, value, ~((pcm_word_t) 0));
+						if ((uintptr_t) BLOCK_ADDR(addr) != block_addr) {
+							block_addr = (uintptr_t) BLOCK_ADDR(addr);
+							truncation_flush_block(set, tmlog, block_addr);
+						}
+					}
+				} else if (addr == XACT_LOGICAL_MARKER) {
+					assert(m_phlog_checksum_read(&(tmlog->phlog_checksum), &opcode) == M_R_SUCCESS);
+					assert(m_phlog_checksum_read(&(tmlog->phlog_checksum), &size) == M_R_SUCCESS);
+					m_logship_logical(log_dsc, opcode, size);
+					for (n = 0; n < size; n += sizeof(pcm_word_t)) {
+						assert(m_phlog_checksum_read(&(tmlog->phlog_checksum), &value) == M_R_SUCCESS);
+						m_logship_word(log_dsc, value);
+					}
+				} else if (addr & XACT_LINE_BIT) {
+					line = XACT_LINE_ADDR(addr);
+					bitmap = XACT_LINE_BITMAP(addr);
+					for (n = 0; n < XACT_LINE_SIZE / sizeof(pcm_word_t); n++) {
+						if (bitmap & (1 << n)) {
+							assert(m_phlog_checksum_read(&(tmlog->phlog_checksum), &value) == M_R_SUCCESS);
+							m_logship_store(log_dsc, line + n * sizeof(pcm_word_t), value, ~((pcm_word_t) 0));
+						}
+					}
+					truncation_flush_block(set, tmlog, (uintptr_t) BLOCK_ADDR(line));
+				} else {
+					assert(m_phlog_checksum_read(&(tmlog->phlog_checksum), &value) == M_R_SUCCESS);
+					if (addr & XACT_FULL_MASK_BIT) {
+						addr &= ~((uintptr_t) XACT_FULL_MASK_BIT);
+						mask = ~((pcm_word_t) 0);
+					} else {
+						assert(m_phlog_checksum_read(&(tmlog->phlog_checksum), &mask) == M_R_SUCCESS);
+					}
+#ifdef _DEBUG_THIS
+					printf("addr  = 0x%lX\n", addr);
+					printf("value = 0x%lX\n", value);
+					printf("mask  = 0x%lX\n", mask);
+#endif
+					m_logship_store(log_dsc, addr, value, mask);
+					truncation_flush_block(set, tmlog, (uintptr_t) BLOCK_ADDR(addr));
+				}	
+			} else {
+				M_INTERNALERROR("Invariant violation: there must be at least one atomic log fragment.");
+			}
+		}	
+		log_dsc->logorder = sqn;
+	} else {
+		log_dsc->logorder = sqn;
+	}
+	
+	return M_R_SUCCESS;
+}
+
+
+m_result_t 
+m_tmlog_checksum_truncation_init(pcm_storeset_t *set, m_log_dsc_t *log_dsc)
+{
+	return truncation_prepare(set, log_dsc);
+}
+
+
+m_result_t 
+m_tmlog_checksum_truncation_prepare_next(pcm_storeset_t *set, m_log_dsc_t *log_dsc)
+{
+	return truncation_prepare(set, log_dsc);
+}
+
+
+m_result_t 
+m_tmlog_checksum_truncation_do(pcm_storeset_t *set, m_log_dsc_t *log_dsc)
+{
+	m_tmlog_checksum_t *tmlog = (m_tmlog_checksum_t *) log_dsc->log;
+
+#ifdef _DEBUG_THIS
+	printf("m_tmlog_checksum_truncation_do: START\n");
+	_DEBUG_PRINT_TMLOG(tmlog)
+#endif
+
+#ifdef FLUSH_CACHELINE_ONCE
+	m_flushset_flush(set, tmlog->flush_set);
+#endif	
+	/* The head moves once the truncation checkpoint is taken */
+	log_dsc->trunc_point = m_phlog_checksum_truncation_point(&tmlog->phlog_checksum);
+	log_dsc->trunc_words = (tmlog->phlog_checksum.read_index - tmlog->phlog_checksum.head) & 
+	                       tmlog->phlog_checksum.mask;
+
+#ifdef _DEBUG_THIS
+	printf("m_tmlog_checksum_truncation_do: DONE\n");
+	_DEBUG_PRINT_TMLOG(tmlog)
+#endif
+
+	return M_R_SUCCESS;
+}
+
+
+m_result_t 
+m_tmlog_checksum_truncation_publish(pcm_storeset_t *set, m_log_dsc_t *log_dsc)
+{
+	m_tmlog_checksum_t *tmlog = (m_tmlog_checksum_t *) log_dsc->log;
+
+	if (log_dsc->trunc_point != INV_LOG_ORDER) {
+		m_phlog_checksum_truncate_to(set, &tmlog->phlog_checksum, log_dsc->trunc_point);
+		log_dsc->trunc_point = INV_LOG_ORDER;
+	}
+
+	return M_R_SUCCESS;
+}
+
+
+static inline
+m_result_t 
+recovery_prepare_next(pcm_storeset_t *set, m_log_dsc_t *log_dsc)
+{
+	m_tmlog_checksum_t *tmlog = (m_tmlog_checksum_t *) log_dsc->log;
+	pcm_word_t        value;
+	uint64_t          sqn = INV_LOG_ORDER;
+	uintptr_t         addr;
+	pcm_word_t        mask;
+	pcm_word_t        nwords;
+	pcm_word_t        opcode;
+	pcm_word_t        size;
+	pcm_word_t        n;
+	uintptr_t         block_addr;
+	int               val;
+	uint64_t          readindex_checkpoint;
+
+#ifdef _DEBUG_THIS
+	printf("recovery_prepare_next: log_dsc = %p\n", log_dsc);
+	_DEBUG_PRINT_TMLOG(tmlog)
+#endif
+
+	/*
+	 * Invariant: If there is a stable region to read from then there is at 
+	 * least one atomic log fragment which corresponds to one logical 
+	 * transaction. 
+	 */
+retry:	 
+	if (m_phlog_checksum_stable_exists(&(tmlog->phlog_checksum))) {
+		/* 
+		 * Checkpoint the readindex so that we can restore it after we find 
+		 * the transaction sequence number and be able to recover the 
+		 * transaction.
+		 */
+		assert(m_phlog_checksum_checkpoint_readindex(&(tmlog->phlog_checksum), &readindex_checkpoint) == M_R_SUCCESS);
+		while(1) {
+			if (m_phlog_checksum_read(&(tmlog->phlog_checksum), &addr) == M_R_SUCCESS) {
+				if (addr == XACT_COMMIT_MARKER) {
+					assert(m_phlog_checksum_read(&(tmlog->phlog_checksum), &sqn) == M_R_SUCCESS);
+					m_phlog_checksum_restore_readindex(&(tmlog->phlog_checksum), readindex_checkpoint);
+					break;
+				} else if (addr == XACT_ABORT_MARKER) {
+					assert(m_phlog_checksum_read(&(tmlog->phlog_checksum), &sqn) == M_R_SUCCESS);
+					m_phlog_checksum_next_chunk(&tmlog->phlog_checksum);
+					/* 
+					 * Ignore an aborted transaction's log fragment. It is 
+					 * truncated along with the recovered fragments once 
+					 * their stores are durable.
+					 */
+					sqn = INV_LOG_ORDER;
+					goto retry;
+				} else if (addr == XACT_RANGE_MARKER) {
+					assert(m_phlog_checksum_read(&(tmlog->phlog_checksum), &addr) == M_R_SUCCESS);
+					assert(m_phlog_checksum_read(&(tmlog->phlog_checksum), &nwords) == M_R_SUCCESS);
+					for (n = 0; n < nwords; n++) {
+						assert(m_phlog_checksum_read(&(tmlog->phlog_checksum), &value) == M_R_SUCCESS);
+					}
+				} else if (addr == XACT_LOGICAL_MARKER) {
+					assert(m_phlog_checksum_read(&(tmlog->phlog_checksum), &opcode) == M_R_SUCCESS);
+					assert(m_phlog_checksum_read(&(tmlog->phlog_checksum), &size) == M_R_SUCCESS);
+					for (n = 0; n < size; n += sizeof(pcm_word_t)) {
+						assert(m_phlog_checksum_read(&(tmlog->phlog_checksum), &value) == M_R_SUCCESS);
+					}
+				} else if (addr & XACT_LINE_BIT) {
+					for (n = __builtin_popcount(XACT_LINE_BITMAP(addr)); n > 0; n--) {
+						assert(m_phlog_checksum_read(&(tmlog->phlog_checksum), &value) == M_R_SUCCESS);
+					}
+				} else {
+					assert(m_phlog_checksum_read(&(tmlog->phlog_checksum), &value) == M_R_SUCCESS);
+					if (addr & XACT_FULL_MASK_BIT) {
+						addr &= ~((uintptr_t) XACT_FULL_MASK_BIT);
+						mask = ~((pcm_word_t) 0);
+					} else {
+						assert(m_phlog_checksum_read(&(tmlog->phlog_checksum), &mask) == M_R_SUCCESS);
+					}
+				}	
+			} else {
+				M_INTERNALERROR("Invariant violation: there must be at least one atomic log fragment.");
+			}
+		}	
+		log_dsc->logorder = sqn;
+	} else {
+		log_dsc->logorder = sqn;
+	}
+	
+	return M_R_SUCCESS;
+}
+
+
+m_result_t 
+m_tmlog_checksum_recovery_init(pcm_storeset_t *set, m_log_dsc_t *log_dsc)
+{
+	m_tmlog_checksum_t *tmlog = (m_tmlog_checksum_t *) log_dsc->log;
+
+	if (log_dsc->trunc_point != INV_LOG_ORDER) {
+		/* Skip the fragments the last truncation checkpoint found durable */
+		PCM_NT_STORE(set, 
+		             (volatile pcm_word_t *) &((m_phlog_checksum_nvmd_t *) log_dsc->nvmd)->flags, 
+		             log_dsc->trunc_point);
+		PCM_PERSIST_BARRIER(set);
+		log_dsc->trunc_point = INV_LOG_ORDER;
+	}
+	m_phlog_checksum_init(&tmlog->phlog_checksum, 
+	                      (m_phlog_checksum_nvmd_t *) log_dsc->nvmd, 
+	                      log_dsc->nvphlog);
+	
+	m_phlog_checksum_check_consistency((m_phlog_checksum_nvmd_t *) log_dsc->nvmd, 
+	                                   log_dsc->nvphlog, 
+	                                   &(tmlog->phlog_checksum.stable_tail));
+	recovery_prepare_next(set, log_dsc);
+
+	return M_R_SUCCESS;
+}
+
+
+m_result_t 
+m_tmlog_checksum_recovery_prepare_next(pcm_storeset_t *set, m_log_dsc_t *log_dsc)
+{
+	return recovery_prepare_next(set, log_dsc);
+}
+
+
+m_result_t 
+m_tmlog_checksum_recovery_do(pcm_storeset_t *set, m_log_dsc_t *log_dsc)
+{
+	m_tmlog_checksum_t *tmlog = (m_tmlog_checksum_t *) log_dsc->log;
+	pcm_word_t        value;
+	uint64_t          sqn = INV_LOG_ORDER;
+	uintptr_t         addr;
+	pcm_word_t        mask;
+	pcm_word_t        nwords;
+	pcm_word_t        opcode;
+	pcm_word_t        size;
+	pcm_word_t        args[XACT_LOGICAL_ARGS_MAX / sizeof(pcm_word_t)];
+	pcm_word_t        n;
+	uintptr_t         block_addr;
+	uintptr_t         line;
+	pcm_word_t        bitmap;
+	int               val;
+	uint64_t          readindex_checkpoint;
+
+#ifdef _DEBUG_THIS
+	printf("m_tmlog_checksum_recovery_do: %lu\n", log_dsc->logorder);
+	_DEBUG_PRINT_TMLOG(tmlog)
+#endif
+
+	/*
+	 * Invariant: If there is a stable region to read from then there is at 
+	 * least one atomic log fragment which corresponds to one logical 
+	 * transaction. 
+	 */
+	assert (m_phlog_checksum_stable_exists(&(tmlog->phlog_checksum))); 
+
+#ifdef _DEBUG_THIS
+	printf("tmlog->phlog_checksum.head = %llu\n", tmlog->phlog_checksum.head);
+	printf("tmlog->phlog_checksum.stable_tail = %llu\n", tmlog->phlog_checksum.stable_tail);
+	printf("tmlog->phlog_checksum.read_index = %llu\n", tmlog->phlog_checksum.read_index);
+#endif	
+	while(1) {
+		if (m_phlog_checksum_read(&(tmlog->phlog_checksum), &addr) == M_R_SUCCESS) {
+			if (addr == XACT_COMMIT_MARKER) {
+				assert(m_phlog_checksum_read(&(tmlog->phlog_checksum), &sqn) == M_R_SUCCESS);
+				m_phlog_checksum_next_chunk(&tmlog->phlog_checksum);
+				/* 
+				 * The log manager drops the recovered fragment once 
+				 * m_logrecovery_store has made its stores durable.
+				 */
+				break;
+			} else if (addr == XACT_ABORT_MARKER) {
+				/* 
+				 * Recovery shouldn't be passed a log fragment corresponding to
+				 * an aborted transaction.
+				 */
+				M_INTERNALERROR("Trying to recover an aborted transaction!\n");
+			} else if (addr == XACT_RANGE_MARKER) {
+				assert(m_phlog_checksum_read(&(tmlog->phlog_checksum), &addr) == M_R_SUCCESS);
+				assert(m_phlog_checksum_read(&(tmlog->phlog_checksum), &nwords) == M_R_SUCCESS);
+				for (n = 0; n < nwords; n++, addr += sizeof(pcm_word_t)) {
+					assert(m_phlog_checksum_read(&(tmlog->phlog_checksum), &value) == M_R_SUCCESS);
+					m_logrecovery_store(set, addr, value, ~((pcm_word_t) 0));
+				}
+			} else if (addr == XACT_LOGICAL_MARKER) {
+				assert(m_phlog_checksum_read(&(tmlog->phlog_checksum), &opcode) == M_R_SUCCESS);
+				assert(m_phlog_checksum_read(&(tmlog->phlog_checksum), &size) == M_R_SUCCESS);
+				assert(size <= XACT_LOGICAL_ARGS_MAX);
+				for (n = 0; n < size; n += sizeof(pcm_word_t)) {
+					assert(m_phlog_checksum_read(&(tmlog->phlog_checksum), &args[n / sizeof(pcm_word_t)]) == M_R_SUCCESS);
+				}
+				m_logrecovery_logical(set, (unsigned int) opcode, args, size);
+			} else if (addr & XACT_LINE_BIT) {
+				line = XACT_LINE_ADDR(addr);
+				bitmap = XACT_LINE_BITMAP(addr);
+				for (n = 0; n < XACT_LINE_SIZE / sizeof(pcm_word_t); n++) {
+					if (bitmap & (1 << n)) {
+						assert(m_phlog_checksum_read(&(tmlog->phlog_checksum), &value) == M_R_SUCCESS);
+						m_logrecovery_store(set, line + n * sizeof(pcm_word_t), value, ~((pcm_word_t) 0));
+					}
+				}
+			} else {
+				assert(m_phlog_checksum_read(&(tmlog->phlog_checksum), &value) == M_R_SUCCESS);
+				if (addr & XACT_FULL_MASK_BIT) {
+					addr &= ~((uintptr_t) XACT_FULL_MASK_BIT);
+					mask = ~((pcm_word_t) 0);
+				} else {
+					assert(m_phlog_checksum_read(&(tmlog->phlog_checksum), &mask) == M_R_SUCCESS);
+				}
+				m_logrecovery_store(set, addr, value, mask);
+			}	
+		} else {
+			M_INTERNALERROR("Invariant violation: there must be at least one atomic log fragment.");
+		}
+	}	
+
+	return M_R_SUCCESS;
+}
+
+
+m_result_t 
+m_tmlog_checksum_report_stats(m_log_dsc_t *log_dsc)
+{
+	m_tmlog_checksum_t *tmlog = (m_tmlog_checksum_t *) log_dsc->log;
+	m_phlog_checksum_t *phlog = &(tmlog->phlog_checksum);
+
+	printf("PRINT CHECKSUM STATS\n");
+	printf("wait_for_trunc               : %llu\n", phlog->stat_wait_for_trunc);
+	if (phlog->stat_wait_for_trunc > 0) {
+		printf("AVG(stat_wait_time_for_trunc): %llu\n", phlog->stat_wait_time_for_trunc / phlog->stat_wait_for_trunc);
+	}
+	printf("chunks                       : %llu\n", phlog->stat_chunks);
+	printf("padded_chunks                : %llu\n", phlog->stat_padded_chunks);
+	printf("pad_words                    : %llu\n", phlog->stat_pad_words);
+	if (phlog->stat_chunks > 0) {
+		printf("padding (%% of log bytes)     : %.1f\n", 
+		       100.0 * phlog->stat_pad_words / (phlog->stat_chunks * CHECKSUM_CHUNK_NWORDS));
+	}
+}
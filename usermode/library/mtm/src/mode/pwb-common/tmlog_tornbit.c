@@ -42,7 +42,6 @@
 #include <assert.h>
 #include <mnemosyne.h>
 #include <pcm.h>
-#include <cuckoo_hash/PointerHashInline.h>
 #include <debug.h>
 #include "tmlog_tornbit.h"
 
@@ -52,14 +51,13 @@ m_log_ops_t tmlog_tornbit_ops = {
 	m_tmlog_tornbit_truncation_init,
 	m_tmlog_tornbit_truncation_prepare_next,
 	m_tmlog_tornbit_truncation_do,
+	m_tmlog_tornbit_truncation_publish,
 	m_tmlog_tornbit_recovery_init,
 	m_tmlog_tornbit_recovery_prepare_next,
 	m_tmlog_tornbit_recovery_do,
 	m_tmlog_tornbit_report_stats,
 };
 
-#define FLUSH_CACHELINE_ONCE
-
 /* Print debug messages */
 #undef _DEBUG_THIS
 //#define _DEBUG_THIS
@@ -73,36 +71,12 @@ m_log_ops_t tmlog_tornbit_ops = {
   printf("head       : %lu\n", tmlog->phlog_tornbit.head);        \
   printf("read_index : %lu\n", tmlog->phlog_tornbit.read_index);
 
-void PointerHash_removeKey_noshrink(PointerHash *self, void *k)
-{
-	PointerHashRecord *r;
-	
-	r = PointerHash_record1_(self, k);	
-	if(r->k == k)
-	{
-		r->k = 0x0;
-		r->v = 0x0;
-		self->keyCount --;
-		return;
-	}
-	
-	r = PointerHash_record2_(self, k);
-	if(r->k == k)
-	{
-		r->k = 0x0;
-		r->v = 0x0;
-		self->keyCount --;
-		return;
-	}
-}
-
-
 m_result_t 
 m_tmlog_tornbit_alloc(m_log_dsc_t *log_dsc)
 {
 	m_tmlog_tornbit_t *tmlog_tornbit;
 
-	if (posix_memalign((void **) &tmlog_tornbit, sizeof(uint64_t), sizeof(m_tmlog_tornbit_t)) != 0) 
+	if (posix_memalign((void **) &tmlog_tornbit, CACHELINE_SIZE, sizeof(m_tmlog_tornbit_t)) != 0) 
 	{
 		return M_R_FAILURE;
 	}
@@ -111,7 +85,11 @@ m_tmlog_tornbit_alloc(m_log_dsc_t *log_dsc)
 	 * word aligned.
 	 */
 	assert((( (uintptr_t) &tmlog_tornbit->phlog_tornbit) & (sizeof(uint64_t)-1)) == 0);
-	tmlog_tornbit->flush_set = (tornbit_flush_set_t *) PointerHash_new();
+	if ((tmlog_tornbit->flush_set = m_flushset_new()) == NULL) {
+		free(tmlog_tornbit);
+		return M_R_FAILURE;
+	}
+	m_logship_stream_init(&tmlog_tornbit->remote);
 	log_dsc->log = (m_log_t *) tmlog_tornbit;
 
 	return M_R_SUCCESS;
@@ -127,7 +105,8 @@ m_tmlog_tornbit_init(pcm_storeset_t *set, m_log_t *log, m_log_dsc_t *log_dsc)
 	m_phlog_tornbit_format(set, 
 	                       (m_phlog_tornbit_nvmd_t *) log_dsc->nvmd, 
 	                       log_dsc->nvphlog, 
-	                       LF_TYPE_TM_TORNBIT);
+	                       LF_TYPE_TM_TORNBIT, 
+	                       log_dsc->size_log2);
 	m_phlog_tornbit_init(phlog_tornbit, 
 	                     (m_phlog_tornbit_nvmd_t *) log_dsc->nvmd, 
 	                     log_dsc->nvphlog);
@@ -136,6 +115,22 @@ m_tmlog_tornbit_init(pcm_storeset_t *set, m_log_t *log, m_log_dsc_t *log_dsc)
 }
 
 
+/* Makes sure the cache block written by a log record reaches memory. */
+static inline
+void
+truncation_flush_block(pcm_storeset_t *set, m_tmlog_tornbit_t *tmlog, uintptr_t block_addr)
+{
+	if (MTM_UNSAFE_DISABLED(MTM_UNSAFE_HOME_FLUSH)) {
+		return;
+	}
+#ifdef FLUSH_CACHELINE_ONCE
+	m_flushset_add(tmlog->flush_set, block_addr);
+#else
+	PCM_WB_FLUSH(set, (volatile pcm_word_t *) block_addr);
+#endif
+}
+
+
 static inline
 m_result_t 
 truncation_prepare(pcm_storeset_t *set, m_log_dsc_t *log_dsc)
@@ -145,7 +140,13 @@ truncation_prepare(pcm_storeset_t *set, m_log_dsc_t *log_dsc)
 	uint64_t          sqn = INV_LOG_ORDER;
 	uintptr_t         addr;
 	pcm_word_t        mask;
+	pcm_word_t        nwords;
+	pcm_word_t        opcode;
+	pcm_word_t        size;
+	pcm_word_t        n;
 	uintptr_t         block_addr;
+	uintptr_t         line;
+	pcm_word_t        bitmap;
 	int               val;
 
 #ifdef _DEBUG_THIS
@@ -162,8 +163,13 @@ retry:
 	if (m_phlog_tornbit_stable_exists(&(tmlog->phlog_tornbit))) {
 		while(1) {
 			if (m_phlog_tornbit_read(&(tmlog->phlog_tornbit), &addr) == M_R_SUCCESS) {
-				if (addr == XACT_COMMIT_MARKER) {
-					assert(m_phlog_tornbit_read(&(tmlog->phlog_tornbit), &sqn) == M_R_SUCCESS);
+				if (addr == XACT_COMMIT_MARKER || (addr & XACT_COMMIT_INLINE_BIT)) {
+					if (addr == XACT_COMMIT_MARKER) {
+						assert(m_phlog_tornbit_read(&(tmlog->phlog_tornbit), &sqn) == M_R_SUCCESS);
+					} else {
+						sqn = addr & ~XACT_COMMIT_INLINE_BIT;
+					}
+					m_logship_commit(log_dsc, sqn);
 					m_phlog_tornbit_next_chunk(&tmlog->phlog_tornbit);
 					break;
 				} else if (addr == XACT_ABORT_MARKER) {
@@ -171,27 +177,59 @@ retry:
 					 * Log fragment corresponds to an aborted transaction.
 					 * Ignore it, truncate the log up to here, and retry.
 					 */
-					//FIXME: truncate the log up to here
+					assert(m_phlog_tornbit_read(&(tmlog->phlog_tornbit), &sqn) == M_R_SUCCESS);
+					m_phlog_tornbit_next_chunk(&tmlog->phlog_tornbit);
+					m_logship_abort(log_dsc);
+#ifdef FLUSH_CACHELINE_ONCE
+					m_flushset_clear(tmlog->flush_set);
+#endif					
+					log_dsc->trunc_point = m_phlog_tornbit_truncation_point(&tmlog->phlog_tornbit);
+					sqn = INV_LOG_ORDER;
 					goto retry;
+				} else if (addr == XACT_RANGE_MARKER) {
+					assert(m_phlog_tornbit_read(&(tmlog->phlog_tornbit), &addr) == M_R_SUCCESS);
+					assert(m_phlog_tornbit_read(&(tmlog->phlog_tornbit), &nwords) == M_R_SUCCESS);
+					for (n = 0, block_addr = 0; n < nwords; n++, addr += sizeof(pcm_word_t)) {
+						assert(m_phlog_tornbit_read(&(tmlog->phlog_tornbit), &value) == M_R_SUCCESS);
+						m_logship_store(log_dsc, addr, value, ~((pcm_word_t) 0));
+						if ((uintptr_t) BLOCK_ADDR(addr) != block_addr) {
+							block_addr = (uintptr_t) BLOCK_ADDR(addr);
+							truncation_flush_block(set, tmlog, block_addr);
+						}
+					}
+				} else if (addr == XACT_LOGICAL_MARKER) {
+					assert(m_phlog_tornbit_read(&(tmlog->phlog_tornbit), &opcode) == M_R_SUCCESS);
+					assert(m_phlog_tornbit_read(&(tmlog->phlog_tornbit), &size) == M_R_SUCCESS);
+					m_logship_logical(log_dsc, opcode, size);
+					for (n = 0; n < size; n += sizeof(pcm_word_t)) {
+						assert(m_phlog_tornbit_read(&(tmlog->phlog_tornbit), &value) == M_R_SUCCESS);
+						m_logship_word(log_dsc, value);
+					}
+				} else if (addr & XACT_LINE_BIT) {
+					line = XACT_LINE_ADDR(addr);
+					bitmap = XACT_LINE_BITMAP(addr);
+					for (n = 0; n < XACT_LINE_SIZE / sizeof(pcm_word_t); n++) {
+						if (bitmap & (1 << n)) {
+							assert(m_phlog_tornbit_read(&(tmlog->phlog_tornbit), &value) == M_R_SUCCESS);
+							m_logship_store(log_dsc, line + n * sizeof(pcm_word_t), value, ~((pcm_word_t) 0));
+						}
+					}
+					truncation_flush_block(set, tmlog, (uintptr_t) BLOCK_ADDR(line));
 				} else {
 					assert(m_phlog_tornbit_read(&(tmlog->phlog_tornbit), &value) == M_R_SUCCESS);
-					assert(m_phlog_tornbit_read(&(tmlog->phlog_tornbit), &mask) == M_R_SUCCESS);
+					if (addr & XACT_FULL_MASK_BIT) {
+						addr &= ~((uintptr_t) XACT_FULL_MASK_BIT);
+						mask = ~((pcm_word_t) 0);
+					} else {
+						assert(m_phlog_tornbit_read(&(tmlog->phlog_tornbit), &mask) == M_R_SUCCESS);
+					}
 #ifdef _DEBUG_THIS
 					printf("addr  = 0x%lX\n", addr);
 					printf("value = 0x%lX\n", value);
 					printf("mask  = 0x%lX\n", mask);
 #endif
-					block_addr = (uintptr_t) BLOCK_ADDR(addr);
-
-#ifdef FLUSH_CACHELINE_ONCE
-					if (!PointerHash_at_((PointerHash *) tmlog->flush_set, (void *) block_addr)) {
-						PointerHash_at_put_((PointerHash *) tmlog->flush_set, 
-						                    (void *) block_addr, 
-						                    (void *) 1);
-					}
-#else 					
-					PCM_WB_FLUSH(set, (volatile pcm_word_t *) block_addr);
-#endif					
+					m_logship_store(log_dsc, addr, value, mask);
+					truncation_flush_block(set, tmlog, (uintptr_t) BLOCK_ADDR(addr));
 				}	
 			} else {
 				M_INTERNALERROR("Invariant violation: there must be at least one atomic log fragment.");
@@ -223,9 +261,7 @@ m_tmlog_tornbit_truncation_prepare_next(pcm_storeset_t *set, m_log_dsc_t *log_ds
 m_result_t 
 m_tmlog_tornbit_truncation_do(pcm_storeset_t *set, m_log_dsc_t *log_dsc)
 {
-	int               i;
 	m_tmlog_tornbit_t *tmlog = (m_tmlog_tornbit_t *) log_dsc->log;
-	uintptr_t         block_addr;
 
 #ifdef _DEBUG_THIS
 	printf("m_tmlog_tornbit_truncation_do: START\n");
@@ -233,16 +269,12 @@ m_tmlog_tornbit_truncation_do(pcm_storeset_t *set, m_log_dsc_t *log_dsc)
 #endif
 
 #ifdef FLUSH_CACHELINE_ONCE
-	for(i = 0; i < ((PointerHash *) tmlog->flush_set)->size; i++) {
-		PointerHashRecord *r = PointerHashRecords_recordAt_(((PointerHash *) tmlog->flush_set)->records, i);
-		if (block_addr = (uintptr_t) r->k) {
-			//PointerHash_removeKey_noshrink((PointerHash *) tmlog->flush_set, (void *) block_addr);
-			PointerHash_removeKey_((PointerHash *) tmlog->flush_set, (void *) block_addr);
-			PCM_WB_FLUSH(set, (volatile pcm_word_t *) block_addr);
-		}
-	}
+	m_flushset_flush(set, tmlog->flush_set);
 #endif	
-	m_phlog_tornbit_truncate_async(set, &tmlog->phlog_tornbit);
+	/* The head moves once the truncation checkpoint is taken */
+	log_dsc->trunc_point = m_phlog_tornbit_truncation_point(&tmlog->phlog_tornbit);
+	log_dsc->trunc_words = (tmlog->phlog_tornbit.read_index - tmlog->phlog_tornbit.head) & 
+	                       tmlog->phlog_tornbit.mask;
 
 #ifdef _DEBUG_THIS
 	printf("m_tmlog_tornbit_truncation_do: DONE\n");
@@ -252,6 +284,33 @@ m_tmlog_tornbit_truncation_do(pcm_storeset_t *set, m_log_dsc_t *log_dsc)
 	return M_R_SUCCESS;
 }
 
+
+m_result_t 
+m_tmlog_tornbit_truncation_publish(pcm_storeset_t *set, m_log_dsc_t *log_dsc)
+{
+	m_tmlog_tornbit_t *tmlog = (m_tmlog_tornbit_t *) log_dsc->log;
+
+	if (log_dsc->trunc_point != INV_LOG_ORDER) {
+		m_phlog_tornbit_truncate_to(set, &tmlog->phlog_tornbit, log_dsc->trunc_point);
+		log_dsc->trunc_point = INV_LOG_ORDER;
+	}
+
+	return M_R_SUCCESS;
+}
+
+
+/* 
+ * Reads the next word of the fragment being prepared for recovery. Chunks
+ * are written out before the fragment commits, so after a crash the stable
+ * region may end inside a fragment; that fragment is not recovered.
+ */
+#define RECOVERY_READ(tmlog, valuep)                                          \
+  do {                                                                        \
+    if (m_phlog_tornbit_read(&((tmlog)->phlog_tornbit), (valuep)) != M_R_SUCCESS) { \
+      goto uncommitted;                                                       \
+    }                                                                         \
+  } while (0)
+
 static inline
 m_result_t 
 recovery_prepare_next(pcm_storeset_t *set, m_log_dsc_t *log_dsc)
@@ -261,6 +320,10 @@ recovery_prepare_next(pcm_storeset_t *set, m_log_dsc_t *log_dsc)
 	uint64_t          sqn = INV_LOG_ORDER;
 	uintptr_t         addr;
 	pcm_word_t        mask;
+	pcm_word_t        nwords;
+	pcm_word_t        opcode;
+	pcm_word_t        size;
+	pcm_word_t        n;
 	uintptr_t         block_addr;
 	int               val;
 	uint64_t          readindex_checkpoint;
@@ -285,23 +348,51 @@ retry:
 		assert(m_phlog_tornbit_checkpoint_readindex(&(tmlog->phlog_tornbit), &readindex_checkpoint) == M_R_SUCCESS);
 		while(1) {
 			if (m_phlog_tornbit_read(&(tmlog->phlog_tornbit), &addr) == M_R_SUCCESS) {
-				if (addr == XACT_COMMIT_MARKER) {
-					assert(m_phlog_tornbit_read(&(tmlog->phlog_tornbit), &sqn) == M_R_SUCCESS);
+				if (addr == XACT_COMMIT_MARKER || (addr & XACT_COMMIT_INLINE_BIT)) {
+					if (addr == XACT_COMMIT_MARKER) {
+						RECOVERY_READ(tmlog, &sqn);
+					} else {
+						sqn = addr & ~XACT_COMMIT_INLINE_BIT;
+					}
 					m_phlog_tornbit_restore_readindex(&(tmlog->phlog_tornbit), readindex_checkpoint);
 					break;
 				} else if (addr == XACT_ABORT_MARKER) {
-					assert(m_phlog_tornbit_read(&(tmlog->phlog_tornbit), &sqn) == M_R_SUCCESS);
+					RECOVERY_READ(tmlog, &sqn);
 					m_phlog_tornbit_next_chunk(&tmlog->phlog_tornbit);
-					/* Ignore an aborted transaction's log fragment */
-					m_phlog_tornbit_truncate_async(set, &tmlog->phlog_tornbit);
+					/* 
+					 * Ignore an aborted transaction's log fragment. It is 
+					 * truncated along with the recovered fragments once 
+					 * their stores are durable.
+					 */
 					sqn = INV_LOG_ORDER;
 					goto retry;
+				} else if (addr == XACT_RANGE_MARKER) {
+					RECOVERY_READ(tmlog, &addr);
+					RECOVERY_READ(tmlog, &nwords);
+					for (n = 0; n < nwords; n++) {
+						RECOVERY_READ(tmlog, &value);
+					}
+				} else if (addr == XACT_LOGICAL_MARKER) {
+					RECOVERY_READ(tmlog, &opcode);
+					RECOVERY_READ(tmlog, &size);
+					for (n = 0; n < size; n += sizeof(pcm_word_t)) {
+						RECOVERY_READ(tmlog, &value);
+					}
+				} else if (addr & XACT_LINE_BIT) {
+					for (n = __builtin_popcount(XACT_LINE_BITMAP(addr)); n > 0; n--) {
+						RECOVERY_READ(tmlog, &value);
+					}
 				} else {
-					assert(m_phlog_tornbit_read(&(tmlog->phlog_tornbit), &value) == M_R_SUCCESS);
-					assert(m_phlog_tornbit_read(&(tmlog->phlog_tornbit), &mask) == M_R_SUCCESS);
+					RECOVERY_READ(tmlog, &value);
+					if (addr & XACT_FULL_MASK_BIT) {
+						addr &= ~((uintptr_t) XACT_FULL_MASK_BIT);
+						mask = ~((pcm_word_t) 0);
+					} else {
+						RECOVERY_READ(tmlog, &mask);
+					}
 				}	
 			} else {
-				M_INTERNALERROR("Invariant violation: there must be at least one atomic log fragment.");
+				goto uncommitted;
 			}
 		}	
 		log_dsc->logorder = sqn;
@@ -309,6 +400,13 @@ retry:
 		log_dsc->logorder = sqn;
 	}
 	
+	return M_R_SUCCESS;
+
+uncommitted:
+	/* The commit of the last fragment never made it to the log */
+	m_phlog_tornbit_restore_readindex(&(tmlog->phlog_tornbit), readindex_checkpoint);
+	log_dsc->logorder = INV_LOG_ORDER;
+
 	return M_R_SUCCESS;
 }
 
@@ -318,6 +416,14 @@ m_tmlog_tornbit_recovery_init(pcm_storeset_t *set, m_log_dsc_t *log_dsc)
 {
 	m_tmlog_tornbit_t *tmlog = (m_tmlog_tornbit_t *) log_dsc->log;
 
+	if (log_dsc->trunc_point != INV_LOG_ORDER) {
+		/* Skip the fragments the last truncation checkpoint found durable */
+		PCM_NT_STORE(set, 
+		             (volatile pcm_word_t *) &((m_phlog_tornbit_nvmd_t *) log_dsc->nvmd)->flags, 
+		             log_dsc->trunc_point);
+		PCM_PERSIST_BARRIER(set);
+		log_dsc->trunc_point = INV_LOG_ORDER;
+	}
 	m_phlog_tornbit_init(&tmlog->phlog_tornbit, 
 	                     (m_phlog_tornbit_nvmd_t *) log_dsc->nvmd, 
 	                     log_dsc->nvphlog);
@@ -346,7 +452,14 @@ m_tmlog_tornbit_recovery_do(pcm_storeset_t *set, m_log_dsc_t *log_dsc)
 	uint64_t          sqn = INV_LOG_ORDER;
 	uintptr_t         addr;
 	pcm_word_t        mask;
+	pcm_word_t        nwords;
+	pcm_word_t        opcode;
+	pcm_word_t        size;
+	pcm_word_t        args[XACT_LOGICAL_ARGS_MAX / sizeof(pcm_word_t)];
+	pcm_word_t        n;
 	uintptr_t         block_addr;
+	uintptr_t         line;
+	pcm_word_t        bitmap;
 	int               val;
 	uint64_t          readindex_checkpoint;
 
@@ -369,11 +482,15 @@ m_tmlog_tornbit_recovery_do(pcm_storeset_t *set, m_log_dsc_t *log_dsc)
 #endif	
 	while(1) {
 		if (m_phlog_tornbit_read(&(tmlog->phlog_tornbit), &addr) == M_R_SUCCESS) {
-			if (addr == XACT_COMMIT_MARKER) {
-				assert(m_phlog_tornbit_read(&(tmlog->phlog_tornbit), &sqn) == M_R_SUCCESS);
+			if (addr == XACT_COMMIT_MARKER || (addr & XACT_COMMIT_INLINE_BIT)) {
+				if (addr == XACT_COMMIT_MARKER) {
+					assert(m_phlog_tornbit_read(&(tmlog->phlog_tornbit), &sqn) == M_R_SUCCESS);
+				}
 				m_phlog_tornbit_next_chunk(&tmlog->phlog_tornbit);
-				/* Drop the recovered log fragment */
-				m_phlog_tornbit_truncate_async(set, &tmlog->phlog_tornbit);
+				/* 
+				 * The log manager drops the recovered fragment once 
+				 * m_logrecovery_store has made its stores durable.
+				 */
 				break;
 			} else if (addr == XACT_ABORT_MARKER) {
 				/* 
@@ -381,13 +498,39 @@ m_tmlog_tornbit_recovery_do(pcm_storeset_t *set, m_log_dsc_t *log_dsc)
 				 * an aborted transaction.
 				 */
 				M_INTERNALERROR("Trying to recover an aborted transaction!\n");
+			} else if (addr == XACT_RANGE_MARKER) {
+				assert(m_phlog_tornbit_read(&(tmlog->phlog_tornbit), &addr) == M_R_SUCCESS);
+				assert(m_phlog_tornbit_read(&(tmlog->phlog_tornbit), &nwords) == M_R_SUCCESS);
+				for (n = 0; n < nwords; n++, addr += sizeof(pcm_word_t)) {
+					assert(m_phlog_tornbit_read(&(tmlog->phlog_tornbit), &value) == M_R_SUCCESS);
+					m_logrecovery_store(set, addr, value, ~((pcm_word_t) 0));
+				}
+			} else if (addr == XACT_LOGICAL_MARKER) {
+				assert(m_phlog_tornbit_read(&(tmlog->phlog_tornbit), &opcode) == M_R_SUCCESS);
+				assert(m_phlog_tornbit_read(&(tmlog->phlog_tornbit), &size) == M_R_SUCCESS);
+				assert(size <= XACT_LOGICAL_ARGS_MAX);
+				for (n = 0; n < size; n += sizeof(pcm_word_t)) {
+					assert(m_phlog_tornbit_read(&(tmlog->phlog_tornbit), &args[n / sizeof(pcm_word_t)]) == M_R_SUCCESS);
+				}
+				m_logrecovery_logical(set, (unsigned int) opcode, args, size);
+			} else if (addr & XACT_LINE_BIT) {
+				line = XACT_LINE_ADDR(addr);
+				bitmap = XACT_LINE_BITMAP(addr);
+				for (n = 0; n < XACT_LINE_SIZE / sizeof(pcm_word_t); n++) {
+					if (bitmap & (1 << n)) {
+						assert(m_phlog_tornbit_read(&(tmlog->phlog_tornbit), &value) == M_R_SUCCESS);
+						m_logrecovery_store(set, line + n * sizeof(pcm_word_t), value, ~((pcm_word_t) 0));
+					}
+				}
 			} else {
 				assert(m_phlog_tornbit_read(&(tmlog->phlog_tornbit), &value) == M_R_SUCCESS);
-				assert(m_phlog_tornbit_read(&(tmlog->phlog_tornbit), &mask) == M_R_SUCCESS);
-				if (mask!=0) {
-					PCM_WB_STORE_ALIGNED_MASKED(set, (volatile pcm_word_t *) addr, value, mask);
-					PCM_WB_FLUSH(set, (volatile pcm_word_t *) addr);
-				}	
+				if (addr & XACT_FULL_MASK_BIT) {
+					addr &= ~((uintptr_t) XACT_FULL_MASK_BIT);
+					mask = ~((pcm_word_t) 0);
+				} else {
+					assert(m_phlog_tornbit_read(&(tmlog->phlog_tornbit), &mask) == M_R_SUCCESS);
+				}
+				m_logrecovery_store(set, addr, value, mask);
 			}	
 		} else {
 			M_INTERNALERROR("Invariant violation: there must be at least one atomic log fragment.");
@@ -409,4 +552,11 @@ m_tmlog_tornbit_report_stats(m_log_dsc_t *log_dsc)
 	if (phlog->stat_wait_for_trunc > 0) {
 		printf("AVG(stat_wait_time_for_trunc): %llu\n", phlog->stat_wait_time_for_trunc / phlog->stat_wait_for_trunc);
 	}
+	printf("chunks                       : %llu\n", phlog->stat_chunks);
+	printf("padded_chunks                : %llu\n", phlog->stat_padded_chunks);
+	printf("pad_words                    : %llu\n", phlog->stat_pad_words);
+	if (phlog->stat_chunks > 0) {
+		printf("padding (%% of log bytes)     : %.1f\n", 
+		       100.0 * phlog->stat_pad_words / (phlog->stat_chunks * CHUNK_NWORDS));
+	}
 }
@@ -0,0 +1,304 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/*!
+ * \file
+ *
+ * \brief Implements the undo log for persistent write-through transactions.
+ */
+
+#include <stdio.h>
+#include <assert.h>
+#include <mnemosyne.h>
+#include <pcm.h>
+#include <debug.h>
+#include "tmlog_undo.h"
+
+m_log_ops_t tmlog_undo_ops = {
+	m_tmlog_undo_alloc,
+	m_tmlog_undo_init,
+	m_tmlog_undo_truncation_init,
+	m_tmlog_undo_truncation_prepare_next,
+	m_tmlog_undo_truncation_do,
+	m_tmlog_undo_truncation_publish,
+	m_tmlog_undo_recovery_init,
+	m_tmlog_undo_recovery_prepare_next,
+	m_tmlog_undo_recovery_do,
+	m_tmlog_undo_report_stats,
+};
+
+
+m_result_t 
+m_tmlog_undo_alloc(m_log_dsc_t *log_dsc)
+{
+	m_tmlog_undo_t *tmlog_undo;
+
+	if (posix_memalign((void **) &tmlog_undo, CACHELINE_SIZE, sizeof(m_tmlog_undo_t)) != 0) 
+	{
+		return M_R_FAILURE;
+	}
+	/* 
+	 * The underlying physical log volatile structure requires to be
+	 * word aligned.
+	 */
+	assert((( (uintptr_t) &tmlog_undo->phlog_base) & (sizeof(uint64_t)-1)) == 0);
+	log_dsc->log = (m_log_t *) tmlog_undo;
+
+	return M_R_SUCCESS;
+}
+
+
+m_result_t 
+m_tmlog_undo_init(pcm_storeset_t *set, m_log_t *log, m_log_dsc_t *log_dsc)
+{
+	m_tmlog_undo_t *tmlog_undo = (m_tmlog_undo_t *) log;
+	m_phlog_base_t *phlog_base = &(tmlog_undo->phlog_base);
+
+	m_phlog_base_format(set, 
+	                    (m_phlog_base_nvmd_t *) log_dsc->nvmd, 
+	                    log_dsc->nvphlog, 
+	                    LF_TYPE_TM_UNDO, 
+	                    log_dsc->size_log2);
+	m_phlog_base_init(phlog_base, 
+	                  (m_phlog_base_nvmd_t *) log_dsc->nvmd, 
+	                  log_dsc->nvphlog);
+
+	return M_R_SUCCESS;
+}
+
+
+/*
+ * Reads one record of the stable log, applying it to memory if set is not
+ * NULL. Returns the marker read, 0 for an undo record, or 
+ * XACT_RANGE_MARKER if the stable log ends before the record.
+ */
+static
+pcm_word_t
+read_record(pcm_storeset_t *set, m_tmlog_undo_t *tmlog)
+{
+	m_phlog_base_t *phlog = &(tmlog->phlog_base);
+	pcm_word_t     addr;
+	pcm_word_t     value;
+	pcm_word_t     mask;
+	pcm_word_t     nwords;
+	pcm_word_t     n;
+
+	if (m_phlog_base_read(phlog, &addr) != M_R_SUCCESS) {
+		return XACT_RANGE_MARKER;
+	}
+	if (addr == XACT_COMMIT_MARKER || addr == XACT_ABORT_MARKER) {
+		/* The sequence number */
+		assert(m_phlog_base_read(phlog, &value) == M_R_SUCCESS);
+		m_phlog_base_next_chunk(phlog);
+		return addr;
+	}
+	if (addr == XACT_RANGE_MARKER) {
+		assert(m_phlog_base_read(phlog, &addr) == M_R_SUCCESS);
+		assert(m_phlog_base_read(phlog, &nwords) == M_R_SUCCESS);
+		for (n = 0; n < nwords; n++, addr += sizeof(pcm_word_t)) {
+			assert(m_phlog_base_read(phlog, &value) == M_R_SUCCESS);
+			if (set) {
+				m_logrecovery_store(set, (uintptr_t) addr, value, ~((pcm_word_t) 0));
+			}
+		}
+	} else {
+		assert(m_phlog_base_read(phlog, &value) == M_R_SUCCESS);
+		assert(m_phlog_base_read(phlog, &mask) == M_R_SUCCESS);
+		if (set) {
+			m_logrecovery_store(set, (uintptr_t) addr, value, mask);
+		}
+	}
+	/* Each record was flushed on its own and the next one starts a chunk */
+	m_phlog_base_next_chunk(phlog);
+	return 0;
+}
+
+
+/*
+ * Reads the next fragment of the stable log. Returns 1 if it ends with a 
+ * marker. Otherwise it belongs to a transaction that was still running: 
+ * the read index is left at its start and 0 is returned.
+ */
+static
+int
+read_fragment(m_tmlog_undo_t *tmlog)
+{
+	uint64_t   start;
+	pcm_word_t marker;
+
+	m_phlog_base_checkpoint_readindex(&(tmlog->phlog_base), &start);
+	while ((marker = read_record(NULL, tmlog)) == 0) {
+	}
+	if (marker == XACT_RANGE_MARKER) {
+		m_phlog_base_restore_readindex(&(tmlog->phlog_base), start);
+		return 0;
+	}
+	return 1;
+}
+
+
+/*
+ * A fragment that ends with a marker needs nothing flushed to be dropped:
+ * its stores or its restored old values were made durable before the 
+ * marker was written.
+ */
+static inline
+m_result_t 
+truncation_prepare(pcm_storeset_t *set, m_log_dsc_t *log_dsc)
+{
+	m_tmlog_undo_t *tmlog = (m_tmlog_undo_t *) log_dsc->log;
+
+	while (read_fragment(tmlog)) {
+		log_dsc->trunc_point = m_phlog_base_truncation_point(&tmlog->phlog_base);
+	}
+	log_dsc->logorder = INV_LOG_ORDER;
+	
+	return M_R_SUCCESS;
+}
+
+
+m_result_t 
+m_tmlog_undo_truncation_init(pcm_storeset_t *set, m_log_dsc_t *log_dsc)
+{
+	return truncation_prepare(set, log_dsc);
+}
+
+
+m_result_t 
+m_tmlog_undo_truncation_prepare_next(pcm_storeset_t *set, m_log_dsc_t *log_dsc)
+{
+	return truncation_prepare(set, log_dsc);
+}
+
+
+m_result_t 
+m_tmlog_undo_truncation_do(pcm_storeset_t *set, m_log_dsc_t *log_dsc)
+{
+	m_tmlog_undo_t *tmlog = (m_tmlog_undo_t *) log_dsc->log;
+
+	/* The head moves once the truncation checkpoint is taken */
+	log_dsc->trunc_point = m_phlog_base_truncation_point(&tmlog->phlog_base);
+	log_dsc->trunc_words = (tmlog->phlog_base.read_index - tmlog->phlog_base.head) & 
+	                       tmlog->phlog_base.mask;
+
+	return M_R_SUCCESS;
+}
+
+
+m_result_t 
+m_tmlog_undo_truncation_publish(pcm_storeset_t *set, m_log_dsc_t *log_dsc)
+{
+	m_tmlog_undo_t *tmlog = (m_tmlog_undo_t *) log_dsc->log;
+
+	if (log_dsc->trunc_point != INV_LOG_ORDER) {
+		m_phlog_base_truncate_to(set, &tmlog->phlog_base, log_dsc->trunc_point);
+		log_dsc->trunc_point = INV_LOG_ORDER;
+	}
+
+	return M_R_SUCCESS;
+}
+
+
+/*
+ * Only a fragment with no marker needs recovery. Transactions hold the 
+ * locks of what they store to until their fragment ends, so the fragments
+ * of different logs cover different words and are recovered in any order.
+ */
+m_result_t 
+m_tmlog_undo_recovery_init(pcm_storeset_t *set, m_log_dsc_t *log_dsc)
+{
+	m_tmlog_undo_t *tmlog = (m_tmlog_undo_t *) log_dsc->log;
+
+	if (log_dsc->trunc_point != INV_LOG_ORDER) {
+		/* Skip the fragments the last truncation checkpoint found durable */
+		PCM_NT_STORE(set, 
+		             (volatile pcm_word_t *) &((m_phlog_base_nvmd_t *) log_dsc->nvmd)->head, 
+		             log_dsc->trunc_point);
+		PCM_PERSIST_BARRIER(set);
+		log_dsc->trunc_point = INV_LOG_ORDER;
+	}
+	m_phlog_base_init(&tmlog->phlog_base, 
+	                  (m_phlog_base_nvmd_t *) log_dsc->nvmd, 
+	                  log_dsc->nvphlog);
+
+	while (read_fragment(tmlog)) {
+	}
+	if (m_phlog_base_stable_exists(&(tmlog->phlog_base))) {
+		log_dsc->logorder = 0;
+	} else {
+		log_dsc->logorder = INV_LOG_ORDER;
+	}
+
+	return M_R_SUCCESS;
+}
+
+
+m_result_t 
+m_tmlog_undo_recovery_prepare_next(pcm_storeset_t *set, m_log_dsc_t *log_dsc)
+{
+	/* There is at most one fragment to recover */
+	log_dsc->logorder = INV_LOG_ORDER;
+
+	return M_R_SUCCESS;
+}
+
+
+m_result_t 
+m_tmlog_undo_recovery_do(pcm_storeset_t *set, m_log_dsc_t *log_dsc)
+{
+	m_tmlog_undo_t *tmlog = (m_tmlog_undo_t *) log_dsc->log;
+
+	/* 
+	 * Write the old values back. The log manager drops the fragment once 
+	 * m_logrecovery_store has made them durable.
+	 */
+	while (read_record(set, tmlog) == 0) {
+	}
+
+	return M_R_SUCCESS;
+}
+
+
+m_result_t 
+m_tmlog_undo_report_stats(m_log_dsc_t *log_dsc)
+{
+	m_tmlog_undo_t *tmlog = (m_tmlog_undo_t *) log_dsc->log;
+	m_phlog_base_t *phlog = &(tmlog->phlog_base);
+
+	printf("PRINT UNDO STATS\n");
+	printf("wait_for_trunc               : %llu\n", phlog->stat_wait_for_trunc);
+	if (phlog->stat_wait_for_trunc > 0) {
+		printf("AVG(stat_wait_time_for_trunc): %llu\n", phlog->stat_wait_time_for_trunc / phlog->stat_wait_for_trunc);
+	}	
+
+	return M_R_SUCCESS;
+}
@@ -31,12 +31,40 @@
 */
 
 #include <stdio.h>
+#include <string.h>
 #include <mnemosyne.h>
 #include <pcm.h>
 
 // These two must come before all other includes; they define things like w_entry_t.
 #include "pwb_i.h"
 #include "mode/pwb-common/barrier-bits.h"
+
+/* Transactions without isolation call out to the pwbnl barriers */
+extern mtm_word_t mtm_pwbnl_load(mtm_tx_t *, volatile mtm_word_t *);
+extern void mtm_pwbnl_store2(mtm_tx_t *, volatile mtm_word_t *, mtm_word_t, mtm_word_t);
+extern void mtm_pwbnl_store_words(mtm_tx_t *, volatile mtm_word_t *, const uint8_t *, size_t);
+extern void mtm_pwbnl_load_words(mtm_tx_t *, volatile mtm_word_t *, uint8_t *, size_t);
+
+/* The _ITM_ barriers of this file inline the word barriers */
+#define BARRIER_WORD_LOAD(NAME, tx, addr)                                      \
+	(PWB_ISOLATION(tx) ? pwb_load_internal(tx, addr, 1)                        \
+	                   : mtm_pwbnl_load(tx, addr))
+/* A read for write locks the word; a read after read adds no read-set entry */
+#define BARRIER_WORD_LOAD_RfW(NAME, tx, addr)                                  \
+	(PWB_ISOLATION(tx) ? pwb_load_for_write(tx, addr)                          \
+	                   : mtm_pwbnl_load(tx, addr))
+#define BARRIER_WORD_LOAD_RaR(NAME, tx, addr)                                  \
+	(PWB_ISOLATION(tx) ? pwb_load_after_read(tx, addr)                         \
+	                   : mtm_pwbnl_load(tx, addr))
+#define BARRIER_WORD_STORE(NAME, tx, addr, value, mask)                        \
+	do {                                                                       \
+		if (PWB_ISOLATION(tx)) {                                               \
+			pwb_write_internal(tx, addr, value, mask, 1);                      \
+		} else {                                                               \
+			mtm_pwbnl_store2(tx, addr, value, mask);                           \
+		}                                                                      \
+	} while (0)
+
 #include <barrier.h>
 
 
@@ -46,7 +74,11 @@
 void 
 mtm_pwbetl_store(mtm_tx_t *tx, volatile mtm_word_t *addr, mtm_word_t value)
 {
-	pwb_write_internal(tx, addr, value, ~(mtm_word_t)0, 1);
+	if (PWB_ISOLATION(tx)) {
+		pwb_write_internal(tx, addr, value, ~(mtm_word_t)0, 1);
+	} else {
+		mtm_pwbnl_store2(tx, addr, value, ~(mtm_word_t)0);
+	}
 }
 
 
@@ -56,7 +88,11 @@ mtm_pwbetl_store(mtm_tx_t *tx, volatile mtm_word_t *addr, mtm_word_t value)
 void 
 mtm_pwbetl_store2(mtm_tx_t *tx, volatile mtm_word_t *addr, mtm_word_t value, mtm_word_t mask)
 {
-	pwb_write_internal(tx, addr, value, mask, 1);
+	if (PWB_ISOLATION(tx)) {
+		pwb_write_internal(tx, addr, value, mask, 1);
+	} else {
+		mtm_pwbnl_store2(tx, addr, value, mask);
+	}
 }
 
 /*
@@ -65,7 +101,75 @@ mtm_pwbetl_store2(mtm_tx_t *tx, volatile mtm_word_t *addr, mtm_word_t value, mtm
 mtm_word_t 
 mtm_pwbetl_load(mtm_tx_t *tx, volatile mtm_word_t *addr)
 {
-	return pwb_load_internal(tx, addr, 1);
+	if (PWB_ISOLATION(tx)) {
+		return pwb_load_internal(tx, addr, 1);
+	}
+	return mtm_pwbnl_load(tx, addr);
+}
+
+
+/*
+ * Called by the CURRENT thread to store n consecutive words.
+ */
+void 
+mtm_pwbetl_store_words(mtm_tx_t *tx, volatile mtm_word_t *addr, const uint8_t *buf, size_t n)
+{
+	if (PWB_ISOLATION(tx)) {
+		pwb_store_words(tx, addr, buf, n, 1);
+	} else {
+		mtm_pwbnl_store_words(tx, addr, buf, n);
+	}
+}
+
+
+/*
+ * Called by the CURRENT thread to load n consecutive words.
+ */
+void 
+mtm_pwbetl_load_words(mtm_tx_t *tx, volatile mtm_word_t *addr, uint8_t *buf, size_t n)
+{
+	if (PWB_ISOLATION(tx)) {
+		pwb_load_words(tx, addr, buf, n, 1);
+	} else {
+		mtm_pwbnl_load_words(tx, addr, buf, n);
+	}
+}
+
+
+/*
+ * Called by the CURRENT thread to log the current contents of a range.
+ */
+void 
+mtm_pwbetl_log_range(mtm_tx_t *tx, const void *addr, size_t size)
+{
+	pwb_log_range(tx, addr, size);
+}
+
+
+/*
+ * Called by the CURRENT thread to open and close a logical operation.
+ */
+int 
+mtm_pwbetl_logical_begin(mtm_tx_t *tx, unsigned int opcode, const void *args, size_t size)
+{
+	return pwb_logical_begin(tx, opcode, args, size);
+}
+
+
+int 
+mtm_pwbetl_logical_end(mtm_tx_t *tx)
+{
+	return pwb_logical_end(tx);
+}
+
+
+/*
+ * Called by the CURRENT thread after it allocated a persistent block.
+ */
+void 
+mtm_pwbetl_capture_range(mtm_tx_t *tx, const void *addr, size_t size)
+{
+	pwb_captured_add(tx, (mode_data_t *) tx->active_modedata, addr, size);
 }
 
 
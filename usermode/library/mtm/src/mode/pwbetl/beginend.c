@@ -40,7 +40,7 @@ mtm_pwbetl_beginTransaction_internal (mtm_tx_t *tx,
                                    _ITM_srcLocation *srcloc, jmp_buf **__env)
 {
 	PM_START_TX();
-	return beginTransaction_internal (tx, prop, srcloc, 1, __env);
+	return beginTransaction_internal (tx, prop, srcloc, PWB_ISOLATION(tx), __env);
 }
 
 
@@ -50,7 +50,14 @@ mtm_pwbetl_rollbackTransaction (mtm_tx_t *tx, const _ITM_srcLocation *loc)
 	assert ((tx->prop & pr_hasNoAbort) == 0);
 	//assert ((mtm_tx()->state & STATE_ABORTING) == 0);
 
+#ifdef HTM_FASTPATH
+	if (tx->htm) {
+		htm_abort(HTM_CODE_RESTART);
+	}
+#endif /* HTM_FASTPATH */
 	rollback_transaction (tx);
+	pwb_serial_exit (tx);
+	mtm_sched_end (tx);
 	//tx->status |= STATE_ABORTING;
 }
 
@@ -66,26 +73,37 @@ mtm_pwbetl_abortTransaction (mtm_tx_t *tx,
 	        (reason == userRetry && 1));
 	//assert ((tx->state & STATE_ABORTING) == 0);
 
-	if (tx->status & TX_IRREVOCABLE) {
+	if (tx->serial & MTM_SERIAL_IRREVOCABLE) {
 		abort ();
 	}	
+#ifdef HTM_FASTPATH
+	/* Let the software path perform the abort */
+	if (tx->htm) {
+		htm_abort(HTM_CODE_RESTART);
+	}
+#endif /* HTM_FASTPATH */
 
 	if (reason == userAbort) {
+#ifdef CLOSED_NESTING
+		/* Abort the innermost nested transaction that has a savepoint (a 
+		 * flattened one aborts along with the transaction it is part of) */
+		mode_data_t *modedata = (mode_data_t *) tx->active_modedata;
+
+		while (modedata->nb_savepoints > 0) {
+			mtm_pwb_savepoint_t *sp = &modedata->savepoints[--modedata->nb_savepoints];
+
+			if (sp->kind == PWB_SAVEPOINT_NESTED) {
+				pwb_savepoint_rollback (tx, sp);
+				tx->nesting = sp->nesting - 1;
+				_ITM_siglongjmp (sp->jb, a_abortTransaction | a_restoreLiveVariables);
+			}
+		}
+#endif /* CLOSED_NESTING */
 		rollback_transaction (tx);
 		//pwb_fini (td);
 
-		/* TODO: Implement serial mode to support irrevocable actions such as I/O
-		 * 
-		 * mtm_rwlock_unlock (&mtm_serial_lock);
-		 * 
-		 */
-
-		/* TODO: Implement true nesting. Currently we only flatten  nested 
-		 * transactions.
-		 * 
-		 * set_mtm_tx (tx->prev);     
-		 * free_tx (td, tx);
-		 */
+		pwb_serial_exit (tx);
+		mtm_sched_end (tx);
 
 		_ITM_siglongjmp (tx->jb, a_abortTransaction | a_restoreLiveVariables);
 	} else if (reason == userRetry) {
@@ -97,7 +115,7 @@ mtm_pwbetl_abortTransaction (mtm_tx_t *tx,
 bool _ITM_CALL_CONVENTION
 mtm_pwbetl_tryCommitTransaction (mtm_tx_t *tx, const _ITM_srcLocation *loc)
 {
-	return trycommit_transaction(tx, 1);
+	return trycommit_transaction(tx, PWB_ISOLATION(tx));
 }
 
 
@@ -105,7 +123,7 @@ void _ITM_CALL_CONVENTION
 mtm_pwbetl_commitTransaction(mtm_tx_t *tx, const _ITM_srcLocation *loc)
 {
 	MTM_DEBUG_PRINT("==> mtm_pwb_commitTransaction(%p)\n", tx);
-	if (!trycommit_transaction(tx, 1)) {
+	if (!trycommit_transaction(tx, PWB_ISOLATION(tx))) {
 		mtm_pwb_restart_transaction(tx, RESTART_VALIDATE_COMMIT);
 	}
 	if (tx->status == TX_COMMITTED) {
@@ -119,13 +137,111 @@ mtm_pwbetl_commitTransaction(mtm_tx_t *tx, const _ITM_srcLocation *loc)
 }
 
 
+/*
+ * Commit the transactions nested inside transaction tid, which becomes the
+ * innermost transaction. Transaction ids are given by the nesting level 
+ * (see _ITM_getTransactionId).
+ */
 void _ITM_CALL_CONVENTION
 mtm_pwbetl_commitTransactionToId(mtm_tx_t *tx, 
                                 const _ITM_transactionId tid,
                                 const _ITM_srcLocation *loc)
 {
-	//TODO
-	assert(0);
+	int nesting = (int) (tid - _ITM_noTransactionId);
+
+	MTM_DEBUG_PRINT("==> mtm_pwb_commitTransactionToId(%p, %u)\n", tx, tid);
+	assert(nesting >= 1 && nesting <= tx->nesting);
+	while (tx->nesting > nesting) {
+		/* Nested transactions merge into their parent and cannot fail */
+		trycommit_transaction(tx, PWB_ISOLATION(tx));
+	}
+}
+
+
+/*
+ * Savepoints requested by the application. The savepoint belongs to the 
+ * current nesting level and is re-executed from, instead of the 
+ * transaction, when a conflict happens after it. Returns 0 if a savepoint
+ * was taken.
+ */
+int
+mtm_pwbetl_setSavepoint(mtm_tx_t *tx, jmp_buf *buf, uint32_t retry)
+{
+#ifdef CLOSED_NESTING
+	mtm_pwb_savepoint_t *sp;
+
+#ifdef HTM_FASTPATH
+	/* Savepoints are kept by the software path only */
+	if (tx->htm) {
+		htm_abort(HTM_CODE_RESTART);
+	}
+#endif /* HTM_FASTPATH */
+	if (tx->serial & MTM_SERIAL_IRREVOCABLE) {
+		return -1;
+	}
+	if ((sp = pwb_savepoint_push(tx, PWB_SAVEPOINT_USER, retry, tx->prop)) == NULL) {
+		return -1;
+	}
+	memcpy(&sp->jb, buf, MTM_CHECKPOINT_SIZE);
+	return 0;
+#else /* ! CLOSED_NESTING */
+	return -1;
+#endif /* ! CLOSED_NESTING */
+}
+
+
+/*
+ * Undo everything done since the innermost savepoint of the current 
+ * nesting level and resume at it, returning value there. Returns only if 
+ * there is no such savepoint.
+ */
+int
+mtm_pwbetl_rollbackToSavepoint(mtm_tx_t *tx, uint32_t value)
+{
+#ifdef CLOSED_NESTING
+	mode_data_t         *modedata = (mode_data_t *) tx->active_modedata;
+	mtm_pwb_savepoint_t *sp;
+
+	if (modedata->nb_savepoints == 0) {
+		return -1;
+	}
+	sp = &modedata->savepoints[modedata->nb_savepoints - 1];
+	if (sp->kind != PWB_SAVEPOINT_USER || sp->nesting != tx->nesting) {
+		return -1;
+	}
+	pwb_savepoint_rollback(tx, sp);
+	_ITM_siglongjmp (sp->jb, value);
+#else /* ! CLOSED_NESTING */
+	return -1;
+#endif /* ! CLOSED_NESTING */
+}
+
+
+/*
+ * Drop the innermost savepoint of the current nesting level; what ran after
+ * it becomes part of what ran before. Returns 0 on success.
+ */
+int
+mtm_pwbetl_releaseSavepoint(mtm_tx_t *tx)
+{
+#ifdef CLOSED_NESTING
+	mode_data_t         *modedata = (mode_data_t *) tx->active_modedata;
+	mtm_pwb_savepoint_t *sp;
+
+	if (modedata->nb_savepoints == 0) {
+		return -1;
+	}
+	sp = &modedata->savepoints[modedata->nb_savepoints - 1];
+	if (sp->kind != PWB_SAVEPOINT_USER || sp->nesting != tx->nesting) {
+		return -1;
+	}
+	if (--modedata->nb_savepoints == 0) {
+		modedata->w_undo.nb_entries = 0;
+	}
+	return 0;
+#else /* ! CLOSED_NESTING */
+	return -1;
+#endif /* ! CLOSED_NESTING */
 }
 
 
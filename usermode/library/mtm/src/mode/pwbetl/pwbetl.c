@@ -35,11 +35,7 @@
 
 #include <pwb_i.h>
 #include <rwset.h>
-
-
-#ifndef RW_SET_SIZE
-#define RW_SET_SIZE (256*1024)
-#endif
+#include "config.h"
 
 #undef _DTABLE_MEMBER
 #define _DTABLE_MEMBER(result, function, args, ARG)   ARG##function,
@@ -80,18 +76,31 @@ mtm_pwbetl_create(mtm_tx_t *tx, mtm_mode_data_t **datap)
 	mtm_allocate_rs_entries(tx, data, 0);
 
 	/* Volatile write set */
-	data->w_set.nb_entries = 0;
-	data->w_set.size = RW_SET_SIZE;
-	data->w_set.reallocate = 0;
-	mtm_allocate_ws_entries(tx, data, 0);
-
-	/* Non-volatile log */
-#ifdef SYNC_TRUNCATION	
-	m_logmgr_alloc_log(tx->pcm_storeset, M_TMLOG_LF_TYPE, 0, &data->ptmlog_dsc);
-#else
-	m_logmgr_alloc_log(tx->pcm_storeset, M_TMLOG_LF_TYPE, LF_ASYNC_TRUNCATION, &data->ptmlog_dsc);
-#endif	
-	data->ptmlog = (M_TMLOG_T *) data->ptmlog_dsc->log;
+	mtm_allocate_ws_entries(tx, data, RW_SET_SIZE);
+	memset(data->sites, 0, sizeof(data->sites));
+	data->sized_begins = 0;
+	data->r_peak = 0;
+	data->w_peak = 0;
+
+#ifdef CLOSED_NESTING
+	/* Savepoints of nested transactions */
+	data->w_undo.entries = NULL;
+	data->w_undo.nb_entries = 0;
+	data->w_undo.size = 1024;
+	mtm_allocate_ws_undo_entries(tx, data, 0);
+	data->nb_savepoints = 0;
+#endif /* CLOSED_NESTING */
+
+	/* 
+	 * Non-volatile log: the thread's own, or claimed by each transaction,
+	 * attached when an update transaction begins (see mtm_pwb_log_attach)
+	 */
+	data->cpu_log = NULL;
+	data->ptmlog_dsc = NULL;
+	data->ptmlog = NULL;
+	if (mtm_runtime_settings.log_per_cpu) {
+		mtm_pwb_cpu_logs_init();
+	}
 
 	*datap = (mtm_mode_data_t *) data;
 
@@ -107,14 +116,19 @@ mtm_pwbetl_destroy(mtm_mode_data_t *_data)
 	mtm_word_t t;
 #endif /* EPOCH_GC */
 	
-	m_logmgr_free_log(data->ptmlog_dsc);
+	/* CPU logs outlive the threads that claimed them */
+	if (data->cpu_log == NULL && data->ptmlog_dsc != NULL) {
+		m_logmgr_free_log(data->ptmlog_dsc);
+	}
 
 #ifdef EPOCH_GC
 	t = GET_CLOCK;
 	gc_free(data->r_set.entries, t);
-	gc_free(data->w_set.entries, t);
 #else /* ! EPOCH_GC */
 	free(data->r_set.entries);
-	free(data->w_set.entries);
 #endif /* ! EPOCH_GC */
+	mtm_free_ws_entries(data);
+#ifdef CLOSED_NESTING
+	free(data->w_undo.entries);
+#endif /* CLOSED_NESTING */
 }
@@ -35,6 +35,26 @@ mtm_pwbnl_load(mtm_tx_t *tx, volatile mtm_word_t *addr)
 	return pwb_load_internal(tx, addr, 0);
 }
 
+
+/*
+ * Called by the CURRENT thread to store n consecutive words.
+ */
+void 
+mtm_pwbnl_store_words(mtm_tx_t *tx, volatile mtm_word_t *addr, const uint8_t *buf, size_t n)
+{
+	pwb_store_words(tx, addr, buf, n, 0);
+}
+
+
+/*
+ * Called by the CURRENT thread to load n consecutive words.
+ */
+void 
+mtm_pwbnl_load_words(mtm_tx_t *tx, volatile mtm_word_t *addr, uint8_t *buf, size_t n)
+{
+	pwb_load_words(tx, addr, buf, n, 0);
+}
+
 DEFINE_LOAD_BYTES(pwbnl)
 DEFINE_STORE_BYTES(pwbnl)
 
@@ -52,3 +72,22 @@ void _ITM_nl_store_bytes(const void *src, void *dest, size_t size)
     volatile uint8_t *daddr=((volatile uint8_t *) dest);
     mtm_pwbnl_store_bytes(tx, daddr, (uint8_t*) src, size);
 }
+
+/*
+ * Word-sized variants for callers that update persistent metadata one
+ * word at a time, such as the heap's block bitmaps: a single write-set
+ * entry and log record per word instead of a byte-granular round trip.
+ * The store only writes the bytes covered by mask, which must consist of
+ * whole bytes.
+ */
+uint64_t _ITM_nl_load_word(const uint64_t *src)
+{
+    mtm_tx_t *tx = mtm_get_tx();
+    return mtm_pwbnl_load(tx, (volatile mtm_word_t *) src);
+}
+
+void _ITM_nl_store_word(uint64_t *dest, uint64_t value, uint64_t mask)
+{
+    mtm_tx_t *tx = mtm_get_tx();
+    mtm_pwbnl_store2(tx, (volatile mtm_word_t *) dest, value, mask);
+}
@@ -40,12 +40,15 @@
 #include <mtm_i.h>
 
 #ifdef TLS
-__thread mtm_tx_t* _mtm_thread_tx;
+__thread mtm_tx_t* _mtm_thread_tx MTM_TLS_MODEL;
 #else /* ! TLS */
 pthread_key_t _mtm_thread_tx;
 #endif /* ! TLS */
 
-volatile mtm_word_t locks[LOCK_ARRAY_SIZE];
+volatile mtm_word_t *locks;
+unsigned int        mtm_lock_array_log_size = LOCK_ARRAY_LOG_SIZE;
+unsigned int        mtm_lock_shift = LOCK_SHIFT_DEFAULT;
+mtm_word_t          mtm_lock_mask = ((mtm_word_t) 1 << LOCK_ARRAY_LOG_SIZE) - 1;
 
 #ifdef CLOCK_IN_CACHE_LINE
 /* At least twice a cache line (512 bytes to be on the safe side) */
@@ -54,8 +57,29 @@ volatile mtm_word_t gclock[1024 / sizeof(mtm_word_t)];
 volatile mtm_word_t gclock;
 #endif /* ! CLOCK_IN_CACHE_LINE */
 
+#ifdef INCREMENTAL_VALIDATION
+mtm_commit_counters_t mtm_commit_counters;
+#endif /* INCREMENTAL_VALIDATION */
+
 
 int vr_threshold;
 int cm_threshold;
 
+#if CM == CM_PRIORITY || CM == CM_POLICY
+volatile mtm_word_t mtm_cm_owner_readers;
+#endif /* CM == CM_PRIORITY || CM == CM_POLICY */
+
+#if CM == CM_POLICY
+int           mtm_cm_policy;
+unsigned long mtm_cm_backoff_min;
+unsigned long mtm_cm_backoff_max;
+#endif /* CM == CM_POLICY */
+
 mtm_rwlock_t mtm_serial_lock;
+
+#ifdef HTM_FASTPATH
+int mtm_htm_attempts;
+#endif /* HTM_FASTPATH */
+
+int mtm_commit_prefetch_max;
+int mtm_unsafe_disable = 0;
@@ -0,0 +1,81 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/**
+ * \file
+ *
+ * \brief Version store for snapshot reads; see mvstore.h.
+ */
+
+#include <sys/mman.h>
+#include "mtm_i.h"
+#include "config.h"
+#include "mvstore.h"
+
+
+mtm_mvstore_bucket_t *mtm_mvstore_buckets = NULL;
+mtm_word_t           mtm_mvstore_mask = 0;
+
+
+/**
+ * \brief Allocates version_store_kb of buckets, rounded down to a power of 2.
+ *
+ * Leaves the store disabled if version_store_kb is 0, or with 
+ * ROLLOVER_CLOCK, whose clock resets would make recorded timestamps lie.
+ */
+void
+mtm_mvstore_init(void)
+{
+	uint64_t nbuckets;
+	void     *addr;
+
+#ifdef ROLLOVER_CLOCK
+	return;
+#endif /* ROLLOVER_CLOCK */
+	nbuckets = ((uint64_t) mtm_runtime_settings.version_store_kb << 10) / 
+	           sizeof(mtm_mvstore_bucket_t);
+	if (nbuckets == 0) {
+		return;
+	}
+	while (nbuckets & (nbuckets - 1)) {
+		nbuckets &= nbuckets - 1;
+	}
+	/* Zero-filled: no entries, nothing evicted */
+	addr = mmap(NULL, nbuckets * sizeof(mtm_mvstore_bucket_t), PROT_READ | PROT_WRITE, 
+	            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (addr == MAP_FAILED) {
+		perror("Error allocating version store");
+		exit(1);
+	}
+	mtm_mvstore_mask = nbuckets - 1;
+	mtm_mvstore_buckets = (mtm_mvstore_bucket_t *) addr;
+}
@@ -0,0 +1,242 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/**
+ * \file
+ *
+ * \brief DRAM read cache for designated persistent regions; see readcache.h.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <pregionlayout.h>
+#include "mtm_i.h"
+#include "config.h"
+#include "readcache.h"
+
+
+volatile int           mtm_readcache_nregions = 0;
+mtm_readcache_region_t mtm_readcache_regions[MTM_READCACHE_MAX_REGIONS];
+
+/* Serializes registration, fills, evictions and invalidations */
+static pthread_mutex_t rc_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t        rc_resident = 0;
+static int             rc_hand_region = 0;
+static uint64_t        rc_hand_page = 0;
+
+
+static inline
+void
+page_set_state(mtm_readcache_page_t *pg, uint64_t state)
+{
+	pg->state = ((pg->state & ~MTM_READCACHE_STATE_MASK) + MTM_READCACHE_EPOCH_INC) | state;
+}
+
+
+static
+void
+page_evict(mtm_readcache_region_t *r, uint64_t i)
+{
+	page_set_state(&r->pages[i], MTM_READCACHE_INVALID);
+	/* Readers that saw the page resident re-read the state after their load */
+	__sync_synchronize();
+	madvise(r->shadow + (i << MTM_READCACHE_PAGE_SHIFT), MTM_READCACHE_PAGE_SIZE, 
+	        MADV_DONTNEED);
+	rc_resident--;
+}
+
+
+/* Evicts the first resident page the CLOCK hand finds unreferenced. */
+static
+void
+clock_evict(void)
+{
+	mtm_readcache_region_t *r;
+	mtm_readcache_page_t   *pg;
+	uint64_t               total = 0;
+	uint64_t               n;
+	int                    i;
+
+	for (i = 0; i < mtm_readcache_nregions; i++) {
+		total += mtm_readcache_regions[i].npages;
+	}
+	for (n = 0; n < 2 * total; n++) {
+		r = &mtm_readcache_regions[rc_hand_region];
+		if (rc_hand_page >= r->npages) {
+			rc_hand_page = 0;
+			rc_hand_region = (rc_hand_region + 1) % mtm_readcache_nregions;
+			continue;
+		}
+		pg = &r->pages[rc_hand_page];
+		if ((pg->state & MTM_READCACHE_STATE_MASK) == MTM_READCACHE_RESIDENT) {
+			if (pg->referenced) {
+				pg->referenced = 0;
+			} else {
+				page_evict(r, rc_hand_page++);
+				return;
+			}
+		}
+		rc_hand_page++;
+	}
+}
+
+
+/**
+ * \brief Registers [addr, addr + size) of persistent memory for caching.
+ *
+ * The region must only be written by transactions, or be passed to 
+ * mtm_readcache_invalidate after it is written otherwise. Returns 0 on 
+ * success, -1 if the cache is disabled (read_cache_mb is 0), the region is 
+ * not persistent or no more regions can be registered.
+ */
+int
+mtm_readcache_register(void *addr, size_t size)
+{
+	mtm_readcache_region_t *r;
+	uintptr_t              start = (uintptr_t) addr & ~(MTM_READCACHE_PAGE_SIZE - 1);
+	uintptr_t              end = ((uintptr_t) addr + size + MTM_READCACHE_PAGE_SIZE - 1) & 
+	                             ~(MTM_READCACHE_PAGE_SIZE - 1);
+	int                    rv = -1;
+
+	if (mtm_runtime_settings.read_cache_mb == 0 || size == 0 ||
+	    start < PSEGMENT_RESERVED_REGION_START || 
+	    end > PSEGMENT_RESERVED_REGION_START + PSEGMENT_RESERVED_REGION_SIZE)
+	{
+		return -1;
+	}
+	pthread_mutex_lock(&rc_lock);
+	if (mtm_readcache_nregions == MTM_READCACHE_MAX_REGIONS || mtm_readcache_region(start) ||
+	    mtm_readcache_region(end - 1)) 
+	{
+		goto out;
+	}
+	r = &mtm_readcache_regions[mtm_readcache_nregions];
+	r->npages = (end - start) >> MTM_READCACHE_PAGE_SHIFT;
+	r->shadow = mmap(NULL, end - start, PROT_READ | PROT_WRITE, 
+	                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (r->shadow == MAP_FAILED) {
+		goto out;
+	}
+	if ((r->pages = calloc(r->npages, sizeof(mtm_readcache_page_t))) == NULL) {
+		munmap(r->shadow, end - start);
+		goto out;
+	}
+	r->start = start;
+	r->size = end - start;
+	/* Publish the filled-in entry */
+	__sync_synchronize();
+	mtm_readcache_nregions++;
+	rv = 0;
+out:
+	pthread_mutex_unlock(&rc_lock);
+	return rv;
+}
+
+
+/**
+ * \brief Fills a page of the shadow from persistent memory.
+ *
+ * Called on a read miss; gives up without waiting if another thread is 
+ * filling or evicting.
+ */
+void
+mtm_readcache_fill(mtm_readcache_region_t *r, mtm_readcache_page_t *pg)
+{
+	uint64_t  capacity = (uint64_t) mtm_runtime_settings.read_cache_mb << 
+	                     (20 - MTM_READCACHE_PAGE_SHIFT);
+	uint64_t  w1;
+	uint64_t  w2;
+	uintptr_t off = (uintptr_t) (pg - r->pages) << MTM_READCACHE_PAGE_SHIFT;
+
+	if (pthread_mutex_trylock(&rc_lock) != 0) {
+		return;
+	}
+	if ((pg->state & MTM_READCACHE_STATE_MASK) != MTM_READCACHE_INVALID) {
+		goto out;
+	}
+	while (rc_resident >= capacity) {
+		clock_evict();
+	}
+	/* From now on write-backs also go to the shadow */
+	page_set_state(pg, MTM_READCACHE_FILLING);
+	__sync_synchronize();
+	w1 = pg->writers;
+	if (w1 & MTM_READCACHE_WRITERS_MASK) {
+		page_set_state(pg, MTM_READCACHE_INVALID);
+		goto out;
+	}
+	memcpy(r->shadow + off, (void *) (r->start + off), MTM_READCACHE_PAGE_SIZE);
+	__sync_synchronize();
+	w2 = pg->writers;
+	if (w1 == w2) {
+		pg->referenced = 1;
+		page_set_state(pg, MTM_READCACHE_RESIDENT);
+		rc_resident++;
+	} else {
+		page_set_state(pg, MTM_READCACHE_INVALID);
+	}
+out:
+	pthread_mutex_unlock(&rc_lock);
+}
+
+
+/**
+ * \brief Drops the cached pages of [addr, addr + size), after it has been 
+ * written outside the transactional write-back.
+ */
+void
+mtm_readcache_invalidate(const void *addr, size_t size)
+{
+	mtm_readcache_region_t *r;
+	uintptr_t              a;
+	uintptr_t              end = (uintptr_t) addr + size;
+	uint64_t               i;
+
+	if (mtm_readcache_nregions == 0 || size == 0) {
+		return;
+	}
+	pthread_mutex_lock(&rc_lock);
+	for (a = (uintptr_t) addr & ~(MTM_READCACHE_PAGE_SIZE - 1); a < end; 
+	     a += MTM_READCACHE_PAGE_SIZE) 
+	{
+		if ((r = mtm_readcache_region(a)) == NULL) {
+			continue;
+		}
+		i = (a - r->start) >> MTM_READCACHE_PAGE_SHIFT;
+		if ((r->pages[i].state & MTM_READCACHE_STATE_MASK) == MTM_READCACHE_RESIDENT) {
+			page_evict(r, i);
+		}
+	}
+	pthread_mutex_unlock(&rc_lock);
+}
@@ -38,9 +38,16 @@
  */
 
 #include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
+#include <execinfo.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <pmalloc.h>
 #include "stats.h"
-#include "chhash.h"
+#include "flathash.h"
+#include "hdrhist.h"
 #include "util.h"
 #include "debug.h"
 
@@ -48,6 +55,23 @@ m_statsmgr_t *m_g_statsmgr;
 
 #define M_STATS_THREADSTAT_HASHTABLE_SIZE 128
 
+/* Slots of the conflict table of a thread (power of 2) */
+#define M_STATS_CONFLICT_TABLE_SIZE       256
+
+/* Number of hottest conflicts printed in the report */
+#define M_STATS_CONFLICT_TOPK             16
+
+/* Slots of the abort stack table of a thread (power of 2) */
+#define M_STATS_ABORT_TABLE_SIZE          128
+
+/* Frames kept of a sampled abort stack, innermost first */
+#define M_STATS_ABORT_STACK_DEPTH         48
+
+#define M_STATS_CACHELINE_SIZE            64
+
+#define M_STATS_EXPORT_JSON               0
+#define M_STATS_EXPORT_PROMETHEUS         1
+
 #define MIN(A, B) (((A) < (B)) ? (A) : (B))
 #define MAX(A, B) (((A) > (B)) ? (A) : (B))
 
@@ -55,17 +79,65 @@ m_statsmgr_t *m_g_statsmgr;
 char *stats_strings[] = {
 	FOREACH_STAT(ACTION)
 };	
+
+static char *phase_strings[] = {
+	FOREACH_COMMIT_PHASE(ACTION)
+};
 #undef ACTION	
 
 static const char __whitespaces[] = "                                                              ";
 
 #define WHITESPACE(len) &__whitespaces[sizeof(__whitespaces) - (len) -1]
 
+/** Sampled conflicts with the same transaction, lock and restart reason */
+typedef struct m_stats_conflict_s {
+	uintptr_t             site;     /**< Call site of the transaction begin (0 if unknown) */
+	uintptr_t             lock_idx; /**< Index of the lock in the lock array */
+	const char            *reason;  /**< Restart reason */
+	uintptr_t             addr_min; /**< Lowest conflicting address (0 if unknown) */
+	uintptr_t             addr_max; /**< Highest conflicting address */
+	m_stats_statcounter_t count;    /**< Number of samples (0 for a free slot) */
+} m_stats_conflict_t;
+
+
+/** Sampled aborts with the same stack, restart reason and lock owner */
+typedef struct m_stats_abort_s {
+	void                  *frames[M_STATS_ABORT_STACK_DEPTH]; /**< Return addresses, innermost first */
+	int                   depth;    /**< Number of frames */
+	unsigned int          hash;     /**< Hash of the frames */
+	const char            *reason;  /**< Restart reason */
+	uintptr_t             owner;    /**< Call site of the begin of the lock owner (0 if unknown) */
+	m_stats_statcounter_t count;    /**< Number of samples (0 for a free slot) */
+} m_stats_abort_t;
+
+
+/** 
+ * Running totals of a thread, read by the export thread without 
+ * synchronization. Only the owner thread writes them. 
+ */
+typedef struct m_stats_threadcounters_s {
+	volatile uint64_t transactions;                   /**< Transactions committed */
+	volatile uint64_t stats[m_stats_numofstats];      /**< Totals of the statistics */
+} __attribute__ ((aligned (M_STATS_CACHELINE_SIZE))) m_stats_threadcounters_t;
+
+
 /** Thread statistics */
 struct m_stats_threadstat_s {
+	m_stats_threadcounters_t    counters;        /**< Exported totals, in their own cache lines */
+	m_stats_statset_t           tx_statset;      /**< Statistics of the running transaction */
+	m_stats_statset_t           *last_statset;   /**< Entry of stats_table the last transaction was aggregated into */
     unsigned int tid;
 	m_stats_statset_t           summary_statset; /**< Statistics summary */
-	m_chhash_t                  *stats_table; /**< Collected statistics */
+	m_flathash_t                  *stats_table; /**< Collected statistics */
+	unsigned int                conflict_sampling; /**< Record one in this many conflicts (none if 0) */
+	unsigned int                conflict_tick;     /**< Conflicts since the last one recorded */
+	m_stats_statcounter_t       conflicts_dropped; /**< Samples not recorded because the table was full */
+	m_stats_conflict_t          conflicts[M_STATS_CONFLICT_TABLE_SIZE]; /**< Open addressing table of sampled conflicts */
+	unsigned int                abort_sampling;    /**< Record the stack of one in this many aborts (none if 0) */
+	unsigned int                abort_tick;        /**< Aborts since the last one recorded */
+	m_stats_statcounter_t       aborts_dropped;    /**< Samples not recorded because the table was full */
+	m_stats_abort_t             *aborts;           /**< Open addressing table of sampled abort stacks (NULL if none) */
+	hdrhist_t                   *commit_phases;    /**< Cycles of each commit phase (NULL if not timed) */
 	struct m_stats_threadstat_s *next;     /**< Used to implement the list of thread statistics. */
 	struct m_stats_threadstat_s *prev;     /**< Used to implement the list of thread statistics. */
 };
@@ -75,20 +147,39 @@ struct m_stats_threadstat_s {
 struct m_statsmgr_s {
 	m_mutex_t            mutex;                       /**< Serializes accesses to this structure */
 	char                 *output_file;
+	unsigned int         conflict_sampling;           /**< Record one in this many conflicts (none if 0) */
+	int                  commit_phases;               /**< Whether commit phases are timed */
+	unsigned int         abort_sampling;              /**< Record the stack of one in this many aborts (none if 0) */
+	char                 *abort_file;                 /**< Folded stacks of the sampled aborts */
 	unsigned int         alloc_threadstat_num;        /**< Number of threads collecting statistics for */
 	m_stats_threadstat_t *alloc_threadstat_list_head; /**< Head of the thread statistics list */
 	m_stats_threadstat_t *alloc_threadstat_list_tail; /**< Tail of the thread statistics list */
+	/* periodic export */
+	int                  export_started;
+	int                  export_stop;
+	int                  export_format;               /**< M_STATS_EXPORT_* */
+	char                 *export_file;
+	unsigned int         export_period_ms;
+	pthread_t            export_thread;
+	m_mutex_t            export_mutex;                /**< Protects export_stop */
+	pthread_cond_t       export_cond;                 /**< Wakes up the export thread to stop */
 };
 
 
 m_result_t
-m_statsmgr_create(m_statsmgr_t **statsmgrp, char *output_file)
+m_statsmgr_create(m_statsmgr_t **statsmgrp, char *output_file, unsigned int conflict_sampling, 
+                  int commit_phases)
 {
 	*statsmgrp = (m_statsmgr_t *) MALLOC(sizeof(m_statsmgr_t));
 	if (*statsmgrp == NULL) {
 		return M_R_NOMEMORY;
 	}
 	(*statsmgrp)->output_file = output_file;
+	(*statsmgrp)->conflict_sampling = conflict_sampling;
+	(*statsmgrp)->commit_phases = commit_phases;
+	(*statsmgrp)->abort_sampling = 0;
+	(*statsmgrp)->abort_file = NULL;
+	(*statsmgrp)->export_started = 0;
 	(*statsmgrp)->alloc_threadstat_num = 0;
 	(*statsmgrp)->alloc_threadstat_list_head = (*statsmgrp)->alloc_threadstat_list_tail = NULL;
 	M_MUTEX_INIT(&(*statsmgrp)->mutex, NULL);
@@ -110,6 +201,8 @@ m_statsmgr_destroy(m_statsmgr_t **statsmgrp)
 		 threadstat = threadstat_next)
 	{
 		threadstat_next = threadstat->next;
+		FREE(threadstat->commit_phases);
+		FREE(threadstat->aborts);
 		FREE(threadstat);
 	}
 
@@ -120,6 +213,20 @@ m_statsmgr_destroy(m_statsmgr_t **statsmgrp)
 }
 
 
+/**
+ * \brief Samples the stack of one in sampling aborts of the threads 
+ * created from now on, and writes them to output_file in the folded 
+ * format of flame graph tools when the statistics are printed.
+ */
+m_result_t
+m_statsmgr_abort_stacks(m_statsmgr_t *statsmgr, char *output_file, unsigned int sampling)
+{
+	statsmgr->abort_sampling = sampling;
+	statsmgr->abort_file = output_file;
+	return M_R_SUCCESS;
+}
+
+
 m_result_t
 m_stats_threadstat_create(m_statsmgr_t *statsmgr, 
                           unsigned int tid, 
@@ -128,7 +235,50 @@ m_stats_threadstat_create(m_statsmgr_t *statsmgr,
 	m_stats_threadstat_t *threadstat;
 	int                  i;
 
-	threadstat = (m_stats_threadstat_t *) MALLOC(sizeof(m_stats_threadstat_t));
+	if (posix_memalign((void **) &threadstat, M_STATS_CACHELINE_SIZE, 
+	                   sizeof(m_stats_threadstat_t)) != 0) 
+	{
+		return M_R_NOMEMORY;
+	}
+
+	/* Initialize before linking it in, the export thread may read it then */
+	memset(&threadstat->counters, 0, sizeof(threadstat->counters));
+	m_stats_statset_init(&(threadstat->tx_statset), NULL);
+	threadstat->last_statset = NULL;
+	m_stats_statset_init(&(threadstat->summary_statset), NULL);
+	threadstat->tid = tid;
+	threadstat->conflict_sampling = statsmgr->conflict_sampling;
+	threadstat->conflict_tick = 0;
+	threadstat->conflicts_dropped = 0;
+	memset(threadstat->conflicts, 0, sizeof(threadstat->conflicts));
+	threadstat->abort_sampling = statsmgr->abort_sampling;
+	threadstat->abort_tick = 0;
+	threadstat->aborts_dropped = 0;
+	threadstat->aborts = NULL;
+	if (statsmgr->abort_sampling) {
+		threadstat->aborts = (m_stats_abort_t *) MALLOC(M_STATS_ABORT_TABLE_SIZE * 
+		                                                sizeof(m_stats_abort_t));
+		if (threadstat->aborts == NULL) {
+			FREE(threadstat);
+			return M_R_NOMEMORY;
+		}
+		memset(threadstat->aborts, 0, M_STATS_ABORT_TABLE_SIZE * sizeof(m_stats_abort_t));
+	}
+	threadstat->commit_phases = NULL;
+	if (statsmgr->commit_phases) {
+		threadstat->commit_phases = (hdrhist_t *) MALLOC(m_stats_numofphases * sizeof(hdrhist_t));
+		if (threadstat->commit_phases == NULL) {
+			FREE(threadstat->aborts);
+			FREE(threadstat);
+			return M_R_NOMEMORY;
+		}
+		for (i=0; i<m_stats_numofphases; i++) {
+			hdrhist_init(&threadstat->commit_phases[i]);
+		}
+	}
+	m_flathash_create(&threadstat->stats_table, 
+	                  M_STATS_THREADSTAT_HASHTABLE_SIZE, 
+					false);
 
 	M_MUTEX_LOCK(&(statsmgr->mutex));
 	if (statsmgr->alloc_threadstat_list_head == NULL) {
@@ -138,23 +288,33 @@ m_stats_threadstat_create(m_statsmgr_t *statsmgr,
 		threadstat->next = NULL;
 		threadstat->prev = NULL;
 	} else {
-		statsmgr->alloc_threadstat_list_tail->next = threadstat;
+		threadstat->next = NULL;
 		threadstat->prev = statsmgr->alloc_threadstat_list_tail;
+		statsmgr->alloc_threadstat_list_tail->next = threadstat;
 		statsmgr->alloc_threadstat_list_tail = threadstat;
 	}
 	statsmgr->alloc_threadstat_num++;
 	M_MUTEX_UNLOCK(&(statsmgr->mutex));
 
-	m_stats_statset_init(&(threadstat->summary_statset), NULL);
-	threadstat->tid = tid;
-	m_chhash_create(&threadstat->stats_table, 
-	                M_STATS_THREADSTAT_HASHTABLE_SIZE, 
-					false);
 	*threadstatp = threadstat;
 	return M_R_SUCCESS;					  
 }
 
 
+/**
+ * \brief Returns the statistics set a thread collects the statistics of 
+ * its running transaction into.
+ *
+ * The set belongs to the thread and is reused by each of its transactions, 
+ * which reset it with m_stats_statset_init, so no allocation is involved.
+ */
+m_stats_statset_t *
+m_stats_threadstat_statset(m_stats_threadstat_t *threadstat)
+{
+	return &threadstat->tx_statset;
+}
+
+
 m_result_t
 m_stats_statset_create(m_stats_statset_t **statsetp)
 {
@@ -184,7 +344,7 @@ stats_statset_reset(m_stats_statset_t *statset)
 {
 #define RESETSTAT(name)                                                      \
   statset->stats[m_stats_##name##_stat].total = 0;                    \
-  statset->stats[m_stats_##name##_stat].min = 0xFFFFFFFF;             \
+  statset->stats[m_stats_##name##_stat].min = ULLONG_MAX;             \
   statset->stats[m_stats_##name##_stat].max = 0;
 
 	FOREACH_STAT (RESETSTAT)
@@ -199,22 +359,33 @@ m_stats_statset_init(m_stats_statset_t *statset,
 {
 	statset->count = 0;
 	statset->name = name;
+	statset->site = 0;
 	stats_statset_reset(statset);
 	return M_R_SUCCESS;
 }
 
 
+/* 
+ * Transactions are told apart by their source location when the compiler 
+ * passes one, else by the call site of their begin.
+ */
+static inline
+m_flathash_key_t
+stats_statset_key(m_stats_statset_t *statset)
+{
+	return statset->name ? (m_flathash_key_t) statset->name : (m_flathash_key_t) statset->site;
+}
+
+
 static
 m_result_t
-stats_get_statset(m_chhash_t *stats_table,
-                  const char *name, 
+stats_get_statset(m_flathash_t *stats_table,
+                  m_flathash_key_t key, 
                   m_stats_statset_t **statsetp)
 {
-	m_chhash_key_t    key;
-	m_chhash_value_t  value;
+	m_flathash_value_t  value;
 	m_stats_statset_t *statset;
-	key = (m_chhash_key_t) name;
-	if (m_chhash_lookup(stats_table, key, &value) == M_R_SUCCESS)
+	if (m_flathash_lookup(stats_table, key, &value) == M_R_SUCCESS)
 	{
 		statset = (m_stats_statset_t *) value;	
 		*statsetp = statset;
@@ -247,26 +418,815 @@ stats_aggregate(m_stats_statset_t *dest_statset,
 void 
 m_stats_threadstat_aggregate(m_stats_threadstat_t *threadstat, m_stats_statset_t *source_statset)
 {
-	m_stats_statset_t    *statset_all;
-	m_result_t           result;
-
-
-	result = stats_get_statset(threadstat->stats_table, source_statset->name, &statset_all);
-	if (result != M_R_SUCCESS) {
-		m_stats_statset_create(&statset_all);
-		m_stats_statset_init(statset_all, source_statset->name);
-		m_chhash_add(threadstat->stats_table, 
-		             (m_chhash_key_t) source_statset->name, 
-		             (m_chhash_value_t) (statset_all));
+	m_stats_threadcounters_t *counters = &threadstat->counters;
+	m_stats_statset_t        *statset_all;
+	m_result_t               result;
+	int                      i;
+
+	/* Consecutive transactions are most often instances of the same one */
+	statset_all = threadstat->last_statset;
+	if (statset_all == NULL || 
+	    stats_statset_key(statset_all) != stats_statset_key(source_statset)) 
+	{
+		result = stats_get_statset(threadstat->stats_table, 
+		                           stats_statset_key(source_statset), &statset_all);
+		if (result != M_R_SUCCESS) {
+			m_stats_statset_create(&statset_all);
+			m_stats_statset_init(statset_all, source_statset->name);
+			statset_all->site = source_statset->site;
+			m_flathash_add(threadstat->stats_table, 
+			               stats_statset_key(source_statset), 
+			               (m_flathash_value_t) (statset_all));
+		}
+		threadstat->last_statset = statset_all;
 	}
-
 	
 	stats_aggregate(statset_all, source_statset);
 	stats_aggregate(&threadstat->summary_statset, source_statset);
+
+	counters->transactions++;
+	for (i=0; i<m_stats_numofstats; i++) {
+		counters->stats[i] += source_statset->stats[i].total;
+	}
 }
 
 
 
+/**
+ * \brief Records the cycles each commit phase of a transaction took.
+ *
+ * \param[in] ts Timestamp of the start of each phase, followed by the 
+ *            timestamp of the end of the last one.
+ */
+void
+m_stats_threadstat_commit_phases(m_stats_threadstat_t *threadstat, 
+                                 const uint64_t *ts)
+{
+	int i;
+
+	if (threadstat->commit_phases == NULL) {
+		return;
+	}
+	for (i=0; i<m_stats_numofphases; i++) {
+		hdrhist_record(&threadstat->commit_phases[i], ts[i+1] - ts[i]);
+	}
+}
+
+
+/**
+ * \brief Samples a conflict into the conflict table of the thread.
+ *
+ * \param[in] site Call site of the begin of the transaction, 0 if unknown.
+ * \param[in] lock_idx Index of the lock the conflict was detected on.
+ * \param[in] addr Conflicting address, 0 if unknown (validation only keeps
+ *            the lock of each read).
+ * \param[in] reason Restart reason. Conflicts are told apart by the 
+ *            pointer, so this must be a string constant.
+ */
+void
+m_stats_threadstat_conflict(m_stats_threadstat_t *threadstat, 
+                            uintptr_t site, 
+                            uintptr_t lock_idx, 
+                            uintptr_t addr,
+                            const char *reason)
+{
+	m_stats_conflict_t *c;
+	unsigned int       i;
+	unsigned int       n;
+
+	if (threadstat->conflict_sampling == 0 || 
+	    ++threadstat->conflict_tick < threadstat->conflict_sampling) 
+	{
+		return;
+	}
+	threadstat->conflict_tick = 0;
+
+	i = (unsigned int) ((lock_idx * 0x9E3779B97F4A7C15ULL) >> 32) ^ (unsigned int) (site >> 4);
+	for (n = 0; n < M_STATS_CONFLICT_TABLE_SIZE; n++, i++) {
+		c = &threadstat->conflicts[i & (M_STATS_CONFLICT_TABLE_SIZE - 1)];
+		if (c->count == 0) {
+			c->site = site;
+			c->lock_idx = lock_idx;
+			c->reason = reason;
+			c->addr_min = c->addr_max = addr;
+		} else if (c->site != site || c->lock_idx != lock_idx || c->reason != reason) {
+			continue;
+		}
+		c->count++;
+		if (addr) {
+			if (c->addr_min == 0 || addr < c->addr_min) {
+				c->addr_min = addr;
+			}
+			if (addr > c->addr_max) {
+				c->addr_max = addr;
+			}
+		}
+		return;
+	}
+	threadstat->conflicts_dropped++;
+}
+
+
+/**
+ * \brief Samples the stack of an abort into the abort table of the thread.
+ *
+ * Called by the restarting transaction, so the stack is that of the 
+ * aborting code down to the barrier or commit that detected the conflict.
+ * The owner of the lock is another thread whose stack cannot be taken 
+ * from here; the call site of the begin of its transaction stands for it.
+ *
+ * \param[in] reason Restart reason. Aborts are told apart by the pointer, 
+ *            so this must be a string constant.
+ * \param[in] owner Call site of the begin of the transaction owning the 
+ *            lock, 0 if unknown.
+ */
+void
+m_stats_threadstat_abort(m_stats_threadstat_t *threadstat, 
+                         const char *reason, 
+                         uintptr_t owner)
+{
+	void            *frames[M_STATS_ABORT_STACK_DEPTH + 1];
+	m_stats_abort_t *a;
+	unsigned int    hash = 2166136261U;
+	unsigned int    i;
+	unsigned int    n;
+	int             depth;
+	int             k;
+
+	if (threadstat->aborts == NULL || 
+	    ++threadstat->abort_tick < threadstat->abort_sampling) 
+	{
+		return;
+	}
+	threadstat->abort_tick = 0;
+
+	/* Leave out this function's own frame */
+	depth = backtrace(frames, M_STATS_ABORT_STACK_DEPTH + 1) - 1;
+	for (k = 0; k < depth; k++) {
+		hash = (hash ^ (unsigned int) ((uintptr_t) frames[k+1] >> 2)) * 16777619U;
+	}
+	hash ^= (unsigned int) (owner >> 4);
+
+	for (n = 0, i = hash; n < M_STATS_ABORT_TABLE_SIZE; n++, i++) {
+		a = &threadstat->aborts[i & (M_STATS_ABORT_TABLE_SIZE - 1)];
+		if (a->count == 0) {
+			memcpy(a->frames, &frames[1], depth * sizeof(void *));
+			a->depth = depth;
+			a->hash = hash;
+			a->reason = reason;
+			a->owner = owner;
+		} else if (a->hash != hash || a->depth != depth || a->reason != reason ||
+		           a->owner != owner || 
+		           memcmp(a->frames, &frames[1], depth * sizeof(void *)) != 0) 
+		{
+			continue;
+		}
+		a->count++;
+		return;
+	}
+	threadstat->aborts_dropped++;
+}
+
+
+static
+int
+stats_conflict_compare_key(const void *a, const void *b)
+{
+	const m_stats_conflict_t *ca = (const m_stats_conflict_t *) a;
+	const m_stats_conflict_t *cb = (const m_stats_conflict_t *) b;
+
+	if (ca->site != cb->site) {
+		return ca->site < cb->site ? -1 : 1;
+	}
+	if (ca->lock_idx != cb->lock_idx) {
+		return ca->lock_idx < cb->lock_idx ? -1 : 1;
+	}
+	if (ca->reason != cb->reason) {
+		return (uintptr_t) ca->reason < (uintptr_t) cb->reason ? -1 : 1;
+	}
+	return 0;
+}
+
+
+static
+int
+stats_conflict_compare_count(const void *a, const void *b)
+{
+	const m_stats_conflict_t *ca = (const m_stats_conflict_t *) a;
+	const m_stats_conflict_t *cb = (const m_stats_conflict_t *) b;
+
+	if (ca->count != cb->count) {
+		return ca->count > cb->count ? -1 : 1;
+	}
+	return 0;
+}
+
+
+/*
+ * Merges the commit phase histograms of all threads and prints the 
+ * percentiles of each phase.
+ */
+static
+void
+stats_commit_phases_print(FILE *fout, m_statsmgr_t *statsmgr)
+{
+	m_stats_threadstat_t *threadstat;
+	hdrhist_t            *all;
+	hdrhist_t            *h;
+	int                  i;
+
+	if (!statsmgr->commit_phases) {
+		return;
+	}
+	all = (hdrhist_t *) MALLOC(m_stats_numofphases * sizeof(hdrhist_t));
+	if (all == NULL) {
+		return;
+	}
+	for (i=0; i<m_stats_numofphases; i++) {
+		hdrhist_init(&all[i]);
+	}
+	for (threadstat=statsmgr->alloc_threadstat_list_head;
+	     threadstat;
+		 threadstat = threadstat->next)
+	{
+		for (i=0; i<m_stats_numofphases && threadstat->commit_phases; i++) {
+			hdrhist_merge(&all[i], &threadstat->commit_phases[i]);
+		}
+	}
+
+	fprintf(fout, "COMMIT PHASES (cycles, update transactions)\n\n");
+	fprintf(fout, "%s%s:%13s%13s%13s%13s%13s\n", 
+	        "", WHITESPACE(25), "Count", "P50", "P99", "P999", "Max");
+	for (i=0; i<m_stats_numofphases; i++) {
+		h = &all[i];
+		fprintf(fout, "%s%s:%13llu%13llu%13llu%13llu%13llu\n", 
+		        phase_strings[i],
+		        WHITESPACE(25 - strlen(phase_strings[i])),
+		        (unsigned long long) h->count,
+		        (unsigned long long) hdrhist_quantile(h, 0.5),
+		        (unsigned long long) hdrhist_quantile(h, 0.99),
+		        (unsigned long long) hdrhist_quantile(h, 0.999),
+		        (unsigned long long) h->max);
+	}
+	fprintf(fout, "\n");
+	FREE(all);
+}
+
+
+/*
+ * Folds the conflict tables of all threads and prints the 
+ * M_STATS_CONFLICT_TOPK conflicts sampled most often.
+ */
+static
+void
+stats_conflicts_print(FILE *fout, m_statsmgr_t *statsmgr)
+{
+	m_stats_threadstat_t  *threadstat;
+	m_stats_conflict_t    *all;
+	m_stats_conflict_t    *c;
+	m_stats_statcounter_t dropped = 0;
+	char                  range[64];
+	char                  **symbols;
+	int                   n = 0;
+	int                   m;
+	int                   i;
+
+	if (statsmgr->conflict_sampling == 0 || statsmgr->alloc_threadstat_num == 0) {
+		return;
+	}
+	all = (m_stats_conflict_t *) MALLOC(statsmgr->alloc_threadstat_num * 
+	                                    M_STATS_CONFLICT_TABLE_SIZE * 
+	                                    sizeof(m_stats_conflict_t));
+	if (all == NULL) {
+		return;
+	}
+	for (threadstat=statsmgr->alloc_threadstat_list_head;
+	     threadstat;
+		 threadstat = threadstat->next)
+	{
+		for (i=0; i<M_STATS_CONFLICT_TABLE_SIZE; i++) {
+			if (threadstat->conflicts[i].count) {
+				all[n++] = threadstat->conflicts[i];
+			}
+		}
+		dropped += threadstat->conflicts_dropped;
+	}
+
+	/* Fold the samples of the same conflict taken by different threads */
+	qsort(all, n, sizeof(m_stats_conflict_t), stats_conflict_compare_key);
+	for (i=0, m=0; i<n; i++) {
+		if (m > 0 && stats_conflict_compare_key(&all[m-1], &all[i]) == 0) {
+			c = &all[m-1];
+			c->count += all[i].count;
+			if (all[i].addr_min && (c->addr_min == 0 || all[i].addr_min < c->addr_min)) {
+				c->addr_min = all[i].addr_min;
+			}
+			if (all[i].addr_max > c->addr_max) {
+				c->addr_max = all[i].addr_max;
+			}
+		} else {
+			all[m++] = all[i];
+		}
+	}
+	qsort(all, m, sizeof(m_stats_conflict_t), stats_conflict_compare_count);
+
+	fprintf(fout, "CONFLICT HOT SPOTS (1 in %u conflicts sampled", 
+	        statsmgr->conflict_sampling);
+	if (dropped) {
+		fprintf(fout, ", %llu samples dropped", dropped);
+	}
+	fprintf(fout, ")\n\n");
+	fprintf(fout, "%13s%10s  %-16s%-40s%s\n", 
+	        "Samples", "Lock", "Reason", "Addresses", "Transaction");
+	for (i=0; i<m && i<M_STATS_CONFLICT_TOPK; i++) {
+		c = &all[i];
+		if (c->addr_min) {
+			sprintf(range, "0x%lx-0x%lx", (unsigned long) c->addr_min, 
+			        (unsigned long) c->addr_max);
+		} else {
+			sprintf(range, "-");
+		}
+		symbols = c->site ? backtrace_symbols((void **) &c->site, 1) : NULL;
+		fprintf(fout, "%13llu%10lu  %-16s%-40s%s\n", 
+		        c->count, (unsigned long) c->lock_idx, c->reason, range,
+		        symbols ? symbols[0] : "unknown");
+		free(symbols);
+	}
+	fprintf(fout, "\n");
+	FREE(all);
+}
+
+
+static
+int
+stats_abort_compare_key(const void *a, const void *b)
+{
+	const m_stats_abort_t *aa = (const m_stats_abort_t *) a;
+	const m_stats_abort_t *ab = (const m_stats_abort_t *) b;
+
+	if (aa->hash != ab->hash) {
+		return aa->hash < ab->hash ? -1 : 1;
+	}
+	if (aa->depth != ab->depth) {
+		return aa->depth < ab->depth ? -1 : 1;
+	}
+	if (aa->reason != ab->reason) {
+		return (uintptr_t) aa->reason < (uintptr_t) ab->reason ? -1 : 1;
+	}
+	if (aa->owner != ab->owner) {
+		return aa->owner < ab->owner ? -1 : 1;
+	}
+	return memcmp(aa->frames, ab->frames, aa->depth * sizeof(void *));
+}
+
+
+/*
+ * Prints a frame as backtrace_symbols gives it, "module(function+offset) 
+ * [address]": the function if it has a dynamic symbol, else the module 
+ * and the offset or address to look up with addr2line. Semicolons 
+ * separate the frames of a folded stack, so none are printed.
+ */
+static
+void
+stats_abort_frame_print(FILE *fout, const char *symbol)
+{
+	const char *module = symbol;
+	const char *p;
+	size_t     len;
+
+	p = strchr(symbol, '(');
+	if (p && p[1] != '+' && p[1] != ')') {
+		len = strcspn(p + 1, "+);");
+		fprintf(fout, "%.*s", (int) len, p + 1);
+		return;
+	}
+	len = strcspn(symbol, "( ;");
+	for (p = symbol; p < symbol + len; p++) {
+		if (*p == '/') {
+			module = p + 1;
+		}
+	}
+	fprintf(fout, "%.*s", (int) (symbol + len - module), module);
+	if ((p = strchr(symbol, '(')) && p[1] == '+') {
+		fprintf(fout, "%.*s", (int) strcspn(p + 1, ");"), p + 1);
+	} else if ((p = strchr(symbol, '['))) {
+		fprintf(fout, "@%.*s", (int) strcspn(p + 1, "];"), p + 1);
+	}
+}
+
+
+/*
+ * Folds the abort tables of all threads and writes one line per stack, 
+ * outermost frame first, followed by the restart reason, the owner of the 
+ * lock and the number of samples, as flamegraph.pl and speedscope read 
+ * them:
+ *
+ *   main;worker;mtm_pwb_restart_transaction;[locked_write];[owner update] 12
+ */
+static
+void
+stats_aborts_print(m_statsmgr_t *statsmgr)
+{
+	m_stats_threadstat_t  *threadstat;
+	m_stats_abort_t       *all;
+	m_stats_abort_t       *a;
+	m_stats_statcounter_t dropped = 0;
+	char                  **symbols;
+	FILE                  *fout;
+	int                   n = 0;
+	int                   m;
+	int                   i;
+	int                   k;
+
+	if (statsmgr->abort_sampling == 0 || statsmgr->alloc_threadstat_num == 0) {
+		return;
+	}
+	all = (m_stats_abort_t *) MALLOC(statsmgr->alloc_threadstat_num * 
+	                                 M_STATS_ABORT_TABLE_SIZE * 
+	                                 sizeof(m_stats_abort_t));
+	if (all == NULL) {
+		return;
+	}
+	for (threadstat=statsmgr->alloc_threadstat_list_head;
+	     threadstat;
+		 threadstat = threadstat->next)
+	{
+		for (i=0; threadstat->aborts && i<M_STATS_ABORT_TABLE_SIZE; i++) {
+			if (threadstat->aborts[i].count) {
+				all[n++] = threadstat->aborts[i];
+			}
+		}
+		dropped += threadstat->aborts_dropped;
+	}
+
+	/* Fold the samples of the same stack taken by different threads */
+	qsort(all, n, sizeof(m_stats_abort_t), stats_abort_compare_key);
+	for (i=0, m=0; i<n; i++) {
+		if (m > 0 && stats_abort_compare_key(&all[m-1], &all[i]) == 0) {
+			all[m-1].count += all[i].count;
+		} else {
+			all[m++] = all[i];
+		}
+	}
+
+	printf("OUTPUT ABORT STACKS >> %s (1 in %u aborts sampled", 
+	       statsmgr->abort_file, statsmgr->abort_sampling);
+	if (dropped) {
+		printf(", %llu samples dropped", dropped);
+	}
+	printf(")\n");
+	if ((fout = fopen(statsmgr->abort_file, "w")) == NULL) {
+		perror(statsmgr->abort_file);
+		FREE(all);
+		return;
+	}
+	for (i=0; i<m; i++) {
+		a = &all[i];
+		symbols = backtrace_symbols(a->frames, a->depth);
+		for (k=a->depth-1; symbols && k>=0; k--) {
+			stats_abort_frame_print(fout, symbols[k]);
+			fprintf(fout, ";");
+		}
+		free(symbols);
+		fprintf(fout, "[%s]", a->reason);
+		if (a->owner) {
+			symbols = backtrace_symbols((void **) &a->owner, 1);
+			if (symbols) {
+				fprintf(fout, ";[owner ");
+				stats_abort_frame_print(fout, symbols[0]);
+				fprintf(fout, "]");
+			}
+			free(symbols);
+		}
+		fprintf(fout, " %llu\n", a->count);
+	}
+	fclose(fout);
+	FREE(all);
+}
+
+
+/*
+ * Appends the occupancy of the persistent heap, once the heap exists, to 
+ * a JSON snapshot. Sizeclasses without slabs are left out.
+ */
+static
+void
+stats_export_pmalloc_json(FILE *fout)
+{
+	pmalloc_stats_t st;
+	int             first = 1;
+	int             c;
+
+	if (pmalloc_stats(&st) != 0) {
+		return;
+	}
+	fprintf(fout, ",\n  \"pmalloc\": {\"mallocs\": %llu, \"frees\": %llu, "
+	        "\"heap_bytes\": %llu, \"free_bytes\": %llu, \"free_extents\": %llu, "
+	        "\"largest_free_bytes\": %llu, \"slab_bytes\": %llu, \"big_bytes\": %llu, "
+	        "\"empty_slabs\": %llu, \"unmapped_slabs\": %llu, \"fullness_bins\": [",
+	        (unsigned long long) st.mallocs, (unsigned long long) st.frees,
+	        (unsigned long long) st.heap_bytes, (unsigned long long) st.free_bytes,
+	        (unsigned long long) st.free_extents, (unsigned long long) st.largest_free_bytes,
+	        (unsigned long long) st.slab_bytes, (unsigned long long) st.big_bytes,
+	        (unsigned long long) st.empty_slabs, (unsigned long long) st.unmapped_slabs);
+	for (c=0; c<PMALLOC_STATS_FULLNESS_BINS; c++) {
+		fprintf(fout, "%s%llu", c ? ", " : "", (unsigned long long) st.fullness_bins[c]);
+	}
+	fprintf(fout, "],\n    \"sizeclasses\": [");
+	for (c=0; c<PMALLOC_STATS_SIZECLASSES; c++) {
+		if (st.sizeclass[c].slabs == 0) {
+			continue;
+		}
+		fprintf(fout, "%s\n      {\"sizeclass\": %d, \"block_size\": %llu, "
+		        "\"slabs\": %llu, \"blocks_in_use\": %llu}", 
+		        first ? "" : ",", c,
+		        (unsigned long long) st.sizeclass[c].block_size,
+		        (unsigned long long) st.sizeclass[c].slabs,
+		        (unsigned long long) st.sizeclass[c].blocks_in_use);
+		first = 0;
+	}
+	fprintf(fout, "\n    ]}");
+}
+
+
+static
+void
+stats_export_pmalloc_prometheus(FILE *fout)
+{
+	pmalloc_stats_t st;
+	int             c;
+
+	if (pmalloc_stats(&st) != 0) {
+		return;
+	}
+	fprintf(fout, "# TYPE pmalloc_mallocs_total counter\npmalloc_mallocs_total %llu\n", 
+	        (unsigned long long) st.mallocs);
+	fprintf(fout, "# TYPE pmalloc_frees_total counter\npmalloc_frees_total %llu\n", 
+	        (unsigned long long) st.frees);
+	fprintf(fout, "# TYPE pmalloc_bytes gauge\n");
+	fprintf(fout, "pmalloc_bytes{kind=\"heap\"} %llu\n", (unsigned long long) st.heap_bytes);
+	fprintf(fout, "pmalloc_bytes{kind=\"free\"} %llu\n", (unsigned long long) st.free_bytes);
+	fprintf(fout, "pmalloc_bytes{kind=\"largest_free\"} %llu\n", (unsigned long long) st.largest_free_bytes);
+	fprintf(fout, "pmalloc_bytes{kind=\"slab\"} %llu\n", (unsigned long long) st.slab_bytes);
+	fprintf(fout, "pmalloc_bytes{kind=\"big\"} %llu\n", (unsigned long long) st.big_bytes);
+	fprintf(fout, "# TYPE pmalloc_free_extents gauge\npmalloc_free_extents %llu\n", 
+	        (unsigned long long) st.free_extents);
+	fprintf(fout, "# TYPE pmalloc_slabs gauge\n");
+	for (c=0; c<PMALLOC_STATS_FULLNESS_BINS; c++) {
+		fprintf(fout, "pmalloc_slabs{bin=\"%d\"} %llu\n", c, (unsigned long long) st.fullness_bins[c]);
+	}
+	fprintf(fout, "pmalloc_slabs{bin=\"empty\"} %llu\n", (unsigned long long) st.empty_slabs);
+	fprintf(fout, "pmalloc_slabs{bin=\"unmapped\"} %llu\n", (unsigned long long) st.unmapped_slabs);
+	fprintf(fout, "# TYPE pmalloc_blocks_in_use gauge\n");
+	for (c=0; c<PMALLOC_STATS_SIZECLASSES; c++) {
+		if (st.sizeclass[c].slabs) {
+			fprintf(fout, "pmalloc_blocks_in_use{block_size=\"%llu\"} %llu\n", 
+			        (unsigned long long) st.sizeclass[c].block_size,
+			        (unsigned long long) st.sizeclass[c].blocks_in_use);
+		}
+	}
+}
+
+
+/*
+ * Writes a snapshot of the counter blocks of all threads in the export 
+ * format. The blocks are read while their threads update them, so a 
+ * snapshot may mix counters of two consecutive transactions of a thread.
+ * The caller holds statsmgr->mutex so that the list of threads does not
+ * change.
+ */
+static
+void
+stats_export_snapshot_json(FILE *fout, m_statsmgr_t *statsmgr)
+{
+	m_stats_threadstat_t *threadstat;
+	uint64_t             total[m_stats_numofstats];
+	uint64_t             transactions = 0;
+	struct timeval       tv;
+	int                  i;
+
+	gettimeofday(&tv, NULL);
+	memset(total, 0, sizeof(total));
+	fprintf(fout, "{\n  \"timestamp_ms\": %llu,\n  \"threads\": [", 
+	        (unsigned long long) tv.tv_sec * 1000 + tv.tv_usec / 1000);
+	for (threadstat=statsmgr->alloc_threadstat_list_head;
+	     threadstat;
+		 threadstat = threadstat->next)
+	{
+		transactions += threadstat->counters.transactions;
+		fprintf(fout, "%s\n    {\"thread\": %u, \"transactions\": %llu", 
+		        threadstat == statsmgr->alloc_threadstat_list_head ? "" : ",",
+		        threadstat->tid, 
+		        (unsigned long long) threadstat->counters.transactions);
+		for (i=0; i<m_stats_numofstats; i++) {
+			total[i] += threadstat->counters.stats[i];
+			fprintf(fout, ", \"%s\": %llu", stats_strings[i], 
+			        (unsigned long long) threadstat->counters.stats[i]);
+		}
+		fprintf(fout, "}");
+	}
+	fprintf(fout, "\n  ],\n  \"total\": {\"transactions\": %llu", 
+	        (unsigned long long) transactions);
+	for (i=0; i<m_stats_numofstats; i++) {
+		fprintf(fout, ", \"%s\": %llu", stats_strings[i], 
+		        (unsigned long long) total[i]);
+	}
+	fprintf(fout, "}");
+	stats_export_pmalloc_json(fout);
+	fprintf(fout, "\n}\n");
+}
+
+
+/* 
+ * Same as stats_export_snapshot_json in the Prometheus text exposition 
+ * format, which wants the samples of each metric together. 
+ */
+static
+void
+stats_export_snapshot_prometheus(FILE *fout, m_statsmgr_t *statsmgr)
+{
+	m_stats_threadstat_t *threadstat;
+	int                  i;
+
+	fprintf(fout, "# TYPE mtm_transactions_total counter\n");
+	for (threadstat=statsmgr->alloc_threadstat_list_head;
+	     threadstat;
+		 threadstat = threadstat->next)
+	{
+		fprintf(fout, "mtm_transactions_total{thread=\"%u\"} %llu\n", 
+		        threadstat->tid, 
+		        (unsigned long long) threadstat->counters.transactions);
+	}
+	for (i=0; i<m_stats_numofstats; i++) {
+		fprintf(fout, "# TYPE mtm_%s_total counter\n", stats_strings[i]);
+		for (threadstat=statsmgr->alloc_threadstat_list_head;
+		     threadstat;
+			 threadstat = threadstat->next)
+		{
+			fprintf(fout, "mtm_%s_total{thread=\"%u\"} %llu\n", stats_strings[i],
+			        threadstat->tid, 
+			        (unsigned long long) threadstat->counters.stats[i]);
+		}
+	}
+	stats_export_pmalloc_prometheus(fout);
+}
+
+
+/*
+ * Replaces the export file with a new snapshot. The snapshot is written 
+ * to a temporary file first, so that readers never see a partial one.
+ */
+static
+void
+stats_export(m_statsmgr_t *statsmgr)
+{
+	char tmp_file[PATH_MAX];
+	FILE *fout;
+
+	snprintf(tmp_file, sizeof(tmp_file), "%s.tmp", statsmgr->export_file);
+	if ((fout = fopen(tmp_file, "w")) == NULL) {
+		return;
+	}
+	M_MUTEX_LOCK(&(statsmgr->mutex));
+	if (statsmgr->export_format == M_STATS_EXPORT_JSON) {
+		stats_export_snapshot_json(fout, statsmgr);
+	} else {
+		stats_export_snapshot_prometheus(fout, statsmgr);
+	}
+	M_MUTEX_UNLOCK(&(statsmgr->mutex));
+	fclose(fout);
+	rename(tmp_file, statsmgr->export_file);
+}
+
+
+static
+void *
+stats_export_main(void *arg)
+{
+	m_statsmgr_t    *statsmgr = (m_statsmgr_t *) arg;
+	struct timeval  tp;
+	struct timespec ts;
+
+	M_MUTEX_LOCK(&(statsmgr->export_mutex));
+	while (!statsmgr->export_stop) {
+		gettimeofday(&tp, NULL);
+		ts.tv_sec = tp.tv_sec + statsmgr->export_period_ms / 1000;
+		ts.tv_nsec = tp.tv_usec * 1000 + (statsmgr->export_period_ms % 1000) * 1000000;
+		if (ts.tv_nsec >= 1000000000) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000;
+		}
+		pthread_cond_timedwait(&(statsmgr->export_cond), &(statsmgr->export_mutex), &ts);
+		if (!statsmgr->export_stop) {
+			M_MUTEX_UNLOCK(&(statsmgr->export_mutex));
+			stats_export(statsmgr);
+			M_MUTEX_LOCK(&(statsmgr->export_mutex));
+		}
+	}
+	M_MUTEX_UNLOCK(&(statsmgr->export_mutex));
+
+	return NULL;
+}
+
+
+/**
+ * \brief Starts a thread exporting the counters of all threads to 
+ * export_file every period_ms milliseconds.
+ *
+ * \param[in] format Either "json" or "prometheus" (text exposition format).
+ */
+m_result_t
+m_statsmgr_export_start(m_statsmgr_t *statsmgr, 
+                        char *export_file, 
+                        char *format, 
+                        unsigned int period_ms)
+{
+	if (strcasecmp(format, "json") == 0) {
+		statsmgr->export_format = M_STATS_EXPORT_JSON;
+	} else if (strcasecmp(format, "prometheus") == 0) {
+		statsmgr->export_format = M_STATS_EXPORT_PROMETHEUS;
+	} else {
+		return M_R_INVALIDARG;
+	}
+	statsmgr->export_file = export_file;
+	statsmgr->export_period_ms = period_ms;
+	statsmgr->export_stop = 0;
+	M_MUTEX_INIT(&(statsmgr->export_mutex), NULL);
+	pthread_cond_init(&(statsmgr->export_cond), NULL);
+	if (pthread_create(&(statsmgr->export_thread), NULL, stats_export_main, statsmgr) != 0) {
+		return M_R_FAILURE;
+	}
+	statsmgr->export_started = 1;
+
+	return M_R_SUCCESS;
+}
+
+
+/**
+ * \brief Stops the export thread, if any, and writes a last snapshot.
+ */
+void
+m_statsmgr_export_stop(m_statsmgr_t *statsmgr)
+{
+	if (!statsmgr->export_started) {
+		return;
+	}
+	M_MUTEX_LOCK(&(statsmgr->export_mutex));
+	statsmgr->export_stop = 1;
+	pthread_cond_signal(&(statsmgr->export_cond));
+	M_MUTEX_UNLOCK(&(statsmgr->export_mutex));
+	pthread_join(statsmgr->export_thread, NULL);
+	statsmgr->export_started = 0;
+	stats_export(statsmgr);
+}
+
+
+#ifdef _M_STATS_BUILD
+/*
+ * Prints how many bytes reach persistent memory per byte of user data the 
+ * transactions wrote: log written out, cachelines written back, and log 
+ * truncated. Code paths with a high log ratio are candidates for logging 
+ * ranges instead of words.
+ */
+static
+void
+stats_amplification_print(FILE *fout, 
+                          m_stats_statset_t *statset, 
+                          int shiftlen)
+{
+	double user = (double) statset->stats[m_stats_nvwrite_bytes_stat].total;
+	double log = (double) statset->stats[m_stats_log_bytes_stat].total;
+	double flush = (double) statset->stats[m_stats_wbflush_stat].total * M_STATS_CACHELINE_SIZE;
+	double trunc = (double) statset->stats[m_stats_trunc_bytes_stat].total;
+
+	if (user == 0) {
+		return;
+	}
+	fprintf(fout, "%s%s%s:%13.2f%13.2f%13.2f%13.2f\n", 
+	        WHITESPACE(shiftlen+2),
+	        "write_amplification",
+	        WHITESPACE(25 - strlen("write_amplification")),
+	        log / user,
+	        flush / user,
+	        trunc / user,
+	        (log + flush) / user);
+	fprintf(fout, "%s%s%s %13s%13s%13s%13s\n", 
+	        WHITESPACE(shiftlen+2),
+	        "",
+	        WHITESPACE(25),
+	        "(log",
+	        "flush",
+	        "trunc",
+	        "total)");
+	fprintf(fout, "%s%s%s:%13.2f\n", 
+	        WHITESPACE(shiftlen+2),
+	        "fences_per_KB",
+	        WHITESPACE(25 - strlen("fences_per_KB")),
+	        (double) statset->stats[m_stats_fences_stat].total * 1024 / user);
+}
+#endif /* _M_STATS_BUILD */
+
+
 static
 void
 m_stats_statset_print(FILE *fout, 
@@ -276,6 +1236,7 @@ m_stats_statset_print(FILE *fout,
 {
 	int                     i;
 	char                    header[512];
+	char                    **symbols = NULL;
 	double                  mean;
 	m_stats_statcounter_t max;
 	m_stats_statcounter_t min;
@@ -283,7 +1244,12 @@ m_stats_statset_print(FILE *fout,
 	m_stats_statcounter_t count;
 
 	if (print_header) {
-		sprintf(header, "Transaction: %s", statset->name);
+		if (statset->name == NULL && statset->site) {
+			symbols = backtrace_symbols((void **) &statset->site, 1);
+		}
+		snprintf(header, sizeof(header), "Transaction: %s", 
+		         statset->name ? statset->name : (symbols ? symbols[0] : "unknown"));
+		free(symbols);
 		fprintf(fout, "%s%s\n\n", WHITESPACE(shiftlen), header);
 	}
 
@@ -298,7 +1264,7 @@ m_stats_statset_print(FILE *fout,
 
 	count = statset->count;
 
-	fprintf(fout, "%s%s%s:%13s%13s%13s%13u\n", 
+	fprintf(fout, "%s%s%s:%13s%13s%13s%13llu\n", 
 	        WHITESPACE(shiftlen+2),
 	        "Transactions",
 			WHITESPACE(25 - strlen("Transactions")),
@@ -312,7 +1278,7 @@ m_stats_statset_print(FILE *fout,
 		min = statset->stats[i].min;
 		max = statset->stats[i].max;
 		mean = (double) total / (double) count;
-		fprintf(fout, "%s%s%s:%13u%13.2f%13u%13u\n", 
+		fprintf(fout, "%s%s%s:%13llu%13.2f%13llu%13llu\n", 
 		        WHITESPACE(shiftlen+2),
 		        stats_strings[i],
 				WHITESPACE(25 - strlen(stats_strings[i])),
@@ -321,6 +1287,9 @@ m_stats_statset_print(FILE *fout,
 				max,
 				total);
 	}
+#ifdef _M_STATS_BUILD
+	stats_amplification_print(fout, statset, shiftlen);
+#endif
 }
 
 
@@ -329,9 +1298,9 @@ void
 stats_threadstat_print(FILE *fout, 
                        m_stats_threadstat_t *threadstat) 
 {
-	m_chhash_iter_t   iter;
-	m_chhash_key_t    key;
-	m_chhash_value_t  value;
+	m_flathash_iter_t   iter;
+	m_flathash_key_t    key;
+	m_flathash_value_t  value;
 	m_stats_statset_t *statset;
 	m_stats_statset_t statset_all;
 	int               i;
@@ -341,8 +1310,8 @@ stats_threadstat_print(FILE *fout,
 	fprintf(fout, "\n");
 	fprintf(fout, "  Transactions for thread %u\n\n", threadstat->tid);
 	
-	m_chhash_iter_init(threadstat->stats_table, &iter);
-	while(M_R_SUCCESS == m_chhash_iter_next(&iter, &key, &value)) {
+	m_flathash_iter_init(threadstat->stats_table, &iter);
+	while(M_R_SUCCESS == m_flathash_iter_next(&iter, &key, &value)) {
 		statset = (m_stats_statset_t *) value;
 		m_stats_statset_print(fout, statset, 4, true);
 		fprintf(fout, "\n");
@@ -355,11 +1324,11 @@ void
 stats_summarize_all(m_statsmgr_t *statsmgr, m_stats_threadstat_t *summary)
 {
 	m_stats_threadstat_t *threadstat;
-	m_chhash_iter_t      iter;
+	m_flathash_iter_t      iter;
 	m_stats_statset_t    *statset;
 	m_stats_statset_t    *statset_summary;
-	m_chhash_key_t       key;
-	m_chhash_value_t     value;
+	m_flathash_key_t       key;
+	m_flathash_value_t     value;
 	int                  i;
 	m_result_t           result;
 
@@ -368,17 +1337,18 @@ stats_summarize_all(m_statsmgr_t *statsmgr, m_stats_threadstat_t *summary)
 	     threadstat;
 		 threadstat = threadstat->next)
 	{
-		m_chhash_iter_init(threadstat->stats_table, &iter);
-		while(M_R_SUCCESS == m_chhash_iter_next(&iter, &key, &value)) {
+		m_flathash_iter_init(threadstat->stats_table, &iter);
+		while(M_R_SUCCESS == m_flathash_iter_next(&iter, &key, &value)) {
 			statset = (m_stats_statset_t *) value;
 			result = stats_get_statset(summary->stats_table, 
-			                           statset->name, &statset_summary);
+			                           stats_statset_key(statset), &statset_summary);
 			if (result != M_R_SUCCESS) {
 				m_stats_statset_create(&statset_summary);
 				m_stats_statset_init(statset_summary, statset->name);
-				m_chhash_add(summary->stats_table, 
-			                 (m_chhash_key_t) statset->name, 
-			                 (m_chhash_value_t) (statset_summary));
+				statset_summary->site = statset->site;
+				m_flathash_add(summary->stats_table, 
+			                 stats_statset_key(statset), 
+			                 (m_flathash_value_t) (statset_summary));
 			}
 			statset_summary->count += statset->count;
 			summary->summary_statset.count += statset->count;
@@ -414,11 +1384,11 @@ stats_summarize_all(m_statsmgr_t *statsmgr, m_stats_threadstat_t *summary)
 void
 m_stats_print(m_statsmgr_t *statsmgr)
 {
-	m_chhash_iter_t      iter;
+	m_flathash_iter_t      iter;
 	m_stats_threadstat_t *threadstat;
 	m_stats_threadstat_t summary;
-	m_chhash_key_t       key;
-	m_chhash_value_t     value;
+	m_flathash_key_t       key;
+	m_flathash_value_t     value;
 	m_stats_statset_t    *statset;
 	m_stats_statset_t    statset_grand_total;
 	int                  i;
@@ -445,13 +1415,13 @@ m_stats_print(m_statsmgr_t *statsmgr)
 
 	/* Print per TRANSACTION totals */
 	fprintf(fout, "TRANSACTION TOTALS\n\n");
-	m_chhash_create(&(summary.stats_table),
-	                M_STATS_THREADSTAT_HASHTABLE_SIZE, 
+	m_flathash_create(&(summary.stats_table),
+	                  M_STATS_THREADSTAT_HASHTABLE_SIZE, 
                     false);
 	m_stats_statset_init(&summary.summary_statset, NULL);					  
 	stats_summarize_all(statsmgr, &summary);
-	m_chhash_iter_init(summary.stats_table, &iter);
-	while(M_R_SUCCESS == m_chhash_iter_next(&iter, &key, &value)) {
+	m_flathash_iter_init(summary.stats_table, &iter);
+	while(M_R_SUCCESS == m_flathash_iter_next(&iter, &key, &value)) {
 		statset = (m_stats_statset_t *) value;
 		m_stats_statset_print(fout, statset, 0, true);
 		fprintf(fout, "\n");
@@ -464,7 +1434,13 @@ m_stats_print(m_statsmgr_t *statsmgr)
 		statset_grand_total.stats[i] = summary.summary_statset.stats[i];
 	}	
 	m_stats_statset_print(fout, &statset_grand_total, 0, false);
+	fprintf(fout, "\n");
+
+	stats_commit_phases_print(fout, statsmgr);
+	stats_conflicts_print(fout, statsmgr);
+	pmalloc_stats_print(fout);
 	if (statsmgr->output_file) {
 		fclose(fout);
 	}	
+	stats_aborts_print(statsmgr);
 }	
@@ -34,45 +34,142 @@
  * \file rwlock.c
  * \brief Reader-writer lock implementation 
  *
- * \todo Implement rw-lock if need to support serial mode for irrevocable 
- * actions
- *
- * Note: Linux implementation could use pthreads rwlock
- *
+ * Used to provide serial mode for irrevocable actions. Readers are 
+ * non-serialized transactions and are expected to be frequent, writers 
+ * (serial transactions) rare. Readers and the writer synchronize 
+ * Dekker-style: a reader publishes itself in its slot and then checks 
+ * for a writer; a writer publishes itself and then checks all slots.
  */
 
+#include <errno.h>
+#include <sched.h>
 #include "rwlock.h"
+#include "atomic.h"
+
+static volatile AO_t next_slot = 0;
+static __thread int  my_slot = -1;
+
+
+static inline
+mtm_rwlock_slot_t *
+reader_slot(mtm_rwlock_t *lock)
+{
+	if (my_slot < 0) {
+		my_slot = (int) (ATOMIC_FETCH_INC_FULL(&next_slot) % MTM_RWLOCK_READER_SLOTS);
+	}
+	return &lock->readers[my_slot];
+}
+
+
+static inline
+int
+readers_active(mtm_rwlock_t *lock)
+{
+	int i;
+
+	for (i=0; i<MTM_RWLOCK_READER_SLOTS; i++) {
+		if (ATOMIC_LOAD_ACQ(&lock->readers[i].count) != 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
 
 int
 mtm_rwlock_init (mtm_rwlock_t *lock)
 {
-	// TODO: implement me
+	int i;
+
+	for (i=0; i<MTM_RWLOCK_READER_SLOTS; i++) {
+		lock->readers[i].count = 0;
+	}
+	lock->writer = 0;
+	return pthread_mutex_init(&lock->writer_mutex, NULL);
 }
 
 
 int
 mtm_rwlock_rdlock (mtm_rwlock_t *lock)
 {
-	// TODO: implement me
+	mtm_rwlock_slot_t *slot = reader_slot(lock);
+
+	while (1) {
+		ATOMIC_FETCH_INC_FULL(&slot->count);
+		if (ATOMIC_LOAD_ACQ(&lock->writer) == 0) {
+			return 0;
+		}
+		/* Back off and let the writer drain the readers */
+		ATOMIC_FETCH_DEC_FULL(&slot->count);
+		while (ATOMIC_LOAD_ACQ(&lock->writer) != 0) {
+			sched_yield();
+		}
+	}
 }
 
 
 int
 mtm_rwlock_wrlock (mtm_rwlock_t *lock)
 {
-	// TODO: implement me
+	pthread_mutex_lock(&lock->writer_mutex);
+	ATOMIC_STORE(&lock->writer, 1);
+	ATOMIC_MB_FULL;
+	while (readers_active(lock)) {
+		cpu_relax();
+	}
+	return 0;
 }
 
 
 int
 mtm_rwlock_trywrlock (mtm_rwlock_t *lock)
 {
-	// TODO: implement me
+	if (pthread_mutex_trylock(&lock->writer_mutex) != 0) {
+		return EBUSY;
+	}
+	ATOMIC_STORE(&lock->writer, 1);
+	ATOMIC_MB_FULL;
+	if (readers_active(lock)) {
+		ATOMIC_STORE_REL(&lock->writer, 0);
+		pthread_mutex_unlock(&lock->writer_mutex);
+		return EBUSY;
+	}
+	return 0;
+}
+
+
+/*
+ * Turns a read hold of the calling thread into a write hold. Fails with
+ * EBUSY, keeping the read hold, if another writer holds or waits for the
+ * lock: that writer waits for our read hold to go away, so the caller must
+ * release it instead of waiting in turn.
+ */
+int
+mtm_rwlock_upgrade (mtm_rwlock_t *lock)
+{
+	if (pthread_mutex_trylock(&lock->writer_mutex) != 0) {
+		return EBUSY;
+	}
+	ATOMIC_STORE(&lock->writer, 1);
+	ATOMIC_FETCH_DEC_FULL(&reader_slot(lock)->count);
+	while (readers_active(lock)) {
+		cpu_relax();
+	}
+	return 0;
+}
+
+
+int
+mtm_rwlock_read_unlock (mtm_rwlock_t *lock)
+{
+	ATOMIC_FETCH_DEC_FULL(&reader_slot(lock)->count);
+	return 0;
 }
 
 
 int
-mtm_rwlock_unlock (mtm_rwlock_t *lock)
+mtm_rwlock_write_unlock (mtm_rwlock_t *lock)
 {
-	// TODO: implement me
+	ATOMIC_STORE_REL(&lock->writer, 0);
+	return pthread_mutex_unlock(&lock->writer_mutex);
 }
@@ -32,28 +32,116 @@
 
 #include <pthread.h>
 #include "mtm_i.h"
+#include "txlock.h"
+#include "sysdeps/x86/htm.h"
 
-typedef pthread_mutex_t m_txmutex_t;
+/* Most acquisitions a mutex skips elision for after failed rounds */
+#define M_TXLOCK_ELIDE_PENALTY_MAX 1024
+
+/* Hardware attempts per elided acquisition (0 if no RTM or not initialized). */
+int mtm_txlock_elide_attempts = 0;
 
 void _ITM_CALL_CONVENTION m_txmutex_unlock_commit_action(void *arg)
 {
 	m_txmutex_t *txmutex = (m_txmutex_t *) arg;
-	pthread_mutex_t *mutex = (pthread_mutex_t *) txmutex;
+	pthread_mutex_t *mutex = &txmutex->mutex;
 
 	//printf("[%d] COMMIT: MUTEX  UNLOCK %p\n", pthread_self(), mutex);
+	txmutex->depth--;
 	pthread_mutex_unlock(mutex);
 
 	return;
 }
 
-typedef pthread_rwlock_t m_txrwlock_t;
+
+/*
+ * Starts an elided critical section of txmutex. Returns 0 if the caller must
+ * take the mutex instead: the mutex is held (possibly by the caller), its 
+ * elisions failed recently, or the attempts aborted. An abort resumes here,
+ * so locking another mutex inside an elided section elides it too, or 
+ * aborts the whole section if it is held.
+ */
+int
+m_txmutex_elide(m_txmutex_t *txmutex)
+{
+	unsigned int status;
+	int          penalty;
+	int          i;
+
+	if (mtm_txlock_elide_attempts == 0) {
+		return 0;
+	}
+	if (htm_test()) {
+		if (txmutex->depth != 0) {
+			htm_abort(HTM_CODE_LOCKED);
+		}
+		htm_begin();
+		return 1;
+	}
+	if (txmutex->depth != 0) {
+		return 0;
+	}
+	if (txmutex->elide_skip > 0) {
+		txmutex->elide_skip--;
+		return 0;
+	}
+	for (i = 0; i < mtm_txlock_elide_attempts; i++) {
+		if ((status = htm_begin()) == HTM_STARTED) {
+			/* Reading depth aborts us when another thread takes the mutex */
+			if (txmutex->depth == 0) {
+				return 1;
+			}
+			htm_abort(HTM_CODE_LOCKED);
+		}
+		if (!(status & HTM_ABORT_RETRY) || txmutex->depth != 0) {
+			break;
+		}
+	}
+	penalty = txmutex->elide_penalty;
+	penalty = penalty == 0 ? 1 : 2 * penalty;
+	if (penalty > M_TXLOCK_ELIDE_PENALTY_MAX) {
+		penalty = M_TXLOCK_ELIDE_PENALTY_MAX;
+	}
+	txmutex->elide_penalty = penalty;
+	txmutex->elide_skip = penalty;
+	return 0;
+}
+
+
+/*
+ * Ends the critical section if it is elided; returns 0 if the caller holds
+ * the mutex itself. Releasing a mutex held for real from inside an elided
+ * section aborts the section, which then takes its mutex.
+ */
+int
+m_txmutex_elide_end(m_txmutex_t *txmutex)
+{
+	if (mtm_txlock_elide_attempts == 0 || !htm_test()) {
+		return 0;
+	}
+	if (txmutex->depth != 0) {
+		htm_abort(HTM_CODE_LOCKED);
+	}
+	htm_end();
+	/* Outermost section committed: the mutex elides well again */
+	if (!htm_test() && txmutex->elide_penalty > 0) {
+		txmutex->elide_penalty >>= 1;
+	}
+	return 1;
+}
 
 void _ITM_CALL_CONVENTION m_txrwlock_unlock_commit_action(void *arg)
 {
 	m_txrwlock_t *txrwlock = (m_txrwlock_t *) arg;
-	pthread_rwlock_t *rwlock = (pthread_rwlock_t *) txrwlock;
+	pthread_rwlock_t *rwlock = &txrwlock->rwlock;
 
 	//printf("[%d] COMMIT: RWLOCK UNLOCK %p\n", pthread_self(), rwlock);
+	if (txrwlock->depth > 0 && pthread_equal(txrwlock->writer, pthread_self())) {
+		if (--txrwlock->depth > 0) {
+			return;
+		}
+		txrwlock->writer = 0;
+	}
 	pthread_rwlock_unlock(rwlock);
 
 	return;
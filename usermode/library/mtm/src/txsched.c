@@ -0,0 +1,193 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/**
+ * \file
+ *
+ * \brief Conflict-aware scheduling of transactions; see txsched.h.
+ */
+
+#include <stdint.h>
+#include <spinwait.h>
+#include "mtm_i.h"
+#include "txsched.h"
+
+int                      mtm_sched_threshold;
+int                      mtm_sched_serial_retries;
+int                      mtm_sched_serial_period;
+mtm_sched_site_t         mtm_sched_sites[MTM_SCHED_SITES];
+mtm_sched_serial_t       mtm_sched_serial_sites[MTM_SCHED_SITES];
+
+static volatile uint32_t pairs[MTM_SCHED_PAIRS];
+static volatile uint32_t conflicts;
+static mtm_sched_queue_t queues[MTM_SCHED_CLASSES];
+
+
+/* Halve the counters; sites whose pair drops below the threshold cool down */
+static
+void
+decay(void)
+{
+	mtm_sched_site_t *s;
+	int              i;
+
+	for (i = 0; i < MTM_SCHED_PAIRS; i++) {
+		pairs[i] >>= 1;
+	}
+	for (i = 0; i < MTM_SCHED_SITES; i++) {
+		s = &mtm_sched_sites[i];
+		if (s->site != 0 && pairs[s->pair] < mtm_sched_threshold) {
+			s->site = 0;
+		}
+	}
+}
+
+
+/*
+ * Counts the conflict that restarts tx, which tx->conflict_lock caused.
+ * Returns the conflict class tx should queue on before it re-executes, or
+ * -1 if it should not (the pair is not hot, or tx holds a class already).
+ */
+int
+mtm_sched_conflict(mtm_tx_t *tx)
+{
+	mtm_sched_site_t *s;
+	mtm_word_t       idx;
+	uint32_t         pair;
+	int              klass;
+
+	if (tx->conflict_lock == NULL || tx->site == 0) {
+		return -1;
+	}
+	idx = tx->conflict_lock - locks;
+	tx->conflict_lock = NULL;
+	pair = MTM_SCHED_HASH(tx->site ^ MTM_SCHED_HASH(idx + 1)) & (MTM_SCHED_PAIRS - 1);
+	klass = MTM_SCHED_HASH(idx) & (MTM_SCHED_CLASSES - 1);
+
+	if (__sync_add_and_fetch(&conflicts, 1) % MTM_SCHED_DECAY_PERIOD == 0) {
+		decay();
+	}
+	if (__sync_add_and_fetch(&pairs[pair], 1) < mtm_sched_threshold) {
+		return -1;
+	}
+
+	/* The site is hot: its next transactions queue up front */
+	s = &mtm_sched_sites[MTM_SCHED_HASH(tx->site) & (MTM_SCHED_SITES - 1)];
+	if (s->site != tx->site || s->klass != klass) {
+		s->site = 0;
+		ATOMIC_MB_WRITE;
+		s->pair = pair;
+		s->klass = klass;
+		ATOMIC_MB_WRITE;
+		s->site = tx->site;
+	}
+	return tx->sched_class < 0 ? klass : -1;
+}
+
+
+/* Waits for the turn of tx in the queue of klass */
+void
+mtm_sched_acquire(mtm_tx_t *tx, int klass)
+{
+	mtm_sched_queue_t *q = &queues[klass];
+	uint32_t          ticket;
+	m_spinwait_t      w;
+
+	ticket = __sync_fetch_and_add(&q->next, 1);
+	if (q->serving != ticket) {
+		m_spinwait_init(&w, &q->serving);
+		while (q->serving != ticket) {
+			m_spinwait_pause(&w);
+		}
+		m_spinwait_done(&w);
+	}
+	tx->sched_class = klass;
+}
+
+
+void
+mtm_sched_release(mtm_tx_t *tx)
+{
+	mtm_sched_queue_t *q = &queues[tx->sched_class];
+
+	tx->sched_class = -1;
+	ATOMIC_MB_WRITE;
+	q->serving++;
+	m_spinwait_wake(&q->serving);
+}
+
+
+/* 
+ * Takes one of the serial starts left to the site of s. The last one 
+ * halves its average, so that the site next runs optimistically.
+ */
+int
+mtm_sched_serial_start(mtm_sched_serial_t *s)
+{
+	int32_t left = __sync_sub_and_fetch(&s->left, 1);
+
+	if (left == 0) {
+		s->retries >>= 1;
+	}
+	return left >= 0;
+}
+
+
+/* Folds the retries of the transaction that committed into its site's average */
+void
+mtm_sched_serial_commit(mtm_tx_t *tx)
+{
+	mtm_sched_serial_t *s = &mtm_sched_serial_sites[MTM_SCHED_HASH(tx->site) & (MTM_SCHED_SITES - 1)];
+	uint32_t           threshold = mtm_sched_serial_retries * MTM_SCHED_SERIAL_SCALE;
+	uint32_t           sample = tx->retries < (1 << 20) ? tx->retries : (1 << 20);
+	uint32_t           retries;
+
+	if (s->site != tx->site) {
+		/* Take the slot over only from a site that does not start serial */
+		if (sample == 0 || s->left > 0 || s->retries >= threshold) {
+			return;
+		}
+		s->site = 0;
+		ATOMIC_MB_WRITE;
+		s->retries = 0;
+		s->left = 0;
+		ATOMIC_MB_WRITE;
+		s->site = tx->site;
+	}
+	retries = s->retries;
+	retries -= retries / MTM_SCHED_SERIAL_WEIGHT;
+	retries += sample * MTM_SCHED_SERIAL_SCALE / MTM_SCHED_SERIAL_WEIGHT;
+	s->retries = retries;
+	if (retries >= threshold && s->left <= 0) {
+		s->left = mtm_sched_serial_period;
+	}
+}
@@ -33,70 +33,59 @@
 #include "mtm_i.h"
 #include "useraction.h"
 
-#define USERACTION_LIST_SIZE 8
-
-typedef struct mtm_user_action_s      mtm_user_action_t;
-
-struct mtm_user_action_s
-{
-	_ITM_userCommitFunction  fn;
-	void                     *arg;
-};
-
-struct mtm_user_action_list_s
+void
+mtm_useraction_list_init(mtm_user_action_list_t *list)
 {
-	mtm_user_action_t *array;
-	int               nb_entries;      /* Number of entries */
-	int               size;            /* Size of array */
-};
-
+	list->array = list->inline_array;
+	list->nb_entries = 0;
+	list->size = USERACTION_INLINE_SIZE;
+}
 
 
-int
-mtm_useraction_list_alloc(mtm_user_action_list_t **listp)
+void
+mtm_useraction_list_fini(mtm_user_action_list_t *list)
 {
-	mtm_user_action_list_t *list;
-
-	list = (mtm_user_action_list_t *) malloc (sizeof(mtm_user_action_list_t));
-	
-	if (list) {
-		list->array = (mtm_user_action_t *) realloc(NULL, sizeof(mtm_user_action_t) * USERACTION_LIST_SIZE);
-		list->size = USERACTION_LIST_SIZE;
-		*listp = list;
-		return 0;
+	if (list->array != list->inline_array) {
+		free (list->array);
 	}
-
-	listp = NULL;
-	return -1;
+	mtm_useraction_list_init(list);
 }
 
 
-int
-mtm_useraction_list_free(mtm_user_action_list_t **listp)
+/* Doubles the storage of a full list, moving it into the arena on the first spill */
+static void
+list_grow(mtm_user_action_list_t *list)
 {
-	assert(listp != NULL);
+	mtm_user_action_t *array;
 
-	mtm_user_action_list_t *list = *listp;
-	
-	if (list) {
-		free (list->array);
-		free (list);
+	if (list->array == list->inline_array) {
+		array = (mtm_user_action_t *) malloc(sizeof(mtm_user_action_t) * list->size * 2);
+		if (array) {
+			memcpy(array, list->inline_array, sizeof(mtm_user_action_t) * list->nb_entries);
+		}
+	} else {
+		array = (mtm_user_action_t *) realloc(list->array, sizeof(mtm_user_action_t) * list->size * 2);
 	}
-	*listp = NULL;
-
-	return 0;
+	if (array == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+	list->array = array;
+	list->size *= 2;
 }
 
 
-
-int
-mtm_useraction_clear(mtm_user_action_list_t *list)
+static inline void
+list_push(mtm_user_action_list_t *list, _ITM_userCommitFunction fn, void *arg)
 {
-	assert(list != NULL);
-
-	list->nb_entries = 0;
+	mtm_user_action_t *action;
 
-	return 0;
+	if (list->nb_entries == list->size) {
+		list_grow(list);
+	}
+	action = &list->array[list->nb_entries++];
+	action->fn = fn;
+	action->arg = arg;
 }
 
 
@@ -117,6 +106,19 @@ mtm_useraction_list_run (mtm_user_action_list_t *list, int reverse)
 }
 
 
+/*
+ * Pre-commit actions run in order right before the outermost transaction 
+ * commits, while it can still make transactional stores.
+ */
+void
+mtm_useraction_addUserPrecommitAction(mtm_tx_t * tx,
+                                      _ITM_userCommitFunction fn,
+                                      void *arg)
+{
+	list_push(&tx->precommit_action_list, fn, arg);
+}
+
+
 void
 mtm_useraction_addUserCommitAction(mtm_tx_t * tx,
                                    _ITM_userCommitFunction fn,
@@ -124,17 +126,7 @@ mtm_useraction_addUserCommitAction(mtm_tx_t * tx,
                                    void *arg)
 {
 	/* tid is ignored */
-	mtm_user_action_list_t *list = tx->commit_action_list;
-	mtm_user_action_t      *action;
-
-	if (list->nb_entries == list->size) {
-		list->size *= 2;
-		list->array = (mtm_user_action_t *) realloc(list->array, sizeof(mtm_user_action_t) * list->size);
-	}
-
-	action = &list->array[list->nb_entries++];
-	action->fn = fn;
-	action->arg = arg;
+	list_push(&tx->commit_action_list, fn, arg);
 }
 
 
@@ -143,15 +135,23 @@ mtm_useraction_addUserUndoAction(mtm_tx_t * tx,
                                  const _ITM_userUndoFunction fn, 
                                  void *arg)
 {
-	mtm_user_action_list_t *list = tx->undo_action_list;
-	mtm_user_action_t      *action;
+	list_push(&tx->undo_action_list, fn, arg);
+}
 
-	if (list->nb_entries == list->size) {
-		list->size *= 2;
-		list->array = (mtm_user_action_t *) realloc(list->array, sizeof(mtm_user_action_t) * list->size);
-	}
 
-	action = &list->array[list->nb_entries++];
-	action->fn = fn;
-	action->arg = arg;
+/*
+ * Drop the actions added after the list had the given length, running 
+ * them first (most recent first) if run is set.
+ */
+void
+mtm_useraction_list_rollback(mtm_user_action_list_t *list, int length, int run)
+{
+	mtm_user_action_t *action;
+
+	while (list->nb_entries > length) {
+		action = &list->array[--list->nb_entries];
+		if (run) {
+			action->fn (action->arg);
+		}
+	}
 }
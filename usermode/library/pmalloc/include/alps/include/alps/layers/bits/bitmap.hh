@@ -19,10 +19,26 @@
 
 #include <stdint.h>
 
+/**
+ * @brief Persistent bitmap
+ *
+ * @details
+ * The map is accessed as 64-bit words, bit i of word w being bit 
+ * w * 64 + i of the map, so that updating one or many bits of a word takes 
+ * a single load and a single masked store through the context, i.e. one 
+ * write-set entry and one log record inside a transaction. Stores only 
+ * write the bytes holding the bits that change.
+ *
+ * The size on media is still rounded to bytes (size_of), so the map must 
+ * start 8-byte aligned and be followed by padding up to the next 8-byte 
+ * boundary, as the last word is loaded and stored whole.
+ */
 template<typename Context>
 struct nvBitMap {
     static const int kEntrySizeLog2 = 3;
     static const int kEntrySize = 1 << kEntrySizeLog2;
+    static const int kWordSizeLog2 = 6;
+    static const int kWordSize = 1 << kWordSizeLog2;
 
     uint8_t  bv_[0];
 
@@ -30,9 +46,9 @@ struct nvBitMap {
     {
         nvBitMap* bm = static_cast<nvBitMap*>(ptr);
         // we have at least one entry
-        for (unsigned int i=0; i<size_of(length); i++) {
-            uint8_t tmp = 0;
-            ctx.store(&tmp, &bm->bv_[i], sizeof(bm->bv_[i]));
+        size_t nwords = (size_of(length) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+        for (size_t i=0; i<nwords; i++) {
+            ctx.store_word(bm->word(i), 0, ~0ULL);
         }
         return bm;  
     } 
@@ -51,40 +67,70 @@ struct nvBitMap {
         return bitmap_len / kEntrySize;
     }
 
+    uint64_t* word(size_t word_index)
+    {
+        return reinterpret_cast<uint64_t*>(&bv_[word_index * sizeof(uint64_t)]);
+    }
+
     size_t elt(int bit_index) 
     {
-        return bit_index >> kEntrySizeLog2;
+        return bit_index >> kWordSizeLog2;
+    }
+
+    uint64_t mask(int bit_index) 
+    {
+        return 1ULL << (bit_index & (kWordSize - 1));
     }
 
-    uint8_t mask(int bit_index) 
+    //! Widens mask to whole bytes: every byte holding a bit of mask is all ones
+    static uint64_t byte_mask(uint64_t mask)
     {
-        return 1 << (bit_index & ((1 << kEntrySizeLog2) - 1));
+        mask |= mask >> 1;
+        mask |= mask >> 2;
+        mask |= mask >> 4;
+        return (mask & 0x0101010101010101ULL) * 0xff;
     }
 
     void clear(Context& ctx, int bit_index) 
     {
-        // bv_[elt(bit_index)] = bv_[elt(bit_index)] & ~mask(bit_index);
-        uint8_t tmp;
-        ctx.load(&bv_[elt(bit_index)], &tmp, sizeof(bv_[elt(bit_index)]));
-        tmp = tmp & ~mask(bit_index);
-        ctx.store(&tmp, &bv_[elt(bit_index)], sizeof(bv_[elt(bit_index)]));
+        clear_word(ctx, elt(bit_index), mask(bit_index));
     }
 
     void set(Context& ctx, int bit_index) 
     {
-        // bv_[elt(bit_index)] = bv_[elt(bit_index)] | mask(bit_index);  
-        uint8_t tmp;
-        ctx.load(&bv_[elt(bit_index)], &tmp, sizeof(bv_[elt(bit_index)]));
-        tmp = tmp | mask(bit_index);
-        ctx.store(&tmp, &bv_[elt(bit_index)], sizeof(bv_[elt(bit_index)]));
+        set_word(ctx, elt(bit_index), mask(bit_index));
+    }
+
+    /**
+     * @brief Sets the bits set in mask in the word_index-th word of the map
+     *
+     * @details
+     * Setting many bits of one word this way takes a single store.
+     */
+    void set_word(Context& ctx, size_t word_index, uint64_t mask)
+    {
+        uint64_t* w = word(word_index);
+        uint64_t tmp = ctx.load_word(w);
+        ctx.store_word(w, tmp | mask, byte_mask(mask));
+    }
+
+    //! Clears the bits set in mask in the word_index-th word of the map, in one store
+    void clear_word(Context& ctx, size_t word_index, uint64_t mask)
+    {
+        uint64_t* w = word(word_index);
+        uint64_t tmp = ctx.load_word(w);
+        ctx.store_word(w, tmp & ~mask, byte_mask(mask));
+    }
+
+    //! Returns the word_index-th word of the map
+    uint64_t load_word(Context& ctx, size_t word_index)
+    {
+        return ctx.load_word(word(word_index));
     }
 
     bool is_set(Context& ctx, int bit_index) 
     {
-        //return (bv_[elt(bit_index)] & mask(bit_index)) != 0;
-        uint8_t tmp;
-        ctx.load(&bv_[elt(bit_index)], &tmp, sizeof(bv_[elt(bit_index)]));
-        return (tmp & mask(bit_index)) != 0;
+        return (load_word(ctx, elt(bit_index)) & mask(bit_index)) != 0;
     }
 };
 
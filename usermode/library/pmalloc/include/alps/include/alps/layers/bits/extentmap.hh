@@ -64,6 +64,15 @@ public:
      */
     int remove_ge(size_t len, ExtentInterval* nex);
 
+    /** 
+     * @brief Remove the first len units of the extent that starts at start
+     *
+     * @details
+     * Fails if no extent starts at start or if it is shorter than len. 
+     * Any remainder of the extent stays in the map.
+     */
+    int remove_at(size_t start, size_t len);
+
     /**
      * @brief Returns the number of extents indexed by this ExtentMap
      */
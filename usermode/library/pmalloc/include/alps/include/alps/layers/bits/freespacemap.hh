@@ -20,6 +20,9 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <iostream>
+#include <vector>
+
 #include "alps/common/error_code.hh"
 #include "alps/common/error_stack.hh"
 
@@ -27,31 +30,126 @@
 
 
 #include "alps/layers/bits/extentinterval.hh"
-#include "alps/layers/bits/extentmap.hh"
 
 namespace alps {
 
+/**
+ * @brief Volatile index of the free extents of an extent heap
+ *
+ * @details
+ * Free extents are kept in segregated free lists in the manner of a 
+ * two-level segregated fit (TLSF) allocator: the first level splits 
+ * lengths by power of two and the second level splits each power of two 
+ * into kSecondLevels lists. Bitmaps over the lists let alloc_extent find 
+ * a list whose extents are all long enough in constant time, and 
+ * boundary tags (the free extent starting or ending at each block) let 
+ * free_extent coalesce with the neighboring free extents in constant 
+ * time. Only when no such list has an extent, the list that the request 
+ * length falls into is searched for one long enough.
+ *
+ * Lengths and starts are in blocks, and init must be given the number of 
+ * blocks of the heap before any other call.
+ */
 template<typename Context, template<typename> class TPtr>
-class FreeSpaceMap: public ExtentMap {
+class FreeSpaceMap {
 public:
+    static const int kSecondLevelLog2 = 3;
+    static const int kSecondLevels = 1 << kSecondLevelLog2;
+    static const int kFirstLevels = 64 - kSecondLevelLog2 + 1;
+
+    FreeSpaceMap()
+        : fl_bitmap_(0),
+          nextents_(0)
+    {
+        for (int fl=0; fl<kFirstLevels; fl++) {
+            sl_bitmap_[fl] = 0;
+            for (int sl=0; sl<kSecondLevels; sl++) {
+                lists_[fl][sl] = NULL;
+            }
+        }
+    }
+
+    ~FreeSpaceMap()
+    {
+        for (int fl=0; fl<kFirstLevels; fl++) {
+            for (int sl=0; sl<kSecondLevels; sl++) {
+                while (lists_[fl][sl]) {
+                    Node* n = lists_[fl][sl];
+                    lists_[fl][sl] = n->next;
+                    delete n;
+                }
+            }
+        }
+    }
+
+    void init(size_t nblocks)
+    {
+        tags_.assign(nblocks, NULL);
+    }
+
+    /**
+     * @brief Insert a free extent, coalescing it with adjacent free extents
+     */
+    void insert(const ExtentInterval& ex)
+    {
+        size_t start = ex.start();
+        size_t len = ex.len();
+
+        if (len == 0) {
+            return;
+        }
+        if (start > 0) {
+            Node* prev = tags_[start-1];
+            if (prev && prev->start + prev->len == start) {
+                remove_node(prev);
+                start = prev->start;
+                len += prev->len;
+                delete prev;
+            }
+        }
+        if (start + len < tags_.size()) {
+            Node* next = tags_[start + len];
+            if (next && next->start == start + len) {
+                remove_node(next);
+                len += next->len;
+                delete next;
+            }
+        }
+        insert_node(new Node(start, len));
+    }
+
     bool exists_extent(size_t size_nblocks)
     {
-        ExtentInterval ex;
-        return find_ge(size_nblocks, &ex) == 0 ? true : false;
+        return find_node(size_nblocks) != NULL;
     }
 
     int alloc_extent(size_t size_nblocks, ExtentInterval* ex)
     {
-        if (remove_ge(size_nblocks, ex) == 0) {
-            // if returned size is larger than requested size then return the
-            // rest of the space back to the extendmap
-            if (ex->len() > size_nblocks) {
-                insert(ExtentInterval(ex->start() + size_nblocks, ex->len() - size_nblocks));
-            }
-            *ex = ExtentInterval(ex->start(), size_nblocks);
-            return 0;   
+        Node* n = find_node(size_nblocks);
+        if (!n) {
+            return -1;
+        }
+        *ex = ExtentInterval(n->start, size_nblocks);
+        take(n, size_nblocks);
+        return 0;
+    }
+
+    /**
+     * @brief Allocate the first size_nblocks blocks of the free extent 
+     * that starts at start
+     */
+    int alloc_extent_at(size_t start, size_t size_nblocks, ExtentInterval* ex)
+    {
+        if (start >= tags_.size()) {
+            return -1;
+        }
+        Node* n = tags_[start];
+        if (!n || n->start != start || n->len < size_nblocks) {
+            return -1;
         }
-        return -1;
+        *ex = ExtentInterval(start, size_nblocks);
+        take(n, size_nblocks);
+        return 0;
     }
 
     void free_extent(Context& ctx, const ExtentInterval& ex)
@@ -60,9 +158,184 @@ public:
             insert(ex);
         }
     }
+
+    /**
+     * @brief Calls fn on each free extent, in no particular order
+     *
+     * @details
+     * fn must not change the map.
+     */
+    template<typename Fn>
+    void for_each(Fn fn) const
+    {
+        for (int fl=0; fl<kFirstLevels; fl++) {
+            if (!(fl_bitmap_ & (1LLU << fl))) {
+                continue;
+            }
+            for (int sl=0; sl<kSecondLevels; sl++) {
+                for (Node* n = lists_[fl][sl]; n; n = n->next) {
+                    fn(ExtentInterval(n->start, n->len));
+                }
+            }
+        }
+    }
+
+    /**
+     * @brief Returns the number of free extents
+     */
+    size_t size() const { return nextents_; }
+
+    void stream_to(std::ostream& os) const
+    {
+        for (int fl=0; fl<kFirstLevels; fl++) {
+            for (int sl=0; sl<kSecondLevels; sl++) {
+                for (Node* n = lists_[fl][sl]; n; n = n->next) {
+                    os << ExtentInterval(n->start, n->len) << std::endl;
+                }
+            }
+        }
+    }
+
+private:
+    struct Node {
+        Node(size_t start, size_t len)
+            : start(start), len(len), prev(NULL), next(NULL)
+        { }
+
+        size_t start;
+        size_t len;
+        Node*  prev;
+        Node*  next;
+    };
+
+    static int log2(size_t len)
+    {
+        return 63 - __builtin_clzl(len);
+    }
+
+    // Indexes of the list that extents of length len go into
+    static void mapping_insert(size_t len, int* fl, int* sl)
+    {
+        if (len < (size_t) kSecondLevels) {
+            *fl = 0;
+            *sl = (int) len;
+        } else {
+            int lg = log2(len);
+            *fl = lg - kSecondLevelLog2 + 1;
+            *sl = (int) (len >> (lg - kSecondLevelLog2)) - kSecondLevels;
+        }
+    }
+
+    // Indexes of the first list whose extents are all at least len long
+    static void mapping_search(size_t len, int* fl, int* sl)
+    {
+        if (len >= (size_t) kSecondLevels) {
+            len += (1LLU << (log2(len) - kSecondLevelLog2)) - 1;
+        }
+        mapping_insert(len, fl, sl);
+    }
+
+    Node* find_node(size_t len)
+    {
+        int fl, sl;
+
+        if (len < 1) {
+            return NULL;
+        }
+        mapping_search(len, &fl, &sl);
+        if (fl < kFirstLevels) {
+            uint64_t sl_map = sl_bitmap_[fl] & (~0LLU << sl);
+            if (!sl_map) {
+                uint64_t fl_map = fl + 1 < kFirstLevels ? fl_bitmap_ & (~0LLU << (fl + 1)) : 0;
+                if (fl_map) {
+                    fl = __builtin_ctzl(fl_map);
+                    sl_map = sl_bitmap_[fl];
+                }
+            }
+            if (sl_map) {
+                return lists_[fl][__builtin_ctzl(sl_map)];
+            }
+        }
+
+        // No list guarantees a fit, but the list len falls into may still 
+        // hold an extent long enough
+        mapping_insert(len, &fl, &sl);
+        for (Node* n = lists_[fl][sl]; n; n = n->next) {
+            if (n->len >= len) {
+                return n;
+            }
+        }
+        return NULL;
+    }
+
+    // Removes the first len blocks of free extent n from the map
+    void take(Node* n, size_t len)
+    {
+        remove_node(n);
+        if (n->len > len) {
+            n->start += len;
+            n->len -= len;
+            insert_node(n);
+        } else {
+            delete n;
+        }
+    }
+
+    void insert_node(Node* n)
+    {
+        int fl, sl;
+        mapping_insert(n->len, &fl, &sl);
+        n->prev = NULL;
+        n->next = lists_[fl][sl];
+        if (n->next) {
+            n->next->prev = n;
+        }
+        lists_[fl][sl] = n;
+        fl_bitmap_ |= 1LLU << fl;
+        sl_bitmap_[fl] |= 1LLU << sl;
+        tags_[n->start] = n;
+        tags_[n->start + n->len - 1] = n;
+        nextents_++;
+    }
+
+    void remove_node(Node* n)
+    {
+        int fl, sl;
+        mapping_insert(n->len, &fl, &sl);
+        if (n->prev) {
+            n->prev->next = n->next;
+        } else {
+            lists_[fl][sl] = n->next;
+        }
+        if (n->next) {
+            n->next->prev = n->prev;
+        }
+        if (!lists_[fl][sl]) {
+            sl_bitmap_[fl] &= ~(1LLU << sl);
+            if (!sl_bitmap_[fl]) {
+                fl_bitmap_ &= ~(1LLU << fl);
+            }
+        }
+        tags_[n->start] = NULL;
+        tags_[n->start + n->len - 1] = NULL;
+        nextents_--;
+    }
+
+    uint64_t           fl_bitmap_;
+    uint64_t           sl_bitmap_[kFirstLevels];
+    Node*              lists_[kFirstLevels][kSecondLevels];
+    std::vector<Node*> tags_; // free extent starting or ending at each block
+    size_t             nextents_;
 };
 
 
+template<typename Context, template<typename> class TPtr>
+inline std::ostream& operator<<(std::ostream& os, const FreeSpaceMap<Context, TPtr>& fsmap)
+{
+    fsmap.stream_to(os);
+    return os;
+}
+
 } // namespace alps
 
 #endif // _ALPS_LAYERS_BITS_FREESPACEMAP_HH_
@@ -54,10 +54,12 @@ public:
     void mark_alloc(uint32_t nblocks)
     {
         size_ = nblocks;
+        slab_ = 0;
         nvExtentHeader* this_bh = reinterpret_cast<nvExtentHeader*>(this);
         for (uint32_t i=1; i<nblocks; i++) {
             nvExtentHeader* bh = this_bh + i;
             bh->type_ = nvExtentHeader::kBlockTypeExtentRun;
+            bh->size_ = i; // distance of a run block from the first block
             //persist((void*) &bh->type_, sizeof(bh->type_));
         }
 
@@ -85,6 +87,9 @@ public:
             /** Block type */
             uint8_t  type_;
 
+            /** Set in the first block of an extent formatted as a slab */
+            uint8_t  slab_;
+
             /** Extent size in number of blocks */
             uint32_t size_;
         };
@@ -106,6 +111,7 @@ struct nvExtentHeapHeader {
             uint64_t  extent_headers_offset_; // extent headers offset relative to payload
             uint64_t  blocks_offset_; // blocks offset relative to payload
             void*     extentheap_; // pointer to the heap's volatile descriptor for quick lookup
+            void*     next_region_; // region appended to the heap after this one, or NULL
         };
         uint8_t u8_[64];
     };
@@ -24,6 +24,7 @@
 #include <algorithm>
 #include <atomic>
 #include <list>
+#include <vector>
 #include <iostream>
 #include <signal.h>
 
@@ -56,12 +57,9 @@ struct nvSlabHeader {
     {
         size_t block_size = size_from_class(size_class);
         size_t nblocks = max_nblocks(slab_size, block_size);
-        size_t header_sz = size_of() + nvBitMap<Context>::size_of(nblocks);
         header->sizeclass = size_class;
-        header->header_size = align<size_t, kCacheLineSize>(header_sz);
-        // Adjust (reduce) number of blocks to accomodate extra space needed 
-        // for roundup
-        header->nblocks = (slab_size - header->header_size) / block_size;
+        header->header_size = header_size_of(nblocks);
+        header->nblocks = usable_nblocks(slab_size, block_size);
         nvBitMap<Context>::make(ctx, nblocks, &header->block_map);
         //persist((void*)&header, sizeof(nvSlabHeader));
         //persist((void*)&header->block_map, nvBitMap::size_of(nblocks));
@@ -72,6 +70,22 @@ struct nvSlabHeader {
         return header_size;
     }
 
+    //! Cache line aligned size of the header of a slab of up to nblocks blocks
+    static size_t header_size_of(size_t nblocks)
+    {
+        return align<size_t, kCacheLineSize>(size_of() + nvBitMap<Context>::size_of(nblocks));
+    }
+
+    /**
+     * @brief Return the number of blocks a slab of a given slab size and 
+     * block size holds once its header is rounded up
+     */
+    static size_t usable_nblocks(size_t slab_size, size_t block_size)
+    {
+        size_t header_sz = header_size_of(max_nblocks(slab_size, block_size));
+        return slab_size > header_sz ? (slab_size - header_sz) / block_size : 0;
+    }
+
     /**
      * @brief Return maximum number of blocks for a given slab size and block size
      *
@@ -141,6 +155,18 @@ struct nvSlab
         header.block_map.clear(ctx, block_idx);
     }
 
+    //! Allocated blocks of the 64-block group group_idx, one bit per block
+    uint64_t alloc_group(Context& ctx, size_t group_idx)
+    {
+        return header.block_map.load_word(ctx, group_idx);
+    }
+
+    //! Marks free the blocks of the 64-block group group_idx set in mask
+    void set_free_group(Context& ctx, size_t group_idx, uint64_t mask)
+    {
+        header.block_map.clear_word(ctx, group_idx, mask);
+    }
+
     void set_slab(void* slab)
     {
         header.slab = slab;
@@ -174,6 +200,13 @@ const int kSlabFullnessBins = 3;
  * Slabs are owned and managed by a SlabHeap and any call for allocating/freeing 
  * blocks in a slab must be done through the SlabHeap that owns the slab.
  *
+ * Free blocks are tracked in a volatile bitmap, one bit per block set 
+ * while the block is free, so allocating and freeing a block flips a bit 
+ * instead of allocating a list node. Allocation takes the lowest free 
+ * block, found with a count of trailing zeros from the first word that 
+ * may have one. Loading a slab builds the bitmap 64 blocks at a time from 
+ * the non-volatile block map; slabs found at restart are loaded deferred 
+ * and build it when their heap first uses them.
  */
 template<typename Context, template<typename> class TPtr, template<typename> class PPtr>
 class Slab
@@ -185,50 +218,83 @@ public:
     static Slab* make(Context& ctx, TPtr<void> region, size_t slab_size, size_t size_class)
     {
         TPtr<nvSlab<Context, TPtr>> nvslab = nvSlab<Context, TPtr>::make(ctx, region, slab_size, size_class);
-        Slab* slab = new Slab(nvslab);
+        Slab* slab = new Slab(nvslab, slab_size);
         slab->init(ctx);
-        nvslab->set_slab(slab);
         return slab;
     }
 
-    static Slab* load(Context& ctx, TPtr<void> region)
+    static Slab* load(Context& ctx, TPtr<void> region, size_t slab_size)
     {
         TPtr<nvSlab<Context,TPtr>> nvslab = region;
-        Slab* slab = new Slab(nvslab);
+        Slab* slab = new Slab(nvslab, slab_size);
         slab->init(ctx);
-        nvslab->set_slab(slab);
         return slab;
     }
 
+    /**
+     * @brief Wraps a slab found at restart without reading it
+     *
+     * @details
+     * The slab's free map is built by init on first use, so loading a heap 
+     * does not touch the memory of slabs that are never used again.
+     */
+    static Slab* load_deferred(TPtr<void> region, size_t slab_size)
+    {
+        return new Slab(region, slab_size);
+    }
+
     static Slab* slab(TPtr<void> region)
     {
         TPtr<nvSlab<Context,TPtr>> nvslab = region;
         return reinterpret_cast<Slab*>(nvslab->slab());
     }
 
-    Slab(TPtr<nvSlab<Context,TPtr>> nvslab)
+    Slab(TPtr<nvSlab<Context,TPtr>> nvslab, size_t slab_size)
         : nvslab_(nvslab),
-          slab_list_(NULL)
+          size_(slab_size),
+          nfree_(0),
+          free_hint_(0),
+          mapped_(false),
+          slab_list_(NULL),
+          spare_next_(NULL)
     { }
 
     void init(Context& ctx)
     {   
+        nvslab_->set_slab(this);
+        free_map_.clear();
+        nfree_ = 0;
+        free_hint_ = 0;
         if (block_size()) {
-            free_list_.clear();
-            for (size_t i=0; i<nblocks(); i++) {
-                if (nvslab_->is_free(ctx, i)) {
-                    free_list_.push_back(i);
-                }
+            size_t n = nblocks();
+            free_map_.resize((n + 63) / 64);
+            for (size_t g = 0; g < free_map_.size(); g++) {
+                uint64_t valid = (n - g * 64 >= 64) ? ~0ULL : (1ULL << (n - g * 64)) - 1;
+                free_map_[g] = ~nvslab_->alloc_group(ctx, g) & valid;
+                nfree_ += __builtin_popcountll(free_map_[g]);
             }
         }
+        mapped_.store(true, std::memory_order_release);
+    }
+
+    //! Whether init has built the free map
+    bool mapped() const
+    {
+        return mapped_.load(std::memory_order_acquire);
     }
 
-    void reset(Context& ctx, size_t slab_size, int szclass)
+    void reset(Context& ctx, int szclass)
     {   
-        nvSlab<Context,TPtr>::make(ctx, nvslab_, slab_size, szclass);
+        nvSlab<Context,TPtr>::make(ctx, nvslab_, size_, szclass);
         init(ctx);
     }
 
+    //! Size in bytes of the extent the slab is carved out of
+    size_t size() const
+    {
+        return size_;
+    }
+
     int sizeclass() const 
     {
         return nvslab_->sizeclass();
@@ -261,7 +327,7 @@ public:
 
     size_t nblocks_free() const
     {
-        return free_list_.size();
+        return nfree_;
     }
 
     void set_owner(void* owner)
@@ -298,9 +364,9 @@ public:
     {
         TPtr<void> ptr;
 
-        if (!free_list_.empty()) {
-            int bid = free_list_.front();
-            free_list_.pop_front();
+        size_t bid;
+
+        if (take_free(&bid)) {
             nvslab_->set_alloc(ctx, bid);
             ptr = nvslab_->block(bid);
             LOG(info) << "Allocate block: " << "nvslab: " << nvslab_ << " block: " << bid;
@@ -317,7 +383,7 @@ public:
 
         LOG(info) << "Free block: " << "nvslab: " << nvslab_ << " block: " << bid;
         if (ctx.do_v) {
-            free_list_.push_front(bid);
+            put_free(bid);
         }
         if (ctx.do_nv) {
             assert(nvslab_->is_free(ctx, bid) == false);
@@ -325,6 +391,60 @@ public:
         }
     }
 
+    /**
+     * @brief Takes a free block off the volatile free list without marking 
+     * it allocated in the non-volatile block map.
+     *
+     * @details
+     * Used by per-thread block caches: the block stays free in the 
+     * non-volatile map until alloc_reserved_block is called on it.
+     */
+    bool reserve_block(size_t* bid)
+    {
+        return take_free(bid);
+    }
+
+    //! Returns a block taken by reserve_block to the volatile free list
+    void unreserve_block(size_t bid)
+    {
+        put_free(bid);
+    }
+
+    TPtr<void> alloc_reserved_block(Context& ctx, size_t bid)
+    {
+        nvslab_->set_alloc(ctx, bid);
+        LOG(info) << "Allocate reserved block: " << "nvslab: " << nvslab_ << " block: " << bid;
+        return nvslab_->block(bid);
+    }
+
+    //! Marks a block free in the non-volatile block map only
+    void free_reserved_block(Context& ctx, size_t bid)
+    {
+        LOG(info) << "Free reserved block: " << "nvslab: " << nvslab_ << " block: " << bid;
+        assert(nvslab_->is_free(ctx, bid) == false);
+        nvslab_->set_free(ctx, bid);
+    }
+
+    /**
+     * @brief Marks free in the non-volatile block map only the blocks of 
+     * the 64-block group group_idx set in mask
+     */
+    void free_reserved_group(Context& ctx, size_t group_idx, uint64_t mask)
+    {
+        LOG(info) << "Free reserved blocks: " << "nvslab: " << nvslab_ << " group: " << group_idx << " mask: " << mask;
+        nvslab_->set_free_group(ctx, group_idx, mask);
+    }
+
+    size_t block_id(TPtr<void> ptr)
+    {
+        return nvslab_->block_id(ptr);
+    }
+
+    TPtr<void> region()
+    {
+        return nvslab_;
+    }
+
     void stream_to(std::ostream& os) const 
     {
         os << "(" << block_size() << ", " << nblocks() << ", " << nblocks_free() << ")";
@@ -337,11 +457,40 @@ public:
     }
 
 
+    //! Takes the lowest free block off the volatile free bitmap
+    bool take_free(size_t* bid)
+    {
+        if (nfree_ == 0) {
+            return false;
+        }
+        while (free_map_[free_hint_] == 0) {
+            free_hint_++;
+        }
+        uint64_t& word = free_map_[free_hint_];
+        *bid = free_hint_ * 64 + __builtin_ctzll(word);
+        word &= word - 1;
+        nfree_--;
+        return true;
+    }
+
+    void put_free(size_t bid)
+    {
+        assert((free_map_[bid / 64] & (1ULL << (bid % 64))) == 0);
+        free_map_[bid / 64] |= 1ULL << (bid % 64);
+        free_hint_ = std::min(free_hint_, bid / 64);
+        nfree_++;
+    }
+
     std::atomic<void*>           owner_;
-    std::list<size_t>            free_list_;
     TPtr<nvSlab<Context, TPtr>>  nvslab_;
+    size_t                       size_;
+    std::vector<uint64_t>        free_map_;  // bit set while the block is free
+    size_t                       nfree_;
+    size_t                       free_hint_; // no free block in the words before
+    std::atomic<bool>            mapped_;    // free map built
     SlabList*                    slab_list_; // list this slab belongs to
     typename SlabList::iterator  slab_list_it_; // position in the slab list
+    Slab*                        spare_next_; // next slab on a spare slab stack
 };
 
 } // namespace alps
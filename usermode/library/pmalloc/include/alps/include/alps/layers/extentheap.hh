@@ -20,8 +20,12 @@
 #include <pthread.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <algorithm>
+#include <atomic>
 #include <map>
 
+#include <mcslock.h>
+
 #include "alps/common/assorted_func.hh"
 #include "alps/common/error_code.hh"
 #include "alps/common/error_stack.hh"
@@ -118,12 +122,24 @@ inline std::ostream& operator<<(std::ostream& os, const Extent<Context, TPtr, PP
 
 /**
  * @brief Manages a heap of extents
+ *
+ * @details
+ * A heap given a grow function appends a new region when it runs out of 
+ * space. The regions are chained through their non-volatile headers, which
+ * load walks, and each region is managed by its own ExtentHeap, the 
+ * first of which serves as the heap for callers.
  */
 template<typename Context, template<typename> class TPtr, template<typename> class PPtr>
 class ExtentHeap {
     friend Extent<Context, TPtr,PPtr>;
 
 public:
+    //! Maps a new region of size bytes for the heap to grow into; NULL if none
+    typedef void* (*GrowFn)(size_t size, void* arg);
+
+    //! Gives the storage of size bytes at addr back; nonzero if it could not
+    typedef int (*DiscardFn)(void* addr, size_t size, void* arg);
+
     static ExtentHeap* make(TPtr<void> region, size_t region_size, size_t block_log2size)
     {
         ExtentHeap* exheap = new ExtentHeap;
@@ -140,10 +156,133 @@ public:
 
         exheap->nvexheap_ = nvExtentHeap<Context, TPtr, PPtr>::load(region);
         exheap->init();
+        if (exheap->nvexheap_->header_.next_region_) {
+            exheap->next_ = load(exheap->nvexheap_->header_.next_region_);
+        }
 
         return exheap;
     }
 
+    /**
+     * @brief Lets the heap grow by regions of at least grow_size bytes 
+     * mapped by fn
+     */
+    void set_grow(GrowFn fn, void* arg, size_t grow_size)
+    {
+        for (ExtentHeap* r = this; r; r = r->next_) {
+            r->grow_fn_ = fn;
+            r->grow_arg_ = arg;
+            r->grow_size_ = grow_size;
+        }
+    }
+
+    bool contains(TPtr<void> ptr)
+    {
+        return owns(ptr) || (next_ && next_->contains(ptr));
+    }
+
+    /**
+     * @brief Attaches a volatile descriptor to each block of the extent 
+     * that starts at ptr, or detaches it with NULL
+     *
+     * @details
+     * Lets layers above find the descriptor of the extent an interior 
+     * pointer falls into, such as the slab of a block, without reading 
+     * the non-volatile headers or taking the lock.
+     */
+    void set_descriptor(TPtr<void> ptr, size_t size_bytes, void* descriptor)
+    {
+        if (!owns(ptr)) {
+            return next_->set_descriptor(ptr, size_bytes, descriptor);
+        }
+        size_t idx = block_index(ptr);
+        size_t nblocks = size_bytes >> nvexheap_->header_.block_log2size_;
+        for (size_t i=idx; i<idx+nblocks; i++) {
+            descriptors_[i].store(descriptor, std::memory_order_release);
+        }
+    }
+
+    //! Descriptor attached to the block ptr falls into, or NULL
+    void* descriptor(TPtr<void> ptr)
+    {
+        if (!owns(ptr)) {
+            return next_ ? next_->descriptor(ptr) : NULL;
+        }
+        return descriptors_[block_index(ptr)].load(std::memory_order_acquire);
+    }
+
+    //! Records in its header that the extent starting at ptr holds a slab
+    void mark_slab(Context& ctx, TPtr<void> ptr)
+    {
+        if (!owns(ptr)) {
+            return next_->mark_slab(ctx, ptr);
+        }
+        if (ctx.do_nv) {
+            nvexheap_->extent_header(block_index(ptr))->slab_ = 1;
+        }
+    }
+
+    /**
+     * @brief Calls fn(extent, size_bytes) on each slab extent of this
+     * region that starts in blocks [first, last)
+     *
+     * @details
+     * Only reads the extent headers, never the slabs. Disjoint block
+     * ranges may be scanned concurrently, each extent being reported by
+     * the range its first block falls in.
+     */
+    template<typename Fn>
+    void for_each_slab(size_t first, size_t last, Fn fn)
+    {
+        for_each_extent(first, last, [&](TPtr<void> extent, size_t size_bytes, bool slab) {
+            if (slab) {
+                fn(extent, size_bytes);
+            }
+        });
+    }
+
+    /**
+     * @brief Calls fn(extent, size_bytes, slab) on each allocated extent 
+     * of this region that starts in blocks [first, last), slab telling 
+     * whether it holds a slab
+     *
+     * @details
+     * Same concurrency as for_each_slab.
+     */
+    template<typename Fn>
+    void for_each_extent(size_t first, size_t last, Fn fn)
+    {
+        size_t i = first;
+        while (i < last) {
+            TPtr<nvExtentHeader<Context, TPtr>> exhdr = nvexheap_->extent_header(i);
+            if (exhdr->type_ == nvExtentHeader<Context, TPtr>::kBlockTypeExtentFirst) {
+                fn(nvexheap_->block(i), (size_t) exhdr->size() << nvexheap_->header_.block_log2size_, 
+                   (bool) exhdr->slab_);
+                i += exhdr->size();
+            } else {
+                i++;
+            }
+        }
+    }
+
+    //! Start of this region, where its non-volatile header is
+    void* region_base()
+    {
+        return nvexheap_.get();
+    }
+
+    //! Number of blocks of this region
+    size_t nblocks()
+    {
+        return nvexheap_->header_.nblocks;
+    }
+
+    //! Next region of the heap, or NULL
+    ExtentHeap* next_region()
+    {
+        return next_;
+    }
+
     uint64_t blocksize()
     {
         return 1 << nvexheap_->header_.block_log2size_;
@@ -157,16 +296,17 @@ public:
 
     ErrorCode extent(TPtr<void> ptr, Extent<Context, TPtr, PPtr>* ex)
     {
-        TPtr<nvBlock> nvblock = ptr;
-
-        if (nvblock < nvexheap_->block(0) || 
-            nvblock >= nvexheap_->block(0) + nvexheap_->header_.region_size_)
-        {
-            return kErrorCodeMemoryInvalidAddress;
+        if (!owns(ptr)) {
+            return next_ ? next_->extent(ptr, ex) : kErrorCodeMemoryInvalidAddress;
         }
-        uintptr_t diff = nvblock - nvexheap_->block(0);
-        size_t idx = diff >> nvexheap_->header_.block_log2size_;
+        size_t idx = block_index(ptr);
         TPtr<nvExtentHeader<Context, TPtr>> exhdr = nvexheap_->extent_header(idx);
+        // A pointer into a run block belongs to the extent starting at the 
+        // extent's first block
+        if (exhdr->type_ == nvExtentHeader<Context, TPtr>::kBlockTypeExtentRun) {
+            idx -= exhdr->size();
+            exhdr = nvexheap_->extent_header(idx);
+        }
         *ex = Extent<Context, TPtr, PPtr>(this, idx, exhdr->size());
 
         return kErrorCodeOk;
@@ -174,20 +314,17 @@ public:
 
     ErrorCode alloc_extent(Context& ctx, size_t size_nblocks, Extent<Context, TPtr, PPtr>* ex)
     {
-        ExtentInterval exintv;
-        if (fsmap_.alloc_extent(size_nblocks, &exintv) == 0) {
-            *ex = Extent<Context, TPtr, PPtr>(this, exintv.start(), exintv.len());
+        ErrorCode rc = reserve_extent(size_nblocks, ex);
+        if (rc == kErrorCodeOk) {
             ex->mark_alloc(ctx);
-            LOG(info) << "Allocated extent: " << ex;
-            return kErrorCodeOk;
         }
-        return kErrorCodeOutofmemory;
+        return rc;
     }
 
     ErrorCode free_extent(Context& ctx, Extent<Context, TPtr, PPtr>& ex)
     {
-        fsmap_.free_extent(ctx, ex.interval());
         ex.mark_free(ctx);
+        fsmap_.free_extent(ctx, ex.interval());
         return kErrorCodeOk;
     }
 
@@ -203,26 +340,133 @@ public:
         ErrorCode rc;
         Extent<Context,TPtr,PPtr> ex;
 
-        pthread_mutex_lock(&mutex_);
+        m_mcslock_lock(&lock_);
 
         // round up to next multiple of block_size
         size_t size_nblocks = size_bytes / blocksize() + (size_bytes % blocksize() ? 1: 0);
 
-        rc = alloc_extent(ctx, size_nblocks, &ex);
+        rc = reserve_extent(size_nblocks, &ex);
+        if (rc != kErrorCodeOk && !next_ && grow_fn_) {
+            grow(size_nblocks);
+        }
+        ExtentHeap* next = next_;
+
+        m_mcslock_unlock(&lock_);
+
+        // The blocks of a reserved extent belong to the caller alone, so 
+        // their headers are written without the lock
         if (rc == kErrorCodeOk) {
+            ex.mark_alloc(ctx);
             *ptr = ex.nvextent();
+        } else if (next) {
+            rc = next->malloc(ctx, size_bytes, ptr);
         }
-
-        pthread_mutex_unlock(&mutex_);
         return rc;
     }
 
     void free(Context& ctx, TPtr<void> ptr)
     {
-        pthread_mutex_lock(&mutex_);
-        ErrorCode rc = free_extent(ctx, ptr);
+        if (!owns(ptr) && next_) {
+            return next_->free(ctx, ptr);
+        }
+        Extent<Context,TPtr,PPtr> ex;
+        ErrorCode rc = extent(ptr, &ex);
         ASSERT_ND(rc == kErrorCodeOk);
-        pthread_mutex_unlock(&mutex_);
+
+        // The headers are marked free before the blocks can be reallocated
+        ex.mark_free(ctx);
+        if (ctx.do_v) {
+            m_mcslock_lock(&lock_);
+            fsmap_.free_extent(ctx, ex.interval());
+            m_mcslock_unlock(&lock_);
+        }
+    }
+
+    /**
+     * @brief Grows in place the extent that starts at ptr to at least 
+     * size_bytes by taking over the free blocks that follow it.
+     */
+    ErrorCode extend(Context& ctx, TPtr<void> ptr, size_t size_bytes)
+    {
+        ErrorCode rc = kErrorCodeOutofmemory;
+        Extent<Context,TPtr,PPtr> ex;
+
+        if (!owns(ptr)) {
+            return next_ ? next_->extend(ctx, ptr, size_bytes) : rc;
+        }
+        m_mcslock_lock(&lock_);
+
+        size_t size_nblocks = size_bytes / blocksize() + (size_bytes % blocksize() ? 1: 0);
+
+        if (extent(ptr, &ex) == kErrorCodeOk && ex.nvextent() == ptr) {
+            ExtentInterval exintv;
+            if (size_nblocks <= ex.len()) {
+                rc = kErrorCodeOk;
+            } else if (fsmap_.alloc_extent_at(ex.end(), size_nblocks - ex.len(), &exintv) == 0) {
+                Extent<Context,TPtr,PPtr> newex(this, ex.start(), size_nblocks);
+                newex.mark_alloc(ctx);
+                LOG(info) << "Extended extent: " << ex << " to " << newex;
+                rc = kErrorCodeOk;
+            }
+        }
+
+        m_mcslock_unlock(&lock_);
+        return rc;
+    }
+
+    /**
+     * @brief Calls fn on the blocks of each free extent of each region and 
+     * returns the number of bytes it discarded
+     *
+     * @details
+     * Goes through the volatile free space map rather than the extent 
+     * headers with the lock held: an extent reserved by malloc is out of 
+     * the map, while its headers read free until the caller marks it 
+     * allocated. The contents of free blocks do not matter, so fn may 
+     * zero them.
+     */
+    size_t discard_free(DiscardFn fn, void* arg)
+    {
+        size_t discarded = 0;
+
+        m_mcslock_lock(&lock_);
+        fsmap_.for_each([&](const ExtentInterval& interval) {
+            TPtr<nvBlock> nvblock = nvexheap_->block(interval.start());
+            size_t size = interval.len() * blocksize();
+            if (fn(nvblock.get(), size, arg) == 0) {
+                discarded += size;
+            }
+        });
+        m_mcslock_unlock(&lock_);
+        if (next_) {
+            discarded += next_->discard_free(fn, arg);
+        }
+        return discarded;
+    }
+
+    //! Sizes in bytes of the heap and of its free space
+    struct FreeSpaceStats {
+        size_t total;
+        size_t free;
+        size_t free_extents;
+        size_t largest_free;
+    };
+
+    //! Adds the regions of the heap to st
+    void add_free_space_stats(FreeSpaceStats* st)
+    {
+        m_mcslock_lock(&lock_);
+        st->total += nblocks() * blocksize();
+        st->free_extents += fsmap_.size();
+        fsmap_.for_each([&](const ExtentInterval& interval) {
+            size_t size = interval.len() * blocksize();
+            st->free += size;
+            st->largest_free = std::max(st->largest_free, size);
+        });
+        m_mcslock_unlock(&lock_);
+        if (next_) {
+            next_->add_free_space_stats(st);
+        }
     }
 
     size_t getsize(TPtr<void> ptr)
@@ -283,10 +527,68 @@ public:
     }
 
 private:
+    // Whether ptr falls within the blocks of this region 
+    bool owns(TPtr<void> ptr)
+    {
+        TPtr<nvBlock> nvblock = ptr;
+
+        return nvblock >= nvexheap_->block(0) && 
+               nvblock < nvexheap_->block(nvexheap_->header_.nblocks);
+    }
+
+    size_t block_index(TPtr<void> ptr)
+    {
+        TPtr<nvBlock> nvblock = ptr;
+        uintptr_t diff = nvblock - nvexheap_->block(0);
+        return diff >> nvexheap_->header_.block_log2size_;
+    }
+
+    // Appends a region large enough for an extent of size_nblocks blocks.
+    // Called with the lock of the last region held.
+    void grow(size_t size_nblocks)
+    {
+        size_t block_log2size = nvexheap_->header_.block_log2size_;
+        size_t min_size = sizeof(nvExtentHeap<Context, TPtr, PPtr>) + 2 * kCacheLineSize +
+                          size_nblocks * (blocksize() + sizeof(nvExtentHeader<Context, TPtr>));
+        size_t region_size = round_up(std::max(grow_size_, min_size), blocksize());
+
+        void* region = grow_fn_(region_size, grow_arg_);
+        if (!region) {
+            return;
+        }
+        ExtentHeap* next = make(region, region_size, block_log2size);
+        next->set_grow(grow_fn_, grow_arg_, grow_size_);
+
+        // The region becomes part of the heap once linked into the last one
+        nvexheap_->header_.next_region_ = region;
+        next_ = next;
+        LOG(info) << "Grew extent heap by region: " << region << " size: " << region_size;
+    }
+
+    //! Takes an extent out of the free space map. Caller must hold the lock.
+    ErrorCode reserve_extent(size_t size_nblocks, Extent<Context, TPtr, PPtr>* ex)
+    {
+        ExtentInterval exintv;
+        if (fsmap_.alloc_extent(size_nblocks, &exintv) == 0) {
+            *ex = Extent<Context, TPtr, PPtr>(this, exintv.start(), exintv.len());
+            LOG(info) << "Allocated extent: " << ex;
+            return kErrorCodeOk;
+        }
+        return kErrorCodeOutofmemory;
+    }
 
     ErrorStack init()
     {
-        pthread_mutex_init(&mutex_, NULL);
+        next_ = NULL;
+        grow_fn_ = NULL;
+        grow_arg_ = NULL;
+        grow_size_ = 0;
+        m_mcslock_init(&lock_);
+        fsmap_.init(nvexheap_->header_.nblocks);
+        descriptors_ = new std::atomic<void*>[nvexheap_->header_.nblocks];
+        for (size_t i=0; i<nvexheap_->header_.nblocks; i++) {
+            descriptors_[i].store(NULL, std::memory_order_relaxed);
+        }
         typename nvExtentHeap<Context, TPtr, PPtr>::Iterator it;
         for (it = nvexheap_->begin(); it != nvexheap_->end(); ++it) {
             if (nvexheap_->is_free(*it)) {
@@ -298,9 +600,15 @@ private:
     }
 
 private:
-    pthread_mutex_t mutex_;
+    m_mcslock_t lock_;
     TPtr<nvExtentHeap<Context, TPtr, PPtr>> nvexheap_;
     FreeSpaceMap<Context, TPtr> fsmap_;        
+    std::atomic<void*>* descriptors_; // per-block descriptor, volatile
+
+    ExtentHeap* next_; // next region of the heap
+    GrowFn grow_fn_;
+    void* grow_arg_;
+    size_t grow_size_;
 };
 
 
@@ -25,7 +25,10 @@ namespace alps {
  * @brief Hybrid heap 
  *
  * @details 
- * 
+ * Objects smaller than bigsize are allocated from the small heap and the 
+ * rest from the big heap. Since a small object may be rounded up to a 
+ * block of bigsize or more, frees and lookups ask the small heap whether 
+ * a pointer is one of its blocks rather than going by size.
  */
 template<typename Context, template<typename> class TPtr, template<typename> class PPtr, typename SmallHeap, typename BigHeap>
 class HybridHeap
@@ -55,22 +58,61 @@ public:
     {
         LOG(info) << "Free ptr==" << ptr.get() << " size==" << sh_->getsize(ptr);  
 
-        if (sh_->getsize(ptr) < bigsize_) {
+        if (sh_->is_block(ptr)) {
             return sh_->free(ctx, ptr);
         } else {
             return bh_->free(ctx, ptr);
         }
     }
  
+    /**
+     * @brief Frees the leading objects of a batch sorted by address and 
+     * returns the position past them
+     *
+     * @details
+     * Small objects are consumed as many at a time as the small heap 
+     * frees together; a big object is freed on its own.
+     */
+    template<typename Iterator>
+    Iterator free_batch(Context& ctx, Iterator first, Iterator last)
+    {
+        if (sh_->is_block(*first)) {
+            return sh_->free_batch(ctx, first, last);
+        }
+        bh_->free(ctx, *first);
+        return ++first;
+    }
+
+    /**
+     * @brief Grows the object at ptr in place to size bytes
+     *
+     * @details
+     * Only big objects can grow, by extending their extent; a small 
+     * object can only use the slack of its slab block.
+     */
+    ErrorCode extend(Context& ctx, TPtr<void> ptr, size_t size)
+    {
+        size_t cursize = getsize(ptr);
+
+        if (size <= cursize) {
+            return kErrorCodeOk;
+        }
+        if (sh_->is_block(ptr)) {
+            return kErrorCodeOutofmemory;
+        }
+        return bh_->extend(ctx, ptr, size);
+    }
+
     size_t getsize(TPtr<void> ptr) 
     {
-        size_t size = sh_->getsize(ptr);
-        if (size >= bigsize_) {
-            size = bh_->getsize(ptr);
+        if (sh_->is_block(ptr)) {
+            return sh_->getsize(ptr);
         }
-        return size;
+        return bh_->getsize(ptr);
     }
 
+    size_t bigsize() const { return bigsize_; }
+
 protected:
     size_t bigsize_;
     SmallHeap* sh_;
@@ -17,6 +17,9 @@
 #ifndef _ALPS_LAYER_SLABHEAP_HH_
 #define _ALPS_LAYER_SLABHEAP_HH_
 
+#include <thread>
+#include <vector>
+
 #include "alps/common/assert_nd.hh"
 
 #include "alps/layers/extentheap.hh"
@@ -32,6 +35,38 @@ namespace alps {
  * This class methods are not-thread safe. User is responsible for proper
  * serialization via lock/unlock.
  * 
+ * A slab heap private to a single thread can be created with a block cache.
+ * The cache keeps, per sizeclass, blocks reserved from the heap's slabs 
+ * (taken off the slabs' volatile free lists but still free in the 
+ * non-volatile block maps) so that malloc and free of blocks of slabs owned 
+ * by the heap do not take the heap lock. The lock is taken only to refill the 
+ * cache in batches or to return blocks when the cache overflows, and 
+ * remains the way non-volatile frees of other threads reach the heap's 
+ * slabs. A cached heap must not serve as a parent slab heap.
+ *
+ * The cache belongs to the thread last bound to the heap with bind_cache, 
+ * and only that thread may use its unlocked paths (malloc, fill_cache and
+ * free of a block of one of the heap's own slabs); debug builds assert 
+ * so. A heap outlives its thread and is handed to the next one, so the 
+ * cache array is only freed with the heap.
+ *
+ * Other threads return blocks to the volatile free lists of a cached 
+ * heap's slabs without its lock: they push them onto the heap's remote 
+ * free list, linked through the blocks themselves, which the heap drains 
+ * when it refills a cache, is trimmed or released. A block whose slab 
+ * changed heaps in the meantime is freed again through its new owner.
+ *
+ * Given a maximum slab size larger than the slab size, the slabs of each 
+ * sizeclass are sized separately: the smallest power-of-two multiple of 
+ * the slab size that holds kSlabMinBlocks blocks with at most 
+ * 1/kSlabMaxWaste of it left unused, up to the maximum slab size. Empty
+ * slabs are only reused by sizeclasses of the same slab size.
+ *
+ * Slabs found in the extent heap at restart are kept aside unmapped, 
+ * without reading them, and only get their free map built and join the 
+ * sizeclass lists when a block of theirs is freed or their heap runs out 
+ * of slabs of a sizeclass, so loading a heap costs a scan of the extent 
+ * headers rather than a read of every slab.
  */
 template<typename Context, template<typename> class TPtr, template<typename> class PPtr>
 class SlabHeap
@@ -40,35 +75,110 @@ public:
     typedef Slab<Context, TPtr, PPtr> SlabT;
     typedef ExtentHeap<Context, TPtr, PPtr> ExtentHeapT;
 
+    static const int kBlockCacheSize = 32;
+    static const int kBlockCacheBatch = kBlockCacheSize / 2;
+
+    static const size_t kSlabMinBlocks = 8;
+    static const size_t kSlabMaxWaste = 8;
+
+    //! Slabs a parent heap formats at once when a child heap asks it for a new one
+    static const int kSlabBatch = 4;
+
+    struct CachedBlock {
+        SlabT* slab;
+        size_t bid;
+    };
+
+    struct BlockCache {
+        int         count;
+        CachedBlock blocks[kBlockCacheSize];
+    };
+
 public:
     SlabHeap(size_t slabsize)
-        : slabsize_(slabsize)
+        : slabsize_(slabsize),
+          parentslabheap_(NULL),
+          extentheap_(NULL),
+          cache_(NULL),
+          epoch_(0),
+          remote_frees_(NULL)
     { 
-        int err = pthread_mutex_init(&mutex_, NULL);
-        ASSERT_ND(err == 0);
+        m_mcslock_init(&lock_);
+        init_slabsizes(slabsize);
+        for (int c=0; c<kSizeClasses; c++) {
+            spare_slabs_[c].store(NULL, std::memory_order_relaxed);
+        }
     }
 
-    SlabHeap(size_t slabsize, SlabHeap* parentslabheap, ExtentHeapT* extentheap)
+    SlabHeap(size_t slabsize, SlabHeap* parentslabheap, ExtentHeapT* extentheap, 
+             bool thread_cache = false, size_t max_slabsize = 0)
         : slabsize_(slabsize),
           parentslabheap_(parentslabheap),
-          extentheap_(extentheap)
+          extentheap_(extentheap),
+          cache_(NULL),
+          epoch_(0),
+          remote_frees_(NULL)
     {
-        int err = pthread_mutex_init(&mutex_, NULL);
-        ASSERT_ND(err == 0);
+        m_mcslock_init(&lock_);
+        init_slabsizes(std::max(slabsize, max_slabsize));
+        for (int c=0; c<kSizeClasses; c++) {
+            spare_slabs_[c].store(NULL, std::memory_order_relaxed);
+        }
+        if (thread_cache) {
+            cache_ = new BlockCache[kSizeClasses];
+            for (int c=0; c<kSizeClasses; c++) {
+                cache_[c].count = 0;
+            }
+        }
     }
 
-    ErrorCode init(Context& ctx)
+    ~SlabHeap()
     {
-        if (extentheap_) {
-            for (typename ExtentHeapT::Iterator it = extentheap_->begin(); 
-                 it != extentheap_->end(); ++it) 
-            {
-                if ((*it).nvheader()->is_free() && (*it).nvheader()->size() == slabsize_) 
-                {
-                    SlabT* slab = insert_slab(ctx, (*it).nvextent());
-                    if (!slab) {
-                        return kErrorCodeOutofmemory;    
-                    }
+        delete [] cache_;
+    }
+
+    //! Makes the calling thread the owner of the block cache
+    void bind_cache()
+    {
+        cache_owner_ = std::this_thread::get_id();
+    }
+
+    /**
+     * @brief Loads the slabs of the extent heap, splitting the scan of 
+     * each region's extent headers among nthreads threads
+     *
+     * @details
+     * The slabs are loaded deferred (see Slab::load_deferred): the threads 
+     * only attach a descriptor to the blocks of each slab extent.
+     */
+    ErrorCode init(Context& ctx, int nthreads = 1)
+    {
+        for (ExtentHeapT* r = extentheap_; r; r = r->next_region()) {
+            std::vector<std::vector<SlabT*>> found(nthreads);
+            auto scan = [r, nthreads, &found](int t) {
+                size_t first = r->nblocks() * t / nthreads;
+                size_t last = r->nblocks() * (t + 1) / nthreads;
+                r->for_each_slab(first, last, [r, t, &found](TPtr<void> region, size_t size) {
+                    SlabT* slab = SlabT::load_deferred(region, size);
+                    r->set_descriptor(region, size, slab);
+                    found[t].push_back(slab);
+                });
+            };
+            if (nthreads > 1) {
+                std::vector<std::thread> workers;
+                for (int t=0; t<nthreads; t++) {
+                    workers.push_back(std::thread(scan, t));
+                }
+                for (int t=0; t<nthreads; t++) {
+                    workers[t].join();
+                }
+            } else {
+                scan(0);
+            }
+            for (int t=0; t<nthreads; t++) {
+                for (size_t i=0; i<found[t].size(); i++) {
+                    found[t][i]->set_owner(this);
+                    found[t][i]->insert(&unmapped_slabs_);
                 }
             }
         }
@@ -79,33 +189,23 @@ public:
     {
         const int szclass = sizeclass(size_bytes);
 
-        lock(); 
-        SlabT* slab = find_slab(szclass);
-
-        // No slab of requested sizeclass, so try to reuse an empty one.
-        if (!slab) {
-            slab = reuse_empty_slab(ctx, szclass);
-        }
-
-        // No slab in this heap so try to get a slab from the parent slab 
-        // heap if we have one
-        if (!slab && parentslabheap_) {
-            slab = parentslabheap_->acquire_slab(ctx, szclass);
-            if (slab) {
-                insert_slab(slab, szclass);
-            }
-        }
- 
-        // No slab in parent heap so try to get a new chunk from the extent 
-        // heap and format it as a slab
-        if (!slab && extentheap_) {
-            TPtr<void> region;
-            if (extentheap_->malloc(ctx, slabsize_, &region) == kErrorCodeOk) {
-                slab = SlabT::make(ctx, region, slabsize_, szclass);
-                insert_slab(slab, szclass);
+        if (cache_) {
+            assert(cache_owner_ == std::this_thread::get_id());
+            BlockCache& bc = cache_[szclass];
+            if (bc.count == 0) {
+                refill_cache(ctx, szclass);
+                if (bc.count == 0) {
+                    return kErrorCodeOutofmemory;
+                }
             }
+            CachedBlock& cb = bc.blocks[--bc.count];
+            *ptr = cb.slab->alloc_reserved_block(ctx, cb.bid);
+            return kErrorCodeOk;
         }
-            
+
+        lock(); 
+        note_activity();
+        SlabT* slab = get_slab(ctx, szclass);
         if (slab) {
             *ptr = alloc_block(ctx, slab);
             assert(*ptr != null_ptr);
@@ -115,13 +215,58 @@ public:
         return kErrorCodeOk;
     }
 
+    /**
+     * @brief Tops the block cache of the given sizeclass up to 
+     * kBlockCacheBatch blocks, so that the next allocations of the 
+     * sizeclass do not take the lock. 
+     *
+     * @details
+     * Meant to be called where taking the lock is cheap, e.g. after a 
+     * transaction that allocated from the cache commits.
+     */
+    void fill_cache(Context& ctx, int szclass)
+    {
+        assert(!cache_ || cache_owner_ == std::this_thread::get_id());
+        if (cache_ && cache_[szclass].count < kBlockCacheBatch) {
+            refill_cache(ctx, szclass, kBlockCacheBatch);
+        }
+    }
+
     void free(Context& ctx, TPtr<void> ptr) 
     {
-        Extent<Context,TPtr,PPtr> ex;
-        ErrorCode rc = extentheap_->extent(ptr, &ex);
-        ASSERT_ND(rc == kErrorCodeOk);
+        SlabT* slab = reinterpret_cast<SlabT*>(extentheap_->descriptor(ptr));
+        ASSERT_ND(slab != NULL);
 
-        SlabT* slab = SlabT::slab(ex.nvextent());
+        // Only this heap's thread moves the slabs of a cached heap, so a 
+        // block of one of our own slabs goes back to the cache unlocked
+        if (cache_ && slab->owner() == this) {
+            assert(cache_owner_ == std::this_thread::get_id());
+            size_t bid = slab->block_id(ptr);
+            if (ctx.do_nv) {
+                slab->free_reserved_block(ctx, bid);
+            }
+            if (ctx.do_v) {
+                BlockCache& bc = cache_[slab->sizeclass()];
+                if (bc.count == kBlockCacheSize) {
+                    flush_cache(bc, kBlockCacheBatch);
+                }
+                bc.blocks[bc.count].slab = slab;
+                bc.blocks[bc.count].bid = bid;
+                bc.count++;
+            }
+            return;
+        }
+
+        // The non-volatile map is updated already (at commit for 
+        // transactional frees): another thread's cached heap takes the 
+        // block back on its own time
+        if (ctx.do_v && !ctx.do_nv) {
+            SlabHeap* owner = reinterpret_cast<SlabHeap*>(slab->owner());
+            if (owner && owner != this && owner->cache_) {
+                owner->push_remote_free(ptr);
+                return;
+            }
+        }
 
         // Expect this to finish after a few iterations as a slab that is 
         // moved between two slab heaps eventually ends up in a slabheap
@@ -139,23 +284,93 @@ public:
         }
     }
 
+    /**
+     * @brief Marks free in the non-volatile block maps a batch of blocks 
+     * sorted by address, starting with the block at first
+     *
+     * @details
+     * Consumes the leading blocks that share the slab and the 64-block 
+     * group of the first one, so that they cost a single store to the 
+     * block map, and returns the position past them. Only the 
+     * non-volatile state is updated: the caller frees each block with a 
+     * volatile-only context afterwards.
+     */
+    template<typename Iterator>
+    Iterator free_batch(Context& ctx, Iterator first, Iterator last)
+    {
+        assert(!ctx.do_v);
+        SlabT* slab = reinterpret_cast<SlabT*>(extentheap_->descriptor(*first));
+        ASSERT_ND(slab != NULL);
+        if (!slab->mapped()) {
+            map_owned_slab(ctx, slab);
+        }
+
+        size_t group = slab->block_id(*first) >> 6;
+        uint64_t mask = 0;
+        for (; first != last; ++first) {
+            if (extentheap_->descriptor(*first) != slab) {
+                break;
+            }
+            size_t bid = slab->block_id(*first);
+            if ((bid >> 6) != group) {
+                break;
+            }
+            mask |= 1ULL << (bid & 63);
+        }
+        slab->free_reserved_group(ctx, group, mask);
+        return first;
+    }
+
     size_t getsize(TPtr<void> ptr) 
     {
+        SlabT* slab = reinterpret_cast<SlabT*>(extentheap_->descriptor(ptr));
+        if (slab) {
+            return slab->block_size();
+        }
         Extent<Context, TPtr, PPtr> ex;
         ErrorCode rc = extentheap_->extent(ptr, &ex);
         if (rc != kErrorCodeOk) {
             return 0;
         }
-        size_t exsz = extentheap_->blocksize() * ex.len(); 
-        // if pointer does not point to the beginning of an extent 
-        // then it is a block within a slab
-        if (exsz == slabsize_ && 
-            (TPtr<char>(ptr) - TPtr<char>(ex.nvextent())) != 0)
-        {
-            SlabT* slab = SlabT::slab(ex.nvextent());
-            return slab->block_size();
+        return extentheap_->blocksize() * ex.len(); 
+    }
+
+    /**
+     * @brief Whether ptr is a block of a slab rather than an extent of its own
+     *
+     * @details
+     * Slabs attach their descriptor to the blocks of their extent, so 
+     * this and finding the slab of a block take a single lookup in a 
+     * volatile map of the extent heap.
+     */
+    bool is_block(TPtr<void> ptr)
+    {
+        return extentheap_->descriptor(ptr) != NULL;
+    }
+
+    //! Slab size of the given sizeclass
+    size_t slabsize(int szclass)
+    {
+        return slabsizes_[szclass];
+    }
+
+    /**
+     * @brief Returns the smallest power-of-two multiple of slabsize, up to 
+     * max_slabsize, that fits blocks of the given sizeclass well.
+     */
+    static size_t fit_slabsize(int szclass, size_t slabsize, size_t max_slabsize)
+    {
+        size_t block_size = size_from_class(szclass);
+        size_t size = slabsize;
+        for (; size < max_slabsize; size *= 2) {
+            size_t nblocks = nvSlabHeader<Context, TPtr>::usable_nblocks(size, block_size);
+            if (nblocks >= kSlabMinBlocks && 
+                (size - nblocks * block_size) * kSlabMaxWaste <= size) 
+            {
+                break;
+            }
         }
-        return exsz;
+        return size;
     }
 
     TPtr<void> alloc_block(Context& ctx, SlabT* slab)
@@ -178,6 +393,7 @@ public:
 
     void free_block(Context& ctx, SlabT* slab, TPtr<void> ptr)
     {
+        map_slab(ctx, slab);
         int old_fullness = slab->fullness();
         slab->free_block(ctx, ptr);
         if (slab->empty()) {
@@ -192,12 +408,130 @@ public:
         }
     }
 
+    /**
+     * @brief Returns the slabs of a heap whose thread exits.
+     *
+     * @details
+     * Cached blocks go back to their slabs, empty slabs go back to the 
+     * extent heap and the remaining ones to the parent slab heap, which 
+     * then serves frees of their blocks. Must be called by the thread that 
+     * allocates from the heap, or after it has exited.
+     */
+    void release(Context& ctx)
+    {
+        if (cache_) {
+            for (int c=0; c<kSizeClasses; c++) {
+                flush_cache(cache_[c], cache_[c].count);
+            }
+            cache_owner_ = std::thread::id();
+        }
+        // trim drains the remote frees too; ones that arrive later find 
+        // the slabs with the parent, or are drained by the next trim
+        trim(ctx);
+        if (!parentslabheap_) {
+            return;
+        }
+        lock();
+        parentslabheap_->lock();
+        for (int c=0; c<kSizeClasses; c++) {
+            for (int i=0; i<kSlabFullnessBins; i++) {
+                typename SlabT::SlabList& sl = full_slabs_[c][i];
+                while (sl.size()) {
+                    SlabT* slab = sl.front();
+                    slab->remove();
+                    parentslabheap_->insert_slab(slab, c);
+                }
+            }
+        }
+        parentslabheap_->unlock();
+        unlock();
+    }
+
+    /**
+     * @brief Returns the heap's empty slabs to the extent heap.
+     *
+     * @details
+     * Safe to call from any thread: empty slabs have no allocated or 
+     * cached blocks. Returns the number of slabs released.
+     */
+    size_t trim(Context& ctx)
+    {
+        size_t n = 0;
+        void*  strays;
+
+        lock();
+        strays = drain_remote_frees(ctx);
+        if (extentheap_) {
+            n = release_empty_slabs(ctx);
+        }
+        unlock();
+        free_strays(ctx, strays);
+        return n;
+    }
+
+    //! Occupancy of the slabs of one or more slab heaps
+    struct Stats {
+        size_t blocks_in_use[kSizeClasses]; // includes blocks in block caches
+        size_t slabs[kSizeClasses];
+        size_t fullness_bins[kSlabFullnessBins];
+        size_t empty_slabs;
+        size_t unmapped_slabs;
+        size_t slab_bytes;
+    };
+
+    //! Adds the heap's slabs to st
+    void add_stats(Stats* st)
+    {
+        lock();
+        for (int c=0; c<kSizeClasses; c++) {
+            for (int i=0; i<kSlabFullnessBins; i++) {
+                typename SlabT::SlabList& sl = full_slabs_[c][i];
+                for (typename SlabT::SlabList::iterator it = sl.begin(); it != sl.end(); it++) {
+                    st->blocks_in_use[c] += (*it)->nblocks() - (*it)->nblocks_free();
+                    st->slab_bytes += (*it)->size();
+                }
+                st->slabs[c] += sl.size();
+                st->fullness_bins[i] += sl.size();
+            }
+        }
+        for (typename SlabT::SlabList::iterator it = empty_slabs_.begin(); it != empty_slabs_.end(); it++) {
+            st->slab_bytes += (*it)->size();
+        }
+        for (typename SlabT::SlabList::iterator it = unmapped_slabs_.begin(); it != unmapped_slabs_.end(); it++) {
+            st->slab_bytes += (*it)->size();
+        }
+        st->empty_slabs += empty_slabs_.size();
+        st->unmapped_slabs += unmapped_slabs_.size();
+        for (int c=0; c<kSizeClasses; c++) {
+            SlabT* first = spare_slabs_[c].exchange(NULL, std::memory_order_acquire);
+            SlabT* last = NULL;
+            for (SlabT* slab = first; slab; slab = slab->spare_next_) {
+                st->empty_slabs++;
+                st->slab_bytes += slab->size();
+                last = slab;
+            }
+            if (first) {
+                push_spare_slabs(c, first, last);
+            }
+        }
+        unlock();
+    }
+
+    //! Number of operations that took the lock so far; unchanged means idle
+    uint64_t epoch()
+    {
+        return epoch_.load(std::memory_order_relaxed);
+    }
+
     SlabT* acquire_slab(Context& ctx, int szclass)
     {
         SlabT* slab;
 
         lock();
         slab = find_slab(szclass);
+        if (!slab) {
+            slab = map_slabs(ctx, szclass);
+        }
         if (!slab) {
             slab = reuse_empty_slab(ctx, szclass);
         }
@@ -208,15 +542,88 @@ public:
         }
 
         if (extentheap_) {
-            TPtr<void> region;
-            if (extentheap_->malloc(ctx, slabsize_, &region) == kErrorCodeOk) {
-                SlabT* slab = SlabT::make(ctx, region, slabsize_, szclass);
-                unlock();
-                return slab;
+            slab = new_slab(ctx, szclass);
+            if (slab) {
+                new_spare_slabs(ctx, szclass);
             }
         }
         unlock();
-        return NULL;
+        return slab;
+    }
+
+    /**
+     * @brief Takes an empty slab of the given sizeclass off the spare slab 
+     * stack without locking, or returns NULL if there is none.
+     *
+     * @details
+     * The whole stack is detached with an exchange and the rest pushed 
+     * back, so a pop never reads the link of a slab another thread may 
+     * have taken in the meantime and is immune to ABA. A pop racing with 
+     * another one may find the stack empty and fall back to acquire_slab.
+     */
+    SlabT* pop_spare_slab(int szclass)
+    {
+        std::atomic<SlabT*>& top = spare_slabs_[szclass];
+        if (!top.load(std::memory_order_relaxed)) {
+            return NULL;
+        }
+        SlabT* slab = top.exchange(NULL, std::memory_order_acquire);
+        if (!slab) {
+            return NULL;
+        }
+        SlabT* rest = slab->spare_next_;
+        slab->spare_next_ = NULL;
+        if (rest) {
+            SlabT* last = rest;
+            while (last->spare_next_) {
+                last = last->spare_next_;
+            }
+            push_spare_slabs(szclass, rest, last);
+        }
+        return slab;
+    }
+
+    /**
+     * @brief Returns a slab of the given sizeclass with at least a free 
+     * block, taking one from the parent slab heap or the extent heap if 
+     * this heap has none. Caller must hold the lock.
+     */
+    SlabT* get_slab(Context& ctx, const int szclass)
+    {
+        SlabT* slab = find_slab(szclass);
+
+        // Then one of the slabs loaded at restart
+        if (!slab) {
+            slab = map_slabs(ctx, szclass);
+        }
+
+        // No slab of requested sizeclass, so try to reuse an empty one.
+        if (!slab) {
+            slab = reuse_empty_slab(ctx, szclass);
+        }
+
+        // No slab in this heap so try to get a slab from the parent slab 
+        // heap if we have one: one of its spare slabs without taking its 
+        // lock, else one of its slabs or a new one
+        if (!slab && parentslabheap_) {
+            slab = parentslabheap_->pop_spare_slab(szclass);
+            if (!slab) {
+                slab = parentslabheap_->acquire_slab(ctx, szclass);
+            }
+            if (slab) {
+                insert_slab(slab, szclass);
+            }
+        }
+ 
+        // No slab in parent heap so try to get a new chunk from the extent 
+        // heap and format it as a slab
+        if (!slab && extentheap_) {
+            slab = new_slab(ctx, szclass);
+            if (slab) {
+                insert_slab(slab, szclass);
+            }
+        }
+        return slab;
     }
 
     SlabT* find_slab(const int szclass)
@@ -238,15 +645,51 @@ public:
         return slab;
     }
 
-    SlabT* insert_slab(Context& ctx, TPtr<nvSlab<Context,TPtr>> nvslab)
+    SlabT* insert_slab(Context& ctx, TPtr<nvSlab<Context,TPtr>> nvslab, size_t slab_size = 0)
     {
         LOG(info) << "Insert slab: " << nvslab;
 
-        SlabT* slab = SlabT::load(ctx, nvslab);
+        SlabT* slab = SlabT::load(ctx, nvslab, slab_size ? slab_size : slabsize_);
+        if (extentheap_) {
+            extentheap_->set_descriptor(nvslab, slab->size(), slab);
+        }
         insert_slab(slab, nvslab->sizeclass());
         return slab;
     }
 
+    /**
+     * @brief Builds the free map of a slab loaded at restart and files it 
+     * under its sizeclass. Caller must hold the lock.
+     *
+     * @details
+     * Must happen before the slab's block map is first updated, as the 
+     * free map is read off the block map.
+     */
+    void map_slab(Context& ctx, SlabT* slab)
+    {
+        if (slab->mapped()) {
+            return;
+        }
+        LOG(info) << "Map slab: " << slab->region();
+        slab->remove();
+        slab->init(ctx);
+        insert_slab(slab, slab->sizeclass());
+    }
+
+    /**
+     * @brief Maps slabs loaded at restart until one of the given sizeclass 
+     * has a free block, and returns it. Caller must hold the lock.
+     */
+    SlabT* map_slabs(Context& ctx, int szclass)
+    {
+        SlabT* slab = NULL;
+        while (!slab && unmapped_slabs_.size()) {
+            map_slab(ctx, unmapped_slabs_.front());
+            slab = find_slab(szclass);
+        }
+        return slab;
+    }
+
 
     void insert_slab(SlabT* slab, int szclass)
     {
@@ -313,29 +756,273 @@ public:
 
     void lock()
     {
-        pthread_mutex_lock(&mutex_);
+        m_mcslock_lock(&lock_);
     }
 
     void unlock()
     {
-        pthread_mutex_unlock(&mutex_);
+        m_mcslock_unlock(&lock_);
     }
 
 private:
+    // Only called with the lock held, so a relaxed increment is enough
+    void note_activity()
+    {
+        epoch_.store(epoch_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
     void insert_slab_to_empty(SlabT* slab)
     {
         slab->insert(&empty_slabs_);
     }
 
+    void init_slabsizes(size_t max_slabsize)
+    {
+        for (int c=0; c<kSizeClasses; c++) {
+            slabsizes_[c] = fit_slabsize(c, slabsize_, max_slabsize);
+        }
+    }
+
+    /**
+     * @brief Formats a new slab of the given sizeclass out of an extent. 
+     * Caller must hold the lock.
+     *
+     * @details
+     * Empty slabs of other slab sizes go back to the extent heap when it 
+     * has no room left for the new slab.
+     */
+    SlabT* new_slab(Context& ctx, int szclass)
+    {
+        TPtr<void> region;
+        size_t size = slabsize(szclass);
+
+        if (extentheap_->malloc(ctx, size, &region) != kErrorCodeOk) {
+            if (!release_empty_slabs(ctx) || 
+                extentheap_->malloc(ctx, size, &region) != kErrorCodeOk) 
+            {
+                return NULL;
+            }
+        }
+        SlabT* slab = SlabT::make(ctx, region, size, szclass);
+        extentheap_->mark_slab(ctx, region);
+        extentheap_->set_descriptor(region, size, slab);
+        return slab;
+    }
+
+    /**
+     * @brief Formats kSlabBatch-1 more slabs of the given sizeclass and 
+     * pushes them onto the spare slab stack. Caller must hold the lock.
+     *
+     * @details
+     * Child heaps that run out of slabs of the sizeclass at about the same 
+     * time then pop them without taking the lock.
+     */
+    void new_spare_slabs(Context& ctx, int szclass)
+    {
+        SlabT* first = NULL;
+        SlabT* last = NULL;
+        for (int i=1; i<kSlabBatch; i++) {
+            SlabT* slab = new_slab(ctx, szclass);
+            if (!slab) {
+                break;
+            }
+            slab->spare_next_ = first;
+            first = slab;
+            if (!last) {
+                last = slab;
+            }
+        }
+        if (first) {
+            push_spare_slabs(szclass, first, last);
+        }
+    }
+
+    //! Pushes the chain of slabs from first to last onto the spare slab stack
+    void push_spare_slabs(int szclass, SlabT* first, SlabT* last)
+    {
+        std::atomic<SlabT*>& top = spare_slabs_[szclass];
+        SlabT* head = top.load(std::memory_order_relaxed);
+        do {
+            last->spare_next_ = head;
+        } while (!top.compare_exchange_weak(head, first, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    //! Frees the empty slabs to the extent heap. Caller must hold the lock.
+    size_t release_empty_slabs(Context& ctx)
+    {
+        size_t n = 0;
+
+        // Spare slabs are empty slabs too
+        for (int c=0; c<kSizeClasses; c++) {
+            SlabT* slab = spare_slabs_[c].exchange(NULL, std::memory_order_acquire);
+            while (slab) {
+                SlabT* next = slab->spare_next_;
+                slab->spare_next_ = NULL;
+                insert_slab(slab, c);
+                slab = next;
+            }
+        }
+
+        while (empty_slabs_.size()) {
+            SlabT* slab = empty_slabs_.front();
+            remove_slab(slab);
+            extentheap_->set_descriptor(slab->region(), slab->size(), NULL);
+            extentheap_->free(ctx, slab->region());
+            delete slab;
+            n++;
+        }
+        return n;
+    }
+
+    /**
+     * @brief Reserves up to kBlockCacheBatch blocks of the given sizeclass 
+     * into the block cache. 
+     *
+     * @details
+     * Drains partially full slabs first and only brings in an empty or new 
+     * slab while the cache holds fewer than want blocks.
+     */
+    void refill_cache(Context& ctx, int szclass, int want = 1)
+    {
+        BlockCache& bc = cache_[szclass];
+        void*       strays;
+
+        lock();
+        note_activity();
+        strays = drain_remote_frees(ctx);
+        while (bc.count < kBlockCacheBatch) {
+            SlabT* slab = bc.count >= want ? find_slab(szclass) : get_slab(ctx, szclass);
+            if (!slab) {
+                break;
+            }
+            bool empty = slab->empty();
+            int old_fullness = slab->fullness();
+            size_t bid;
+            while (bc.count < kBlockCacheBatch && slab->reserve_block(&bid)) {
+                bc.blocks[bc.count].slab = slab;
+                bc.blocks[bc.count].bid = bid;
+                bc.count++;
+            }
+            int new_fullness = slab->fullness();
+            if (empty || (new_fullness != old_fullness)) {
+                move_slab(slab, szclass, new_fullness);
+            }
+        }
+        unlock();
+        free_strays(ctx, strays);
+    }
+
+    //! Pushes a block onto the remote free list, linked through its first word
+    void push_remote_free(TPtr<void> ptr)
+    {
+        void** block = reinterpret_cast<void**>(ptr.get());
+        void*  head = remote_frees_.load(std::memory_order_relaxed);
+        do {
+            *block = head;
+        } while (!remote_frees_.compare_exchange_weak(head, block, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    /**
+     * @brief Returns the blocks on the remote free list to the volatile 
+     * free lists of their slabs. Caller must hold the lock.
+     *
+     * @details
+     * Blocks of slabs the heap no longer owns are returned linked the same
+     * way, for free_strays once the lock is dropped.
+     */
+    void* drain_remote_frees(Context& ctx)
+    {
+        if (!remote_frees_.load(std::memory_order_relaxed)) {
+            return NULL;
+        }
+        Context vctx = ctx;
+        vctx.do_v = true;
+        vctx.do_nv = false;
+        void* block = remote_frees_.exchange(NULL, std::memory_order_acquire);
+        void* strays = NULL;
+        while (block) {
+            void* next = *reinterpret_cast<void**>(block);
+            SlabT* slab = reinterpret_cast<SlabT*>(extentheap_->descriptor(block));
+            if (slab->owner() == this) {
+                free_block(vctx, slab, block);
+            } else {
+                *reinterpret_cast<void**>(block) = strays;
+                strays = block;
+            }
+            block = next;
+        }
+        return strays;
+    }
+
+    //! Frees the blocks drain_remote_frees left through their slabs' new owners
+    void free_strays(Context& ctx, void* strays)
+    {
+        if (!strays) {
+            return;
+        }
+        Context vctx = ctx;
+        vctx.do_v = true;
+        vctx.do_nv = false;
+        while (strays) {
+            void* next = *reinterpret_cast<void**>(strays);
+            free(vctx, strays);
+            strays = next;
+        }
+    }
+
+    //! Returns the nblocks oldest blocks of a cache to their slabs
+    void flush_cache(BlockCache& bc, int nblocks)
+    {
+        lock();
+        note_activity();
+        for (int i=0; i<nblocks; i++) {
+            SlabT* slab = bc.blocks[i].slab;
+            slab->unreserve_block(bc.blocks[i].bid);
+            if (slab->empty()) {
+                slab->remove();
+                insert_slab_to_empty(slab);
+            } else {
+                move_slab(slab, slab->sizeclass(), slab->fullness());
+            }
+        }
+        unlock();
+        bc.count -= nblocks;
+        std::copy(&bc.blocks[nblocks], &bc.blocks[nblocks + bc.count], &bc.blocks[0]);
+    }
+
+    //! Maps a slab of whichever heap owns it, under that heap's lock
+    void map_owned_slab(Context& ctx, SlabT* slab)
+    {
+        for (;;) {
+            SlabHeap* owner = reinterpret_cast<SlabHeap*>(slab->owner());
+            if (owner) {
+                owner->lock();
+                if (owner == slab->owner()) {
+                    owner->map_slab(ctx, slab);
+                    owner->unlock();
+                    break;
+                }
+                owner->unlock();
+            }
+        }
+    }
+
     SlabT* reuse_empty_slab(Context& ctx, int szclass)
     {
         SlabT* slab = NULL;
-        if (empty_slabs_.size()) {
-            slab = empty_slabs_.front();
+        for (typename SlabT::SlabList::iterator it = empty_slabs_.begin(); 
+             it != empty_slabs_.end(); it++) 
+        {
+            if ((*it)->size() == slabsize(szclass)) {
+                slab = *it;
+                break;
+            }
+        }
+        if (slab) {
             int fullness = slab->fullness();
             move_slab(slab, szclass, fullness);
             if (slab->sizeclass() != szclass) {
-                slab->reset(ctx, slabsize_, szclass);
+                slab->reset(ctx, szclass);
             }
         }
         return slab;
@@ -343,15 +1030,33 @@ private:
 
 protected:
     size_t            slabsize_;
+    size_t            slabsizes_[kSizeClasses];
     SlabHeap*         parentslabheap_;
     ExtentHeapT*      extentheap_;
-    pthread_mutex_t   mutex_;
+    m_mcslock_t       lock_;
+
+    //! per-sizeclass reserved blocks; NULL unless the heap is thread private
+    BlockCache*       cache_;
+
+    //! the only thread that may use cache_ (see bind_cache)
+    std::thread::id   cache_owner_;
+
+    std::atomic<uint64_t> epoch_;
     
     //! completely or partially full slabs
     typename SlabT::SlabList full_slabs_[kSizeClasses][kSlabFullnessBins]; 
 
     //! completely empty slabs (that can be reused as a different size class)
     typename SlabT::SlabList empty_slabs_; 
+
+    //! slabs loaded at restart whose free map is not built yet
+    typename SlabT::SlabList unmapped_slabs_; 
+
+    //! per-sizeclass stacks of new empty slabs, owned by no heap, for child heaps to pop
+    std::atomic<SlabT*> spare_slabs_[kSizeClasses];
+
+    //! blocks other threads freed into the slabs of a cached heap, linked through their first word
+    std::atomic<void*> remote_frees_;
 };
 
 } // namespace alps
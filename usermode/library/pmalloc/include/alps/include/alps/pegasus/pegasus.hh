@@ -79,6 +79,12 @@ public:
     static ErrorCode open_region_file(const char* pathname, int flags, RegionFile** region_file);
     static ErrorCode open_region_file(const char** pathnames, int npathnames, int flags, RegionFile** region_file);
 
+    /**
+     * \brief Opens region files as a single pseudo file that interleaves 
+     * stripes of \a stripe_size bytes across them in round-robin.
+     */
+    static ErrorCode open_striped_region_file(const char** pathnames, int npathnames, int flags, size_t stripe_size, RegionFile** region_file);
+
 #ifdef HAVE_BOOST_FILESYSTEM
     static ErrorCode create_region_file(const boost::filesystem::path& pathname, mode_t mode, RegionFile** region_file);
     static ErrorCode open_region_file(const boost::filesystem::path& pathname, int flags, mode_t mode, RegionFile** region_file);
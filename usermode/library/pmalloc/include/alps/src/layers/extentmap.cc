@@ -207,6 +207,24 @@ int ExtentMap::remove_ge(size_t len, ExtentInterval* nex)
     return 0;
 }
 
+int ExtentMap::remove_at(size_t start, size_t len)
+{
+    MapAddr::iterator ita = map_addr_.find(start);
+    if (ita == map_addr_.end() || ita->second->len() < len) {
+        return -1;
+    }
+    ExtentInterval* ex = ita->second;
+    map_len_.erase(MapLenKey(ex->len(), ex->start()));
+    map_addr_.erase(ita);
+    if (ex->len() > len) {
+        insert(ExtentInterval(start + len, ex->len() - len));
+    }
+    delete ex;
+
+    assert(verify_maplen_equivalent_to_mapaddr() == true);
+    return 0;
+}
+
 void ExtentMap::stream_to(std::ostream& os) const
 {
     for (MapAddr::const_iterator it = map_addr_.begin(); 
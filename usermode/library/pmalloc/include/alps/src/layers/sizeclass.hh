@@ -21,17 +21,27 @@
 
 namespace alps {
 
-const int kSizeClasses = 116;
+/*
+ * Size classes are spaced by 8 bytes up to 512 bytes and then by a quarter 
+ * of the power of two below them (640, 768, 896, 1024, 1280, ...) up to 
+ * 256 KB, similar to jemalloc, which bounds internal fragmentation to 
+ * 25% past 512 bytes. The table index of a size is computed rather 
+ * than searched for.
+ */
+const int kSizeClasses = 100;
+
+const size_t kSizeClassMaxSize = 256*1024;
 
 extern size_t size_table[kSizeClasses];
 
 inline int sizeclass(size_t sz)
 {
-    int sizeclass = 0;
-    while (size_table[sizeclass] < sz) {
-        sizeclass++;
+    if (sz <= 512) {
+        return sz ? (sz + 7) / 8 - 1 : 0;
     }
-    return sizeclass;
+    size_t s = sz - 1;
+    int lg = 63 - __builtin_clzl(s);
+    return 64 + (lg - 9) * 4 + ((s - (1LLU << lg)) >> (lg - 2));
 }
 
 inline size_t size_from_class(const int sizeclass)
@@ -17,7 +17,9 @@
 #ifndef _ALPS_PEGASUS_INVTBL_HH_
 #define _ALPS_PEGASUS_INVTBL_HH_
 
+#include <stdint.h>
 #include <atomic>
+#include <mutex>
 #include <utility>
 
 #include <boost/icl/discrete_interval.hpp>
@@ -37,27 +39,57 @@
 
 namespace alps {
 
+/**
+ * \brief Maps virtual addresses to the virtual memory areas that map 
+ * persistent regions.
+ *
+ * Lookups go through a two-level radix table indexed by the address bits 
+ * above kChunkShift. The entry of a chunk covered by a single area points 
+ * straight to it, so translating an address into the middle of a region 
+ * costs two loads and no locking. Chunks at the edges of areas that do not 
+ * fill them are marked mixed and resolved with the interval map, under the
+ * lock that also serializes updates. Leaves are allocated on demand and 
+ * published with a compare-and-swap; entries are updated with release 
+ * stores, so readers never wait on map or unmap.
+ */
 class InvertedTable
 {
 public:
     typedef boost::icl::interval_map<uintptr_t, VmArea*>::iterator       iterator;
     typedef boost::icl::interval_map<uintptr_t, VmArea*>::const_iterator const_iterator;
 
+    static const int       kChunkShift = 21; // 2MB
+    static const int       kLeafBits = 13;
+    static const int       kDirBits = 48 - kChunkShift - kLeafBits;
+    static const uintptr_t kMixed = 1;
+
 public:
     InvertedTable()
         : version_(0)
     {
+        for (size_t i = 0; i < (1UL << kDirBits); i++) {
+            dir_[i].store(NULL, std::memory_order_relaxed);
+        }
+    }
 
+    ~InvertedTable()
+    {
+        for (size_t i = 0; i < (1UL << kDirBits); i++) {
+            delete [] dir_[i].load(std::memory_order_relaxed);
+        }
     }
 
     void insert_vmarea(VmArea* vma)
     {
+        std::lock_guard<std::mutex> guard(mutex_);
         version_++;
         map_.insert(std::make_pair(boost::icl::discrete_interval<uintptr_t>(vma->vm_start(), vma->vm_end()-1, boost::icl::interval_bounds::closed()), vma));
+        update_chunks(vma->vm_start(), vma->vm_end());
     }
 
     void remove_vmarea(VmArea* vma)
     {
+        std::lock_guard<std::mutex> guard(mutex_);
         version_++;
         const_iterator it = map_.find(vma->vm_start());
         if (it == map_.end()) {
@@ -65,6 +97,7 @@ public:
         }
         map_.erase(boost::icl::discrete_interval<uint64_t>(vma->vm_start(), vma->vm_end() - 1, boost::icl::interval_bounds::closed()));
         assert(map_.find(vma->vm_start()) == map_.end());
+        update_chunks(vma->vm_start(), vma->vm_end());
     }
 
     VmArea* find_vmarea(uintptr_t addr)
@@ -76,16 +109,98 @@ public:
             return pegas_thread.vmarea_;
         }
 
-        const_iterator it = map_.find(addr);
-        if (it == map_.end()) {
+        // Read the version first: an area found with it is dropped from the
+        // thread cache by any later update
+        uint64_t version = version_;
+        VmArea* vma;
+        uintptr_t e = entry(addr);
+        if (e == kMixed) {
+            std::lock_guard<std::mutex> guard(mutex_);
+            const_iterator it = map_.find(addr);
+            if (it == map_.end()) {
+                return NULL;
+            }
+            vma = it->second;
+        } else if (e) {
+            vma = reinterpret_cast<VmArea*>(e);
+        } else {
             return NULL;
         }
-        pegas_thread.vmarea_ = it->second;
-        pegas_thread.vmarea_version_ = version_;
-        return it->second;
+        pegas_thread.vmarea_ = vma;
+        pegas_thread.vmarea_version_ = version;
+        return vma;
     }
 
 private:
+    typedef std::atomic<uintptr_t> Entry;
+
+    static size_t dir_index(uintptr_t addr)
+    {
+        return (addr >> (kChunkShift + kLeafBits)) & ((1UL << kDirBits) - 1);
+    }
+
+    static size_t leaf_index(uintptr_t addr)
+    {
+        return (addr >> kChunkShift) & ((1UL << kLeafBits) - 1);
+    }
+
+    // Addresses the table does not cover are resolved by the interval map
+    uintptr_t entry(uintptr_t addr)
+    {
+        if (addr >> 48) {
+            return kMixed;
+        }
+        Entry* leaf = dir_[dir_index(addr)].load(std::memory_order_acquire);
+        if (!leaf) {
+            return 0;
+        }
+        return leaf[leaf_index(addr)].load(std::memory_order_acquire);
+    }
+
+    Entry* leaf(uintptr_t addr)
+    {
+        std::atomic<Entry*>& slot = dir_[dir_index(addr)];
+        Entry* leaf = slot.load(std::memory_order_acquire);
+        if (leaf) {
+            return leaf;
+        }
+        leaf = new Entry[1UL << kLeafBits];
+        for (size_t i = 0; i < (1UL << kLeafBits); i++) {
+            leaf[i].store(0, std::memory_order_relaxed);
+        }
+        Entry* expected = NULL;
+        if (!slot.compare_exchange_strong(expected, leaf, std::memory_order_acq_rel)) {
+            delete [] leaf;
+            return expected;
+        }
+        return leaf;
+    }
+
+    // Recomputes from the interval map the entries of the chunks that 
+    // [start, end) overlaps; called with mutex_ held
+    void update_chunks(uintptr_t start, uintptr_t end)
+    {
+        if (start >= end || (end - 1) >> 48) {
+            return;
+        }
+        uintptr_t chunk_size = 1UL << kChunkShift;
+        for (uintptr_t chunk = start & ~(chunk_size - 1); chunk < end; chunk += chunk_size) {
+            std::pair<const_iterator, const_iterator> range = 
+                map_.equal_range(boost::icl::discrete_interval<uintptr_t>(chunk, chunk + chunk_size - 1, boost::icl::interval_bounds::closed()));
+            uintptr_t e = 0;
+            if (range.first != range.second) {
+                const_iterator next = range.first;
+                next++;
+                bool covers = boost::icl::first(range.first->first) <= chunk && 
+                              boost::icl::last(range.first->first) >= chunk + chunk_size - 1;
+                e = (next == range.second && covers) ? reinterpret_cast<uintptr_t>(range.first->second) : kMixed;
+            }
+            leaf(chunk)[leaf_index(chunk)].store(e, std::memory_order_release);
+        }
+    }
+
+    std::atomic<Entry*>                          dir_[1UL << kDirBits];
+    std::mutex                                   mutex_; // serializes updates and lookups of mixed chunks
     boost::icl::interval_map<uintptr_t, VmArea*> map_; 
     std::atomic<uint64_t>                        version_; // versioning to detect when vmarea objects become stale
 };
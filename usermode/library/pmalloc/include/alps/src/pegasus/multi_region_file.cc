@@ -86,12 +86,68 @@ ErrorCode MultiRegionFile::size(loff_t* length)
     std::vector<RegionFile*>::iterator it;
 
     *length = 0;
+    loff_t min_len = -1;
     for (it = region_files_.begin(); it != region_files_.end(); it++) {
         RegionFile* rfile = *it;
         loff_t      rfile_len;
         CHECK_ERROR_CODE(rfile->size(&rfile_len));
         *length += rfile_len;
+        if (min_len < 0 || rfile_len < min_len) {
+            min_len = rfile_len;
+        }
+    }
+    if (stripe_size_ && min_len >= 0) {
+        *length = (min_len / stripe_size_) * stripe_size_ * region_files_.size();
+    }
+    return kErrorCodeOk;
+}
+
+/**
+ * @brief Finds the file and the offset in it of byte offset of a striped 
+ * pseudo file, and how many bytes follow it in the same stripe.
+ */
+void MultiRegionFile::locate(loff_t offset, RegionFile** rfile, loff_t* file_offset, loff_t* length)
+{
+    loff_t stripe = offset / stripe_size_;
+    loff_t nfiles = region_files_.size();
+    *rfile = region_files_[stripe % nfiles];
+    *file_offset = (stripe / nfiles) * stripe_size_ + offset % stripe_size_;
+    *length = stripe_size_ - offset % stripe_size_;
+}
+
+ErrorCode MultiRegionFile::map_striped(void* addr_hint, size_t length, int prot, int flags, loff_t offset, void** mapped_addr)
+{
+    ErrorCode rc;
+    void*     hole_base;
+
+    // Reserve a hole for the whole range and map each stripe into its place
+    hole_base = ::mmap(addr_hint, length, prot, flags|MAP_ANONYMOUS, 0, 0);
+    if (hole_base == MAP_FAILED) {
+        return kErrorCodeMemoryMapFailed;
+    }
+
+    uintptr_t base = reinterpret_cast<uintptr_t>(hole_base);
+    for (loff_t pos = offset; pos < offset + (loff_t) length; ) {
+        RegionFile* rfile;
+        loff_t      file_offset;
+        loff_t      map_length;
+        void*       mpaddr;
+        locate(pos, &rfile, &file_offset, &map_length);
+        map_length = std::min(map_length, offset + (loff_t) length - pos);
+        void* addr = reinterpret_cast<void*>(base + (pos - offset));
+        if (kErrorCodeOk != (rc = rfile->map(addr, map_length, prot, flags|MAP_FIXED, file_offset, &mpaddr))) {
+            ::munmap(hole_base, length);
+            return rc;
+        }
+        if (mpaddr != addr) {
+            LOG(warning) << "Cannot map region file stripes contiguously";
+            ::munmap(hole_base, length);
+            return kErrorCodeMemoryMapFailed;
+        }
+        pos += map_length;
     }
+
+    *mapped_addr = hole_base;
     return kErrorCodeOk;
 }
 
@@ -104,6 +160,10 @@ ErrorCode MultiRegionFile::map(void* addr_hint, size_t length, int prot, int fla
     void*     hole_base;
     std::vector<std::tuple<void*, loff_t> > mapped_addr_vec;
 
+    if (stripe_size_) {
+        return map_striped(addr_hint, length, prot, flags, offset, mapped_addr);
+    }
+
     hole_base = ::mmap(addr_hint, length, prot, flags|MAP_ANONYMOUS, 0, 0);
 
     uaddr_hint = reinterpret_cast<uintptr_t>(hole_base);
@@ -193,6 +253,21 @@ ErrorCode MultiRegionFile::interleave_group(loff_t offset, loff_t length, std::v
     std::vector<RegionFile*>::iterator it;
     loff_t cur_pos; // current position in the logical range comprised of multi region files
 
+    if (stripe_size_) {
+        for (loff_t pos = offset; pos < offset + length; ) {
+            RegionFile* file;
+            loff_t      local_offset;
+            loff_t      local_length;
+            locate(pos, &file, &local_offset, &local_length);
+            local_length = std::min(local_length, offset + length - pos);
+            std::vector<InterleaveGroup> local_vig;
+            CHECK_ERROR_CODE(file->interleave_group(local_offset, local_length, &local_vig));
+            vig->insert(vig->end(), local_vig.begin(), local_vig.end());
+            pos += local_length;
+        }
+        return kErrorCodeOk;
+    }
+
     for (it = region_files_.begin(), cur_pos = 0;
          it != region_files_.end();
          it++)
@@ -33,11 +33,19 @@ namespace alps {
  * metadata of underlying region files, including create, truncate, unlink, 
  * set/get attributes.
  * 
+ * By default the files are concatenated. With a non-zero stripe size the
+ * pseudo file instead interleaves stripes of that size across the files in
+ * round-robin, so that sequential accesses spread over all the devices 
+ * backing them rather than filling one device at a time. Each file then 
+ * contributes as many whole stripes as the smallest one holds. The stripe 
+ * size must be a multiple of the page size, and each stripe in a mapping 
+ * is a separate memory mapping, so stripes should be large (e.g. a book).
  */
 class MultiRegionFile: public RegionFile {
 public:
-    MultiRegionFile(const std::vector<RegionFile*> region_files)
-        : region_files_(region_files)
+    MultiRegionFile(const std::vector<RegionFile*> region_files, size_t stripe_size = 0)
+        : region_files_(region_files),
+          stripe_size_(stripe_size)
     { }
 
     ~MultiRegionFile() {};  
@@ -83,7 +91,11 @@ public:
     ErrorCode interleave_group(loff_t offset, loff_t length, std::vector<InterleaveGroup>* vig);
 
 private:
+    void locate(loff_t offset, RegionFile** rfile, loff_t* file_offset, loff_t* length);
+    ErrorCode map_striped(void* addr_hint, size_t length, int prot, int flags, loff_t offset, void** mapped_addr);
+
     std::vector<RegionFile*> region_files_;
+    size_t                   stripe_size_; // 0 when the files are concatenated
 };
 
 } // namespace alps
@@ -153,6 +153,11 @@ ErrorCode Pegasus::open_region_file(const char** pathnames, int npathnames, int
     return region_file_factory_->open(path_vector(pathnames, npathnames), flags, region_file);
 }
 
+ErrorCode Pegasus::open_striped_region_file(const char** pathnames, int npathnames, int flags, size_t stripe_size, RegionFile** region_file)
+{
+    return region_file_factory_->open(path_vector(pathnames, npathnames), flags, region_file, stripe_size);
+}
+
 
 #ifdef HAVE_BOOST_FILESYSTEM
 
@@ -85,28 +85,28 @@ ErrorCode RegionFileFactory::region_files(const std::vector<boost::filesystem::p
     return kErrorCodeOk;
 }
 
-ErrorCode RegionFileFactory::multi_region_file(const std::vector<boost::filesystem::path>& pathnames, MultiRegionFile** mrfile)
+ErrorCode RegionFileFactory::multi_region_file(const std::vector<boost::filesystem::path>& pathnames, size_t stripe_size, MultiRegionFile** mrfile)
 {
     std::vector<RegionFile*> rfiles;
     CHECK_ERROR_CODE(region_files(pathnames, &rfiles));
-    *mrfile = new MultiRegionFile(rfiles);
+    *mrfile = new MultiRegionFile(rfiles, stripe_size);
     return kErrorCodeOk;
 }
 
-ErrorCode RegionFileFactory::open(const std::vector<boost::filesystem::path>& pathnames, int flags, mode_t mode, RegionFile** region_file)
+ErrorCode RegionFileFactory::open(const std::vector<boost::filesystem::path>& pathnames, int flags, mode_t mode, RegionFile** region_file, size_t stripe_size)
 {
     MultiRegionFile* mrfile;
-    CHECK_ERROR_CODE(multi_region_file(pathnames, &mrfile));
+    CHECK_ERROR_CODE(multi_region_file(pathnames, stripe_size, &mrfile));
     CHECK_ERROR_CODE(mrfile->open(flags, mode));
     *region_file = mrfile;
 
     return kErrorCodeOk;
 }
 
-ErrorCode RegionFileFactory::open(const std::vector<boost::filesystem::path>& pathnames, int flags, RegionFile** region_file)
+ErrorCode RegionFileFactory::open(const std::vector<boost::filesystem::path>& pathnames, int flags, RegionFile** region_file, size_t stripe_size)
 {
     MultiRegionFile* mrfile;
-    CHECK_ERROR_CODE(multi_region_file(pathnames, &mrfile));
+    CHECK_ERROR_CODE(multi_region_file(pathnames, stripe_size, &mrfile));
     CHECK_ERROR_CODE(mrfile->open(flags));
     *region_file = mrfile;
 
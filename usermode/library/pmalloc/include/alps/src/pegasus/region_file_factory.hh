@@ -43,13 +43,13 @@ public:
 
     ErrorCode create(const boost::filesystem::path& pathname, mode_t mode, RegionFile** region_file);
     ErrorCode open(const boost::filesystem::path& pathname, int flags, mode_t mode, RegionFile** region_file);
-    ErrorCode open(const std::vector<boost::filesystem::path>& pathnames, int flags, mode_t mode, RegionFile** region_file);
+    ErrorCode open(const std::vector<boost::filesystem::path>& pathnames, int flags, mode_t mode, RegionFile** region_file, size_t stripe_size = 0);
     ErrorCode open(const boost::filesystem::path& pathname, int flags, RegionFile** region_file);
-    ErrorCode open(const std::vector<boost::filesystem::path>& pathnames, int flags, RegionFile** region_file);
+    ErrorCode open(const std::vector<boost::filesystem::path>& pathnames, int flags, RegionFile** region_file, size_t stripe_size = 0);
 
 private:
     ErrorCode region_files(const std::vector<boost::filesystem::path>& pathnames, std::vector<RegionFile*>* rfiles);
-    ErrorCode multi_region_file(const std::vector<boost::filesystem::path>& pathnames, MultiRegionFile** mrfile);
+    ErrorCode multi_region_file(const std::vector<boost::filesystem::path>& pathnames, size_t stripe_size, MultiRegionFile** mrfile);
 };
 
 } // namespace alps
@@ -251,25 +251,29 @@ ErrorCode TmpfsRegionFile::__alloc_physical_frames(int fd, loff_t offset, loff_t
         interleave_request.push_back(0x0);
     }
 
-    int i;
+    // Runs of books bound to the same node are allocated with a single call
     loff_t off;
-    for (off = begin, i = begin/booksize_; 
-         off < end; 
-         off += booksize_, i++) 
+    loff_t run_length;
+    int i;
+    for (off = begin, i = begin/booksize_; off < end; off += run_length, i += run_length/booksize_) 
     {
         int interleave_group = static_cast<int>(interleave_request[i]);
+        for (run_length = booksize_; 
+             off + run_length < end && static_cast<int>(interleave_request[i + run_length/booksize_]) == interleave_group;
+             run_length += booksize_)
+        { }
         os_set_membind(interleave_group); // the interleave group is the socket node
         if (zero_books) {
-            if (os_write_zeros(fd, off, booksize_)) {
+            if (os_write_zeros(fd, off, run_length)) {
                 return kErrorCodeGeneric;
             }
         } else {
 #if _XOPEN_SOURCE >= 600 || _POSIX_C_SOURCE >= 200112L
-            if (posix_fallocate(fd, off, booksize_) < 0) {
+            if (posix_fallocate(fd, off, run_length) != 0) {
                 return kErrorCodeGeneric;
             }
 #else
-            if (os_write_zeros(fd, off, booksize_)) {
+            if (os_write_zeros(fd, off, run_length)) {
                 return kErrorCodeGeneric;
             }
 #endif
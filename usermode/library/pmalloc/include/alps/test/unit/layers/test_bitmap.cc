@@ -27,7 +27,7 @@ typedef nvBitMap<Context> nvBitMap_t;
 
 void test_make(Context& ctx, int bitmap_len)
 {
-    char buf[64];
+    uint64_t buf[8];
   
     // set all buffer bits to one 
     memset(buf, 0xff, sizeof(buf));
@@ -72,7 +72,7 @@ TEST(BitMap, make_len256)
 TEST(BitMap, set)
 {
     Context ctx;
-    char buf[64];
+    uint64_t buf[8];
     int bitmap_len = 256;
 
     nvBitMap_t* bm = nvBitMap_t::make(ctx, bitmap_len, buf);
@@ -86,7 +86,7 @@ TEST(BitMap, set)
 void test_clear(int bitmap_len)
 {
     Context ctx;
-    char buf[64];
+    uint64_t buf[8];
   
     nvBitMap_t* bm = nvBitMap_t::make(ctx, bitmap_len, buf);
 
@@ -110,6 +110,28 @@ TEST(BitMap, clear)
     test_clear(256);
 }
 
+TEST(BitMap, set_clear_word)
+{
+    Context ctx;
+    uint64_t buf[8];
+    int bitmap_len = 256;
+
+    nvBitMap_t* bm = nvBitMap_t::make(ctx, bitmap_len, buf);
+
+    uint64_t mask = 0x8000000000010f01ULL;
+    bm->set_word(ctx, 1, mask);
+    EXPECT_EQ(mask, bm->load_word(ctx, 1));
+    for (int i=0; i<bitmap_len; i++) {
+        EXPECT_EQ(i >= 64 && i < 128 && (mask >> (i - 64)) & 1, bm->is_set(ctx, i));
+    }
+
+    bm->set(ctx, 70);
+    bm->clear_word(ctx, 1, mask);
+    EXPECT_EQ(1ULL << 6, bm->load_word(ctx, 1));
+    EXPECT_EQ(0U, bm->load_word(ctx, 0));
+    EXPECT_EQ(0U, bm->load_word(ctx, 2));
+}
+
 int main(int argc, char** argv)
 {
     ::testing::InitGoogleTest(&argc, argv);
@@ -17,6 +17,7 @@
 #include <fcntl.h>
 
 #include <cinttypes>
+#include <map>
 
 #include "gtest/gtest.h"
 #include "alps/layers/pointer.hh"
@@ -171,6 +172,29 @@ TEST(ExtentHeapTest, load)
 }
 
 
+TEST(ExtentHeapTest, for_each_extent)
+{
+    Context ctx;
+    TPtr<void> region = malloc(region_size);
+
+    ExtentHeap_t* exheap = ExtentHeap_t::make(region, region_size, block_log2size);
+    Extent_t ex1, ex2, ex3;
+    EXPECT_EQ(kErrorCodeOk, exheap->alloc_extent(ctx, 2, &ex1));
+    EXPECT_EQ(kErrorCodeOk, exheap->alloc_extent(ctx, 3, &ex2));
+    EXPECT_EQ(kErrorCodeOk, exheap->alloc_extent(ctx, 4, &ex3));
+    EXPECT_EQ(kErrorCodeOk, exheap->free_extent(ctx, ex2.nvextent()));
+
+    std::map<void*, size_t> found;
+    exheap->for_each_extent(0, exheap->nblocks(), [&](TPtr<void> extent, size_t size, bool slab) {
+        EXPECT_FALSE(slab);
+        found[extent.get()] = size;
+    });
+    EXPECT_EQ(2U, found.size());
+    EXPECT_EQ(2 * exheap->blocksize(), found[ex1.nvextent().get()]);
+    EXPECT_EQ(4 * exheap->blocksize(), found[ex3.nvextent().get()]);
+}
+
+
 
 int main(int argc, char** argv)
 {
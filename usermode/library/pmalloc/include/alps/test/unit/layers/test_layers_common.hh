@@ -36,6 +36,16 @@ public:
         memcpy(dest, src, size);    
     }
 
+    uint64_t load_word(uint64_t* src)
+    {
+        return *src;
+    }
+
+    void store_word(uint64_t* dest, uint64_t value, uint64_t mask)
+    {
+        *dest = (*dest & ~mask) | (value & mask);
+    }
+
     bool do_v;
     bool do_nv;
 };
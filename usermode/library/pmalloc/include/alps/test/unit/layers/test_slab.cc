@@ -147,7 +147,7 @@ TEST_F(SlabTest, slab_load)
     nvslab->set_alloc(ctx, 1);
     nvslab->set_alloc(ctx, 3);
 
-    Slab_t* slab= Slab_t::load(ctx, nvslab);
+    Slab_t* slab= Slab_t::load(ctx, nvslab, slab_size);
     EXPECT_EQ(slab->nblocks() - 3, slab->nblocks_free());
 }
 
@@ -160,13 +160,13 @@ TEST_F(SlabTest, slab_alloc_block)
 
     nvSlab_t::make(ctx, nvslab, slab_size, szcl_1K);
 
-    Slab_t* slab = Slab_t::load(ctx, nvslab);
+    Slab_t* slab = Slab_t::load(ctx, nvslab, slab_size);
     slab->alloc_block(ctx);
     slab->alloc_block(ctx);
     slab->alloc_block(ctx);
     EXPECT_EQ(slab->nblocks() - 3, slab->nblocks_free());
 
-    Slab_t* shadow_slab = Slab_t::load(ctx, nvslab);
+    Slab_t* shadow_slab = Slab_t::load(ctx, nvslab, slab_size);
     EXPECT_EQ(slab->nblocks_free(), shadow_slab->nblocks_free());
     delete slab;
     delete shadow_slab;
@@ -75,17 +75,18 @@ TEST_F(SlabHeapTest, insert)
 {
     Context ctx;
     SlabHeap_t slabheap(slab_size);
+    int szcl_1K = sizeclass(1024);
 
-    Slab_t* slab0 = slabheap.insert_slab(ctx, alloc_nvslab(ctx, 71, 0));
-    Slab_t* slab1 = slabheap.insert_slab(ctx, alloc_nvslab(ctx, 71, 1));
-    Slab_t* slab2 = slabheap.insert_slab(ctx, alloc_nvslab(ctx, 71, 50));
-    Slab_t* slab3 = slabheap.insert_slab(ctx, alloc_nvslab(ctx, 71, 99));
+    Slab_t* slab0 = slabheap.insert_slab(ctx, alloc_nvslab(ctx, szcl_1K, 0));
+    Slab_t* slab1 = slabheap.insert_slab(ctx, alloc_nvslab(ctx, szcl_1K, 1));
+    Slab_t* slab2 = slabheap.insert_slab(ctx, alloc_nvslab(ctx, szcl_1K, 50));
+    Slab_t* slab3 = slabheap.insert_slab(ctx, alloc_nvslab(ctx, szcl_1K, 99));
 
     UNUSED_ND(slab0);
     UNUSED_ND(slab1);
     UNUSED_ND(slab2);
 
-    Slab_t* slab4 = slabheap.find_slab(71);
+    Slab_t* slab4 = slabheap.find_slab(szcl_1K);
     
     EXPECT_EQ(slab3, slab4);
     
@@ -119,6 +120,123 @@ TEST(SlabHeapWithExtentHeapTest, alloc)
 
 }
 
+TEST(SlabHeapWithExtentHeapTest, reload)
+{
+    size_t region_size = 1024*1024;
+    size_t block_log2size = 12; // 4KB
+    const size_t slab_size = 1 << block_log2size;
+    Context ctx;
+    TPtr<void> region = malloc(region_size);
+    TPtr<void> ptr[64];
+
+    ExtentHeap_t* exheap = ExtentHeap_t::make(region, region_size, block_log2size);
+    SlabHeap_t* slabheap = new SlabHeap_t(slab_size, NULL, exheap);
+    for (int i=0; i<64; i++) {
+        EXPECT_EQ(kErrorCodeOk, slabheap->malloc(ctx, (i % 2) ? 64 : slab_size / 4, &ptr[i]));
+    }
+
+    // Load the heap again, scanning it with several threads
+    exheap = ExtentHeap_t::load(region);
+    slabheap = new SlabHeap_t(slab_size, NULL, exheap);
+    EXPECT_EQ(kErrorCodeOk, slabheap->init(ctx, 4));
+    for (int i=0; i<64; i++) {
+        EXPECT_TRUE(slabheap->is_block(ptr[i]));
+        EXPECT_EQ((i % 2) ? 64U : slab_size / 4, slabheap->getsize(ptr[i]));
+    }
+
+    // Freed blocks are reused and live ones are not handed out again
+    slabheap->free(ctx, ptr[1]);
+    TPtr<void> p;
+    EXPECT_EQ(kErrorCodeOk, slabheap->malloc(ctx, 64, &p));
+    EXPECT_EQ(ptr[1], p);
+    for (int i=0; i<8; i++) {
+        EXPECT_EQ(kErrorCodeOk, slabheap->malloc(ctx, slab_size / 4, &p));
+        for (int j=0; j<64; j+=2) {
+            EXPECT_NE(ptr[j], p);
+        }
+    }
+}
+
+TEST(SlabHeapWithExtentHeapTest, spare_slabs)
+{
+    size_t region_size = 4*1024*1024;
+    size_t block_log2size = 12; // 4KB
+    const size_t slab_size = 1 << block_log2size;
+    Context ctx;
+    TPtr<void> region = malloc(region_size);
+    TPtr<void> ptr[3];
+    SlabHeap_t::Stats st;
+
+    ExtentHeap_t* exheap = ExtentHeap_t::make(region, region_size, block_log2size);
+    SlabHeap_t parent(slab_size, NULL, exheap);
+    SlabHeap_t child1(slab_size, &parent, exheap);
+    SlabHeap_t child2(slab_size, &parent, exheap);
+    SlabHeap_t child3(slab_size, &parent, exheap);
+
+    // The first child makes the parent format a batch of slabs
+    EXPECT_EQ(kErrorCodeOk, child1.malloc(ctx, 64, &ptr[0]));
+    memset(&st, 0, sizeof(st));
+    parent.add_stats(&st);
+    EXPECT_EQ((size_t) SlabHeap_t::kSlabBatch - 1, st.empty_slabs);
+
+    // The next ones pop the spare slabs
+    EXPECT_EQ(kErrorCodeOk, child2.malloc(ctx, 64, &ptr[1]));
+    EXPECT_EQ(kErrorCodeOk, child3.malloc(ctx, 64, &ptr[2]));
+    memset(&st, 0, sizeof(st));
+    parent.add_stats(&st);
+    EXPECT_EQ((size_t) SlabHeap_t::kSlabBatch - 3, st.empty_slabs);
+    memset(&st, 0, sizeof(st));
+    child2.add_stats(&st);
+    EXPECT_EQ(1U, st.slabs[sizeclass(64)]);
+    EXPECT_EQ(1U, st.blocks_in_use[sizeclass(64)]);
+
+    // Trimming the parent frees the remaining spare slab
+    EXPECT_EQ(1U, parent.trim(ctx));
+    child2.free(ctx, ptr[1]);
+    EXPECT_EQ(kErrorCodeOk, child2.malloc(ctx, 64, &ptr[1]));
+}
+
+TEST(SlabHeapWithExtentHeapTest, remote_free)
+{
+    size_t region_size = 4*1024*1024;
+    size_t block_log2size = 12; // 4KB
+    const size_t slab_size = 1 << block_log2size;
+    Context ctx;
+    Context nvctx;
+    Context vctx;
+    TPtr<void> region = malloc(region_size);
+    TPtr<void> ptr;
+    SlabHeap_t::Stats st;
+    size_t in_use;
+
+    nvctx.do_v = false;
+    vctx.do_nv = false;
+
+    ExtentHeap_t* exheap = ExtentHeap_t::make(region, region_size, block_log2size);
+    SlabHeap_t parent(slab_size, NULL, exheap);
+    SlabHeap_t child1(slab_size, &parent, exheap, true);
+    SlabHeap_t child2(slab_size, &parent, exheap, true);
+    child1.bind_cache();
+    child2.bind_cache();
+
+    EXPECT_EQ(kErrorCodeOk, child1.malloc(ctx, 64, &ptr));
+    memset(&st, 0, sizeof(st));
+    child1.add_stats(&st);
+    in_use = st.blocks_in_use[sizeclass(64)];
+
+    // The volatile free by another heap waits on the owner's remote free 
+    // list until the owner drains it
+    child2.free(nvctx, ptr);
+    child2.free(vctx, ptr);
+    memset(&st, 0, sizeof(st));
+    child1.add_stats(&st);
+    EXPECT_EQ(in_use, st.blocks_in_use[sizeclass(64)]);
+
+    child1.trim(ctx);
+    memset(&st, 0, sizeof(st));
+    child1.add_stats(&st);
+    EXPECT_EQ(in_use - 1, st.blocks_in_use[sizeclass(64)]);
+}
 
 int main(int argc, char** argv)
 {
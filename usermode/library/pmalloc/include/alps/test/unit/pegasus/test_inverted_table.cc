@@ -62,6 +62,31 @@ TEST(InvertedTableTest, remove2)
     EXPECT_EQ(0x0, tbl.find_vmarea(0x7f0000001100));
 }
 
+TEST(InvertedTableTest, chunks)
+{
+    InvertedTable tbl;
+    uintptr_t chunk = 1UL << InvertedTable::kChunkShift;
+    uintptr_t base = 0x7f0000000000;
+    VmArea vma1(0x0, 0x0, base + 0x1000, base + 3*chunk + 0x1000);
+    VmArea vma2(0x0, 0x1, base + 3*chunk + 0x1000, base + 8*chunk);
+    tbl.insert_vmarea(&vma1);
+    tbl.insert_vmarea(&vma2);
+
+    EXPECT_EQ(0x0, tbl.find_vmarea(base));
+    EXPECT_EQ((uintptr_t) 0x0, tbl.find_vmarea(base + 0x1000)->offset());
+    EXPECT_EQ((uintptr_t) 0x0, tbl.find_vmarea(base + chunk + 0x10)->offset());
+    EXPECT_EQ((uintptr_t) 0x0, tbl.find_vmarea(base + 3*chunk + 0xfff)->offset());
+    EXPECT_EQ((uintptr_t) 0x1, tbl.find_vmarea(base + 3*chunk + 0x1000)->offset());
+    EXPECT_EQ((uintptr_t) 0x1, tbl.find_vmarea(base + 8*chunk - 1)->offset());
+    EXPECT_EQ(0x0, tbl.find_vmarea(base + 8*chunk));
+
+    tbl.remove_vmarea(&vma1);
+    EXPECT_EQ(0x0, tbl.find_vmarea(base + chunk + 0x10));
+    EXPECT_EQ(0x0, tbl.find_vmarea(base + 3*chunk + 0xfff));
+    EXPECT_EQ((uintptr_t) 0x1, tbl.find_vmarea(base + 3*chunk + 0x1000)->offset());
+    EXPECT_EQ((uintptr_t) 0x1, tbl.find_vmarea(base + 5*chunk)->offset());
+}
+
 
 int main(int argc, char** argv)
 {
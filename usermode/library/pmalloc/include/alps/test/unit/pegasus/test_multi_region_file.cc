@@ -119,6 +119,33 @@ TEST_F(MapMultiRegionFileTest, map_partial_case3)
     EXPECT_EQ(kErrorCodeOk, region_file->close());
 }
 
+TEST_F(MapMultiRegionFileTest, map_striped)
+{
+    RegionFile* region_file;
+    size_t      region_size = REGION_FILE_SIZE * NUM_REGION_FILES;
+    size_t      stripe_size = booksize()/2;
+    loff_t      size;
+    void*       mapped_addr;
+
+    size_t length = region_size - booksize();
+    loff_t offset = booksize()/2;
+
+    EXPECT_EQ(kErrorCodeOk, Pegasus::open_striped_region_file(region_file_paths_c, NUM_REGION_FILES, O_RDWR, stripe_size, &region_file));
+    EXPECT_EQ(kErrorCodeOk, region_file->size(&size));
+    EXPECT_EQ((loff_t) region_size, size);
+    EXPECT_EQ(kErrorCodeOk, region_file->map(0, length, PROT_READ|PROT_WRITE, MAP_SHARED, offset, &mapped_addr));
+
+    // Consecutive stripes come from consecutive files
+    for (size_t i = 0; i < length / stripe_size; i++) {
+        *((uint64_t*) ((char*) mapped_addr + i * stripe_size)) = i;
+    }
+    EXPECT_EQ(kErrorCodeOk, region_file->unmap(mapped_addr, length));
+    EXPECT_EQ(kErrorCodeOk, region_file->map(0, stripe_size, PROT_READ|PROT_WRITE, MAP_SHARED, offset + NUM_REGION_FILES * stripe_size, &mapped_addr));
+    EXPECT_EQ((uint64_t) NUM_REGION_FILES, *((uint64_t*) mapped_addr));
+    EXPECT_EQ(kErrorCodeOk, region_file->unmap(mapped_addr, stripe_size));
+    EXPECT_EQ(kErrorCodeOk, region_file->close());
+}
+
 int main(int argc, char** argv)
 {
     ::alps::init_test_env<MapEnvironment>(argc, argv);
@@ -34,6 +34,8 @@
 #define _MNEMOSYNE_PMALLOC_H
 
 #include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
 
 #if __cplusplus
 extern "C" {
@@ -48,6 +50,121 @@ __attribute__((transaction_pure)) void *_ITM_pcalloc(size_t, size_t);
 __attribute__((transaction_pure)) void *_ITM_prealloc(void *, size_t);
 #define prealloc _ITM_prealloc
 
+/*
+ * Pools: heaps of their own, each in regions of its own, so that the 
+ * objects of a tenant are kept apart from the others'. m_pool_open opens 
+ * the pool called name (up to 47 characters), creating it with 
+ * pool_size_mb if it does not exist, and returns NULL if it cannot; 
+ * opening an open pool returns it again. pmalloc_from allocates from a 
+ * pool as pmalloc does from the main heap; pfree and prealloc take 
+ * objects of any open pool. m_pool_close drops the volatile state of a 
+ * pool, whose objects must not be used until it is opened again; returns 
+ * -1 if the pool is not open. Pools share the logs and the segment table
+ * of the process. Not transactional.
+ */
+typedef struct pmalloc_pool_s pmalloc_pool_t;
+
+pmalloc_pool_t *m_pool_open(const char *name);
+int m_pool_close(pmalloc_pool_t *pool);
+__attribute__((transaction_pure)) void *_ITM_pmalloc_from(pmalloc_pool_t *, size_t);
+#define pmalloc_from _ITM_pmalloc_from
+
+/* 
+ * Punches holes in the backing stores under the free extents of the heap. 
+ * Not transactional; returns the number of bytes discarded. 
+ */
+size_t pmalloc_discard_free(void);
+
+/*
+ * Bulk load: between pmalloc_bulk_begin and pmalloc_bulk_end the calling 
+ * thread has the heap to itself, and pmalloc, pfree and friends update the
+ * allocator metadata with plain stores instead of transactional ones, even
+ * inside transactions. pmalloc_bulk_end writes the metadata back and makes
+ * the whole load durable at once. The caller persists the contents of the
+ * objects itself (e.g. with m_pflush) before ending the load. A crash 
+ * during the load may leave any part of it allocated, so an interrupted 
+ * load must start over on a fresh heap.
+ */
+void pmalloc_bulk_begin(void);
+void pmalloc_bulk_end(void);
+
+/*
+ * Leak collection: frees the objects of the heap and of all its pools that
+ * no persistent segment outside the heap points to, directly or through 
+ * other objects, such as objects a crash left allocated but unpublished. 
+ * Any aligned word holding the address of an object, or its persistent 
+ * pointer offset (see pptr.h), counts as a pointer to it, and so do the 
+ * words of the ranges registered with pmalloc_collect_root (e.g. volatile 
+ * memory with pointers to persistent objects). Marks with nthreads threads.
+ * Nothing else may use the heap or run transactions meanwhile, and the 
+ * committed stores must have been written back (mtm_sync): run it at 
+ * startup or from the pcollect tool. Returns the number of unreachable 
+ * objects, freed unless dry_run, and their size in *freed_bytes; -1 on 
+ * failure.
+ */
+long pmalloc_collect(int nthreads, int dry_run, size_t *freed_bytes);
+void pmalloc_collect_root(const void *addr, size_t size);
+
+/*
+ * Compaction: pmalloc_compact moves objects out of slabs that are mostly 
+ * free, which then go back to the extent heap, and big objects (up to 
+ * 1 MB) towards the start of the heap, so that the free space comes 
+ * together. Only objects a registered relocator takes are moved, each in 
+ * a transaction of its own that allocates the new copy from the same heap 
+ * or pool, copies the object into it and calls the relocators in order 
+ * until one returns nonzero. That relocator must have repointed every 
+ * reference to from to to, transactionally; it returns 0 if from is not a 
+ * live object of a type it knows, and the move is abandoned. from is then
+ * freed, so pointers to it that the relocators do not patch, such as 
+ * volatile copies, go stale: a relocator only takes objects referenced 
+ * from where it patches. Relocators must be transaction safe; up to 16 can
+ * be registered, and pmalloc_relocator_register returns -1 past that. 
+ * pmalloc_compact moves up to max_bytes and returns the bytes moved; the 
+ * rebalancer runs it every compact_interval_s seconds. Must be called 
+ * outside a transaction.
+ */
+typedef int (*pmalloc_relocate_fn_t)(void *from, void *to, size_t size, void *arg) __attribute__((transaction_safe));
+int pmalloc_relocator_register(pmalloc_relocate_fn_t fn, void *arg);
+size_t pmalloc_compact(size_t max_bytes);
+
+#define PMALLOC_STATS_SIZECLASSES   100
+#define PMALLOC_STATS_FULLNESS_BINS 3
+
+/* 
+ * Occupancy of the persistent heap. Slabs are binned by how full they are,
+ * the last bin holding full slabs; blocks held in per-thread caches count
+ * as in use. Unmapped slabs were loaded at restart and not used since, so
+ * their occupancy is unknown. The malloc and free counts are cumulative: 
+ * rates come from the difference between two snapshots.
+ */
+typedef struct {
+	uint64_t mallocs;
+	uint64_t frees;
+	uint64_t heap_bytes;          /* size of the extent heap */
+	uint64_t free_bytes;          /* in free extents */
+	uint64_t free_extents;
+	uint64_t largest_free_bytes;  /* largest free extent */
+	uint64_t slab_bytes;          /* in extents formatted as slabs */
+	uint64_t big_bytes;           /* in extents holding a single object */
+	uint64_t empty_slabs;
+	uint64_t unmapped_slabs;
+	uint64_t fullness_bins[PMALLOC_STATS_FULLNESS_BINS];
+	struct {
+		uint64_t block_size;
+		uint64_t slabs;
+		uint64_t blocks_in_use;
+	} sizeclass[PMALLOC_STATS_SIZECLASSES];
+} pmalloc_stats_t;
+
+/* 
+ * Fills stats; returns 0, or -1 if the heap has not been created yet, 
+ * which pmalloc_stats does not do by itself.
+ */
+int pmalloc_stats(pmalloc_stats_t *stats);
+
+/* Prints the heap occupancy and free space fragmentation report */
+void pmalloc_stats_print(FILE *fout);
+
 #if __cplusplus
 }
 #endif
@@ -0,0 +1,76 @@
+#ifndef _MNEMOSYNE_HEAP_CONFIG_H
+#define _MNEMOSYNE_HEAP_CONFIG_H
+
+extern "C" {
+#include "config_generic.h"
+}
+
+/* Build-time defaults of the runtime settings */
+#ifndef PMALLOC_REGION_SIZE_MB
+#define PMALLOC_REGION_SIZE_MB 8192
+#endif
+
+#ifndef PMALLOC_REGION_GROW_MB
+#define PMALLOC_REGION_GROW_MB 1024
+#endif
+
+#ifndef PMALLOC_POOL_SIZE_MB
+#define PMALLOC_POOL_SIZE_MB 256
+#endif
+
+#ifndef PMALLOC_BLOCK_LOG2SIZE
+#define PMALLOC_BLOCK_LOG2SIZE 13
+#endif
+
+#ifndef PMALLOC_SLAB_LOG2SIZE
+#define PMALLOC_SLAB_LOG2SIZE 13
+#endif
+
+#ifndef PMALLOC_SLAB_MAX_LOG2SIZE
+#define PMALLOC_SLAB_MAX_LOG2SIZE 18
+#endif
+
+#ifndef PMALLOC_DISCARD_INTERVAL_S
+#define PMALLOC_DISCARD_INTERVAL_S 0
+#endif
+
+#ifndef PMALLOC_COMPACT_INTERVAL_S
+#define PMALLOC_COMPACT_INTERVAL_S 0
+#endif
+
+#ifndef PMALLOC_LOAD_THREADS
+#define PMALLOC_LOAD_THREADS 4
+#endif
+
+/*
+ * The region, block and slab sizes only apply when the heap is first 
+ * created; a recovered heap keeps the ones it was created with.
+ */
+#define FOREACH_RUNTIME_CONFIG_SETTING(ACTION, group, config, values)          \
+  ACTION(config, values, group, region_size_mb, int, int,                      \
+         PMALLOC_REGION_SIZE_MB, CONFIG_RANGE_CHECK, 16, 1048576)              \
+  ACTION(config, values, group, region_grow_mb, int, int,                      \
+         PMALLOC_REGION_GROW_MB, CONFIG_RANGE_CHECK, 0, 1048576)               \
+  ACTION(config, values, group, pool_size_mb, int, int,                        \
+         PMALLOC_POOL_SIZE_MB, CONFIG_RANGE_CHECK, 16, 1048576)                \
+  ACTION(config, values, group, block_log2size, int, int,                      \
+         PMALLOC_BLOCK_LOG2SIZE, CONFIG_RANGE_CHECK, 12, 24)                   \
+  ACTION(config, values, group, slab_log2size, int, int,                       \
+         PMALLOC_SLAB_LOG2SIZE, CONFIG_RANGE_CHECK, 12, 24)                    \
+  ACTION(config, values, group, slab_max_log2size, int, int,                   \
+         PMALLOC_SLAB_MAX_LOG2SIZE, CONFIG_RANGE_CHECK, 12, 24)                \
+  ACTION(config, values, group, discard_interval_s, int, int,                  \
+         PMALLOC_DISCARD_INTERVAL_S, CONFIG_RANGE_CHECK, 0, 86400)              \
+  ACTION(config, values, group, compact_interval_s, int, int,                  \
+         PMALLOC_COMPACT_INTERVAL_S, CONFIG_RANGE_CHECK, 0, 86400)              \
+  ACTION(config, values, group, load_threads, int, int,                        \
+         PMALLOC_LOAD_THREADS, CONFIG_RANGE_CHECK, 1, 64)
+
+
+typedef CONFIG_GROUP_STRUCT(pmalloc) pmalloc_config_t;
+
+extern pmalloc_config_t pmalloc_runtime_settings;
+
+void pmalloc_config_init();
+
+#endif // _MNEMOSYNE_HEAP_CONFIG_H
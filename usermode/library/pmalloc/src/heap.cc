@@ -1,10 +1,37 @@
 #include "heap.hh"
+#include "config.h"
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include <sys/mman.h>
 
+#include <algorithm>
+
 #include <mnemosyne.h>
+extern "C" {
+#include <workpool.h>
+}
+
+/* Period of the idle thread heap rebalancer; 0 disables it */
+#ifndef PMALLOC_REBALANCE_INTERVAL_MS
+#define PMALLOC_REBALANCE_INTERVAL_MS 1000
+#endif
+
+/* 
+ * Compaction moves the objects of slabs at most this full, and big objects 
+ * up to this large; a rebalancer pass moves up to this many bytes
+ */
+#ifndef PMALLOC_COMPACT_SPARSE_PCT
+#define PMALLOC_COMPACT_SPARSE_PCT 25
+#endif
+#ifndef PMALLOC_COMPACT_MAX_OBJECT
+#define PMALLOC_COMPACT_MAX_OBJECT (1 << 20)
+#endif
+#ifndef PMALLOC_COMPACT_PASS_BYTES
+#define PMALLOC_COMPACT_PASS_BYTES (64 << 20)
+#endif
 
 
 //MNEMOSYNE_PERSISTENT void *psegment = 0;
@@ -13,6 +40,42 @@
 
 //MNEMOSYNE_PERSISTENT void* PREGION_BASE = 0;
 __attribute__ ((section("PERSISTENT"))) void* PREGION_BASE = 0;
+/* Regions of NUMA nodes 1 and up, and the number of nodes the heap was 
+ * created with (0 for heaps created before NUMA support: a single node) */
+__attribute__ ((section("PERSISTENT"))) void* PREGION_NODE_BASE[PMALLOC_MAX_NODES] = { 0 };
+__attribute__ ((section("PERSISTENT"))) uint64_t PREGION_NNODES = 0;
+__attribute__ ((section("PERSISTENT"))) uint64_t PREGION_SLAB_LOG2SIZE = 0;
+
+/* 
+ * Pool directory: the first region of each pool by name. An entry is in 
+ * use once its base is set, which is written and flushed after the name.
+ */
+struct PoolEntry {
+    char name[PMALLOC_POOL_NAME_MAX];
+    void* base;
+    uint64_t pad;
+};
+__attribute__ ((section("PERSISTENT"))) PoolEntry PPOOL_DIR[PMALLOC_MAX_POOLS] = { };
+
+std::vector<uintptr_t>* bulk_lines = NULL;
+
+/*
+ * Maps another persistent region when an extent heap runs out of space. 
+ * The extent heap links the region into its persistent chain, so it is 
+ * found again by ExtentHeap_t::load on recovery.
+ */
+static void* grow_region(size_t size, void* arg)
+{
+    int node = (int) (intptr_t) arg;
+    void* region = (void*) m_pmap(NULL, size, PROT_READ|PROT_WRITE, 0);
+    if (region == MAP_FAILED || region == NULL) {
+        return NULL;
+    }
+    if (node >= 0) {
+        m_pmap_bind_node(region, size, node);
+    }
+    return region;
+}
 
 int Heap::init()
 {
@@ -21,52 +84,870 @@ int Heap::init()
     alps::init_log(dbgopt);
 
     Context ctx;
+    pmalloc_config_init();
+
     /* Clean up multiple definitions of PSEGMENT_* */
-    /*
-     * Do not combine n_gb and region_size in the defn
-     * of region_size. it causes compiler to generate wrong
-     * (my guess), which can actually be observed as an overflow 
-     * during runtime.
-     * splitting the values as n_gb and region_size does not
-     * cause any absurd overflows during runtime.
-     */
-    unsigned long long n_gb = 8;
-    unsigned long long region_size = 1024*1024*1024;
-    region_size *= n_gb; 
-    size_t block_log2size = 13;
+    unsigned long long region_size = (unsigned long long) pmalloc_runtime_settings.region_size_mb << 20;
+    size_t block_log2size = pmalloc_runtime_settings.block_log2size;
 
-    slabsize_ = 1 << block_log2size;
-    //slabsize /= 2; 
+    /* 
+     * A slab is carved out of a single extent, so it is at least one block. 
+     * The slab size of a recovered heap is the one it was created with 
+     * (0 for heaps created before it was configurable).
+     */
+    if (PREGION_BASE == 0) {
+        PREGION_SLAB_LOG2SIZE = std::max(pmalloc_runtime_settings.slab_log2size, 
+                                         (int) block_log2size);
+    }
+    slabsize_ = 1 << (PREGION_SLAB_LOG2SIZE ? PREGION_SLAB_LOG2SIZE : 13);
 
-    /* Max block allocated from slabheap must be smaller than the slab extent size 
-     * to ensure slab data and metadata fit within the slab extent */
-    bigsize_ = slabsize_/2;
+    /* 
+     * Slabs of the larger sizeclasses are made up to maxslabsize_ large so 
+     * that they hold several blocks, which lets objects of up to an eighth 
+     * of it come from the slab heap. A recovered slab keeps the size of its 
+     * extent.
+     */
+    maxslabsize_ = std::max(slabsize_, (size_t) 1 << pmalloc_runtime_settings.slab_max_log2size);
+    bigsize_ = std::max(slabsize_/2, maxslabsize_/SlabHeap_t::kSlabMinBlocks);
+    bigsize_ = std::min(bigsize_, alps::kSizeClassMaxSize);
 
+    /* 
+     * With PMALLOC_NUMA the region is split into one extent heap per NUMA 
+     * node, each preferring the memory of its node. The number of nodes is 
+     * fixed when the heap is first created.
+     */
     if (PREGION_BASE == 0) {
-        PREGION_BASE = (void*) m_pmap((void *) PREGION_BASE, region_size, PROT_READ|PROT_WRITE, 0);
-        void* region = PREGION_BASE;
-        exheap_ = ExtentHeap_t::make(region, region_size, block_log2size);
-    } else {
-        void* region = PREGION_BASE;
-        exheap_ = ExtentHeap_t::load(region);
+        int nnodes = 1;
+#ifdef PMALLOC_NUMA
+        nnodes = std::min(m_numa_nodes(), PMALLOC_MAX_NODES);
+#endif
+        PREGION_NNODES = nnodes;
     }
+    nnodes_ = PREGION_NNODES ? (int) PREGION_NNODES : 1;
+    region_size /= nnodes_;
 
-    slheap_ = new SlabHeap_t(slabsize_, NULL, exheap_);
-    slheap_->init(ctx);
+    for (int n=0; n<nnodes_; n++) {
+        void** basep = n == 0 ? &PREGION_BASE : &PREGION_NODE_BASE[n];
+        if (*basep == 0) {
+            void* region = (void*) m_pmap(NULL, region_size, PROT_READ|PROT_WRITE, 0);
+            if (nnodes_ > 1) {
+                m_pmap_bind_node(region, region_size, n);
+            }
+            *basep = region;
+            exheap_[n] = ExtentHeap_t::make(region, region_size, block_log2size);
+        } else {
+            exheap_[n] = ExtentHeap_t::load(*basep);
+        }
+        if (pmalloc_runtime_settings.region_grow_mb > 0) {
+            exheap_[n]->set_grow(grow_region, (void*) (intptr_t) (nnodes_ > 1 ? n : -1), 
+                                 (size_t) pmalloc_runtime_settings.region_grow_mb << 20);
+        }
+        slheap_[n] = new SlabHeap_t(slabsize_, NULL, exheap_[n], false, maxslabsize_);
+        slheap_[n]->init(ctx, pmalloc_runtime_settings.load_threads);
+        hheap_[n] = new HybridHeap_t(bigsize_, slheap_[n], exheap_[n]);
+    }
+
+    pthread_mutex_init(&threadheaps_mutex_, NULL);
+    pthread_mutex_init(&bulk_mutex_, NULL);
+    pthread_mutex_init(&pools_mutex_, NULL);
+    npools_.store(0);
+    for (int i=0; i<PMALLOC_MAX_POOLS; i++) {
+        pools_[i].store(NULL);
+    }
+    if (PMALLOC_REBALANCE_INTERVAL_MS > 0) {
+        if (pthread_create(&rebalancer_, NULL, rebalancer_main, this) != 0) {
+            perror("pthread_create");
+        } else {
+            pthread_detach(rebalancer_);
+        }
+    }
+    return 0;
 }
 
+/*
+ * Slabs recovered from the extent heap are loaded once into the shared slab 
+ * heap by Heap::init; per-thread slab heaps start empty and acquire slabs 
+ * from it on demand, so creating one does not scan the extent heap.
+ */
 ThreadHeap* Heap::threadheap()
 {
-    Context ctx;
+    ThreadHeap* thp = NULL;
+    int node = nnodes_ > 1 ? m_numa_node_self() % nnodes_ : 0;
+
+    pthread_mutex_lock(&threadheaps_mutex_);
+    if (!retired_threadheaps_[node].empty()) {
+        thp = retired_threadheaps_[node].front();
+        retired_threadheaps_[node].pop_front();
+    }
+    pthread_mutex_unlock(&threadheaps_mutex_);
 
-    SlabHeap_t* slheap = new SlabHeap_t(slabsize_, NULL, exheap_);
-    slheap_->init(ctx);
+    if (!thp) {
+        SlabHeap_t* slheap = new SlabHeap_t(slabsize_, slheap_[node], exheap_[node], true, maxslabsize_);
+        HybridHeap_t* hheap = new HybridHeap_t(bigsize_, slheap, exheap_[node]);
+        thp = new ThreadHeap(hheap, slheap, this, node);
+    }
+    thp->slabheap()->bind_cache();
 
-    HybridHeap_t* hheap = new HybridHeap_t(bigsize_, slheap, exheap_);
-    ThreadHeap* thp = new ThreadHeap(hheap);
+    pthread_mutex_lock(&threadheaps_mutex_);
+    threadheaps_.push_back(thp);
+    pthread_mutex_unlock(&threadheaps_mutex_);
     return thp;
 }
 
+/*
+ * Called on thread exit. The heap's slabs go back to the shared slab heap 
+ * and extent heap, but the (now empty) heap itself is kept for the next 
+ * thread: other threads may still be about to lock it while freeing a block
+ * of a slab it just gave away.
+ */
+void Heap::retire_threadheap(ThreadHeap* thp)
+{
+    thp->release();
+
+    pthread_mutex_lock(&threadheaps_mutex_);
+    threadheaps_.remove(thp);
+    retired_threadheaps_[thp->node()].push_back(thp);
+    pthread_mutex_unlock(&threadheaps_mutex_);
+}
+
+/*
+ * Returns to the extent heap the empty slabs of thread heaps that did not
+ * refill or spill their caches since the last pass, and of the shared slab 
+ * heap. Slabs holding free blocks stay with live threads as the blocks may 
+ * be reserved in their lock-free caches. Trimming also drains the blocks 
+ * other threads freed into a heap, which forwards those freed into a 
+ * retired heap after it gave their slabs away.
+ */
+void Heap::rebalance()
+{
+    Context ctx;
+
+    pthread_mutex_lock(&threadheaps_mutex_);
+    for (std::list<ThreadHeap*>::iterator it = threadheaps_.begin();
+         it != threadheaps_.end(); it++)
+    {
+        (*it)->trim_if_idle();
+    }
+    for (int n=0; n<nnodes_; n++) {
+        for (std::list<ThreadHeap*>::iterator it = retired_threadheaps_[n].begin();
+             it != retired_threadheaps_[n].end(); it++)
+        {
+            (*it)->trim_if_idle();
+        }
+    }
+    pthread_mutex_unlock(&threadheaps_mutex_);
+    for (int n=0; n<nnodes_; n++) {
+        slheap_[n]->trim(ctx);
+    }
+    pthread_mutex_lock(&pools_mutex_);
+    for (int i=0; i<PMALLOC_MAX_POOLS; i++) {
+        Pool* pool = pools_[i].load(std::memory_order_relaxed);
+        if (pool) {
+            pool->slheap_->trim(ctx);
+        }
+    }
+    pthread_mutex_unlock(&pools_mutex_);
+}
+
+static_assert(PMALLOC_STATS_SIZECLASSES == alps::kSizeClasses, "pmalloc_stats_t sizeclasses");
+static_assert(PMALLOC_STATS_FULLNESS_BINS == alps::kSlabFullnessBins, "pmalloc_stats_t fullness bins");
+
+/*
+ * Collects the occupancy of the shared and per-thread slab heaps and the 
+ * free space of the extent heaps. Each slab heap is locked in turn, so the
+ * totals are not a single point in time.
+ */
+void Heap::stats(pmalloc_stats_t* st)
+{
+    SlabHeap_t::Stats sst;
+    ExtentHeap_t::FreeSpaceStats est;
+
+    memset(st, 0, sizeof(*st));
+    memset(&sst, 0, sizeof(sst));
+    memset(&est, 0, sizeof(est));
+    for (int n=0; n<nnodes_; n++) {
+        slheap_[n]->add_stats(&sst);
+        exheap_[n]->add_free_space_stats(&est);
+    }
+
+    pthread_mutex_lock(&threadheaps_mutex_);
+    std::list<ThreadHeap*> all(threadheaps_);
+    for (int n=0; n<nnodes_; n++) {
+        all.insert(all.end(), retired_threadheaps_[n].begin(), retired_threadheaps_[n].end());
+    }
+    for (std::list<ThreadHeap*>::iterator it = all.begin(); it != all.end(); it++) {
+        (*it)->slabheap()->add_stats(&sst);
+        st->mallocs += (*it)->mallocs();
+        st->frees += (*it)->frees();
+    }
+    pthread_mutex_unlock(&threadheaps_mutex_);
+
+    st->heap_bytes = est.total;
+    st->free_bytes = est.free;
+    st->free_extents = est.free_extents;
+    st->largest_free_bytes = est.largest_free;
+    st->slab_bytes = sst.slab_bytes;
+    st->big_bytes = est.total - est.free - sst.slab_bytes;
+    st->empty_slabs = sst.empty_slabs;
+    st->unmapped_slabs = sst.unmapped_slabs;
+    for (int i=0; i<PMALLOC_STATS_FULLNESS_BINS; i++) {
+        st->fullness_bins[i] = sst.fullness_bins[i];
+    }
+    for (int c=0; c<PMALLOC_STATS_SIZECLASSES; c++) {
+        st->sizeclass[c].block_size = alps::size_from_class(c);
+        st->sizeclass[c].slabs = sst.slabs[c];
+        st->sizeclass[c].blocks_in_use = sst.blocks_in_use[c];
+    }
+}
+
+static int discard_region(void* addr, size_t size, void* arg)
+{
+    return m_pdiscard(addr, size);
+}
+
+/*
+ * Punches holes in the backing stores under the free extents of every 
+ * node, after the rebalancer returned the empty slabs it could. Returns 
+ * the number of bytes discarded.
+ */
+size_t Heap::discard_free()
+{
+    size_t discarded = 0;
+
+    for (int n=0; n<nnodes_; n++) {
+        discarded += exheap_[n]->discard_free(discard_region, NULL);
+    }
+    return discarded;
+}
+
+/*
+ * A bulk load keeps the rebalancer out and has the calling thread write the
+ * heap metadata with plain stores, remembering the cachelines it dirties.
+ */
+void Heap::bulk_begin()
+{
+    pthread_mutex_lock(&bulk_mutex_);
+    bulk_lines_.clear();
+    bulk_lines = &bulk_lines_;
+}
+
+// Writes back the dirty lines, merging adjacent ones into a single range, 
+// and fences once: the whole load becomes durable at this point
+void Heap::bulk_end()
+{
+    bulk_lines = NULL;
+    std::sort(bulk_lines_.begin(), bulk_lines_.end());
+    std::vector<uintptr_t>::iterator last = std::unique(bulk_lines_.begin(), bulk_lines_.end());
+    std::vector<uintptr_t>::iterator it = bulk_lines_.begin();
+    while (it != last) {
+        uintptr_t start = *it;
+        uintptr_t end = start + CACHELINE_SIZE;
+        for (it++; it != last && *it == end; it++) {
+            end += CACHELINE_SIZE;
+        }
+        m_pflush((const void*) start, end - start);
+    }
+    m_pfence();
+    bulk_lines_.clear();
+    bulk_lines_.shrink_to_fit();
+    pthread_mutex_unlock(&bulk_mutex_);
+}
+
+/*
+ * Opens the pool called name, creating it in a region of pool_size_mb if 
+ * the pool directory has no such entry. Returns the pool already open 
+ * under that name, or NULL if the name is too long or the directory is 
+ * full. The slab sizes are the ones of the main heap.
+ */
+Pool* Heap::pool_open(const char* name)
+{
+    Context ctx(true, true);
+    int slot = -1;
+
+    if (strlen(name) >= PMALLOC_POOL_NAME_MAX) {
+        return NULL;
+    }
+    pthread_mutex_lock(&pools_mutex_);
+    for (int i=0; i<PMALLOC_MAX_POOLS; i++) {
+        if (PPOOL_DIR[i].base && strcmp(PPOOL_DIR[i].name, name) == 0) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot >= 0 && pools_[slot].load(std::memory_order_relaxed)) {
+        pthread_mutex_unlock(&pools_mutex_);
+        return pools_[slot].load(std::memory_order_relaxed);
+    }
+
+    ExtentHeap_t* exheap;
+    if (slot >= 0) {
+        exheap = ExtentHeap_t::load(PPOOL_DIR[slot].base);
+    } else {
+        for (int i=0; i<PMALLOC_MAX_POOLS && slot < 0; i++) {
+            if (!PPOOL_DIR[i].base) {
+                slot = i;
+            }
+        }
+        if (slot < 0) {
+            pthread_mutex_unlock(&pools_mutex_);
+            return NULL;
+        }
+        size_t size = (size_t) pmalloc_runtime_settings.pool_size_mb << 20;
+        void* region = grow_region(size, (void*) (intptr_t) -1);
+        if (!region) {
+            pthread_mutex_unlock(&pools_mutex_);
+            return NULL;
+        }
+        exheap = ExtentHeap_t::make(region, size, pmalloc_runtime_settings.block_log2size);
+        strcpy(PPOOL_DIR[slot].name, name);
+        m_persist(PPOOL_DIR[slot].name, sizeof(PPOOL_DIR[slot].name));
+        PPOOL_DIR[slot].base = region;
+        m_persist(&PPOOL_DIR[slot].base, sizeof(PPOOL_DIR[slot].base));
+    }
+    if (pmalloc_runtime_settings.region_grow_mb > 0) {
+        exheap->set_grow(grow_region, (void*) (intptr_t) -1, 
+                         (size_t) pmalloc_runtime_settings.region_grow_mb << 20);
+    }
+
+    Pool* pool = new Pool();
+    strcpy(pool->name_, name);
+    pool->slot_ = slot;
+    pool->exheap_ = exheap;
+    pool->slheap_ = new SlabHeap_t(slabsize_, NULL, exheap, false, maxslabsize_);
+    pool->slheap_->init(ctx, pmalloc_runtime_settings.load_threads);
+    pool->hheap_ = new HybridHeap_t(bigsize_, pool->slheap_, exheap);
+    pools_[slot].store(pool, std::memory_order_release);
+    npools_.fetch_add(1);
+    pthread_mutex_unlock(&pools_mutex_);
+    return pool;
+}
+
+/*
+ * Drops the volatile state of a pool. Its objects stay allocated in 
+ * persistent memory, and mapped, until the pool is opened again; they must
+ * not be used or freed meanwhile, and no transaction may be running on 
+ * them.
+ */
+int Heap::pool_close(Pool* pool)
+{
+    pthread_mutex_lock(&pools_mutex_);
+    if (pools_[pool->slot_].load(std::memory_order_relaxed) != pool) {
+        pthread_mutex_unlock(&pools_mutex_);
+        return -1;
+    }
+    pools_[pool->slot_].store(NULL, std::memory_order_release);
+    npools_.fetch_sub(1);
+    pthread_mutex_unlock(&pools_mutex_);
+    delete pool->hheap_;
+    delete pool->slheap_;
+    delete pool->exheap_;
+    delete pool;
+    return 0;
+}
+
+/*
+ * Leak collector. Marking is conservative: any aligned word of a root or 
+ * of a marked object that points into an allocated object, as an address 
+ * or as a persistent pointer offset (see pptr.h), marks the object. Each 
+ * task scans a batch of objects and queues the ones it marks in batches of
+ * its own, which the workpool balances among the threads.
+ */
+static pthread_mutex_t collect_roots_mutex = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<std::pair<uintptr_t, size_t> > collect_roots;
+
+static const size_t kCollectBatch = 256;
+static const size_t kCollectChunk = 1 << 20; // bytes of a root scanned by a task
+
+struct Collector;
+
+struct CollectTask {
+    Collector* c;
+    uintptr_t start;             // root range, if size is not 0
+    size_t size;
+    std::vector<size_t> objects; // indices of marked objects to scan
+};
+
+struct CollectRange {
+    ExtentHeap_t* region;
+    HybridHeap_t* hheap;
+    size_t first;
+    size_t last;
+};
+
+struct Collector {
+    m_workpool_t* pool;
+    std::vector<CollectRange> ranges;
+    std::vector<std::vector<std::pair<uintptr_t, size_t> > > found; // objects found in each range
+    std::vector<uintptr_t> starts;           // allocated objects, sorted
+    std::vector<size_t> sizes;
+    std::vector<HybridHeap_t*> hheaps;
+    std::atomic<uint8_t>* marks;
+    std::vector<uintptr_t> region_bases;
+    std::vector<std::pair<uintptr_t, size_t> > roots;
+
+    // Index of the object addr points into, or -1
+    ssize_t find(uintptr_t addr)
+    {
+        if (starts.empty() || addr < starts.front()) {
+            return -1;
+        }
+        size_t i = std::upper_bound(starts.begin(), starts.end(), addr) - starts.begin() - 1;
+        return addr < starts[i] + sizes[i] ? (ssize_t) i : -1;
+    }
+
+    void submit(CollectTask* task);
+    void mark(uintptr_t addr, std::vector<size_t>** batch);
+    void scan(uintptr_t start, size_t size, std::vector<size_t>** batch);
+};
+
+static void collect_task_main(void* arg)
+{
+    CollectTask* task = reinterpret_cast<CollectTask*>(arg);
+    Collector* c = task->c;
+    std::vector<size_t>* batch = NULL;
+
+    if (task->size) {
+        c->scan(task->start, task->size, &batch);
+    }
+    for (size_t i=0; i<task->objects.size(); i++) {
+        size_t o = task->objects[i];
+        c->scan(c->starts[o], c->sizes[o], &batch);
+    }
+    if (batch) {
+        CollectTask* next = new CollectTask();
+        next->c = c;
+        next->size = 0;
+        next->objects.swap(*batch);
+        delete batch;
+        c->submit(next);
+    }
+    delete task;
+}
+
+// Runs the task in place if it cannot be queued
+void Collector::submit(CollectTask* task)
+{
+    if (m_workpool_submit(pool, collect_task_main, task) != M_R_SUCCESS) {
+        collect_task_main(task);
+    }
+}
+
+void Collector::mark(uintptr_t addr, std::vector<size_t>** batch)
+{
+    ssize_t o = find(addr);
+    if (o < 0 || marks[o].exchange(1, std::memory_order_relaxed)) {
+        return;
+    }
+    if (!*batch) {
+        *batch = new std::vector<size_t>();
+    }
+    (*batch)->push_back(o);
+    if ((*batch)->size() == kCollectBatch) {
+        CollectTask* task = new CollectTask();
+        task->c = this;
+        task->size = 0;
+        task->objects.swap(**batch);
+        submit(task);
+    }
+}
+
+void Collector::scan(uintptr_t start, size_t size, std::vector<size_t>** batch)
+{
+    uintptr_t* w = reinterpret_cast<uintptr_t*>((start + sizeof(uintptr_t) - 1) & ~(sizeof(uintptr_t) - 1));
+    uintptr_t* end = reinterpret_cast<uintptr_t*>((start + size) & ~(sizeof(uintptr_t) - 1));
+
+    for (; w < end; w++) {
+        uintptr_t v = *w;
+        if (v == 0) {
+            continue;
+        }
+        mark(v, batch);
+        if (v < PSEGMENT_RESERVED_REGION_SIZE) {
+            mark(m_pregion_base + v, batch);
+        }
+    }
+}
+
+// Lists the allocated objects of one range of region blocks: big objects 
+// and the allocated blocks of slabs, per their non-volatile block maps
+static void collect_find_worker(void* arg, int i)
+{
+    Collector* c = reinterpret_cast<Collector*>(arg);
+    CollectRange& r = c->ranges[i];
+    std::vector<std::pair<uintptr_t, size_t> >& found = c->found[i];
+    Context ctx(false, false);
+
+    r.region->for_each_extent(r.first, r.last, [&](alps::TPtr<void> extent, size_t size, bool slab) {
+        if (!slab) {
+            found.push_back(std::make_pair((uintptr_t) extent.get(), size));
+            return;
+        }
+        alps::nvSlab<Context, alps::TPtr>* nvslab = 
+            reinterpret_cast<alps::nvSlab<Context, alps::TPtr>*>(extent.get());
+        // A slab extent whose header was never initialized holds nothing
+        if (nvslab->nblocks() == 0 || nvslab->block_offset(nvslab->nblocks()) > size) {
+            return;
+        }
+        for (size_t g=0; g<(nvslab->nblocks() + 63) / 64; g++) {
+            uint64_t mask = nvslab->alloc_group(ctx, g);
+            while (mask) {
+                size_t bid = g * 64 + __builtin_ctzll(mask);
+                mask &= mask - 1;
+                if (bid < nvslab->nblocks()) {
+                    found.push_back(std::make_pair((uintptr_t) nvslab->block(bid).get(), 
+                                                   nvslab->block_size()));
+                }
+            }
+        }
+    });
+}
+
+static void collect_segment(void* start, size_t size, void* arg)
+{
+    Collector* c = reinterpret_cast<Collector*>(arg);
+    if (!std::binary_search(c->region_bases.begin(), c->region_bases.end(), (uintptr_t) start)) {
+        c->roots.push_back(std::make_pair((uintptr_t) start, size));
+    }
+}
+
+void Heap::collect_add_regions(Collector* c, ExtentHeap_t* exheap, HybridHeap_t* hheap, int nthreads)
+{
+    for (ExtentHeap_t* r = exheap; r; r = r->next_region()) {
+        c->region_bases.push_back((uintptr_t) r->region_base());
+        for (int t=0; t<nthreads; t++) {
+            CollectRange range;
+            range.region = r;
+            range.hheap = hheap;
+            range.first = r->nblocks() * t / nthreads;
+            range.last = r->nblocks() * (t + 1) / nthreads;
+            c->ranges.push_back(range);
+        }
+    }
+}
+
+/*
+ * Frees the objects of the heap and of all its pools that are reachable 
+ * neither from a persistent segment outside the heap nor from a root 
+ * registered with collect_root. Opens every pool of the directory. Must 
+ * run with no other thread using the heap or running transactions, and 
+ * with the committed stores written back (mtm_sync). Returns the number 
+ * of unreachable objects, freed unless dry_run, and their size in bytes.
+ */
+long Heap::collect(int nthreads, bool dry_run, size_t* freed_bytes)
+{
+    Collector c;
+    long nleaked = 0;
+    size_t leaked_bytes = 0;
+
+    for (int i=0; i<PMALLOC_MAX_POOLS; i++) {
+        if (PPOOL_DIR[i].base) {
+            pool_open(PPOOL_DIR[i].name);
+        }
+    }
+    pthread_mutex_lock(&bulk_mutex_);
+    nthreads = std::max(nthreads, 1);
+    if (m_workpool_create(&c.pool, nthreads - 1) != M_R_SUCCESS) {
+        pthread_mutex_unlock(&bulk_mutex_);
+        return -1;
+    }
+
+    // Allocated objects, from the non-volatile extent headers and block maps
+    for (int n=0; n<nnodes_; n++) {
+        collect_add_regions(&c, exheap_[n], hheap_[n], nthreads);
+    }
+    pthread_mutex_lock(&pools_mutex_);
+    for (int i=0; i<PMALLOC_MAX_POOLS; i++) {
+        Pool* pool = pools_[i].load(std::memory_order_relaxed);
+        if (pool) {
+            collect_add_regions(&c, pool->exheap_, pool->hheap_, nthreads);
+        }
+    }
+    pthread_mutex_unlock(&pools_mutex_);
+    c.found.resize(c.ranges.size());
+    m_workpool_parallel_for(c.pool, c.ranges.size(), collect_find_worker, &c);
+
+    // The ranges are in address order within each region, so sorting the 
+    // ranges by their first object sorts the objects
+    std::vector<size_t> order;
+    for (size_t i=0; i<c.ranges.size(); i++) {
+        if (!c.found[i].empty()) {
+            order.push_back(i);
+        }
+    }
+    std::sort(order.begin(), order.end(), [&c](size_t a, size_t b) {
+        return c.found[a].front().first < c.found[b].front().first;
+    });
+    for (size_t k=0; k<order.size(); k++) {
+        size_t i = order[k];
+        for (size_t j=0; j<c.found[i].size(); j++) {
+            c.starts.push_back(c.found[i][j].first);
+            c.sizes.push_back(c.found[i][j].second);
+            c.hheaps.push_back(c.ranges[i].hheap);
+        }
+        std::vector<std::pair<uintptr_t, size_t> >().swap(c.found[i]);
+    }
+    c.marks = new std::atomic<uint8_t>[c.starts.size()];
+    for (size_t i=0; i<c.starts.size(); i++) {
+        c.marks[i].store(0, std::memory_order_relaxed);
+    }
+
+    // Mark from the persistent segments that are not heap regions, split 
+    // into chunks, and from the registered roots
+    std::sort(c.region_bases.begin(), c.region_bases.end());
+    m_segment_foreach(collect_segment, &c);
+    pthread_mutex_lock(&collect_roots_mutex);
+    c.roots.insert(c.roots.end(), collect_roots.begin(), collect_roots.end());
+    pthread_mutex_unlock(&collect_roots_mutex);
+    for (size_t i=0; i<c.roots.size(); i++) {
+        m_segment_touch((void*) c.roots[i].first);
+        for (size_t off=0; off<c.roots[i].second; off+=kCollectChunk) {
+            CollectTask* task = new CollectTask();
+            task->c = &c;
+            task->start = c.roots[i].first + off;
+            task->size = std::min(kCollectChunk, c.roots[i].second - off);
+            c.submit(task);
+        }
+    }
+    m_workpool_wait(c.pool);
+    m_workpool_destroy(c.pool);
+
+    // Sweep, as a bulk load so that the frees take a single fence
+    if (!dry_run) {
+        bulk_lines_.clear();
+        bulk_lines = &bulk_lines_;
+    }
+    Context sweep_ctx(true, true);
+    for (size_t i=0; i<c.starts.size(); i++) {
+        if (c.marks[i].load(std::memory_order_relaxed)) {
+            continue;
+        }
+        nleaked++;
+        leaked_bytes += c.sizes[i];
+        if (!dry_run) {
+            c.hheaps[i]->free(sweep_ctx, (void*) c.starts[i]);
+        }
+    }
+    delete [] c.marks;
+    if (!dry_run) {
+        bulk_end();
+    } else {
+        pthread_mutex_unlock(&bulk_mutex_);
+    }
+    if (freed_bytes) {
+        *freed_bytes = leaked_bytes;
+    }
+    return nleaked;
+}
+
+/*
+ * Registers [addr, addr + size) as a root of collect, such as volatile 
+ * memory holding pointers to persistent objects.
+ */
+void Heap::collect_root(const void* addr, size_t size)
+{
+    pthread_mutex_lock(&collect_roots_mutex);
+    collect_roots.push_back(std::make_pair((uintptr_t) addr, size));
+    pthread_mutex_unlock(&collect_roots_mutex);
+}
+
+/*
+ * Compaction. The relocators are set once and never removed, so the 
+ * compactor reads them without the lock.
+ */
+static pthread_mutex_t relocators_mutex = PTHREAD_MUTEX_INITIALIZER;
+static std::atomic<int> nrelocators(0);
+static pmalloc_relocate_fn_t relocators[PMALLOC_MAX_RELOCATORS];
+static void* relocators_arg[PMALLOC_MAX_RELOCATORS];
+
+int Heap::relocator_register(pmalloc_relocate_fn_t fn, void* arg)
+{
+    pthread_mutex_lock(&relocators_mutex);
+    int n = nrelocators.load(std::memory_order_relaxed);
+    if (n == PMALLOC_MAX_RELOCATORS) {
+        pthread_mutex_unlock(&relocators_mutex);
+        return -1;
+    }
+    relocators[n] = fn;
+    relocators_arg[n] = arg;
+    nrelocators.store(n + 1, std::memory_order_release);
+    pthread_mutex_unlock(&relocators_mutex);
+    return 0;
+}
+
+// An object to move, with the extent it should leave: its slab, or itself
+struct CompactCandidate {
+    void* ptr;
+    uintptr_t extent;
+    size_t extent_size;
+};
+
+/*
+ * Moves the object at ptr, of size bytes, out of [extent, extent + 
+ * extent_size) and below ptr if big, in a transaction of its own. Gives up
+ * if the new copy does not land there or no relocator takes the object. 
+ * The copy needs no logging: the block is new to the transaction, which 
+ * writes it back at commit.
+ */
+static bool relocate(void* ptr, size_t size, uintptr_t extent, size_t extent_size, bool big, Pool* pool)
+{
+    pmalloc_relocate_fn_t fns[PMALLOC_MAX_RELOCATORS];
+    void* args[PMALLOC_MAX_RELOCATORS];
+    int n = nrelocators.load(std::memory_order_acquire);
+    bool moved = false;
+
+    for (int i=0; i<n; i++) {
+        fns[i] = relocators[i];
+        args[i] = relocators_arg[i];
+    }
+    __transaction_atomic {
+        void* to = pool ? pmalloc_from(reinterpret_cast<pmalloc_pool_t*>(pool), size) : pmalloc(size);
+        if (!to) {
+            __transaction_cancel;
+        }
+        if (big ? (uintptr_t) to >= (uintptr_t) ptr 
+                : (uintptr_t) to - extent < extent_size) 
+        {
+            __transaction_cancel;
+        }
+        memcpy(to, ptr, size);
+        int i = 0;
+        while (i < n && !fns[i](ptr, to, size, args[i])) {
+            i++;
+        }
+        if (i == n) {
+            __transaction_cancel;
+        }
+        pfree(ptr);
+        moved = true;
+    }
+    return moved;
+}
+
+/*
+ * Moves the objects of the sparse slabs of a heap or pool, then its big 
+ * objects, until max_bytes have been moved. The candidates are read off 
+ * the non-volatile metadata without locks: the transaction of each move 
+ * holds only if a relocator finds the object live.
+ */
+size_t Heap::compact_heap(ExtentHeap_t* exheap, HybridHeap_t* hheap, Pool* pool, size_t max_bytes)
+{
+    std::vector<CompactCandidate> slab_objects;
+    std::vector<CompactCandidate> big_objects;
+    Context ctx(false, false);
+    size_t moved = 0;
+
+    for (ExtentHeap_t* r = exheap; r; r = r->next_region()) {
+        r->for_each_extent(0, r->nblocks(), [&](alps::TPtr<void> extent, size_t size, bool slab) {
+            CompactCandidate cand;
+            cand.extent = (uintptr_t) extent.get();
+            cand.extent_size = size;
+            if (!slab) {
+                if (size <= PMALLOC_COMPACT_MAX_OBJECT) {
+                    cand.ptr = extent.get();
+                    big_objects.push_back(cand);
+                }
+                return;
+            }
+            alps::nvSlab<Context, alps::TPtr>* nvslab = 
+                reinterpret_cast<alps::nvSlab<Context, alps::TPtr>*>(extent.get());
+            size_t nblocks = nvslab->nblocks();
+            if (nblocks == 0 || nvslab->block_offset(nblocks) > size) {
+                return;
+            }
+            size_t nallocated = 0;
+            for (size_t g=0; g<(nblocks + 63) / 64; g++) {
+                nallocated += __builtin_popcountll(nvslab->alloc_group(ctx, g));
+            }
+            if (nallocated == 0 || nallocated * 100 > nblocks * PMALLOC_COMPACT_SPARSE_PCT) {
+                return;
+            }
+            for (size_t g=0; g<(nblocks + 63) / 64; g++) {
+                uint64_t mask = nvslab->alloc_group(ctx, g);
+                while (mask) {
+                    size_t bid = g * 64 + __builtin_ctzll(mask);
+                    mask &= mask - 1;
+                    if (bid < nblocks) {
+                        cand.ptr = nvslab->block(bid).get();
+                        slab_objects.push_back(cand);
+                    }
+                }
+            }
+        });
+    }
+
+    // A slab that a new copy landed in is taken for allocation again
+    uintptr_t skip_extent = 0;
+    for (size_t i=0; i<slab_objects.size() && moved < max_bytes; i++) {
+        CompactCandidate& cand = slab_objects[i];
+        if (cand.extent == skip_extent) {
+            continue;
+        }
+        size_t size = hheap->getsize(cand.ptr);
+        if (relocate(cand.ptr, size, cand.extent, cand.extent_size, false, pool)) {
+            moved += size;
+        } else {
+            skip_extent = cand.extent;
+        }
+    }
+    for (size_t i=big_objects.size(); i-- > 0 && moved < max_bytes; ) {
+        CompactCandidate& cand = big_objects[i];
+        if (relocate(cand.ptr, cand.extent_size, cand.extent, cand.extent_size, true, pool)) {
+            moved += cand.extent_size;
+        }
+    }
+    return moved;
+}
+
+/*
+ * Moves up to max_bytes of objects of the heap and its open pools that a
+ * registered relocator takes, out of sparse slabs, which then go back to 
+ * the extent heap, and towards the start of the regions. Returns the bytes
+ * moved.
+ */
+size_t Heap::compact(size_t max_bytes)
+{
+    size_t moved = 0;
+
+    if (nrelocators.load(std::memory_order_acquire) == 0) {
+        return 0;
+    }
+    for (int n=0; n<nnodes_ && moved < max_bytes; n++) {
+        moved += compact_heap(exheap_[n], hheap_[n], NULL, max_bytes - moved);
+    }
+    for (int i=0; i<PMALLOC_MAX_POOLS && moved < max_bytes; i++) {
+        Pool* pool = pools_[i].load(std::memory_order_acquire);
+        if (pool) {
+            moved += compact_heap(pool->exheap_, pool->hheap_, pool, max_bytes - moved);
+        }
+    }
+    return moved;
+}
+
+void* Heap::rebalancer_main(void* arg)
+{
+    Heap* heap = reinterpret_cast<Heap*>(arg);
+    unsigned long long discard_ms = (unsigned long long) pmalloc_runtime_settings.discard_interval_s * 1000;
+    unsigned long long since_discard_ms = 0;
+    unsigned long long compact_ms = (unsigned long long) pmalloc_runtime_settings.compact_interval_s * 1000;
+    unsigned long long since_compact_ms = 0;
+
+    while (1) {
+        usleep(PMALLOC_REBALANCE_INTERVAL_MS * 1000);
+        pthread_mutex_lock(&heap->bulk_mutex_);
+        heap->rebalance();
+        if (discard_ms && (since_discard_ms += PMALLOC_REBALANCE_INTERVAL_MS) >= discard_ms) {
+            since_discard_ms = 0;
+            heap->discard_free();
+        }
+        if (compact_ms && (since_compact_ms += PMALLOC_REBALANCE_INTERVAL_MS) >= compact_ms) {
+            since_compact_ms = 0;
+            heap->compact(PMALLOC_COMPACT_PASS_BYTES);
+        }
+        pthread_mutex_unlock(&heap->bulk_mutex_);
+    }
+    return NULL;
+}
+
 void* ThreadHeap::pmalloc(size_t sz)
 {
     Context ctx(true, true);
@@ -76,34 +957,184 @@ void* ThreadHeap::pmalloc(size_t sz)
     if (rc != alps::kErrorCodeOk) {
         return NULL;
     }
+    count(mallocs_);
+    return ptr.get();
+}
+
+void* ThreadHeap::pmalloc_from(Pool* pool, size_t sz)
+{
+    Context ctx(true, true);
+
+    alps::TPtr<void> ptr;
+    alps::ErrorCode rc = pool->hheap_->malloc(ctx, sz, &ptr);
+    if (rc != alps::kErrorCodeOk) {
+        return NULL;
+    }
+    count(mallocs_);
     return ptr.get();
 }
 
+/*
+ * The block is not reachable from persistent data before the allocating 
+ * transaction commits and its contents do not matter if it aborts, so it is 
+ * zeroed with non-temporal stores instead of transactional ones that would
+ * fill the write set. The stores are drained before returning, hence 
+ * before the commit that publishes the block.
+ */
+void* ThreadHeap::pcalloc(size_t nelem, size_t elsize)
+{
+    if (elsize && nelem > SIZE_MAX / elsize) {
+        return NULL;
+    }
+    size_t sz = nelem * elsize;
+    void* ptr = pmalloc(sz);
+    if (!ptr) {
+        return NULL;
+    }
+
+    pcm_storeset_t* set = pcm_storeset_get();
+    pcm_word_t* word = reinterpret_cast<pcm_word_t*>(ptr);
+    for (size_t i=0; i<(sz + sizeof(pcm_word_t) - 1) / sizeof(pcm_word_t); i++) {
+        PCM_NT_STORE(set, (volatile pcm_word_t *) &word[i], 0);
+    }
+    PCM_NT_FLUSH(set);
+    return ptr;
+}
+
+/*
+ * Small objects already fit their slab block or cannot grow; big objects
+ * grow by taking over the free extent blocks that follow them. The extent
+ * is not shrunk back if the transaction aborts.
+ */
+void* ThreadHeap::prealloc_inplace(void* ptr, size_t sz)
+{
+    Context ctx(true, true);
+
+    if (hheap(ptr)->extend(ctx, ptr, sz) != alps::kErrorCodeOk) {
+        return NULL;
+    }
+    return ptr;
+}
+
+// The block goes back to the block cache it came from. The transaction 
+// that allocated it does not commit, so its refill is dropped too.
 void ThreadHeap::pmalloc_undo(void* ptr) 
 {
     Context ctx(true, false);
     
-    hheap_->free(ctx, ptr);
+    hheap(ptr)->free(ctx, ptr);
+    count(frees_);
+    refill_classes_.reset();
 }
 
 void ThreadHeap::pfree_prepare(void* ptr) 
 {
     Context ctx(false, true);
     
-    hheap_->free(ctx, ptr);
+    hheap(ptr)->free(ctx, ptr);
 }
 
 void ThreadHeap::pfree_commit(void* ptr) 
 {
     Context ctx(true, false);
     
-    hheap_->free(ctx, ptr);
+    hheap(ptr)->free(ctx, ptr);
+    count(frees_);
 }
 
+/*
+ * Transactional frees are batched until the transaction commits, when 
+ * pfree_flush marks them free in the non-volatile block maps all at 
+ * once; pfree_commit still returns each one to the volatile free lists 
+ * after the commit. Returns whether ptr starts a new batch.
+ */
+bool ThreadHeap::pfree_defer(void* ptr)
+{
+    deferred_frees_.push_back(ptr);
+    return deferred_frees_.size() == 1;
+}
+
+// Drops ptr from the batch when its free is rolled back; a batch already 
+// flushed by a commit that then failed is gone
+void ThreadHeap::pfree_cancel(void* ptr)
+{
+    if (!deferred_frees_.empty() && deferred_frees_.back() == ptr) {
+        deferred_frees_.pop_back();
+        return;
+    }
+    std::vector<void*>::iterator it = std::find(deferred_frees_.begin(), deferred_frees_.end(), ptr);
+    if (it != deferred_frees_.end()) {
+        deferred_frees_.erase(it);
+    }
+}
+
+// Sorting the batch by address lets blocks that share a slab and a word 
+// of its block map be marked free with a single transactional store
+void ThreadHeap::pfree_flush()
+{
+    Context ctx(false, true);
+
+    std::sort(deferred_frees_.begin(), deferred_frees_.end());
+    std::vector<void*>::iterator it = deferred_frees_.begin();
+    while (it != deferred_frees_.end()) {
+        it = hheap(*it)->free_batch(ctx, it, deferred_frees_.end());
+    }
+    deferred_frees_.clear();
+}
+
+/*
+ * Allocations inside a transaction are served from the block caches, 
+ * which refill under the slab heap lock (and maybe the parent's and the 
+ * extent heap's) when they run dry, while the transaction holds its write
+ * locks. Instead the caches of the sizeclasses a transaction allocated 
+ * are topped up after it commits, so that the next transaction finds 
+ * them full. Returns whether sz is the first such size of the 
+ * transaction, which then needs to refill at commit.
+ */
+bool ThreadHeap::refill_defer(size_t sz)
+{
+    if (sz >= hheap_->bigsize()) {
+        return false;
+    }
+    bool first = refill_classes_.none();
+    refill_classes_.set(alps::sizeclass(sz));
+    return first;
+}
+
+void ThreadHeap::refill()
+{
+    Context ctx(true, true);
+
+    for (int c=0; c<alps::kSizeClasses && refill_classes_.any(); c++) {
+        if (refill_classes_.test(c)) {
+            slheap_->fill_cache(ctx, c);
+            refill_classes_.reset(c);
+        }
+    }
+}
 
 size_t ThreadHeap::getsize(void* ptr)
 {
     Context ctx(true, true);
 
-    return hheap_->getsize(ptr);
+    return hheap(ptr)->getsize(ptr);
+}
+
+void ThreadHeap::release()
+{
+    Context ctx(true, true);
+
+    slheap_->release(ctx);
+}
+
+size_t ThreadHeap::trim_if_idle()
+{
+    Context ctx(true, true);
+
+    uint64_t epoch = slheap_->epoch();
+    if (epoch != last_epoch_) {
+        last_epoch_ = epoch;
+        return 0;
+    }
+    return slheap_->trim(ctx);
 }
@@ -1,30 +1,52 @@
 #ifndef _MNEMOSYNE_HEAP_HEAP_HH
 #define _MNEMOSYNE_HEAP_HEAP_HH
 
+#include <pthread.h>
+
+#include <atomic>
+#include <bitset>
+#include <list>
+#include <vector>
+
 #include <alps/layers/pointer.hh>
 #include <alps/layers/slabheap.hh>
 #include <alps/layers/extentheap.hh>
 #include <alps/layers/hybridheap.hh>
 
 #include <mnemosyne.h>
+#include <pmalloc.h>
 #include <mtm.h>
 #include <mtm_i.h>
 #include <itm.h>
 
 extern "C" void _ITM_nl_load_bytes(const void *src, void *dest, size_t size);
 extern "C" void _ITM_nl_store_bytes(const void *src, void *dest, size_t size);
+extern "C" uint64_t _ITM_nl_load_word(const uint64_t *src);
+extern "C" void _ITM_nl_store_word(uint64_t *dest, uint64_t value, uint64_t mask);
+
+/* 
+ * Cachelines of heap metadata written with plain stores by the running bulk
+ * load, written back all at once by pmalloc_bulk_end; NULL outside bulk 
+ * loads. Only the loading thread uses the heap meanwhile.
+ */
+extern std::vector<uintptr_t>* bulk_lines;
 
 class Context {
 public:
     Context(bool _do_v = true, bool _do_nv = true)
         : do_v(_do_v),
-          do_nv(_do_nv)
-    { 
-        if (_ITM_inTransaction()) {
-            td = _ITM_getTransaction();
-        } else {
-            td = NULL;
-        }
+          do_nv(_do_nv),
+          td(bulk_lines ? NULL : current_transaction()),
+          bulk(bulk_lines)
+    { }
+
+    // The running transaction of the thread, if any, read straight off the
+    // descriptor: a single TLS load rather than calls to _ITM_inTransaction
+    // and _ITM_getTransaction on every heap operation
+    static _ITM_transaction* current_transaction()
+    {
+        mtm_tx_t* tx = mtm_get_tx();
+        return (tx && tx->status != TX_IDLE) ? tx : NULL;
     }
 
     void load(uint8_t* src, uint8_t *dest, size_t size)
@@ -42,6 +64,30 @@ public:
             _ITM_nl_store_bytes(src, dest, size);
         } else {
             memcpy(dest, src, size);
+            if (bulk) {
+                mark_dirty(dest, size);
+            }
+        }
+    }
+
+    uint64_t load_word(uint64_t* src)
+    {
+        if (td) {
+            return _ITM_nl_load_word(src);
+        }
+        return *src;
+    }
+
+    //! Stores the bytes of value selected by mask, which must cover whole bytes
+    void store_word(uint64_t* dest, uint64_t value, uint64_t mask)
+    {
+        if (td) {
+            _ITM_nl_store_word(dest, value, mask);
+        } else {
+            *dest = (*dest & ~mask) | (value & mask);
+            if (bulk) {
+                mark_dirty(dest, sizeof(*dest));
+            }
         }
     }
 
@@ -49,40 +95,190 @@ public:
     bool do_nv;
 
     _ITM_transaction * td;
+    std::vector<uintptr_t>* bulk;
+
+private:
+    // Consecutive stores mostly hit the same line, so only a change of line is recorded
+    void mark_dirty(void* dest, size_t size)
+    {
+        uintptr_t end = (uintptr_t) dest + size;
+        for (uintptr_t line = (uintptr_t) dest & ~((uintptr_t) CACHELINE_SIZE - 1); 
+             line < end; line += CACHELINE_SIZE) 
+        {
+            if (bulk->empty() || bulk->back() != line) {
+                bulk->push_back(line);
+            }
+        }
+    }
 };
 
 typedef alps::SlabHeap<Context, alps::TPtr, alps::PPtr> SlabHeap_t;
 typedef alps::ExtentHeap<Context, alps::TPtr, alps::PPtr> ExtentHeap_t;
 typedef alps::HybridHeap<Context, alps::TPtr, alps::PPtr, SlabHeap_t, ExtentHeap_t> HybridHeap_t;
 
+/* Maximum number of NUMA nodes with their own extent heap */
+#define PMALLOC_MAX_NODES 8
+
+/* Maximum number of pools, and length of their names */
+#define PMALLOC_MAX_POOLS 64
+#define PMALLOC_POOL_NAME_MAX 48
+
+/* Maximum number of relocators registered for compaction */
+#define PMALLOC_MAX_RELOCATORS 16
+
+class Heap;
+
+/*
+ * A pool is a heap of its own, an extent heap with a shared slab heap on 
+ * top, in regions of its own. All threads allocate from it through the 
+ * shared heaps, which lock.
+ */
+class Pool
+{
+public:
+    char name_[PMALLOC_POOL_NAME_MAX];
+    int slot_; // entry of the pool directory
+    ExtentHeap_t* exheap_;
+    SlabHeap_t* slheap_;
+    HybridHeap_t* hheap_;
+};
+
 class ThreadHeap
 {
 public:
-    ThreadHeap(HybridHeap_t* hheap)
-        : hheap_(hheap)
+    ThreadHeap(HybridHeap_t* hheap, SlabHeap_t* slheap, Heap* heap, int node)
+        : hheap_(hheap),
+          slheap_(slheap),
+          heap_(heap),
+          node_(node),
+          last_epoch_(0),
+          mallocs_(0),
+          frees_(0)
     { }
 
     void* pmalloc(size_t sz);
+    void* pmalloc_from(Pool* pool, size_t sz);
+    void* pcalloc(size_t nelem, size_t elsize);
+    void* prealloc_inplace(void* ptr, size_t sz);
     void pmalloc_undo(void* ptr);
     void pfree_prepare(void* ptr);
     void pfree_commit(void* ptr);
+    bool pfree_defer(void* ptr);
+    void pfree_cancel(void* ptr);
+    void pfree_flush();
+    bool refill_defer(size_t sz);
+    void refill();
     size_t getsize(void* ptr);
+    void release();
+    size_t trim_if_idle();
+    int node() { return node_; }
+    SlabHeap_t* slabheap() { return slheap_; }
+    uint64_t mallocs() { return mallocs_.load(std::memory_order_relaxed); }
+    uint64_t frees() { return frees_.load(std::memory_order_relaxed); }
 
 private:
+    HybridHeap_t* hheap(void* ptr);
+
+    // Only the heap's thread counts, so a relaxed increment is enough
+    static void count(std::atomic<uint64_t>& counter)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
     HybridHeap_t* hheap_;
+    SlabHeap_t* slheap_;
+    Heap* heap_;
+    int node_; // NUMA node whose extent heap this heap allocates from
+    uint64_t last_epoch_; // slab heap epoch seen by the last trim_if_idle
+    std::vector<void*> deferred_frees_; // frees of the running transaction, applied at its commit
+    std::bitset<alps::kSizeClasses> refill_classes_; // sizeclasses the running transaction allocated, refilled at its commit
+    std::atomic<uint64_t> mallocs_;
+    std::atomic<uint64_t> frees_;
 };
 
+struct Collector;
+
 class Heap {
 public:
 
     int init();
     ThreadHeap* threadheap();
+    void retire_threadheap(ThreadHeap* thp);
+    void rebalance();
+    size_t discard_free();
+    void stats(pmalloc_stats_t* st);
+    void bulk_begin();
+    void bulk_end();
+    Pool* pool_open(const char* name);
+    int pool_close(Pool* pool);
+    long collect(int nthreads, bool dry_run, size_t* freed_bytes);
+    static void collect_root(const void* addr, size_t size);
+    static int relocator_register(pmalloc_relocate_fn_t fn, void* arg);
+    size_t compact(size_t max_bytes);
+
+    // Heap of the open pool ptr belongs to, if any
+    HybridHeap_t* pool_hheap(void* ptr)
+    {
+        if (npools_.load(std::memory_order_acquire) == 0) {
+            return NULL;
+        }
+        for (int i=0; i<PMALLOC_MAX_POOLS; i++) {
+            Pool* pool = pools_[i].load(std::memory_order_acquire);
+            if (pool && pool->exheap_->contains(ptr)) {
+                return pool->hheap_;
+            }
+        }
+        return NULL;
+    }
+
+    int node(void* ptr)
+    {
+        for (int n=1; n<nnodes_; n++) {
+            if (exheap_[n]->contains(ptr)) {
+                return n;
+            }
+        }
+        return 0;
+    }
+
+    HybridHeap_t* node_hheap(int node) { return hheap_[node]; }
 
 private:
-    ExtentHeap_t* exheap_;
-    SlabHeap_t* slheap_;
+    static void* rebalancer_main(void* arg);
+    void collect_add_regions(Collector* c, ExtentHeap_t* exheap, HybridHeap_t* hheap, int nthreads);
+    size_t compact_heap(ExtentHeap_t* exheap, HybridHeap_t* hheap, Pool* pool, size_t max_bytes);
+
+    // One extent heap, with a shared slab heap on top, per NUMA node. 
+    // hheap_ serves frees of blocks of a node other than the thread's.
+    int nnodes_;
+    ExtentHeap_t* exheap_[PMALLOC_MAX_NODES];
+    SlabHeap_t* slheap_[PMALLOC_MAX_NODES];
+    HybridHeap_t* hheap_[PMALLOC_MAX_NODES];
     size_t bigsize_;
     size_t slabsize_;
+    size_t maxslabsize_;
+
+    pthread_mutex_t threadheaps_mutex_;
+    std::list<ThreadHeap*> threadheaps_; // heaps of live threads
+    std::list<ThreadHeap*> retired_threadheaps_[PMALLOC_MAX_NODES]; // released, ready for reuse
+    pthread_t rebalancer_;
+    pthread_mutex_t bulk_mutex_; // held by a rebalancer pass and for the whole of a bulk load
+    std::vector<uintptr_t> bulk_lines_;
+
+    // Open pools, by directory entry; opened and closed under pools_mutex_
+    pthread_mutex_t pools_mutex_;
+    std::atomic<int> npools_;
+    std::atomic<Pool*> pools_[PMALLOC_MAX_POOLS];
 };
 
+inline HybridHeap_t* ThreadHeap::hheap(void* ptr)
+{
+    HybridHeap_t* pool_hheap = heap_->pool_hheap(ptr);
+    if (pool_hheap) {
+        return pool_hheap;
+    }
+    int node = heap_->node(ptr);
+    return node == node_ ? hheap_ : heap_->node_hheap(node);
+}
+
 #endif // _MNEMOSYNE_HEAP_HEAP_HH
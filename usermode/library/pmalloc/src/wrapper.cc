@@ -1,6 +1,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <atomic>
 #include <mutex>
 
 #include "heap.hh"
@@ -9,20 +10,31 @@
 #include <itm.h>
 
 thread_local ThreadHeap* threadheap = NULL;
-static Heap* heap;
-std::mutex heapmtx;
+static std::atomic<Heap*> heap(NULL);
+static std::once_flag heapflag;
+static pthread_key_t threadheapkey;
+
+static void releaseThreadHeap (void* arg)
+{
+    heap.load(std::memory_order_acquire)->retire_threadheap(reinterpret_cast<ThreadHeap*>(arg));
+}
+
+static void initHeap (void)
+{
+    Heap* h = new Heap();
+    h->init();
+    pthread_key_create(&threadheapkey, releaseThreadHeap);
+    heap.store(h, std::memory_order_release);
+}
 
 inline static Heap * getHeap (void) 
 {
-    heapmtx.lock();
-    if (heap) {
-        heapmtx.unlock();
-        return heap;
+    Heap* h = heap.load(std::memory_order_acquire);
+    if (h) {
+        return h;
     }
-    heap = new Heap();
-    heap->init();
-    heapmtx.unlock();
-    return heap;
+    std::call_once(heapflag, initHeap);
+    return heap.load(std::memory_order_acquire);
 }
 
 inline static ThreadHeap* getThreadHeap (void)
@@ -32,6 +44,7 @@ inline static ThreadHeap* getThreadHeap (void)
     }
     Heap* heap = getHeap();
     threadheap = heap->threadheap();
+    pthread_setspecific(threadheapkey, threadheap);
     return threadheap;
 }
 
@@ -46,6 +59,13 @@ void * mtm_pmalloc (size_t sz)
 	return addr;
 }
 
+extern "C"
+void * mtm_pmalloc_from (void* pool, size_t sz)
+{
+    ThreadHeap* heap = getThreadHeap();
+    return heap->pmalloc_from(reinterpret_cast<Pool*>(pool), sz);
+}
+
 extern "C"
 void mtm_pmalloc_undo (void* ptr)
 {
@@ -57,10 +77,8 @@ void mtm_pmalloc_undo (void* ptr)
 extern "C"
 void * mtm_pcalloc (size_t nelem, size_t elsize)
 {
-    void* addr;
-    // TODO
-
-	return addr;
+    ThreadHeap* heap = getThreadHeap();
+    return heap->pcalloc(nelem, elsize);
 }
 
 
@@ -87,6 +105,149 @@ void mtm_pfree_commit (void* ptr)
     heap->pfree_commit(ptr);
 }
 
+extern "C"
+int mtm_pfree_defer (void* ptr)
+{
+    ThreadHeap* heap = getThreadHeap();
+    return heap->pfree_defer(ptr);
+}
+
+extern "C"
+void mtm_pfree_cancel (void* ptr)
+{
+    ThreadHeap* heap = getThreadHeap();
+    heap->pfree_cancel(ptr);
+}
+
+extern "C"
+void mtm_pfree_flush (void* arg)
+{
+    ThreadHeap* heap = getThreadHeap();
+    heap->pfree_flush();
+}
+
+extern "C"
+int mtm_pmalloc_refill_defer (size_t sz)
+{
+    ThreadHeap* heap = getThreadHeap();
+    return heap->refill_defer(sz);
+}
+
+extern "C"
+void mtm_pmalloc_refill (void* arg)
+{
+    ThreadHeap* heap = getThreadHeap();
+    heap->refill();
+}
+
+extern "C"
+pmalloc_pool_t* m_pool_open (const char* name)
+{
+    return reinterpret_cast<pmalloc_pool_t*>(getHeap()->pool_open(name));
+}
+
+extern "C"
+int m_pool_close (pmalloc_pool_t* pool)
+{
+    return getHeap()->pool_close(reinterpret_cast<Pool*>(pool));
+}
+
+extern "C"
+size_t pmalloc_discard_free (void)
+{
+    return getHeap()->discard_free();
+}
+
+extern "C"
+void pmalloc_bulk_begin (void)
+{
+    getHeap()->bulk_begin();
+}
+
+extern "C"
+void pmalloc_bulk_end (void)
+{
+    getHeap()->bulk_end();
+}
+
+extern "C"
+long pmalloc_collect (int nthreads, int dry_run, size_t* freed_bytes)
+{
+    return getHeap()->collect(nthreads, dry_run, freed_bytes);
+}
+
+extern "C"
+void pmalloc_collect_root (const void* addr, size_t size)
+{
+    Heap::collect_root(addr, size);
+}
+
+extern "C"
+int pmalloc_relocator_register (pmalloc_relocate_fn_t fn, void* arg)
+{
+    return Heap::relocator_register(fn, arg);
+}
+
+extern "C"
+size_t pmalloc_compact (size_t max_bytes)
+{
+    return getHeap()->compact(max_bytes);
+}
+
+extern "C"
+int pmalloc_stats (pmalloc_stats_t* stats)
+{
+    Heap* h = heap.load(std::memory_order_acquire);
+    if (!h) {
+        return -1;
+    }
+    h->stats(stats);
+    return 0;
+}
+
+/*
+ * Fragmentation is the share of the free space outside the largest free 
+ * extent: the larger it is, the more a big allocation may fail or grow the
+ * heap despite enough free space in total.
+ */
+extern "C"
+void pmalloc_stats_print (FILE* fout)
+{
+    pmalloc_stats_t st;
+
+    if (pmalloc_stats(&st) != 0) {
+        return;
+    }
+    fprintf(fout, "PERSISTENT HEAP\n\n");
+    fprintf(fout, "%-24s%llu\n", "Heap bytes", (unsigned long long) st.heap_bytes);
+    fprintf(fout, "%-24s%llu in %llu extents, largest %llu, fragmentation %.1f%%\n", "Free bytes",
+            (unsigned long long) st.free_bytes, (unsigned long long) st.free_extents,
+            (unsigned long long) st.largest_free_bytes, 
+            st.free_bytes ? 100.0 * (st.free_bytes - st.largest_free_bytes) / st.free_bytes : 0.0);
+    fprintf(fout, "%-24s%llu\n", "Slab bytes", (unsigned long long) st.slab_bytes);
+    fprintf(fout, "%-24s%llu\n", "Big object bytes", (unsigned long long) st.big_bytes);
+    fprintf(fout, "%-24s", "Slabs by fullness");
+    for (int i=0; i<PMALLOC_STATS_FULLNESS_BINS; i++) {
+        fprintf(fout, "%llu ", (unsigned long long) st.fullness_bins[i]);
+    }
+    fprintf(fout, "(%llu empty, %llu unmapped)\n", 
+            (unsigned long long) st.empty_slabs, (unsigned long long) st.unmapped_slabs);
+    fprintf(fout, "%-24s%llu mallocs, %llu frees\n\n", "Operations",
+            (unsigned long long) st.mallocs, (unsigned long long) st.frees);
+    fprintf(fout, "%10s%12s%10s%14s%16s\n", "Sizeclass", "BlockSize", "Slabs", "BlocksInUse", "BytesInUse");
+    for (int c=0; c<PMALLOC_STATS_SIZECLASSES; c++) {
+        if (st.sizeclass[c].slabs == 0) {
+            continue;
+        }
+        fprintf(fout, "%10d%12llu%10llu%14llu%16llu\n", c, 
+                (unsigned long long) st.sizeclass[c].block_size,
+                (unsigned long long) st.sizeclass[c].slabs,
+                (unsigned long long) st.sizeclass[c].blocks_in_use,
+                (unsigned long long) (st.sizeclass[c].blocks_in_use * st.sizeclass[c].block_size));
+    }
+    fprintf(fout, "\n");
+}
+
 extern "C"
 size_t mtm_get_obj_size(void *ptr)
 {
@@ -94,9 +255,12 @@ size_t mtm_get_obj_size(void *ptr)
     return heap->getsize(ptr);
 }
 
+/*
+ * Resizes ptr in place; returns ptr on success and NULL if the object 
+ * cannot grow where it is, in which case the caller must move it.
+ */
 extern "C" void * mtm_prealloc (void * ptr, size_t sz)
 {
-    //TODO
-
-	return NULL;
+    ThreadHeap* heap = getThreadHeap();
+    return heap->prealloc_inplace(ptr, sz);
 }
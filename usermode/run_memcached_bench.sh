@@ -0,0 +1,329 @@
+#!/bin/bash
+#meant to be run from mnemosyne-gcc/usermode/
+#
+# End-to-end comparison of memcached-1.2.4-base and memcached-1.2.4-mtm
+# under memslap. Every run starts a fresh server on a reset persistent
+# heap, loads it for a fixed time with a fixed key/value size mix, and
+# appends one CSV record: ops/s, P99 latency (upper edge of the memslap
+# log2 bucket, in us) and, for mtm servers built with --build-stats, the
+# bytes written to persistent memory by transactions and the log.
+#
+#   scons --build-bench=memcached [--build-stats]
+#   ./run_memcached_bench.sh -s "base mtm" -t "1 2 4" -f "clflushopt clwb"
+#
+# With -W, each mtm run measures a warm restart instead: the server is
+# filled with -n sets and a probe key, killed with SIGKILL and restarted on
+# the same persistent heap. From the moment it is started again, the run
+# records when the server first answers, when the probe key first hits and
+# when the background LRU restore sweep finishes, and then loads it for the
+# run time with memslap reporting every second. The per-second throughput
+# and hit ratio go to <tag>.timeline.csv, and restart.csv gets one record
+# per run with the second by which throughput first reached 90% of its
+# mean over the second half of the run.
+#
+#   ./run_memcached_bench.sh -W -s mtm -t 4 -n 1000000 -d 30s
+PWD=`pwd`
+export LD_LIBRARY_PATH=$PWD/library/:$LD_LIBRARY_PATH
+
+MEMASLAP_BIN=$PWD/bench/memcached/memslap
+BUILD_DIR=$PWD/build/bench/memcached
+OUT_DIR=$PWD/build/results/memcached
+
+SERVERS="base mtm"
+SERVER_THREADS="4"
+FLUSH_BACKENDS="auto"
+LOG_STORES="auto"
+CLIENT_THREADS=4
+CLIENT_CONCURRENCY=16
+KEY_SIZE=16
+VALUE_SIZE=128
+GET_RATIO=0.9
+RUN_TIME=10s
+SERVER_IP="127.0.0.1"
+SERVER_PORT=11211
+WARM_RESTART=0
+FILL_OPS=1000000
+
+usage() {
+	echo "usage: $0 [-s servers] [-t server_threads] [-f flush_backends] [-g log_stream_stores]"
+	echo "          [-T client_threads] [-c concurrency] [-k key_size] [-v value_size]"
+	echo "          [-r get_ratio] [-d run_time] [-o out_dir] [-W] [-n fill_ops]"
+	echo "Lists are space separated, e.g. -t \"1 2 4\" -f \"clflushopt clwb\"."
+	exit 1
+}
+
+while getopts "s:t:f:g:T:c:k:v:r:d:o:Wn:h" opt
+do
+	case $opt in
+	s) SERVERS=$OPTARG ;;
+	t) SERVER_THREADS=$OPTARG ;;
+	f) FLUSH_BACKENDS=$OPTARG ;;
+	g) LOG_STORES=$OPTARG ;;
+	T) CLIENT_THREADS=$OPTARG ;;
+	c) CLIENT_CONCURRENCY=$OPTARG ;;
+	k) KEY_SIZE=$OPTARG ;;
+	v) VALUE_SIZE=$OPTARG ;;
+	r) GET_RATIO=$OPTARG ;;
+	d) RUN_TIME=$OPTARG ;;
+	o) OUT_DIR=$OPTARG ;;
+	W) WARM_RESTART=1 ;;
+	n) FILL_OPS=$OPTARG ;;
+	*) usage ;;
+	esac
+done
+
+mkdir -p $OUT_DIR
+RESULTS=$OUT_DIR/results.csv
+WORKLOAD=$OUT_DIR/workload.cnf
+SET_RATIO=`echo "1 - $GET_RATIO" | bc -l`
+
+cat > $WORKLOAD <<EOF
+key
+$KEY_SIZE $KEY_SIZE 1
+
+value
+$VALUE_SIZE $VALUE_SIZE 1
+
+cmd
+0 $SET_RATIO
+1 $GET_RATIO
+EOF
+
+FILL_WORKLOAD=$OUT_DIR/fill.cnf
+cat > $FILL_WORKLOAD <<EOF
+key
+$KEY_SIZE $KEY_SIZE 1
+
+value
+$VALUE_SIZE $VALUE_SIZE 1
+
+cmd
+0 1
+1 0
+EOF
+
+RESTARTS=$OUT_DIR/restart.csv
+if [ $WARM_RESTART -eq 1 ] && [ ! -f $RESTARTS ]
+then
+	echo "server,server_threads,flush_backend,log_stream_store,client_threads,concurrency,key_size,value_size,get_ratio,fill_ops,first_response_ms,first_hit_ms,restore_ms,full_tput_s,steady_ops_per_sec" > $RESTARTS
+fi
+
+if [ ! -f $RESULTS ]
+then
+	echo "server,server_threads,flush_backend,log_stream_store,client_threads,concurrency,key_size,value_size,get_ratio,ops_per_sec,p99_us,pm_write_bytes,pm_log_bytes" > $RESULTS
+fi
+
+# P99 from the "Total Statistics" log2 histogram: bucket i holds
+# latencies in [2^i, 2^(i+1)) us.
+p99_from_memslap() {
+	awk '
+	/^Total Statistics \(/ { total = 1; next }
+	total && /Log2 Dist:/ { dist = 1; next }
+	dist && NF == 0 { exit_dist = 1 }
+	dist && !exit_dist {
+		sub(":", "", $1); base = $1
+		for (i = 2; i <= NF; i++) { count[base + i - 2] = $i; events += $i; if (base + i - 2 > max) max = base + i - 2 }
+	}
+	END {
+		seen = 0
+		for (i = 0; i <= max; i++) {
+			seen += count[i]
+			if (events > 0 && seen >= 0.99 * events) { print 2 ^ (i + 1); exit }
+		}
+		print "n/a"
+	}' $1
+}
+
+# Last value of a counter in the totals of the mtm statistics export
+stat_total() {
+	if [ -f $1 ]
+	then
+		grep '"total"' $1 | tail -1 | sed -n "s/.*\"$2\": \([0-9]*\).*/\1/p"
+	else
+		echo "n/a"
+	fi
+}
+
+run_one() {
+	server=$1
+	threads=$2
+	flush=$3
+	logstore=$4
+	tag=$server-t$threads-$flush-$logstore
+	ini=$OUT_DIR/$tag.ini
+	stats=$OUT_DIR/$tag.stats.json
+	log=$OUT_DIR/$tag.memslap
+
+	rm -f $stats
+	cat > $ini <<EOF
+mcore: {
+  reset_segments = true;
+  flush_backend = "$flush";
+  log_stream_store = "$logstore";
+};
+mtm: {
+  stats_export_file = "$stats";
+  stats_export_period_ms = 1000;
+};
+EOF
+
+	MNEMOSYNE_CONFIG=$ini $BUILD_DIR/memcached-1.2.4-$server/memcached -u root \
+		-p $SERVER_PORT -l $SERVER_IP -t $threads > $OUT_DIR/$tag.server 2>&1 &
+	server_pid=$!
+	sleep 2
+
+	$MEMASLAP_BIN -s $SERVER_IP:$SERVER_PORT -T $CLIENT_THREADS -c $CLIENT_CONCURRENCY \
+		-F $WORKLOAD -t $RUN_TIME -S $RUN_TIME > $log 2>&1
+
+	kill -INT $server_pid
+	wait $server_pid
+
+	tps=`sed -n 's/.*TPS: \([0-9]*\).*/\1/p' $log | tail -1`
+	p99=`p99_from_memslap $log`
+	nvbytes=`stat_total $stats nvwrite_bytes`
+	logbytes=`stat_total $stats log_bytes`
+	echo "$server,$threads,$flush,$logstore,$CLIENT_THREADS,$CLIENT_CONCURRENCY,$KEY_SIZE,$VALUE_SIZE,$GET_RATIO,${tps:-n/a},$p99,${nvbytes:-n/a},${logbytes:-n/a}" | tee -a $RESULTS
+}
+
+now_ms() {
+	echo $((`date +%s%N` / 1000000))
+}
+
+# Sends one request to the server and prints the reply up to the line that
+# ends it. Fails if the server does not accept the connection.
+mc_request() {
+	exec 3<>/dev/tcp/$SERVER_IP/$SERVER_PORT || return 1
+	printf "%b\r\n" "$1" >&3
+	while read -t 2 -r line <&3
+	do
+		line=${line%$'\r'}
+		echo "$line"
+		case $line in END|STORED|VERSION*|*ERROR*) break ;; esac
+	done
+	exec 3<&-
+}
+
+# One line per period of a memslap log: the second since the server was
+# started (memslap started $2 seconds after it), the ops/s of the "Total
+# Statistics" period and the hit ratio of the "Get Statistics" period.
+timeline_from_memslap() {
+	awk -v offset=$2 '
+	/^Get Statistics/ { block = "get"; next }
+	/^Set Statistics/ { block = "set"; next }
+	/^Total Statistics/ { block = "total"; next }
+	$1 == "Period" && block == "get" { gets[$2] = $3; misses[$2] = $6 }
+	$1 == "Period" && block == "total" { if (!($2 in tps)) order[n++] = $2; tps[$2] = $4 }
+	END {
+		for (i = 0; i < n; i++) {
+			t = order[i]
+			hit = gets[t] > 0 ? sprintf("%.1f", 100 * (gets[t] - misses[t]) / gets[t]) : "n/a"
+			printf "%.1f,%d,%s\n", offset + t, tps[t], hit
+		}
+	}' $1
+}
+
+# First second of a timeline at 90% of the mean ops/s of its second half,
+# and that mean
+recovery_from_timeline() {
+	awk -F, '
+	{ t[NR] = $1; tps[NR] = $2 }
+	END {
+		if (NR == 0) { print "n/a,n/a"; exit }
+		for (i = int(NR / 2) + 1; i <= NR; i++) { sum += tps[i]; cnt++ }
+		steady = sum / cnt
+		for (i = 1; i <= NR; i++) {
+			if (tps[i] >= 0.9 * steady) { printf "%s,%.0f\n", t[i], steady; exit }
+		}
+		printf "n/a,%.0f\n", steady
+	}' $1
+}
+
+warm_server() {
+	cat > $ini <<EOF
+mcore: {
+  reset_segments = $1;
+  flush_backend = "$flush";
+  log_stream_store = "$logstore";
+};
+EOF
+	MNEMOSYNE_CONFIG=$ini $BUILD_DIR/memcached-1.2.4-$server/memcached -u root \
+		-p $SERVER_PORT -l $SERVER_IP -t $threads >> $OUT_DIR/$tag.server 2>&1 &
+	server_pid=$!
+}
+
+warm_one() {
+	server=$1
+	threads=$2
+	flush=$3
+	logstore=$4
+	tag=warm-$server-t$threads-$flush-$logstore
+	ini=$OUT_DIR/$tag.ini
+	log=$OUT_DIR/$tag.memslap
+	timeline=$OUT_DIR/$tag.timeline.csv
+
+	# Fill a fresh heap, leave the probe key and crash
+	rm -f $OUT_DIR/$tag.server
+	warm_server true
+	sleep 2
+	$MEMASLAP_BIN -s $SERVER_IP:$SERVER_PORT -T $CLIENT_THREADS -c $CLIENT_CONCURRENCY \
+		-F $FILL_WORKLOAD -x $FILL_OPS > $OUT_DIR/$tag.fill 2>&1
+	mc_request "set warm_probe 0 0 1\r\n1" > /dev/null
+	kill -KILL $server_pid
+	wait $server_pid 2> /dev/null
+
+	t0=`now_ms`
+	warm_server false
+	until mc_request "version" 2> /dev/null | grep -q VERSION
+	do
+		sleep 0.01
+	done
+	first_response=$((`now_ms` - t0))
+	until mc_request "get warm_probe" | grep -q "^VALUE" || [ $((`now_ms` - t0)) -gt 60000 ]
+	do
+		sleep 0.01
+	done
+	first_hit=$((`now_ms` - t0))
+
+	offset=`echo "(\`now_ms\` - $t0) / 1000" | bc -l`
+	$MEMASLAP_BIN -s $SERVER_IP:$SERVER_PORT -T $CLIENT_THREADS -c $CLIENT_CONCURRENCY \
+		-F $WORKLOAD -t $RUN_TIME -S 1s > $log 2>&1
+
+	kill -INT $server_pid
+	wait $server_pid
+
+	echo "second,ops_per_sec,get_hit_pct" > $timeline
+	timeline_from_memslap $log $offset >> $timeline
+	restore=`sed -n 's/.*assoc_restore_sweep: done in \([0-9]*\) ms.*/\1/p' $OUT_DIR/$tag.server | tail -1`
+	recovery=`tail -n +2 $timeline | recovery_from_timeline /dev/stdin`
+	echo "$server,$threads,$flush,$logstore,$CLIENT_THREADS,$CLIENT_CONCURRENCY,$KEY_SIZE,$VALUE_SIZE,$GET_RATIO,$FILL_OPS,$first_response,$first_hit,${restore:-n/a},$recovery" | tee -a $RESTARTS
+}
+
+for server in $SERVERS
+do
+	for threads in $SERVER_THREADS
+	do
+		if [ "$server" == "base" ]
+		then
+			if [ $WARM_RESTART -eq 1 ]
+			then
+				# Nothing survives a restart of the volatile server
+				continue
+			fi
+			# The volatile server ignores the Mnemosyne settings
+			run_one $server $threads - -
+			continue
+		fi
+		for flush in $FLUSH_BACKENDS
+		do
+			for logstore in $LOG_STORES
+			do
+				if [ $WARM_RESTART -eq 1 ]
+				then
+					warm_one $server $threads $flush $logstore
+				else
+					run_one $server $threads $flush $logstore
+				fi
+			done
+		done
+	done
+done
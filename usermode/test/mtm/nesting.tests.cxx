@@ -0,0 +1,204 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/*!
+ * \file
+ * Implements tests for closed nesting in libMTM: a nested transaction that 
+ * is cancelled or conflicts rolls back and re-executes alone, and nesting 
+ * deeper than the savepoint stack is flattened into its parent.
+ */
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <UnitTest++/UnitTest++.h>
+
+/* PWB_MAX_SAVEPOINTS of the pwb modes: nesting levels 2 to 17 get one */
+#define MAX_SAVEPOINTS 16
+
+#define MAX_DEPTH      (MAX_SAVEPOINTS + 4)
+
+/* Each word sits on a lock of its own */
+#define WORD(name) static uint64_t name __attribute__((aligned(256)))
+
+WORD(a);
+WORD(b);
+WORD(c);
+WORD(x);
+WORD(y);
+WORD(w);
+WORD(z);
+
+static int levels[MAX_DEPTH + 1];
+
+static int outer_runs;
+static int inner_runs;
+static volatile int writer_go;
+static volatile int writer_done;
+
+
+static __attribute__((transaction_pure)) void count_run(int *runs)
+{
+	(*runs)++;
+}
+
+
+/* Lets the writer commit while the caller is inside its nested transaction */
+static __attribute__((transaction_pure)) void wait_writer()
+{
+	if (!writer_go) {
+		writer_go = 1;
+		while (!writer_done);
+	}
+}
+
+
+static void *writer(void *arg)
+{
+	while (!writer_go);
+	__transaction_atomic {
+		y = 1;
+		w = 1;
+	}
+	writer_done = 1;
+	return NULL;
+}
+
+
+/* 
+ * GCC flattens a transaction nested in the same function unless it may be
+ * cancelled: the nested transactions that may not are in functions of their
+ * own.
+ */
+static __attribute__((transaction_safe, noinline)) void read_nested()
+{
+	__transaction_atomic {
+		uint64_t value;
+		count_run(&inner_runs);
+		value = y;
+		wait_writer();
+		z = value + w;
+	}
+}
+
+
+/* Runs levels level to depth as nested transactions, cancelling level cancel */
+static __attribute__((transaction_safe)) void nest(int level, int depth, int cancel)
+{
+	__transaction_atomic {
+		levels[level] = level;
+		if (level == cancel) {
+			__transaction_cancel;
+		}
+		if (level < depth) {
+			nest(level + 1, depth, cancel);
+		}
+	}
+}
+
+
+static void reset()
+{
+	a = b = c = 0;
+	x = y = w = z = 0;
+	memset(levels, 0, sizeof(levels));
+	outer_runs = inner_runs = 0;
+	writer_go = writer_done = 0;
+}
+
+
+SUITE(ClosedNesting) {
+
+	TEST(cancelNestedKeepsOuterWrites) {
+		reset();
+		__transaction_atomic {
+			a = 1;
+			__transaction_atomic {
+				a = 2;
+				b = 2;
+				__transaction_cancel;
+			}
+			c = a + 2;
+		}
+		CHECK_EQUAL(1, a);
+		CHECK_EQUAL(0, b);
+		CHECK_EQUAL(3, c);
+	}
+
+	TEST(cancelDeepNested) {
+		reset();
+		nest(1, 8, 5);
+		for (int i = 1; i <= 8; i++) {
+			CHECK_EQUAL(i < 5 ? i : 0, levels[i]);
+		}
+	}
+
+	/* 
+	 * The writer commits to y, read by the nested transaction only, and to 
+	 * w, which the nested transaction reads next: the nested transaction 
+	 * fails to extend its snapshot and re-executes without the outer one.
+	 */
+	TEST(retryNestedOnConflict) {
+		pthread_t thread;
+		reset();
+		pthread_create(&thread, NULL, writer, NULL);
+		__transaction_atomic {
+			count_run(&outer_runs);
+			a = x + 1;
+			read_nested();
+		}
+		pthread_join(thread, NULL);
+		CHECK_EQUAL(1, outer_runs);
+		CHECK_EQUAL(2, inner_runs);
+		CHECK_EQUAL(1, a);
+		CHECK_EQUAL(2, z);
+	}
+
+	TEST(commitBeyondMaxSavepoints) {
+		reset();
+		nest(1, MAX_DEPTH, 0);
+		for (int i = 1; i <= MAX_DEPTH; i++) {
+			CHECK_EQUAL(i, levels[i]);
+		}
+	}
+
+	/* 
+	 * The levels past the last savepoint are flattened into the last level
+	 * that has one: cancelling the innermost cancels all of them.
+	 */
+	TEST(cancelBeyondMaxSavepoints) {
+		reset();
+		nest(1, MAX_DEPTH, MAX_DEPTH);
+		for (int i = 1; i <= MAX_DEPTH; i++) {
+			CHECK_EQUAL(i <= MAX_SAVEPOINTS ? i : 0, levels[i]);
+		}
+	}
+}
@@ -0,0 +1,167 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/*!
+ * \file
+ * Implements tests for the savepoints an application takes with 
+ * mtm_savepoint(), rolls back to and releases.
+ */
+#include <stdint.h>
+#include <UnitTest++/UnitTest++.h>
+#include <mtm.h>
+
+/* Each word sits on a lock of its own */
+#define WORD(name) static uint64_t name __attribute__((aligned(256)))
+
+WORD(a);
+WORD(b);
+WORD(c);
+
+/* What mtm_savepoint returned, each time it did */
+static int returns[4];
+static int nreturns;
+
+static int rollback_ret;
+static int release_ret;
+
+
+static __attribute__((transaction_pure)) void log_return(int ret)
+{
+	if (nreturns < 4) {
+		returns[nreturns] = ret;
+	}
+	nreturns++;
+}
+
+
+static __attribute__((transaction_pure)) void log_rollback(int ret)
+{
+	rollback_ret = ret;
+}
+
+
+static __attribute__((transaction_pure)) void log_release(int ret)
+{
+	release_ret = ret;
+}
+
+
+/* A nested transaction, which GCC would flatten were it in the caller */
+static __attribute__((transaction_safe, noinline)) void rollback_nested()
+{
+	__transaction_atomic {
+		b = 2;
+		log_rollback(mtm_rollback_to_savepoint());
+		log_release(mtm_release_savepoint());
+	}
+}
+
+
+static void reset()
+{
+	a = b = c = 0;
+	nreturns = 0;
+	rollback_ret = release_ret = 0;
+}
+
+
+SUITE(Savepoints) {
+
+	TEST(rollbackToSavepoint) {
+		reset();
+		__transaction_atomic {
+			int ret;
+			a = 1;
+			ret = mtm_savepoint();
+			log_return(ret);
+			if (ret == MTM_SAVEPOINT_SET) {
+				a = 2;
+				b = 2;
+				mtm_rollback_to_savepoint();
+			}
+			c = a + 1;
+		}
+		CHECK_EQUAL(2, nreturns);
+		CHECK_EQUAL(MTM_SAVEPOINT_SET, returns[0]);
+		CHECK_EQUAL(MTM_SAVEPOINT_ROLLBACK, returns[1]);
+		CHECK_EQUAL(1, a);
+		CHECK_EQUAL(0, b);
+		CHECK_EQUAL(2, c);
+	}
+
+	/* What ran after a released savepoint stays, and cannot be rolled back */
+	TEST(releaseSavepoint) {
+		reset();
+		__transaction_atomic {
+			int ret;
+			a = 1;
+			ret = mtm_savepoint();
+			log_return(ret);
+			b = 2;
+			log_release(mtm_release_savepoint());
+			log_rollback(mtm_rollback_to_savepoint());
+			c = 3;
+		}
+		CHECK_EQUAL(1, nreturns);
+		CHECK_EQUAL(MTM_SAVEPOINT_SET, returns[0]);
+		CHECK_EQUAL(0, release_ret);
+		CHECK_EQUAL(-1, rollback_ret);
+		CHECK_EQUAL(1, a);
+		CHECK_EQUAL(2, b);
+		CHECK_EQUAL(3, c);
+	}
+
+	/* A savepoint belongs to the transaction, nested or not, that took it */
+	TEST(rollbackFromNestedTransaction) {
+		reset();
+		__transaction_atomic {
+			int ret;
+			ret = mtm_savepoint();
+			log_return(ret);
+			a = 1;
+			rollback_nested();
+			c = 3;
+		}
+		CHECK_EQUAL(1, nreturns);
+		CHECK_EQUAL(-1, rollback_ret);
+		CHECK_EQUAL(-1, release_ret);
+		CHECK_EQUAL(1, a);
+		CHECK_EQUAL(2, b);
+		CHECK_EQUAL(3, c);
+	}
+
+	TEST(savepointOutsideTransaction) {
+		CHECK_EQUAL(MTM_SAVEPOINT_NONE, mtm_savepoint());
+		CHECK_EQUAL(-1, mtm_rollback_to_savepoint());
+		CHECK_EQUAL(-1, mtm_release_savepoint());
+	}
+}
@@ -0,0 +1,116 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/*!
+ * \file
+ * Implements tests for the transaction ids of libMTM and for committing the
+ * transactions nested inside one of them with _ITM_commitTransactionToId.
+ */
+#include <stdint.h>
+#include <UnitTest++/UnitTest++.h>
+
+typedef struct mtm_tx_s mtm_tx_t;
+#include <itm.h>
+
+/* Each word sits on a lock of its own */
+#define WORD(name) static uint64_t name __attribute__((aligned(256)))
+
+WORD(a);
+WORD(b);
+WORD(c);
+
+static _ITM_transactionId outer_id;
+static _ITM_transactionId inner_id;
+static _ITM_transactionId merged_id;
+
+
+/* 
+ * GCC does not emit _ITM_commitTransactionToId, so the transactions nested 
+ * in the caller's are begun and written through the ABI directly. They do 
+ * not abort, which would resume at their begin in a frame that is gone.
+ */
+static __attribute__((transaction_pure)) void commit_nested_to_outer()
+{
+	outer_id = _ITM_getTransactionId();
+	_ITM_beginTransaction(pr_instrumentedCode | pr_hasNoAbort);
+	_ITM_WU8(&b, 2);
+	_ITM_beginTransaction(pr_instrumentedCode | pr_hasNoAbort);
+	_ITM_WU8(&c, _ITM_RU8(&b) + 1);
+	inner_id = _ITM_getTransactionId();
+	_ITM_commitTransactionToId(outer_id, NULL);
+	merged_id = _ITM_getTransactionId();
+}
+
+
+static void reset()
+{
+	a = b = c = 0;
+	outer_id = inner_id = merged_id = 0;
+}
+
+
+SUITE(TransactionIds) {
+
+	TEST(transactionIdOutsideTransaction) {
+		CHECK_EQUAL(_ITM_noTransactionId, _ITM_getTransactionId());
+	}
+
+	TEST(commitTransactionToId) {
+		reset();
+		__transaction_atomic {
+			a = 1;
+			commit_nested_to_outer();
+			a = b + c;
+		}
+		CHECK_EQUAL(_ITM_noTransactionId + 1, outer_id);
+		CHECK_EQUAL(_ITM_noTransactionId + 3, inner_id);
+		CHECK_EQUAL(outer_id, merged_id);
+		CHECK_EQUAL(_ITM_noTransactionId, _ITM_getTransactionId());
+		CHECK_EQUAL(5, a);
+		CHECK_EQUAL(2, b);
+		CHECK_EQUAL(3, c);
+	}
+
+	/* The committed nested transactions became part of the outer one */
+	TEST(cancelAfterCommitTransactionToId) {
+		reset();
+		__transaction_atomic {
+			a = 1;
+			commit_nested_to_outer();
+			__transaction_cancel;
+		}
+		CHECK_EQUAL(outer_id, merged_id);
+		CHECK_EQUAL(0, a);
+		CHECK_EQUAL(0, b);
+		CHECK_EQUAL(0, c);
+	}
+}
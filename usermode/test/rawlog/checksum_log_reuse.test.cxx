@@ -0,0 +1,112 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <UnitTest++/UnitTest++.h>
+#include <mnemosyne.h>
+#include <pcm.h>
+#include <log.h>
+
+#define REUSE_LOG_SIZE_LOG2 10
+
+/* A checksum physical log kept in plain memory, formatted as on first use. */
+struct fixtureChecksumLog {
+	fixtureChecksumLog() 
+	{
+		pcm_storeset = pcm_storeset_get();
+		posix_memalign((void **) &nvmd, CACHELINE_SIZE, sizeof(*nvmd));
+		posix_memalign((void **) &nvphlog, CACHELINE_SIZE, sizeof(pcm_word_t) << REUSE_LOG_SIZE_LOG2);
+		memset(nvmd, 0, sizeof(*nvmd));
+		memset(nvphlog, 0, sizeof(pcm_word_t) << REUSE_LOG_SIZE_LOG2);
+		posix_memalign((void **) &phlog, CACHELINE_SIZE, sizeof(*phlog));
+		m_phlog_checksum_format(pcm_storeset, nvmd, nvphlog, 0, REUSE_LOG_SIZE_LOG2);
+		m_phlog_checksum_init(phlog, nvmd, nvphlog);
+	}
+
+	~fixtureChecksumLog() 
+	{
+		free(phlog);
+		free(nvphlog);
+		free(nvmd);
+		pcm_storeset_put();
+	}
+
+	/* Writes a fragment of nwords words starting from value first. */
+	void writeFragment(pcm_word_t first, int nwords)
+	{
+		for (int i=0; i<nwords; i++) {
+			m_phlog_checksum_write(pcm_storeset, phlog, first + i);
+		}
+		m_phlog_checksum_flush(pcm_storeset, phlog);
+	}
+
+	pcm_storeset_t          *pcm_storeset;
+	m_phlog_checksum_nvmd_t *nvmd;
+	pcm_word_t              *nvphlog;
+	m_phlog_checksum_t      *phlog;
+};
+
+
+SUITE(ChecksumLogReuse) {
+
+	/* 
+	 * A log freed at thread exit and handed to a new thread is formatted 
+	 * again. Recovery must only find what the new owner wrote, not the 
+	 * fragments of the previous owner that lie beyond the new tail.
+	 */
+	TEST_FIXTURE(fixtureChecksumLog, recoverAfterReuse) {
+		m_phlog_checksum_t *recovered;
+		pcm_word_t         value;
+
+		/* Previous owner: two one-chunk fragments, then truncated */
+		writeFragment(0x100, CHECKSUM_CHUNK_NWORDS - 1);
+		writeFragment(0x200, CHECKSUM_CHUNK_NWORDS - 1);
+		m_phlog_checksum_truncate_sync(pcm_storeset, phlog);
+
+		/* New owner: reformats the log and writes a single fragment */
+		m_phlog_checksum_format(pcm_storeset, nvmd, nvphlog, 0, REUSE_LOG_SIZE_LOG2);
+		m_phlog_checksum_init(phlog, nvmd, nvphlog);
+		writeFragment(0x300, 3);
+
+		/* Crash: recover from the non-volatile log alone */
+		posix_memalign((void **) &recovered, CACHELINE_SIZE, sizeof(*recovered));
+		m_phlog_checksum_init(recovered, nvmd, nvphlog);
+		m_phlog_checksum_check_consistency(nvmd, nvphlog, &recovered->stable_tail);
+		CHECK_EQUAL((uint64_t) CHECKSUM_CHUNK_NWORDS, recovered->stable_tail);
+		for (int i=0; i<3; i++) {
+			CHECK(m_phlog_checksum_read(recovered, &value) == M_R_SUCCESS);
+			CHECK_EQUAL((pcm_word_t) (0x300 + i), value);
+		}
+		free(recovered);
+	}
+}
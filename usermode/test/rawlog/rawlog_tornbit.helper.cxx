@@ -48,7 +48,8 @@ m_rawlog_tornbit_init(pcm_storeset_t *set, m_log_t *log, m_log_dsc_t *log_dsc)
 	m_phlog_tornbit_format(set, 
 	                       (m_phlog_tornbit_nvmd_t *) log_dsc->nvmd, 
 	                       log_dsc->nvphlog, 
-	                       LF_TYPE_TM_TORNBIT);
+	                       LF_TYPE_TM_TORNBIT, 
+	                       log_dsc->size_log2);
 	m_phlog_tornbit_init(phlog_tornbit, 
 	                     (m_phlog_tornbit_nvmd_t *) log_dsc->nvmd, 
 	                     log_dsc->nvphlog);
@@ -0,0 +1,101 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+#include <UnitTest++/UnitTest++.h>
+#include "tmlog.fixtures.hxx"
+
+#define FULL ~((pcm_word_t) 0)
+
+
+SUITE(TmlogFullMaskRecords) {
+
+	/* A full word takes two log words and a partial one three */
+	TEST_FIXTURE(fixtureTmlogBase, recordFormatBase) {
+		begin();
+		write(homeAddr(0), 0x100, FULL);
+		write(homeAddr(1), 0x200, 0xFF);
+		commit(1);
+
+		CHECK_EQUAL((pcm_word_t) (homeAddr(0) | tmlog_helper_full_mask_bit), log_dsc.nvphlog[0]);
+		CHECK_EQUAL((pcm_word_t) 0x100, log_dsc.nvphlog[1]);
+		CHECK_EQUAL((pcm_word_t) homeAddr(1), log_dsc.nvphlog[2]);
+		CHECK_EQUAL((pcm_word_t) 0x200, log_dsc.nvphlog[3]);
+		CHECK_EQUAL((pcm_word_t) 0xFF, log_dsc.nvphlog[4]);
+		CHECK_EQUAL(tmlog_helper_commit_marker, log_dsc.nvphlog[5]);
+	}
+
+	TEST_FIXTURE(fixtureTmlogBase, recoverFullAndPartialWordsBase) {
+		begin();
+		write(homeAddr(0), 0x1122334455667788, FULL);
+		write(homeAddr(1), 0x1122334455667788, 0xFFFF);
+		write(homeAddr(2), 0x99, FULL);
+		commit(1);
+		crash();
+		home[1] = 0xAAAAAAAAAAAAAAAA;
+
+		CHECK_EQUAL(1, recover());
+		CHECK_EQUAL((pcm_word_t) 0x1122334455667788, home[0]);
+		CHECK_EQUAL((pcm_word_t) 0xAAAAAAAAAAAA7788, home[1]);
+		CHECK_EQUAL((pcm_word_t) 0x99, home[2]);
+	}
+
+	/* Later transactions win, whatever the encoding of their records */
+	TEST_FIXTURE(fixtureTmlogBase, recoverInOrderBase) {
+		begin();
+		write(homeAddr(0), 0x1111, FULL);
+		commit(1);
+		begin();
+		write(homeAddr(0), 0x2200, 0xFF00);
+		commit(2);
+		crash();
+
+		CHECK_EQUAL(2, recover());
+		CHECK_EQUAL((pcm_word_t) 0x2211, home[0]);
+	}
+
+	/* The records of the transaction span more than one chunk */
+	TEST_FIXTURE(fixtureTmlogTornbit, recoverFullAndPartialWordsTornbit) {
+		begin();
+		for (int i=0; i<8; i++) {
+			write(homeAddr(i), 0x100 + i, FULL);
+		}
+		write(homeAddr(8), 0x1122334455667788, 0xFFFF0000);
+		commit(1);
+		crash();
+
+		CHECK_EQUAL(1, recover());
+		for (int i=0; i<8; i++) {
+			CHECK_EQUAL((pcm_word_t) (0x100 + i), home[i]);
+		}
+		CHECK_EQUAL((pcm_word_t) 0x55660000, home[8]);
+	}
+}
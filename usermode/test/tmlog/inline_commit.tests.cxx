@@ -0,0 +1,104 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+#include <UnitTest++/UnitTest++.h>
+#include "tmlog.fixtures.hxx"
+
+#define FULL ~((pcm_word_t) 0)
+
+/* Words of a torn bit log chunk, the last of which is its header */
+#define CHUNK_NWORDS 8
+
+
+SUITE(TmlogInlineCommit) {
+
+	/* The records and the commit of a small transaction share a chunk */
+	TEST_FIXTURE(fixtureTmlogTornbit, recordFormat) {
+		begin();
+		write(homeAddr(0), 0x100, FULL);
+		commit(5);
+
+		CHECK_EQUAL((pcm_word_t) (homeAddr(0) | tmlog_helper_full_mask_bit), log_dsc.nvphlog[0]);
+		CHECK_EQUAL((pcm_word_t) 0x100, log_dsc.nvphlog[1]);
+		CHECK_EQUAL(tmlog_helper_commit_inline_bit | 5, log_dsc.nvphlog[2]);
+	}
+
+	TEST_FIXTURE(fixtureTmlogTornbit, recoverInlineCommit) {
+		begin();
+		write(homeAddr(0), 0x100, FULL);
+		write(homeAddr(1), 0x200, FULL);
+		write(homeAddr(2), 0x300, FULL);
+		commit(5);
+		crash();
+
+		CHECK_EQUAL(1, recover());
+		CHECK_EQUAL((pcm_word_t) 0x100, home[0]);
+		CHECK_EQUAL((pcm_word_t) 0x200, home[1]);
+		CHECK_EQUAL((pcm_word_t) 0x300, home[2]);
+	}
+
+	/* A sequence number that does not fit below the bit takes a word */
+	TEST_FIXTURE(fixtureTmlogTornbit, recoverLargeSequenceNumber) {
+		begin();
+		write(homeAddr(0), 0x100, FULL);
+		commit(tmlog_helper_commit_inline_bit);
+
+		CHECK_EQUAL(tmlog_helper_commit_marker, log_dsc.nvphlog[2]);
+		CHECK_EQUAL(tmlog_helper_commit_inline_bit, log_dsc.nvphlog[3]);
+		crash();
+
+		CHECK_EQUAL(1, recover());
+		CHECK_EQUAL((pcm_word_t) 0x100, home[0]);
+	}
+
+	/* 
+	 * The chunk of the second transaction is torn: its inline commit word 
+	 * still holds what the log held before. The transaction must not be 
+	 * taken as committed.
+	 */
+	TEST_FIXTURE(fixtureTmlogTornbit, ignoreTornInlineCommit) {
+		begin();
+		write(homeAddr(0), 0x100, FULL);
+		commit(1);
+		begin();
+		write(homeAddr(1), 0x200, FULL);
+		commit(2);
+
+		CHECK_EQUAL(tmlog_helper_commit_inline_bit | 2, log_dsc.nvphlog[CHUNK_NWORDS + 2]);
+		log_dsc.nvphlog[CHUNK_NWORDS + 2] = 0;
+		crash();
+
+		CHECK_EQUAL(1, recover());
+		CHECK_EQUAL((pcm_word_t) 0x100, home[0]);
+		CHECK_EQUAL((pcm_word_t) 0, home[1]);
+	}
+}
@@ -0,0 +1,121 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+#include <UnitTest++/UnitTest++.h>
+#include "tmlog.fixtures.hxx"
+
+/* The home words are cacheline aligned, so a line starts every 8 words */
+#define LINE_NWORDS 8
+
+
+SUITE(TmlogLineRecords) {
+
+	/* The head word packs the line, the bitmap and the line bit */
+	TEST_FIXTURE(fixtureTmlogBase, recordFormatBase) {
+		pcm_word_t vals[3] = { 0x100, 0x200, 0x300 };
+
+		begin();
+		writeLine(homeAddr(LINE_NWORDS), 0x25, vals);
+		commit(1);
+
+		CHECK_EQUAL((pcm_word_t) (homeAddr(LINE_NWORDS) | 
+		                          ((pcm_word_t) 0x25 << tmlog_helper_line_bitmap_shift) | 
+		                          tmlog_helper_line_bit), 
+		            log_dsc.nvphlog[0]);
+		for (int i=0; i<3; i++) {
+			CHECK_EQUAL(vals[i], log_dsc.nvphlog[1 + i]);
+		}
+		CHECK_EQUAL(tmlog_helper_commit_marker, log_dsc.nvphlog[4]);
+	}
+
+	TEST_FIXTURE(fixtureTmlogBase, recoverSparseLineBase) {
+		pcm_word_t vals[3] = { 0x100, 0x200, 0x300 };
+
+		begin();
+		writeLine(homeAddr(LINE_NWORDS), 0x25, vals);
+		commit(1);
+		crash();
+
+		CHECK_EQUAL(1, recover());
+		CHECK_EQUAL((pcm_word_t) 0x100, home[LINE_NWORDS + 0]);
+		CHECK_EQUAL((pcm_word_t) 0x200, home[LINE_NWORDS + 2]);
+		CHECK_EQUAL((pcm_word_t) 0x300, home[LINE_NWORDS + 5]);
+		for (int i=0; i<LINE_NWORDS; i++) {
+			if (i != 0 && i != 2 && i != 5) {
+				CHECK_EQUAL((pcm_word_t) 0, home[LINE_NWORDS + i]);
+			}
+		}
+	}
+
+	/* Line and word records of later transactions apply on top */
+	TEST_FIXTURE(fixtureTmlogBase, recoverInOrderBase) {
+		pcm_word_t vals[LINE_NWORDS];
+
+		for (int i=0; i<LINE_NWORDS; i++) {
+			vals[i] = 0x100 + i;
+		}
+		begin();
+		writeLine(homeAddr(0), 0xFF, vals);
+		commit(1);
+		begin();
+		write(homeAddr(3), 0x999, ~((pcm_word_t) 0));
+		writeLine(homeAddr(LINE_NWORDS), 0x80, vals);
+		commit(2);
+		crash();
+
+		CHECK_EQUAL(2, recover());
+		for (int i=0; i<LINE_NWORDS; i++) {
+			CHECK_EQUAL(i == 3 ? (pcm_word_t) 0x999 : vals[i], home[i]);
+		}
+		CHECK_EQUAL(vals[0], home[2 * LINE_NWORDS - 1]);
+	}
+
+	/* A full line record spans two chunks of the torn bit log */
+	TEST_FIXTURE(fixtureTmlogTornbit, recoverFullLineTornbit) {
+		pcm_word_t vals[LINE_NWORDS];
+
+		for (int i=0; i<LINE_NWORDS; i++) {
+			vals[i] = 0x100 + i;
+		}
+		begin();
+		write(homeAddr(2 * LINE_NWORDS), 0x999, 0xFFFF);
+		writeLine(homeAddr(LINE_NWORDS), 0xFF, vals);
+		commit(1);
+		crash();
+
+		CHECK_EQUAL(1, recover());
+		for (int i=0; i<LINE_NWORDS; i++) {
+			CHECK_EQUAL(vals[i], home[LINE_NWORDS + i]);
+		}
+		CHECK_EQUAL((pcm_word_t) 0x999, home[2 * LINE_NWORDS]);
+	}
+}
@@ -30,15 +30,13 @@
 ### END HEADER ###
 */
 
-/*!
- * \file
- *
- */
-#include <unittest++/UnitTest++.h>
-#include <iostream>
-
-int main ()
+#include "../common/unittest.h"
+
+int main(int argc, char **argv)
 {
-	std::cout << "TMLOG" << std::endl;
-	return 1;
+	char         *suiteName;
+	char         *testName;
+
+	getTest(argc, argv, &suiteName, &testName);
+	return runTests(suiteName, testName);
 }
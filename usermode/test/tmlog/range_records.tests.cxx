@@ -0,0 +1,151 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+#include <UnitTest++/UnitTest++.h>
+#include "tmlog.fixtures.hxx"
+
+#define RANGE_NWORDS 20
+
+static void fillRange(pcm_word_t *vals, int nwords, pcm_word_t first)
+{
+	for (int i=0; i<nwords; i++) {
+		vals[i] = first + i;
+	}
+}
+
+
+SUITE(TmlogRangeRecords) {
+
+	TEST_FIXTURE(fixtureTmlogBase, recoverRangeBase) {
+		pcm_word_t vals[RANGE_NWORDS];
+
+		fillRange(vals, RANGE_NWORDS, 0x100);
+		begin();
+		writeRange(homeAddr(2), vals, RANGE_NWORDS);
+		commit(1);
+		crash();
+
+		CHECK_EQUAL(1, recover());
+		CHECK_EQUAL((pcm_word_t) 0, home[1]);
+		for (int i=0; i<RANGE_NWORDS; i++) {
+			CHECK_EQUAL(vals[i], home[2 + i]);
+		}
+		CHECK_EQUAL((pcm_word_t) 0, home[2 + RANGE_NWORDS]);
+	}
+
+	/* Fewer than four words are logged as word records */
+	TEST_FIXTURE(fixtureTmlogBase, recoverShortRangeBase) {
+		pcm_word_t vals[3];
+
+		fillRange(vals, 3, 0x200);
+		begin();
+		writeRange(homeAddr(0), vals, 3);
+		commit(1);
+		crash();
+
+		CHECK_EQUAL(1, recover());
+		for (int i=0; i<3; i++) {
+			CHECK_EQUAL(vals[i], home[i]);
+		}
+	}
+
+	/* 
+	 * The range spans several chunks, written out before the crash; the 
+	 * commit is not, so the range must not be applied.
+	 */
+	TEST_FIXTURE(fixtureTmlogBase, ignoreTruncatedRangeBase) {
+		pcm_word_t vals[RANGE_NWORDS];
+
+		fillRange(vals, RANGE_NWORDS, 0x300);
+		begin();
+		writeRange(homeAddr(0), vals, RANGE_NWORDS);
+		crash();
+
+		CHECK_EQUAL(0, recover());
+		for (int i=0; i<RANGE_NWORDS; i++) {
+			CHECK_EQUAL((pcm_word_t) 0, home[i]);
+		}
+	}
+
+	TEST_FIXTURE(fixtureTmlogBase, truncateRangeBase) {
+		pcm_word_t vals[RANGE_NWORDS];
+
+		fillRange(vals, RANGE_NWORDS, 0x400);
+		begin();
+		writeRange(homeAddr(0), vals, RANGE_NWORDS);
+		commit(1);
+		truncate();
+		crash();
+
+		CHECK_EQUAL(0, recover());
+	}
+
+	TEST_FIXTURE(fixtureTmlogTornbit, recoverRangeTornbit) {
+		pcm_word_t vals[RANGE_NWORDS];
+
+		fillRange(vals, RANGE_NWORDS, 0x500);
+		begin();
+		writeRange(homeAddr(2), vals, RANGE_NWORDS);
+		commit(1);
+		crash();
+
+		CHECK_EQUAL(1, recover());
+		CHECK_EQUAL((pcm_word_t) 0, home[1]);
+		for (int i=0; i<RANGE_NWORDS; i++) {
+			CHECK_EQUAL(vals[i], home[2 + i]);
+		}
+		CHECK_EQUAL((pcm_word_t) 0, home[2 + RANGE_NWORDS]);
+	}
+
+	/* 
+	 * The chunks of the uncommitted range are valid, so the stable region 
+	 * of the torn bit log ends inside it. Only the committed fragment before
+	 * it is applied.
+	 */
+	TEST_FIXTURE(fixtureTmlogTornbit, ignoreTruncatedRangeTornbit) {
+		pcm_word_t vals[RANGE_NWORDS];
+
+		begin();
+		write(homeAddr(RANGE_NWORDS), 0x600, ~((pcm_word_t) 0));
+		commit(1);
+		fillRange(vals, RANGE_NWORDS, 0x700);
+		begin();
+		writeRange(homeAddr(0), vals, RANGE_NWORDS);
+		crash();
+
+		CHECK_EQUAL(1, recover());
+		CHECK_EQUAL((pcm_word_t) 0x600, home[RANGE_NWORDS]);
+		for (int i=0; i<RANGE_NWORDS; i++) {
+			CHECK_EQUAL((pcm_word_t) 0, home[i]);
+		}
+	}
+}
@@ -0,0 +1,167 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/*!
+ * \file
+ * Fixture structures to write transactional redo logs, crash, and recover
+ * them from their non-volatile state alone.
+ */
+#ifndef TMLOG_FIXTURES_HXX
+#define TMLOG_FIXTURES_HXX
+
+#include <stdlib.h>
+#include <string.h>
+#include "tmlog.helpers.h"
+
+#define TMLOG_SIZE_LOG2   10
+#define TMLOG_HOME_NWORDS 64
+
+/* 
+ * A transactional redo log of the type ops implements, kept in plain memory
+ * and formatted as on first use, and the home words its records update.
+ */
+struct fixtureTmlog {
+	fixtureTmlog(m_log_ops_t *ops) 
+	{
+		pcm_storeset = pcm_storeset_get();
+		memset(&log_dsc, 0, sizeof(log_dsc));
+		log_dsc.ops = ops;
+		log_dsc.size_log2 = TMLOG_SIZE_LOG2;
+		log_dsc.trunc_point = INV_LOG_ORDER;
+		log_dsc.node = -1;
+		posix_memalign((void **) &log_dsc.nvmd, CACHELINE_SIZE, CACHELINE_SIZE);
+		posix_memalign((void **) &log_dsc.nvphlog, CACHELINE_SIZE, sizeof(pcm_word_t) << TMLOG_SIZE_LOG2);
+		posix_memalign((void **) &home, CACHELINE_SIZE, TMLOG_HOME_NWORDS * sizeof(pcm_word_t));
+		memset(log_dsc.nvmd, 0, CACHELINE_SIZE);
+		memset(log_dsc.nvphlog, 0, sizeof(pcm_word_t) << TMLOG_SIZE_LOG2);
+		memset(home, 0, TMLOG_HOME_NWORDS * sizeof(pcm_word_t));
+		ops->alloc(&log_dsc);
+		ops->init(pcm_storeset, log_dsc.log, &log_dsc);
+	}
+
+	~fixtureTmlog() 
+	{
+		free(log_dsc.log);
+		free(home);
+		free(log_dsc.nvphlog);
+		free(log_dsc.nvmd);
+		pcm_storeset_put();
+	}
+
+	/* 
+	 * Loses the volatile log and the stores to the home words, which the 
+	 * transactions left to the log truncation to write back.
+	 */
+	void crash()
+	{
+		free(log_dsc.log);
+		log_dsc.ops->alloc(&log_dsc);
+		memset(home, 0, TMLOG_HOME_NWORDS * sizeof(pcm_word_t));
+	}
+
+	/* 
+	 * Replays the committed fragments as the log manager does at startup.
+	 * Returns the number of fragments recovered.
+	 */
+	int recover()
+	{
+		int nfragments = 0;
+
+		m_logrecovery_begin();
+		log_dsc.ops->recovery_init(pcm_storeset, &log_dsc);
+		while (log_dsc.logorder != INV_LOG_ORDER) {
+			log_dsc.ops->recovery_do(pcm_storeset, &log_dsc);
+			log_dsc.ops->recovery_prepare_next(pcm_storeset, &log_dsc);
+			nfragments++;
+		}
+		m_logrecovery_end(pcm_storeset);
+		return nfragments;
+	}
+
+	/* Truncates the committed fragments as a log truncation pass does */
+	void truncate()
+	{
+		log_dsc.ops->truncation_init(pcm_storeset, &log_dsc);
+		while (log_dsc.logorder != INV_LOG_ORDER) {
+			log_dsc.ops->truncation_do(pcm_storeset, &log_dsc);
+			log_dsc.ops->truncation_prepare_next(pcm_storeset, &log_dsc);
+		}
+		log_dsc.ops->truncation_publish(pcm_storeset, &log_dsc);
+	}
+
+	void begin()
+	{
+		tmlog_helper_begin(&log_dsc);
+	}
+
+	void write(uintptr_t addr, pcm_word_t val, pcm_word_t mask)
+	{
+		tmlog_helper_write(pcm_storeset, &log_dsc, addr, val, mask);
+	}
+
+	void writeRange(uintptr_t addr, const pcm_word_t *vals, size_t nwords)
+	{
+		tmlog_helper_write_range(pcm_storeset, &log_dsc, addr, vals, nwords);
+	}
+
+	/* vals holds the words whose indexes are set in bitmap, in order */
+	void writeLine(uintptr_t line, unsigned int bitmap, const pcm_word_t *vals)
+	{
+		tmlog_helper_write_line(pcm_storeset, &log_dsc, line, bitmap, vals);
+	}
+
+	void commit(uint64_t sqn)
+	{
+		tmlog_helper_commit(pcm_storeset, &log_dsc, sqn);
+	}
+
+	uintptr_t homeAddr(int i) 
+	{
+		return (uintptr_t) &home[i];
+	}
+
+	pcm_storeset_t *pcm_storeset;
+	m_log_dsc_t    log_dsc;
+	pcm_word_t     *home;
+};
+
+
+struct fixtureTmlogBase : fixtureTmlog {
+	fixtureTmlogBase() : fixtureTmlog(&tmlog_base_ops) { }
+};
+
+
+struct fixtureTmlogTornbit : fixtureTmlog {
+	fixtureTmlogTornbit() : fixtureTmlog(&tmlog_tornbit_ops) { }
+};
+
+#endif /* TMLOG_FIXTURES_HXX */
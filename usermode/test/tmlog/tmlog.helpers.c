@@ -0,0 +1,96 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+#include "tmlog_base.h"
+#include "tmlog_tornbit.h"
+#include "tmlog.helpers.h"
+
+const pcm_word_t tmlog_helper_commit_marker = XACT_COMMIT_MARKER;
+const pcm_word_t tmlog_helper_commit_inline_bit = XACT_COMMIT_INLINE_BIT;
+const pcm_word_t tmlog_helper_full_mask_bit = XACT_FULL_MASK_BIT;
+const pcm_word_t tmlog_helper_line_bit = XACT_LINE_BIT;
+const int        tmlog_helper_line_bitmap_shift = XACT_LINE_BITMAP_SHIFT;
+
+
+void 
+tmlog_helper_begin(m_log_dsc_t *log_dsc)
+{
+	if (log_dsc->ops == &tmlog_base_ops) {
+		m_tmlog_base_begin((m_tmlog_base_t *) log_dsc->log);
+	} else {
+		m_tmlog_tornbit_begin((m_tmlog_tornbit_t *) log_dsc->log);
+	}
+}
+
+
+void 
+tmlog_helper_write(pcm_storeset_t *set, m_log_dsc_t *log_dsc, uintptr_t addr, pcm_word_t val, pcm_word_t mask)
+{
+	if (log_dsc->ops == &tmlog_base_ops) {
+		m_tmlog_base_write(set, (m_tmlog_base_t *) log_dsc->log, addr, val, mask);
+	} else {
+		m_tmlog_tornbit_write(set, (m_tmlog_tornbit_t *) log_dsc->log, addr, val, mask);
+	}
+}
+
+
+void 
+tmlog_helper_write_range(pcm_storeset_t *set, m_log_dsc_t *log_dsc, uintptr_t addr, const void *buf, size_t nwords)
+{
+	if (log_dsc->ops == &tmlog_base_ops) {
+		m_tmlog_base_write_range(set, (m_tmlog_base_t *) log_dsc->log, addr, buf, nwords);
+	} else {
+		m_tmlog_tornbit_write_range(set, (m_tmlog_tornbit_t *) log_dsc->log, addr, buf, nwords);
+	}
+}
+
+
+void 
+tmlog_helper_write_line(pcm_storeset_t *set, m_log_dsc_t *log_dsc, uintptr_t line, unsigned int bitmap, const pcm_word_t *vals)
+{
+	if (log_dsc->ops == &tmlog_base_ops) {
+		m_tmlog_base_write_line(set, (m_tmlog_base_t *) log_dsc->log, line, bitmap, vals);
+	} else {
+		m_tmlog_tornbit_write_line(set, (m_tmlog_tornbit_t *) log_dsc->log, line, bitmap, vals);
+	}
+}
+
+
+void 
+tmlog_helper_commit(pcm_storeset_t *set, m_log_dsc_t *log_dsc, uint64_t sqn)
+{
+	if (log_dsc->ops == &tmlog_base_ops) {
+		m_tmlog_base_commit(set, (m_tmlog_base_t *) log_dsc->log, sqn);
+	} else {
+		m_tmlog_tornbit_commit(set, (m_tmlog_tornbit_t *) log_dsc->log, sqn);
+	}
+}
@@ -0,0 +1,73 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/*!
+ * \file
+ * Exposes the inline routines the TM library writes its redo logs with.
+ * Their headers are internal to the library and C only, so they are 
+ * wrapped in tmlog.helpers.c, which dispatches on the type of the log.
+ */
+#ifndef TMLOG_HELPERS_H
+#define TMLOG_HELPERS_H
+
+#include <stddef.h>
+#include <mnemosyne.h>
+#include <pcm.h>
+#include <log.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <logrecovery.h>
+
+extern m_log_ops_t tmlog_base_ops;
+extern m_log_ops_t tmlog_tornbit_ops;
+
+/* Record encodings, to check the words a log holds */
+extern const pcm_word_t tmlog_helper_commit_marker;
+extern const pcm_word_t tmlog_helper_commit_inline_bit;
+extern const pcm_word_t tmlog_helper_full_mask_bit;
+extern const pcm_word_t tmlog_helper_line_bit;
+extern const int        tmlog_helper_line_bitmap_shift;
+
+void tmlog_helper_begin(m_log_dsc_t *log_dsc);
+void tmlog_helper_write(pcm_storeset_t *set, m_log_dsc_t *log_dsc, uintptr_t addr, pcm_word_t val, pcm_word_t mask);
+void tmlog_helper_write_range(pcm_storeset_t *set, m_log_dsc_t *log_dsc, uintptr_t addr, const void *buf, size_t nwords);
+void tmlog_helper_write_line(pcm_storeset_t *set, m_log_dsc_t *log_dsc, uintptr_t line, unsigned int bitmap, const pcm_word_t *vals);
+void tmlog_helper_commit(pcm_storeset_t *set, m_log_dsc_t *log_dsc, uint64_t sqn);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TMLOG_HELPERS_H */
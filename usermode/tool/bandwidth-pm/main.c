@@ -0,0 +1,658 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/**
+ * \file
+ *
+ * Persistent-memory write path characterization.
+ *
+ * Sweeps thread count, store type, access pattern and memory node, and 
+ * reports the aggregate write-back bandwidth together with histograms of 
+ * the flush and fence latencies sampled along the way. It ends with the 
+ * mnemosyne.ini settings the measurements favor.
+ */
+
+#include <immintrin.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sched.h>
+#include <errno.h>
+#include <time.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <cpuid.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "ut_barrier.h"
+
+
+#define CACHELINE_SIZE   64
+
+/* Latency of every SAMPLE_PERIOD-th cacheline is recorded. */
+#define SAMPLE_PERIOD    16
+
+/* Log2 latency buckets in ns: [0,1), [1,2), [2,4), ... */
+#define HIST_BUCKETS     24
+
+#define MAX_THREADS      256
+
+#define MPOL_BIND        2
+
+typedef uint64_t hrtime_t;
+
+typedef enum {
+	STORE_CLFLUSH = 0,
+	STORE_CLFLUSHOPT,
+	STORE_CLWB,
+	STORE_MOVNTI,
+	STORE_AVX2,
+	STORE_AVX512,
+	num_of_stores
+} store_t;
+
+typedef enum {
+	PATTERN_SEQ = 0,
+	PATTERN_RAND,
+	num_of_patterns
+} pattern_t;
+
+static const char *store_str[] = {"clflush", "clflushopt", "clwb", "movnti", "avx2", "avx512"};
+static const char *pattern_str[] = {"seq", "rand"};
+
+typedef struct {
+	uint64_t count[HIST_BUCKETS];
+} hist_t;
+
+typedef struct {
+	int       tid;
+	store_t   store;
+	pattern_t pattern;
+	int       node;
+	char      *buf;
+	uint64_t  bytes;
+	hrtime_t  cycles;
+	hist_t    flush;
+	hist_t    fence;
+} worker_t;
+
+ut_barrier_t global_barrier;
+char         *prog_name = "bandwidth-pm";
+uint64_t     tsc_mhz;
+size_t       buf_size = 64*1024*1024;
+int          batch = 1;
+int          npasses = 4;
+int          ncpus;
+int          verbose = 0;
+int          store_supported[num_of_stores];
+
+/* Best single-thread sequential bandwidth per store type, in MB/s */
+double       best_mbs[num_of_stores];
+
+static const char __whitespaces[] = "                                                                                                                                    ";
+#define WHITESPACE(len) &__whitespaces[sizeof(__whitespaces) - (len) -1]
+
+
+static inline hrtime_t asm_rdtsc(void)
+{
+	unsigned hi, lo;
+	__asm__ __volatile__ ("rdtsc" : "=a"(lo), "=d"(hi));
+	return ((hrtime_t) lo) | (((hrtime_t) hi) << 32);
+}
+
+static inline hrtime_t asm_rdtscp(void)
+{
+	unsigned hi, lo;
+	__asm__ __volatile__ ("rdtscp" : "=a"(lo), "=d"(hi)::"rcx");
+	return ((hrtime_t) lo) | (((hrtime_t) hi) << 32);
+}
+
+static inline void asm_sfence(void)
+{
+	__asm__ __volatile__ ("sfence" ::: "memory");
+}
+
+static inline void asm_clflush(void *addr)
+{
+	__asm__ __volatile__ ("clflush %0" : "+m"(*(volatile char *) addr));
+}
+
+static inline void asm_clflushopt(void *addr)
+{
+	__asm__ __volatile__ (".byte 0x66; clflush %0" : "+m"(*(volatile char *) addr));
+}
+
+static inline void asm_clwb(void *addr)
+{
+	__asm__ __volatile__ (".byte 0x66; xsaveopt %0" : "+m"(*(volatile char *) addr));
+}
+
+static inline void write_block64_cached(uint64_t *addr, uint64_t val)
+{
+	int i;
+
+	for (i=0; i<8; i++) {
+		((volatile uint64_t *) addr)[i] = val;
+	}
+}
+
+static inline void write_block64_movnti(uint64_t *addr, uint64_t val)
+{
+	int i;
+
+	for (i=0; i<8; i++) {
+		__asm__ __volatile__ ("movnti %1, %0" : "=m"(addr[i]): "r" (val));
+	}
+}
+
+__attribute__ ((target ("avx2")))
+static void write_block64_avx2(uint64_t *addr, uint64_t val)
+{
+	__m256i v = _mm256_set1_epi64x((long long) val);
+
+	_mm256_stream_si256((__m256i *) addr, v);
+	_mm256_stream_si256((__m256i *) addr + 1, v);
+}
+
+__attribute__ ((target ("avx512f")))
+static void write_block64_avx512(uint64_t *addr, uint64_t val)
+{
+	_mm512_stream_si512((void *) addr, _mm512_set1_epi64((long long) val));
+}
+
+
+#define CYCLE2NS(__cycles) ((__cycles) * 1000 / tsc_mhz)
+
+static uint64_t tsc_calibrate_mhz(void)
+{
+	struct timespec ts0, ts1;
+	hrtime_t        c0, c1;
+	uint64_t        ns;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts0);
+	c0 = asm_rdtsc();
+	do {
+		clock_gettime(CLOCK_MONOTONIC_RAW, &ts1);
+		ns = (ts1.tv_sec - ts0.tv_sec) * 1000000000ULL + ts1.tv_nsec - ts0.tv_nsec;
+	} while (ns < 50*1000*1000);
+	c1 = asm_rdtsc();
+
+	return (c1 - c0) * 1000 / ns;
+}
+
+
+static void detect_stores(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	store_supported[STORE_CLFLUSH] = 1;
+	store_supported[STORE_MOVNTI] = 1;
+	if (__get_cpuid_max(0, NULL) >= 7) {
+		__cpuid_count(7, 0, eax, ebx, ecx, edx);
+		store_supported[STORE_CLFLUSHOPT] = (ebx >> 23) & 1;
+		store_supported[STORE_CLWB] = (ebx >> 24) & 1;
+		store_supported[STORE_AVX2] = (ebx >> 5) & 1;
+		store_supported[STORE_AVX512] = (ebx >> 16) & 1;
+	}
+}
+
+
+static inline void hist_add(hist_t *hist, hrtime_t cycles)
+{
+	uint64_t ns = CYCLE2NS(cycles);
+	int      b = ns ? 64 - __builtin_clzll(ns) : 0;
+
+	hist->count[b < HIST_BUCKETS ? b : HIST_BUCKETS-1]++;
+}
+
+
+static void hist_merge(hist_t *dst, hist_t *src)
+{
+	int i;
+
+	for (i=0; i<HIST_BUCKETS; i++) {
+		dst->count[i] += src->count[i];
+	}
+}
+
+
+/* Upper bound of the bucket holding the given percentile, in ns. */
+static uint64_t hist_percentile(hist_t *hist, double p)
+{
+	uint64_t total = 0;
+	uint64_t seen = 0;
+	int      i;
+
+	for (i=0; i<HIST_BUCKETS; i++) {
+		total += hist->count[i];
+	}
+	for (i=0; i<HIST_BUCKETS; i++) {
+		seen += hist->count[i];
+		if (total && seen >= total * p) {
+			return 1ULL << i;
+		}
+	}
+	return 0;
+}
+
+
+static void hist_print(const char *name, hist_t *hist)
+{
+	int i;
+
+	printf("    %s latency: p50 < %llu ns, p99 < %llu ns\n", name, 
+	       (unsigned long long) hist_percentile(hist, 0.5),
+	       (unsigned long long) hist_percentile(hist, 0.99));
+	if (!verbose) {
+		return;
+	}
+	for (i=0; i<HIST_BUCKETS; i++) {
+		if (hist->count[i]) {
+			printf("      [%llu, %llu) ns: %llu\n", 
+			       (unsigned long long) (i ? 1ULL << (i-1) : 0), 
+			       (unsigned long long) (1ULL << i),
+			       (unsigned long long) hist->count[i]);
+		}
+	}
+}
+
+
+static void bind_cpu(int cpu)
+{
+	cpu_set_t mask;
+
+	CPU_ZERO(&mask);
+	CPU_SET(cpu, &mask);
+	if (sched_setaffinity(0, sizeof(mask), &mask) == -1) {
+		fprintf(stderr, "WARNING: Could not bind on CPU %d, continuing...\n", cpu);
+	}
+}
+
+
+static char *alloc_buffer(size_t size, int node)
+{
+	unsigned long nodemask;
+	char          *buf;
+
+	buf = mmap(NULL, size, PROT_READ | PROT_WRITE, 
+	           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (buf == MAP_FAILED) {
+		return NULL;
+	}
+	if (node >= 0) {
+		nodemask = 1UL << node;
+		if (syscall(SYS_mbind, buf, size, MPOL_BIND, &nodemask, 
+		            sizeof(nodemask) * 8, 0) != 0) 
+		{
+			fprintf(stderr, "WARNING: Could not bind memory on node %d: %s\n", 
+			        node, strerror(errno));
+		}
+	}
+	/* First touch, so page faults stay out of the measurements */
+	memset(buf, 0, size);
+	return buf;
+}
+
+
+/* 
+ * Writes one cacheline and writes it back, fencing when asked to. Records 
+ * the flush and fence latencies in the worker's histograms when sampling.
+ */
+static inline void write_line(store_t store, char *line, uint64_t val, 
+                              int fence, int sample, worker_t *w)
+{
+	hrtime_t t0, t1, t2;
+
+	switch (store) {
+		case STORE_MOVNTI:
+			write_block64_movnti((uint64_t *) line, val);
+			break;
+		case STORE_AVX2:
+			write_block64_avx2((uint64_t *) line, val);
+			break;
+		case STORE_AVX512:
+			write_block64_avx512((uint64_t *) line, val);
+			break;
+		default:
+			write_block64_cached((uint64_t *) line, val);
+	}
+	t0 = sample ? asm_rdtscp() : 0;
+	switch (store) {
+		case STORE_CLFLUSH:
+			asm_clflush(line);
+			break;
+		case STORE_CLFLUSHOPT:
+			asm_clflushopt(line);
+			break;
+		case STORE_CLWB:
+			asm_clwb(line);
+			break;
+		default:
+			break;
+	}
+	t1 = sample ? asm_rdtscp() : 0;
+	if (fence) {
+		asm_sfence();
+	}
+	if (sample) {
+		t2 = asm_rdtscp();
+		if (store < STORE_MOVNTI) {
+			hist_add(&w->flush, t1 - t0);
+		}
+		if (fence) {
+			hist_add(&w->fence, t2 - t1);
+		}
+	}
+}
+
+
+static void *worker(void *arg)
+{
+	worker_t     *w = (worker_t *) arg;
+	uint64_t     nlines = buf_size / CACHELINE_SIZE;
+	uint64_t     i;
+	uint64_t     idx;
+	uint64_t     stride;
+	hrtime_t     start;
+	int          pass;
+
+	bind_cpu(w->tid % ncpus);
+	if (!w->buf) {
+		w->buf = alloc_buffer(buf_size, w->node);
+	}
+	/* An odd stride visits every line of the power-of-two buffer once */
+	stride = (w->pattern == PATTERN_RAND) ? (nlines / 2 + 0x9e3779b1ULL) | 1 : 1;
+
+	ut_barrier_wait(&global_barrier);
+	start = asm_rdtsc();
+	for (pass=0; pass<npasses; pass++) {
+		for (i=0, idx=0; i<nlines; i++, idx=(idx + stride) & (nlines - 1)) {
+			write_line(w->store, &w->buf[idx * CACHELINE_SIZE], i + pass, 
+			           (i % batch) == batch - 1, (i % SAMPLE_PERIOD) == 0, w);
+		}
+	}
+	asm_sfence();
+	w->cycles = asm_rdtsc() - start;
+	w->bytes = (uint64_t) npasses * nlines * CACHELINE_SIZE;
+	ut_barrier_wait(&global_barrier);
+	return NULL;
+}
+
+
+static void run(worker_t *workers, int nthreads, store_t store, 
+                pattern_t pattern, int node)
+{
+	pthread_t threads[MAX_THREADS];
+	hist_t    flush;
+	hist_t    fence;
+	hrtime_t  max_cycles = 0;
+	uint64_t  bytes = 0;
+	double    mbs;
+	int       i;
+
+	memset(&flush, 0, sizeof(flush));
+	memset(&fence, 0, sizeof(fence));
+	ut_barrier_init(&global_barrier, nthreads);
+	for (i=0; i<nthreads; i++) {
+		workers[i].tid = i;
+		workers[i].store = store;
+		workers[i].pattern = pattern;
+		workers[i].node = node;
+		memset(&workers[i].flush, 0, sizeof(hist_t));
+		memset(&workers[i].fence, 0, sizeof(hist_t));
+		pthread_create(&threads[i], NULL, worker, &workers[i]);
+	}
+	for (i=0; i<nthreads; i++) {
+		pthread_join(threads[i], NULL);
+		bytes += workers[i].bytes;
+		if (workers[i].cycles > max_cycles) {
+			max_cycles = workers[i].cycles;
+		}
+		hist_merge(&flush, &workers[i].flush);
+		hist_merge(&fence, &workers[i].fence);
+	}
+	mbs = (double) bytes / (1024*1024) / ((double) CYCLE2NS(max_cycles) / 1e9);
+	printf("store = %s, pattern = %s, threads = %d, node = %d: %.1lf MB/s\n",
+	       store_str[store], pattern_str[pattern], nthreads, node, mbs);
+	if (store < STORE_MOVNTI) {
+		hist_print("flush", &flush);
+	}
+	hist_print("fence", &fence);
+	fflush(stdout);
+
+	if (nthreads == 1 && pattern == PATTERN_SEQ && mbs > best_mbs[store]) {
+		best_mbs[store] = mbs;
+	}
+}
+
+
+static void recommend(void)
+{
+	store_t flush = STORE_CLFLUSH;
+	store_t stream = STORE_MOVNTI;
+	store_t s;
+
+	for (s=STORE_CLFLUSH; s<=STORE_CLWB; s++) {
+		if (best_mbs[s] > best_mbs[flush]) {
+			flush = s;
+		}
+	}
+	printf("\nRecommended mnemosyne.ini settings:\n");
+	if (best_mbs[flush] > 0) {
+		printf("  flush_backend = \"%s\";\n", store_str[flush]);
+	}
+	for (s=STORE_MOVNTI; s<=STORE_AVX512; s++) {
+		if (best_mbs[s] > best_mbs[stream]) {
+			stream = s;
+		}
+	}
+	if (best_mbs[stream] > 0) {
+		printf("  log_stream_store = \"%s\";\n", store_str[stream]);
+	}
+}
+
+
+/* Parses a comma-separated list of names into a bitmask. */
+static int parse_names(char *arg, const char *names[], int n)
+{
+	char *tok;
+	int   mask = 0;
+	int   i;
+
+	for (tok = strtok(arg, ","); tok; tok = strtok(NULL, ",")) {
+		if (strcmp(tok, "all") == 0) {
+			return (1 << n) - 1;
+		}
+		for (i=0; i<n; i++) {
+			if (strcmp(tok, names[i]) == 0) {
+				break;
+			}
+		}
+		if (i == n) {
+			return -1;
+		}
+		mask |= 1 << i;
+	}
+	return mask;
+}
+
+
+static int parse_ints(char *arg, int *list, int max)
+{
+	char *tok;
+	int   n = 0;
+
+	for (tok = strtok(arg, ","); tok && n < max; tok = strtok(NULL, ",")) {
+		list[n++] = atoi(tok);
+	}
+	return n;
+}
+
+
+static
+void usage(FILE *fout, char *name) 
+{
+	fprintf(fout, "usage:");
+	fprintf(fout, "       %s   %s\n", WHITESPACE(strlen(name)), "--threads=N[,N...]");
+	fprintf(fout, "       %s   %s\n", WHITESPACE(strlen(name)), "--store=STORE[,STORE...]");
+	fprintf(fout, "       %s   %s\n", WHITESPACE(strlen(name)), "--pattern=PATTERN[,PATTERN...]");
+	fprintf(fout, "       %s   %s\n", WHITESPACE(strlen(name)), "--node=NODE[,NODE...] (-1: local)");
+	fprintf(fout, "       %s   %s\n", WHITESPACE(strlen(name)), "--size=BUFFER_SIZE_PER_THREAD (MB, power of 2)");
+	fprintf(fout, "       %s   %s\n", WHITESPACE(strlen(name)), "--batch=CACHELINES_PER_FENCE");
+	fprintf(fout, "       %s   %s\n", WHITESPACE(strlen(name)), "--passes=NUMBER_OF_PASSES");
+	fprintf(fout, "       %s   %s\n", WHITESPACE(strlen(name)), "--verbose");
+	fprintf(fout, "\nValid arguments:\n");
+	fprintf(fout, "  --store    [clflush, clflushopt, clwb, movnti, avx2, avx512, all]\n");
+	fprintf(fout, "  --pattern  [seq, rand, all]\n");
+	exit(1);
+}
+
+
+int main(int argc, char *argv[])
+{
+	worker_t  *workers;
+	int       threads_list[64] = {1};
+	int       nthreads_list = 1;
+	int       node_list[64] = {-1};
+	int       nnodes = 1;
+	int       stores = -1;
+	int       patterns = 1 << PATTERN_SEQ;
+	int       max_threads;
+	int       i, t, n;
+	store_t   s;
+	pattern_t p;
+	int       c;
+
+	while (1) {
+		static struct option long_options[] = {
+			{"threads", required_argument, 0, 't'},
+			{"store", required_argument, 0, 's'},
+			{"pattern", required_argument, 0, 'p'},
+			{"node", required_argument, 0, 'n'},
+			{"size", required_argument, 0, 'z'},
+			{"batch", required_argument, 0, 'b'},
+			{"passes", required_argument, 0, 'o'},
+			{"verbose", no_argument, 0, 'v'},
+			{0, 0, 0, 0}
+		};
+		int option_index = 0;
+     
+		c = getopt_long (argc, argv, "t:s:p:n:z:b:o:v",
+		                 long_options, &option_index);
+		if (c == -1)
+			break;
+     
+		switch (c) {
+			case 't':
+				nthreads_list = parse_ints(optarg, threads_list, 64);
+				break;
+			case 's':
+				if ((stores = parse_names(optarg, store_str, num_of_stores)) < 0) {
+					usage(stderr, prog_name);
+				}
+				break;
+			case 'p':
+				if ((patterns = parse_names(optarg, pattern_str, num_of_patterns)) < 0) {
+					usage(stderr, prog_name);
+				}
+				break;
+			case 'n':
+				nnodes = parse_ints(optarg, node_list, 64);
+				break;
+			case 'z':
+				buf_size = (size_t) atoi(optarg) * 1024 * 1024;
+				break;
+			case 'b':
+				batch = atoi(optarg);
+				break;
+			case 'o':
+				npasses = atoi(optarg);
+				break;
+			case 'v':
+				verbose = 1;
+				break;
+			default:
+				usage(stderr, prog_name);
+		}
+	}
+	if (buf_size == 0 || (buf_size & (buf_size - 1)) || batch < 1 || npasses < 1) {
+		usage(stderr, prog_name);
+	}
+
+	ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	tsc_mhz = tsc_calibrate_mhz();
+	detect_stores();
+	printf("TSC: %llu MHz, buffer: %zu MB per thread, batch: %d, passes: %d\n",
+	       (unsigned long long) tsc_mhz, buf_size >> 20, batch, npasses);
+
+	max_threads = 0;
+	for (t=0; t<nthreads_list; t++) {
+		if (threads_list[t] < 1 || threads_list[t] > MAX_THREADS) {
+			usage(stderr, prog_name);
+		}
+		if (threads_list[t] > max_threads) {
+			max_threads = threads_list[t];
+		}
+	}
+	workers = calloc(max_threads, sizeof(worker_t));
+
+	for (n=0; n<nnodes; n++) {
+		/* Buffers are reused across runs bound to the same node */
+		for (i=0; i<max_threads; i++) {
+			if (workers[i].buf) {
+				munmap(workers[i].buf, buf_size);
+				workers[i].buf = NULL;
+			}
+		}
+		for (s=0; s<num_of_stores; s++) {
+			if (!(stores & (1 << s))) {
+				continue;
+			}
+			if (!store_supported[s]) {
+				printf("store = %s: not supported by this CPU, skipped\n", store_str[s]);
+				continue;
+			}
+			for (p=0; p<num_of_patterns; p++) {
+				if (!(patterns & (1 << p))) {
+					continue;
+				}
+				for (t=0; t<nthreads_list; t++) {
+					run(workers, threads_list[t], s, p, node_list[n]);
+				}
+			}
+		}
+	}
+	recommend();
+	return 0;
+}
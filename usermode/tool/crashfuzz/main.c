@@ -0,0 +1,320 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/**
+ * \file
+ *
+ * Crash-consistency fuzzer.
+ *
+ * Repeatedly restores the persistent segments from a golden copy, runs a 
+ * workload that mcore crashes at a random persist barrier (crash_point), 
+ * and runs a checker on what is left. Recovery happens when the checker 
+ * attaches to the segments; the checker then verifies the workload's 
+ * invariants and exits nonzero if any is broken.
+ *
+ * Example:
+ *
+ *   crashfuzz --segments=/dev/shm/psegments --golden=/dev/shm/golden \
+ *             --setup="./rbench --init" --run="./rbench" \
+ *             --check="./rbench --check" --iterations=5000
+ *
+ * Restoring from the golden copy is a file copy inside the kernel, which on 
+ * tmpfs is much cheaper than having the workload create and format its 
+ * segments on every iteration.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+
+/* Must match PCM_CRASH_EXIT_STATUS in mcore/include/hal/pcm_i.h */
+#define CRASH_EXIT_STATUS 86
+
+char     *prog_name = "crashfuzz";
+char     *segments_dir = "/dev/shm/psegments";
+char     *golden_dir = NULL;
+char     *failures_dir = NULL;
+char     *setup_cmd = NULL;
+char     *run_cmd = NULL;
+char     *check_cmd = NULL;
+int      iterations = 1000;
+int      max_point = 100000;
+unsigned seed;
+
+static const char __whitespaces[] = "                                                                                                                                    ";
+#define WHITESPACE(len) &__whitespaces[sizeof(__whitespaces) - (len) -1]
+
+
+static int copy_file(const char *src, const char *dst)
+{
+	struct stat st;
+	ssize_t     n;
+	int         sfd;
+	int         dfd;
+	char        buf[65536];
+
+	if ((sfd = open(src, O_RDONLY)) < 0) {
+		return -1;
+	}
+	if (fstat(sfd, &st) != 0 || 
+	    (dfd = open(dst, O_WRONLY | O_CREAT | O_TRUNC, st.st_mode & 0777)) < 0) 
+	{
+		close(sfd);
+		return -1;
+	}
+	while ((n = copy_file_range(sfd, NULL, dfd, NULL, 1 << 30, 0)) > 0);
+	if (n < 0) {
+		/* Not supported between these file systems */
+		lseek(sfd, 0, SEEK_SET);
+		lseek(dfd, 0, SEEK_SET);
+		while ((n = read(sfd, buf, sizeof(buf))) > 0) {
+			if (write(dfd, buf, n) != n) {
+				n = -1;
+				break;
+			}
+		}
+	}
+	close(sfd);
+	close(dfd);
+	return n < 0 ? -1 : 0;
+}
+
+
+/* Makes dst hold exactly the regular files of src. */
+static int copy_dir(const char *src, const char *dst)
+{
+	DIR           *dir;
+	struct dirent *de;
+	char          spath[4096];
+	char          dpath[4096];
+	int           rv = 0;
+
+	mkdir(dst, 0755);
+	if ((dir = opendir(dst)) == NULL) {
+		return -1;
+	}
+	while ((de = readdir(dir)) != NULL) {
+		if (de->d_name[0] == '.') {
+			continue;
+		}
+		snprintf(dpath, sizeof(dpath), "%s/%s", dst, de->d_name);
+		unlink(dpath);
+	}
+	closedir(dir);
+
+	if ((dir = opendir(src)) == NULL) {
+		return -1;
+	}
+	while ((de = readdir(dir)) != NULL) {
+		if (de->d_name[0] == '.') {
+			continue;
+		}
+		snprintf(spath, sizeof(spath), "%s/%s", src, de->d_name);
+		snprintf(dpath, sizeof(dpath), "%s/%s", dst, de->d_name);
+		if (copy_file(spath, dpath) != 0) {
+			fprintf(stderr, "%s: cannot copy %s to %s: %s\n", 
+			        prog_name, spath, dpath, strerror(errno));
+			rv = -1;
+			break;
+		}
+	}
+	closedir(dir);
+	return rv;
+}
+
+
+/* Runs cmd through the shell with MCORE_CRASH_POINT set; returns its wait status. */
+static int run(const char *cmd, int crash_point, int reset_segments)
+{
+	char  point[32];
+	pid_t pid;
+	int   status;
+
+	if ((pid = fork()) == 0) {
+		snprintf(point, sizeof(point), "%d", crash_point);
+		setenv("MCORE_CRASH_POINT", point, 1);
+		setenv("MCORE_SEGMENTS_DIR", segments_dir, 1);
+		setenv("MCORE_RESET_SEGMENTS", reset_segments ? "1" : "0", 1);
+		execl("/bin/sh", "sh", "-c", cmd, (char *) NULL);
+		_exit(127);
+	}
+	if (pid < 0 || waitpid(pid, &status, 0) < 0) {
+		return -1;
+	}
+	return status;
+}
+
+
+static
+void usage(FILE *fout, char *name) 
+{
+	fprintf(fout, "usage:");
+	fprintf(fout, "       %s   %s\n", WHITESPACE(strlen(name)), "--run=WORKLOAD_COMMAND");
+	fprintf(fout, "       %s   %s\n", WHITESPACE(strlen(name)), "--check=CHECKER_COMMAND");
+	fprintf(fout, "       %s   %s\n", WHITESPACE(strlen(name)), "--golden=GOLDEN_SEGMENTS_DIR");
+	fprintf(fout, "       %s   %s\n", WHITESPACE(strlen(name)), "--setup=SETUP_COMMAND (creates the golden segments)");
+	fprintf(fout, "       %s   %s\n", WHITESPACE(strlen(name)), "--segments=SEGMENTS_DIR");
+	fprintf(fout, "       %s   %s\n", WHITESPACE(strlen(name)), "--failures=DIR_TO_KEEP_FAILING_CRASH_STATES");
+	fprintf(fout, "       %s   %s\n", WHITESPACE(strlen(name)), "--iterations=NUMBER_OF_ITERATIONS");
+	fprintf(fout, "       %s   %s\n", WHITESPACE(strlen(name)), "--max-point=LARGEST_CRASH_POINT");
+	fprintf(fout, "       %s   %s\n", WHITESPACE(strlen(name)), "--seed=RANDOM_SEED");
+	exit(1);
+}
+
+
+int main(int argc, char *argv[])
+{
+	struct timespec ts0, ts1;
+	struct stat     st;
+	char            path[4096];
+	char            kept[4096];
+	double          secs;
+	int             crashed = 0;
+	int             completed = 0;
+	int             failed = 0;
+	int             point;
+	int             status;
+	int             i;
+	int             c;
+
+	seed = (unsigned) time(NULL) ^ getpid();
+	while (1) {
+		static struct option long_options[] = {
+			{"run", required_argument, 0, 'r'},
+			{"check", required_argument, 0, 'c'},
+			{"golden", required_argument, 0, 'g'},
+			{"setup", required_argument, 0, 'u'},
+			{"segments", required_argument, 0, 's'},
+			{"failures", required_argument, 0, 'f'},
+			{"iterations", required_argument, 0, 'i'},
+			{"max-point", required_argument, 0, 'm'},
+			{"seed", required_argument, 0, 'e'},
+			{0, 0, 0, 0}
+		};
+		int option_index = 0;
+
+		c = getopt_long (argc, argv, "r:c:g:u:s:f:i:m:e:",
+		                 long_options, &option_index);
+		if (c == -1)
+			break;
+
+		switch (c) {
+			case 'r': run_cmd = optarg; break;
+			case 'c': check_cmd = optarg; break;
+			case 'g': golden_dir = optarg; break;
+			case 'u': setup_cmd = optarg; break;
+			case 's': segments_dir = optarg; break;
+			case 'f': failures_dir = optarg; break;
+			case 'i': iterations = atoi(optarg); break;
+			case 'm': max_point = atoi(optarg); break;
+			case 'e': seed = strtoul(optarg, NULL, 0); break;
+			default: usage(stderr, prog_name);
+		}
+	}
+	if (!run_cmd || !check_cmd || !golden_dir || max_point < 1) {
+		usage(stderr, prog_name);
+	}
+	printf("seed = %u\n", seed);
+	srand(seed);
+
+	if (setup_cmd || stat(golden_dir, &st) != 0) {
+		if (!setup_cmd) {
+			fprintf(stderr, "%s: no golden segments in %s and no --setup\n", 
+			        prog_name, golden_dir);
+			return 1;
+		}
+		status = run(setup_cmd, 0, 1);
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			fprintf(stderr, "%s: setup failed\n", prog_name);
+			return 1;
+		}
+		if (copy_dir(segments_dir, golden_dir) != 0) {
+			return 1;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &ts0);
+	for (i=0; i<iterations; i++) {
+		if (copy_dir(golden_dir, segments_dir) != 0) {
+			return 1;
+		}
+		point = 1 + rand() % max_point;
+		status = run(run_cmd, point, 0);
+		if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+			/* The workload has fewer barriers than that: aim lower */
+			completed++;
+			max_point = point > 1 ? point - 1 : 1;
+			continue;
+		}
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != CRASH_EXIT_STATUS) {
+			printf("iteration %d: crash point %d: workload failed (status 0x%x)\n", 
+			       i, point, status);
+			failed++;
+			continue;
+		}
+		crashed++;
+		if (failures_dir) {
+			snprintf(path, sizeof(path), "%s/crash", failures_dir);
+			mkdir(failures_dir, 0755);
+			copy_dir(segments_dir, path);
+		}
+		status = run(check_cmd, 0, 0);
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			printf("iteration %d: crash point %d: check failed (status 0x%x)\n", 
+			       i, point, status);
+			failed++;
+			if (failures_dir) {
+				snprintf(path, sizeof(path), "%s/crash", failures_dir);
+				snprintf(kept, sizeof(kept), "%s/%d-%d", failures_dir, i, point);
+				rename(path, kept);
+			}
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &ts1);
+	secs = (ts1.tv_sec - ts0.tv_sec) + (ts1.tv_nsec - ts0.tv_nsec) / 1e9;
+
+	printf("iterations = %d, crashed = %d, completed = %d, failed = %d, "
+	       "max crash point = %d, %.0lf iterations/min\n", 
+	       iterations, crashed, completed, failed, max_point, 
+	       secs > 0 ? iterations * 60 / secs : 0);
+	return failed ? 2 : 0;
+}
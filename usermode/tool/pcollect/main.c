@@ -0,0 +1,102 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/**
+ * \file
+ *
+ * \brief Finds the objects of the persistent heap that nothing points to 
+ * and frees them.
+ *
+ * Run it against the segments_dir of an application that is not running:
+ * it reincarnates the application's persistent segments, which must not be
+ * mapped by another process, recovers the transaction logs and has 
+ * pmalloc_collect mark the heap from the persistent segments outside it.
+ * An application that keeps pointers to persistent objects only in 
+ * volatile memory must collect itself, at startup, after registering 
+ * that memory with pmalloc_collect_root.
+ *
+ * Usage: pcollect [-n threads] [-d] [-l]
+ *   -n  threads to mark the heap with (default 1)
+ *   -d  dry run: report the unreachable objects without freeing them
+ *   -l  run at the lowest CPU priority
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <mnemosyne.h>
+#include <mtm.h>
+#include <pmalloc.h>
+
+
+int
+main(int argc, char **argv)
+{
+	int    nthreads = 1;
+	int    dry_run = 0;
+	int    c;
+	long   nobjects;
+	size_t bytes;
+
+	while ((c = getopt(argc, argv, "n:dl")) != -1) {
+		switch (c) {
+			case 'n':
+				nthreads = atoi(optarg);
+				break;
+			case 'd':
+				dry_run = 1;
+				break;
+			case 'l':
+				setpriority(PRIO_PROCESS, 0, 19);
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-n threads] [-d] [-l]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	mnemosyne_init_global();
+	/* Recover the logs, which the first transaction descriptor does, and 
+	 * write the recovered stores back */
+	mtm_tx_destroy(mtm_tx_create());
+	mtm_sync();
+
+	if ((nobjects = pmalloc_collect(nthreads, dry_run, &bytes)) < 0) {
+		fprintf(stderr, "Heap collection failed\n");
+		return 1;
+	}
+	printf("%s %ld unreachable objects, %zu KB\n", dry_run ? "Found" : "Freed", 
+	       nobjects, bytes / 1024);
+
+	return 0;
+}
@@ -31,42 +31,31 @@
 */
 
 /**
- * \file chhash.h
+ * \file
  *
- * \brief Simple bucket hash table interface.
+ * \brief Gives the space under the free extents of the persistent heap 
+ * back to the file system.
+ *
+ * Run it against the segments_dir of an application that is not running: 
+ * it reincarnates the application's persistent segments, which must not 
+ * be mapped by another process, and punches holes in their backing stores 
+ * under the free extents of the heap. A running application does the same 
+ * with pmalloc_discard_free() or the pmalloc.discard_interval_s setting.
  */
 
-#ifndef _M_HASH_H
-#define _M_HASH_H
-
-#include "mtypes.h"
-#include "result.h"
-
-#define HASH_FACTOR 4
-
-/* Opaque structure used to represent hash table. */
-typedef struct m_chhash_s m_chhash_t;
-
-/* Opaque structure used to represent hash table iterator. */
-typedef struct m_chhash_iter_s m_chhash_iter_t;
+#include <stdio.h>
+#include <mnemosyne.h>
+#include <pmalloc.h>
 
-typedef uintptr_t m_chhash_key_t;
-typedef void *m_chhash_value_t;
-typedef struct m_chhash_bucket_s m_chhash_bucket_t;
 
-struct m_chhash_iter_s {
-	m_chhash_t        *chhash;
-	unsigned int      index;
-	m_chhash_bucket_t *bucket;
-};
+int
+main(int argc, char **argv)
+{
+	size_t discarded;
 
+	mnemosyne_init_global();
+	discarded = pmalloc_discard_free();
+	printf("Discarded %zu KB\n", discarded / 1024);
 
-m_result_t m_chhash_create(m_chhash_t**, unsigned int, bool);
-m_result_t m_chhash_destroy(m_chhash_t**);
-m_result_t m_chhash_add(m_chhash_t*, m_chhash_key_t, m_chhash_value_t);
-m_result_t m_chhash_lookup(m_chhash_t*, m_chhash_key_t, m_chhash_value_t *);
-m_result_t m_chhash_remove(m_chhash_t*, m_chhash_key_t, m_chhash_value_t *);
-void m_chhash_iter_init(m_chhash_t *chhash, m_chhash_iter_t *iter);
-m_result_t m_chhash_iter_next(m_chhash_iter_t *iter, m_chhash_key_t *key, m_chhash_value_t *value);
-void m_chhash_print(m_chhash_t *);
-#endif
+	return 0;
+}
@@ -0,0 +1,215 @@
+/*
+    Copyright (C) 2011 Computer Sciences Department, 
+    University of Wisconsin -- Madison
+
+    ----------------------------------------------------------------------
+
+    This file is part of Mnemosyne: Lightweight Persistent Memory, 
+    originally developed at the University of Wisconsin -- Madison.
+
+    Mnemosyne was originally developed primarily by Haris Volos
+    with contributions from Andres Jaan Tack.
+
+    ----------------------------------------------------------------------
+
+    Mnemosyne is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, version 2
+    of the License.
+ 
+    Mnemosyne is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, 
+    Boston, MA  02110-1301, USA.
+
+### END HEADER ###
+*/
+
+/**
+ * \file
+ *
+ * Decoder of the binary PM access trace (library/common/pm_btrace.h).
+ *
+ * Merges the per-thread rings of a trace file by timestamp and prints 
+ * one line per record in the format of the text tracer, minus the 
+ * location:
+ *
+ *   tid:ns:marker:addr:size
+ *
+ * where ns counts from the start of tracing. --stats instead prints how 
+ * many records of each marker every thread left, and how many were lost 
+ * to ring overflow.
+ *
+ * Example:
+ *
+ *   pmtrace --file=/tmp/pmtrace --stats
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <pm_btrace.h>
+
+
+char *prog_name = "pmtrace";
+char *trace_file = "/tmp/pmtrace";
+int  print_stats = 0;
+
+static const char *marker_name[PM_BT_NTYPES] = {
+	"?", "PM_W", "PM_DW", "PM_DI", "PM_R", "PM_I", "PM_L", "PM_O", 
+	"PM_XS", "PM_N", "PM_C", "PM_B", "PM_XE"
+};
+
+static const char __whitespaces[] = "                                                                                                                                    ";
+#define WHITESPACE(len) &__whitespaces[sizeof(__whitespaces) - (len) -1]
+
+
+typedef struct {
+	pm_btrace_slot_t   *slot;
+	pm_btrace_record_t *records;
+	uint64_t            next;   /* next record to print */
+	uint64_t            end;
+} ring_t;
+
+
+static
+void usage(FILE *fout, char *name) 
+{
+	fprintf(fout, "usage:");
+	fprintf(fout, "       %s   %s\n", WHITESPACE(strlen(name)), "--file=TRACE_FILE");
+	fprintf(fout, "       %s   %s\n", WHITESPACE(strlen(name)), "--stats (per thread counts instead of the records)");
+	exit(1);
+}
+
+
+static
+void print_record(ring_t *ring, pm_btrace_header_t *hdr, uint64_t mask)
+{
+	pm_btrace_record_t *r = &ring->records[ring->next & mask];
+	uint64_t            ns;
+
+	ns = hdr->tsc_mhz ? (r->tsc - hdr->start_tsc) * 1000 / hdr->tsc_mhz : 0;
+	if (r->type < PM_BT_TX_START) {
+		printf("%u:%llu:%s:%p:%u\n", ring->slot->tid, (unsigned long long) ns, 
+		       marker_name[r->type < PM_BT_NTYPES ? r->type : 0], 
+		       (void *) r->addr, r->size);
+	} else {
+		printf("%u:%llu:%s\n", ring->slot->tid, (unsigned long long) ns, 
+		       marker_name[r->type < PM_BT_NTYPES ? r->type : 0]);
+	}
+}
+
+
+int main(int argc, char *argv[])
+{
+	pm_btrace_header_t *hdr;
+	ring_t             *rings;
+	ring_t             *min;
+	struct stat         st;
+	uint64_t            nrecords;
+	uint64_t            mask;
+	uint64_t            count[PM_BT_NTYPES];
+	uint32_t            nthreads;
+	uint32_t            i;
+	uint64_t            j;
+	int                 fd;
+	int                 c;
+
+	while (1) {
+		static struct option long_options[] = {
+			{"file", required_argument, 0, 'f'},
+			{"stats", no_argument, 0, 's'},
+			{0, 0, 0, 0}
+		};
+		int option_index = 0;
+
+		c = getopt_long (argc, argv, "f:s",
+		                 long_options, &option_index);
+		if (c == -1)
+			break;
+
+		switch (c) {
+			case 'f': trace_file = optarg; break;
+			case 's': print_stats = 1; break;
+			default: usage(stderr, prog_name);
+		}
+	}
+
+	if ((fd = open(trace_file, O_RDONLY)) < 0 || fstat(fd, &st) != 0) {
+		fprintf(stderr, "%s: cannot open %s\n", prog_name, trace_file);
+		return 1;
+	}
+	hdr = (pm_btrace_header_t *) mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (hdr == MAP_FAILED || st.st_size < PM_BTRACE_HEADER_SIZE ||
+	    hdr->magic != PM_BTRACE_MAGIC || hdr->version != PM_BTRACE_VERSION ||
+	    hdr->record_size != sizeof(pm_btrace_record_t) ||
+	    st.st_size < PM_BTRACE_HEADER_SIZE + hdr->max_threads * hdr->slot_size) 
+	{
+		fprintf(stderr, "%s: %s is not a trace file\n", prog_name, trace_file);
+		return 1;
+	}
+
+	nrecords = 1ULL << hdr->records_log2;
+	mask = nrecords - 1;
+	nthreads = hdr->nthreads < hdr->max_threads ? hdr->nthreads : hdr->max_threads;
+	rings = (ring_t *) calloc(nthreads ? nthreads : 1, sizeof(ring_t));
+	for (i=0; i<nthreads; i++) {
+		rings[i].slot = (pm_btrace_slot_t *) ((char *) hdr + 
+		                PM_BTRACE_HEADER_SIZE + i * hdr->slot_size);
+		rings[i].records = (pm_btrace_record_t *) (rings[i].slot + 1);
+		rings[i].end = rings[i].slot->head;
+		rings[i].next = rings[i].end > nrecords ? rings[i].end - nrecords : 0;
+	}
+
+	if (print_stats) {
+		printf("pid = %u, threads = %u, records per thread = %llu, tsc = %llu MHz\n",
+		       hdr->pid, nthreads, (unsigned long long) nrecords, 
+		       (unsigned long long) hdr->tsc_mhz);
+		for (i=0; i<nthreads; i++) {
+			memset(count, 0, sizeof(count));
+			for (j=rings[i].next; j<rings[i].end; j++) {
+				uint16_t type = rings[i].records[j & mask].type;
+				count[type < PM_BT_NTYPES ? type : 0]++;
+			}
+			printf("tid %u: records = %llu, lost = %llu", rings[i].slot->tid,
+			       (unsigned long long) rings[i].end, 
+			       (unsigned long long) rings[i].next);
+			for (c=1; c<PM_BT_NTYPES; c++) {
+				printf(", %s = %llu", marker_name[c], (unsigned long long) count[c]);
+			}
+			printf("\n");
+		}
+		return 0;
+	}
+
+	/* Merge the rings by timestamp; they are few, so a linear scan will do */
+	while (1) {
+		min = NULL;
+		for (i=0; i<nthreads; i++) {
+			if (rings[i].next < rings[i].end && 
+			    (!min || rings[i].records[rings[i].next & mask].tsc < 
+			             min->records[min->next & mask].tsc))
+			{
+				min = &rings[i];
+			}
+		}
+		if (!min) {
+			break;
+		}
+		print_record(min, hdr, mask);
+		min->next++;
+	}
+	return 0;
+}